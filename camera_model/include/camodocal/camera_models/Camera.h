@@ -80,6 +80,14 @@ public:
     virtual void spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p) const = 0;
     //%output p
 
+    // Batched liftProjective/spaceToPlane over n contiguous points, same results
+    // as the single-point calls. The default loops over them; the camera models
+    // override with kernels that load the parameters once per call
+    virtual void liftProjectiveBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, size_t n) const;
+    //%output P
+    virtual void spaceToPlaneBatch(const Eigen::Vector3d* P, Eigen::Vector2d* p, size_t n) const;
+    //%output p
+
     // Projects 3D points to the image plane (Pi function)
     // and calculates jacobian
     //virtual void spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
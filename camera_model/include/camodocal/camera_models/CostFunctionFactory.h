@@ -73,6 +73,14 @@ public:
                                               const Eigen::Vector2d& observed_p_left,
                                               const Eigen::Vector2d& observed_p_right) const;
 
+    // all corners of one image (intrinsics, rotation, translation), analytic jacobians,
+    // each corner robustified by a Cauchy loss of scale cauchyScale (0: none);
+    // 0 for models without analytic jacobians (Scaramuzza)
+    ceres::CostFunction* generateImageCostFunction(const CameraConstPtr& camera,
+                                                   const std::vector<cv::Point3f>& scenePoints,
+                                                   const std::vector<cv::Point2f>& imagePoints,
+                                                   double cauchyScale) const;
+
 private:
     static boost::shared_ptr<CostFunctionFactory> m_instance;
 };
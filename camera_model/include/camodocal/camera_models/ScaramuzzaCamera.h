@@ -92,6 +92,11 @@ public:
     void spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p) const;
     //%output p
 
+    void liftProjectiveBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, size_t n) const;
+    //%output P
+    void spaceToPlaneBatch(const Eigen::Vector3d* P, Eigen::Vector2d* p, size_t n) const;
+    //%output p
+
     // Projects 3D points to the image plane (Pi function)
     // and calculates jacobian
     //void spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
@@ -0,0 +1,46 @@
+#ifndef UNDISTORTIONLUT_H
+#define UNDISTORTIONLUT_H
+
+#include <boost/shared_ptr.hpp>
+#include <eigen3/Eigen/Dense>
+#include <vector>
+
+#include "camodocal/camera_models/Camera.h"
+
+namespace camodocal
+{
+
+/**
+ * Precomputed liftProjective for any camera model. The rays of a regular grid of
+ * pixels (every `step` pixels) are computed once; lookups are a table fetch with
+ * optional bilinear interpolation, independent of the distortion model.
+ * Points outside the table fall back to Camera::liftProjective.
+ */
+class UndistortionLUT
+{
+public:
+    UndistortionLUT(const CameraConstPtr& camera, int step = 1, bool interpolate = true);
+
+    // same contract as Camera::liftProjective, P is a unit ray
+    void liftProjective(const Eigen::Vector2d& p, Eigen::Vector3d& P) const;
+
+    int step(void) const;
+    size_t bytes(void) const;
+
+private:
+    const float* node(int col, int row) const;
+
+    CameraConstPtr m_camera;
+    int m_step;
+    bool m_interpolate;
+    int m_cols;
+    int m_rows;
+    std::vector<float> m_rays;  // unit rays, row-major grid of (x, y, z)
+};
+
+typedef boost::shared_ptr<UndistortionLUT> UndistortionLUTPtr;
+typedef boost::shared_ptr<const UndistortionLUT> UndistortionLUTConstPtr;
+
+}
+
+#endif
@@ -18,18 +18,32 @@ class Chessboard
 public:
     Chessboard(cv::Size boardSize, cv::Mat& image);
 
-    void findCorners(bool useOpenCV = false);
+    // coarseToFine: the board is searched on a pyramid level of about COARSE_MIN_SIZE pixels and its
+    // corners refined at full resolution, the full-resolution search is the fallback
+    void findCorners(bool useOpenCV = false, bool coarseToFine = false);
     const std::vector<cv::Point2f>& getCorners(void) const;
     bool cornersFound(void) const;
 
     const cv::Mat& getImage(void) const;
     const cv::Mat& getSketch(void) const;
 
+    // shorter image side of the coarse level
+    static const int COARSE_MIN_SIZE = 480;
+
 private:
     bool findChessboardCorners(const cv::Mat& image,
                                const cv::Size& patternSize,
                                std::vector<cv::Point2f>& corners,
-                               int flags, bool useOpenCV);
+                               int flags, bool useOpenCV, bool coarseToFine);
+
+    bool findChessboardCornersSingleScale(const cv::Mat& image,
+                                          const cv::Size& patternSize,
+                                          std::vector<cv::Point2f>& corners,
+                                          int flags, bool useOpenCV);
+
+    // corners found on a level downsampled by scale, refined in windows around them at full resolution
+    void refineCoarseCorners(const cv::Mat& image, const cv::Size& patternSize,
+                             std::vector<cv::Point2f>& corners, int scale) const;
 
     bool findChessboardCornersImproved(const cv::Mat& image,
                                        const cv::Size& patternSize,
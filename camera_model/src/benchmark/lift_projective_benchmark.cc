@@ -0,0 +1,117 @@
+/**
+ * Micro-benchmark of liftProjective per camera model and of the UndistortionLUT lookup,
+ * over all pixels of a 752x480 image. Reports ns per point (median of the repetitions).
+ * usage: gvins_camera_benchmark [repetitions]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "camodocal/camera_models/CameraFactory.h"
+#include "camodocal/camera_models/ScaramuzzaCamera.h"
+#include "camodocal/camera_models/UndistortionLUT.h"
+
+namespace
+{
+
+const int IMAGE_WIDTH = 752;
+const int IMAGE_HEIGHT = 480;
+
+camodocal::CameraPtr
+makeCamera(camodocal::Camera::ModelType type, const std::vector<double>& intrinsics)
+{
+    camodocal::CameraPtr camera = camodocal::CameraFactory::instance()->generateCamera(
+        type, "benchmark", cv::Size(IMAGE_WIDTH, IMAGE_HEIGHT));
+    camera->readParameters(intrinsics);
+    return camera;
+}
+
+// sums the rays so that the lifts cannot be dropped
+template <typename Lift>
+double
+runOnce(Lift&& lift, const std::vector<Eigen::Vector2d>& pixels, double& checksum)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+    Eigen::Vector3d P;
+    for (size_t i = 0; i < pixels.size(); ++i)
+    {
+        lift(pixels[i], P);
+        sum += P;
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    checksum += sum.sum();
+    return elapsed.count() / pixels.size();
+}
+
+template <typename Lift>
+void
+benchmark(const std::string& name, Lift&& lift, const std::vector<Eigen::Vector2d>& pixels, int repetitions)
+{
+    double checksum = 0.0;
+    runOnce(lift, pixels, checksum);
+    std::vector<double> ns(repetitions);
+    for (int r = 0; r < repetitions; ++r)
+    {
+        ns[r] = runOnce(lift, pixels, checksum);
+    }
+    std::sort(ns.begin(), ns.end());
+    printf("%-36s %10.1f ns/point %10.1f min (checksum %.3g)\n",
+           name.c_str(), ns[repetitions / 2], ns.front(), checksum);
+}
+
+}
+
+int
+main(int argc, char** argv)
+{
+    const int repetitions = std::max(1, argc > 1 ? std::atoi(argv[1]) : 9);
+
+    std::vector<Eigen::Vector2d> pixels;
+    pixels.reserve(IMAGE_WIDTH * IMAGE_HEIGHT);
+    for (int v = 0; v < IMAGE_HEIGHT; ++v)
+    {
+        for (int u = 0; u < IMAGE_WIDTH; ++u)
+        {
+            pixels.push_back(Eigen::Vector2d(u + 0.25, v + 0.75));
+        }
+    }
+
+    // MEI as in config/visensor_f9p, the others with comparable fields of view
+    std::vector<double> ocam(SCARAMUZZA_CAMERA_NUM_PARAMS, 0.0);
+    const double ocam_head[] = {1.0, 0.0, 1.0, 376.0, 240.0, -250.0, 0.0, 1.2e-3, -1.5e-6, 2.0e-9};
+    std::copy(ocam_head, ocam_head + 10, ocam.begin());
+    ocam[5 + SCARAMUZZA_POLY_SIZE] = 350.0;
+    ocam[5 + SCARAMUZZA_POLY_SIZE + 1] = 200.0;
+
+    const struct
+    {
+        const char* name;
+        camodocal::Camera::ModelType type;
+        std::vector<double> intrinsics;
+    } models[] = {
+        {"pinhole", camodocal::Camera::PINHOLE,
+         {-0.28, 0.07, 1.8e-4, 1.8e-5, 458.7, 457.3, 367.2, 248.4}},
+        {"mei", camodocal::Camera::MEI,
+         {1.8477, -0.0660, 0.8559, -6.4e-4, 1.5e-3, 1338.18, 1340.12, 378.79, 217.69}},
+        {"kannala_brandt", camodocal::Camera::KANNALA_BRANDT,
+         {-0.01, 0.02, -0.01, 0.002, 460.0, 460.0, 376.0, 240.0}},
+        {"scaramuzza", camodocal::Camera::SCARAMUZZA, ocam},
+    };
+
+    for (const auto& model : models)
+    {
+        camodocal::CameraPtr camera = makeCamera(model.type, model.intrinsics);
+        benchmark(std::string("liftProjective/") + model.name,
+                  [&camera](const Eigen::Vector2d& p, Eigen::Vector3d& P) { camera->liftProjective(p, P); },
+                  pixels, repetitions);
+        camodocal::UndistortionLUT lut(camera);
+        benchmark(std::string("UndistortionLUT/") + model.name,
+                  [&lut](const Eigen::Vector2d& p, Eigen::Vector3d& P) { lut.liftProjective(p, P); },
+                  pixels, repetitions);
+    }
+    return 0;
+}
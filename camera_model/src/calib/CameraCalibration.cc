@@ -6,6 +6,7 @@
 #include <iostream>
 #include <algorithm>
 #include <fstream>
+#include <thread>
 #include <opencv2/core/core.hpp>
 #include <opencv2/core/eigen.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -486,7 +487,22 @@ CameraCalibration::optimize(CameraPtr& camera,
     // create residuals for each observation
     for (size_t i = 0; i < m_imagePoints.size(); ++i)
     {
-        for (size_t j = 0; j < m_imagePoints.at(i).size(); ++j)
+        // one block with analytic jacobians for all corners of the image, the Cauchy loss
+        // is applied per corner inside it
+        ceres::CostFunction* imageCostFunction =
+            CostFunctionFactory::instance()->generateImageCostFunction(camera,
+                                                                       m_scenePoints.at(i),
+                                                                       m_imagePoints.at(i),
+                                                                       1.0);
+        if (imageCostFunction)
+        {
+            problem.AddResidualBlock(imageCostFunction, NULL,
+                                     intrinsicCameraParams.data(),
+                                     transformVec.at(i).rotationData(),
+                                     transformVec.at(i).translationData());
+        }
+
+        for (size_t j = 0; !imageCostFunction && j < m_imagePoints.at(i).size(); ++j)
         {
             const cv::Point3f& spt = m_scenePoints.at(i).at(j);
             const cv::Point2f& ipt = m_imagePoints.at(i).at(j);
@@ -514,7 +530,7 @@ CameraCalibration::optimize(CameraPtr& camera,
     std::cout << "begin ceres" << std::endl;
     ceres::Solver::Options options;
     options.max_num_iterations = 1000;
-    options.num_threads = 1;
+    options.num_threads = std::max(1u, std::thread::hardware_concurrency());
 
     if (m_verbose)
     {
@@ -140,6 +140,24 @@ Camera::estimateExtrinsics(const std::vector<cv::Point3f>& objectPoints,
     cv::solvePnP(objectPoints, Ms, cv::Mat::eye(3, 3, CV_64F), cv::noArray(), rvec, tvec);
 }
 
+void
+Camera::liftProjectiveBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, size_t n) const
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        liftProjective(p[i], P[i]);
+    }
+}
+
+void
+Camera::spaceToPlaneBatch(const Eigen::Vector3d* P, Eigen::Vector2d* p, size_t n) const
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        spaceToPlane(P[i], p[i]);
+    }
+}
+
 double
 Camera::reprojectionDist(const Eigen::Vector3d& P1, const Eigen::Vector3d& P2) const
 {
@@ -232,20 +250,23 @@ Camera::projectPoints(const std::vector<cv::Point3f>& objectPoints,
     Eigen::Vector3d t;
     t << tvec.at<double>(0), tvec.at<double>(1), tvec.at<double>(2);
 
+    std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d> > P(objectPoints.size());
     for (size_t i = 0; i < objectPoints.size(); ++i)
     {
         const cv::Point3f& objectPoint = objectPoints.at(i);
 
         // Rotate and translate
-        Eigen::Vector3d P;
-        P << objectPoint.x, objectPoint.y, objectPoint.z;
+        P[i] << objectPoint.x, objectPoint.y, objectPoint.z;
 
-        P = R * P + t;
+        P[i] = R * P[i] + t;
+    }
 
-        Eigen::Vector2d p;
-        spaceToPlane(P, p);
+    std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d> > p(P.size());
+    spaceToPlaneBatch(P.data(), p.data(), P.size());
 
-        imagePoints.push_back(cv::Point2f(p(0), p(1)));
+    for (size_t i = 0; i < p.size(); ++i)
+    {
+        imagePoints.push_back(cv::Point2f(p[i](0), p[i](1)));
     }
 }
 
@@ -1,5 +1,6 @@
 #include "camodocal/camera_models/CataCamera.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <eigen3/Eigen/Dense>
@@ -14,6 +15,31 @@
 namespace camodocal
 {
 
+namespace
+{
+
+// Points per block in the batched kernels. Each undistortion step runs over a
+// whole block, a loop without calls or data dependent branches that the
+// compiler can vectorise
+const size_t BATCH_BLOCK = 16;
+
+// Same arithmetic as CataCamera::distortion, so the batched results match the
+// single-point ones exactly
+inline void
+radialTangentialDistortion(double k1, double k2, double p1, double p2,
+                           double mx_u, double my_u, double& dx_u, double& dy_u)
+{
+    double mx2_u = mx_u * mx_u;
+    double my2_u = my_u * my_u;
+    double mxy_u = mx_u * my_u;
+    double rho2_u = mx2_u + my2_u;
+    double rad_dist_u = k1 * rho2_u + k2 * rho2_u * rho2_u;
+    dx_u = mx_u * rad_dist_u + 2.0 * p1 * mxy_u + p2 * (rho2_u + 2.0 * mx2_u);
+    dy_u = my_u * rad_dist_u + 2.0 * p2 * mxy_u + p1 * (rho2_u + 2.0 * my2_u);
+}
+
+}
+
 CataCamera::Parameters::Parameters()
  : Camera::Parameters(MEI)
  , m_xi(0.0)
@@ -658,6 +684,114 @@ CataCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p) const
          mParameters.gamma2() * p_d(1) + mParameters.v0();
 }
 
+/**
+ * \brief Lifts n contiguous points from the image plane to their projective rays,
+ *        same results as liftProjective
+ *
+ * \param p image coordinates
+ * \param P return value, the projective rays
+ * \param n number of points
+ */
+void
+CataCamera::liftProjectiveBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, size_t n) const
+{
+    const double k1 = mParameters.k1();
+    const double k2 = mParameters.k2();
+    const double p1 = mParameters.p1();
+    const double p2 = mParameters.p2();
+    const double xi = mParameters.xi();
+
+    double mx_d[BATCH_BLOCK], my_d[BATCH_BLOCK], mx_u[BATCH_BLOCK], my_u[BATCH_BLOCK];
+    for (size_t begin = 0; begin < n; begin += BATCH_BLOCK)
+    {
+        const size_t m = std::min(BATCH_BLOCK, n - begin);
+
+        // Lift points to normalised plane
+        for (size_t j = 0; j < m; ++j)
+        {
+            mx_d[j] = m_inv_K11 * p[begin + j](0) + m_inv_K13;
+            my_d[j] = m_inv_K22 * p[begin + j](1) + m_inv_K23;
+            mx_u[j] = mx_d[j];
+            my_u[j] = my_d[j];
+        }
+
+        if (!m_noDistortion)
+        {
+            // Recursive distortion model, 8 steps as in liftProjective
+            for (int i = 0; i < 8; ++i)
+            {
+                for (size_t j = 0; j < m; ++j)
+                {
+                    double dx_u, dy_u;
+                    radialTangentialDistortion(k1, k2, p1, p2, mx_u[j], my_u[j], dx_u, dy_u);
+                    mx_u[j] = mx_d[j] - dx_u;
+                    my_u[j] = my_d[j] - dy_u;
+                }
+            }
+        }
+
+        // Obtain a projective ray
+        if (xi == 1.0)
+        {
+            for (size_t j = 0; j < m; ++j)
+            {
+                P[begin + j] << mx_u[j], my_u[j], (1.0 - mx_u[j] * mx_u[j] - my_u[j] * my_u[j]) / 2.0;
+            }
+        }
+        else
+        {
+            for (size_t j = 0; j < m; ++j)
+            {
+                double rho2_u = mx_u[j] * mx_u[j] + my_u[j] * my_u[j];
+                P[begin + j] << mx_u[j], my_u[j], 1.0 - xi * (rho2_u + 1.0) / (xi + sqrt(1.0 + (1.0 - xi * xi) * rho2_u));
+            }
+        }
+    }
+}
+
+/**
+ * \brief Projects n contiguous 3D points to the image plane, same results as
+ *        spaceToPlane
+ *
+ * \param P 3D point coordinates
+ * \param p return value, the image point coordinates
+ * \param n number of points
+ */
+void
+CataCamera::spaceToPlaneBatch(const Eigen::Vector3d* P, Eigen::Vector2d* p, size_t n) const
+{
+    const double k1 = mParameters.k1();
+    const double k2 = mParameters.k2();
+    const double p1 = mParameters.p1();
+    const double p2 = mParameters.p2();
+    const double xi = mParameters.xi();
+    const double gamma1 = mParameters.gamma1();
+    const double gamma2 = mParameters.gamma2();
+    const double u0 = mParameters.u0();
+    const double v0 = mParameters.v0();
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        // Project points to the normalised plane
+        double z = P[i](2) + xi * P[i].norm();
+        double mx_u = P[i](0) / z;
+        double my_u = P[i](1) / z;
+
+        if (!m_noDistortion)
+        {
+            // Apply distortion
+            double dx_u, dy_u;
+            radialTangentialDistortion(k1, k2, p1, p2, mx_u, my_u, dx_u, dy_u);
+            mx_u += dx_u;
+            my_u += dy_u;
+        }
+
+        // Apply generalised projection matrix
+        p[i] << gamma1 * mx_u + u0,
+                gamma2 * my_u + v0;
+    }
+}
+
 #if 0
 /** 
  * \brief Project a 3D point to the image plane and calculate Jacobian
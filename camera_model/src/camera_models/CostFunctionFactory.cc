@@ -479,6 +479,287 @@ class ComprehensionError {
     Eigen::Matrix2d m_sqrtPrecisionMat;
 };
 
+// distortion of the pinhole and MEI models and its derivatives w.r.t. the undistorted point
+// and (k1, k2, p1, p2)
+static void
+radialTangentialDistortion(const double* k, double u, double v, double& ud, double& vd,
+                           Eigen::Matrix2d& J_uv, Eigen::Matrix<double, 2, 4>& J_k)
+{
+    const double k1 = k[0], k2 = k[1], p1 = k[2], p2 = k[3];
+    const double rho_sqr = u * u + v * v;
+    const double L = 1.0 + k1 * rho_sqr + k2 * rho_sqr * rho_sqr;
+    const double dL = k1 + 2.0 * k2 * rho_sqr;     // dL / d(rho_sqr)
+
+    ud = L * u + 2.0 * p1 * u * v + p2 * (rho_sqr + 2.0 * u * u);
+    vd = L * v + p1 * (rho_sqr + 2.0 * v * v) + 2.0 * p2 * u * v;
+
+    J_uv(0,0) = L + 2.0 * u * u * dL + 2.0 * p1 * v + 6.0 * p2 * u;
+    J_uv(0,1) = 2.0 * u * v * dL + 2.0 * p1 * u + 2.0 * p2 * v;
+    J_uv(1,0) = 2.0 * u * v * dL + 2.0 * p1 * u + 2.0 * p2 * v;
+    J_uv(1,1) = L + 2.0 * v * v * dL + 6.0 * p1 * v + 2.0 * p2 * u;
+
+    J_k << u * rho_sqr, u * rho_sqr * rho_sqr, 2.0 * u * v, rho_sqr + 2.0 * u * u,
+           v * rho_sqr, v * rho_sqr * rho_sqr, rho_sqr + 2.0 * v * v, 2.0 * u * v;
+}
+
+// projections of a point in the camera frame with the jacobians w.r.t. the point and the
+// intrinsics, in the parameter order of writeParameters() / spaceToPlane()
+struct PinholeProjection
+{
+    enum { NUM_PARAMS = 8 };    // k1, k2, p1, p2, fx, fy, cx, cy
+
+    static void project(const double* params, const Eigen::Vector3d& P_c, Eigen::Vector2d& p,
+                        Eigen::Matrix<double, 2, 3>& J_P, Eigen::Matrix<double, 2, NUM_PARAMS>& J_params)
+    {
+        const double inv_z = 1.0 / P_c(2);
+        const double u = P_c(0) * inv_z;
+        const double v = P_c(1) * inv_z;
+
+        Eigen::Matrix<double, 2, 3> J_uv_P;
+        J_uv_P << inv_z, 0.0, -u * inv_z,
+                  0.0, inv_z, -v * inv_z;
+
+        double ud, vd;
+        Eigen::Matrix2d J_d_uv;
+        Eigen::Matrix<double, 2, 4> J_d_k;
+        radialTangentialDistortion(params, u, v, ud, vd, J_d_uv, J_d_k);
+
+        const Eigen::Vector2d f(params[4], params[5]);
+        p << f(0) * ud + params[6], f(1) * vd + params[7];
+
+        J_P = f.asDiagonal() * J_d_uv * J_uv_P;
+        J_params.leftCols<4>() = f.asDiagonal() * J_d_k;
+        J_params.rightCols<4>() << ud, 0.0, 1.0, 0.0,
+                                   0.0, vd, 0.0, 1.0;
+    }
+};
+
+struct CataProjection
+{
+    enum { NUM_PARAMS = 9 };    // xi, k1, k2, p1, p2, gamma1, gamma2, u0, v0
+
+    static void project(const double* params, const Eigen::Vector3d& P_c, Eigen::Vector2d& p,
+                        Eigen::Matrix<double, 2, 3>& J_P, Eigen::Matrix<double, 2, NUM_PARAMS>& J_params)
+    {
+        const double xi = params[0];
+        const double len = P_c.norm();
+        const Eigen::Vector3d s = P_c / len;
+        const Eigen::Matrix3d J_s_P = (Eigen::Matrix3d::Identity() - s * s.transpose()) / len;
+
+        const double inv_d = 1.0 / (s(2) + xi);
+        const double u = s(0) * inv_d;
+        const double v = s(1) * inv_d;
+
+        Eigen::Matrix<double, 2, 3> J_uv_s;
+        J_uv_s << inv_d, 0.0, -u * inv_d,
+                  0.0, inv_d, -v * inv_d;
+        const Eigen::Vector2d J_uv_xi(-u * inv_d, -v * inv_d);
+
+        double ud, vd;
+        Eigen::Matrix2d J_d_uv;
+        Eigen::Matrix<double, 2, 4> J_d_k;
+        radialTangentialDistortion(params + 1, u, v, ud, vd, J_d_uv, J_d_k);
+
+        const Eigen::Vector2d gamma(params[5], params[6]);
+        p << gamma(0) * ud + params[7], gamma(1) * vd + params[8];
+
+        const Eigen::Matrix2d J_p_uv = gamma.asDiagonal() * J_d_uv;
+        J_P = J_p_uv * J_uv_s * J_s_P;
+        J_params.col(0) = J_p_uv * J_uv_xi;
+        J_params.block<2, 4>(0, 1) = gamma.asDiagonal() * J_d_k;
+        J_params.rightCols<4>() << ud, 0.0, 1.0, 0.0,
+                                   0.0, vd, 0.0, 1.0;
+    }
+};
+
+struct EquidistantProjection
+{
+    enum { NUM_PARAMS = 8 };    // k2, k3, k4, k5, mu, mv, u0, v0
+
+    static void project(const double* params, const Eigen::Vector3d& P_c, Eigen::Vector2d& p,
+                        Eigen::Matrix<double, 2, 3>& J_P, Eigen::Matrix<double, 2, NUM_PARAMS>& J_params)
+    {
+        const double k2 = params[0], k3 = params[1], k4 = params[2], k5 = params[3];
+        const double x = P_c(0), y = P_c(1), z = P_c(2);
+        const double rho_sqr = x * x + y * y;
+        const double rho = sqrt(rho_sqr);
+        const double len_sqr = rho_sqr + z * z;
+        const double theta = atan2(rho, z);
+        const double theta2 = theta * theta;
+
+        // r(theta) = theta + k2 theta^3 + k3 theta^5 + k4 theta^7 + k5 theta^9
+        const double r = theta * (1.0 + theta2 * (k2 + theta2 * (k3 + theta2 * (k4 + theta2 * k5))));
+        const double dr = 1.0 + theta2 * (3.0 * k2 + theta2 * (5.0 * k3 + theta2 * (7.0 * k4 + theta2 * 9.0 * k5)));
+
+        // p_u = r(theta) / rho * (x, y), on the optical axis r / rho -> dr(0) / z = 1 / z
+        double f;
+        Eigen::RowVector3d J_f_P;
+        Eigen::Vector2d dir;
+        if (rho > 1e-12 * sqrt(len_sqr))
+        {
+            f = r / rho;
+            const Eigen::RowVector3d J_theta_P(z * x / (rho * len_sqr), z * y / (rho * len_sqr), -rho / len_sqr);
+            const Eigen::RowVector3d J_rho_P(x / rho, y / rho, 0.0);
+            J_f_P = dr / rho * J_theta_P - r / rho_sqr * J_rho_P;
+            dir << x / rho, y / rho;
+        }
+        else
+        {
+            f = 1.0 / z;
+            J_f_P << 0.0, 0.0, -1.0 / (z * z);
+            dir << 1.0, 0.0;
+        }
+        const Eigen::Vector2d p_u = f * Eigen::Vector2d(x, y);
+
+        Eigen::Matrix<double, 2, 3> J_pu_P;
+        J_pu_P << f, 0.0, 0.0,
+                  0.0, f, 0.0;
+        J_pu_P += Eigen::Vector2d(x, y) * J_f_P;
+
+        const Eigen::Vector2d m(params[4], params[5]);
+        p << m(0) * p_u(0) + params[6], m(1) * p_u(1) + params[7];
+
+        J_P = m.asDiagonal() * J_pu_P;
+        const double theta3 = theta2 * theta;
+        const Eigen::Vector4d theta_pow(theta3, theta3 * theta2, theta3 * theta2 * theta2,
+                                        theta3 * theta2 * theta2 * theta2);
+        J_params.leftCols<4>() = m.asDiagonal() * dir * theta_pow.transpose();
+        J_params.rightCols<4>() << p_u(0), 0.0, 1.0, 0.0,
+                                   0.0, p_u(1), 0.0, 1.0;
+    }
+};
+
+/*
+ * All corners of one chessboard image in one residual block, with analytic jacobians w.r.t.
+ * the intrinsics, the pose rotation (Eigen quaternion x, y, z, w) and the translation.
+ * The per-corner Cauchy loss rho(s) = a^2 log(1 + s / a^2) is folded into the residual:
+ * r = sqrt(rho(|e|^2) / |e|^2) * e gives 0.5 |r|^2 = 0.5 rho(|e|^2), the cost the former
+ * per-corner blocks with a CauchyLoss had.
+ */
+template<class ProjectionT>
+class ImageReprojectionError : public ceres::CostFunction
+{
+public:
+    ImageReprojectionError(const std::vector<cv::Point3f>& scenePoints,
+                           const std::vector<cv::Point2f>& imagePoints,
+                           double cauchyScale)
+        : m_cauchyScaleSqr(cauchyScale * cauchyScale)
+    {
+        for (size_t j = 0; j < scenePoints.size(); ++j)
+        {
+            m_observed_P.push_back(Eigen::Vector3d(scenePoints[j].x, scenePoints[j].y, scenePoints[j].z));
+            m_observed_p.push_back(Eigen::Vector2d(imagePoints[j].x, imagePoints[j].y));
+        }
+        set_num_residuals(2 * static_cast<int>(scenePoints.size()));
+        *mutable_parameter_block_sizes() = std::vector<int32_t>{ProjectionT::NUM_PARAMS, 4, 3};
+    }
+
+    virtual bool Evaluate(double const* const* parameters, double* residuals, double** jacobians) const
+    {
+        const double* params = parameters[0];
+        const double* q = parameters[1];
+        const double* t = parameters[2];
+
+        // rotation of the normalized quaternion, like ceres::QuaternionRotatePoint
+        const double q_norm = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+        const Eigen::Quaterniond q_unit(q[3] / q_norm, q[0] / q_norm, q[1] / q_norm, q[2] / q_norm);
+        const Eigen::Matrix3d R = q_unit.toRotationMatrix();
+        const Eigen::Vector3d v = q_unit.vec();
+        const double w = q_unit.w();
+        const Eigen::Vector4d q_vec(v(0), v(1), v(2), w);
+        const Eigen::Matrix4d J_unit_q = (Eigen::Matrix4d::Identity() - q_vec * q_vec.transpose()) / q_norm;
+        const Eigen::Map<const Eigen::Vector3d> t_vec(t);
+
+        const int numResiduals = num_residuals();
+        typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrix;
+        for (size_t j = 0; j < m_observed_P.size(); ++j)
+        {
+            const Eigen::Vector3d& P = m_observed_P[j];
+            const Eigen::Vector3d P_c = R * P + t_vec;
+
+            Eigen::Vector2d p;
+            Eigen::Matrix<double, 2, 3> J_P;
+            Eigen::Matrix<double, 2, ProjectionT::NUM_PARAMS> J_params;
+            ProjectionT::project(params, P_c, p, J_P, J_params);
+
+            const Eigen::Vector2d e = p - m_observed_p[j];
+            double g, dg;
+            cauchyScaling(e.squaredNorm(), g, dg);
+            residuals[2 * j] = g * e(0);
+            residuals[2 * j + 1] = g * e(1);
+
+            if (!jacobians)
+            {
+                continue;
+            }
+
+            const Eigen::Matrix2d J_r_e = g * Eigen::Matrix2d::Identity() + 2.0 * dg * e * e.transpose();
+            if (jacobians[0])
+            {
+                Eigen::Map<RowMatrix> J(jacobians[0], numResiduals, ProjectionT::NUM_PARAMS);
+                J.block<2, ProjectionT::NUM_PARAMS>(2 * j, 0) = J_r_e * J_params;
+            }
+            if (jacobians[1])
+            {
+                // d(R p) / d(x, y, z, w) of a unit quaternion, w.r.t. the raw coefficients through J_unit_q
+                Eigen::Matrix<double, 3, 4> J_Pc_q;
+                J_Pc_q.leftCols<3>() = -2.0 * w * skew(P) +
+                    2.0 * (v.dot(P) * Eigen::Matrix3d::Identity() + v * P.transpose() - 2.0 * P * v.transpose());
+                J_Pc_q.col(3) = 2.0 * v.cross(P);
+                Eigen::Map<RowMatrix> J(jacobians[1], numResiduals, 4);
+                J.block<2, 4>(2 * j, 0) = J_r_e * J_P * J_Pc_q * J_unit_q;
+            }
+            if (jacobians[2])
+            {
+                Eigen::Map<RowMatrix> J(jacobians[2], numResiduals, 3);
+                J.block<2, 3>(2 * j, 0) = J_r_e * J_P;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    static Eigen::Matrix3d skew(const Eigen::Vector3d& x)
+    {
+        Eigen::Matrix3d m;
+        m << 0.0, -x(2), x(1),
+             x(2), 0.0, -x(0),
+             -x(1), x(0), 0.0;
+        return m;
+    }
+
+    // g = sqrt(rho(s) / s) and dg / ds, g = 1 without a loss
+    void cauchyScaling(double s, double& g, double& dg) const
+    {
+        if (m_cauchyScaleSqr <= 0.0)
+        {
+            g = 1.0;
+            dg = 0.0;
+            return;
+        }
+        const double x = s / m_cauchyScaleSqr;
+        double h, dh;   // log(1 + x) / x and its derivative w.r.t. x
+        if (x < 1e-4)
+        {
+            h = 1.0 - x / 2.0 + x * x / 3.0;
+            dh = -0.5 + 2.0 * x / 3.0;
+        }
+        else
+        {
+            const double log1px = log1p(x);
+            h = log1px / x;
+            dh = (x / (1.0 + x) - log1px) / (x * x);
+        }
+        g = sqrt(h);
+        dg = dh / (2.0 * g) / m_cauchyScaleSqr;
+    }
+
+    std::vector<Eigen::Vector3d> m_observed_P;
+    std::vector<Eigen::Vector2d> m_observed_p;
+    double m_cauchyScaleSqr;
+};
+
 boost::shared_ptr<CostFunctionFactory> CostFunctionFactory::m_instance;
 
 CostFunctionFactory::CostFunctionFactory()
@@ -1204,5 +1485,30 @@ CostFunctionFactory::generateCostFunction(const CameraConstPtr& cameraL,
     return costFunction;
 }
 
+ceres::CostFunction*
+CostFunctionFactory::generateImageCostFunction(const CameraConstPtr& camera,
+        const std::vector<cv::Point3f>& scenePoints,
+        const std::vector<cv::Point2f>& imagePoints,
+        double cauchyScale) const
+{
+    ceres::CostFunction* costFunction = 0;
+
+    switch (camera->modelType())
+    {
+    case Camera::KANNALA_BRANDT:
+        costFunction = new ImageReprojectionError<EquidistantProjection>(scenePoints, imagePoints, cauchyScale);
+        break;
+    case Camera::PINHOLE:
+        costFunction = new ImageReprojectionError<PinholeProjection>(scenePoints, imagePoints, cauchyScale);
+        break;
+    case Camera::MEI:
+        costFunction = new ImageReprojectionError<CataProjection>(scenePoints, imagePoints, cauchyScale);
+        break;
+    default:
+        break;
+    }
+
+    return costFunction;
 }
 
+}
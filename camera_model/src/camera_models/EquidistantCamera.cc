@@ -460,6 +460,69 @@ EquidistantCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p) co
          mParameters.mv() * p_u(1) + mParameters.v0();
 }
 
+/**
+ * \brief Lifts n contiguous points from the image plane to their projective rays,
+ *        same results as liftProjective
+ *
+ * \param p image coordinates
+ * \param P return value, the projective rays
+ * \param n number of points
+ */
+void
+EquidistantCamera::liftProjectiveBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, size_t n) const
+{
+    // backprojectSymmetric solves a polynomial per point, so only the
+    // parameter loads and the virtual calls are saved here
+    for (size_t i = 0; i < n; ++i)
+    {
+        // Lift points to normalised plane
+        Eigen::Vector2d p_u;
+        p_u << m_inv_K11 * p[i](0) + m_inv_K13,
+               m_inv_K22 * p[i](1) + m_inv_K23;
+
+        // Obtain a projective ray
+        double theta, phi;
+        backprojectSymmetric(p_u, theta, phi);
+
+        P[i](0) = sin(theta) * cos(phi);
+        P[i](1) = sin(theta) * sin(phi);
+        P[i](2) = cos(theta);
+    }
+}
+
+/**
+ * \brief Projects n contiguous 3D points to the image plane, same results as
+ *        spaceToPlane
+ *
+ * \param P 3D point coordinates
+ * \param p return value, the image point coordinates
+ * \param n number of points
+ */
+void
+EquidistantCamera::spaceToPlaneBatch(const Eigen::Vector3d* P, Eigen::Vector2d* p, size_t n) const
+{
+    const double k2 = mParameters.k2();
+    const double k3 = mParameters.k3();
+    const double k4 = mParameters.k4();
+    const double k5 = mParameters.k5();
+    const double mu = mParameters.mu();
+    const double mv = mParameters.mv();
+    const double u0 = mParameters.u0();
+    const double v0 = mParameters.v0();
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        double theta = acos(P[i](2) / P[i].norm());
+        double phi = atan2(P[i](1), P[i](0));
+
+        double r_theta = r(k2, k3, k4, k5, theta);
+
+        // Apply generalised projection matrix
+        p[i] << mu * (r_theta * cos(phi)) + u0,
+                mv * (r_theta * sin(phi)) + v0;
+    }
+}
+
 
 /** 
  * \brief Project a 3D point to the image plane and calculate Jacobian
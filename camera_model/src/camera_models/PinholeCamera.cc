@@ -1,5 +1,6 @@
 #include "camodocal/camera_models/PinholeCamera.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <eigen3/Eigen/Dense>
@@ -13,6 +14,31 @@
 namespace camodocal
 {
 
+namespace
+{
+
+// Points per block in the batched kernels. Each undistortion step runs over a
+// whole block, a loop without calls or data dependent branches that the
+// compiler can vectorise
+const size_t BATCH_BLOCK = 16;
+
+// Same arithmetic as PinholeCamera::distortion, so the batched results match the
+// single-point ones exactly
+inline void
+radialTangentialDistortion(double k1, double k2, double p1, double p2,
+                           double mx_u, double my_u, double& dx_u, double& dy_u)
+{
+    double mx2_u = mx_u * mx_u;
+    double my2_u = my_u * my_u;
+    double mxy_u = mx_u * my_u;
+    double rho2_u = mx2_u + my2_u;
+    double rad_dist_u = k1 * rho2_u + k2 * rho2_u * rho2_u;
+    dx_u = mx_u * rad_dist_u + 2.0 * p1 * mxy_u + p2 * (rho2_u + 2.0 * mx2_u);
+    dy_u = my_u * rad_dist_u + 2.0 * p2 * mxy_u + p1 * (rho2_u + 2.0 * my2_u);
+}
+
+}
+
 PinholeCamera::Parameters::Parameters()
  : Camera::Parameters(PINHOLE)
  , m_k1(0.0)
@@ -541,6 +567,100 @@ PinholeCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p) const
          mParameters.fy() * p_d(1) + mParameters.cy();
 }
 
+/**
+ * \brief Lifts n contiguous points from the image plane to their projective rays,
+ *        same results as liftProjective
+ *
+ * \param p image coordinates
+ * \param P return value, the projective rays
+ * \param n number of points
+ */
+void
+PinholeCamera::liftProjectiveBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, size_t n) const
+{
+    const double k1 = mParameters.k1();
+    const double k2 = mParameters.k2();
+    const double p1 = mParameters.p1();
+    const double p2 = mParameters.p2();
+
+    double mx_d[BATCH_BLOCK], my_d[BATCH_BLOCK], mx_u[BATCH_BLOCK], my_u[BATCH_BLOCK];
+    for (size_t begin = 0; begin < n; begin += BATCH_BLOCK)
+    {
+        const size_t m = std::min(BATCH_BLOCK, n - begin);
+
+        // Lift points to normalised plane
+        for (size_t j = 0; j < m; ++j)
+        {
+            mx_d[j] = m_inv_K11 * p[begin + j](0) + m_inv_K13;
+            my_d[j] = m_inv_K22 * p[begin + j](1) + m_inv_K23;
+            mx_u[j] = mx_d[j];
+            my_u[j] = my_d[j];
+        }
+
+        if (!m_noDistortion)
+        {
+            // Recursive distortion model, 8 steps as in liftProjective
+            for (int i = 0; i < 8; ++i)
+            {
+                for (size_t j = 0; j < m; ++j)
+                {
+                    double dx_u, dy_u;
+                    radialTangentialDistortion(k1, k2, p1, p2, mx_u[j], my_u[j], dx_u, dy_u);
+                    mx_u[j] = mx_d[j] - dx_u;
+                    my_u[j] = my_d[j] - dy_u;
+                }
+            }
+        }
+
+        // Obtain a projective ray
+        for (size_t j = 0; j < m; ++j)
+        {
+            P[begin + j] << mx_u[j], my_u[j], 1.0;
+        }
+    }
+}
+
+/**
+ * \brief Projects n contiguous 3D points to the image plane, same results as
+ *        spaceToPlane
+ *
+ * \param P 3D point coordinates
+ * \param p return value, the image point coordinates
+ * \param n number of points
+ */
+void
+PinholeCamera::spaceToPlaneBatch(const Eigen::Vector3d* P, Eigen::Vector2d* p, size_t n) const
+{
+    const double k1 = mParameters.k1();
+    const double k2 = mParameters.k2();
+    const double p1 = mParameters.p1();
+    const double p2 = mParameters.p2();
+    const double fx = mParameters.fx();
+    const double fy = mParameters.fy();
+    const double cx = mParameters.cx();
+    const double cy = mParameters.cy();
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        // Project points to the normalised plane
+        double mx_u = P[i](0) / P[i](2);
+        double my_u = P[i](1) / P[i](2);
+
+        if (!m_noDistortion)
+        {
+            // Apply distortion
+            double dx_u, dy_u;
+            radialTangentialDistortion(k1, k2, p1, p2, mx_u, my_u, dx_u, dy_u);
+            mx_u += dx_u;
+            my_u += dy_u;
+        }
+
+        // Apply generalised projection matrix
+        p[i] << fx * mx_u + cx,
+                fy * my_u + cy;
+    }
+}
+
 #if 0
 /**
  * \brief Project a 3D point to the image plane and calculate Jacobian
@@ -652,6 +652,96 @@ OCAMCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p) const
          xn[0] * mParameters.E() + xn[1]                   + mParameters.center_y();
 }
 
+/**
+ * \brief Lifts n contiguous points from the image plane to their projective rays,
+ *        same results as liftProjective
+ *
+ * \param p image coordinates
+ * \param P return value, the projective rays
+ * \param n number of points
+ */
+void
+OCAMCamera::liftProjectiveBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, size_t n) const
+{
+    const double center_x = mParameters.center_x();
+    const double center_y = mParameters.center_y();
+    const double C = mParameters.C();
+    const double D = mParameters.D();
+    const double E = mParameters.E();
+    double poly[SCARAMUZZA_POLY_SIZE];
+    for (int i = 0; i < SCARAMUZZA_POLY_SIZE; i++)
+    {
+        poly[i] = mParameters.poly(i);
+    }
+
+    for (size_t j = 0; j < n; ++j)
+    {
+        // Relative to Center
+        double xc_0 = p[j][0] - center_x;
+        double xc_1 = p[j][1] - center_y;
+
+        // Affine Transformation
+        double xc_a_0 = m_inv_scale * (xc_0 - D * xc_1);
+        double xc_a_1 = m_inv_scale * (-E * xc_0 + C * xc_1);
+
+        double phi = std::sqrt(xc_a_0 * xc_a_0 + xc_a_1 * xc_a_1);
+        double phi_i = 1.0;
+        double z = 0.0;
+
+        for (int i = 0; i < SCARAMUZZA_POLY_SIZE; i++)
+        {
+            z += phi_i * poly[i];
+            phi_i *= phi;
+        }
+
+        P[j] << xc_0, xc_1, -z;
+    }
+}
+
+/**
+ * \brief Projects n contiguous 3D points to the image plane, same results as
+ *        spaceToPlane
+ *
+ * \param P 3D point coordinates
+ * \param p return value, the image point coordinates
+ * \param n number of points
+ */
+void
+OCAMCamera::spaceToPlaneBatch(const Eigen::Vector3d* P, Eigen::Vector2d* p, size_t n) const
+{
+    const double center_x = mParameters.center_x();
+    const double center_y = mParameters.center_y();
+    const double C = mParameters.C();
+    const double D = mParameters.D();
+    const double E = mParameters.E();
+    double inv_poly[SCARAMUZZA_INV_POLY_SIZE];
+    for (int i = 0; i < SCARAMUZZA_INV_POLY_SIZE; i++)
+    {
+        inv_poly[i] = mParameters.inv_poly(i);
+    }
+
+    for (size_t j = 0; j < n; ++j)
+    {
+        double norm = std::sqrt(P[j][0] * P[j][0] + P[j][1] * P[j][1]);
+        double theta = std::atan2(-P[j][2], norm);
+        double rho = 0.0;
+        double theta_i = 1.0;
+
+        for (int i = 0; i < SCARAMUZZA_INV_POLY_SIZE; i++)
+        {
+            rho += theta_i * inv_poly[i];
+            theta_i *= theta;
+        }
+
+        double invNorm = 1.0 / norm;
+        double xn_0 = P[j][0] * invNorm * rho;
+        double xn_1 = P[j][1] * invNorm * rho;
+
+        p[j] << xn_0 * C + xn_1 * D + center_x,
+                xn_0 * E + xn_1     + center_y;
+    }
+}
+
 
 /** 
  * \brief Projects an undistorted 2D point p_u to the image plane
@@ -0,0 +1,90 @@
+#include "camodocal/camera_models/UndistortionLUT.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace camodocal
+{
+
+UndistortionLUT::UndistortionLUT(const CameraConstPtr& camera, int step, bool interpolate)
+ : m_camera(camera)
+ , m_step(step < 1 ? 1 : step)
+ , m_interpolate(interpolate)
+{
+    // the grid covers the whole image, the last node may lie beyond the border
+    m_cols = (camera->imageWidth() - 1 + m_step - 1) / m_step + 1;
+    m_rows = (camera->imageHeight() - 1 + m_step - 1) / m_step + 1;
+    m_rays.resize(3 * m_cols * m_rows);
+
+    for (int r = 0; r < m_rows; ++r)
+    {
+        for (int c = 0; c < m_cols; ++c)
+        {
+            Eigen::Vector3d P;
+            camera->liftProjective(Eigen::Vector2d(c * m_step, r * m_step), P);
+            // rays of different models have different scales, interpolate on the unit sphere
+            P.normalize();
+            float* ray = &m_rays[3 * (r * m_cols + c)];
+            ray[0] = static_cast<float>(P(0));
+            ray[1] = static_cast<float>(P(1));
+            ray[2] = static_cast<float>(P(2));
+        }
+    }
+}
+
+const float*
+UndistortionLUT::node(int col, int row) const
+{
+    return &m_rays[3 * (row * m_cols + col)];
+}
+
+void
+UndistortionLUT::liftProjective(const Eigen::Vector2d& p, Eigen::Vector3d& P) const
+{
+    const double gx = p(0) / m_step;
+    const double gy = p(1) / m_step;
+    if (!(gx >= 0.0 && gy >= 0.0 && gx <= m_cols - 1 && gy <= m_rows - 1))
+    {
+        m_camera->liftProjective(p, P);
+        return;
+    }
+
+    if (!m_interpolate)
+    {
+        const float* ray = node(static_cast<int>(gx + 0.5), static_cast<int>(gy + 0.5));
+        P << ray[0], ray[1], ray[2];
+        return;
+    }
+
+    const int c0 = std::min(static_cast<int>(gx), std::max(m_cols - 2, 0));
+    const int r0 = std::min(static_cast<int>(gy), std::max(m_rows - 2, 0));
+    const int c1 = std::min(c0 + 1, m_cols - 1);
+    const int r1 = std::min(r0 + 1, m_rows - 1);
+    const double ax = gx - c0;
+    const double ay = gy - r0;
+
+    const float* r00 = node(c0, r0);
+    const float* r01 = node(c1, r0);
+    const float* r10 = node(c0, r1);
+    const float* r11 = node(c1, r1);
+    for (int k = 0; k < 3; ++k)
+    {
+        P(k) = (1.0 - ay) * ((1.0 - ax) * r00[k] + ax * r01[k]) +
+               ay * ((1.0 - ax) * r10[k] + ax * r11[k]);
+    }
+    P.normalize();
+}
+
+int
+UndistortionLUT::step(void) const
+{
+    return m_step;
+}
+
+size_t
+UndistortionLUT::bytes(void) const
+{
+    return m_rays.size() * sizeof(float);
+}
+
+}
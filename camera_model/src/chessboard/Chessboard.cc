@@ -1,5 +1,8 @@
 #include "camodocal/chessboard/Chessboard.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
@@ -28,14 +31,14 @@ Chessboard::Chessboard(cv::Size boardSize, cv::Mat& image)
 }
 
 void
-Chessboard::findCorners(bool useOpenCV)
+Chessboard::findCorners(bool useOpenCV, bool coarseToFine)
 {
     mCornersFound = findChessboardCorners(mImage, mBoardSize, mCorners,
                                           CV_CALIB_CB_ADAPTIVE_THRESH +
                                           CV_CALIB_CB_NORMALIZE_IMAGE +
                                           CV_CALIB_CB_FILTER_QUADS +
                                           CV_CALIB_CB_FAST_CHECK,
-                                          useOpenCV);
+                                          useOpenCV, coarseToFine);
 
     if (mCornersFound)
     {
@@ -72,7 +75,70 @@ bool
 Chessboard::findChessboardCorners(const cv::Mat& image,
                                   const cv::Size& patternSize,
                                   std::vector<cv::Point2f>& corners,
-                                  int flags, bool useOpenCV)
+                                  int flags, bool useOpenCV, bool coarseToFine)
+{
+    if (coarseToFine)
+    {
+        // thresholding, the dilation runs and the quad search all scale with the pixel count
+        cv::Mat coarse = image;
+        int scale = 1;
+        while (std::min(coarse.cols, coarse.rows) >= 2 * COARSE_MIN_SIZE)
+        {
+            cv::pyrDown(coarse, coarse);
+            scale *= 2;
+        }
+        if (scale == 1)
+        {
+            return findChessboardCornersSingleScale(image, patternSize, corners, flags, useOpenCV);
+        }
+        if (findChessboardCornersSingleScale(coarse, patternSize, corners, flags, useOpenCV))
+        {
+            refineCoarseCorners(image, patternSize, corners, scale);
+            return true;
+        }
+        // e.g. a small board far away, searched at full resolution as without coarseToFine
+    }
+
+    return findChessboardCornersSingleScale(image, patternSize, corners, flags, useOpenCV);
+}
+
+void
+Chessboard::refineCoarseCorners(const cv::Mat& image, const cv::Size& patternSize,
+                                std::vector<cv::Point2f>& corners, int scale) const
+{
+    // pyrDown keeps pixel 2i of the finer level as pixel i
+    float spacing = std::numeric_limits<float>::max();
+    for (size_t i = 0; i < corners.size(); ++i)
+    {
+        corners.at(i) *= static_cast<float>(scale);
+    }
+    for (int r = 0; r < patternSize.height; ++r)
+    {
+        for (int c = 0; c + 1 < patternSize.width; ++c)
+        {
+            const cv::Point2f d = corners.at(r * patternSize.width + c + 1) - corners.at(r * patternSize.width + c);
+            spacing = std::min(spacing, std::sqrt(d.dot(d)));
+        }
+    }
+
+    // the coarse corners are off by up to about one coarse pixel; a first pass with a window covering
+    // that error, kept inside the square so that no neighbouring corner enters it
+    const int halfWin = std::max(std::min(2 * scale, static_cast<int>(spacing / 3.0f)), 2);
+    if (halfWin > 11)
+    {
+        cv::cornerSubPix(image, corners, cv::Size(halfWin, halfWin), cv::Size(-1,-1),
+                         cv::TermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 30, 0.5));
+    }
+    // the same final refinement as the full-resolution search
+    cv::cornerSubPix(image, corners, cv::Size(11, 11), cv::Size(-1,-1),
+                     cv::TermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 30, 0.1));
+}
+
+bool
+Chessboard::findChessboardCornersSingleScale(const cv::Mat& image,
+                                             const cv::Size& patternSize,
+                                             std::vector<cv::Point2f>& corners,
+                                             int flags, bool useOpenCV)
 {
     if (useOpenCV)
     {
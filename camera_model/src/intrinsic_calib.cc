@@ -4,6 +4,9 @@
 #include <iomanip>
 #include <iostream>
 #include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -12,6 +15,15 @@
 #include "camodocal/calib/CameraCalibration.h"
 #include "camodocal/gpl/gpl.h"
 
+// corner detection result of one image, filled by a detection thread and consumed in input order
+struct DetectionResult
+{
+    bool done = false;
+    bool found = false;
+    std::vector<cv::Point2f> corners;
+    cv::Mat sketch;
+};
+
 int main(int argc, char** argv)
 {
     cv::Size boardSize;
@@ -22,8 +34,10 @@ int main(int argc, char** argv)
     std::string prefix;
     std::string fileExtension;
     bool useOpenCV;
+    bool coarseToFine;
     bool viewResults;
     bool verbose;
+    int numThreads;
 
     //========= Handling Program options =========
     boost::program_options::options_description desc("Allowed options");
@@ -38,8 +52,10 @@ int main(int argc, char** argv)
         ("camera-model", boost::program_options::value<std::string>(&cameraModel)->default_value("mei"), "Camera model: kannala-brandt | mei | pinhole")
         ("camera-name", boost::program_options::value<std::string>(&cameraName)->default_value("camera"), "Name of camera")
         ("opencv", boost::program_options::bool_switch(&useOpenCV)->default_value(true), "Use OpenCV to detect corners")
+        ("coarse-to-fine", boost::program_options::bool_switch(&coarseToFine)->default_value(false), "Detect the chessboard on a downsampled image and refine the corners at full resolution")
         ("view-results", boost::program_options::bool_switch(&viewResults)->default_value(false), "View results")
         ("verbose,v", boost::program_options::bool_switch(&verbose)->default_value(true), "Verbose output")
+        ("threads,t", boost::program_options::value<int>(&numThreads)->default_value(0), "Number of corner detection threads, 0 uses all cores")
         ;
 
     boost::program_options::positional_options_description pdesc;
@@ -155,33 +171,91 @@ int main(int argc, char** argv)
     calibration.setVerbose(verbose);
 
     std::vector<bool> chessboardFound(imageFilenames.size(), false);
-    for (size_t i = 0; i < imageFilenames.size(); ++i)
+
+    // images are decoded and searched on numThreads threads; the main thread adds the corners
+    // and shows the sketches in input order. Detection runs at most maxAhead images ahead of it
+    if (numThreads <= 0)
     {
-        image = cv::imread(imageFilenames.at(i), -1);
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    const size_t maxAhead = 4 * numThreads;
+    std::vector<DetectionResult> results(imageFilenames.size());
+    std::mutex resultMutex;
+    std::condition_variable resultReady, slotFree;
+    size_t nextImage = 0;
+    size_t nextConsumed = 0;
+
+    std::vector<std::thread> detectors;
+    for (int t = 0; t < numThreads; ++t)
+    {
+        detectors.push_back(std::thread([&]()
+        {
+            while (true)
+            {
+                size_t i;
+                {
+                    std::unique_lock<std::mutex> lock(resultMutex);
+                    slotFree.wait(lock, [&]{ return nextImage >= imageFilenames.size() ||
+                                                    nextImage < nextConsumed + maxAhead; });
+                    if (nextImage >= imageFilenames.size())
+                    {
+                        return;
+                    }
+                    i = nextImage++;
+                }
+
+                cv::Mat detectImage = cv::imread(imageFilenames.at(i), -1);
+                camodocal::Chessboard chessboard(boardSize, detectImage);
+                chessboard.findCorners(useOpenCV, coarseToFine);
+
+                std::lock_guard<std::mutex> lock(resultMutex);
+                DetectionResult& result = results.at(i);
+                result.found = chessboard.cornersFound();
+                if (result.found)
+                {
+                    result.corners = chessboard.getCorners();
+                    chessboard.getSketch().copyTo(result.sketch);
+                }
+                result.done = true;
+                resultReady.notify_all();
+            }
+        }));
+    }
 
-        camodocal::Chessboard chessboard(boardSize, image);
+    for (size_t i = 0; i < imageFilenames.size(); ++i)
+    {
+        DetectionResult result;
+        {
+            std::unique_lock<std::mutex> lock(resultMutex);
+            resultReady.wait(lock, [&]{ return results.at(i).done; });
+            std::swap(result, results.at(i));
+            nextConsumed = i + 1;
+            slotFree.notify_all();
+        }
 
-        chessboard.findCorners(useOpenCV);
-        if (chessboard.cornersFound())
+        if (result.found)
         {
             if (verbose)
             {
-                std::cerr << "# INFO: Detected chessboard in image " << i + 1 << ", " << imageFilenames.at(i) << std::endl;
+                std::cerr << "# INFO: [" << i + 1 << "/" << imageFilenames.size() << "] Detected chessboard in image "
+                          << imageFilenames.at(i) << std::endl;
             }
 
-            calibration.addChessboardData(chessboard.getCorners());
-
-            cv::Mat sketch;
-            chessboard.getSketch().copyTo(sketch);
+            calibration.addChessboardData(result.corners);
 
-            cv::imshow("Image", sketch);
+            cv::imshow("Image", result.sketch);
             cv::waitKey(50);
         }
         else if (verbose)
         {
-            std::cerr << "# INFO: Did not detect chessboard in image " << i + 1 << std::endl;
+            std::cerr << "# INFO: [" << i + 1 << "/" << imageFilenames.size() << "] Did not detect chessboard in image "
+                      << imageFilenames.at(i) << std::endl;
         }
-        chessboardFound.at(i) = chessboard.cornersFound();
+        chessboardFound.at(i) = result.found;
+    }
+    for (size_t t = 0; t < detectors.size(); ++t)
+    {
+        detectors.at(t).join();
     }
     cv::destroyWindow("Image");
 
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "../utility/tic_toc.h"
+
+/**
+ * 微基准的计时, 不依赖 ROS 和 Google Benchmark: 每个用例先预热一轮, 再重复 repetitions 轮, 每轮至少 min_ms,
+ * 报告每次调用耗时 (ns) 的中位数和最小值; --filter 只运行名字含该子串的用例, --csv 输出为 CSV
+ * 用法: <benchmark> [--filter <substring>] [--min_ms <ms>] [--repetitions <n>] [--csv]
+ */
+class BenchmarkRunner
+{
+  public:
+    BenchmarkRunner(int argc, char **argv)
+        : min_ms(200), repetitions(5), csv(false)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string arg(argv[i]);
+            if (arg == "--filter" && i + 1 < argc)
+                filter = argv[++i];
+            else if (arg == "--min_ms" && i + 1 < argc)
+                min_ms = std::atof(argv[++i]);
+            else if (arg == "--repetitions" && i + 1 < argc)
+                repetitions = std::max(1, std::atoi(argv[++i]));
+            else if (arg == "--csv")
+                csv = true;
+        }
+        if (csv)
+            printf("name,median_ns,min_ns,iterations\n");
+        else
+            printf("%-52s %14s %14s %12s\n", "benchmark", "median ns/op", "min ns/op", "iterations");
+    }
+
+    bool selected(const std::string &name) const
+    {
+        return filter.empty() || name.find(filter) != std::string::npos;
+    }
+
+    // op() is one call of the kernel
+    template <typename Op>
+    void run(const std::string &name, Op &&op)
+    {
+        runTimed(name, [&op](size_t n)
+        {
+            TicToc t;
+            for (size_t i = 0; i < n; ++i)
+                op();
+            return t.toc();
+        });
+    }
+
+    // op(n) makes n calls and returns the ms spent in them, for kernels whose input has to be rebuilt untimed
+    template <typename Op>
+    void runTimed(const std::string &name, Op &&op)
+    {
+        if (!selected(name))
+            return;
+        // warm-up, also sizes the batch of one repetition
+        size_t n = 1;
+        double ms = op(n);
+        while (ms < min_ms / 10 && n < (size_t(1) << 30))
+        {
+            n *= 2;
+            ms = op(n);
+        }
+        n = std::max<size_t>(1, std::min<size_t>(size_t(1) << 30, static_cast<size_t>(n * (min_ms / std::max(ms, 1e-6)))));
+
+        std::vector<double> ns_per_op(repetitions);
+        for (int r = 0; r < repetitions; ++r)
+            ns_per_op[r] = op(n) * 1e6 / n;
+        std::sort(ns_per_op.begin(), ns_per_op.end());
+        const double median = ns_per_op[repetitions / 2];
+        if (csv)
+            printf("%s,%.1f,%.1f,%zu\n", name.c_str(), median, ns_per_op.front(), n);
+        else
+            printf("%-52s %14.1f %14.1f %12zu\n", name.c_str(), median, ns_per_op.front(), n);
+        fflush(stdout);
+    }
+
+  private:
+    std::string filter;
+    double min_ms;
+    int repetitions;
+    bool csv;
+};
+
+// keeps the compiler from dropping a result that is otherwise unused
+template <typename T>
+inline void doNotOptimize(const T &value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
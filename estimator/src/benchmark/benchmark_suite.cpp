@@ -0,0 +1,185 @@
+/**
+ * 回归基准: 对清单中的每个数据集运行 gvins_offline --stats, 并把各次运行的结果合并为一个 JSON 文件,
+ * 含各阶段耗时分布, 峰值内存和 (有真值时) 轨迹精度, 用于比较不同提交
+ * 用法: gvins_benchmark_suite <manifest.yaml> <results.json> [--label <name>] [--offline <gvins_offline>]
+ * 清单格式见 config/benchmark_suite.yaml; 每个数据集在单独的进程中运行, 峰值内存互不影响
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <opencv2/core/core.hpp>
+
+#include "../utility/run_statistics.h"
+#include "../utility/tic_toc.h"
+
+#ifndef GVINS_GIT_REVISION
+#define GVINS_GIT_REVISION "unknown"
+#endif
+
+struct BenchmarkDataset
+{
+    std::string name, config, bag, ground_truth, feature_topic;
+    double duration;
+};
+
+static std::string joinPath(const std::string &dir, const std::string &path)
+{
+    if (path.empty() || path[0] == '/' || dir.empty())
+        return path;
+    return (dir.back() == '/' ? dir : dir + "/") + path;
+}
+
+static std::string readText(const std::string &path)
+{
+    std::ifstream file(path);
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+// runs gvins_offline, returns its exit status and the peak memory of the child
+static int runOffline(const std::vector<std::string> &args, long &peak_rss_kb)
+{
+    std::vector<char *> argv;
+    for (const std::string &arg : args)
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    peak_rss_kb = -1;
+    const pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0)
+    {
+        execv(argv[0], argv.data());
+        perror(argv[0]);
+        _exit(127);
+    }
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid)
+        return -1;
+    peak_rss_kb = usage.ru_maxrss;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> positional;
+    std::string label = GVINS_GIT_REVISION;
+    std::string offline = std::string(argv[0]).substr(0, std::string(argv[0]).find_last_of('/') + 1) + "gvins_offline";
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg(argv[i]);
+        if (arg == "--label" && i + 1 < argc)
+            label = argv[++i];
+        else if (arg == "--offline" && i + 1 < argc)
+            offline = argv[++i];
+        else
+            positional.push_back(arg);
+    }
+    if (positional.size() != 2)
+    {
+        std::cerr << "usage: gvins_benchmark_suite <manifest.yaml> <results.json> [--label <name>] [--offline <gvins_offline>]\n";
+        return 1;
+    }
+
+    cv::FileStorage fs(positional[0], cv::FileStorage::READ);
+    if (!fs.isOpened())
+    {
+        std::cerr << "cannot open " << positional[0] << std::endl;
+        return 1;
+    }
+    std::string data_dir, gvins_folder, output_dir;
+    fs["data_dir"] >> data_dir;
+    fs["gvins_folder"] >> gvins_folder;
+    fs["output_dir"] >> output_dir;
+    const int repeat = fs["repeat"].empty() ? 1 : static_cast<int>(fs["repeat"]);
+    const bool deterministic = fs["deterministic"].empty() || static_cast<int>(fs["deterministic"]);
+
+    std::vector<BenchmarkDataset> datasets;
+    cv::FileNode datasets_node = fs["datasets"];
+    for (cv::FileNodeIterator it = datasets_node.begin(); it != datasets_node.end(); ++it)
+    {
+        BenchmarkDataset dataset;
+        (*it)["name"] >> dataset.name;
+        (*it)["config"] >> dataset.config;
+        (*it)["bag"] >> dataset.bag;
+        (*it)["ground_truth"] >> dataset.ground_truth;
+        (*it)["feature_topic"] >> dataset.feature_topic;
+        dataset.duration = (*it)["duration"].empty() ? -1 : static_cast<double>((*it)["duration"]);
+        dataset.config = joinPath(gvins_folder, dataset.config);
+        dataset.bag = joinPath(data_dir, dataset.bag);
+        dataset.ground_truth = joinPath(data_dir, dataset.ground_truth);
+        datasets.push_back(dataset);
+    }
+    fs.release();
+    if (datasets.empty())
+    {
+        std::cerr << "no datasets in " << positional[0] << std::endl;
+        return 1;
+    }
+
+    FILE *results = fopen(positional[1].c_str(), "w");
+    if (!results)
+    {
+        std::cerr << "cannot write " << positional[1] << std::endl;
+        return 1;
+    }
+    fprintf(results, "{\n\"label\": \"%s\",\n\"revision\": \"%s\",\n\"runs\": [\n",
+            jsonEscape(label).c_str(), jsonEscape(GVINS_GIT_REVISION).c_str());
+
+    int num_failed = 0;
+    bool first_run = true;
+    for (const BenchmarkDataset &dataset : datasets)
+    {
+        for (int r = 0; r < repeat; ++r)
+        {
+            const std::string run_dir = joinPath(output_dir, dataset.name + "_" + std::to_string(r));
+            const std::string stats_file = run_dir + "/stats.json";
+            std::remove(stats_file.c_str());
+
+            std::vector<std::string> args = {offline, dataset.config, dataset.bag, "--output", run_dir, "--stats", stats_file};
+            if (!gvins_folder.empty())
+                args.insert(args.end(), {"--gvins_folder", gvins_folder});
+            if (!dataset.feature_topic.empty())
+                args.insert(args.end(), {"--feature_topic", dataset.feature_topic});
+            if (!dataset.ground_truth.empty())
+                args.insert(args.end(), {"--ground_truth", dataset.ground_truth});
+            if (dataset.duration > 0)
+                args.insert(args.end(), {"--duration", std::to_string(dataset.duration)});
+            if (deterministic)
+                args.push_back("--deterministic");
+
+            printf("benchmark: %s, run %d of %d\n", dataset.name.c_str(), r + 1, repeat);
+            fflush(stdout);
+            TicToc t_run;
+            long peak_rss_kb;
+            const int exit_status = runOffline(args, peak_rss_kb);
+            const double run_s = t_run.toc() / 1000.0;
+            const std::string stats = (exit_status == 0 ? readText(stats_file) : std::string());
+            if (stats.empty())
+            {
+                std::cerr << "benchmark: " << dataset.name << " failed, exit status " << exit_status << std::endl;
+                num_failed++;
+            }
+
+            fprintf(results, "%s{\"name\": \"%s\", \"run\": %d, \"exit_status\": %d, \"process_s\": %.3f, "
+                             "\"process_peak_rss_kb\": %ld,\n \"stats\": %s}",
+                    first_run ? "" : ",\n", jsonEscape(dataset.name).c_str(), r, exit_status, run_s, peak_rss_kb,
+                    stats.empty() ? "null" : stats.c_str());
+            first_run = false;
+        }
+    }
+    fprintf(results, "\n]\n}\n");
+    fclose(results);
+    printf("benchmark: %zu datasets, %d failed runs, results in %s\n", datasets.size(), num_failed, positional[1].c_str());
+    return num_failed == 0 ? 0 : 2;
+}
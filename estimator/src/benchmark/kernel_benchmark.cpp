@@ -0,0 +1,452 @@
+/**
+ * 后端热点核函数的微基准, 输入为合成但规模和数值接近实际的数据, 不需要 ROS 节点和数据集:
+ * IMUFactor/ProjectionFactor/ProjectionTdFactor/ProjectionTrackFactor (double 和打包求值)/GnssPsrDoppFactor::Evaluate, IntegrationBase::push_back/repropagate,
+ * MarginalizationInfo::preMarginalize/marginalize (不同窗口大小和特征数), eph2pos/geph2pos
+ * 用法见 benchmark_harness.h, 另有 --threads <n> (边缘化的线程数), 例如 gvins_kernel_benchmark --filter marginalization --csv
+ */
+#include <array>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gnss_comm/gnss_constant.hpp>
+#include <gnss_comm/gnss_utility.hpp>
+#include <gnss_comm/gnss_spp.hpp>
+
+#include "benchmark_harness.h"
+#include "../parameters.h"
+#include "../factor/integration_base.h"
+#include "../factor/imu_factor.h"
+#include "../factor/projection_factor.h"
+#include "../factor/projection_td_factor.h"
+#include "../factor/projection_track_factor.h"
+#include "../factor/gnss_psr_dopp_factor.hpp"
+#include "../factor/marginalization_factor.h"
+
+using namespace gnss_comm;
+
+namespace
+{
+    const double IMU_RATE = 200.0;
+    const double CAMERA_RATE = 10.0;
+    const int SAMPLES_PER_FRAME = static_cast<int>(IMU_RATE / CAMERA_RATE);
+
+    struct ImuSample
+    {
+        double dt;
+        Eigen::Vector3d acc, gyr;
+    };
+
+    // slow hand-held motion with sensor noise, one frame interval starting at t0
+    std::vector<ImuSample> simulateFrameImu(double t0, std::mt19937 &rng)
+    {
+        std::normal_distribution<double> acc_noise(0.0, 0.08), gyr_noise(0.0, 0.004);
+        std::vector<ImuSample> samples(SAMPLES_PER_FRAME + 1);
+        for (int i = 0; i <= SAMPLES_PER_FRAME; ++i)
+        {
+            const double t = t0 + i / IMU_RATE;
+            samples[i].dt = 1.0 / IMU_RATE;
+            samples[i].acc << 0.5*std::sin(t) + acc_noise(rng), 0.3*std::cos(2*t) + acc_noise(rng), 9.8 + acc_noise(rng);
+            samples[i].gyr << 0.2*std::sin(0.5*t) + gyr_noise(rng), 0.1*std::cos(t) + gyr_noise(rng), 0.3 + gyr_noise(rng);
+        }
+        return samples;
+    }
+
+    IntegrationBase *integrateFrame(const std::vector<ImuSample> &samples)
+    {
+        IntegrationBase *integration = new IntegrationBase(samples[0].acc, samples[0].gyr,
+            Eigen::Vector3d(0.02, -0.01, 0.03), Eigen::Vector3d(0.001, 0.002, -0.001));
+        for (size_t i = 1; i < samples.size(); ++i)
+            integration->push_back(samples[i].dt, samples[i].acc, samples[i].gyr);
+        return integration;
+    }
+
+    // the state of one window frame as the ceres parameter blocks of the estimator
+    struct FrameState
+    {
+        double pose[SIZE_POSE];
+        double speed_bias[SIZE_SPEEDBIAS];
+    };
+
+    void setFrameState(FrameState &state, int k)
+    {
+        const Eigen::Quaterniond q(Eigen::AngleAxisd(0.03 * k, Eigen::Vector3d(0.1, 0.2, 1.0).normalized()));
+        const double p[3] = {0.1 * k, 0.02 * k, 0.01 * k};
+        const double sb[9] = {1.0, 0.2, 0.1, 0.02, -0.01, 0.03, 0.001, 0.002, -0.001};
+        std::copy(p, p + 3, state.pose);
+        state.pose[3] = q.x(); state.pose[4] = q.y(); state.pose[5] = q.z(); state.pose[6] = q.w();
+        std::copy(sb, sb + 9, state.speed_bias);
+    }
+
+    void setExtrinsic(double *ex_pose)
+    {
+        const double ex[SIZE_POSE] = {0.05, 0.01, -0.02, 0.5, -0.5, 0.5, 0.5};
+        std::copy(ex, ex + SIZE_POSE, ex_pose);
+    }
+
+    // jacobian storage of a SizedCostFunction, row major as ceres passes it
+    struct JacobianBuffers
+    {
+        explicit JacobianBuffers(const ceres::CostFunction &f)
+        {
+            const std::vector<int32_t> &sizes = f.parameter_block_sizes();
+            storage.resize(sizes.size());
+            for (size_t i = 0; i < sizes.size(); ++i)
+            {
+                storage[i].resize(f.num_residuals() * sizes[i]);
+                pointers.push_back(storage[i].data());
+            }
+        }
+        std::vector<std::vector<double>> storage;
+        std::vector<double *> pointers;
+    };
+
+    template <typename Factor>
+    void benchmarkEvaluate(BenchmarkRunner &runner, const std::string &name, const Factor &factor,
+                           const std::vector<double *> &parameters)
+    {
+        std::vector<double> residuals(factor.num_residuals());
+        JacobianBuffers jacobians(factor);
+        runner.run(name + "/residual", [&]
+        {
+            factor.Evaluate(parameters.data(), residuals.data(), nullptr);
+            doNotOptimize(residuals[0]);
+        });
+        runner.run(name + "/jacobian", [&]
+        {
+            factor.Evaluate(parameters.data(), residuals.data(), jacobians.pointers.data());
+            doNotOptimize(jacobians.storage[0][0]);
+        });
+    }
+
+    void benchmarkImuFactor(BenchmarkRunner &runner)
+    {
+        std::mt19937 rng(7);
+        std::unique_ptr<IntegrationBase> integration(integrateFrame(simulateFrameImu(0.0, rng)));
+        FrameState state_i, state_j;
+        setFrameState(state_i, 0);
+        setFrameState(state_j, 1);
+        IMUFactor factor(integration.get());
+        benchmarkEvaluate(runner, "imu_factor", factor,
+                          {state_i.pose, state_i.speed_bias, state_j.pose, state_j.speed_bias});
+    }
+
+    void benchmarkIntegration(BenchmarkRunner &runner)
+    {
+        std::mt19937 rng(7);
+        const std::vector<ImuSample> samples = simulateFrameImu(0.0, rng);
+        runner.run("integration_base/push_back_frame_" + std::to_string(SAMPLES_PER_FRAME), [&]
+        {
+            std::unique_ptr<IntegrationBase> integration(integrateFrame(samples));
+            doNotOptimize(integration->delta_p);
+        });
+        std::unique_ptr<IntegrationBase> integration(integrateFrame(samples));
+        Eigen::Vector3d ba(0.02, -0.01, 0.03), bg(0.001, 0.002, -0.001);
+        runner.run("integration_base/repropagate", [&]
+        {
+            ba.x() = -ba.x();
+            integration->repropagate(ba, bg);
+            doNotOptimize(integration->delta_p);
+        });
+    }
+
+    void benchmarkProjectionFactors(BenchmarkRunner &runner)
+    {
+        ProjectionFactor::sqrt_info = FOCAL_LENGTH / 1.5 * Eigen::Matrix2d::Identity();
+        ProjectionTdFactor::sqrt_info = FOCAL_LENGTH / 1.5 * Eigen::Matrix2d::Identity();
+        FrameState state_i, state_j;
+        setFrameState(state_i, 0);
+        setFrameState(state_j, 3);
+        double ex_pose[SIZE_POSE], inv_depth[1] = {0.2}, td[1] = {0.003};
+        setExtrinsic(ex_pose);
+        const Eigen::Vector3d pts_i(0.12, -0.05, 1.0), pts_j(0.09, -0.04, 1.0);
+
+        ProjectionFactor factor(pts_i, pts_j);
+        benchmarkEvaluate(runner, "projection_factor", factor, {state_i.pose, state_j.pose, ex_pose, inv_depth});
+        ProjectionTdFactor td_factor(pts_i, pts_j, Eigen::Vector2d(0.01, -0.02), Eigen::Vector2d(0.015, -0.01), 0.0, 0.0);
+        benchmarkEvaluate(runner, "projection_td_factor", td_factor, {state_i.pose, state_j.pose, ex_pose, inv_depth, td});
+
+        // a track over the whole window, the residual-only evaluation with and without the float packs
+        std::vector<FrameState> window(WINDOW_SIZE + 1);
+        for (int k = 0; k <= WINDOW_SIZE; ++k)
+            setFrameState(window[k], k);
+        ProjectionTrackFactor track_factor(pts_i, Eigen::Vector2d(0.01, -0.02), 0.0, false);
+        std::vector<double *> track_parameters{window[0].pose, ex_pose, inv_depth};
+        for (int k = 1; k <= WINDOW_SIZE; ++k)
+        {
+            track_factor.addObservation(pts_j + Eigen::Vector3d(-0.003 * k, 0.001 * k, 0.0), Eigen::Vector2d::Zero(), 0.0);
+            track_parameters.push_back(window[k].pose);
+        }
+        const std::string track_name = "projection_track_factor_" + std::to_string(WINDOW_SIZE) + "_obs";
+        benchmarkEvaluate(runner, track_name, track_factor, track_parameters);
+        std::vector<double> track_residuals(track_factor.num_residuals());
+        ProjectionTrackFactor::packed_evaluation = true;
+        runner.run(track_name + "/residual_packed", [&]
+        {
+            track_factor.Evaluate(track_parameters.data(), track_residuals.data(), nullptr);
+            doNotOptimize(track_residuals[0]);
+        });
+        ProjectionTrackFactor::packed_evaluation = false;
+    }
+
+    /*** GNSS: GPS satellites and a GLONASS satellite on realistic orbits, seen from Hong Kong ***/
+    const uint32_t GNSS_WEEK = 2100;
+    const double GNSS_TOE_TOW = 345600.0;
+    const Eigen::Vector3d RECEIVER_ECEF(-2418000.0, 5386000.0, 2405000.0);
+
+    EphemPtr gpsEphem(uint32_t prn)
+    {
+        EphemPtr eph(new Ephem());
+        eph->sat = sat_no(SYS_GPS, prn);
+        eph->toe = eph->toc = gpst2time(GNSS_WEEK, GNSS_TOE_TOW);
+        eph->ttr = eph->toe;
+        eph->toe_tow = GNSS_TOE_TOW;
+        eph->week = GNSS_WEEK;
+        eph->health = 0;
+        eph->ura = 2.0;
+        eph->iode = eph->iodc = 1;
+        eph->code = 0;
+        eph->A = 5153.6;
+        eph->e = 0.01;
+        eph->i0 = 0.96;
+        eph->omg = 0.5 * prn;
+        eph->OMG0 = 2.0 * M_PI / 6 * (prn % 6);
+        eph->M0 = 0.7 * prn;
+        eph->delta_n = 4.5e-9;
+        eph->OMG_dot = -8.0e-9;
+        eph->i_dot = 1.0e-10;
+        eph->cuc = 1.0e-6; eph->cus = 8.0e-6;
+        eph->crc = 200.0;  eph->crs = 20.0;
+        eph->cic = 1.0e-7; eph->cis = 1.0e-7;
+        eph->af0 = 1.0e-4; eph->af1 = 1.0e-12; eph->af2 = 0;
+        eph->tgd[0] = 5.0e-9; eph->tgd[1] = 0;
+        eph->A_dot = eph->n_dot = 0;
+        return eph;
+    }
+
+    GloEphemPtr gloEphem(uint32_t prn)
+    {
+        GloEphemPtr geph(new GloEphem());
+        geph->sat = sat_no(SYS_GLO, prn);
+        geph->toe = gpst2time(GNSS_WEEK, GNSS_TOE_TOW);
+        geph->ttr = geph->toe;
+        geph->health = 0;
+        geph->ura = 2.0;
+        geph->iode = 1;
+        geph->freqo = static_cast<int>(prn % 7) - 3;
+        geph->age = 0;
+        // circular orbit of 25510 km at 64.8 deg inclination
+        const double r = 25510e3, v = std::sqrt(3.986004418e14 / r), inc = 64.8 * M_PI / 180.0, u = 0.8 * prn;
+        const Eigen::Vector3d pos(r * std::cos(u), r * std::sin(u) * std::cos(inc), r * std::sin(u) * std::sin(inc));
+        const Eigen::Vector3d vel(-v * std::sin(u), v * std::cos(u) * std::cos(inc), v * std::cos(u) * std::sin(inc));
+        for (int k = 0; k < 3; ++k)
+        {
+            geph->pos[k] = pos(k);
+            geph->vel[k] = vel(k);
+            geph->acc[k] = 0;
+        }
+        geph->tau_n = 1.0e-5;
+        geph->gamma = 1.0e-12;
+        geph->delta_tau_n = 0;
+        return geph;
+    }
+
+    ObsPtr gpsObs(const EphemPtr &eph, const gtime_t &time)
+    {
+        double svdt;
+        const Eigen::Vector3d sv_pos = eph2pos(time, eph, &svdt);
+        ObsPtr obs(new Obs());
+        obs->time = time;
+        obs->sat = eph->sat;
+        obs->freqs = {FREQ1};
+        obs->CN0 = {42.0};
+        obs->LLI = {0};
+        obs->code = {0};
+        obs->psr = {(sv_pos - RECEIVER_ECEF).norm() - svdt * LIGHT_SPEED};
+        obs->psr_std = {0.6};
+        obs->cp = {0};
+        obs->cp_std = {0};
+        obs->dopp = {-1200.0};
+        obs->dopp_std = {0.3};
+        obs->status = {1};
+        return obs;
+    }
+
+    void benchmarkGnss(BenchmarkRunner &runner)
+    {
+        const gtime_t obs_time = time_add(gpst2time(GNSS_WEEK, GNSS_TOE_TOW), 900.0);
+        std::vector<EphemBasePtr> ephems;
+        std::vector<ObsPtr> obs;
+        const int num_sats = 10;
+        for (uint32_t prn = 1; prn <= num_sats; ++prn)
+        {
+            EphemPtr eph = gpsEphem(prn);
+            ephems.push_back(eph);
+            obs.push_back(gpsObs(eph, obs_time));
+        }
+        const std::vector<SatStatePtr> states = sat_states(obs, ephems);
+        std::vector<double> iono_params = {1.1176e-08, -1.4901e-08, -5.9605e-08, 1.1921e-07,
+                                           9.8304e+04, -1.1469e+05, -1.3107e+05, 7.2090e+05};
+        std::vector<std::unique_ptr<GnssPsrDoppFactor>> factors;
+        for (int k = 0; k < num_sats; ++k)
+            factors.emplace_back(new GnssPsrDoppFactor(obs[k], ephems[k], states[k], iono_params, 0.5));
+
+        FrameState state_i, state_j;
+        setFrameState(state_i, 0);
+        setFrameState(state_j, 1);
+        double rcv_dt[1] = {10.0}, rcv_ddt[1] = {0.1}, yaw_diff[1] = {0.3};
+        double anc_ecef[3] = {RECEIVER_ECEF.x(), RECEIVER_ECEF.y(), RECEIVER_ECEF.z()};
+        const std::vector<double *> parameters = {state_i.pose, state_i.speed_bias, state_j.pose, state_j.speed_bias,
+                                                  rcv_dt, rcv_ddt, yaw_diff, anc_ecef};
+        benchmarkEvaluate(runner, "gnss_psr_dopp_factor", *factors[0], parameters);
+
+        // all satellites of an epoch at a new linearization point, as in one ceres iteration
+        std::vector<double> residuals(2);
+        JacobianBuffers jacobians(*factors[0]);
+        runner.run("gnss_psr_dopp_factor/epoch_" + std::to_string(num_sats) + "_sats_jacobian", [&]
+        {
+            state_j.pose[0] += 1e-9;
+            for (const auto &factor : factors)
+                factor->Evaluate(parameters.data(), residuals.data(), jacobians.pointers.data());
+            doNotOptimize(jacobians.storage[0][0]);
+        });
+
+        // orbits over the whole validity of the ephemeris
+        const EphemPtr eph = std::dynamic_pointer_cast<Ephem>(ephems[0]);
+        int step = 0;
+        runner.run("eph2pos", [&]
+        {
+            double svdt;
+            const Eigen::Vector3d pos = eph2pos(time_add(eph->toe, (step++ % 7200) - 3600.0), eph, &svdt);
+            doNotOptimize(pos);
+        });
+        const GloEphemPtr geph = gloEphem(3);
+        step = 0;
+        runner.run("geph2pos", [&]
+        {
+            double svdt;
+            const Eigen::Vector3d pos = geph2pos(time_add(geph->toe, (step++ % 1800) - 900.0), geph, &svdt);
+            doNotOptimize(pos);
+        });
+    }
+
+    /**
+     * MARGIN_OLD 的边缘化问题: 相邻帧之间的 IMUFactor, 以及起始于最老帧的 num_features 个特征到后续帧的 ProjectionFactor,
+     * 与 Estimator::optimization() 加入的结构相同 (不含上一次的先验和 GNSS 因子); 轨迹长度在 2 帧到整个窗口之间
+     */
+    struct MarginalizationProblem
+    {
+        MarginalizationProblem(int window_size, int num_features)
+            : frames(window_size + 1), inv_depths(num_features), track_lengths(num_features), loss(1.0)
+        {
+            std::mt19937 rng(11);
+            std::uniform_int_distribution<int> length(2, window_size + 1);
+            for (int k = 0; k <= window_size; ++k)
+            {
+                setFrameState(frames[k], k);
+                integrations.emplace_back(integrateFrame(simulateFrameImu(k / CAMERA_RATE, rng)));
+            }
+            setExtrinsic(ex_pose);
+            std::uniform_real_distribution<double> coord(-0.4, 0.4), depth(2.0, 20.0);
+            for (int f = 0; f < num_features; ++f)
+            {
+                inv_depths[f][0] = 1.0 / depth(rng);
+                track_lengths[f] = length(rng);
+                points.emplace_back(coord(rng), coord(rng), 1.0);
+            }
+        }
+
+        MarginalizationInfo *build()
+        {
+            MarginalizationInfo *info = new MarginalizationInfo();
+            IMUFactor *imu_factor = info->create<IMUFactor>(integrations[1].get());
+            info->addResidualBlockInfo(info->create<ResidualBlockInfo>(imu_factor, nullptr,
+                std::vector<double *>{frames[0].pose, frames[0].speed_bias, frames[1].pose, frames[1].speed_bias},
+                std::vector<int>{0, 1}));
+            for (size_t f = 0; f < points.size(); ++f)
+            {
+                for (int j = 1; j < track_lengths[f]; ++j)
+                {
+                    const Eigen::Vector3d pts_j = points[f] + Eigen::Vector3d(0.01 * j, -0.005 * j, 0.0);
+                    ProjectionFactor *factor = info->create<ProjectionFactor>(points[f], pts_j);
+                    info->addResidualBlockInfo(info->create<ResidualBlockInfo>(factor, &loss,
+                        std::vector<double *>{frames[0].pose, frames[j].pose, ex_pose, inv_depths[f].data()},
+                        std::vector<int>{0, 3}));
+                }
+            }
+            return info;
+        }
+
+        std::vector<FrameState> frames;
+        std::vector<std::unique_ptr<IntegrationBase>> integrations;
+        double ex_pose[SIZE_POSE];
+        std::vector<std::array<double, SIZE_FEATURE>> inv_depths;
+        std::vector<Eigen::Vector3d> points;
+        std::vector<int> track_lengths;
+        ceres::CauchyLoss loss;
+    };
+
+    void benchmarkMarginalization(BenchmarkRunner &runner)
+    {
+        ProjectionFactor::sqrt_info = FOCAL_LENGTH / 1.5 * Eigen::Matrix2d::Identity();
+        for (int window_size : {5, 10, 20})
+        {
+            for (int num_features : {30, 100, 300})
+            {
+                const std::string suffix = "/w" + std::to_string(window_size) + "_f" + std::to_string(num_features);
+                if (!runner.selected("marginalization/pre_marginalize" + suffix) &&
+                    !runner.selected("marginalization/marginalize" + suffix))
+                    continue;
+                MarginalizationProblem problem(window_size, num_features);
+                // the problem is rebuilt for every call, only the measured step is timed
+                runner.runTimed("marginalization/pre_marginalize" + suffix, [&](size_t n)
+                {
+                    double ms = 0;
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        std::unique_ptr<MarginalizationInfo> info(problem.build());
+                        TicToc t;
+                        info->preMarginalize();
+                        ms += t.toc();
+                    }
+                    return ms;
+                });
+                runner.runTimed("marginalization/marginalize" + suffix, [&](size_t n)
+                {
+                    double ms = 0;
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        std::unique_ptr<MarginalizationInfo> info(problem.build());
+                        info->preMarginalize();
+                        TicToc t;
+                        info->marginalize();
+                        ms += t.toc();
+                    }
+                    return ms;
+                });
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    ACC_N = 0.08; ACC_W = 0.00004;
+    GYR_N = 0.004; GYR_W = 2.0e-6;
+    G = Eigen::Vector3d(0, 0, 9.8);
+    // marginalize() runs on the worker pool like in the estimator, single threaded unless --threads is given
+    int num_threads = 1;
+    for (int i = 1; i + 1 < argc; ++i)
+        if (std::string(argv[i]) == "--threads")
+            num_threads = std::max(1, std::atoi(argv[i + 1]));
+    WorkerPool::instance().setNumThreads(num_threads);
+
+    BenchmarkRunner runner(argc, argv);
+    benchmarkImuFactor(runner);
+    benchmarkIntegration(runner);
+    benchmarkProjectionFactors(runner);
+    benchmarkGnss(runner);
+    benchmarkMarginalization(runner);
+    return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef EPHEM_FIELDS_H
+#define EPHEM_FIELDS_H
+
+#include <gnss_comm/gnss_constant.hpp>
+
+/**
+ * 星历逐字段的序列化顺序, 写和读共用: 对每个字段调用 f(field), 字段均为 POD (gtime_t, 数组);
+ * GLONASS 的轨道积分缓存 (orbit) 不在其中, 首次使用时重建. 用于检查点和共享内存星历 (shared_ephem.h)
+ */
+template <typename Base, typename F> void visitEphemBase(Base &e, F &f)
+{
+    f(e.sat); f(e.ttr); f(e.toe); f(e.health); f(e.ura); f(e.iode);
+}
+
+template <typename GloEphemeris, typename F> void visitGloEphem(GloEphemeris &e, F &f)
+{
+    visitEphemBase(e, f);
+    f(e.freqo); f(e.age); f(e.pos); f(e.vel); f(e.acc); f(e.tau_n); f(e.gamma); f(e.delta_tau_n);
+}
+
+template <typename Ephemeris, typename F> void visitEphem(Ephemeris &e, F &f)
+{
+    visitEphemBase(e, f);
+    f(e.toc); f(e.toe_tow); f(e.week); f(e.iodc); f(e.code);
+    f(e.A); f(e.e); f(e.i0); f(e.omg); f(e.OMG0); f(e.M0); f(e.delta_n); f(e.OMG_dot); f(e.i_dot);
+    f(e.cuc); f(e.cus); f(e.crc); f(e.crs); f(e.cic); f(e.cis);
+    f(e.af0); f(e.af1); f(e.af2); f(e.tgd); f(e.A_dot); f(e.n_dot);
+}
+
+#endif
@@ -0,0 +1,167 @@
+#include "ephem_store.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+namespace
+{
+    typedef std::pair<double, EphemBasePtr> EphemEntry;
+
+    bool toe_less(const EphemEntry &entry, double toe)
+    {
+        return entry.first < toe;
+    }
+}
+
+EphemBasePtr EphemStore::Snapshot::lookup(uint32_t sat, double obs_time, double max_diff) const
+{
+    auto sat_it = sat2ephems.find(sat);
+    if (sat_it == sat2ephems.end() || sat_it->second->empty())
+        return nullptr;
+
+    const EphemList &ephems = *sat_it->second;
+    EphemList::const_iterator upper = std::lower_bound(ephems.begin(), ephems.end(), obs_time, toe_less);
+    EphemList::const_iterator best = ephems.end();
+    double best_diff = max_diff;
+    // on a tie the earlier toe wins, same as the former linear scan
+    if (upper != ephems.begin())
+    {
+        EphemList::const_iterator lower = upper - 1;
+        if (obs_time - lower->first < best_diff)
+        {
+            best_diff = obs_time - lower->first;
+            best = lower;
+        }
+    }
+    if (upper != ephems.end() && upper->first - obs_time < best_diff)
+        best = upper;
+
+    return (best == ephems.end() ? nullptr : best->second);
+}
+
+bool EphemStore::Snapshot::hasSat(uint32_t sat) const
+{
+    auto sat_it = sat2ephems.find(sat);
+    return sat_it != sat2ephems.end() && !sat_it->second->empty();
+}
+
+std::vector<EphemBasePtr> EphemStore::Snapshot::all() const
+{
+    std::vector<EphemBasePtr> ephems;
+    ephems.reserve(num_ephems);
+    for (const auto &sat_ephems : sat2ephems)
+        for (const auto &toe_ephem : *sat_ephems.second)
+            ephems.push_back(toe_ephem.second);
+    return ephems;
+}
+
+EphemStore::Stats EphemStore::Snapshot::stats() const
+{
+    Stats s;
+    s.num_sats = sat2ephems.size();
+    s.num_ephems = num_ephems;
+    s.num_evicted = num_evicted;
+    s.bytes = bytes;
+    return s;
+}
+
+EphemStore::EphemStore()
+{
+    clear();
+}
+
+size_t EphemStore::ephemBytes(const EphemBasePtr &ephem)
+{
+    const size_t object_size = (satsys(ephem->sat, NULL) == SYS_GLO ? sizeof(GloEphem) : sizeof(Ephem));
+    return object_size + sizeof(EphemEntry);
+}
+
+EphemStore::SnapshotPtr EphemStore::snapshot() const
+{
+    return std::atomic_load(&current);
+}
+
+void EphemStore::publish(const std::shared_ptr<Snapshot> &next)
+{
+    next->version = current->version + 1;
+    std::atomic_store(&current, SnapshotPtr(next));
+}
+
+bool EphemStore::add(const EphemBasePtr &ephem)
+{
+    const double toe = time2sec(ephem->toe);
+    std::lock_guard<std::mutex> lk(m_write);
+    auto sat_it = current->sat2ephems.find(ephem->sat);
+    std::shared_ptr<EphemList> ephems(sat_it == current->sat2ephems.end() ? 
+        new EphemList() : new EphemList(*sat_it->second));
+    EphemList::iterator it = std::lower_bound(ephems->begin(), ephems->end(), toe, toe_less);
+    if (it != ephems->end() && it->first == toe)
+        return false;
+    // ephemerides normally arrive in toe order, so this is an append
+    ephems->insert(it, EphemEntry(toe, ephem));
+
+    // only the list of this satellite is copied, the others are shared with the previous snapshot
+    std::shared_ptr<Snapshot> next(new Snapshot(*current));
+    next->sat2ephems[ephem->sat] = ephems;
+    ++next->num_ephems;
+    next->bytes += ephemBytes(ephem);
+    publish(next);
+    return true;
+}
+
+void EphemStore::setIonoParams(const std::vector<double> &iono_params)
+{
+    std::lock_guard<std::mutex> lk(m_write);
+    if (current->iono_params == iono_params)
+        return;
+    std::shared_ptr<Snapshot> next(new Snapshot(*current));
+    next->iono_params = iono_params;
+    publish(next);
+}
+
+size_t EphemStore::evict(double curr_time, double valid_seconds)
+{
+    const double min_toe = curr_time - valid_seconds;
+    size_t num_removed = 0;
+    std::lock_guard<std::mutex> lk(m_write);
+    std::shared_ptr<Snapshot> next;
+    for (const auto &sat_ephems : current->sat2ephems)
+    {
+        const EphemList &ephems = *sat_ephems.second;
+        // toe <= min_toe can never be strictly within valid_seconds of a later observation
+        EphemList::const_iterator keep = std::lower_bound(ephems.begin(), ephems.end(), min_toe, toe_less);
+        if (keep != ephems.end() && keep->first == min_toe)
+            ++keep;
+        if (keep == ephems.begin())
+            continue;
+
+        if (!next)
+            next.reset(new Snapshot(*current));
+        for (EphemList::const_iterator it = ephems.begin(); it != keep; ++it)
+            next->bytes -= ephemBytes(it->second);
+        num_removed += keep - ephems.begin();
+        if (keep == ephems.end())
+            next->sat2ephems.erase(sat_ephems.first);
+        else
+            next->sat2ephems[sat_ephems.first] = std::make_shared<const EphemList>(keep, ephems.end());
+    }
+    if (!next)
+        return 0;
+
+    next->num_ephems -= num_removed;
+    next->num_evicted += num_removed;
+    publish(next);
+    return num_removed;
+}
+
+void EphemStore::clear()
+{
+    std::lock_guard<std::mutex> lk(m_write);
+    std::shared_ptr<Snapshot> next(new Snapshot());
+    next->version = (current ? current->version + 1 : 0);
+    next->num_ephems = 0;
+    next->num_evicted = 0;
+    next->bytes = 0;
+    std::atomic_store(&current, SnapshotPtr(next));
+}
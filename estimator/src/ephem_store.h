@@ -0,0 +1,79 @@
+#ifndef EPHEM_STORE_H
+#define EPHEM_STORE_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <gnss_comm/gnss_constant.hpp>
+#include <gnss_comm/gnss_utility.hpp>
+
+using namespace gnss_comm;
+
+/**
+ * 按卫星存储星历, 每颗卫星的星历按 toe 升序保存, 同时保存最新的广播电离层参数
+ * 内容以不可修改的快照发布 (copy-on-write): 写者 (星历/电离层回调, evict) 复制变化的部分后原子地替换当前快照,
+ * 读者 (process 线程) 每帧取一次快照, 不加锁, 也不会被写者阻塞; 一颗卫星的星历列表在快照之间共享
+ */
+class EphemStore
+{
+  public:
+    struct Stats
+    {
+        size_t num_sats;
+        size_t num_ephems;
+        size_t num_evicted;     // accumulated since the last clear()
+        size_t bytes;           // approximate heap usage of the stored ephemerides
+    };
+
+    typedef std::vector<std::pair<double, EphemBasePtr>> EphemList;
+
+    class Snapshot
+    {
+      public:
+        // ephemeris whose toe is closest to obs_time, nullptr if none is within max_diff seconds
+        EphemBasePtr lookup(uint32_t sat, double obs_time, double max_diff = EPH_VALID_SECONDS) const;
+        bool hasSat(uint32_t sat) const;
+        // every stored ephemeris, by satellite and toe, for checkpoints
+        std::vector<EphemBasePtr> all() const;
+        Stats stats() const;
+
+        uint64_t version;                   // increased by every published change
+        std::vector<double> iono_params;    // empty until parameters are received
+
+      private:
+        friend class EphemStore;
+        std::map<uint32_t, std::shared_ptr<const EphemList>> sat2ephems;
+        size_t num_ephems;
+        size_t num_evicted;
+        size_t bytes;
+    };
+    typedef std::shared_ptr<const Snapshot> SnapshotPtr;
+
+    EphemStore();
+
+    // returns false if an ephemeris with the same toe is already stored for this satellite
+    bool add(const EphemBasePtr &ephem);
+    void setIonoParams(const std::vector<double> &iono_params);
+
+    // drop ephemerides that can no longer be valid for observations at or after curr_time
+    size_t evict(double curr_time, double valid_seconds = EPH_VALID_SECONDS);
+
+    // latest published snapshot, never null
+    SnapshotPtr snapshot() const;
+
+    std::vector<EphemBasePtr> all() const { return snapshot()->all(); }
+    Stats stats() const { return snapshot()->stats(); }
+    void clear();
+
+  private:
+    static size_t ephemBytes(const EphemBasePtr &ephem);
+    void publish(const std::shared_ptr<Snapshot> &next);
+
+    std::mutex m_write;             // serializes the writers, readers never take it
+    SnapshotPtr current;            // only accessed through std::atomic_load/atomic_store
+};
+
+#endif
@@ -1,24 +1,151 @@
 #include "estimator.h"
+#include <gvins_feature_tracker/trace_zones.h>
+#include <gvins_feature_tracker/stage_profiler.h>
+
+// ceres::CUDA as dense_linear_algebra_library_type exists from ceres 2.1 when ceres is built with CUDA
+#if !defined(CERES_NO_CUDA) && defined(CERES_VERSION_MAJOR) && \
+    (CERES_VERSION_MAJOR > 2 || (CERES_VERSION_MAJOR == 2 && CERES_VERSION_MINOR >= 1))
+#define GVINS_CERES_CUDA
+#endif
+
+#ifdef GVINS_TRACE
+// each Ceres iteration as an event on the solver's timeline, with the cost as a plot
+class TraceIterationCallback : public ceres::IterationCallback
+{
+  public:
+    ceres::CallbackReturnType operator()(const ceres::IterationSummary &summary) override
+    {
+        GVINS_TRACE_MESSAGE("ceres iteration");
+        GVINS_TRACE_PLOT("ceres cost", summary.cost);
+        return ceres::SOLVER_CONTINUE;
+    }
+};
+#endif
 
-Estimator::Estimator(): f_manager{Rs}
+Estimator::Estimator(const EstimatorConfig &_config, std::shared_ptr<EphemStore> shared_ephem_store)
+    : config(_config), ephem_store(shared_ephem_store ? shared_ephem_store : std::make_shared<EphemStore>()),
+      owns_ephem_store(!shared_ephem_store), f_manager{Rs, config},
+      solver_deadline("ceres"), marginalization_deadline("marginalization")
 {
-    ROS_INFO("init begins");
+    GVINS_INFO("init begins");
     for (int i = 0; i < WINDOW_SIZE + 1; i++)
         pre_integrations[i] = nullptr;
+    inc_problem = nullptr;
+    inc_loss_function = nullptr;
+    gnss_align_generation = 0;
+    world_generation = 0;
+    relocalizer = nullptr;
+    last_marginalization_info = nullptr;
+    pending_marginalization_info = nullptr;
+    tmp_pre_integration = nullptr;
+    imu_downsampler.setInterval(config.IMU_PREINT_RATE > 0 ? 1.0 / config.IMU_PREINT_RATE : 0.0);
+    discardCheckpoint();
     clearState();
 }
 
+Estimator::~Estimator()
+{
+    // the stages write pending_marginalization_info and the alignment job, or read a snapshot of the state
+    gnss_align_stage.wait();
+    checkpoint_stage.wait();
+    waitMarginalization();
+    for (int i = 0; i < WINDOW_SIZE + 1; i++)
+    {
+        delete pre_integrations[i];
+        pre_integrations[i] = nullptr;
+    }
+    releaseFrameHistory();
+    delete last_marginalization_info;
+    last_marginalization_info = nullptr;
+    resetIncrementalProblem();
+}
+
 void Estimator::setParameter()
 {
     for (int i = 0; i < NUM_OF_CAM; i++)
     {
-        tic[i] = TIC[i];
-        ric[i] = RIC[i];
+        tic[i] = config.TIC[i];
+        ric[i] = config.RIC[i];
     }
     f_manager.setRic(ric);
     ProjectionFactor::sqrt_info = FOCAL_LENGTH / 1.5 * Matrix2d::Identity();
     ProjectionTdFactor::sqrt_info = FOCAL_LENGTH / 1.5 * Matrix2d::Identity();
-    td = TD;
+    ProjectionTrackFactor::packed_evaluation = config.VISUAL_PACKED_EVAL;
+    MarginalizationInfo::gpu_min_size = config.GPU_DENSE ? config.GPU_DENSE_MIN_SIZE : 0;
+    MarginalizationInfo::fixed_partition = config.DETERMINISTIC;
+    setGnssAtmosCacheThres(config.GNSS_ATMOS_CACHE_THRES);
+    td = config.TD;
+    WorkerPool::instance().setNumThreads(config.NUM_WORKER_THREADS, config.MARGINALIZATION_THREADS);
+    if (config.PIPELINE_MARGINALIZATION)
+    {
+        const ThreadConfig marginalization_threads = config.MARGINALIZATION_THREADS;
+        marginalization_stage.submit([marginalization_threads]
+        {
+            applyThreadConfig(marginalization_threads, "marginalization stage");
+            GVINS_TRACE_THREAD("marginalization stage");
+        });
+    }
+    solver_deadline.setDeadline(config.CERES_THREADS.deadline_ms);
+    latency_governor.setTarget(config.LATENCY_TARGET, config.MIN_SOLVER_TIME * 1000.0, config.SOLVER_TIME * 1000.0);
+    marginalization_deadline.setDeadline(config.MARGINALIZATION_THREADS.deadline_ms);
+    solver_watchdog.setLimits(config.SOLVER_DIVERGENCE_RATIO, config.SOLVER_MAX_VELOCITY);
+}
+
+/**
+ * 性能档位只改变求解预算 (SOLVER_TIME, NUM_ITERATIONS) 和 GNSS 卫星的筛选阈值, 都在每帧使用时读取,
+ * 窗口状态不受影响, 不需要重新初始化. 须在两帧之间调用 (节点持 m_estimator)
+ */
+bool Estimator::setPerformanceProfile(const std::string &name)
+{
+    if (!applyPerformanceProfile(name, config))
+        return false;
+    latency_governor.setTarget(config.LATENCY_TARGET, config.MIN_SOLVER_TIME * 1000.0, config.SOLVER_TIME * 1000.0);
+    GVINS_INFO("performance profile %s: max_solver_time %.3f s, max_num_iterations %d, "
+               "gnss_elevation_thres %.1f, gnss_track_num_thres %u", name.c_str(), config.SOLVER_TIME,
+               config.NUM_ITERATIONS, config.GNSS_ELEVATION_THRES, config.GNSS_TRACK_NUM_THRES);
+    return true;
+}
+
+// before ceres::Solve of the window, options.max_solver_time_in_seconds already set
+void Estimator::watchSolver(ceres::Solver::Options &options)
+{
+    solver_watchdog.reset();
+    if (!config.SOLVER_WATCHDOG)
+        return;
+    // the budget stop depends on the wall clock, deterministic runs keep the divergence checks only
+    solver_watchdog.begin(para_SpeedBias, config.DETERMINISTIC ? 0.0 : options.max_solver_time_in_seconds);
+    options.callbacks.push_back(&solver_watchdog);
+    options.update_state_every_iteration = true;
+    std::copy(para_rcv_dt, para_rcv_dt + (WINDOW_SIZE+1)*4, watched_rcv_dt);
+    std::copy(para_rcv_ddt, para_rcv_ddt + WINDOW_SIZE+1, watched_rcv_ddt);
+}
+
+void Estimator::restoreDivergedSolve()
+{
+    std::copy(watched_rcv_dt, watched_rcv_dt + (WINDOW_SIZE+1)*4, para_rcv_dt);
+    std::copy(watched_rcv_ddt, watched_rcv_ddt + WINDOW_SIZE+1, para_rcv_ddt);
+    // Ps/Rs/Vs/..., the depths, yaw and anchor were not written back
+    vector2double();
+}
+
+/**
+ * 帧历史 (all_image_frame 中每帧的特征副本和帧间预积分, tmp_pre_integration) 只有初始化 (SFM, 视觉惯性对齐, 陀螺仪零偏)
+ * 使用, 初始化成功后释放, 之后 processIMU/processImage 不再维护, 直到 clearState 重新开始初始化
+ */
+void Estimator::releaseFrameHistory()
+{
+    for (auto &it : all_image_frame)
+    {
+        if (it.second.pre_integration != nullptr)
+        {
+            delete it.second.pre_integration;
+            it.second.pre_integration = nullptr;
+        }
+    }
+    all_image_frame.clear();
+    if (tmp_pre_integration != nullptr)
+        delete tmp_pre_integration;
+    tmp_pre_integration = nullptr;
 }
 
 void Estimator::clearState()
@@ -33,6 +160,12 @@ void Estimator::clearState()
         dt_buf[i].clear();
         linear_acceleration_buf[i].clear();
         angular_velocity_buf[i].clear();
+        imu_samples_buf[i].clear();
+        // epochs are appended to their frames, a restarted window starts without them
+        gnss_meas_buf[i].clear();
+        gnss_ephem_buf[i].clear();
+        gnss_sat_state_buf[i].clear();
+        gnss_epoch_buf[i].clear();
 
         if (pre_integrations[i] != nullptr)
             delete pre_integrations[i];
@@ -45,14 +178,9 @@ void Estimator::clearState()
         ric[i] = Matrix3d::Identity();
     }
 
-    for (auto &it : all_image_frame)
-    {
-        if (it.second.pre_integration != nullptr)
-        {
-            delete it.second.pre_integration;
-            it.second.pre_integration = nullptr;
-        }
-    }
+    releaseFrameHistory();
+    imu_downsampler.reset();
+    solver_watchdog.reset();
 
     solver_flag = INITIAL;
     first_imu = false,
@@ -61,38 +189,102 @@ void Estimator::clearState()
     frame_count = 0;
     solver_flag = INITIAL;
     initial_timestamp = 0;
-    all_image_frame.clear();
-    td = TD;
+    sfm_warm_centers.clear();
+    sfm_warm_points.clear();
+    td = config.TD;
 
     gnss_ready = false;
+    // an alignment still running in the background belongs to the old trajectory
+    gnss_align_generation++;
     anc_ecef.setZero();
     R_ecef_enu.setIdentity();
     para_yaw_enu_local[0] = 0;
     yaw_enu_local = 0;
-    sat2ephem.clear();
-    sat2time_index.clear();
+    if (owns_ephem_store)
+        ephem_store->clear();
     sat_track_status.clear();
     latest_gnss_iono_params.clear();
-    std::copy(GNSS_IONO_DEFAULT_PARAMS.begin(), GNSS_IONO_DEFAULT_PARAMS.end(), 
+    std::copy(config.GNSS_IONO_DEFAULT_PARAMS.begin(), config.GNSS_IONO_DEFAULT_PARAMS.end(), 
         std::back_inserter(latest_gnss_iono_params));
     diff_t_gnss_local = 0;
+    gnss_binding_time_diff = 0;
+    gnss_selection_pdop = gnss_selection_gdop = 0;
+    num_gnss_psr_rejected = num_gnss_dopp_rejected = 0;
 
     first_optimization = true;
+    num_motion_only_frames = 0;
+    world_generation++;
+    relo_frame_valid = false;
+    map_initialized = false;
+    stereo_failed_time = -1;
 
-    if (tmp_pre_integration != nullptr)
-        delete tmp_pre_integration;
+    waitMarginalization();
     if (last_marginalization_info != nullptr)
         delete last_marginalization_info;
 
-    tmp_pre_integration = nullptr;
     last_marginalization_info = nullptr;
     last_marginalization_parameter_blocks.clear();
 
     f_manager.clearState();
 
+    resetIncrementalProblem();
+
     failure_occur = 0;
 }
 
+void Estimator::resetIncrementalProblem()
+{
+    if (inc_problem != nullptr)
+        delete inc_problem;
+    if (inc_loss_function != nullptr)
+        delete inc_loss_function;
+
+    inc_problem = nullptr;
+    inc_loss_function = nullptr;
+    inc_last_residuals.clear();
+    inc_curr_residuals.clear();
+    inc_volatile_residuals.clear();
+    inc_num_feature_blocks = 0;
+}
+
+// the key encodes the measurement and the window slots a residual is attached to, 
+// a residual from the last frame with the same key and source is kept in the problem
+bool Estimator::reuseResidual(const std::vector<double> &key, const void *source)
+{
+    if (!config.INCREMENTAL_PROBLEM)
+        return false;
+    auto it = inc_last_residuals.find(key);
+    if (it == inc_last_residuals.end() || it->second.source != source)
+        return false;
+    inc_curr_residuals.insert(*it);
+    inc_last_residuals.erase(it);
+    return true;
+}
+
+void Estimator::rememberResidual(const std::vector<double> &key, const void *source, ceres::ResidualBlockId id)
+{
+    if (!config.INCREMENTAL_PROBLEM)
+        return;
+    auto it = inc_curr_residuals.find(key);
+    if (it != inc_curr_residuals.end())
+        inc_volatile_residuals.push_back(it->second.id);    // duplicated key, drop it next frame
+    CachedResidual cached;
+    cached.id = id;
+    cached.source = source;
+    inc_curr_residuals[key] = cached;
+}
+
+void Estimator::pruneStaleResiduals()
+{
+    // residuals of the marginalized frame and of dropped measurements were not reused
+    for (auto &it : inc_last_residuals)
+        inc_problem->RemoveResidualBlock(it.second.id);
+    GVINS_DEBUG("incremental problem: %lu residuals kept, %lu removed", 
+        inc_curr_residuals.size(), inc_last_residuals.size());
+    inc_last_residuals.clear();
+    std::swap(inc_last_residuals, inc_curr_residuals);
+}
+
 void Estimator::processIMU(double dt, const Vector3d &linear_acceleration, const Vector3d &angular_velocity)
 {
     if (!first_imu)
@@ -104,65 +296,112 @@ void Estimator::processIMU(double dt, const Vector3d &linear_acceleration, const
 
     if (!pre_integrations[frame_count])
     {
-        pre_integrations[frame_count] = new IntegrationBase{acc_0, gyr_0, Bas[frame_count], Bgs[frame_count]};
+        pre_integrations[frame_count] = new IntegrationBase{acc_0, gyr_0, Bas[frame_count], Bgs[frame_count], config};
     }
     if (frame_count != 0)
     {
-        pre_integrations[frame_count]->push_back(dt, linear_acceleration, angular_velocity);
-        //if(solver_flag != NON_LINEAR)
-            tmp_pre_integration->push_back(dt, linear_acceleration, angular_velocity);
-
-        dt_buf[frame_count].push_back(dt);
-        linear_acceleration_buf[frame_count].push_back(linear_acceleration);
-        angular_velocity_buf[frame_count].push_back(angular_velocity);
-
-        int j = frame_count;         
-        Vector3d un_acc_0 = Rs[j] * (acc_0 - Bas[j]) - g;
-        Vector3d un_gyr = 0.5 * (gyr_0 + angular_velocity) - Bgs[j];
-        Rs[j] *= Utility::deltaQ(un_gyr * dt).toRotationMatrix();
-        Vector3d un_acc_1 = Rs[j] * (linear_acceleration - Bas[j]) - g;
-        Vector3d un_acc = 0.5 * (un_acc_0 + un_acc_1);
-        Ps[j] += dt * Vs[j] + 0.5 * dt * dt * un_acc;
-        Vs[j] += dt * un_acc;
+        if (!imu_downsampler.enabled())
+            integrateIMU(dt, linear_acceleration, angular_velocity, 0);
+        else if (imu_downsampler.add(dt, acc_0, gyr_0, linear_acceleration, angular_velocity))
+            flushIMU();
     }
     acc_0 = linear_acceleration;
     gyr_0 = angular_velocity;
+
+    if (latest_checkpoint)
+    {
+        ImuSample sample;
+        sample.dt = dt;
+        sample.acc = linear_acceleration;
+        sample.gyr = angular_velocity;
+        checkpoint_imu.push_back(sample);
+    }
+}
+
+// the interval of the samples since the last flush, before the frame they belong to is closed
+void Estimator::flushIMU()
+{
+    double dt;
+    Vector3d acc, gyr;
+    int num_samples;
+    if (imu_downsampler.flush(dt, acc, gyr, num_samples))
+        integrateIMU(dt, acc, gyr, num_samples);
+}
+
+// num_samples as in IntegrationBase::push_back
+void Estimator::integrateIMU(double dt, const Vector3d &linear_acceleration, const Vector3d &angular_velocity,
+                             int num_samples)
+{
+    pre_integrations[frame_count]->push_back(dt, linear_acceleration, angular_velocity, num_samples);
+    if (tmp_pre_integration)
+        tmp_pre_integration->push_back(dt, linear_acceleration, angular_velocity, num_samples);
+
+    dt_buf[frame_count].push_back(dt);
+    linear_acceleration_buf[frame_count].push_back(linear_acceleration);
+    angular_velocity_buf[frame_count].push_back(angular_velocity);
+    imu_samples_buf[frame_count].push_back(num_samples);
+
+    const Vector3d &a_0 = num_samples > 0 ? linear_acceleration : acc_0;
+    const Vector3d &g_0 = num_samples > 0 ? angular_velocity : gyr_0;
+    int j = frame_count;         
+    Vector3d un_acc_0 = Rs[j] * (a_0 - Bas[j]) - g;
+    Vector3d un_gyr = 0.5 * (g_0 + angular_velocity) - Bgs[j];
+    Rs[j] *= Utility::deltaQ(un_gyr * dt).toRotationMatrix();
+    Vector3d un_acc_1 = Rs[j] * (linear_acceleration - Bas[j]) - g;
+    Vector3d un_acc = 0.5 * (un_acc_0 + un_acc_1);
+    Ps[j] += dt * Vs[j] + 0.5 * dt * dt * un_acc;
+    Vs[j] += dt * un_acc;
 }
 
-void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image, const std_msgs::Header &header)
+void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image, const FrameHeader &header)
 {
-    ROS_DEBUG("new image coming ------------------------------------------");
-    ROS_DEBUG("Adding feature points %lu", image.size());
+    GVINS_TRACE_ZONE("processImage");
+    GVINS_DEBUG("new image coming ------------------------------------------");
+    GVINS_DEBUG("Adding feature points %lu", image.size());
+    flushIMU();
     if (f_manager.addFeatureCheckParallax(frame_count, image, td))
         marginalization_flag = MARGIN_OLD;
     else
         marginalization_flag = MARGIN_SECOND_NEW;
 
-    ROS_DEBUG("this frame is--------------------%s", marginalization_flag ? "reject" : "accept");
-    ROS_DEBUG("%s", marginalization_flag ? "Non-keyframe" : "Keyframe");
-    ROS_DEBUG("Solving %d", frame_count);
-    ROS_DEBUG("number of feature: %d", f_manager.getFeatureCount());
+    GVINS_DEBUG("this frame is--------------------%s", marginalization_flag ? "reject" : "accept");
+    GVINS_DEBUG("%s", marginalization_flag ? "Non-keyframe" : "Keyframe");
+    GVINS_DEBUG("Solving %d", frame_count);
+    GVINS_DEBUG("number of feature: %d", f_manager.getFeatureCount());
     Headers[frame_count] = header;
 
-    ImageFrame imageframe(image, header.stamp.toSec());
-    imageframe.pre_integration = tmp_pre_integration;
-    all_image_frame.insert(make_pair(header.stamp.toSec(), imageframe));
-    tmp_pre_integration = new IntegrationBase{acc_0, gyr_0, Bas[frame_count], Bgs[frame_count]};
+    // the new frame bounds the later epochs of the one before it; a new time difference moves every epoch
+    const bool rebind_all = gnss_binding_time_diff != diff_t_gnss_local;
+    gnss_binding_time_diff = diff_t_gnss_local;
+    for (int i = rebind_all ? 0 : std::max(frame_count - 1, 0); i <= frame_count; i++)
+        bindGNSSEpochs(i, frame_count);
 
-    if(ESTIMATE_EXTRINSIC == 2)
+    // the frame history is only used by the initialization
+    if (solver_flag == INITIAL)
+    {
+        ImageFrame imageframe(image, header.stamp.toSec());
+        imageframe.pre_integration = tmp_pre_integration;
+        all_image_frame.insert(make_pair(header.stamp.toSec(), imageframe));
+        tmp_pre_integration = new IntegrationBase{acc_0, gyr_0, Bas[frame_count], Bgs[frame_count], config};
+    }
+
+    if (solver_flag == INITIAL && config.STEREO_INIT)
+        stereoInitFrame(header.stamp.toSec());
+
+    if(config.ESTIMATE_EXTRINSIC == 2)
     {
-        ROS_INFO("calibrating extrinsic param, rotation movement is needed");
+        GVINS_INFO("calibrating extrinsic param, rotation movement is needed");
         if (frame_count != 0)
         {
             vector<pair<Vector3d, Vector3d>> corres = f_manager.getCorresponding(frame_count - 1, frame_count);
             Matrix3d calib_ric;
             if (initial_ex_rotation.CalibrationExRotation(corres, pre_integrations[frame_count]->delta_q, calib_ric))
             {
-                ROS_WARN("initial extrinsic rotation calib success");
-                ROS_WARN_STREAM("initial extrinsic rotation: " << endl << calib_ric);
+                GVINS_WARN("initial extrinsic rotation calib success");
+                GVINS_WARN_STREAM("initial extrinsic rotation: " << endl << calib_ric);
                 ric[0] = calib_ric;
-                RIC[0] = calib_ric;
-                ESTIMATE_EXTRINSIC = 1;
+                config.RIC[0] = calib_ric;
+                config.ESTIMATE_EXTRINSIC = 1;
             }
         }
     }
@@ -172,7 +411,7 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
         if (frame_count == WINDOW_SIZE)
         {
             bool result = false;
-            if( ESTIMATE_EXTRINSIC != 2 && (header.stamp.toSec() - initial_timestamp) > 0.1)
+            if( config.ESTIMATE_EXTRINSIC != 2 && (header.stamp.toSec() - initial_timestamp) > 0.1)
             {
                 result = initialStructure();
                 initial_timestamp = header.stamp.toSec();
@@ -183,7 +422,8 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
                 solveOdometry();
                 slideWindow();
                 f_manager.removeFailures();
-                ROS_INFO("Initialization finish!");
+                releaseFrameHistory();
+                GVINS_INFO("Initialization finish!");
                 last_R = Rs[WINDOW_SIZE];
                 last_P = Ps[WINDOW_SIZE];
                 last_R0 = Rs[0];
@@ -202,22 +442,33 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
     {
         TicToc t_solve;
         solveOdometry();
-        ROS_DEBUG("solver costs: %fms", t_solve.toc());
+        GVINS_DEBUG("solver costs: %fms", t_solve.toc());
+        if (config.GNSS_ENABLE && config.GNSS_ATMOS_CACHE_THRES > 0)
+        {
+            const GnssAtmosCacheStats atmos_stats = takeGnssAtmosCacheStats();
+            GVINS_DEBUG("atmospheric delay cache: %lu hits, %lu misses", atmos_stats.hits, atmos_stats.misses);
+        }
 
         if (failureDetection())
         {
-            ROS_WARN("failure detection!");
+            GVINS_WARN("failure detection!");
             failure_occur = 1;
+            if (resumeFromCheckpoint())
+            {
+                GVINS_WARN("resumed from the checkpoint at %f", latest_checkpoint_time);
+                return;
+            }
+            discardCheckpoint();
             clearState();
             setParameter();
-            ROS_WARN("system reboot!");
+            GVINS_WARN("system reboot!");
             return;
         }
 
         TicToc t_margin;
         slideWindow();
         f_manager.removeFailures();
-        ROS_DEBUG("marginalization costs: %fms", t_margin.toc());
+        GVINS_DEBUG("marginalization costs: %fms", t_margin.toc());
         key_poses.clear();
         for (int i = 0; i <= WINDOW_SIZE; i++)
             key_poses.push_back(Ps[i]);
@@ -226,27 +477,25 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
         last_P = Ps[WINDOW_SIZE];
         last_R0 = Rs[0];
         last_P0 = Ps[0];
+
+        const double t = header.stamp.toSec() + td;
+        if (config.CHECKPOINT_INTERVAL > 0 && t >= next_checkpoint_time)
+            takeCheckpoint(t);
     }
 }
 
 void Estimator::inputEphem(EphemBasePtr ephem_ptr)
 {
-    double toe = time2sec(ephem_ptr->toe);
-    // if a new ephemeris comes
-    if (sat2time_index.count(ephem_ptr->sat) == 0 || sat2time_index.at(ephem_ptr->sat).count(toe) == 0)
-    {
-        sat2ephem[ephem_ptr->sat].emplace_back(ephem_ptr);
-        sat2time_index[ephem_ptr->sat].emplace(toe, sat2ephem.at(ephem_ptr->sat).size()-1);
-    }
+    // duplicated toe is ignored inside the store
+    ephem_store->add(ephem_ptr);
 }
 
 void Estimator::inputIonoParams(double ts, const std::vector<double> &iono_params)
 {
     if (iono_params.size() != 8)    return;
 
-    // update ionosphere parameters
-    latest_gnss_iono_params.clear();
-    std::copy(iono_params.begin(), iono_params.end(), std::back_inserter(latest_gnss_iono_params));
+    // published to the store, processGNSS picks it up on the process thread
+    ephem_store->setIonoParams(iono_params);
 }
 
 void Estimator::inputGNSSTimeDiff(const double t_diff)
@@ -254,17 +503,78 @@ void Estimator::inputGNSSTimeDiff(const double t_diff)
     diff_t_gnss_local = t_diff;
 }
 
+/**
+ * @brief 等待超时之后才到达的 GNSS 观测: 对应的帧已先行处理, 如果它仍在窗口中, 则把历元补到 (时间上) 最近的帧,
+ *        下一次优化加入它的因子
+ * 
+ * @param gnss_meas 一个历元的观测
+ * @param max_delay 历元与帧 (GNSS 时间) 的最大时间差
+ * @return 是否找到了对应的帧
+ */
+bool Estimator::processLateGNSS(const std::vector<ObsPtr> &gnss_meas, double max_delay)
+{
+    if (gnss_meas.empty())
+        return false;
+    const double gnss_ts = time2sec(gnss_meas.front()->time);
+    // slot frame_count is the frame about to be added
+    int frame = -1;
+    double min_delay = max_delay;
+    for (int i = 0; i < frame_count; ++i)
+    {
+        const double delay = std::abs(Headers[i].stamp.toSec() + diff_t_gnss_local - gnss_ts);
+        if (delay < min_delay)
+        {
+            frame = i;
+            min_delay = delay;
+        }
+    }
+    if (frame < 0)
+        return false;
+    for (const GnssEpochBinding &epoch : gnss_epoch_buf[frame])
+    {
+        if (epoch.gnss_ts == gnss_ts)
+            return true;    // already there
+    }
+    processGNSS(gnss_meas, frame);
+    bindGNSSEpochs(frame, frame_count - 1);
+    return true;
+}
+
 /**
  * @brief  输入当前帧图像匹配的gnss观测信息，进行处理后放到estimator的类成员变量中
  * 
  * @note 注意这里面会根据一些规则对接受到的卫星观测信息进行过滤，只会使用那种满足要求（比如比较稳定）的观测
  * 
  * @param gnss_meas 
+ * @param frame     窗口中的帧, 通常是正在加入的 frame_count
  */
-void Estimator::processGNSS(const std::vector<ObsPtr> &gnss_meas)
+void Estimator::processGNSS(const std::vector<ObsPtr> &gnss_meas, int frame)
 {
+    GVINS_TRACE_ZONE("processGNSS");
     std::vector<ObsPtr> valid_meas;
     std::vector<EphemBasePtr> valid_ephems;
+    std::vector<SatStatePtr> valid_sat_states;
+    std::vector<double> valid_weights;
+    std::vector<ObsPtr> tracked_meas;
+    std::vector<EphemBasePtr> tracked_ephems;
+    std::vector<double> tracked_weights;
+
+    // 删除对当前及之后的观测已不可能有效的星历, 避免长时间运行时无限增长
+    if (owns_ephem_store && !gnss_meas.empty() && ephem_store->evict(time2sec(gnss_meas.front()->time)) > 0)
+    {
+        const EphemStore::Stats ephem_stats = ephem_store->stats();
+        GVINS_DEBUG("ephemeris store: %lu sats, %lu ephems, %lu evicted, %lu KB", ephem_stats.num_sats, 
+            ephem_stats.num_ephems, ephem_stats.num_evicted, ephem_stats.bytes / 1024);
+    }
+
+    // 每帧取一次星历/电离层快照, 回调线程之后发布的内容不影响本帧.
+    // 电离层参数只在 process 线程更新, 优化中因子引用的 latest_gnss_iono_params 不会被并发修改
+    const EphemStore::SnapshotPtr gnss_snapshot = ephem_store->snapshot();
+    if (!gnss_snapshot->iono_params.empty() && gnss_snapshot->iono_params != latest_gnss_iono_params)
+    {
+        latest_gnss_iono_params = gnss_snapshot->iono_params;
+        GVINS_DEBUG("ionosphere parameters updated (snapshot %lu)", gnss_snapshot->version);
+    }
 
     // 遍历所有的卫星观测信息
     for (auto obs : gnss_meas)
@@ -276,7 +586,7 @@ void Estimator::processGNSS(const std::vector<ObsPtr> &gnss_meas)
             continue;
 
         // if not got cooresponding ephemeris yet
-        if (sat2ephem.count(obs->sat) == 0)
+        if (!gnss_snapshot->hasSat(obs->sat))
             continue;
         
         if (obs->freqs.empty())    continue;       // no valid signal measurement
@@ -285,28 +595,17 @@ void Estimator::processGNSS(const std::vector<ObsPtr> &gnss_meas)
         if (freq_idx < 0)   continue;              // no L1 observation
         
         double obs_time = time2sec(obs->time);
-        std::map<double, size_t> time2index = sat2time_index.at(obs->sat);
-        double ephem_time = EPH_VALID_SECONDS;
-        size_t ephem_index = -1;
-        for (auto ti : time2index)
-        {
-            if (std::abs(ti.first - obs_time) < ephem_time)
-            {
-                ephem_time = std::abs(ti.first - obs_time);
-                ephem_index = ti.second;
-            }
-        }
-        if (ephem_time >= EPH_VALID_SECONDS)
+        const EphemBasePtr best_ephem = gnss_snapshot->lookup(obs->sat, obs_time);
+        if (!best_ephem)
         {
             cerr << "ephemeris not valid anymore\n";
             continue;
         }
-        const EphemBasePtr &best_ephem = sat2ephem.at(obs->sat).at(ephem_index);
 
         // filter by tracking status
         LOG_IF(FATAL, freq_idx < 0) << "No L1 observation found.\n";
-        if (obs->psr_std[freq_idx]  > GNSS_PSR_STD_THRES ||
-            obs->dopp_std[freq_idx] > GNSS_DOPP_STD_THRES)
+        if (obs->psr_std[freq_idx]  > config.GNSS_PSR_STD_THRES ||
+            obs->dopp_std[freq_idx] > config.GNSS_DOPP_STD_THRES)
         {
             sat_track_status[obs->sat] = 0;
             continue;
@@ -317,32 +616,336 @@ void Estimator::processGNSS(const std::vector<ObsPtr> &gnss_meas)
                 sat_track_status[obs->sat] = 0;
             ++ sat_track_status[obs->sat];
         }
-        if (sat_track_status[obs->sat] < GNSS_TRACK_NUM_THRES)
+        if (sat_track_status[obs->sat] < config.GNSS_TRACK_NUM_THRES)
             continue;           // not being tracked for enough epochs
 
+        tracked_meas.push_back(obs);
+        tracked_ephems.push_back(best_ephem);
+        tracked_weights.push_back(1.0 / (obs->psr_std[freq_idx] * obs->psr_std[freq_idx] + 
+            obs->dopp_std[freq_idx] * obs->dopp_std[freq_idx]));
+    }
+
+    // satellite states at signal transmission time, evaluated for the whole epoch at once
+    // and kept for the whole window life
+    const std::vector<SatStatePtr> tracked_sat_states = sat_states(tracked_meas, tracked_ephems);
+    for (size_t i = 0; i < tracked_meas.size(); ++i)
+    {
         // filter by elevation angle
         if (gnss_ready)
         {
-            Eigen::Vector3d sat_ecef;
-            if (sys == SYS_GLO)
-                sat_ecef = geph2pos(obs->time, std::dynamic_pointer_cast<GloEphem>(best_ephem), NULL);
-            else
-                sat_ecef = eph2pos(obs->time, std::dynamic_pointer_cast<Ephem>(best_ephem), NULL);
             double azel[2] = {0, M_PI/2.0};
-            sat_azel(ecef_pos, sat_ecef, azel);
-            if (azel[1] < GNSS_ELEVATION_THRES*M_PI/180.0)
+            sat_azel(ecef_pos, tracked_sat_states[i]->pos, azel);
+            if (azel[1] < config.GNSS_ELEVATION_THRES*M_PI/180.0)
                 continue;
         }
-        valid_meas.push_back(obs);
-        valid_ephems.push_back(best_ephem);
+        valid_meas.push_back(tracked_meas[i]);
+        valid_ephems.push_back(tracked_ephems[i]);
+        valid_sat_states.push_back(tracked_sat_states[i]);
+        valid_weights.push_back(tracked_weights[i]);
+    }
+
+    // 与 IMU 预测的状态不一致的伪距/多普勒在构造因子之前剔除, 同样需要接收机位置
+    if (gnss_ready && (config.GNSS_PSR_OUTLIER_THRES > 0 || config.GNSS_DOPP_OUTLIER_THRES > 0) && !valid_meas.empty())
+    {
+        const Eigen::Matrix3d R_ecef_local = R_ecef_enu * Eigen::AngleAxisd(yaw_enu_local, Eigen::Vector3d::UnitZ());
+        const Eigen::Vector3d pred_ecef = anc_ecef + R_ecef_local * Ps[frame];
+        const GnssScreening screening = screenOutliers(pred_ecef, R_ecef_local * Vs[frame], valid_meas,
+            valid_sat_states, latest_gnss_iono_params, config.GNSS_PSR_OUTLIER_THRES, config.GNSS_DOPP_OUTLIER_THRES);
+        if (screening.indices.size() < valid_meas.size())
+        {
+            std::vector<ObsPtr> screened_meas;
+            std::vector<EphemBasePtr> screened_ephems;
+            std::vector<SatStatePtr> screened_sat_states;
+            std::vector<double> screened_weights;
+            for (size_t i : screening.indices)
+            {
+                screened_meas.push_back(valid_meas[i]);
+                screened_ephems.push_back(valid_ephems[i]);
+                screened_sat_states.push_back(valid_sat_states[i]);
+                screened_weights.push_back(valid_weights[i]);
+            }
+            GVINS_DEBUG("GNSS screening: rejected %lu pseudoranges and %lu Dopplers of %lu satellites",
+                screening.num_psr_rejected, screening.num_dopp_rejected, valid_meas.size());
+            valid_meas.swap(screened_meas);
+            valid_ephems.swap(screened_ephems);
+            valid_sat_states.swap(screened_sat_states);
+            valid_weights.swap(screened_weights);
+        }
+        num_gnss_psr_rejected += screening.num_psr_rejected;
+        num_gnss_dopp_rejected += screening.num_dopp_rejected;
+    }
+
+    // 卫星过多时只保留几何构型最好的子集, 需要接收机位置, GNSS 初始化之前全部保留
+    if (gnss_ready && config.GNSS_MAX_SATS > 0 && valid_meas.size() > config.GNSS_MAX_SATS)
+    {
+        std::vector<Eigen::Vector3d> sat_pos;
+        std::vector<uint32_t> sat_sys;
+        for (size_t i = 0; i < valid_meas.size(); ++i)
+        {
+            sat_pos.push_back(valid_sat_states[i]->pos);
+            sat_sys.push_back(satsys(valid_meas[i]->sat, NULL));
+        }
+        const GnssSelection selection = selectSatellites(ecef_pos, sat_pos, sat_sys, valid_weights, config.GNSS_MAX_SATS);
+        std::vector<ObsPtr> selected_meas;
+        std::vector<EphemBasePtr> selected_ephems;
+        std::vector<SatStatePtr> selected_sat_states;
+        for (size_t i : selection.indices)
+        {
+            selected_meas.push_back(valid_meas[i]);
+            selected_ephems.push_back(valid_ephems[i]);
+            selected_sat_states.push_back(valid_sat_states[i]);
+        }
+        GVINS_DEBUG("GNSS selection: %lu of %lu satellites, weighted PDOP %f (all %f), GDOP %f", 
+            selection.indices.size(), valid_meas.size(), selection.pdop, selection.full_pdop, selection.gdop);
+        gnss_selection_pdop = selection.pdop;
+        gnss_selection_gdop = selection.gdop;
+        valid_meas.swap(selected_meas);
+        valid_ephems.swap(selected_ephems);
+        valid_sat_states.swap(selected_sat_states);
     }
     
-    gnss_meas_buf[frame_count] = valid_meas;
-    gnss_ephem_buf[frame_count] = valid_ephems;
+    if (valid_meas.empty())
+        return;
+    // bound once the frame's neighbours are known (processImage), or at once for a frame already in the window
+    GnssEpochBinding epoch;
+    epoch.gnss_ts = time2sec(valid_meas.front()->time);
+    epoch.begin = static_cast<uint32_t>(gnss_meas_buf[frame].size());
+    epoch.end = epoch.begin + static_cast<uint32_t>(valid_meas.size());
+    epoch.lower_offset = 0;
+    epoch.ts_ratio = 1.0;
+    gnss_epoch_buf[frame].push_back(epoch);
+    gnss_meas_buf[frame].insert(gnss_meas_buf[frame].end(), valid_meas.begin(), valid_meas.end());
+    gnss_ephem_buf[frame].insert(gnss_ephem_buf[frame].end(), valid_ephems.begin(), valid_ephems.end());
+    gnss_sat_state_buf[frame].insert(gnss_sat_state_buf[frame].end(), valid_sat_states.begin(), valid_sat_states.end());
+}
+
+/**
+ * 历元 (本地时间) 在帧之前时与前一帧插值, 之后时与后一帧插值; 第一帧之前和最新的帧 newest 之后外推
+ * 只依赖相邻两帧的时间戳, 帧不变时绑定不变
+ */
+void Estimator::bindGNSSEpochs(int frame, int newest)
+{
+    if (frame < 0 || newest < 1)
+        return;     // nothing to interpolate between yet
+    const double frame_ts = Headers[frame].stamp.toSec();
+    for (GnssEpochBinding &epoch : gnss_epoch_buf[frame])
+    {
+        const double obs_local_ts = epoch.gnss_ts - diff_t_gnss_local;
+        const int lower = std::min(std::max(frame_ts > obs_local_ts ? frame - 1 : frame, 0), newest - 1);
+        const double lower_ts = Headers[lower].stamp.toSec();
+        const double upper_ts = Headers[lower+1].stamp.toSec();
+        epoch.lower_offset = lower - frame;
+        epoch.ts_ratio = (upper_ts-obs_local_ts) / (upper_ts-lower_ts);
+    }
+}
+
+int Estimator::nearestGNSSEpoch(int frame) const
+{
+    const double frame_gnss_ts = Headers[frame].stamp.toSec() + diff_t_gnss_local;
+    int nearest = -1;
+    for (int k = 0; k < static_cast<int>(gnss_epoch_buf[frame].size()); ++k)
+    {
+        if (nearest < 0 || std::abs(gnss_epoch_buf[frame][k].gnss_ts - frame_gnss_ts) <
+                           std::abs(gnss_epoch_buf[frame][nearest].gnss_ts - frame_gnss_ts))
+            nearest = k;
+    }
+    return nearest;
+}
+
+/**
+ * 已知区域的初始化: 窗口中每一帧都在加载的关键帧地图中 PnP 定位成功时, 直接取地图系 (重力对齐, 有锚点时即其 ENU 系)
+ * 中的位姿作为初值, 速度由相邻帧的位置和预积分求出, 不需要 SFM 和尺度/重力的求解; 有 GNSS 锚点时 GNSS-VI 对齐
+ * 只需要估计接收机钟差, 不再依赖运动
+ */
+bool Estimator::mapInitialStructure()
+{
+    if (!relocalizer || !relocalizer->hasMap())
+        return false;
+    Matrix3d R_c[WINDOW_SIZE + 1];
+    Vector3d P_c[WINDOW_SIZE + 1];
+    // newest first, fails fast outside the map
+    for (int i = WINDOW_SIZE; i >= 0; i--)
+    {
+        std::vector<int> feature_ids;
+        std::vector<Vector2d, Eigen::aligned_allocator<Vector2d>> observations;
+        for (const FeaturePerId &it_per_id : f_manager.feature)
+        {
+            const int offset = i - it_per_id.start_frame;
+            if (offset < 0 || offset >= static_cast<int>(it_per_id.feature_per_frame.size()))
+                continue;
+            const Vector3d &obs = it_per_id.feature_per_frame[offset].point;
+            feature_ids.push_back(it_per_id.feature_id);
+            observations.push_back(Vector2d(obs.x(), obs.y()));
+        }
+        if (!relocalizer->localize(Headers[i].stamp, feature_ids, observations, R_c[i], P_c[i]))
+        {
+            GVINS_DEBUG("frame %d is not localized in the keyframe map", i);
+            return false;
+        }
+    }
+
+    g = config.G;
+    for (int i = 0; i <= WINDOW_SIZE; i++)
+    {
+        Rs[i] = R_c[i] * ric[0].transpose();
+        Ps[i] = P_c[i] - Rs[i] * tic[0];
+    }
+    velocitiesFromPoses();
+
+    // depths of the metric poses, triangulated again by solveOdometry
+    VectorXd dep = f_manager.getDepthVector();
+    for (int i = 0; i < dep.size(); i++)
+        dep[i] = -1;
+    f_manager.clearDepth(dep);
+
+    map_initialized = true;
+    relocalizer->setMapAlignment(world_generation, Matrix3d::Identity(), Vector3d::Zero());
+    Vector3d map_anc_ecef;
+    Matrix3d map_R_ecef_enu;
+    if (config.GNSS_ENABLE && relocalizer->mapAnchor(map_anc_ecef, map_R_ecef_enu))
+    {
+        anc_ecef = map_anc_ecef;
+        R_ecef_enu = map_R_ecef_enu;
+        yaw_enu_local = 0;
+        para_yaw_enu_local[0] = 0;
+    }
+    GVINS_INFO("initialized from the keyframe map");
+    return true;
+}
+
+void Estimator::velocitiesFromPoses()
+{
+    // P_j = P_i + V_i dt - 1/2 g dt^2 + R_i alpha, V_j = V_i - g dt + R_i beta
+    for (int i = 0; i < WINDOW_SIZE; i++)
+    {
+        const IntegrationBase *pre_integration = pre_integrations[i + 1];
+        const double dt = pre_integration->sum_dt;
+        Vs[i] = (Ps[i + 1] - Ps[i] + 0.5 * g * dt * dt - Rs[i] * pre_integration->delta_p) / dt;
+    }
+    const IntegrationBase *last_integration = pre_integrations[WINDOW_SIZE];
+    Vs[WINDOW_SIZE] = Vs[WINDOW_SIZE - 1] - g * last_integration->sum_dt +
+                      Rs[WINDOW_SIZE - 1] * last_integration->delta_v;
+}
+
+/**
+ * 双目初始化的一帧: 特征的深度由其起始帧的双目观测三角化 (窗口滑动后起始帧会变, 每帧重新计算), 最新帧的位姿由这些
+ * 特征 PnP 求出 (以预积分的旋转和上一帧的位置为初值); 第一帧的位置为原点, 姿态由加速度计对齐重力, yaw 为 0
+ */
+void Estimator::stereoInitFrame(double t)
+{
+    GVINS_TRACE_ZONE("stereoInitFrame");
+    // camera 1 in the frame of camera 0
+    const Matrix3d R_lr = ric[0].transpose() * ric[1];
+    const Vector3d t_lr = ric[0].transpose() * (tic[1] - tic[0]);
+    Eigen::Matrix<double, 3, 4> pose_l, pose_r;
+    pose_l.leftCols<3>().setIdentity();
+    pose_l.rightCols<1>().setZero();
+    pose_r.leftCols<3>() = R_lr.transpose();
+    pose_r.rightCols<1>() = -R_lr.transpose() * t_lr;
+    for (FeaturePerId &it_per_id : f_manager.feature)
+    {
+        const FeaturePerFrame &first = it_per_id.feature_per_frame[0];
+        it_per_id.estimated_depth = -1;
+        if (!first.is_stereo)
+            continue;
+        Matrix4d A;
+        A.row(0) = first.point.x() * pose_l.row(2) - pose_l.row(0);
+        A.row(1) = first.point.y() * pose_l.row(2) - pose_l.row(1);
+        A.row(2) = first.point_right.x() * pose_r.row(2) - pose_r.row(0);
+        A.row(3) = first.point_right.y() * pose_r.row(2) - pose_r.row(1);
+        const Vector4d X = A.jacobiSvd(Eigen::ComputeFullV).matrixV().rightCols<1>();
+        const double depth = X(2) / X(3);
+        if (depth > 0.1 && depth < config.STEREO_MAX_DEPTH)
+            it_per_id.estimated_depth = depth;
+    }
+
+    if (frame_count == 0)
+    {
+        Rs[0] = Utility::g2R(acc_0);
+        Ps[0].setZero();
+        Vs[0].setZero();
+    }
+    else
+    {
+        vector<cv::Point3f> pts_3_vector;
+        vector<cv::Point2f> pts_2_vector;
+        for (const FeaturePerId &it_per_id : f_manager.feature)
+        {
+            const int offset = frame_count - it_per_id.start_frame;
+            if (it_per_id.estimated_depth < 0 || offset <= 0 ||
+                offset >= static_cast<int>(it_per_id.feature_per_frame.size()))
+                continue;
+            const int i = it_per_id.start_frame;
+            const Vector3d pts_c = it_per_id.feature_per_frame[0].point * it_per_id.estimated_depth;
+            const Vector3d pts_w = Rs[i] * (ric[0] * pts_c + tic[0]) + Ps[i];
+            const Vector3d &obs = it_per_id.feature_per_frame[offset].point;
+            pts_3_vector.push_back(cv::Point3f(pts_w.x(), pts_w.y(), pts_w.z()));
+            pts_2_vector.push_back(cv::Point2f(obs.x(), obs.y()));
+        }
+
+        // Rs[frame_count] is not propagated before the window is initialized
+        const Matrix3d R_guess = Rs[frame_count - 1] * pre_integrations[frame_count]->delta_q.toRotationMatrix();
+        const Matrix3d R_cw_guess = (R_guess * ric[0]).transpose();
+        const Vector3d t_cw_guess = -R_cw_guess * (Ps[frame_count - 1] + R_guess * tic[0]);
+        cv::Mat r, rvec, tvec, tmp_r;
+        cv::eigen2cv(R_cw_guess, tmp_r);
+        cv::Rodrigues(tmp_r, rvec);
+        cv::eigen2cv(t_cw_guess, tvec);
+        cv::Mat K = (cv::Mat_<double>(3, 3) << 1, 0, 0, 0, 1, 0, 0, 0, 1);
+        vector<int> inliers;
+        if (pts_3_vector.size() < 10 ||
+            !cv::solvePnPRansac(pts_3_vector, pts_2_vector, K, cv::Mat(), rvec, tvec, true, 100,
+                                3.0 / FOCAL_LENGTH, 0.99, inliers) ||
+            inliers.size() < 10)
+        {
+            GVINS_DEBUG("stereo initialization: frame %d not localized (%lu points)", frame_count,
+                        static_cast<unsigned long>(pts_3_vector.size()));
+            stereo_failed_time = t;
+            Rs[frame_count] = R_guess;
+            Ps[frame_count] = Ps[frame_count - 1];
+            return;
+        }
+        cv::Rodrigues(rvec, r);
+        Matrix3d R_cw;
+        Vector3d t_cw;
+        cv::cv2eigen(r, R_cw);
+        cv::cv2eigen(tvec, t_cw);
+        Rs[frame_count] = R_cw.transpose() * ric[0].transpose();
+        Ps[frame_count] = -R_cw.transpose() * t_cw - Rs[frame_count] * tic[0];
+    }
+    ImageFrame &frame = all_image_frame.at(t);
+    frame.R = Rs[frame_count];
+    frame.T = Ps[frame_count];
+}
+
+/**
+ * 双目初始化: 窗口中每一帧 (及其间被丢弃的帧) 都由 stereoInitFrame 定位时直接取其位姿, 位姿已是重力对齐的米制位姿,
+ * 只需由相邻帧的旋转求陀螺仪零偏, 再由位置和预积分求速度; 不依赖 SFM 所需的视差, 窗口填满即可初始化
+ */
+bool Estimator::stereoInitialStructure()
+{
+    if (!config.STEREO_INIT || Headers[0].stamp.toSec() <= stereo_failed_time)
+        return false;
+    solveGyroscopeBias(all_image_frame, Bgs);
+    for (int i = 0; i <= WINDOW_SIZE; i++)
+        pre_integrations[i]->repropagate(Vector3d::Zero(), Bgs[i]);
+    g = config.G;
+    velocitiesFromPoses();
+    for (auto &frame : all_image_frame)
+        frame.second.is_key_frame = false;
+    for (int i = 0; i <= WINDOW_SIZE; i++)
+        all_image_frame.at(Headers[i].stamp.toSec()).is_key_frame = true;
+    GVINS_INFO("initialized from the stereo depth");
+    return true;
 }
 
 bool Estimator::initialStructure()
 {
+    GVINS_TRACE_ZONE("initialStructure");
+    if (mapInitialStructure())
+        return true;
+    if (stereoInitialStructure())
+        return true;
     TicToc t_sfm;
     //check imu observibility
     {
@@ -365,10 +968,10 @@ bool Estimator::initialStructure()
             //cout << "frame g " << tmp_g.transpose() << endl;
         }
         var = sqrt(var / ((int)all_image_frame.size() - 1));
-        //ROS_WARN("IMU variation %f!", var);
+        //GVINS_WARN("IMU variation %f!", var);
         if(var < 0.25)
         {
-            ROS_INFO("IMU excitation not enough!");
+            GVINS_INFO("IMU excitation not enough!");
             //return false;
         }
     }
@@ -396,18 +999,35 @@ bool Estimator::initialStructure()
     int l;
     if (!relativePose(relative_R, relative_T, l))
     {
-        ROS_INFO("Not enough features or parallax; Move device around");
+        GVINS_INFO("Not enough features or parallax; Move device around");
         return false;
     }
+    // 上一次 SFM 成功但与 IMU 对齐失败时, 用它的结果作为本次 BA 的初值
+    SFMPrior sfm_prior;
+    for (int i = 0; i <= frame_count; i++)
+    {
+        auto center_it = sfm_warm_centers.find(Headers[i].stamp.toSec());
+        if (center_it != sfm_warm_centers.end())
+            sfm_prior.centers[i] = center_it->second;
+    }
+    sfm_prior.points.swap(sfm_warm_points);
     GlobalSFM sfm;
+    if (config.DETERMINISTIC)
+        sfm.max_solver_time = 1e9;
     if(!sfm.construct(frame_count + 1, Q, T, l,
               relative_R, relative_T,
-              sfm_f, sfm_tracked_points))
+              sfm_f, sfm_tracked_points, &sfm_prior))
     {
-        ROS_DEBUG("global SFM failed!");
+        GVINS_DEBUG("global SFM failed!");
+        sfm_warm_centers.clear();
         marginalization_flag = MARGIN_OLD;
         return false;
     }
+    GVINS_DEBUG("global SFM: %d of %lu points warm started", sfm.numPriorPoints(), sfm_tracked_points.size());
+    sfm_warm_centers.clear();
+    for (int i = 0; i <= frame_count; i++)
+        sfm_warm_centers[Headers[i].stamp.toSec()] = T[i];
+    sfm_warm_points = sfm_tracked_points;
 
     //solve pnp for all frame
     map<double, ImageFrame>::iterator frame_it;
@@ -420,7 +1040,7 @@ bool Estimator::initialStructure()
         if((frame_it->first) == Headers[i].stamp.toSec())
         {
             frame_it->second.is_key_frame = true;
-            frame_it->second.R = Q[i].toRotationMatrix() * RIC[0].transpose();
+            frame_it->second.R = Q[i].toRotationMatrix() * config.RIC[0].transpose();
             frame_it->second.T = T[i];
             i++;
             continue;
@@ -459,12 +1079,12 @@ bool Estimator::initialStructure()
         if(pts_3_vector.size() < 6)
         {
             cout << "pts_3_vector size " << pts_3_vector.size() << endl;
-            ROS_DEBUG("Not enough points for solve pnp !");
+            GVINS_DEBUG("Not enough points for solve pnp !");
             return false;
         }
         if (! cv::solvePnP(pts_3_vector, pts_2_vector, K, D, rvec, t, 1))
         {
-            ROS_DEBUG("solve pnp fail!");
+            GVINS_DEBUG("solve pnp fail!");
             return false;
         }
         cv::Rodrigues(rvec, r);
@@ -474,13 +1094,13 @@ bool Estimator::initialStructure()
         MatrixXd T_pnp;
         cv::cv2eigen(t, T_pnp);
         T_pnp = R_pnp * (-T_pnp);
-        frame_it->second.R = R_pnp * RIC[0].transpose();
+        frame_it->second.R = R_pnp * config.RIC[0].transpose();
         frame_it->second.T = T_pnp;
     }
 
     if (!visualInitialAlign())
     {
-        ROS_WARN("misalign visual structure with IMU");
+        GVINS_WARN("misalign visual structure with IMU");
         return false;
     }
     return true;
@@ -491,10 +1111,10 @@ bool Estimator::visualInitialAlign()
     TicToc t_g;
     VectorXd x;
     //solve scale
-    bool result = VisualIMUAlignment(all_image_frame, Bgs, g, x);
+    bool result = VisualIMUAlignment(all_image_frame, Bgs, config, g, x);
     if(!result)
     {
-        ROS_DEBUG("solve g failed!");
+        GVINS_DEBUG("solve g failed!");
         return false;
     }
 
@@ -517,9 +1137,9 @@ bool Estimator::visualInitialAlign()
     Vector3d TIC_TMP[NUM_OF_CAM];
     for(int i = 0; i < NUM_OF_CAM; i++)
         TIC_TMP[i].setZero();
-    ric[0] = RIC[0];
+    ric[0] = config.RIC[0];
     f_manager.setRic(ric);
-    f_manager.triangulate(Ps, &(TIC_TMP[0]), &(RIC[0]));
+    f_manager.triangulate(Ps, &(TIC_TMP[0]), &(config.RIC[0]));
 
     double s = (x.tail<1>())(0);
     for (int i = 0; i <= WINDOW_SIZE; i++)
@@ -527,7 +1147,7 @@ bool Estimator::visualInitialAlign()
         pre_integrations[i]->repropagate(Vector3d::Zero(), Bgs[i]);
     }
     for (int i = frame_count; i >= 0; i--)
-        Ps[i] = s * Ps[i] - Rs[i] * TIC[0] - (s * Ps[0] - Rs[0] * TIC[0]);
+        Ps[i] = s * Ps[i] - Rs[i] * config.TIC[0] - (s * Ps[0] - Rs[0] * config.TIC[0]);
     int kv = -1;
     map<double, ImageFrame>::iterator frame_i;
     for (frame_i = all_image_frame.begin(); frame_i != all_image_frame.end(); frame_i++)
@@ -559,26 +1179,31 @@ bool Estimator::visualInitialAlign()
         Vs[i] = rot_diff * Vs[i];
     }
 
-    ROS_DEBUG_STREAM("g0     " << g.transpose());
-    ROS_DEBUG_STREAM("my R0  " << Utility::R2ypr(Rs[0]).transpose());
+    GVINS_DEBUG_STREAM("g0     " << g.transpose());
+    GVINS_DEBUG_STREAM("my R0  " << Utility::R2ypr(Rs[0]).transpose());
 
     return true;
 }
 
-bool Estimator::GNSSVIAlign()
+// measurements and local trajectory are ready for an alignment attempt
+bool Estimator::gnssAlignPossible() const
 {
     if (solver_flag == INITIAL)     // visual-inertial not initialized
         return false;
     
-    if (gnss_ready)                 // GNSS-VI already initialized
-        return true;
-    
     for (uint32_t i = 0; i < (WINDOW_SIZE+1); ++i)
     {
-        if (gnss_meas_buf[i].empty() || gnss_meas_buf[i].size() < 10)
+        const int k = nearestGNSSEpoch(i);
+        if (k < 0 || gnss_epoch_buf[i][k].end - gnss_epoch_buf[i][k].begin < 10)
             return false;
     }
 
+    // the yaw of a map initialized window is known
+    Eigen::Vector3d map_anc_ecef;
+    Eigen::Matrix3d map_R_ecef_enu;
+    if (map_initialized && relocalizer && relocalizer->mapAnchor(map_anc_ecef, map_R_ecef_enu))
+        return true;
+
     // check horizontal velocity excitation
     Eigen::Vector2d avg_hor_vel(0.0, 0.0);
     for (uint32_t i = 0; i < (WINDOW_SIZE+1); ++i)
@@ -589,60 +1214,109 @@ bool Estimator::GNSSVIAlign()
         std::cerr << "velocity excitation not enough for GNSS-VI alignment.\n";
         return false;
     }
+    return true;
+}
 
-    std::vector<std::vector<ObsPtr>> curr_gnss_meas_buf;
-    std::vector<std::vector<EphemBasePtr>> curr_gnss_ephem_buf;
+std::shared_ptr<Estimator::GNSSAlignment> Estimator::snapshotGNSSAlignment() const
+{
+    std::shared_ptr<GNSSAlignment> job(new GNSSAlignment());
+    job->generation = gnss_align_generation;
+    Eigen::Matrix3d map_R_ecef_enu;
+    job->known_anchor = map_initialized && relocalizer && relocalizer->mapAnchor(job->anchor_ecef, map_R_ecef_enu);
+    job->iono_params = latest_gnss_iono_params;
+    // the initializer takes one epoch per frame, at the frame's velocity and position
     for (uint32_t i = 0; i < (WINDOW_SIZE+1); ++i)
     {
-        curr_gnss_meas_buf.push_back(gnss_meas_buf[i]);
-        curr_gnss_ephem_buf.push_back(gnss_ephem_buf[i]);
+        const GnssEpochBinding &epoch = gnss_epoch_buf[i][nearestGNSSEpoch(i)];
+        job->meas.emplace_back(gnss_meas_buf[i].begin() + epoch.begin, gnss_meas_buf[i].begin() + epoch.end);
+        job->ephem.emplace_back(gnss_ephem_buf[i].begin() + epoch.begin, gnss_ephem_buf[i].begin() + epoch.end);
+        job->sat_state.emplace_back(gnss_sat_state_buf[i].begin() + epoch.begin, gnss_sat_state_buf[i].begin() + epoch.end);
+        job->local_vs.push_back(Vs[i]);
+        job->local_ps.push_back(Ps[i]);
+        job->stamps.push_back(Headers[i].stamp.toSec());
     }
+    job->success = false;
+    return job;
+}
 
-    GNSSVIInitializer gnss_vi_initializer(curr_gnss_meas_buf, curr_gnss_ephem_buf, latest_gnss_iono_params);
+/**
+ * coarse_localization, yaw_alignment 和 anchor_refinement 三步 (锚点已知时 coarse_localization 后只做 clock_alignment),
+ * 只使用 job 中的快照, 可在后台线程执行
+ */
+void Estimator::runGNSSAlignment(GNSSAlignment &job)
+{
+    GVINS_TRACE_ZONE("GNSSVIAlign");
+    GNSSVIInitializer gnss_vi_initializer(job.meas, job.ephem, job.sat_state, job.iono_params);
 
     // 1. get a rough global location
-    Eigen::Matrix<double, 7, 1> rough_xyzt;
-    rough_xyzt.setZero();
-    if (!gnss_vi_initializer.coarse_localization(rough_xyzt))
+    job.rough_xyzt.setZero();
+    if (!gnss_vi_initializer.coarse_localization(job.rough_xyzt))
     {
         std::cerr << "Fail to obtain a coarse location.\n";
-        return false;
+        return;
+    }
+
+    // the anchor and yaw of a window initialized from the keyframe map are known, only the clocks are aligned
+    if (job.known_anchor)
+    {
+        job.aligned_yaw = 0;
+        job.refined_xyzt.head<3>() = job.anchor_ecef;
+        job.refined_xyzt.tail<4>() = job.rough_xyzt.tail<4>();
+        if (!gnss_vi_initializer.clock_alignment(job.local_ps, job.local_vs, job.anchor_ecef,
+            job.rough_xyzt, job.refined_xyzt, job.aligned_rcv_ddt))
+        {
+            std::cerr << "Fail to align receiver clocks at the map anchor.\n";
+            return;
+        }
+        job.success = true;
+        return;
     }
 
     // 2. perform yaw alignment
-    std::vector<Eigen::Vector3d> local_vs;
-    for (uint32_t i = 0; i < (WINDOW_SIZE+1); ++i)
-        local_vs.push_back(Vs[i]);
-    Eigen::Vector3d rough_anchor_ecef = rough_xyzt.head<3>();
-    double aligned_yaw = 0;
-    double aligned_rcv_ddt = 0;
-    if (!gnss_vi_initializer.yaw_alignment(local_vs, rough_anchor_ecef, aligned_yaw, aligned_rcv_ddt))
+    Eigen::Vector3d rough_anchor_ecef = job.rough_xyzt.head<3>();
+    job.aligned_yaw = 0;
+    job.aligned_rcv_ddt = 0;
+    if (!gnss_vi_initializer.yaw_alignment(job.local_vs, rough_anchor_ecef, job.aligned_yaw, job.aligned_rcv_ddt))
     {
         std::cerr << "Fail to align ENU and local frames.\n";
-        return false;
+        return;
     }
     // std::cout << "aligned_yaw is " << aligned_yaw*180.0/M_PI << '\n';
 
     // 3. perform anchor refinement
-    std::vector<Eigen::Vector3d> local_ps;
-    for (uint32_t i = 0; i < (WINDOW_SIZE+1); ++i)
-        local_ps.push_back(Ps[i]);
-    Eigen::Matrix<double, 7, 1> refined_xyzt;
-    refined_xyzt.setZero();
-    if (!gnss_vi_initializer.anchor_refinement(local_ps, aligned_yaw, 
-        aligned_rcv_ddt, rough_xyzt, refined_xyzt))
+    job.refined_xyzt.setZero();
+    if (!gnss_vi_initializer.anchor_refinement(job.local_ps, job.aligned_yaw, 
+        job.aligned_rcv_ddt, job.rough_xyzt, job.refined_xyzt))
     {
         std::cerr << "Fail to refine anchor point.\n";
-        return false;
+        return;
     }
     // std::cout << "refined anchor point is " << std::setprecision(20) 
     //           << refined_xyzt.head<3>().transpose() << '\n';
+    job.success = true;
+}
+
+/**
+ * 对齐结果写入 GNSS 状态; 窗口可能已在快照之后滑动, 钟差按各帧在快照中的位置 (不在快照中的帧按平均帧间隔外推) 恢复,
+ * 快照的窗口即当前窗口时与原来的逐帧恢复相同
+ */
+void Estimator::applyGNSSAlignment(const GNSSAlignment &job)
+{
+    const std::vector<double> &stamps = job.stamps;
+    const double frame_interval = (stamps.back() - stamps.front()) / WINDOW_SIZE;
+    auto snapshot_index = [&](double t)
+    {
+        std::vector<double>::const_iterator it = std::find(stamps.begin(), stamps.end(), t);
+        if (it != stamps.end())
+            return static_cast<double>(it - stamps.begin());
+        return WINDOW_SIZE + (frame_interval > 0 ? (t - stamps.back()) / frame_interval : 0.0);
+    };
 
     // restore GNSS states
     uint32_t one_observed_sys = static_cast<uint32_t>(-1);
     for (uint32_t k = 0; k < 4; ++k)
     {
-        if (rough_xyzt(k+3) != 0)
+        if (job.rough_xyzt(k+3) != 0)
         {
             one_observed_sys = k;
             break;
@@ -650,21 +1324,69 @@ bool Estimator::GNSSVIAlign()
     }
     for (uint32_t i = 0; i < (WINDOW_SIZE+1); ++i)
     {
-        para_rcv_ddt[i] = aligned_rcv_ddt;
+        const double idx = snapshot_index(Headers[i].stamp.toSec());
+        para_rcv_ddt[i] = job.aligned_rcv_ddt;
         for (uint32_t k = 0; k < 4; ++k)
         {
-            if (rough_xyzt(k+3) == 0)
-                para_rcv_dt[i*4+k] = refined_xyzt(3+one_observed_sys) + aligned_rcv_ddt * i;
+            if (job.rough_xyzt(k+3) == 0)
+                para_rcv_dt[i*4+k] = job.refined_xyzt(3+one_observed_sys) + job.aligned_rcv_ddt * idx;
             else
-                para_rcv_dt[i*4+k] = refined_xyzt(3+k) + aligned_rcv_ddt * i;
+                para_rcv_dt[i*4+k] = job.refined_xyzt(3+k) + job.aligned_rcv_ddt * idx;
         }
     }
-    anc_ecef = refined_xyzt.head<3>();
+    anc_ecef = job.refined_xyzt.head<3>();
     R_ecef_enu = ecef2rotation(anc_ecef);
 
-    yaw_enu_local = aligned_yaw;
+    yaw_enu_local = job.aligned_yaw;
+}
 
-    return true;
+bool Estimator::GNSSVIAlign()
+{
+    if (gnss_ready)                 // GNSS-VI already initialized
+        return true;
+    if (!gnssAlignPossible())
+        return false;
+    std::shared_ptr<GNSSAlignment> job = snapshotGNSSAlignment();
+    runGNSSAlignment(*job);
+    if (job->success)
+        applyGNSSAlignment(*job);
+    return job->success;
+}
+
+/**
+ * GNSS_ASYNC_INIT 时的 GNSSVIAlign: 每帧边界先取回已完成的对齐 (在此之前 clearState 过的结果丢弃), 成功则一次写入;
+ * 否则在后台没有任务时提交当前窗口的快照, VIO 不等待对齐而照常运行
+ */
+bool Estimator::pollGNSSVIAlign()
+{
+    if (gnss_ready)
+        return true;
+    if (gnss_align_job)
+    {
+        // deterministic: taken at the frame after the submission whatever the time it took
+        if (config.DETERMINISTIC)
+            gnss_align_stage.wait();
+        if (!gnss_align_stage.idle())
+            return false;
+        std::shared_ptr<GNSSAlignment> job;
+        job.swap(gnss_align_job);
+        if (job->success && job->generation == gnss_align_generation && solver_flag == NON_LINEAR)
+        {
+            applyGNSSAlignment(*job);
+            GVINS_INFO("GNSS-VI alignment of the window ending at %f applied at %f", 
+                job->stamps.back(), Headers[WINDOW_SIZE].stamp.toSec());
+            return true;
+        }
+    }
+    if (!gnssAlignPossible())
+        return false;
+    gnss_align_job = snapshotGNSSAlignment();
+    std::shared_ptr<GNSSAlignment> job = gnss_align_job;
+    gnss_align_stage.submit([job]()
+    {
+        runGNSSAlignment(*job);
+    });
+    return false;
 }
 
 void Estimator::updateGNSSStatistics()
@@ -676,11 +1398,70 @@ void Estimator::updateGNSSStatistics()
     ecef_pos = anc_ecef + R_ecef_enu * enu_pos;
 }
 
+// 与 pubKeyframe 相同的关键帧: MARGIN_OLD 后窗口中的 WINDOW_SIZE - 2 帧, 及其上已三角化的特征
+bool Estimator::reloKeyframe(ReloKeyframe &keyframe) const
+{
+    if (solver_flag != NON_LINEAR || marginalization_flag != MARGIN_OLD)
+        return false;
+    const int i = WINDOW_SIZE - 2;
+    keyframe.stamp = Headers[i].stamp;
+    keyframe.generation = world_generation;
+    keyframe.P = Ps[i] + Rs[i] * tic[0];
+    keyframe.R = Rs[i] * ric[0];
+    keyframe.feature_ids.clear();
+    keyframe.points.clear();
+    keyframe.observations.clear();
+    for (const FeaturePerId &it_per_id : f_manager.feature)
+    {
+        const int frame_size = it_per_id.feature_per_frame.size();
+        if (!(it_per_id.start_frame < i && it_per_id.start_frame + frame_size - 1 >= i && it_per_id.solve_flag == 1))
+            continue;
+        const int imu_i = it_per_id.start_frame;
+        const Vector3d pts_i = it_per_id.feature_per_frame[0].point * it_per_id.estimated_depth;
+        keyframe.feature_ids.push_back(it_per_id.feature_id);
+        keyframe.points.push_back(Rs[imu_i] * (ric[0] * pts_i + tic[0]) + Ps[imu_i]);
+        const Vector3d &obs = it_per_id.feature_per_frame[i - imu_i].point;
+        keyframe.observations.push_back(Vector2d(obs.x(), obs.y()));
+    }
+    return !keyframe.feature_ids.empty();
+}
 
+void Estimator::setReloFrame(const ReloResult &result)
+{
+    if (!result.constraint || result.generation != world_generation)
+        return;
+    bool in_window = false;
+    for (int i = 0; i <= frame_count; i++)
+        in_window = in_window || Headers[i].stamp == result.stamp;
+    if (!in_window)
+        return;
+    const Matrix3d R_b = result.R * ric[0].transpose();
+    const Vector3d P_b = result.P - R_b * tic[0];
+    const Quaterniond q_b(R_b);
+    relo_frame_pose = {P_b.x(), P_b.y(), P_b.z(), q_b.x(), q_b.y(), q_b.z(), q_b.w()};
+    relo_frame_stamp = result.stamp;
+    relo_frame_valid = true;
+}
+
+
+/**
+ * 窗口内每一帧与最新帧的相对位姿互不相关, 在 WorkerPool 上并行求解 (RANSAC 占主要耗时),
+ * 在通过视差和内点检查的帧中选 内点数 x 平均视差 最大的一帧, 而不是按顺序第一个通过的帧
+ */
 bool Estimator::relativePose(Matrix3d &relative_R, Vector3d &relative_T, int &l)
 {
+    struct Candidate
+    {
+        bool valid = false;
+        double score = 0;
+        double average_parallax = 0;
+        Matrix3d R;
+        Vector3d T;
+    };
+    vector<Candidate> candidates(WINDOW_SIZE);
+
     // find previous frame which contians enough correspondance and parallex with newest frame
-    for (int i = 0; i < WINDOW_SIZE; i++)
+    WorkerPool::instance().parallelFor(WINDOW_SIZE, [&](int i)
     {
         vector<pair<Vector3d, Vector3d>> corres;
         corres = f_manager.getCorresponding(i, WINDOW_SIZE);
@@ -697,15 +1478,31 @@ bool Estimator::relativePose(Matrix3d &relative_R, Vector3d &relative_T, int &l)
 
             }
             average_parallax = 1.0 * sum_parallax / int(corres.size());
-            if(average_parallax * 460 > 30 && m_estimator.solveRelativeRT(corres, relative_R, relative_T))
+            Candidate &candidate = candidates[i];
+            int inlier_cnt = 0;
+            if(average_parallax * 460 > 30 && m_estimator.solveRelativeRT(corres, candidate.R, candidate.T, inlier_cnt))
             {
-                l = i;
-                ROS_DEBUG("average_parallax %f choose l %d and newest frame to triangulate the whole structure", average_parallax * 460, l);
-                return true;
+                candidate.valid = true;
+                candidate.average_parallax = average_parallax;
+                candidate.score = inlier_cnt * average_parallax;
             }
         }
+    });
+
+    l = -1;
+    for (int i = 0; i < WINDOW_SIZE; i++)
+    {
+        if (candidates[i].valid && (l < 0 || candidates[i].score > candidates[l].score))
+            l = i;
     }
-    return false;
+    if (l < 0)
+        return false;
+
+    relative_R = candidates[l].R;
+    relative_T = candidates[l].T;
+    GVINS_DEBUG("average_parallax %f choose l %d and newest frame to triangulate the whole structure", 
+              candidates[l].average_parallax * 460, l);
+    return true;
 }
 
 void Estimator::solveOdometry()
@@ -716,13 +1513,22 @@ void Estimator::solveOdometry()
     {
         TicToc t_tri;
         f_manager.triangulate(Ps, tic, ric);
-        ROS_DEBUG("triangulation costs %f", t_tri.toc());
-        optimization();
-        if (GNSS_ENABLE)
+        GVINS_DEBUG("triangulation costs %f", t_tri.toc());
+        if (motionOnlyDue())
+        {
+            motionOnlyOptimization();
+            num_motion_only_frames++;
+        }
+        else
+        {
+            optimization();
+            num_motion_only_frames = 0;
+        }
+        if (config.GNSS_ENABLE)
         {
             if (!gnss_ready)
             {
-                gnss_ready = GNSSVIAlign();
+                gnss_ready = (config.GNSS_ASYNC_INIT ? pollGNSSVIAlign() : GNSSVIAlign());
             }
             if (gnss_ready)
             {
@@ -769,24 +1575,36 @@ void Estimator::vector2double()
         para_Ex_Pose[i][6] = q.w();
     }
 
-    VectorXd dep = f_manager.getDepthVector();
-    for (int i = 0; i < f_manager.getFeatureCount(); i++)
-        para_Feature[i][0] = dep(i);
-    if (ESTIMATE_TD)
+    f_manager.getInverseDepths(para_Feature);
+    if (config.ESTIMATE_TD)
         para_Td[0][0] = td;
     
     para_yaw_enu_local[0] = yaw_enu_local;
     for (uint32_t k = 0; k < 3; ++k)
         para_anc_ecef[k] = anc_ecef(k);
+
+    // para_rcv_dt/para_rcv_ddt stay the clock state, the merged blocks are a copy for the solver
+    if (config.GNSS_MERGED_CLOCK)
+    {
+        for (int i = 0; i <= WINDOW_SIZE; i++)
+        {
+            std::copy(para_rcv_dt + i*4, para_rcv_dt + (i+1)*4, para_rcv_clock[i]);
+            para_rcv_clock[i][RCV_CLOCK_DDT_IDX] = para_rcv_ddt[i];
+        }
+    }
 }
 
+/**
+ * @brief 优化结果写回状态; 四元数归一化后同样写回 para_Pose, 之后 para_* 与状态一致,
+ *        边缘化直接使用 para_*, 不再调用 vector2double
+ */
 void Estimator::double2vector()
 {
     for (int i = 0; i <= WINDOW_SIZE; i++)
     {
-
-        Rs[i] = Quaterniond(para_Pose[i][6], para_Pose[i][3], 
-                            para_Pose[i][4], para_Pose[i][5]).normalized().toRotationMatrix();
+        Eigen::Map<Quaterniond> q(para_Pose[i] + 3);
+        q.normalize();
+        Rs[i] = q.toRotationMatrix();
         
         Ps[i] = Vector3d(para_Pose[i][0], para_Pose[i][1], para_Pose[i][2]);
 
@@ -797,18 +1615,17 @@ void Estimator::double2vector()
         Bgs[i] = Vector3d(para_SpeedBias[i][6], para_SpeedBias[i][7], para_SpeedBias[i][8]);
     }
 
-    for (int i = 0; i < NUM_OF_CAM; i++)
+    // constant blocks without extrinsic estimation
+    for (int i = 0; config.ESTIMATE_EXTRINSIC && i < NUM_OF_CAM; i++)
     {
+        Eigen::Map<Quaterniond> q(para_Ex_Pose[i] + 3);
+        q.normalize();
         tic[i] = Vector3d(para_Ex_Pose[i][0], para_Ex_Pose[i][1], para_Ex_Pose[i][2]);
-        ric[i] = Quaterniond(para_Ex_Pose[i][6], para_Ex_Pose[i][3],
-                             para_Ex_Pose[i][4], para_Ex_Pose[i][5]).normalized().toRotationMatrix();
+        ric[i] = q.toRotationMatrix();
     }
 
-    VectorXd dep = f_manager.getDepthVector();
-    for (int i = 0; i < f_manager.getFeatureCount(); i++)
-        dep(i) = para_Feature[i][0];
-    f_manager.setDepth(dep);
-    if (ESTIMATE_TD)
+    f_manager.setInverseDepths(para_Feature);
+    if (config.ESTIMATE_TD)
         td = para_Td[0][0];
     
     if (gnss_ready)
@@ -818,41 +1635,55 @@ void Estimator::double2vector()
             anc_ecef(k) = para_anc_ecef[k];
         R_ecef_enu = ecef2rotation(anc_ecef);
     }
+
+    if (config.GNSS_MERGED_CLOCK)
+    {
+        for (int i = 0; i <= WINDOW_SIZE; i++)
+        {
+            std::copy(para_rcv_clock[i], para_rcv_clock[i] + 4, para_rcv_dt + i*4);
+            para_rcv_ddt[i] = para_rcv_clock[i][RCV_CLOCK_DDT_IDX];
+        }
+    }
 }
 
 bool Estimator::failureDetection()
 {
     if (f_manager.last_track_num < 2)
     {
-        ROS_INFO(" little feature %d", f_manager.last_track_num);
+        GVINS_INFO(" little feature %d", f_manager.last_track_num);
         //return true;
     }
-    if (Bas[WINDOW_SIZE].norm() > 2.5)
+    if (solver_watchdog.diverged())
+    {
+        GVINS_INFO(" solver diverged: %s", SolverWatchdog::REASON_NAMES[solver_watchdog.lastReason()]);
+        return true;
+    }
+    if (Bas[WINDOW_SIZE].norm() > MAX_ACC_BIAS)
     {
-        ROS_INFO(" big IMU acc bias estimation %f", Bas[WINDOW_SIZE].norm());
+        GVINS_INFO(" big IMU acc bias estimation %f", Bas[WINDOW_SIZE].norm());
         return true;
     }
-    if (Bgs[WINDOW_SIZE].norm() > 1.0)
+    if (Bgs[WINDOW_SIZE].norm() > MAX_GYR_BIAS)
     {
-        ROS_INFO(" big IMU gyr bias estimation %f", Bgs[WINDOW_SIZE].norm());
+        GVINS_INFO(" big IMU gyr bias estimation %f", Bgs[WINDOW_SIZE].norm());
         return true;
     }
     /*
     if (tic(0) > 1)
     {
-        ROS_INFO(" big extri param estimation %d", tic(0) > 1);
+        GVINS_INFO(" big extri param estimation %d", tic(0) > 1);
         return true;
     }
     */
     Vector3d tmp_P = Ps[WINDOW_SIZE];
     if ((tmp_P - last_P).norm() > 5)
     {
-        ROS_INFO(" big translation");
+        GVINS_INFO(" big translation");
         return true;
     }
     if (abs(tmp_P.z() - last_P.z()) > 1)
     {
-        ROS_INFO(" big z translation");
+        GVINS_INFO(" big z translation");
         return true; 
     }
     Matrix3d tmp_R = Rs[WINDOW_SIZE];
@@ -862,7 +1693,7 @@ bool Estimator::failureDetection()
     delta_angle = acos(delta_Q.w()) * 2.0 / 3.14 * 180.0;
     if (delta_angle > 50)
     {
-        ROS_INFO(" big delta_angle ");
+        GVINS_INFO(" big delta_angle ");
         //return true;
     }
     return false;
@@ -870,29 +1701,74 @@ bool Estimator::failureDetection()
 
 void Estimator::optimization()
 {
-    ceres::Problem problem;
+    GVINS_TRACE_ZONE("optimization");
+    // the prior of the previous frame must be complete before it is added to the problem
+    TicToc t_barrier;
+    {
+        GVINS_TRACE_ZONE("waitMarginalization");
+        waitMarginalization();
+    }
+    GVINS_DEBUG("wait for marginalization %f ms", t_barrier.toc());
+
+    std::unique_ptr<ceres::Problem> frame_problem;
     ceres::LossFunction *loss_function;
-    //loss_function = new ceres::HuberLoss(1.0);
-    loss_function = new ceres::CauchyLoss(1.0);
+    if (config.INCREMENTAL_PROBLEM)
+    {
+        if (inc_problem == nullptr)
+        {
+            ceres::Problem::Options problem_options;
+            problem_options.enable_fast_removal = true;
+            problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+            inc_problem = new ceres::Problem(problem_options);
+            inc_loss_function = new ceres::CauchyLoss(1.0);
+        }
+        // prior and anchor factors are rebuilt every frame
+        for (auto id : inc_volatile_residuals)
+            inc_problem->RemoveResidualBlock(id);
+        inc_volatile_residuals.clear();
+        loss_function = inc_loss_function;
+    }
+    else
+    {
+        // the factors of the last frame went with its problem
+        frame_arena.reset();
+        ceres::Problem::Options problem_options;
+        problem_options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+        problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+        problem_options.local_parameterization_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+        frame_problem.reset(new ceres::Problem(problem_options));
+        //loss_function = new ceres::HuberLoss(1.0);
+        loss_function = frame_arena.create<ceres::CauchyLoss>(1.0);
+    }
+    ceres::Problem &problem = (config.INCREMENTAL_PROBLEM ? *inc_problem : *frame_problem);
+
     for (int i = 0; i < WINDOW_SIZE + 1; i++)
     {
-        ceres::LocalParameterization *local_parameterization = new PoseLocalParameterization();
+        if (problem.HasParameterBlock(para_Pose[i]))
+            continue;
+        ceres::LocalParameterization *local_parameterization = newFactor<PoseLocalParameterization>();
         problem.AddParameterBlock(para_Pose[i], SIZE_POSE, local_parameterization);
         problem.AddParameterBlock(para_SpeedBias[i], SIZE_SPEEDBIAS);
     }
     for (int i = 0; i < NUM_OF_CAM; i++)
     {
-        ceres::LocalParameterization *local_parameterization = new PoseLocalParameterization();
-        problem.AddParameterBlock(para_Ex_Pose[i], SIZE_POSE, local_parameterization);
-        if (!ESTIMATE_EXTRINSIC)
+        if (!problem.HasParameterBlock(para_Ex_Pose[i]))
+        {
+            ceres::LocalParameterization *local_parameterization = newFactor<PoseLocalParameterization>();
+            problem.AddParameterBlock(para_Ex_Pose[i], SIZE_POSE, local_parameterization);
+        }
+        if (!config.ESTIMATE_EXTRINSIC)
         {
-            ROS_DEBUG("fix extinsic param");
+            GVINS_DEBUG("fix extinsic param");
             problem.SetParameterBlockConstant(para_Ex_Pose[i]);
         }
         else
-            ROS_DEBUG("estimate extinsic param");
+        {
+            GVINS_DEBUG("estimate extinsic param");
+            problem.SetParameterBlockVariable(para_Ex_Pose[i]);
+        }
     }
-    if (ESTIMATE_TD)
+    if (config.ESTIMATE_TD)
     {
         problem.AddParameterBlock(para_Td[0], 1);
     }
@@ -900,6 +1776,7 @@ void Estimator::optimization()
     if (gnss_ready)
     {
         problem.AddParameterBlock(para_yaw_enu_local, 1);
+        bool fix_yaw = false;
         Eigen::Vector2d avg_hor_vel(0.0, 0.0);
         for (uint32_t i = 0; i <= WINDOW_SIZE; ++i)
             avg_hor_vel += Vs[i].head<2>().cwiseAbs();
@@ -908,20 +1785,29 @@ void Estimator::optimization()
         if (avg_hor_vel.norm() < 0.3)
         {
             // std::cerr << "velocity excitation not enough, fix yaw angle.\n";
-            problem.SetParameterBlockConstant(para_yaw_enu_local);
+            fix_yaw = true;
         }
 
         for (uint32_t i = 0; i <= WINDOW_SIZE; ++i)
         {
             if (gnss_meas_buf[i].size() < 10)
-                problem.SetParameterBlockConstant(para_yaw_enu_local);
+                fix_yaw = true;
         }
+        if (fix_yaw)
+            problem.SetParameterBlockConstant(para_yaw_enu_local);
+        else
+            problem.SetParameterBlockVariable(para_yaw_enu_local);
         
         problem.AddParameterBlock(para_anc_ecef, 3);
         // problem.SetParameterBlockConstant(para_anc_ecef);
 
         for (uint32_t i = 0; i <= WINDOW_SIZE; ++i)
         {
+            if (config.GNSS_MERGED_CLOCK)
+            {
+                problem.AddParameterBlock(para_rcv_clock[i], SIZE_RCV_CLOCK);
+                continue;
+            }
             for (uint32_t k = 0; k < 4; ++k)
                 problem.AddParameterBlock(para_rcv_dt+i*4+k, 1);
             problem.AddParameterBlock(para_rcv_ddt+i, 1);
@@ -936,17 +1822,41 @@ void Estimator::optimization()
         std::vector<double> anchor_value;
         for (uint32_t k = 0; k < 7; ++k)
             anchor_value.push_back(para_Pose[0][k]);
-        PoseAnchorFactor *pose_anchor_factor = new PoseAnchorFactor(anchor_value);
-        problem.AddResidualBlock(pose_anchor_factor, NULL, para_Pose[0]);
+        PoseAnchorFactor *pose_anchor_factor = newFactor<PoseAnchorFactor>(anchor_value);
+        ceres::ResidualBlockId anchor_id = problem.AddResidualBlock(pose_anchor_factor, NULL, para_Pose[0]);
+        if (config.INCREMENTAL_PROBLEM)
+            inc_volatile_residuals.push_back(anchor_id);
         first_optimization = false;
     }
 
+    if (relo_frame_valid)
+    {
+        int relo_index = -1;
+        for (int i = 0; i <= frame_count; i++)
+            if (Headers[i].stamp == relo_frame_stamp)
+                relo_index = i;
+        if (relo_index < 0)
+            relo_frame_valid = false;   // slid out of the window
+        else
+        {
+            PoseAnchorFactor *relo_factor = newFactor<PoseAnchorFactor>(relo_frame_pose, config.RELO_POSE_WEIGHT);
+            ceres::ResidualBlockId relo_id = problem.AddResidualBlock(relo_factor, NULL, para_Pose[relo_index]);
+            if (config.INCREMENTAL_PROBLEM)
+                inc_volatile_residuals.push_back(relo_id);
+        }
+    }
+
     if (last_marginalization_info)
     {
-        // construct new marginlization_factor
-        MarginalizationFactor *marginalization_factor = new MarginalizationFactor(last_marginalization_info);
-        problem.AddResidualBlock(marginalization_factor, NULL,
-                                 last_marginalization_parameter_blocks);
+        // construct new marginlization_factor, one per relative factor if the prior was sparsified
+        for (int piece : last_marginalization_info->priorFactors())
+        {
+            MarginalizationFactor *marginalization_factor = newFactor<MarginalizationFactor>(last_marginalization_info, piece);
+            ceres::ResidualBlockId prior_id = problem.AddResidualBlock(marginalization_factor, NULL,
+                                     priorParameterBlocks(piece));
+            if (config.INCREMENTAL_PROBLEM)
+                inc_volatile_residuals.push_back(prior_id);
+        }
     }
 
     for (int i = 0; i < WINDOW_SIZE; i++)
@@ -954,8 +1864,13 @@ void Estimator::optimization()
         int j = i + 1;
         if (pre_integrations[j]->sum_dt > 10.0)
             continue;
-        IMUFactor* imu_factor = new IMUFactor(pre_integrations[j]);
-        problem.AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j], para_SpeedBias[j]);
+        std::vector<double> imu_key{IMU_RESIDUAL, static_cast<double>(j), 
+            Headers[i].stamp.toSec(), Headers[j].stamp.toSec()};
+        if (reuseResidual(imu_key, pre_integrations[j]))
+            continue;
+        IMUFactor* imu_factor = newFactor<IMUFactor>(pre_integrations[j]);
+        rememberResidual(imu_key, pre_integrations[j], problem.AddResidualBlock(imu_factor, NULL, 
+            para_Pose[i], para_SpeedBias[i], para_Pose[j], para_SpeedBias[j]));
     }
 
     if (gnss_ready)
@@ -965,52 +1880,132 @@ void Estimator::optimization()
             // cerr << "size of gnss_meas_buf[" << i << "] is " << gnss_meas_buf[i].size() << endl;
             const std::vector<ObsPtr> &curr_obs = gnss_meas_buf[i];
             const std::vector<EphemBasePtr> &curr_ephem = gnss_ephem_buf[i];
+            const std::vector<SatStatePtr> &curr_sat_state = gnss_sat_state_buf[i];
 
-            for (uint32_t j = 0; j < curr_obs.size(); ++j)
+            // 观测时刻所在的相邻两帧和插值系数在历元加入窗口时已求出
+            if (config.GNSS_EPOCH_FACTOR)
             {
-                const uint32_t sys = satsys(curr_obs[j]->sat, NULL);
-                const uint32_t sys_idx = gnss_comm::sys2idx.at(sys);
+                // 同一接收时刻的所有卫星合并为一个历元因子
+                for (const GnssEpochBinding &epoch : gnss_epoch_buf[i])
+                {
+                    const int lower_idx = i + epoch.lower_offset;
+                    const double ts_ratio = epoch.ts_ratio;
+                    std::vector<double> gnss_key{GNSS_RESIDUAL, static_cast<double>(i), 
+                        static_cast<double>(lower_idx), -static_cast<double>(epoch.end - epoch.begin), 
+                        epoch.gnss_ts, ts_ratio};
+                    if (reuseResidual(gnss_key, curr_obs[epoch.begin].get()))
+                        continue;
 
-                int lower_idx = -1;
-                const double obs_local_ts = time2sec(curr_obs[j]->time) - diff_t_gnss_local;
-                if (Headers[i].stamp.toSec() > obs_local_ts)
-                    lower_idx = (i==0? 0 : i-1);
-                else
-                    lower_idx = (i==WINDOW_SIZE? WINDOW_SIZE-1 : i);
-                const double lower_ts = Headers[lower_idx].stamp.toSec();
-                const double upper_ts = Headers[lower_idx+1].stamp.toSec();
-
-                const double ts_ratio = (upper_ts-obs_local_ts) / (upper_ts-lower_ts);
-                GnssPsrDoppFactor *gnss_factor = new GnssPsrDoppFactor(curr_obs[j], 
-                    curr_ephem[j], latest_gnss_iono_params, ts_ratio);
-                problem.AddResidualBlock(gnss_factor, NULL, para_Pose[lower_idx], 
-                    para_SpeedBias[lower_idx], para_Pose[lower_idx+1], para_SpeedBias[lower_idx+1],
-                    para_rcv_dt+i*4+sys_idx, para_rcv_ddt+i, para_yaw_enu_local, para_anc_ecef);
+                    std::vector<ObsPtr> epoch_obs(curr_obs.begin() + epoch.begin, curr_obs.begin() + epoch.end);
+                    std::vector<EphemBasePtr> epoch_ephem(curr_ephem.begin() + epoch.begin, curr_ephem.begin() + epoch.end);
+                    std::vector<SatStatePtr> epoch_sat_state(curr_sat_state.begin() + epoch.begin, 
+                        curr_sat_state.begin() + epoch.end);
+                    if (config.GNSS_MERGED_CLOCK)
+                    {
+                        GnssClockBlockFactor<GnssEpochFactor> *epoch_factor = newFactor<GnssClockBlockFactor<GnssEpochFactor>>(
+                            epoch_obs, epoch_ephem, epoch_sat_state, latest_gnss_iono_params, ts_ratio);
+                        std::vector<int> clock_components{-1, -1, -1, -1, RCV_CLOCK_DDT_IDX, -1, -1};
+                        for (uint32_t sys_idx : epoch_factor->inner().sys_indices())
+                            clock_components.push_back(static_cast<int>(sys_idx));
+                        epoch_factor->setClockComponents(clock_components);
+                        rememberResidual(gnss_key, curr_obs[epoch.begin].get(), problem.AddResidualBlock(epoch_factor, NULL, 
+                            para_Pose[lower_idx], para_SpeedBias[lower_idx], para_Pose[lower_idx+1], 
+                            para_SpeedBias[lower_idx+1], para_rcv_clock[i], para_yaw_enu_local, para_anc_ecef));
+                        continue;
+                    }
+                    GnssEpochFactor *epoch_factor = newFactor<GnssEpochFactor>(epoch_obs, epoch_ephem, 
+                        epoch_sat_state, latest_gnss_iono_params, ts_ratio);
+                    std::vector<double*> epoch_paras{para_Pose[lower_idx], para_SpeedBias[lower_idx], 
+                        para_Pose[lower_idx+1], para_SpeedBias[lower_idx+1], para_rcv_ddt+i, 
+                        para_yaw_enu_local, para_anc_ecef};
+                    for (uint32_t sys_idx : epoch_factor->sys_indices())
+                        epoch_paras.push_back(para_rcv_dt+i*4+sys_idx);
+                    rememberResidual(gnss_key, curr_obs[epoch.begin].get(), 
+                        problem.AddResidualBlock(epoch_factor, NULL, epoch_paras));
+                }
+                continue;
+            }
+
+            for (const GnssEpochBinding &epoch : gnss_epoch_buf[i])
+            {
+                for (uint32_t j = epoch.begin; j < epoch.end; ++j)
+                {
+                    const uint32_t sys = satsys(curr_obs[j]->sat, NULL);
+                    const uint32_t sys_idx = gnss_comm::sys2idx.at(sys);
+
+                    const int lower_idx = i + epoch.lower_offset;
+                    const double ts_ratio = epoch.ts_ratio;
+                    std::vector<double> gnss_key{GNSS_RESIDUAL, static_cast<double>(i), 
+                        static_cast<double>(lower_idx), static_cast<double>(curr_obs[j]->sat), 
+                        time2sec(curr_obs[j]->time), ts_ratio};
+                    if (reuseResidual(gnss_key, curr_obs[j].get()))
+                        continue;
+                    if (config.GNSS_MERGED_CLOCK)
+                    {
+                        GnssClockBlockFactor<GnssPsrDoppFactor> *gnss_factor = newFactor<GnssClockBlockFactor<GnssPsrDoppFactor>>(
+                            curr_obs[j], curr_ephem[j], curr_sat_state[j], latest_gnss_iono_params, ts_ratio);
+                        gnss_factor->setClockComponents(std::vector<int>{-1, -1, -1, -1, 
+                            static_cast<int>(sys_idx), RCV_CLOCK_DDT_IDX, -1, -1});
+                        rememberResidual(gnss_key, curr_obs[j].get(), problem.AddResidualBlock(gnss_factor, NULL, 
+                            para_Pose[lower_idx], para_SpeedBias[lower_idx], para_Pose[lower_idx+1], 
+                            para_SpeedBias[lower_idx+1], para_rcv_clock[i], para_yaw_enu_local, para_anc_ecef));
+                        continue;
+                    }
+                    GnssPsrDoppFactor *gnss_factor = newFactor<GnssPsrDoppFactor>(curr_obs[j], 
+                        curr_ephem[j], curr_sat_state[j], latest_gnss_iono_params, ts_ratio);
+                    rememberResidual(gnss_key, curr_obs[j].get(), problem.AddResidualBlock(gnss_factor, NULL, 
+                        para_Pose[lower_idx], para_SpeedBias[lower_idx], para_Pose[lower_idx+1], 
+                        para_SpeedBias[lower_idx+1], para_rcv_dt+i*4+sys_idx, para_rcv_ddt+i, 
+                        para_yaw_enu_local, para_anc_ecef));
+                }
             }
         }
 
+        // one fused clock dynamics factor per epoch pair with the merged clock blocks
+        for (uint32_t i = 0; config.GNSS_MERGED_CLOCK && i < WINDOW_SIZE; ++i)
+        {
+            const double gnss_dt = Headers[i+1].stamp.toSec() - Headers[i].stamp.toSec();
+            std::vector<double> rcv_clock_key{RCV_CLOCK_RESIDUAL, static_cast<double>(i), gnss_dt};
+            if (reuseResidual(rcv_clock_key, nullptr))
+                continue;
+            RcvClockFactor *rcv_clock_factor = newFactor<RcvClockFactor>(gnss_dt, config.GNSS_DDT_WEIGHT);
+            rememberResidual(rcv_clock_key, nullptr, problem.AddResidualBlock(rcv_clock_factor, NULL, 
+                para_rcv_clock[i], para_rcv_clock[i+1]));
+        }
+
         // build relationship between rcv_dt and rcv_ddt
-        for (size_t k = 0; k < 4; ++k)
+        for (size_t k = 0; !config.GNSS_MERGED_CLOCK && k < 4; ++k)
         {
             for (uint32_t i = 0; i < WINDOW_SIZE; ++i)
             {
                 const double gnss_dt = Headers[i+1].stamp.toSec() - Headers[i].stamp.toSec();
-                DtDdtFactor *dt_ddt_factor = new DtDdtFactor(gnss_dt);
-                problem.AddResidualBlock(dt_ddt_factor, NULL, para_rcv_dt+i*4+k, 
-                    para_rcv_dt+(i+1)*4+k, para_rcv_ddt+i, para_rcv_ddt+i+1);
+                std::vector<double> dt_ddt_key{DT_DDT_RESIDUAL, static_cast<double>(k), 
+                    static_cast<double>(i), gnss_dt};
+                if (reuseResidual(dt_ddt_key, nullptr))
+                    continue;
+                DtDdtFactor *dt_ddt_factor = newFactor<DtDdtFactor>(gnss_dt);
+                rememberResidual(dt_ddt_key, nullptr, problem.AddResidualBlock(dt_ddt_factor, NULL, 
+                    para_rcv_dt+i*4+k, para_rcv_dt+(i+1)*4+k, para_rcv_ddt+i, para_rcv_ddt+i+1));
             }
         }
 
         // add rcv_ddt smooth factor
-        for (int i = 0; i < WINDOW_SIZE; ++i)
+        for (int i = 0; !config.GNSS_MERGED_CLOCK && i < WINDOW_SIZE; ++i)
         {
-            DdtSmoothFactor *ddt_smooth_factor = new DdtSmoothFactor(GNSS_DDT_WEIGHT);
-            problem.AddResidualBlock(ddt_smooth_factor, NULL, para_rcv_ddt+i, para_rcv_ddt+i+1);
+            std::vector<double> ddt_smooth_key{DDT_SMOOTH_RESIDUAL, static_cast<double>(i)};
+            if (reuseResidual(ddt_smooth_key, nullptr))
+                continue;
+            DdtSmoothFactor *ddt_smooth_factor = newFactor<DdtSmoothFactor>(config.GNSS_DDT_WEIGHT);
+            rememberResidual(ddt_smooth_key, nullptr, problem.AddResidualBlock(ddt_smooth_factor, NULL, 
+                para_rcv_ddt+i, para_rcv_ddt+i+1));
         }
     }
 
     int f_m_cnt = 0;
     int feature_index = -1;
+    structureless_tracks.clear();
+    // unselected features keep their depth slot (feature_index) but get no residuals
+    f_manager.selectLandmarks(config.MAX_OPTIMIZED_FEATURES, Ps, tic, ric);
     for (auto &it_per_id : f_manager.feature)
     {
         it_per_id.used_num = it_per_id.feature_per_frame.size();
@@ -1018,11 +2013,35 @@ void Estimator::optimization()
             continue;
  
         ++feature_index;
+        if (!it_per_id.selected)
+            continue;
 
         int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
         
         Vector3d pts_i = it_per_id.feature_per_frame[0].point;
 
+        if (config.STRUCTURELESS_VISUAL)
+        {
+            const FeaturePerFrame &host = it_per_id.feature_per_frame[0];
+            StructurelessTrack track;
+            StructurelessTrackFactor *f = frame_arena.create<StructurelessTrackFactor>(host.point, host.velocity,
+                host.cur_td, config.ESTIMATE_TD != 0, para_Feature[feature_index][0]);
+            addStructurelessObservations(it_per_id, f, track.blocks);
+            problem.AddResidualBlock(f, loss_function, track.blocks);
+            track.factor = f;
+            track.feature_index = feature_index;
+            structureless_tracks.push_back(track);
+            f_m_cnt += it_per_id.used_num - 1;
+            continue;
+        }
+
+        if (config.VISUAL_TRACK_FACTOR)
+        {
+            addTrackResidual(problem, loss_function, it_per_id, feature_index);
+            f_m_cnt += it_per_id.used_num - 1;
+            continue;
+        }
+
         for (auto &it_per_frame : it_per_id.feature_per_frame)
         {
             imu_j++;
@@ -1031,44 +2050,109 @@ void Estimator::optimization()
                 continue;
             }
             Vector3d pts_j = it_per_frame.point;
-            if (ESTIMATE_TD)
+            f_m_cnt++;
+            std::vector<double> visual_key{VISUAL_RESIDUAL, static_cast<double>(it_per_id.feature_id), 
+                static_cast<double>(feature_index), static_cast<double>(imu_i), static_cast<double>(imu_j), 
+                pts_i.x(), pts_i.y(), pts_i.z(), pts_j.x(), pts_j.y(), pts_j.z()};
+            if (config.ESTIMATE_TD)
             {
-                    ProjectionTdFactor *f_td = new ProjectionTdFactor(pts_i, pts_j, 
+                visual_key.push_back(it_per_id.feature_per_frame[0].velocity.x());
+                visual_key.push_back(it_per_id.feature_per_frame[0].velocity.y());
+                visual_key.push_back(it_per_frame.velocity.x());
+                visual_key.push_back(it_per_frame.velocity.y());
+                visual_key.push_back(it_per_id.feature_per_frame[0].cur_td);
+                visual_key.push_back(it_per_frame.cur_td);
+            }
+            if (reuseResidual(visual_key, nullptr))
+                continue;
+            if (config.ESTIMATE_TD)
+            {
+                    ProjectionTdFactor *f_td = newFactor<ProjectionTdFactor>(pts_i, pts_j, 
                         it_per_id.feature_per_frame[0].velocity, it_per_frame.velocity,
                         it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                    problem.AddResidualBlock(f_td, loss_function, para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Feature[feature_index], para_Td[0]);
+                    rememberResidual(visual_key, nullptr, problem.AddResidualBlock(f_td, loss_function, 
+                        para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Feature[feature_index], para_Td[0]));
             }
             else
             {
-                ProjectionFactor *f = new ProjectionFactor(pts_i, pts_j);
-                problem.AddResidualBlock(f, loss_function, para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Feature[feature_index]);
+                ProjectionFactor *f = newFactor<ProjectionFactor>(pts_i, pts_j);
+                rememberResidual(visual_key, nullptr, problem.AddResidualBlock(f, loss_function, 
+                    para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Feature[feature_index]));
             }
-            f_m_cnt++;
         }
     }
 
-    ROS_DEBUG("visual measurement count: %d", f_m_cnt);
-    ROS_DEBUG("prepare for ceres: %f", t_prepare.toc());
+    if (config.INCREMENTAL_PROBLEM)
+    {
+        pruneStaleResiduals();
+        // depth blocks beyond the current feature count are no longer referenced
+        for (int k = feature_index + 1; k < inc_num_feature_blocks; ++k)
+        {
+            if (problem.HasParameterBlock(para_Feature[k]))
+                problem.RemoveParameterBlock(para_Feature[k]);
+        }
+        inc_num_feature_blocks = feature_index + 1;
+    }
+
+    GVINS_DEBUG("visual measurement count: %d", f_m_cnt);
+    GVINS_DEBUG("prepare for ceres: %f", t_prepare.toc());
 
     ceres::Solver::Options options;
-    options.linear_solver_type = ceres::DENSE_SCHUR;
-    //options.num_threads = 2;
-    options.trust_region_strategy_type = ceres::DOGLEG;
-    options.max_num_iterations = NUM_ITERATIONS;
+    configureSolver(problem, options);
+    options.max_num_iterations = config.NUM_ITERATIONS;
     //options.use_explicit_schur_complement = true;
     // options.minimizer_progress_to_stdout = true;
     options.use_nonmonotonic_steps = true;
-    if (marginalization_flag == MARGIN_OLD)
-        options.max_solver_time_in_seconds = SOLVER_TIME * 4.0 / 5.0;
+    // deterministic runs are bounded by the iterations only; the governor already accounts for the measured
+    // marginalization time
+    if (config.DETERMINISTIC)
+        options.max_solver_time_in_seconds = 1e9;   // ceres' default
+    else if (latency_governor.enabled())
+        options.max_solver_time_in_seconds = latency_governor.solverBudget() / 1000.0;
+    else if (marginalization_flag == MARGIN_OLD)
+        options.max_solver_time_in_seconds = config.SOLVER_TIME * 4.0 / 5.0;
     else
-        options.max_solver_time_in_seconds = SOLVER_TIME;
+        options.max_solver_time_in_seconds = config.SOLVER_TIME;
+    options.function_tolerance = config.SOLVER_STALL_RATIO;
+#ifdef GVINS_TRACE
+    TraceIterationCallback trace_iterations;
+    options.callbacks.push_back(&trace_iterations);
+#endif
+    watchSolver(options);
     TicToc t_solver;
     ceres::Solver::Summary summary;
-    ceres::Solve(options, &problem, &summary);
+    {
+        GVINS_TRACE_ZONE("ceres::Solve");
+        ScopedThreadConfig ceres_threads(config.CERES_THREADS, "ceres");
+        ceres::Solve(options, &problem, &summary);
+    }
+    solver_deadline.record(t_solver.toc());
+    latency_governor.endSolve();
+    if (latency_governor.enabled())
+        GVINS_DEBUG("solver budget %f ms, expected after the solve %f ms", options.max_solver_time_in_seconds * 1000.0,
+                  latency_governor.expectedPostSolve());
     // cout << summary.BriefReport() << endl;
     // cout << summary.FullReport() << endl;
-    ROS_DEBUG("Iterations : %d", static_cast<int>(summary.iterations.size()));
-    ROS_DEBUG("solver costs: %f", t_solver.toc());
+    GVINS_DEBUG("Iterations : %d, %s with %d threads", static_cast<int>(summary.iterations.size()),
+              ceres::LinearSolverTypeToString(summary.linear_solver_type_used), summary.num_threads_used);
+    GVINS_DEBUG("solver costs: %f", t_solver.toc());
+    solver_stats.solver_ms = t_solver.toc();
+    solver_stats.iterations = static_cast<int>(summary.iterations.size());
+    solver_stats.initial_cost = summary.initial_cost;
+    solver_stats.final_cost = summary.final_cost;
+    solver_stats.residual_blocks = problem.NumResidualBlocks();
+    solver_stats.parameter_blocks = problem.NumParameterBlocks();
+    if (solver_watchdog.lastReason() != SolverWatchdog::NONE)
+        GVINS_DEBUG("solver stopped by the watchdog: %s", SolverWatchdog::REASON_NAMES[solver_watchdog.lastReason()]);
+    // the state is left as before the solve, failureDetection takes over
+    if (solver_watchdog.diverged())
+    {
+        restoreDivergedSolve();
+        return;
+    }
+    // the eliminated depths at the solved poses, as the landmarks of the other factors
+    for (const StructurelessTrack &track : structureless_tracks)
+        para_Feature[track.feature_index][0] = track.factor->inverseDepth(track.blocks.data());
 
     while(para_yaw_enu_local[0] > M_PI)   para_yaw_enu_local[0] -= 2.0*M_PI;
     while(para_yaw_enu_local[0] < -M_PI)  para_yaw_enu_local[0] += 2.0*M_PI;
@@ -1076,44 +2160,60 @@ void Estimator::optimization()
 
     double2vector();
 
+    marginalizeWindow(loss_function);
+    
+    GVINS_DEBUG("whole time for ceres: %f", t_whole.toc());
+}
+
+/**
+ * 按 marginalization_flag 边缘化最老帧或次新帧, 作为下一次优化的先验; para_* 须已与状态一致,
+ * loss_function 为视觉残差在优化中使用的鲁棒核
+ */
+void Estimator::marginalizeWindow(ceres::LossFunction *loss_function)
+{
     TicToc t_whole_marginalization;
     if (marginalization_flag == MARGIN_OLD)
     {
+        GVINS_TRACE_ZONE("marginalizeOld");
+        // para_* already hold the state written back by double2vector
         MarginalizationInfo *marginalization_info = new MarginalizationInfo();
-        vector2double();
 
         if (last_marginalization_info)
         {
-            vector<int> drop_set;
-            for (int i = 0; i < static_cast<int>(last_marginalization_parameter_blocks.size()); i++)
+            for (int piece : last_marginalization_info->priorFactors())
             {
-                if (last_marginalization_parameter_blocks[i] == para_Pose[0] ||
-                    last_marginalization_parameter_blocks[i] == para_SpeedBias[0])
-                    drop_set.push_back(i);
+                const vector<double *> prior_blocks = priorParameterBlocks(piece);
+                vector<int> drop_set;
+                for (int i = 0; i < static_cast<int>(prior_blocks.size()); i++)
+                {
+                    if (prior_blocks[i] == para_Pose[0] ||
+                        prior_blocks[i] == para_SpeedBias[0])
+                        drop_set.push_back(i);
+                }
+                // construct new marginlization_factor
+                MarginalizationFactor *marginalization_factor = marginalization_info->create<MarginalizationFactor>(
+                    last_marginalization_info, piece);
+                ResidualBlockInfo *residual_block_info = marginalization_info->create<ResidualBlockInfo>(
+                    marginalization_factor, nullptr, prior_blocks, drop_set);
+                marginalization_info->addResidualBlockInfo(residual_block_info);
             }
-            // construct new marginlization_factor
-            MarginalizationFactor *marginalization_factor = new MarginalizationFactor(
-                last_marginalization_info);
-            ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(
-                marginalization_factor, NULL, last_marginalization_parameter_blocks, drop_set);
-            marginalization_info->addResidualBlockInfo(residual_block_info);
         }
         else
         {
             std::vector<double> anchor_value;
             for (uint32_t k = 0; k < 7; ++k)
                 anchor_value.push_back(para_Pose[0][k]);
-            PoseAnchorFactor *pose_anchor_factor = new PoseAnchorFactor(anchor_value);
-            ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(pose_anchor_factor, 
-                NULL, vector<double *>{para_Pose[0]}, vector<int>{0});
+            PoseAnchorFactor *pose_anchor_factor = marginalization_info->create<PoseAnchorFactor>(anchor_value);
+            ResidualBlockInfo *residual_block_info = marginalization_info->create<ResidualBlockInfo>(pose_anchor_factor, 
+                nullptr, vector<double *>{para_Pose[0]}, vector<int>{0});
             marginalization_info->addResidualBlockInfo(residual_block_info);
         }
 
         {
             if (pre_integrations[1]->sum_dt < 10.0)
             {
-                IMUFactor* imu_factor = new IMUFactor(pre_integrations[1]);
-                ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(imu_factor, NULL,
+                IMUFactor* imu_factor = marginalization_info->create<IMUFactor>(pre_integrations[1]);
+                ResidualBlockInfo *residual_block_info = marginalization_info->create<ResidualBlockInfo>(imu_factor, nullptr,
                                                                            vector<double *>{para_Pose[0], para_SpeedBias[0], para_Pose[1], para_SpeedBias[1]},
                                                                            vector<int>{0, 1});
                 marginalization_info->addResidualBlockInfo(residual_block_info);
@@ -1122,41 +2222,108 @@ void Estimator::optimization()
 
         if (gnss_ready)
         {
-            for (uint32_t j = 0; j < gnss_meas_buf[0].size(); ++j)
+            // the epochs of the first frame are all bound between frames 0 and 1
+            if (config.GNSS_EPOCH_FACTOR)
             {
-                const uint32_t sys = satsys(gnss_meas_buf[0][j]->sat, NULL);
-                const uint32_t sys_idx = gnss_comm::sys2idx.at(sys);
-
-                const double obs_local_ts = time2sec(gnss_meas_buf[0][j]->time) - diff_t_gnss_local;
-                const double lower_ts = Headers[0].stamp.toSec();
-                const double upper_ts = Headers[1].stamp.toSec();
-                const double ts_ratio = (upper_ts-obs_local_ts) / (upper_ts-lower_ts);
-
-                GnssPsrDoppFactor *gnss_factor = new GnssPsrDoppFactor(gnss_meas_buf[0][j], 
-                    gnss_ephem_buf[0][j], latest_gnss_iono_params, ts_ratio);
-                ResidualBlockInfo *psr_dopp_residual_block_info = new ResidualBlockInfo(gnss_factor, NULL,
-                    vector<double *>{para_Pose[0], para_SpeedBias[0], para_Pose[1], 
-                        para_SpeedBias[1],para_rcv_dt+sys_idx, para_rcv_ddt, 
-                        para_yaw_enu_local, para_anc_ecef},
-                    vector<int>{0, 1, 4, 5});
-                marginalization_info->addResidualBlockInfo(psr_dopp_residual_block_info);
+                for (const GnssEpochBinding &epoch : gnss_epoch_buf[0])
+                {
+                    const double ts_ratio = epoch.ts_ratio;
+                    std::vector<ObsPtr> epoch_obs(gnss_meas_buf[0].begin() + epoch.begin, 
+                        gnss_meas_buf[0].begin() + epoch.end);
+                    std::vector<EphemBasePtr> epoch_ephem(gnss_ephem_buf[0].begin() + epoch.begin, 
+                        gnss_ephem_buf[0].begin() + epoch.end);
+                    std::vector<SatStatePtr> epoch_sat_state(gnss_sat_state_buf[0].begin() + epoch.begin, 
+                        gnss_sat_state_buf[0].begin() + epoch.end);
+                    if (config.GNSS_MERGED_CLOCK)
+                    {
+                        GnssClockBlockFactor<GnssEpochFactor> *epoch_factor = 
+                            marginalization_info->create<GnssClockBlockFactor<GnssEpochFactor>>(
+                                epoch_obs, epoch_ephem, epoch_sat_state, latest_gnss_iono_params, ts_ratio);
+                        std::vector<int> clock_components{-1, -1, -1, -1, RCV_CLOCK_DDT_IDX, -1, -1};
+                        for (uint32_t sys_idx : epoch_factor->inner().sys_indices())
+                            clock_components.push_back(static_cast<int>(sys_idx));
+                        epoch_factor->setClockComponents(clock_components);
+                        ResidualBlockInfo *epoch_residual_block_info = marginalization_info->create<ResidualBlockInfo>(epoch_factor, nullptr,
+                            vector<double *>{para_Pose[0], para_SpeedBias[0], para_Pose[1], para_SpeedBias[1], 
+                                para_rcv_clock[0], para_yaw_enu_local, para_anc_ecef}, vector<int>{0, 1, 4});
+                        marginalization_info->addResidualBlockInfo(epoch_residual_block_info);
+                        continue;
+                    }
+                    GnssEpochFactor *epoch_factor = marginalization_info->create<GnssEpochFactor>(epoch_obs, epoch_ephem, 
+                        epoch_sat_state, latest_gnss_iono_params, ts_ratio);
+                    std::vector<double*> epoch_paras{para_Pose[0], para_SpeedBias[0], para_Pose[1], 
+                        para_SpeedBias[1], para_rcv_ddt, para_yaw_enu_local, para_anc_ecef};
+                    std::vector<int> drop_set{0, 1, 4};
+                    for (uint32_t sys_idx : epoch_factor->sys_indices())
+                    {
+                        drop_set.push_back(static_cast<int>(epoch_paras.size()));
+                        epoch_paras.push_back(para_rcv_dt+sys_idx);
+                    }
+                    ResidualBlockInfo *epoch_residual_block_info = marginalization_info->create<ResidualBlockInfo>(epoch_factor, nullptr,
+                        epoch_paras, drop_set);
+                    marginalization_info->addResidualBlockInfo(epoch_residual_block_info);
+                }
+            }
+            else
+            {
+                for (const GnssEpochBinding &epoch : gnss_epoch_buf[0])
+                {
+                    for (uint32_t j = epoch.begin; j < epoch.end; ++j)
+                    {
+                        const uint32_t sys = satsys(gnss_meas_buf[0][j]->sat, NULL);
+                        const uint32_t sys_idx = gnss_comm::sys2idx.at(sys);
+                        const double ts_ratio = epoch.ts_ratio;
+
+                        if (config.GNSS_MERGED_CLOCK)
+                        {
+                            GnssClockBlockFactor<GnssPsrDoppFactor> *gnss_factor = 
+                                marginalization_info->create<GnssClockBlockFactor<GnssPsrDoppFactor>>(gnss_meas_buf[0][j], 
+                                    gnss_ephem_buf[0][j], gnss_sat_state_buf[0][j], latest_gnss_iono_params, ts_ratio);
+                            gnss_factor->setClockComponents(std::vector<int>{-1, -1, -1, -1, 
+                                static_cast<int>(sys_idx), RCV_CLOCK_DDT_IDX, -1, -1});
+                            ResidualBlockInfo *psr_dopp_residual_block_info = marginalization_info->create<ResidualBlockInfo>(gnss_factor, nullptr,
+                                vector<double *>{para_Pose[0], para_SpeedBias[0], para_Pose[1], para_SpeedBias[1], 
+                                    para_rcv_clock[0], para_yaw_enu_local, para_anc_ecef}, vector<int>{0, 1, 4});
+                            marginalization_info->addResidualBlockInfo(psr_dopp_residual_block_info);
+                            continue;
+                        }
+                        GnssPsrDoppFactor *gnss_factor = marginalization_info->create<GnssPsrDoppFactor>(gnss_meas_buf[0][j], 
+                            gnss_ephem_buf[0][j], gnss_sat_state_buf[0][j], latest_gnss_iono_params, ts_ratio);
+                        ResidualBlockInfo *psr_dopp_residual_block_info = marginalization_info->create<ResidualBlockInfo>(gnss_factor, nullptr,
+                            vector<double *>{para_Pose[0], para_SpeedBias[0], para_Pose[1], 
+                                para_SpeedBias[1],para_rcv_dt+sys_idx, para_rcv_ddt, 
+                                para_yaw_enu_local, para_anc_ecef},
+                            vector<int>{0, 1, 4, 5});
+                        marginalization_info->addResidualBlockInfo(psr_dopp_residual_block_info);
+                    }
+                }
             }
 
             const double gnss_dt = Headers[1].stamp.toSec() - Headers[0].stamp.toSec();
-            for (size_t k = 0; k < 4; ++k)
+            if (config.GNSS_MERGED_CLOCK)
             {
-                DtDdtFactor *dt_ddt_factor = new DtDdtFactor(gnss_dt);
-                ResidualBlockInfo *dt_ddt_residual_block_info = new ResidualBlockInfo(dt_ddt_factor, NULL,
+                RcvClockFactor *rcv_clock_factor = marginalization_info->create<RcvClockFactor>(gnss_dt, config.GNSS_DDT_WEIGHT);
+                ResidualBlockInfo *rcv_clock_residual_block_info = marginalization_info->create<ResidualBlockInfo>(rcv_clock_factor, nullptr,
+                    vector<double *>{para_rcv_clock[0], para_rcv_clock[1]}, vector<int>{0});
+                marginalization_info->addResidualBlockInfo(rcv_clock_residual_block_info);
+            }
+            for (size_t k = 0; !config.GNSS_MERGED_CLOCK && k < 4; ++k)
+            {
+                DtDdtFactor *dt_ddt_factor = marginalization_info->create<DtDdtFactor>(gnss_dt);
+                ResidualBlockInfo *dt_ddt_residual_block_info = marginalization_info->create<ResidualBlockInfo>(dt_ddt_factor, nullptr,
                     vector<double *>{para_rcv_dt+k, para_rcv_dt+4+k, para_rcv_ddt, para_rcv_ddt+1}, 
                     vector<int>{0, 2});
                 marginalization_info->addResidualBlockInfo(dt_ddt_residual_block_info);
             }
 
             // margin rcv_ddt smooth factor
-            DdtSmoothFactor *ddt_smooth_factor = new DdtSmoothFactor(GNSS_DDT_WEIGHT);
-            ResidualBlockInfo *ddt_smooth_residual_block_info = new ResidualBlockInfo(ddt_smooth_factor, NULL,
-                    vector<double *>{para_rcv_ddt, para_rcv_ddt+1}, vector<int>{0});
-            marginalization_info->addResidualBlockInfo(ddt_smooth_residual_block_info);
+            if (!config.GNSS_MERGED_CLOCK)
+            {
+                DdtSmoothFactor *ddt_smooth_factor = marginalization_info->create<DdtSmoothFactor>(config.GNSS_DDT_WEIGHT);
+                ResidualBlockInfo *ddt_smooth_residual_block_info = marginalization_info->create<ResidualBlockInfo>(ddt_smooth_factor, nullptr,
+                        vector<double *>{para_rcv_ddt, para_rcv_ddt+1}, vector<int>{0});
+                marginalization_info->addResidualBlockInfo(ddt_smooth_residual_block_info);
+            }
         }
 
         {
@@ -1170,11 +2337,25 @@ void Estimator::optimization()
                 ++feature_index;
 
                 int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
-                if (imu_i != 0)
+                if (imu_i != 0 || !it_per_id.selected)
                     continue;
 
                 Vector3d pts_i = it_per_id.feature_per_frame[0].point;
 
+                if (config.STRUCTURELESS_VISUAL)
+                {
+                    // only the poses enter the prior, no landmark is marginalized
+                    const FeaturePerFrame &host = it_per_id.feature_per_frame[0];
+                    StructurelessTrackFactor *f = marginalization_info->create<StructurelessTrackFactor>(host.point,
+                        host.velocity, host.cur_td, config.ESTIMATE_TD != 0, para_Feature[feature_index][0]);
+                    std::vector<double *> blocks;
+                    addStructurelessObservations(it_per_id, f, blocks);
+                    ResidualBlockInfo *residual_block_info = marginalization_info->create<ResidualBlockInfo>(f,
+                        loss_function, blocks, vector<int>{0});
+                    marginalization_info->addResidualBlockInfo(residual_block_info);
+                    continue;
+                }
+
                 for (auto &it_per_frame : it_per_id.feature_per_frame)
                 {
                     imu_j++;
@@ -1182,12 +2363,12 @@ void Estimator::optimization()
                         continue;
 
                     Vector3d pts_j = it_per_frame.point;
-                    if (ESTIMATE_TD)
+                    if (config.ESTIMATE_TD)
                     {
-                        ProjectionTdFactor *f_td = new ProjectionTdFactor(pts_i, pts_j, 
+                        ProjectionTdFactor *f_td = marginalization_info->create<ProjectionTdFactor>(pts_i, pts_j, 
                             it_per_id.feature_per_frame[0].velocity, it_per_frame.velocity,
                             it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                        ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(f_td, 
+                        ResidualBlockInfo *residual_block_info = marginalization_info->create<ResidualBlockInfo>(f_td, 
                             loss_function, vector<double *>{para_Pose[imu_i], para_Pose[imu_j], 
                                 para_Ex_Pose[0], para_Feature[feature_index], para_Td[0]},
                             vector<int>{0, 3});
@@ -1195,8 +2376,8 @@ void Estimator::optimization()
                     }
                     else
                     {
-                        ProjectionFactor *f = new ProjectionFactor(pts_i, pts_j);
-                        ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(f, 
+                        ProjectionFactor *f = marginalization_info->create<ProjectionFactor>(pts_i, pts_j);
+                        ResidualBlockInfo *residual_block_info = marginalization_info->create<ResidualBlockInfo>(f, 
                             loss_function, vector<double *>{para_Pose[imu_i], para_Pose[imu_j], 
                                 para_Ex_Pose[0], para_Feature[feature_index]},
                             vector<int>{0, 3});
@@ -1208,11 +2389,7 @@ void Estimator::optimization()
 
         TicToc t_pre_margin;
         marginalization_info->preMarginalize();
-        ROS_DEBUG("pre marginalization %f ms", t_pre_margin.toc());
-        
-        TicToc t_margin;
-        marginalization_info->marginalize();
-        ROS_DEBUG("marginalization %f ms", t_margin.toc());
+        GVINS_DEBUG("pre marginalization %f ms", t_pre_margin.toc());
 
         std::unordered_map<long, double *> addr_shift;
         for (int i = 1; i <= WINDOW_SIZE; i++)
@@ -1222,58 +2399,53 @@ void Estimator::optimization()
             for (uint32_t k = 0; k < 4; ++k)
                 addr_shift[reinterpret_cast<long>(para_rcv_dt+i*4+k)] = para_rcv_dt+(i-1)*4+k;
             addr_shift[reinterpret_cast<long>(para_rcv_ddt+i)] = para_rcv_ddt+i-1;
+            addr_shift[reinterpret_cast<long>(para_rcv_clock[i])] = para_rcv_clock[i-1];
         }
         for (int i = 0; i < NUM_OF_CAM; i++)
             addr_shift[reinterpret_cast<long>(para_Ex_Pose[i])] = para_Ex_Pose[i];
-        if (ESTIMATE_TD)
+        if (config.ESTIMATE_TD)
         {
             addr_shift[reinterpret_cast<long>(para_Td[0])] = para_Td[0];
         }
         addr_shift[reinterpret_cast<long>(para_yaw_enu_local)] = para_yaw_enu_local;
         addr_shift[reinterpret_cast<long>(para_anc_ecef)] = para_anc_ecef;
-        vector<double *> parameter_blocks = marginalization_info->getParameterBlocks(addr_shift);
-
-        if (last_marginalization_info)
-            delete last_marginalization_info;
-        last_marginalization_info = marginalization_info;
-        last_marginalization_parameter_blocks = parameter_blocks;
-        
+        finishMarginalization(marginalization_info, std::move(addr_shift));
     }
     else
     {
+        GVINS_TRACE_ZONE("marginalizeSecondNew");
         if (last_marginalization_info &&
             std::count(std::begin(last_marginalization_parameter_blocks), std::end(last_marginalization_parameter_blocks), para_Pose[WINDOW_SIZE - 1]))
         {
 
             MarginalizationInfo *marginalization_info = new MarginalizationInfo();
-            vector2double();
             if (last_marginalization_info)
             {
-                vector<int> drop_set;
-                for (int i = 0; i < static_cast<int>(last_marginalization_parameter_blocks.size()); i++)
+                for (int piece : last_marginalization_info->priorFactors())
                 {
-                    ROS_ASSERT(last_marginalization_parameter_blocks[i] != para_SpeedBias[WINDOW_SIZE - 1]);
-                    if (last_marginalization_parameter_blocks[i] == para_Pose[WINDOW_SIZE - 1])
-                        drop_set.push_back(i);
+                    const vector<double *> prior_blocks = priorParameterBlocks(piece);
+                    vector<int> drop_set;
+                    for (int i = 0; i < static_cast<int>(prior_blocks.size()); i++)
+                    {
+                        GVINS_ASSERT(prior_blocks[i] != para_SpeedBias[WINDOW_SIZE - 1]);
+                        if (prior_blocks[i] == para_Pose[WINDOW_SIZE - 1])
+                            drop_set.push_back(i);
+                    }
+                    // construct new marginlization_factor
+                    MarginalizationFactor *marginalization_factor = marginalization_info->create<MarginalizationFactor>(
+                        last_marginalization_info, piece);
+                    ResidualBlockInfo *residual_block_info = marginalization_info->create<ResidualBlockInfo>(marginalization_factor, nullptr,
+                                                                                   prior_blocks,
+                                                                                   drop_set);
+
+                    marginalization_info->addResidualBlockInfo(residual_block_info);
                 }
-                // construct new marginlization_factor
-                MarginalizationFactor *marginalization_factor = new MarginalizationFactor(last_marginalization_info);
-                ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(marginalization_factor, NULL,
-                                                                               last_marginalization_parameter_blocks,
-                                                                               drop_set);
-
-                marginalization_info->addResidualBlockInfo(residual_block_info);
             }
 
             TicToc t_pre_margin;
-            ROS_DEBUG("begin marginalization");
+            GVINS_DEBUG("begin marginalization");
             marginalization_info->preMarginalize();
-            ROS_DEBUG("end pre marginalization, %f ms", t_pre_margin.toc());
-
-            TicToc t_margin;
-            ROS_DEBUG("begin marginalization");
-            marginalization_info->marginalize();
-            ROS_DEBUG("end marginalization, %f ms", t_margin.toc());
+            GVINS_DEBUG("end pre marginalization, %f ms", t_pre_margin.toc());
             
             std::unordered_map<long, double *> addr_shift;
             for (int i = 0; i <= WINDOW_SIZE; i++)
@@ -1287,6 +2459,7 @@ void Estimator::optimization()
                     for (uint32_t k = 0; k < 4; ++k)
                         addr_shift[reinterpret_cast<long>(para_rcv_dt+i*4+k)] = para_rcv_dt+(i-1)*4+k;
                     addr_shift[reinterpret_cast<long>(para_rcv_ddt+i)] = para_rcv_ddt+i-1;
+                    addr_shift[reinterpret_cast<long>(para_rcv_clock[i])] = para_rcv_clock[i-1];
                 }
                 else
                 {
@@ -1295,31 +2468,263 @@ void Estimator::optimization()
                     for (uint32_t k = 0; k < 4; ++k)
                         addr_shift[reinterpret_cast<long>(para_rcv_dt+i*4+k)] = para_rcv_dt+i*4+k;
                     addr_shift[reinterpret_cast<long>(para_rcv_ddt+i)] = para_rcv_ddt+i;
+                    addr_shift[reinterpret_cast<long>(para_rcv_clock[i])] = para_rcv_clock[i];
                 }
             }
             for (int i = 0; i < NUM_OF_CAM; i++)
                 addr_shift[reinterpret_cast<long>(para_Ex_Pose[i])] = para_Ex_Pose[i];
-            if (ESTIMATE_TD)
+            if (config.ESTIMATE_TD)
             {
                 addr_shift[reinterpret_cast<long>(para_Td[0])] = para_Td[0];
             }
             addr_shift[reinterpret_cast<long>(para_yaw_enu_local)] = para_yaw_enu_local;
             addr_shift[reinterpret_cast<long>(para_anc_ecef)] = para_anc_ecef;
-            vector<double *> parameter_blocks = marginalization_info->getParameterBlocks(addr_shift);
-            if (last_marginalization_info)
-                delete last_marginalization_info;
-            last_marginalization_info = marginalization_info;
-            last_marginalization_parameter_blocks = parameter_blocks;
-            
+            finishMarginalization(marginalization_info, std::move(addr_shift));
         }
     }
-    ROS_DEBUG("whole marginalization costs: %f", t_whole_marginalization.toc());
-    
-    ROS_DEBUG("whole time for ceres: %f", t_whole.toc());
+    solver_stats.marginalization_ms = t_whole_marginalization.toc();
+    GVINS_DEBUG("whole marginalization costs: %f", solver_stats.marginalization_ms);
+}
+
+/**
+ * 一个特征的全部观测作为一个 ProjectionTrackFactor 残差块; 增量模式下以整条轨迹为键复用,
+ * 新增一个观测即重建该特征的残差块
+ */
+void Estimator::addTrackResidual(ceres::Problem &problem, ceres::LossFunction *loss_function,
+                                 const FeaturePerId &it_per_id, int feature_index)
+{
+    const FeaturePerFrame &host = it_per_id.feature_per_frame[0];
+    const int imu_i = it_per_id.start_frame;
+    std::vector<double> track_key{VISUAL_TRACK_RESIDUAL, static_cast<double>(it_per_id.feature_id),
+        static_cast<double>(feature_index), static_cast<double>(imu_i), host.point.x(), host.point.y(), host.point.z()};
+    if (config.ESTIMATE_TD)
+        track_key.insert(track_key.end(), {host.velocity.x(), host.velocity.y(), host.cur_td});
+    for (size_t k = 1; k < it_per_id.feature_per_frame.size(); ++k)
+    {
+        const FeaturePerFrame &obs = it_per_id.feature_per_frame[k];
+        track_key.insert(track_key.end(), {obs.point.x(), obs.point.y(), obs.point.z()});
+        if (config.ESTIMATE_TD)
+            track_key.insert(track_key.end(), {obs.velocity.x(), obs.velocity.y(), obs.cur_td});
+    }
+    if (reuseResidual(track_key, nullptr))
+        return;
+
+    ProjectionTrackFactor *f = newFactor<ProjectionTrackFactor>(host.point, host.velocity, host.cur_td, config.ESTIMATE_TD != 0);
+    std::vector<double *> blocks{para_Pose[imu_i], para_Ex_Pose[0], para_Feature[feature_index]};
+    if (config.ESTIMATE_TD)
+        blocks.push_back(para_Td[0]);
+    for (size_t k = 1; k < it_per_id.feature_per_frame.size(); ++k)
+    {
+        const FeaturePerFrame &obs = it_per_id.feature_per_frame[k];
+        f->addObservation(obs.point, obs.velocity, obs.cur_td);
+        blocks.push_back(para_Pose[imu_i + k]);
+    }
+    rememberResidual(track_key, nullptr, problem.AddResidualBlock(f, loss_function, blocks));
+}
+
+void Estimator::addStructurelessObservations(const FeaturePerId &it_per_id, StructurelessTrackFactor *factor,
+                                             std::vector<double *> &blocks)
+{
+    const int imu_i = it_per_id.start_frame;
+    blocks.assign({para_Pose[imu_i], para_Ex_Pose[0]});
+    if (config.ESTIMATE_TD)
+        blocks.push_back(para_Td[0]);
+    for (size_t k = 1; k < it_per_id.feature_per_frame.size(); ++k)
+    {
+        const FeaturePerFrame &obs = it_per_id.feature_per_frame[k];
+        factor->addObservation(obs.point, obs.velocity, obs.cur_td);
+        blocks.push_back(para_Pose[imu_i + k]);
+    }
+}
+
+/**
+ * 逆深度块互不相连 (每个只出现在同一特征的投影因子中), 作为第 0 组先消元; 位姿/速度偏置/外参/td
+ * 以及 GNSS 的钟差/钟漂/yaw/anchor 留在第 1 组, 即约化相机系统中. GNSS 的 1 维钟差块若交给 ceres
+ * 自动排序会被当成可消元块, 约化系统的稀疏结构随卫星系统数变化
+ * linear_solver 为 auto 时按约化系统维数选择: 小维数稠密 Schur, 大维数稀疏 Schur (没有稀疏库时迭代 Schur)
+ * gpu_dense 且 ceres 带 CUDA 时, 不小于 gpu_dense_min_size 的稠密约化系统在 GPU 上分解, 稠密 Schur 的上限随之提高
+ */
+void Estimator::configureSolver(const ceres::Problem &problem, ceres::Solver::Options &options)
+{
+    // reduced systems up to this size are faster to factorize densely
+    const int MAX_DENSE_SCHUR_SIZE = 600;
+    // on the GPU the dense factorization stays faster than the sparse one up to a larger size
+    const int MAX_GPU_DENSE_SCHUR_SIZE = 3000;
+
+    vector<double *> blocks;
+    problem.GetParameterBlocks(&blocks);
+    std::shared_ptr<ceres::ParameterBlockOrdering<double *>> ordering(new ceres::ParameterBlockOrdering<double *>());
+    const double *feature_begin = para_Feature[0], *feature_end = para_Feature[0] + NUM_OF_F * SIZE_FEATURE;
+    int num_eliminated = 0, reduced_size = 0;
+    for (double *block : blocks)
+    {
+        if (block >= feature_begin && block < feature_end)
+        {
+            ordering->AddElementToGroup(block, 0);
+            ++num_eliminated;
+        }
+        else
+        {
+            ordering->AddElementToGroup(block, 1);
+            if (!problem.IsParameterBlockConstant(block))
+                reduced_size += problem.ParameterBlockLocalSize(block);
+        }
+    }
+    options.linear_solver_ordering = ordering;
+    options.num_threads = std::max(config.NUM_SOLVER_THREADS, 1);
+
+#ifdef GVINS_CERES_CUDA
+    const bool gpu_dense = config.GPU_DENSE && reduced_size >= config.GPU_DENSE_MIN_SIZE;
+#else
+    const bool gpu_dense = false;
+#endif
+
+    ceres::LinearSolverType type;
+    if (config.LINEAR_SOLVER == "dense_schur")
+        type = ceres::DENSE_SCHUR;
+    else if (config.LINEAR_SOLVER == "sparse_schur")
+        type = ceres::SPARSE_SCHUR;
+    else if (config.LINEAR_SOLVER == "iterative_schur")
+        type = ceres::ITERATIVE_SCHUR;
+    else if (reduced_size <= (gpu_dense ? MAX_GPU_DENSE_SCHUR_SIZE : MAX_DENSE_SCHUR_SIZE))
+        type = ceres::DENSE_SCHUR;
+    else
+        type = ceres::SPARSE_SCHUR;
+    // nothing to eliminate (STRUCTURELESS_VISUAL), the normal equations are the reduced system
+    if (num_eliminated == 0)
+    {
+        if (type == ceres::DENSE_SCHUR)
+            type = ceres::DENSE_NORMAL_CHOLESKY;
+        else if (type == ceres::SPARSE_SCHUR)
+            type = ceres::SPARSE_NORMAL_CHOLESKY;
+        else
+            type = ceres::CGNR;
+    }
+    // the default library is the best one ceres was built with
+    if (type == ceres::SPARSE_SCHUR && options.sparse_linear_algebra_library_type == ceres::NO_SPARSE)
+        type = ceres::ITERATIVE_SCHUR;
+    if (type == ceres::SPARSE_NORMAL_CHOLESKY && options.sparse_linear_algebra_library_type == ceres::NO_SPARSE)
+        type = ceres::CGNR;
+    options.linear_solver_type = type;
+    if (type == ceres::ITERATIVE_SCHUR || type == ceres::CGNR)
+    {
+        // dogleg needs an exact solve of the normal equations
+        options.preconditioner_type = (type == ceres::CGNR ? ceres::JACOBI : ceres::SCHUR_JACOBI);
+        options.trust_region_strategy_type = ceres::LEVENBERG_MARQUARDT;
+    }
+    else
+        options.trust_region_strategy_type = ceres::DOGLEG;
+    const bool on_gpu = gpu_dense && (type == ceres::DENSE_SCHUR || type == ceres::DENSE_NORMAL_CHOLESKY);
+#ifdef GVINS_CERES_CUDA
+    if (on_gpu)
+        options.dense_linear_algebra_library_type = ceres::CUDA;
+#endif
+
+    const std::string description = std::string(ceres::LinearSolverTypeToString(type)) + (on_gpu ? " (cuda)" : "") +
+        ", " + std::to_string(options.num_threads) + " threads";
+    if (description != solver_config)
+    {
+        GVINS_INFO("ceres solver: %s, %d inverse depths eliminated, reduced system %d", description.c_str(),
+                 num_eliminated, reduced_size);
+        solver_config = description;
+    }
+}
+
+/**
+ * preMarginalize 已经把参数块的值和雅可比拷贝进 marginalization_info, 之后的 Schur 补和 getParameterBlocks
+ * 只用其内部数据和地址, 因此可以与 slideWindow 及下一帧的 processIMU/processGNSS/特征关联并行执行
+ */
+void Estimator::finishMarginalization(MarginalizationInfo *marginalization_info,
+                                      std::unordered_map<long, double *> &&addr_shift)
+{
+    if (!config.PIPELINE_MARGINALIZATION)
+    {
+        GVINS_TRACE_ZONE("finishMarginalization");
+        TicToc t_margin;
+        marginalization_info->marginalize();
+        marginalization_deadline.record(t_margin.toc());
+        GVINS_DEBUG("marginalization %f ms", t_margin.toc());
+        vector<double *> parameter_blocks = marginalization_info->getParameterBlocks(addr_shift);
+        if (config.SPARSIFY_PRIOR)
+            sparsifyPrior(marginalization_info, parameter_blocks);
+        if (last_marginalization_info)
+            delete last_marginalization_info;
+        last_marginalization_info = marginalization_info;
+        last_marginalization_parameter_blocks = parameter_blocks;
+        return;
+    }
+
+    pending_marginalization_info = marginalization_info;
+    // addr_shift is moved into the job, it is only needed by getParameterBlocks
+    std::shared_ptr<std::unordered_map<long, double *>> shift(
+        new std::unordered_map<long, double *>(std::move(addr_shift)));
+    marginalization_stage.submit([this, marginalization_info, shift]()
+    {
+        GVINS_TRACE_ZONE("finishMarginalization");
+        TicToc t_margin;
+        marginalization_info->marginalize();
+        marginalization_deadline.record(t_margin.toc());
+        pending_marginalization_parameter_blocks = marginalization_info->getParameterBlocks(*shift);
+        if (config.SPARSIFY_PRIOR)
+            sparsifyPrior(marginalization_info, pending_marginalization_parameter_blocks);
+        GVINS_DEBUG("marginalization %f ms (pipelined)", t_margin.toc());
+    });
+}
+
+vector<double *> Estimator::priorParameterBlocks(int piece) const
+{
+    if (piece < 0)
+        return last_marginalization_parameter_blocks;
+    vector<double *> blocks;
+    for (int k : last_marginalization_info->priorBlocks(piece))
+        blocks.push_back(last_marginalization_parameter_blocks[k]);
+    return blocks;
+}
+
+/**
+ * 按参数块所属的窗口帧分组后稀疏化先验 (见 MarginalizationInfo::sparsify), 只比较地址, 可在流水线的边缘化线程中执行;
+ * 丢失的信息 (KL 散度) 和先验每次求值节省的时间计入 /diagnostics
+ */
+void Estimator::sparsifyPrior(MarginalizationInfo *marginalization_info, const vector<double *> &parameter_blocks)
+{
+    vector<int> block_group(parameter_blocks.size(), -1);
+    for (size_t k = 0; k < parameter_blocks.size(); k++)
+    {
+        const double *addr = parameter_blocks[k];
+        for (int i = 0; i <= WINDOW_SIZE; i++)
+        {
+            if (addr == para_Pose[i] || addr == para_SpeedBias[i] || addr == para_rcv_ddt + i ||
+                addr == para_rcv_clock[i] || (addr >= para_rcv_dt + i * 4 && addr < para_rcv_dt + (i + 1) * 4))
+            {
+                block_group[k] = i;
+                break;
+            }
+        }
+    }
+    if (!marginalization_info->sparsify(block_group))
+        return;
+    StageProfiler &profiler = StageProfiler::instance();
+    profiler.count(StageProfiler::PRIOR_INFO_LOSS, marginalization_info->sparsify_kl);
+    profiler.count(StageProfiler::PRIOR_EVAL_SAVED,
+                   1e3 * (marginalization_info->t_dense_eval_ms - marginalization_info->t_sparse_eval_ms));
+}
+
+void Estimator::waitMarginalization()
+{
+    marginalization_stage.wait();
+    if (pending_marginalization_info == nullptr)
+        return;
+    if (last_marginalization_info)
+        delete last_marginalization_info;
+    last_marginalization_info = pending_marginalization_info;
+    last_marginalization_parameter_blocks.swap(pending_marginalization_parameter_blocks);
+    pending_marginalization_info = nullptr;
+    pending_marginalization_parameter_blocks.clear();
 }
 
 void Estimator::slideWindow()
 {
+    GVINS_TRACE_ZONE("slideWindow");
     TicToc t_margin;
     if (marginalization_flag == MARGIN_OLD)
     {
@@ -1328,25 +2733,27 @@ void Estimator::slideWindow()
         back_P0 = Ps[0];
         if (frame_count == WINDOW_SIZE)
         {
+            // 环形窗口只移动 head, 最老帧的槽位变为第 WINDOW_SIZE 帧, 下面重置其内容
+            Rs.rotate();
+            Ps.rotate();
+            Vs.rotate();
+            Bas.rotate();
+            Bgs.rotate();
+            Headers.rotate();
+            pre_integrations.rotate();
+            dt_buf.rotate();
+            linear_acceleration_buf.rotate();
+            angular_velocity_buf.rotate();
+            imu_samples_buf.rotate();
+
+            // GNSS related
+            gnss_meas_buf.rotate();
+            gnss_ephem_buf.rotate();
+            gnss_sat_state_buf.rotate();
+            gnss_epoch_buf.rotate();
+            // ceres parameter blocks must stay contiguous, shift the few clock values
             for (int i = 0; i < WINDOW_SIZE; i++)
             {
-                Rs[i].swap(Rs[i + 1]);
-
-                std::swap(pre_integrations[i], pre_integrations[i + 1]);
-
-                dt_buf[i].swap(dt_buf[i + 1]);
-                linear_acceleration_buf[i].swap(linear_acceleration_buf[i + 1]);
-                angular_velocity_buf[i].swap(angular_velocity_buf[i + 1]);
-
-                Headers[i] = Headers[i + 1];
-                Ps[i].swap(Ps[i + 1]);
-                Vs[i].swap(Vs[i + 1]);
-                Bas[i].swap(Bas[i + 1]);
-                Bgs[i].swap(Bgs[i + 1]);
-
-                // GNSS related
-                gnss_meas_buf[i].swap(gnss_meas_buf[i+1]);
-                gnss_ephem_buf[i].swap(gnss_ephem_buf[i+1]);
                 for (uint32_t k = 0; k < 4; ++k)
                     para_rcv_dt[i*4+k] = para_rcv_dt[(i+1)*4+k];
                 para_rcv_ddt[i] = para_rcv_ddt[i+1];
@@ -1361,15 +2768,19 @@ void Estimator::slideWindow()
             // GNSS related
             gnss_meas_buf[WINDOW_SIZE].clear();
             gnss_ephem_buf[WINDOW_SIZE].clear();
+            gnss_sat_state_buf[WINDOW_SIZE].clear();
+            gnss_epoch_buf[WINDOW_SIZE].clear();
+            // the epochs of the new first frame before it now extrapolate
+            bindGNSSEpochs(0, WINDOW_SIZE - 1);
 
-            delete pre_integrations[WINDOW_SIZE];
-            pre_integrations[WINDOW_SIZE] = new IntegrationBase{acc_0, gyr_0, Bas[WINDOW_SIZE], Bgs[WINDOW_SIZE]};
+            pre_integrations[WINDOW_SIZE]->reset(acc_0, gyr_0, Bas[WINDOW_SIZE], Bgs[WINDOW_SIZE]);
 
             dt_buf[WINDOW_SIZE].clear();
             linear_acceleration_buf[WINDOW_SIZE].clear();
             angular_velocity_buf[WINDOW_SIZE].clear();
+            imu_samples_buf[WINDOW_SIZE].clear();
 
-            if (true || solver_flag == INITIAL)
+            if (solver_flag == INITIAL)
             {
                 map<double, ImageFrame>::iterator it_0;
                 it_0 = all_image_frame.find(t_0);
@@ -1399,12 +2810,15 @@ void Estimator::slideWindow()
                 double tmp_dt = dt_buf[frame_count][i];
                 Vector3d tmp_linear_acceleration = linear_acceleration_buf[frame_count][i];
                 Vector3d tmp_angular_velocity = angular_velocity_buf[frame_count][i];
+                int tmp_num_samples = imu_samples_buf[frame_count][i];
 
-                pre_integrations[frame_count - 1]->push_back(tmp_dt, tmp_linear_acceleration, tmp_angular_velocity);
+                pre_integrations[frame_count - 1]->push_back(tmp_dt, tmp_linear_acceleration, tmp_angular_velocity,
+                                                             tmp_num_samples);
 
                 dt_buf[frame_count - 1].push_back(tmp_dt);
                 linear_acceleration_buf[frame_count - 1].push_back(tmp_linear_acceleration);
                 angular_velocity_buf[frame_count - 1].push_back(tmp_angular_velocity);
+                imu_samples_buf[frame_count - 1].push_back(tmp_num_samples);
             }
 
             Headers[frame_count - 1] = Headers[frame_count];
@@ -1415,20 +2829,27 @@ void Estimator::slideWindow()
             Bgs[frame_count - 1] = Bgs[frame_count];
 
             // GNSS related
-            gnss_meas_buf[frame_count-1] = gnss_meas_buf[frame_count];
-            gnss_ephem_buf[frame_count-1] = gnss_ephem_buf[frame_count];
+            gnss_meas_buf[frame_count-1].swap(gnss_meas_buf[frame_count]);
+            gnss_ephem_buf[frame_count-1].swap(gnss_ephem_buf[frame_count]);
+            gnss_sat_state_buf[frame_count-1].swap(gnss_sat_state_buf[frame_count]);
+            gnss_epoch_buf[frame_count-1].swap(gnss_epoch_buf[frame_count]);
             for (uint32_t k = 0; k < 4; ++k)
                 para_rcv_dt[(frame_count-1)*4+k] = para_rcv_dt[frame_count*4+k];
             para_rcv_ddt[frame_count-1] = para_rcv_ddt[frame_count];
             gnss_meas_buf[frame_count].clear();
             gnss_ephem_buf[frame_count].clear();
+            gnss_sat_state_buf[frame_count].clear();
+            gnss_epoch_buf[frame_count].clear();
+            // the frame before the dropped one and its successor are neighbours now
+            bindGNSSEpochs(frame_count - 2, frame_count - 1);
+            bindGNSSEpochs(frame_count - 1, frame_count - 1);
 
-            delete pre_integrations[WINDOW_SIZE];
-            pre_integrations[WINDOW_SIZE] = new IntegrationBase{acc_0, gyr_0, Bas[WINDOW_SIZE], Bgs[WINDOW_SIZE]};
+            pre_integrations[WINDOW_SIZE]->reset(acc_0, gyr_0, Bas[WINDOW_SIZE], Bgs[WINDOW_SIZE]);
 
             dt_buf[WINDOW_SIZE].clear();
             linear_acceleration_buf[WINDOW_SIZE].clear();
             angular_velocity_buf[WINDOW_SIZE].clear();
+            imu_samples_buf[WINDOW_SIZE].clear();
 
             slideWindowNew();
         }
@@ -3,32 +3,46 @@
 #include <typeinfo>
 #include "parameters.h"
 #include "feature_manager.h"
+#include "ephem_store.h"
+#include "gnss_selection.h"
 #include "utility/utility.h"
 #include "utility/tic_toc.h"
+#include "utility/window_array.h"
+#include "utility/pipeline_stage.h"
+#include "utility/latency_governor.h"
+#include "utility/solver_watchdog.h"
+#include "utility/object_arena.h"
 #include "initial/solve_5pts.h"
 #include "initial/initial_sfm.h"
 #include "initial/initial_alignment.h"
 #include "initial/initial_ex_rotation.h"
 #include "initial/gnss_vi_initializer.h"
-#include <std_msgs/Header.h>
+#include "relocalization/relocalizer.h"
+#include "utility/timestamp.h"
 
 #include <ceres/ceres.h>
 #include "factor/imu_factor.h"
+#include "factor/imu_downsampler.h"
 #include "factor/pose_local_parameterization.h"
 #include "factor/projection_factor.h"
 #include "factor/projection_td_factor.h"
+#include "factor/projection_track_factor.h"
+#include "factor/structureless_track_factor.h"
 #include "factor/marginalization_factor.h"
 #include "factor/gnss_psr_dopp_factor.hpp"
+#include "factor/gnss_epoch_factor.hpp"
+#include "factor/gnss_receiver_state.hpp"
 #include "factor/gnss_dt_ddt_factor.hpp"
 #include "factor/gnss_dt_anchor_factor.hpp"
 #include "factor/gnss_ddt_smooth_factor.hpp"
+#include "factor/gnss_clock_block_factor.hpp"
+#include "factor/gnss_rcv_clock_factor.hpp"
 #include "factor/pos_vel_factor.hpp"
 #include "factor/pose_anchor_factor.h"
 
 #include <opencv2/core/eigen.hpp>
 
 #include <gnss_comm/gnss_utility.hpp>
-#include <gnss_comm/gnss_ros.hpp>
 #include <gnss_comm/gnss_spp.hpp>
 
 using namespace gnss_comm;
@@ -36,37 +50,133 @@ using namespace gnss_comm;
 class Estimator
 {
   public:
-    Estimator();
+    // a shared_ephem_store is filled by the host for all its estimators, they neither clear nor evict it
+    explicit Estimator(const EstimatorConfig &_config = PROCESS_CONFIG,
+                       std::shared_ptr<EphemStore> shared_ephem_store = nullptr);
+    // joins the background stages, then frees the pre-integrations, priors and the incremental problem
+    ~Estimator();
+    Estimator(const Estimator&) = delete;
+    Estimator& operator=(const Estimator&) = delete;
 
     void setParameter();
+    // switch to one of config.PERFORMANCE_PROFILES between two frames, false if there is none of that name
+    bool setPerformanceProfile(const std::string &name);
 
     // interface
     void processIMU(double t, const Vector3d &linear_acceleration, const Vector3d &angular_velocity);
-    void processGNSS(const std::vector<ObsPtr> &gnss_mea);
+    void processGNSS(const std::vector<ObsPtr> &gnss_mea) { processGNSS(gnss_mea, frame_count); }
+    // one epoch, appended to the epochs of frame
+    void processGNSS(const std::vector<ObsPtr> &gnss_mea, int frame);
+    bool processLateGNSS(const std::vector<ObsPtr> &gnss_mea, double max_delay);
     void inputEphem(EphemBasePtr ephem_ptr);
     void inputIonoParams(double ts, const std::vector<double> &iono_params);
     void inputGNSSTimeDiff(const double t_diff);
 
-    void processImage(const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image, const std_msgs::Header &header);
+    void processImage(const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image, const FrameHeader &header);
 
     // internal
+    void integrateIMU(double dt, const Vector3d &linear_acceleration, const Vector3d &angular_velocity, int num_samples);
+    void flushIMU();
     void clearState();
+    void releaseFrameHistory();
     bool initialStructure();
+    // the window localized in the keyframe map of relocalizer instead of the SFM and visual-inertial alignment
+    bool mapInitialStructure();
+    // STEREO_INIT: pose of the newest frame by PnP on the stereo depths, at every frame while INITIAL
+    void stereoInitFrame(double t);
+    // the window localized by stereoInitFrame instead of the SFM and visual-inertial alignment
+    bool stereoInitialStructure();
+    // Vs of the window from Ps/Rs and the preintegrations, for the initializations with metric poses
+    void velocitiesFromPoses();
     bool visualInitialAlign();
     // GNSS related
     bool GNSSVIAlign();
+    // snapshot of the window for GNSS-VI alignment and its result
+    struct GNSSAlignment
+    {
+        std::vector<std::vector<ObsPtr>> meas;
+        std::vector<std::vector<EphemBasePtr>> ephem;
+        std::vector<std::vector<SatStatePtr>> sat_state;
+        std::vector<double> iono_params;
+        std::vector<Eigen::Vector3d> local_vs, local_ps;
+        std::vector<double> stamps;
+        int generation;     // gnss_align_generation when taken
+        bool known_anchor;  // world frame is the ENU frame of anchor_ecef (initialized from the keyframe map)
+        Eigen::Vector3d anchor_ecef;
+        bool success;
+        double aligned_yaw, aligned_rcv_ddt;
+        Eigen::Matrix<double, 7, 1> rough_xyzt, refined_xyzt;
+    };
+    // interpolation of the epochs of frame between its neighbours up to the newest valid frame
+    void bindGNSSEpochs(int frame, int newest);
+    // the epoch of frame closest to it, -1 if there is none; the alignment uses one epoch per frame
+    int nearestGNSSEpoch(int frame) const;
+    bool gnssAlignPossible() const;
+    std::shared_ptr<GNSSAlignment> snapshotGNSSAlignment() const;
+    static void runGNSSAlignment(GNSSAlignment &job);
+    void applyGNSSAlignment(const GNSSAlignment &job);
+    // GNSSVIAlign on gnss_align_stage, true once a finished alignment has been applied
+    bool pollGNSSVIAlign();
 
     void updateGNSSStatistics();
 
+    // relocalization related: the keyframe WINDOW_SIZE - 2 after a MARGIN_OLD frame, false otherwise
+    bool reloKeyframe(ReloKeyframe &keyframe) const;
+    // pose prior on the frame of a relocalization in this world frame, for as long as the frame is in the window
+    void setReloFrame(const ReloResult &result);
+
     bool relativePose(Matrix3d &relative_R, Vector3d &relative_T, int &l);
     void slideWindow();
     void solveOdometry();
     void slideWindowNew();
     void slideWindowOld();
     void optimization();
+    // marginalization after optimization() or motionOnlyOptimization()
+    void marginalizeWindow(ceres::LossFunction *loss_function);
+    // non-keyframe update of the newest frame only, see estimator_motion_only.cpp
+    bool motionOnlyDue();
+    void motionOnlyOptimization();
+    // all observations of one feature as a single ProjectionTrackFactor
+    void addTrackResidual(ceres::Problem &problem, ceres::LossFunction *loss_function,
+                          const FeaturePerId &it_per_id, int feature_index);
+    // the same with the inverse depth projected out (STRUCTURELESS_VISUAL): adds the observations of the
+    // feature to a factor created with its host observation and sets blocks to the parameter blocks
+    void addStructurelessObservations(const FeaturePerId &it_per_id, StructurelessTrackFactor *factor,
+                                      std::vector<double *> &blocks);
+    // threads, Schur ordering and linear solver for the problem as built
+    void configureSolver(const ceres::Problem &problem, ceres::Solver::Options &options);
+    void watchSolver(ceres::Solver::Options &options);
+    // after a diverged solve: para_* back to the state before it, ceres wrote every iterate into them
+    void restoreDivergedSolve();
+    void finishMarginalization(MarginalizationInfo *marginalization_info, std::unordered_map<long, double *> &&addr_shift);
+    // barrier before the prior is used again
+    void waitMarginalization();
+    // parameter blocks of one of last_marginalization_info->priorFactors()
+    vector<double *> priorParameterBlocks(int piece) const;
+    void sparsifyPrior(MarginalizationInfo *marginalization_info, const vector<double *> &parameter_blocks);
     void vector2double();
     void double2vector();
     bool failureDetection();
+    // factors of the per-frame problem come from frame_arena, the incremental problem keeps and owns its own
+    template <typename T, typename... Args>
+    T *newFactor(Args &&... args)
+    {
+        if (config.INCREMENTAL_PROBLEM)
+            return new T(std::forward<Args>(args)...);
+        return frame_arena.create<T>(std::forward<Args>(args)...);
+    }
+    // incremental problem related
+    void resetIncrementalProblem();
+    bool reuseResidual(const std::vector<double> &key, const void *source);
+    void rememberResidual(const std::vector<double> &key, const void *source, ceres::ResidualBlockId id);
+    void pruneStaleResiduals();
+    // checkpoint related, see estimator_checkpoint.cpp
+    void saveCheckpoint(double t, std::string &data);
+    bool loadCheckpoint(const std::string &data);
+    void takeCheckpoint(double t);
+    bool resumeFromCheckpoint();
+    bool readCheckpointFile(const std::string &path);
+    void discardCheckpoint();
 
     enum SolverFlag
     {
@@ -80,6 +190,9 @@ class Estimator
         MARGIN_SECOND_NEW = 1
     };
 
+    // copied at construction, the extrinsic calibration updates RIC and ESTIMATE_EXTRINSIC of this copy only
+    EstimatorConfig config;
+
     SolverFlag solver_flag;
     MarginalizationFlag  marginalization_flag;
     Vector3d g;
@@ -89,43 +202,69 @@ class Estimator
     Matrix3d ric[NUM_OF_CAM];
     Vector3d tic[NUM_OF_CAM];
 
-    Vector3d Ps[(WINDOW_SIZE + 1)];
-    Vector3d Vs[(WINDOW_SIZE + 1)];
-    Matrix3d Rs[(WINDOW_SIZE + 1)];
-    Vector3d Bas[(WINDOW_SIZE + 1)];
-    Vector3d Bgs[(WINDOW_SIZE + 1)];
+    // per-frame window state, indexed by the frame position in the window; sliding only rotates the head
+    WindowArray<Vector3d, WINDOW_SIZE + 1> Ps;
+    WindowArray<Vector3d, WINDOW_SIZE + 1> Vs;
+    WindowArray<Matrix3d, WINDOW_SIZE + 1> Rs;
+    WindowArray<Vector3d, WINDOW_SIZE + 1> Bas;
+    WindowArray<Vector3d, WINDOW_SIZE + 1> Bgs;
     double td;
 
     Matrix3d back_R0, last_R, last_R0;
     Vector3d back_P0, last_P, last_P0;
-    std_msgs::Header Headers[(WINDOW_SIZE + 1)];
+    WindowArray<FrameHeader, WINDOW_SIZE + 1> Headers;
 
-    IntegrationBase *pre_integrations[(WINDOW_SIZE + 1)];
+    WindowArray<IntegrationBase *, WINDOW_SIZE + 1> pre_integrations;
     Vector3d acc_0, gyr_0;
 
-    vector<double> dt_buf[(WINDOW_SIZE + 1)];
-    vector<Vector3d> linear_acceleration_buf[(WINDOW_SIZE + 1)];
-    vector<Vector3d> angular_velocity_buf[(WINDOW_SIZE + 1)];
+    WindowArray<vector<double>, WINDOW_SIZE + 1> dt_buf;
+    WindowArray<vector<Vector3d>, WINDOW_SIZE + 1> linear_acceleration_buf;
+    WindowArray<vector<Vector3d>, WINDOW_SIZE + 1> angular_velocity_buf;
+    WindowArray<vector<int>, WINDOW_SIZE + 1> imu_samples_buf;    // num_samples of IntegrationBase::push_back
+    ImuDownsampler imu_downsampler;     // IMU_PREINT_RATE
 
     // GNSS related
     bool gnss_ready;
     Eigen::Vector3d anc_ecef;
     Eigen::Matrix3d R_ecef_enu;
     double yaw_enu_local;
-    std::vector<ObsPtr> gnss_meas_buf[(WINDOW_SIZE+1)];
-    std::vector<EphemBasePtr> gnss_ephem_buf[(WINDOW_SIZE+1)];
+    WindowArray<std::vector<ObsPtr>, WINDOW_SIZE + 1> gnss_meas_buf;
+    WindowArray<std::vector<EphemBasePtr>, WINDOW_SIZE + 1> gnss_ephem_buf;
+    // 卫星位置/速度/钟差, 观测进入窗口时由 sat_states() 计算一次, 因子和初始化直接复用
+    WindowArray<std::vector<SatStatePtr>, WINDOW_SIZE + 1> gnss_sat_state_buf;
+    /**
+     * 帧 i 的历元 (GNSS 以自己的频率输出, 一帧可有多个): 观测为 gnss_*_buf[i] 中的 [begin, end),
+     * 观测时刻在帧 i + lower_offset 与其后一帧之间插值, ts_ratio 为前一帧的权重
+     * 区间和系数在加入时及相邻的帧变化时 (新帧, 滑窗, 时间差更新) 由 bindGNSSEpochs 求出, 构造因子时直接使用
+     */
+    struct GnssEpochBinding
+    {
+        double gnss_ts;
+        uint32_t begin, end;
+        int lower_offset;       // -1 or 0, relative to the frame so that rotating the window keeps it
+        double ts_ratio;
+    };
+    WindowArray<std::vector<GnssEpochBinding>, WINDOW_SIZE + 1> gnss_epoch_buf;
+    double gnss_binding_time_diff;      // diff_t_gnss_local of the bindings
     std::vector<double> latest_gnss_iono_params;
-    std::map<uint32_t, std::vector<EphemBasePtr>> sat2ephem;
-    std::map<uint32_t, std::map<double, size_t>> sat2time_index;
+    std::shared_ptr<EphemStore> ephem_store;
+    bool owns_ephem_store;
     std::map<uint32_t, uint32_t> sat_track_status;
     double para_anc_ecef[3];
     double para_yaw_enu_local[1];
     double para_rcv_dt[(WINDOW_SIZE+1)*4];
     double para_rcv_ddt[WINDOW_SIZE+1];
+    // [dt of the 4 systems, ddt] of each epoch as one block, used instead of the above with GNSS_MERGED_CLOCK
+    double para_rcv_clock[WINDOW_SIZE+1][SIZE_RCV_CLOCK];
+    // para_rcv_dt/para_rcv_ddt before the watched solve, the clock state has no copy outside para_*
+    double watched_rcv_dt[(WINDOW_SIZE+1)*4];
+    double watched_rcv_ddt[WINDOW_SIZE+1];
     // GNSS statistics
     double diff_t_gnss_local;
     Eigen::Matrix3d R_enu_local;
     Eigen::Vector3d ecef_pos, enu_pos, enu_vel, enu_ypr;
+    double gnss_selection_pdop, gnss_selection_gdop;     // of the last epoch reduced by GNSS_MAX_SATS
+    uint64_t num_gnss_psr_rejected, num_gnss_dopp_rejected;     // satellites screened out since the start
 
     int frame_count;
     int sum_of_outlier, sum_of_back, sum_of_front, sum_of_invalid;
@@ -138,6 +277,32 @@ class Estimator
     bool is_valid, is_key;
     bool failure_occur;
 
+    // the last optimization(), written to the factor graph result file
+    struct SolverStatistics
+    {
+        double solver_ms, marginalization_ms;   // marginalization on the estimator thread only
+        double initial_cost, final_cost;
+        int iterations, residual_blocks, parameter_blocks;
+    };
+    SolverStatistics solver_stats;
+    std::string solver_config;      // reported again whenever it changes
+    // per-frame solver time against latency_target, frames are begun and ended by the node
+    LatencyGovernor latency_governor;
+    // cost functions, loss and parameterizations of the per-frame problem, reset by the next optimization()
+    ObjectArena frame_arena;
+    // ceres::Solve and marginalize() against the thread_config deadlines
+    DeadlineMonitor solver_deadline, marginalization_deadline;
+    // the structureless factors of the last optimization(), their inverse depths are written back after the solve
+    struct StructurelessTrack
+    {
+        const StructurelessTrackFactor *factor;
+        std::vector<double *> blocks;
+        int feature_index;
+    };
+    std::vector<StructurelessTrack> structureless_tracks;
+    // per-iteration checks of ceres::Solve (SOLVER_WATCHDOG), its counts are exported by the node
+    SolverWatchdog solver_watchdog;
+
     vector<Vector3d> point_cloud;
     vector<Vector3d> margin_cloud;
     vector<Vector3d> key_poses;
@@ -152,8 +317,69 @@ class Estimator
     MarginalizationInfo *last_marginalization_info;
     vector<double *> last_marginalization_parameter_blocks;
 
+    // with PIPELINE_MARGINALIZATION the Schur complement of frame k runs on marginalization_stage while
+    // frame k+1 is assembled; declared after the pending result so the stage is joined first on destruction
+    MarginalizationInfo *pending_marginalization_info;
+    vector<double *> pending_marginalization_parameter_blocks;
+    PipelineStage marginalization_stage;
+    // GNSS_ASYNC_INIT: the alignment in flight, cleared once taken; the stage only touches the job
+    std::shared_ptr<GNSSAlignment> gnss_align_job;
+    int gnss_align_generation;      // bumped by clearState, older alignments are dropped
+    PipelineStage gnss_align_stage;
+
     map<double, ImageFrame> all_image_frame;
+    // camera centres (by image stamp) and points of the last successful SFM, warm start of the next attempt
+    map<double, Vector3d> sfm_warm_centers;
+    map<int, Vector3d> sfm_warm_points;
     IntegrationBase *tmp_pre_integration;
 
     bool first_optimization;
+    // bumped by clearState, the generation of relocalization keyframes and results
+    int world_generation;
+    bool relo_frame_valid;
+    Timestamp relo_frame_stamp;
+    std::vector<double> relo_frame_pose;    // body pose as para_Pose
+    // set by the host, owns the keyframe map; null without relocalization
+    Relocalizer *relocalizer;
+    bool map_initialized;       // world frame of this session is the map frame of relocalizer
+    double stereo_failed_time;  // image stamp of the last frame stereoInitFrame did not localize
+    int num_motion_only_frames;     // consecutive non-keyframes given only the motion-only update
+
+    // 窗口状态的检查点, 每 CHECKPOINT_INTERVAL 在一帧优化完成后序列化一次 (内存中保留最新的一份, 并由
+    // checkpoint_stage 写入 CHECKPOINT_PATH); 失败检测或节点重启后从它恢复, 不再重新初始化
+    // clearState() 不清除检查点, 失败恢复正是在 clearState() 之后进行的
+    struct ImuSample
+    {
+        double dt;
+        Vector3d acc, gyr;
+    };
+    std::shared_ptr<const std::string> latest_checkpoint;
+    double latest_checkpoint_time;          // IMU time of the checkpoint, without the samples since
+    std::vector<ImuSample> checkpoint_imu;  // processIMU input since the checkpoint, replayed on a resume
+    bool checkpoint_restored;               // resumed from latest_checkpoint already, a second failure cold starts
+    double next_checkpoint_time;
+    PipelineStage checkpoint_stage;
+
+    // persistent problem kept across frames when INCREMENTAL_PROBLEM is set
+    enum ResidualKind
+    {
+        IMU_RESIDUAL = 0,
+        GNSS_RESIDUAL = 1,
+        DT_DDT_RESIDUAL = 2,
+        DDT_SMOOTH_RESIDUAL = 3,
+        VISUAL_RESIDUAL = 4,
+        VISUAL_TRACK_RESIDUAL = 5,
+        RCV_CLOCK_RESIDUAL = 6
+    };
+    struct CachedResidual
+    {
+        ceres::ResidualBlockId id;
+        const void *source;
+    };
+    ceres::Problem *inc_problem;
+    ceres::LossFunction *inc_loss_function;
+    std::map<std::vector<double>, CachedResidual> inc_last_residuals;
+    std::map<std::vector<double>, CachedResidual> inc_curr_residuals;
+    std::vector<ceres::ResidualBlockId> inc_volatile_residuals;
+    int inc_num_feature_blocks;
 };
@@ -0,0 +1,505 @@
+#include "estimator.h"
+#include "ephem_fields.h"
+
+#include <cstdio>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+
+#include <unistd.h>
+
+/**
+ * 检查点格式 (本机字节序, 只在同一台机器上读写):
+ *   magic | version | WINDOW_SIZE | NUM_OF_CAM | 检查点的 IMU 时间
+ *   窗口状态 Headers/Ps/Vs/Rs/Bas/Bgs, g/tic/ric/td, acc_0/gyr_0
+ *   每帧预积分的线性化点和原始 IMU 数据 (恢复时按原顺序 push_back, 与保存时完全一致)
+ *   GNSS 锚点/yaw_enu_local/接收机钟差, 电离层参数, 卫星跟踪计数
+ *   先验 last_marginalization_info, 参数块地址保存为 (参数数组, 偏移)
+ *   星历, 逐字段保存 (GLONASS 的轨道积分缓存不保存, 首次使用时重建)
+ * 视觉特征和窗口内的 GNSS 观测不保存: 特征 id 在前端重启后不再对应, 恢复后由新帧重新建立,
+ * 此前的帧只通过先验和 IMU 约束
+ */
+namespace
+{
+
+const char CHECKPOINT_MAGIC[8] = {'G', 'V', 'I', 'N', 'S', 'C', 'K', 'P'};
+const uint32_t CHECKPOINT_VERSION = 3;
+
+class CheckpointWriter
+{
+  public:
+    explicit CheckpointWriter(std::string &_out) : out(_out) {}
+
+    void raw(const void *p, size_t n) { out.append(static_cast<const char *>(p), n); }
+    template <typename T> void pod(const T &x) { raw(&x, sizeof(T)); }
+    void doubles(const double *x, size_t n) { raw(x, sizeof(double) * n); }
+
+  private:
+    std::string &out;
+};
+
+class CheckpointReader
+{
+  public:
+    explicit CheckpointReader(const std::string &_in) : in(_in), pos(0) {}
+
+    const char *take(size_t n)
+    {
+        if (n > in.size() - pos)
+            return nullptr;
+        const char *p = in.data() + pos;
+        pos += n;
+        return p;
+    }
+    template <typename T> bool pod(T &x)
+    {
+        const char *p = take(sizeof(T));
+        if (p)
+            memcpy(&x, p, sizeof(T));
+        return p != nullptr;
+    }
+    bool doubles(double *x, size_t n)
+    {
+        const char *p = take(sizeof(double) * n);
+        if (p)
+            memcpy(x, p, sizeof(double) * n);
+        return p != nullptr;
+    }
+
+    bool done() const { return pos == in.size(); }
+
+  private:
+    const std::string &in;
+    size_t pos;
+};
+
+struct FieldWriter
+{
+    CheckpointWriter &w;
+    template <typename T> void operator()(const T &x) { w.pod(x); }
+};
+
+struct FieldReader
+{
+    CheckpointReader &r;
+    bool ok;
+    template <typename T> void operator()(T &x) { ok = ok && r.pod(x); }
+};
+
+bool readHeader(CheckpointReader &r, double &t)
+{
+    const char *magic = r.take(sizeof(CHECKPOINT_MAGIC));
+    uint32_t version, window_size, num_of_cam;
+    if (!magic || memcmp(magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 ||
+        !r.pod(version) || !r.pod(window_size) || !r.pod(num_of_cam) || !r.pod(t))
+    {
+        GVINS_WARN("checkpoint: not a checkpoint");
+        return false;
+    }
+    if (version != CHECKPOINT_VERSION || window_size != WINDOW_SIZE || num_of_cam != NUM_OF_CAM)
+    {
+        GVINS_WARN("checkpoint: version %u window size %u cameras %u, expected %u %d %d",
+                 version, window_size, num_of_cam, CHECKPOINT_VERSION, WINDOW_SIZE, NUM_OF_CAM);
+        return false;
+    }
+    return true;
+}
+
+// the parameter arrays a prior block can live in, the order is part of the format
+struct ParameterRegion
+{
+    double *base;
+    int size;
+};
+
+std::vector<ParameterRegion> parameterRegions(Estimator &e)
+{
+    return {{e.para_Pose[0], (WINDOW_SIZE + 1) * SIZE_POSE},
+            {e.para_SpeedBias[0], (WINDOW_SIZE + 1) * SIZE_SPEEDBIAS},
+            {e.para_Ex_Pose[0], NUM_OF_CAM * SIZE_POSE},
+            {e.para_Td[0], 1},
+            {e.para_yaw_enu_local, 1},
+            {e.para_anc_ecef, 3},
+            {e.para_rcv_dt, (WINDOW_SIZE + 1) * 4},
+            {e.para_rcv_ddt, WINDOW_SIZE + 1},
+            {e.para_rcv_clock[0], (WINDOW_SIZE + 1) * SIZE_RCV_CLOCK}};
+}
+
+// written next to the target and renamed, a crash never leaves a truncated checkpoint behind
+void writeCheckpointFile(const std::string &path, const std::string &data)
+{
+    const std::string tmp_path = path + ".tmp";
+    FILE *file = fopen(tmp_path.c_str(), "wb");
+    if (!file)
+    {
+        GVINS_WARN("cannot write checkpoint %s", tmp_path.c_str());
+        return;
+    }
+    const bool written = fwrite(data.data(), 1, data.size(), file) == data.size() &&
+                         fflush(file) == 0 && fsync(fileno(file)) == 0;
+    fclose(file);
+    if (!written || rename(tmp_path.c_str(), path.c_str()) != 0)
+        GVINS_WARN("cannot write checkpoint %s", path.c_str());
+}
+
+}
+
+void Estimator::saveCheckpoint(double t, std::string &data)
+{
+    // the prior of the last frame may still be computed on marginalization_stage
+    waitMarginalization();
+
+    CheckpointWriter w(data);
+    w.raw(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    w.pod(CHECKPOINT_VERSION);
+    w.pod(static_cast<uint32_t>(WINDOW_SIZE));
+    w.pod(static_cast<uint32_t>(NUM_OF_CAM));
+    w.pod(t);
+
+    for (int i = 0; i <= WINDOW_SIZE; i++)
+    {
+        w.pod(Headers[i].stamp.toSec());
+        w.doubles(Ps[i].data(), 3);
+        w.doubles(Vs[i].data(), 3);
+        w.doubles(Rs[i].data(), 9);
+        w.doubles(Bas[i].data(), 3);
+        w.doubles(Bgs[i].data(), 3);
+    }
+    w.doubles(g.data(), 3);
+    for (int i = 0; i < NUM_OF_CAM; i++)
+    {
+        w.doubles(tic[i].data(), 3);
+        w.doubles(ric[i].data(), 9);
+    }
+    w.pod(td);
+    w.doubles(acc_0.data(), 3);
+    w.doubles(gyr_0.data(), 3);
+
+    for (int i = 0; i <= WINDOW_SIZE; i++)
+    {
+        const IntegrationBase *pre_integration = pre_integrations[i];
+        w.pod(static_cast<uint8_t>(pre_integration != nullptr));
+        if (!pre_integration)
+            continue;
+        w.doubles(pre_integration->linearized_acc.data(), 3);
+        w.doubles(pre_integration->linearized_gyr.data(), 3);
+        w.doubles(pre_integration->linearized_ba.data(), 3);
+        w.doubles(pre_integration->linearized_bg.data(), 3);
+        w.pod(static_cast<uint32_t>(pre_integration->dt_buf.size()));
+        for (size_t k = 0; k < pre_integration->dt_buf.size(); k++)
+        {
+            w.pod(pre_integration->dt_buf[k]);
+            w.doubles(pre_integration->acc_buf[k].data(), 3);
+            w.doubles(pre_integration->gyr_buf[k].data(), 3);
+            w.pod(static_cast<int32_t>(pre_integration->samples_buf[k]));
+        }
+    }
+
+    // GNSS related
+    w.pod(static_cast<uint8_t>(gnss_ready));
+    w.doubles(anc_ecef.data(), 3);
+    w.doubles(R_ecef_enu.data(), 9);
+    w.pod(yaw_enu_local);
+    w.doubles(para_rcv_dt, (WINDOW_SIZE + 1) * 4);
+    w.doubles(para_rcv_ddt, WINDOW_SIZE + 1);
+    w.pod(diff_t_gnss_local);
+    w.pod(static_cast<uint32_t>(latest_gnss_iono_params.size()));
+    w.doubles(latest_gnss_iono_params.data(), latest_gnss_iono_params.size());
+    w.pod(static_cast<uint32_t>(sat_track_status.size()));
+    for (const auto &sat_status : sat_track_status)
+    {
+        w.pod(sat_status.first);
+        w.pod(sat_status.second);
+    }
+
+    w.pod(static_cast<uint8_t>(last_marginalization_info != nullptr));
+    if (last_marginalization_info)
+    {
+        const MarginalizationInfo &info = *last_marginalization_info;
+        const std::vector<ParameterRegion> regions = parameterRegions(*this);
+        w.pod(static_cast<int32_t>(info.m));
+        w.pod(static_cast<int32_t>(info.n));
+        w.pod(static_cast<uint32_t>(last_marginalization_parameter_blocks.size()));
+        for (size_t k = 0; k < last_marginalization_parameter_blocks.size(); k++)
+        {
+            const double *addr = last_marginalization_parameter_blocks[k];
+            uint32_t region = 0;
+            while (region < regions.size() &&
+                   !(addr >= regions[region].base && addr < regions[region].base + regions[region].size))
+                region++;
+            GVINS_ASSERT(region < regions.size());
+            w.pod(region);
+            w.pod(static_cast<uint32_t>(addr - regions[region].base));
+            w.pod(static_cast<int32_t>(info.keep_block_size[k]));
+            w.pod(static_cast<int32_t>(info.keep_block_idx[k]));
+            w.doubles(info.keep_block_data[k], info.keep_block_size[k]);
+        }
+        w.pod(static_cast<int32_t>(info.linearized_jacobians.rows()));
+        w.pod(static_cast<int32_t>(info.linearized_jacobians.cols()));
+        w.doubles(info.linearized_jacobians.data(), info.linearized_jacobians.size());
+        w.doubles(info.linearized_residuals.data(), info.linearized_residuals.size());
+    }
+
+    const std::vector<EphemBasePtr> ephems = ephem_store->all();
+    w.pod(static_cast<uint32_t>(ephems.size()));
+    for (const EphemBasePtr &ephem : ephems)
+    {
+        const bool glo = satsys(ephem->sat, NULL) == SYS_GLO;
+        w.pod(static_cast<uint8_t>(glo));
+        FieldWriter field_writer{w};
+        if (glo)
+            visitGloEphem(*std::dynamic_pointer_cast<const GloEphem>(ephem), field_writer);
+        else
+            visitEphem(*std::dynamic_pointer_cast<const Ephem>(ephem), field_writer);
+    }
+}
+
+bool Estimator::loadCheckpoint(const std::string &data)
+{
+    clearState();
+
+    CheckpointReader r(data);
+    double t;
+    bool ok = readHeader(r, t);
+
+    for (int i = 0; ok && i <= WINDOW_SIZE; i++)
+    {
+        double stamp;
+        ok = r.pod(stamp) && r.doubles(Ps[i].data(), 3) && r.doubles(Vs[i].data(), 3) &&
+             r.doubles(Rs[i].data(), 9) && r.doubles(Bas[i].data(), 3) && r.doubles(Bgs[i].data(), 3);
+        Headers[i].stamp = Timestamp(stamp);
+        Headers[i].frame_id = "world";
+    }
+    ok = ok && r.doubles(g.data(), 3);
+    for (int i = 0; ok && i < NUM_OF_CAM; i++)
+        ok = r.doubles(tic[i].data(), 3) && r.doubles(ric[i].data(), 9);
+    ok = ok && r.pod(td) && r.doubles(acc_0.data(), 3) && r.doubles(gyr_0.data(), 3);
+
+    for (int i = 0; ok && i <= WINDOW_SIZE; i++)
+    {
+        uint8_t present;
+        if (!(ok = r.pod(present)) || !present)
+            continue;
+        Vector3d lin_acc, lin_gyr, lin_ba, lin_bg;
+        uint32_t num_samples;
+        ok = r.doubles(lin_acc.data(), 3) && r.doubles(lin_gyr.data(), 3) &&
+             r.doubles(lin_ba.data(), 3) && r.doubles(lin_bg.data(), 3) && r.pod(num_samples);
+        if (!ok)
+            break;
+        pre_integrations[i] = new IntegrationBase{lin_acc, lin_gyr, lin_ba, lin_bg, config};
+        for (uint32_t k = 0; ok && k < num_samples; k++)
+        {
+            double dt;
+            Vector3d acc, gyr;
+            int32_t samples;
+            if (!(ok = r.pod(dt) && r.doubles(acc.data(), 3) && r.doubles(gyr.data(), 3) && r.pod(samples)))
+                break;
+            pre_integrations[i]->push_back(dt, acc, gyr, samples);
+            dt_buf[i].push_back(dt);
+            linear_acceleration_buf[i].push_back(acc);
+            angular_velocity_buf[i].push_back(gyr);
+            imu_samples_buf[i].push_back(samples);
+        }
+    }
+
+    // GNSS related
+    uint8_t ready = 0;
+    uint32_t num_iono = 0, num_sats = 0;
+    ok = ok && r.pod(ready) && r.doubles(anc_ecef.data(), 3) && r.doubles(R_ecef_enu.data(), 9) &&
+         r.pod(yaw_enu_local) && r.doubles(para_rcv_dt, (WINDOW_SIZE + 1) * 4) &&
+         r.doubles(para_rcv_ddt, WINDOW_SIZE + 1) && r.pod(diff_t_gnss_local) && r.pod(num_iono);
+    gnss_ready = ready != 0;
+    if (ok)
+    {
+        latest_gnss_iono_params.resize(num_iono);
+        ok = r.doubles(latest_gnss_iono_params.data(), num_iono) && r.pod(num_sats);
+        if (ok && num_iono == 8)
+            ephem_store->setIonoParams(latest_gnss_iono_params);
+    }
+    for (uint32_t k = 0; ok && k < num_sats; k++)
+    {
+        uint32_t sat, count;
+        if ((ok = r.pod(sat) && r.pod(count)))
+            sat_track_status[sat] = count;
+    }
+
+    uint8_t has_prior = 0;
+    ok = ok && r.pod(has_prior);
+    if (ok && has_prior)
+    {
+        const std::vector<ParameterRegion> regions = parameterRegions(*this);
+        MarginalizationInfo *info = new MarginalizationInfo();
+        // owned by the info from here on, blocks read so far are freed with it on a parse error
+        last_marginalization_info = info;
+        int32_t m, n;
+        uint32_t num_blocks;
+        ok = r.pod(m) && r.pod(n) && r.pod(num_blocks);
+        info->m = m;
+        info->n = n;
+        for (uint32_t k = 0; ok && k < num_blocks; k++)
+        {
+            uint32_t region, offset;
+            int32_t size, idx;
+            if (!(ok = r.pod(region) && r.pod(offset) && r.pod(size) && r.pod(idx)))
+                break;
+            if (!(ok = region < regions.size() && size > 0 && static_cast<int>(offset) + size <= regions[region].size))
+                break;
+            double *addr = regions[region].base + offset;
+            double *block_data = new double[size];
+            info->parameter_block_data[reinterpret_cast<long>(addr)] = block_data;
+            info->parameter_block_size[reinterpret_cast<long>(addr)] = size;
+            info->parameter_block_idx[reinterpret_cast<long>(addr)] = idx;
+            info->keep_block_size.push_back(size);
+            info->keep_block_idx.push_back(idx);
+            info->keep_block_data.push_back(block_data);
+            last_marginalization_parameter_blocks.push_back(addr);
+            ok = r.doubles(block_data, size);
+        }
+        info->sum_block_size = std::accumulate(info->keep_block_size.begin(), info->keep_block_size.end(), 0);
+        int32_t rows = 0, cols = 0;
+        ok = ok && r.pod(rows) && r.pod(cols) && rows == n && cols == n;
+        if (ok)
+        {
+            info->linearized_jacobians.resize(rows, cols);
+            info->linearized_residuals.resize(rows);
+            ok = r.doubles(info->linearized_jacobians.data(), info->linearized_jacobians.size()) &&
+                 r.doubles(info->linearized_residuals.data(), info->linearized_residuals.size());
+        }
+    }
+
+    uint32_t num_ephems = 0;
+    ok = ok && r.pod(num_ephems);
+    for (uint32_t k = 0; ok && k < num_ephems; k++)
+    {
+        uint8_t glo;
+        if (!(ok = r.pod(glo)))
+            break;
+        FieldReader field_reader{r, true};
+        if (glo)
+        {
+            GloEphemPtr glo_ephem(new GloEphem());
+            visitGloEphem(*glo_ephem, field_reader);
+            if ((ok = field_reader.ok))
+                ephem_store->add(glo_ephem);
+        }
+        else
+        {
+            EphemPtr gps_ephem(new Ephem());
+            visitEphem(*gps_ephem, field_reader);
+            if ((ok = field_reader.ok))
+                ephem_store->add(gps_ephem);
+        }
+    }
+
+    if (!ok || !r.done())
+    {
+        GVINS_WARN("checkpoint is truncated or corrupt, discarded");
+        clearState();
+        setParameter();
+        return false;
+    }
+
+    f_manager.setRic(ric);
+    if (config.ESTIMATE_EXTRINSIC == 2)
+    {
+        // the checkpoint has the calibrated rotation already
+        config.RIC[0] = ric[0];
+        config.ESTIMATE_EXTRINSIC = 1;
+    }
+    // initialized, no frame history (releaseFrameHistory)
+    first_imu = true;
+    frame_count = WINDOW_SIZE;
+    solver_flag = NON_LINEAR;
+    marginalization_flag = MARGIN_OLD;
+    // without a prior the window has to be anchored like the first optimization after initialization
+    first_optimization = last_marginalization_info == nullptr;
+    para_yaw_enu_local[0] = yaw_enu_local;
+    for (uint32_t k = 0; k < 3; ++k)
+        para_anc_ecef[k] = anc_ecef(k);
+    if (gnss_ready)
+        updateGNSSStatistics();
+
+    key_poses.clear();
+    for (int i = 0; i <= WINDOW_SIZE; i++)
+        key_poses.push_back(Ps[i]);
+    last_R = Rs[WINDOW_SIZE];
+    last_P = Ps[WINDOW_SIZE];
+    last_R0 = Rs[0];
+    last_P0 = Ps[0];
+    return true;
+}
+
+void Estimator::takeCheckpoint(double t)
+{
+    TicToc t_checkpoint;
+    std::shared_ptr<std::string> data = std::make_shared<std::string>();
+    saveCheckpoint(t, *data);
+    latest_checkpoint = data;
+    latest_checkpoint_time = t;
+    checkpoint_imu.clear();
+    checkpoint_restored = false;
+    next_checkpoint_time = t + config.CHECKPOINT_INTERVAL;
+
+    const std::string path = config.CHECKPOINT_PATH;
+    checkpoint_stage.submit([data, path]{ writeCheckpointFile(path, *data); });
+    GVINS_DEBUG("checkpoint of %lu bytes costs %f ms", data->size(), t_checkpoint.toc());
+}
+
+bool Estimator::resumeFromCheckpoint()
+{
+    if (!latest_checkpoint || checkpoint_restored)
+        return false;
+    std::shared_ptr<const std::string> data = latest_checkpoint;
+    std::vector<ImuSample> replay;
+    replay.swap(checkpoint_imu);
+    if (!loadCheckpoint(*data))
+    {
+        discardCheckpoint();
+        return false;
+    }
+
+    // bring the newest frame up to the IMU data the estimator has already seen
+    double resume_time = latest_checkpoint_time;
+    for (const ImuSample &sample : replay)
+    {
+        processIMU(sample.dt, sample.acc, sample.gyr);
+        resume_time += sample.dt;
+    }
+    checkpoint_restored = true;
+    // a new checkpoint only after a full interval of healthy frames
+    next_checkpoint_time = resume_time + config.CHECKPOINT_INTERVAL;
+    GVINS_INFO("resumed from the checkpoint at %f, %lu IMU samples replayed", latest_checkpoint_time, replay.size());
+    return true;
+}
+
+bool Estimator::readCheckpointFile(const std::string &path)
+{
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file)
+    {
+        GVINS_INFO("no checkpoint at %s, cold start", path.c_str());
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::shared_ptr<std::string> data = std::make_shared<std::string>(buffer.str());
+    CheckpointReader r(*data);
+    double t;
+    if (!readHeader(r, t))
+        return false;
+
+    discardCheckpoint();
+    latest_checkpoint = data;
+    latest_checkpoint_time = t;
+    GVINS_INFO("checkpoint at %f read from %s", t, path.c_str());
+    return true;
+}
+
+void Estimator::discardCheckpoint()
+{
+    latest_checkpoint.reset();
+    latest_checkpoint_time = -1;
+    checkpoint_imu.clear();
+    checkpoint_restored = false;
+    next_checkpoint_time = 0;
+}
@@ -0,0 +1,197 @@
+#include "estimator.h"
+#include <gvins_feature_tracker/trace_zones.h>
+
+/**
+ * 非关键帧是否只做运动更新: 连续的快速更新不超过 MOTION_ONLY_FRAMES 帧, 启用延迟目标时若本帧的求解预算
+ * 仍是完整的 SOLVER_TIME (时间充裕) 则照常做完整的滑窗优化
+ */
+bool Estimator::motionOnlyDue()
+{
+    if (config.MOTION_ONLY_FRAMES <= 0 || marginalization_flag != MARGIN_SECOND_NEW || first_optimization)
+        return false;
+    if (num_motion_only_frames >= config.MOTION_ONLY_FRAMES)
+        return false;
+    if (latency_governor.enabled() && latency_governor.solverBudget() >= config.SOLVER_TIME * 1000.0)
+        return false;
+    return true;
+}
+
+/**
+ * 非关键帧的快速更新: 只优化最新一帧的位姿, 速度/零偏和 GNSS 接收机钟差, 窗口中其余各帧, 外参, td, 路标逆深度,
+ * yaw_enu_local 和 anc_ecef 固定不变; 残差为最新帧的重投影, 与次新帧之间的 IMU 预积分, 最新帧的 GNSS 伪距/多普勒
+ * (按卫星) 和两帧间的钟差约束. 之后照常做 MARGIN_SECOND_NEW 的边缘化, 因此滑窗和先验与完整优化的流程一致
+ */
+void Estimator::motionOnlyOptimization()
+{
+    GVINS_TRACE_ZONE("motionOnlyOptimization");
+    {
+        GVINS_TRACE_ZONE("waitMarginalization");
+        waitMarginalization();
+    }
+    TicToc t_whole;
+    vector2double();
+
+    // the factors live for this solve only, whatever INCREMENTAL_PROBLEM is
+    ObjectArena arena;
+    ceres::Problem::Options problem_options;
+    problem_options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.local_parameterization_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    ceres::Problem problem(problem_options);
+    ceres::LossFunction *loss_function = arena.create<ceres::CauchyLoss>(1.0);
+
+    const int curr = WINDOW_SIZE, prev = WINDOW_SIZE - 1;
+    problem.AddParameterBlock(para_Pose[curr], SIZE_POSE, arena.create<PoseLocalParameterization>());
+    problem.AddParameterBlock(para_SpeedBias[curr], SIZE_SPEEDBIAS);
+    problem.AddParameterBlock(para_Pose[prev], SIZE_POSE, arena.create<PoseLocalParameterization>());
+    problem.AddParameterBlock(para_SpeedBias[prev], SIZE_SPEEDBIAS);
+
+    if (pre_integrations[curr]->sum_dt <= 10.0)
+    {
+        IMUFactor *imu_factor = arena.create<IMUFactor>(pre_integrations[curr]);
+        problem.AddResidualBlock(imu_factor, NULL, para_Pose[prev], para_SpeedBias[prev],
+            para_Pose[curr], para_SpeedBias[curr]);
+    }
+
+    // same landmarks and depth slots as optimization(), each seen in the newest frame against its first observation
+    int f_m_cnt = 0;
+    int feature_index = -1;
+    for (auto &it_per_id : f_manager.feature)
+    {
+        const int used_num = it_per_id.feature_per_frame.size();
+        if (!(used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
+            continue;
+        ++feature_index;
+        if (it_per_id.start_frame + used_num - 1 != curr || it_per_id.estimated_depth <= 0)
+            continue;
+        const FeaturePerFrame &host = it_per_id.feature_per_frame.front(), &obs = it_per_id.feature_per_frame.back();
+        if (config.ESTIMATE_TD)
+        {
+            ProjectionTdFactor *f_td = arena.create<ProjectionTdFactor>(host.point, obs.point,
+                host.velocity, obs.velocity, host.cur_td, obs.cur_td);
+            problem.AddResidualBlock(f_td, loss_function, para_Pose[it_per_id.start_frame], para_Pose[curr],
+                para_Ex_Pose[0], para_Feature[feature_index], para_Td[0]);
+        }
+        else
+        {
+            ProjectionFactor *f = arena.create<ProjectionFactor>(host.point, obs.point);
+            problem.AddResidualBlock(f, loss_function, para_Pose[it_per_id.start_frame], para_Pose[curr],
+                para_Ex_Pose[0], para_Feature[feature_index]);
+        }
+        f_m_cnt++;
+    }
+
+    // the epoch factor only groups the same per-satellite residuals, the fast path always adds them one by one
+    std::vector<double *> clock_blocks;
+    if (gnss_ready && !gnss_meas_buf[curr].empty())
+    {
+        const std::vector<ObsPtr> &curr_obs = gnss_meas_buf[curr];
+        const std::vector<EphemBasePtr> &curr_ephem = gnss_ephem_buf[curr];
+        const std::vector<SatStatePtr> &curr_sat_state = gnss_sat_state_buf[curr];
+        // the newest frame's epochs are bound between prev and curr
+        for (const GnssEpochBinding &epoch : gnss_epoch_buf[curr])
+        {
+            for (uint32_t j = epoch.begin; j < epoch.end; ++j)
+            {
+                const uint32_t sys_idx = gnss_comm::sys2idx.at(satsys(curr_obs[j]->sat, NULL));
+                const double ts_ratio = epoch.ts_ratio;
+                if (config.GNSS_MERGED_CLOCK)
+                {
+                    GnssClockBlockFactor<GnssPsrDoppFactor> *gnss_factor = arena.create<GnssClockBlockFactor<GnssPsrDoppFactor>>(
+                        curr_obs[j], curr_ephem[j], curr_sat_state[j], latest_gnss_iono_params, ts_ratio);
+                    gnss_factor->setClockComponents(std::vector<int>{-1, -1, -1, -1,
+                        static_cast<int>(sys_idx), RCV_CLOCK_DDT_IDX, -1, -1});
+                    problem.AddResidualBlock(gnss_factor, NULL, para_Pose[prev], para_SpeedBias[prev],
+                        para_Pose[curr], para_SpeedBias[curr], para_rcv_clock[curr], para_yaw_enu_local, para_anc_ecef);
+                    continue;
+                }
+                GnssPsrDoppFactor *gnss_factor = arena.create<GnssPsrDoppFactor>(curr_obs[j],
+                    curr_ephem[j], curr_sat_state[j], latest_gnss_iono_params, ts_ratio);
+                problem.AddResidualBlock(gnss_factor, NULL, para_Pose[prev], para_SpeedBias[prev],
+                    para_Pose[curr], para_SpeedBias[curr], para_rcv_dt+curr*4+sys_idx, para_rcv_ddt+curr,
+                    para_yaw_enu_local, para_anc_ecef);
+            }
+        }
+
+        const double gnss_dt = Headers[curr].stamp.toSec() - Headers[prev].stamp.toSec();
+        if (config.GNSS_MERGED_CLOCK)
+        {
+            RcvClockFactor *rcv_clock_factor = arena.create<RcvClockFactor>(gnss_dt, config.GNSS_DDT_WEIGHT);
+            problem.AddResidualBlock(rcv_clock_factor, NULL, para_rcv_clock[prev], para_rcv_clock[curr]);
+            clock_blocks.push_back(para_rcv_clock[curr]);
+        }
+        else
+        {
+            for (uint32_t k = 0; k < 4; ++k)
+            {
+                DtDdtFactor *dt_ddt_factor = arena.create<DtDdtFactor>(gnss_dt);
+                problem.AddResidualBlock(dt_ddt_factor, NULL, para_rcv_dt+prev*4+k, para_rcv_dt+curr*4+k,
+                    para_rcv_ddt+prev, para_rcv_ddt+curr);
+                clock_blocks.push_back(para_rcv_dt+curr*4+k);
+            }
+            DdtSmoothFactor *ddt_smooth_factor = arena.create<DdtSmoothFactor>(config.GNSS_DDT_WEIGHT);
+            problem.AddResidualBlock(ddt_smooth_factor, NULL, para_rcv_ddt+prev, para_rcv_ddt+curr);
+            clock_blocks.push_back(para_rcv_ddt+curr);
+        }
+    }
+
+    // everything but the newest frame is held at the last full optimization
+    std::vector<double *> parameter_blocks;
+    problem.GetParameterBlocks(&parameter_blocks);
+    for (double *block : parameter_blocks)
+    {
+        if (block != para_Pose[curr] && block != para_SpeedBias[curr] &&
+            std::find(clock_blocks.begin(), clock_blocks.end(), block) == clock_blocks.end())
+            problem.SetParameterBlockConstant(block);
+    }
+    GVINS_DEBUG("motion-only visual measurement count: %d", f_m_cnt);
+
+    ceres::Solver::Options options;
+    options.linear_solver_type = ceres::DENSE_NORMAL_CHOLESKY;
+    options.trust_region_strategy_type = ceres::DOGLEG;
+    options.max_num_iterations = config.NUM_ITERATIONS;
+    if (config.DETERMINISTIC)
+        options.max_solver_time_in_seconds = 1e9;   // ceres' default, bounded by the iterations
+    else
+        options.max_solver_time_in_seconds = latency_governor.enabled() ? latency_governor.solverBudget() / 1000.0 : config.SOLVER_TIME;
+    options.function_tolerance = config.SOLVER_STALL_RATIO;
+    watchSolver(options);
+    TicToc t_solver;
+    ceres::Solver::Summary summary;
+    {
+        GVINS_TRACE_ZONE("ceres::Solve");
+        ScopedThreadConfig ceres_threads(config.CERES_THREADS, "ceres");
+        ceres::Solve(options, &problem, &summary);
+    }
+    solver_deadline.record(t_solver.toc());
+    latency_governor.endSolve();
+    solver_stats.solver_ms = t_solver.toc();
+    solver_stats.iterations = static_cast<int>(summary.iterations.size());
+    solver_stats.initial_cost = summary.initial_cost;
+    solver_stats.final_cost = summary.final_cost;
+    solver_stats.residual_blocks = problem.NumResidualBlocks();
+    solver_stats.parameter_blocks = problem.NumParameterBlocks();
+    if (solver_watchdog.diverged())
+    {
+        restoreDivergedSolve();
+        return;
+    }
+
+    // only the newest frame changed, the other para_* still match the state
+    Eigen::Map<Quaterniond> q(para_Pose[curr] + 3);
+    q.normalize();
+    Rs[curr] = q.toRotationMatrix();
+    Ps[curr] = Vector3d(para_Pose[curr][0], para_Pose[curr][1], para_Pose[curr][2]);
+    Vs[curr] = Vector3d(para_SpeedBias[curr][0], para_SpeedBias[curr][1], para_SpeedBias[curr][2]);
+    Bas[curr] = Vector3d(para_SpeedBias[curr][3], para_SpeedBias[curr][4], para_SpeedBias[curr][5]);
+    Bgs[curr] = Vector3d(para_SpeedBias[curr][6], para_SpeedBias[curr][7], para_SpeedBias[curr][8]);
+    if (config.GNSS_MERGED_CLOCK)
+    {
+        std::copy(para_rcv_clock[curr], para_rcv_clock[curr] + 4, para_rcv_dt + curr*4);
+        para_rcv_ddt[curr] = para_rcv_clock[curr][RCV_CLOCK_DDT_IDX];
+    }
+    GVINS_DEBUG("motion-only solve: %d iterations, %f ms", solver_stats.iterations, solver_stats.solver_ms);
+
+    marginalizeWindow(loss_function);
+    GVINS_DEBUG("whole time for motion-only update: %f", t_whole.toc());
+}
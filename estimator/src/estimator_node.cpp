@@ -1,19 +1,34 @@
 #include <stdio.h>
-#include <queue>
 #include <map>
+#include <iterator>
 #include <thread>
 #include <mutex>
-#include <condition_variable>
+#include <atomic>
+#include <unistd.h>
 #include <ros/ros.h>
 #include <cv_bridge/cv_bridge.h>
 #include <opencv2/opencv.hpp>
 #include <gnss_comm/gnss_ros.hpp>
 #include <gnss_comm/gnss_utility.hpp>
+#include <gnss_comm/rinex_helper.hpp>
 #include <gvins/LocalSensorExternalTrigger.h>
+#include <gvins/SetPerformanceProfile.h>
+#include <gvins_feature_tracker/FeatureTracks.h>
+#include <gvins_feature_tracker/EstimatorLoad.h>
+#include <gvins_feature_tracker/log_ros.h>
+#include <gvins_feature_tracker/stage_profiler.h>
+#include <gvins_feature_tracker/trace_zones.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
 #include <sensor_msgs/NavSatFix.h>
+#include <std_msgs/String.h>
 
 #include "estimator.h"
 #include "parameters.h"
+#include "imu_propagator.h"
+#include "shared_ephem.h"
+#include "odometry_output.h"
+#include "utility/spsc_queue.h"
+#include "utility/result_logger.h"
 #include "utility/visualization.h"
 
 using namespace gnss_comm;
@@ -21,31 +36,43 @@ using namespace gnss_comm;
 #define MAX_GNSS_CAMERA_DELAY 0.05
 
 std::unique_ptr<Estimator> estimator_ptr;
+std::unique_ptr<RinexObsWriter> gnss_rinex_writer;     // 原始 GNSS 观测存档, 后台线程写盘
+// 与同机其它估计器共享的星历 (gnss_shared_ephem): 发布者在星历回调中写入, 读者在 process() 中取回
+std::unique_ptr<SharedEphemSegment> shared_ephem;
+bool shared_ephem_reader = false;
+std::mutex m_shared_ephem;      // 星历回调可能在不同线程, 共享段只能有一个写者
+// 重定位 (relocalization): 关键帧在后台查询, 结果在 process() 中取回后交给估计器
+std::unique_ptr<Relocalizer> relocalizer;
+std::vector<ReloResult> relo_buf;
+
+// 一帧图像的特征点, 在回调中就转换成 processImage 的输入格式
+struct FeatureFrame
+{
+    std_msgs::Header header;
+    map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> image;
+    // relocalization: the features of camera 0 and their descriptors
+    std::vector<int> descriptor_ids;
+    std::vector<uint8_t> descriptors;
+};
+typedef std::shared_ptr<const FeatureFrame> FeatureFrameConstPtr;
 
-std::condition_variable con;
 double current_time = -1;
-queue<sensor_msgs::ImuConstPtr> imu_buf;
-queue<sensor_msgs::PointCloudConstPtr> feature_buf;
-queue<std::vector<ObsPtr>> gnss_meas_buf;
-queue<sensor_msgs::PointCloudConstPtr> relo_buf;
+// 每个传感器流一个 SPSC 队列: 生产者是对应话题的回调, 消费者是 process() 线程
+SpscQueue<sensor_msgs::ImuConstPtr> imu_buf(8192);          // ~40 s at 200 Hz
+SpscQueue<FeatureFrameConstPtr> feature_buf(1024);
+SpscQueue<std::vector<ObsPtr>> gnss_meas_buf(512);
+SpscNotifier buf_notifier;
+std::atomic<bool> buf_reset_requested(false);   // restart 时由 process() 清空队列, 回调线程不能 pop
 int sum_of_wait = 0;
 
-std::mutex m_buf;
 std::mutex m_state;
 std::mutex i_buf;
 std::mutex m_estimator;
 
-/*** IMU预积分相关参数 ***/
-double latest_time;             // 上一帧IMU数据的时间戳（用于IMU预积分）
-Eigen::Vector3d tmp_P;          // 平移（临时量）
-Eigen::Quaterniond tmp_Q;       // 旋转（临时量）
-Eigen::Vector3d tmp_V;          // 速度（临时量）
-Eigen::Vector3d tmp_Ba;         // IMU加速度计偏置（临时量）
-Eigen::Vector3d tmp_Bg;         // IMU陀螺仪偏置（临时量）
-Eigen::Vector3d acc_0;          // 上一帧IMU加速度测量值
-Eigen::Vector3d gyr_0;          // 上一帧IMU角速度测量值
+/*** 高频 IMU 递推 ***/
+ImuPropagator imu_propagator;   // 由 m_state 保护
+OdometryOutput odometry_output; // 递推结果的无锁快照, 写入在 m_state 内, 读取和发布不加锁
 bool init_feature = 0;          // 未使用
-bool init_imu = 1;              // 是否是第一帧IMU数据
 double last_imu_t = -1;         //  上一帧IMU数据的时间戳（用于判断IMU数据时间是否正常，初始值为-1）
 
 std::mutex m_time;              // PPS互斥锁
@@ -57,109 +84,137 @@ double latest_gnss_time;        // 上一帧GNSS数据的时间戳（初始值
 double tmp_last_feature_time;   // 上一帧图像特征数据的时间戳（初始值为-1）
 uint64_t feature_msg_counter;   // 图像特征消息计数
 int skip_parameter;
+std::atomic<bool> process_running(true);    // process() 线程退出标志 (nodelet 卸载时置 false)
+
+/*** 帧准入控制, 只在 process() 线程访问 ***/
+FeatureFrameConstPtr last_admitted_frame;   // 上一帧交给估计器的特征帧
+uint64_t num_merged_frames = 0;             // 积压时跳过的非关键帧
+uint64_t num_logged_merged_frames = 0;
+
+/*** GNSS 等待截止, 只在 process() 线程访问 ***/
+std::vector<std::vector<ObsPtr>> late_gnss_msgs;    // 帧已按纯 VIO 先行之后才到达的历元, 由 processMeasurement 补到窗口中的帧
+uint64_t num_gnss_timeouts = 0;                     // 等待超时, 没有 GNSS 的帧
+double last_gnss_epoch_ts = -1;                     // GNSS 时间, 最近取出的历元
+double gnss_epoch_interval = 0;                     // 观测到的最短历元间隔, 0 为未知
+uint64_t num_late_gnss_attached = 0;                // 补到窗口中的迟到历元
+uint64_t num_late_gnss_dropped = 0;                 // 对应的帧已滑出窗口 (或还没有帧) 的迟到历元
+ros::Publisher pub_estimator_load;          // 估计器负载, 前端据此降低发布频率
+ros::Publisher pub_performance_profile;     // 当前性能档位 (latched), 前端随之切换
+ros::ServiceServer srv_performance_profile;
+std::mutex m_profile;
+std::string pending_profile;                // 服务请求的档位, 由 process() 在下一帧之前应用
+ros::Publisher pub_diagnostics;             // 各阶段耗时的周期汇总 (StageProfiler)
+
+// 最近一次 processMeasurement() 各阶段的耗时 (ms), 离线批处理据此统计耗时分布
+struct FrameTiming
+{
+    double preintegration_ms, gnss_ms, estimate_ms, publish_ms;
+};
+FrameTiming last_frame_timing;
 
 /**
- * @brief 基于IMU测量数据进行PVQ状态预测（位置、速度、姿态）
- * 
- * @details 本函数实现惯性导航的机械编排(Mechanical Alignment)，通过积分IMU的角速度和线加速度数据，
- *          更新载体的姿态、速度和位置预测值。通常用于组合导航或视觉惯性里程计(VIO)的预测步骤。
- * 
- * @param[in] imu_msg IMU消息，包含线加速度和角速度测量值（传感器坐标系下）
+ * @brief 优化结束后把最新帧的状态交给 imu_propagator, 之后的 IMU 由缓存的预积分量直接组合, 不重放队列
  */
-void predict(const sensor_msgs::ImuConstPtr &imu_msg)
+void update()
 {
-    // 1.处理IMU时间戳
-    // 获取当前IMU时间戳（转换为秒）
-    double t = imu_msg->header.stamp.toSec();
+    TicToc t_update;
+    imu_propagator.correct(current_time, estimator_ptr->Ps[WINDOW_SIZE], Eigen::Quaterniond(estimator_ptr->Rs[WINDOW_SIZE]),
+                           estimator_ptr->Vs[WINDOW_SIZE], estimator_ptr->Bas[WINDOW_SIZE], estimator_ptr->Bgs[WINDOW_SIZE],
+                           estimator_ptr->acc_0, estimator_ptr->gyr_0, estimator_ptr->g);
+    odometry_output.update(imu_propagator.latestTime(), imu_propagator.latestP(), imu_propagator.latestQ(),
+                           imu_propagator.latestV(), imu_propagator.latestAcc(), imu_propagator.latestGyr());
+    ROS_DEBUG("imu propagation update costs %fms, %zu samples cached", t_update.toc(), imu_propagator.historySize());
+}
 
-    // 记录第一帧IMU时间戳
-    if (init_imu)
+/**
+ * @brief 按 addFeatureCheckParallax 的判据预估一帧是否会成为关键帧: 与上一帧准入帧共视的特征少于 20 个,
+ *        或平均视差不小于 MIN_PARALLAX; 只用相机 0, 不做旋转补偿, 因此偏向于判为关键帧
+ */
+bool isKeyframeCandidate(const FeatureFrame &frame)
+{
+    if (!last_admitted_frame)
+        return true;
+    const auto &last_image = last_admitted_frame->image;
+    auto it = last_image.begin();
+    int num_common = 0;
+    double sum_parallax = 0;
+    // both maps are ordered by feature id
+    for (const auto &feature : frame.image)
     {
-        latest_time = t;
-        init_imu = 0;
-        return;
+        while (it != last_image.end() && it->first < feature.first)
+            ++it;
+        if (it == last_image.end())
+            break;
+        if (it->first != feature.first || feature.second[0].first != 0 || it->second[0].first != 0)
+            continue;
+        const Eigen::Matrix<double, 7, 1> &p_j = feature.second[0].second;
+        const Eigen::Matrix<double, 7, 1> &p_i = it->second[0].second;
+        sum_parallax += std::hypot(p_j(0) - p_i(0), p_j(1) - p_i(1));
+        num_common++;
     }
-
-    // 计算两次IMU测量的时间间隔（单位：秒）
-    double dt = t - latest_time;
-
-    // 更新上一帧IMU数据的时间戳
-    latest_time = t;
-
-    
-    // 2.提取IMU测量值（传感器坐标系下）
-    // 线加速度（m/s²）
-    double dx = imu_msg->linear_acceleration.x;
-    double dy = imu_msg->linear_acceleration.y;
-    double dz = imu_msg->linear_acceleration.z;
-    Eigen::Vector3d linear_acceleration{dx, dy, dz};
-
-    // 角速度（rad/s）
-    double rx = imu_msg->angular_velocity.x;
-    double ry = imu_msg->angular_velocity.y;
-    double rz = imu_msg->angular_velocity.z;
-    Eigen::Vector3d angular_velocity{rx, ry, rz};
-
-    // 3.状态更新
-    // 计算校正后的上一帧IMU加速度
-    Eigen::Vector3d un_acc_0 = tmp_Q * (acc_0 - tmp_Ba) - estimator_ptr->g;
-    // 计算校正后的角速度（中值积分）
-    Eigen::Vector3d un_gyr = 0.5 * (gyr_0 + angular_velocity) - tmp_Bg;
-
-    // 3.1 姿态更新：q_{k+1} = q_k ⊗ Δq(ω*dt)
-    tmp_Q = tmp_Q * Utility::deltaQ(un_gyr * dt);
-
-    // 计算校正后的当前IMU加速度
-    Eigen::Vector3d un_acc_1 = tmp_Q * (linear_acceleration - tmp_Ba) - estimator_ptr->g;
-
-    // 校正后的加速度中值积分
-    Eigen::Vector3d un_acc = 0.5 * (un_acc_0 + un_acc_1);
-
-    // 3.2 位置更新：P_{k+1} = P_k + V_k*dt + 0.5*a*dt²（二阶泰勒展开）
-    tmp_P = tmp_P + dt * tmp_V + 0.5 * dt * dt * un_acc;
-    
-    // 3.3 速度更新：V_{k+1} = V_k + a*dt
-    tmp_V = tmp_V + dt * un_acc;
-
-    // 4.缓存当前IMU测量值用于下一帧计算
-    acc_0 = linear_acceleration;    // 缓存当前加速度
-    gyr_0 = angular_velocity;       // 缓存当前角速度
+    return num_common < 20 || sum_parallax / num_common >= MIN_PARALLAX;
 }
 
-void update()
+/**
+ * @brief 发布估计器负载, 每帧处理完后调用
+ */
+void pubEstimatorLoad(const std_msgs::Header &header, double solve_ms)
 {
-    TicToc t_predict;
-    latest_time = current_time;
-    tmp_P = estimator_ptr->Ps[WINDOW_SIZE];
-    tmp_Q = estimator_ptr->Rs[WINDOW_SIZE];
-    tmp_V = estimator_ptr->Vs[WINDOW_SIZE];
-    tmp_Ba = estimator_ptr->Bas[WINDOW_SIZE];
-    tmp_Bg = estimator_ptr->Bgs[WINDOW_SIZE];
-    acc_0 = estimator_ptr->acc_0;
-    gyr_0 = estimator_ptr->gyr_0;
-
-    queue<sensor_msgs::ImuConstPtr> tmp_imu_buf = imu_buf;
-    for (sensor_msgs::ImuConstPtr tmp_imu_msg; !tmp_imu_buf.empty(); tmp_imu_buf.pop())
-        predict(tmp_imu_buf.front());
-
+    gvins_feature_tracker::EstimatorLoad load;
+    load.header = header;
+    load.backlog = feature_buf.size();
+    load.backlog_span = feature_buf.empty() ? 0.0 :
+        feature_buf.back()->header.stamp.toSec() - feature_buf.front()->header.stamp.toSec();
+    load.solve_time = solve_ms / 1000.0;
+    load.merged_frames = num_merged_frames;
+    // not advertised offline
+    if (pub_estimator_load)
+        pub_estimator_load.publish(load);
+
+    if (num_merged_frames != num_logged_merged_frames)
+    {
+        ROS_INFO_THROTTLE(10.0, "frame admission: %lu non-keyframes merged, backlog %u frames (%.3f s)",
+                          num_merged_frames, load.backlog, load.backlog_span);
+        num_logged_merged_frames = num_merged_frames;
+    }
 }
 
 /**
  * @brief 同步一帧图像和多个IMU、GNSS观测的数据
  * 
  * @param[out] imu_msg      上一帧图像时间到当前帧图像时间的所有IMU数据 + 大于当前帧图像时间的第一帧IMU数据
- * @param[out] img_msg      图像特征数据
- * @param[out] gnss_msg     GNSS数据（与当前帧图像时间戳的时间差不大于0.05s）
+ * @param[out] img_msg      图像特征数据 (已转换的特征帧)
+ * @param[out] gnss_msgs    与当前帧图像时间戳的时间差不大于 MAX_GNSS_CAMERA_DELAY 的所有历元 (GNSS 可以高于图像的频率),
+ *                          等待超过 gnss_wait_deadline 时为已到达的部分
  * @return true 
  * @return false 
  */
-bool getMeasurements(std::vector<sensor_msgs::ImuConstPtr> &imu_msg, sensor_msgs::PointCloudConstPtr &img_msg, std::vector<ObsPtr> &gnss_msg)
+bool getMeasurements(std::vector<sensor_msgs::ImuConstPtr> &imu_msg, FeatureFrameConstPtr &img_msg,
+                     std::vector<std::vector<ObsPtr>> &gnss_msgs)
 {
-    // 注意这个地方很有意思，是按照顺序进行或的，也就是如果imu不是空，这里就能过去。
-    // 所以如果gnss一直收不到，那么也不影响单纯的VIO运行
-    if (imu_buf.empty() || feature_buf.empty() || (GNSS_ENABLE && gnss_meas_buf.empty()))
+    if (buf_reset_requested.exchange(false))
+    {
+        feature_buf.clear();
+        imu_buf.clear();
+        last_admitted_frame.reset();
+        late_gnss_msgs.clear();
+        last_gnss_epoch_ts = -1;
+        gnss_epoch_interval = 0;
+    }
+
+    // GNSS 不在这里等待, 见下面的 gnss_wait_deadline
+    if (imu_buf.empty() || feature_buf.empty())
         return false;
     
+    // 积压的特征帧超过 ADMISSION_MAX_LATENCY 时跳过队首的非关键帧, 它的 IMU 留在 imu_buf 中, 并入下一帧的预积分
+    while (ADMISSION_MAX_LATENCY > 0 && feature_buf.size() > 1 &&
+           feature_buf.back()->header.stamp.toSec() - feature_buf.front()->header.stamp.toSec() > ADMISSION_MAX_LATENCY &&
+           !isKeyframeCandidate(*feature_buf.front()))
+    {
+        feature_buf.pop();
+        num_merged_frames++;
+    }
+
     double front_feature_ts = feature_buf.front()->header.stamp.toSec();
 
     // 最新的IMU时间比图像时间还早，说明imu还没到
@@ -172,10 +227,11 @@ bool getMeasurements(std::vector<sensor_msgs::ImuConstPtr> &imu_msg, sensor_msgs
     double front_imu_ts = imu_buf.front()->header.stamp.toSec();
 
     // 最老的图像时间比最老的IMU时间还老，那么只能把图像丢掉
-    while (!feature_buf.empty() && front_imu_ts > front_feature_ts)
+    while (front_imu_ts > front_feature_ts)
     {
         ROS_WARN("throw img, only should happen at the beginning");
         feature_buf.pop();
+        if (feature_buf.empty()) return false;
         front_feature_ts = feature_buf.front()->header.stamp.toSec();
     }
 
@@ -183,35 +239,51 @@ bool getMeasurements(std::vector<sensor_msgs::ImuConstPtr> &imu_msg, sensor_msgs
 
     if (GNSS_ENABLE)
     {
+        const double local_feature_ts = front_feature_ts;
         front_feature_ts += time_diff_gnss_local;    // 补偿图像时间，和GNSS时间对齐
-        double front_gnss_ts = time2sec(gnss_meas_buf.front()[0]->time);
 
-        // 把太老的GNSS数据全部丢掉
-        while (!gnss_meas_buf.empty() && front_gnss_ts < front_feature_ts-MAX_GNSS_CAMERA_DELAY)
+        const double frame_end_ts = front_feature_ts + MAX_GNSS_CAMERA_DELAY;
+        auto pop_epoch = [](std::vector<std::vector<ObsPtr>> &dst)
         {
-            ROS_WARN("throw gnss, only should happen at the beginning");
+            const double epoch_ts = time2sec(gnss_meas_buf.front()[0]->time);
+            if (last_gnss_epoch_ts >= 0 && epoch_ts > last_gnss_epoch_ts)
+            {
+                const double interval = epoch_ts - last_gnss_epoch_ts;
+                gnss_epoch_interval = gnss_epoch_interval > 0 ? std::min(gnss_epoch_interval, interval) : interval;
+            }
+            last_gnss_epoch_ts = std::max(last_gnss_epoch_ts, epoch_ts);
+            dst.push_back(gnss_meas_buf.front());
             gnss_meas_buf.pop();
-            if (gnss_meas_buf.empty()) return false;
-            front_gnss_ts = time2sec(gnss_meas_buf.front()[0]->time);
-        }
+        };
 
-        // 疑问：如果是在室内，此时GNSS全部失效，那这里返回false，岂不是VIO都不能运行了？
-        if (gnss_meas_buf.empty())
-        {
-            ROS_WARN("wait for gnss...");
-            return false;
-        }
-        // 如果在时间容忍范围内，则这个gnss观测数据就可以使用
-        // 疑问：但是为什么还是用了一个时间容忍来寻找呢?
-        else if (abs(front_gnss_ts-front_feature_ts) < MAX_GNSS_CAMERA_DELAY)
+        // 比这一帧还老的历元: 它的帧已经因等待超时先行, 交给 processMeasurement 补到窗口中
+        while (!gnss_meas_buf.empty() && time2sec(gnss_meas_buf.front()[0]->time) < front_feature_ts-MAX_GNSS_CAMERA_DELAY)
+            pop_epoch(late_gnss_msgs);
+
+        // 这一帧的历元已全部到达: 已有更新的历元, 或按历元间隔下一个历元不会再属于这一帧
+        // 没有 GNSS (遮挡, 隧道, 接收机链路中断或时间尚未同步) 时, 等到 IMU 超过这一帧 gnss_wait_deadline
+        // 之后只用已到达的历元 (或只用 VIO) 处理这一帧; 以 IMU 的时间而不是墙上时间计时, 离线处理时结果不变
+        const double newest_epoch_ts = gnss_meas_buf.empty() ? last_gnss_epoch_ts : time2sec(gnss_meas_buf.back()[0]->time);
+        if (!(newest_epoch_ts >= 0 && newest_epoch_ts + gnss_epoch_interval > frame_end_ts))
         {
-            gnss_msg = gnss_meas_buf.front();
-            gnss_meas_buf.pop();
+            const double waited = imu_buf.back()->header.stamp.toSec() - local_feature_ts;
+            if (GNSS_WAIT_DEADLINE < 0 || waited < GNSS_WAIT_DEADLINE)
+                return false;
+            if (gnss_meas_buf.empty())
+            {
+                num_gnss_timeouts++;
+                ROS_WARN_THROTTLE(5.0, "no GNSS within %.2f s, %lu frames processed VIO-only", GNSS_WAIT_DEADLINE,
+                                  num_gnss_timeouts);
+            }
         }
+        // 时间容忍范围内的历元都属于这一帧, 更新的历元属于之后的帧
+        while (!gnss_meas_buf.empty() && time2sec(gnss_meas_buf.front()[0]->time) <= frame_end_ts)
+            pop_epoch(gnss_msgs);
     }
 
     img_msg = feature_buf.front();
     feature_buf.pop();
+    last_admitted_frame = img_msg;
 
     // 最后，把所有可用的IMU序列找出来（IMU时间戳小于相机时间戳+大于相机时间戳的第一帧IMU）
     while (imu_buf.front()->header.stamp.toSec() < img_msg->header.stamp.toSec() + estimator_ptr->td)   // estimator_ptr->td = 0.0
@@ -225,6 +297,18 @@ bool getMeasurements(std::vector<sensor_msgs::ImuConstPtr> &imu_msg, sensor_msgs
     return true;
 }
 
+/**
+ * @brief 消息到达时相对其时间戳的延迟 (ms), 按流汇总到 /diagnostics; 离线时到达时间没有意义, 不统计
+ */
+void recordStreamLag(StageProfiler::Counter stream, double stamp)
+{
+#ifndef GVINS_OFFLINE
+    StageProfiler &profiler = StageProfiler::instance();
+    if (profiler.enabled())
+        profiler.count(stream, (ros::Time::now().toSec() - stamp) * 1000.0);
+#endif
+}
+
 /**
  * @brief Imu消息存进imu_buf，同时按照imu频率（200Hz）预测predict位姿并发送(IMU状态递推并发布[P,Q,V,header])，提高里程计频率
  * 
@@ -232,30 +316,46 @@ bool getMeasurements(std::vector<sensor_msgs::ImuConstPtr> &imu_msg, sensor_msgs
  */
 void imu_callback(const sensor_msgs::ImuConstPtr &imu_msg)
 {
+    GVINS_TRACE_ZONE("imu_callback");
     if (imu_msg->header.stamp.toSec() <= last_imu_t)
     {
         ROS_WARN("imu message in disorder!");
         return;
     }
     last_imu_t = imu_msg->header.stamp.toSec();
+    recordStreamLag(StageProfiler::IMU_LAG, last_imu_t);
 
-    m_buf.lock();
-    imu_buf.push(imu_msg);
-    m_buf.unlock();
-    con.notify_one();
+    if (!imu_buf.push(imu_msg))
+        ROS_WARN_THROTTLE(1.0, "imu_buf full, %zu imu messages dropped", imu_buf.overflows());
+    buf_notifier.notify();
 
     last_imu_t = imu_msg->header.stamp.toSec();
 
     {
         std::lock_guard<std::mutex> lg(m_state);
-        predict(imu_msg);
-        std_msgs::Header header = imu_msg->header;
-        header.frame_id = "world";
-        if (estimator_ptr->solver_flag == Estimator::SolverFlag::NON_LINEAR)
-            pubLatestOdometry(tmp_P, tmp_Q, tmp_V, header);
+        imu_propagator.push(last_imu_t,
+            Eigen::Vector3d(imu_msg->linear_acceleration.x, imu_msg->linear_acceleration.y, imu_msg->linear_acceleration.z),
+            Eigen::Vector3d(imu_msg->angular_velocity.x, imu_msg->angular_velocity.y, imu_msg->angular_velocity.z));
+        if (estimator_ptr->solver_flag == Estimator::SolverFlag::NON_LINEAR && imu_propagator.valid())
+        {
+            odometry_output.update(last_imu_t, imu_propagator.latestP(), imu_propagator.latestQ(), imu_propagator.latestV(),
+                                   imu_propagator.latestAcc(), imu_propagator.latestGyr());
+            // without the output thread, publish once per IMU message as before
+            if (!odometry_output.threaded())
+                odometry_output.publish(last_imu_t);
+        }
     }
 }
 
+// 发布者: 收到的星历同时写入共享内存
+void publishSharedEphem(const EphemBasePtr &ephem)
+{
+    if (!shared_ephem || shared_ephem_reader)
+        return;
+    std::lock_guard<std::mutex> lock(m_shared_ephem);
+    shared_ephem->publish(ephem);
+}
+
 /**
  * @brief 订阅星历信息（GPS, Galileo, BeiDou）
  * 
@@ -268,6 +368,7 @@ void gnss_ephem_callback(const GnssEphemMsgConstPtr &ephem_msg)
 {
     EphemPtr ephem = msg2ephem(ephem_msg);  //将ROS星历信息，转换成相应的Ephem数据
     estimator_ptr->inputEphem(ephem);
+    publishSharedEphem(ephem);
 }
 
 /**
@@ -282,6 +383,7 @@ void gnss_glo_ephem_callback(const GnssGloEphemMsgConstPtr &glo_ephem_msg)
 {
     GloEphemPtr glo_ephem = msg2glo_ephem(glo_ephem_msg);   //将ROS星历信息，转换成相应的Ephem数据
     estimator_ptr->inputEphem(glo_ephem);
+    publishSharedEphem(glo_ephem);
 }
 
 void gnss_iono_params_callback(const StampedFloat64ArrayConstPtr &iono_msg)
@@ -291,31 +393,71 @@ void gnss_iono_params_callback(const StampedFloat64ArrayConstPtr &iono_msg)
     std::copy(iono_msg->data.begin(), iono_msg->data.end(), std::back_inserter(iono_params));
     assert(iono_params.size() == 8);
     estimator_ptr->inputIonoParams(ts, iono_params);
+    if (shared_ephem && !shared_ephem_reader)
+    {
+        std::lock_guard<std::mutex> lock(m_shared_ephem);
+        shared_ephem->publishIonoParams(iono_params);
+    }
+}
+
+/**
+ * @brief 读者: 取回发布者新写入的星历和电离层参数, 放入估计器; 发布者尚未创建共享段时每帧重试打开
+ * 
+ * @param stamp 当前帧时间, 作为电离层参数的时间戳
+ */
+void pollSharedEphem(double stamp)
+{
+    if (!shared_ephem)
+    {
+        shared_ephem = SharedEphemSegment::open(GNSS_SHARED_EPHEM);
+        if (!shared_ephem)
+        {
+            ROS_WARN_THROTTLE(10, "shared ephemeris %s not published yet", GNSS_SHARED_EPHEM.c_str());
+            return;
+        }
+    }
+    std::vector<EphemBasePtr> ephems;
+    std::vector<double> iono_params;
+    shared_ephem->poll(ephems, iono_params);
+    for (const EphemBasePtr &ephem : ephems)
+        estimator_ptr->inputEphem(ephem);
+    if (!iono_params.empty())
+        estimator_ptr->inputIonoParams(stamp, iono_params);
+    if (!ephems.empty())
+        ROS_DEBUG("shared ephemeris: %lu new, %lu missed in total", ephems.size(),
+                  static_cast<unsigned long>(shared_ephem->numMissed()));
 }
 
 void gnss_meas_callback(const GnssMeasMsgConstPtr &meas_msg)
 {
-    std::vector<ObsPtr> gnss_meas = msg2meas(meas_msg);
+    GVINS_TRACE_ZONE("gnss_meas_callback");
+    static ObsPool obs_pool;        // 回调线程独占; Obs 随窗口滑出后回收, 稳定后转换不再分配内存
+    std::vector<ObsPtr> gnss_meas;
+    msg2meas(meas_msg, obs_pool, gnss_meas);
+    if (gnss_rinex_writer)
+        gnss_rinex_writer->write(gnss_meas);
 
     latest_gnss_time = time2sec(gnss_meas[0]->time);
 
     // cerr << "gnss ts is " << std::setprecision(20) << time2sec(gnss_meas[0]->time) << endl;
     if (!time_diff_valid)   return;
+    recordStreamLag(StageProfiler::GNSS_LAG, latest_gnss_time - time_diff_gnss_local);
 
-    m_buf.lock();
-    gnss_meas_buf.push(std::move(gnss_meas));
-    m_buf.unlock();
-    con.notify_one();
+    if (!gnss_meas_buf.push(std::move(gnss_meas)))
+        ROS_WARN_THROTTLE(1.0, "gnss_meas_buf full, %zu gnss measurements dropped", gnss_meas_buf.overflows());
+    buf_notifier.notify();
 }
 
 /**
- * @brief feature回调函数，将feature_msg放入feature_buf
+ * @brief 将一帧特征放入feature_buf, GNSS 模式下按 GNSS 时间隔帧丢弃
  * 
  * @param feature_msg 
  */
-void feature_callback(const sensor_msgs::PointCloudConstPtr &feature_msg)
+void inputFeatureFrame(const FeatureFrameConstPtr &feature_msg)
 {
+    GVINS_TRACE_ZONE("inputFeatureFrame");
     ++ feature_msg_counter;
+    recordStreamLag(StageProfiler::FEATURE_LAG, feature_msg->header.stamp.toSec());
 
     if (skip_parameter < 0 && time_diff_valid)
     {
@@ -336,13 +478,91 @@ void feature_callback(const sensor_msgs::PointCloudConstPtr &feature_msg)
 
     if (skip_parameter >= 0 && int(feature_msg_counter%2) != skip_parameter)
     {
-        m_buf.lock();
-        feature_buf.push(feature_msg);
-        m_buf.unlock();
-        con.notify_one();
+        if (!feature_buf.push(feature_msg))
+            ROS_WARN_THROTTLE(1.0, "feature_buf full, %zu feature frames dropped", feature_buf.overflows());
+        buf_notifier.notify();
     }
 }
 
+/**
+ * @brief feature回调函数 (sensor_msgs::PointCloud, 仿真器和 compact_feature_msg: 0 时使用)
+ * 
+ * @param feature_msg 
+ */
+void feature_callback(const sensor_msgs::PointCloudConstPtr &feature_msg)
+{
+    std::shared_ptr<FeatureFrame> frame(new FeatureFrame);
+    frame->header = feature_msg->header;
+    auto &image = frame->image;
+    for (unsigned int i = 0; i < feature_msg->points.size(); i++)
+    {
+        int v = feature_msg->channels[0].values[i] + 0.5;
+        int feature_id = v / NUM_OF_CAM;
+        int camera_id = v % NUM_OF_CAM;
+        double x = feature_msg->points[i].x;
+        double y = feature_msg->points[i].y;
+        double z = feature_msg->points[i].z;
+        double p_u = feature_msg->channels[1].values[i];
+        double p_v = feature_msg->channels[2].values[i];
+        double velocity_x = feature_msg->channels[3].values[i];
+        double velocity_y = feature_msg->channels[4].values[i];
+        ROS_ASSERT(z == 1);
+        Eigen::Matrix<double, 7, 1> xyz_uv_velocity;
+        xyz_uv_velocity << x, y, z, p_u, p_v, velocity_x, velocity_y;
+        image[feature_id].emplace_back(camera_id,  xyz_uv_velocity);
+    }
+    inputFeatureFrame(frame);
+}
+
+/**
+ * @brief feature回调函数 (gvins_feature_tracker::FeatureTracks)
+ * 
+ * @details id 没有顺序 (前端按跟踪长度排列特征): 大于已有 id 时 emplace_hint 在末尾插入为均摊 O(1),
+ *          否则 emplace 为 O(log n)
+ * @param tracks_msg 
+ */
+void feature_tracks_callback(const gvins_feature_tracker::FeatureTracksConstPtr &tracks_msg)
+{
+    const size_t num_tracks = tracks_msg->id.size();
+    ROS_ASSERT(tracks_msg->x.size() == num_tracks && tracks_msg->y.size() == num_tracks &&
+               tracks_msg->u.size() == num_tracks && tracks_msg->v.size() == num_tracks &&
+               tracks_msg->velocity_x.size() == num_tracks && tracks_msg->velocity_y.size() == num_tracks);
+
+    std::shared_ptr<FeatureFrame> frame(new FeatureFrame);
+    frame->header = tracks_msg->header;
+    auto &image = frame->image;
+    for (size_t i = 0; i < num_tracks; i++)
+    {
+        const int feature_id = tracks_msg->id[i] / NUM_OF_CAM;
+        const int camera_id = tracks_msg->id[i] % NUM_OF_CAM;
+        auto it = image.end();
+        if (image.empty() || std::prev(it)->first < feature_id)
+        {
+            it = image.emplace_hint(it, feature_id, vector<pair<int, Eigen::Matrix<double, 7, 1>>>());
+            it->second.reserve(NUM_OF_CAM);
+        }
+        else
+            it = image.emplace(feature_id, vector<pair<int, Eigen::Matrix<double, 7, 1>>>()).first;
+
+        Eigen::Matrix<double, 7, 1> xyz_uv_velocity;
+        xyz_uv_velocity << tracks_msg->x[i], tracks_msg->y[i], 1.0, tracks_msg->u[i], tracks_msg->v[i], 
+                           tracks_msg->velocity_x[i], tracks_msg->velocity_y[i];
+        it->second.emplace_back(camera_id, xyz_uv_velocity);
+    }
+    if (tracks_msg->descriptors.size() == num_tracks * RELO_DESCRIPTOR_SIZE)
+    {
+        for (size_t i = 0; i < num_tracks; i++)
+        {
+            if (tracks_msg->id[i] % NUM_OF_CAM != 0)
+                continue;
+            frame->descriptor_ids.push_back(tracks_msg->id[i] / NUM_OF_CAM);
+            frame->descriptors.insert(frame->descriptors.end(), tracks_msg->descriptors.begin() + i * RELO_DESCRIPTOR_SIZE,
+                                      tracks_msg->descriptors.begin() + (i + 1) * RELO_DESCRIPTOR_SIZE);
+        }
+    }
+    inputFeatureFrame(frame);
+}
+
 /**
  * @brief 订阅VI传感器的外部触发信息（时间硬同步）
  * 
@@ -400,157 +620,424 @@ void gnss_tp_info_callback(const GnssTimePulseInfoMsgConstPtr &tp_msg)
     next_pulse_time_valid = true;   // 设置下一个pps时间有效
 }
 
+bool set_performance_profile_callback(gvins::SetPerformanceProfile::Request &req,
+                                      gvins::SetPerformanceProfile::Response &res)
+{
+    PerformanceProfile profile;
+    res.success = resolvePerformanceProfile(PERFORMANCE_PROFILES, req.name, profile);
+    if (!res.success)
+    {
+        res.message = "no performance profile " + req.name + ", the active one is kept";
+        return true;
+    }
+    std::lock_guard<std::mutex> lk(m_profile);
+    pending_profile = req.name;
+    res.message = "performance profile " + req.name + " applied from the next frame";
+    return true;
+}
+
+/**
+ * @brief 服务请求的性能档位在两帧之间应用 (持 m_estimator), 再公布给前端
+ */
+void applyPendingProfile()
+{
+    std::string profile;
+    {
+        std::lock_guard<std::mutex> lk(m_profile);
+        profile.swap(pending_profile);
+    }
+    if (profile.empty() || profile == estimator_ptr->config.PERFORMANCE_PROFILE ||
+        !estimator_ptr->setPerformanceProfile(profile))
+        return;
+    std_msgs::String profile_msg;
+    profile_msg.data = profile;
+    if (pub_performance_profile)
+        pub_performance_profile.publish(profile_msg);
+}
+
 void restart_callback(const std_msgs::BoolConstPtr &restart_msg)
 {
     if (restart_msg->data == true)
     {
         ROS_WARN("restart the estimator!");
-        m_buf.lock();
-        while(!feature_buf.empty())
-            feature_buf.pop();
-        while(!imu_buf.empty())
-            imu_buf.pop();
-        m_buf.unlock();
+        buf_reset_requested = true;
+        buf_notifier.wake();
         m_estimator.lock();
+        estimator_ptr->discardCheckpoint();
         estimator_ptr->clearState();
         estimator_ptr->setParameter();
         m_estimator.unlock();
+        m_state.lock();
+        imu_propagator.reset();
+        odometry_output.invalidate();
+        m_state.unlock();
         current_time = -1;
         last_imu_t = 0;
     }
     return;
 }
 
+/**
+ * @brief 每帧的阶段耗时和计数交给 StageProfiler, 每 DIAGNOSTICS_PERIOD 发布一次汇总
+ */
+void profileFrame(const std_msgs::Header &header, size_t num_sats)
+{
+    StageProfiler &profiler = StageProfiler::instance();
+    if (!profiler.enabled())
+        return;
+    profiler.record(StageProfiler::PREINTEGRATION, last_frame_timing.preintegration_ms);
+    if (num_sats > 0)
+    {
+        profiler.record(StageProfiler::GNSS, last_frame_timing.gnss_ms);
+        profiler.count(StageProfiler::SATELLITES, num_sats);
+    }
+    profiler.record(StageProfiler::ESTIMATE, last_frame_timing.estimate_ms);
+    profiler.record(StageProfiler::PUBLISH, last_frame_timing.publish_ms);
+    profiler.count(StageProfiler::FEATURES, estimator_ptr->f_manager.getFeatureCount());
+    if (estimator_ptr->solver_flag == Estimator::SolverFlag::NON_LINEAR)
+    {
+        const Estimator::SolverStatistics &stats = estimator_ptr->solver_stats;
+        profiler.record(StageProfiler::SOLVER, stats.solver_ms);
+        profiler.record(StageProfiler::MARGINALIZATION, stats.marginalization_ms);
+        profiler.count(StageProfiler::RESIDUAL_BLOCKS, stats.residual_blocks);
+        profiler.count(StageProfiler::ITERATIONS, stats.iterations);
+    }
+
+    if (!profiler.due())
+        return;
+    diagnostic_msgs::DiagnosticArray diagnostics;
+    diagnostics.header = header;
+    diagnostics.status.resize(1);
+    profiler.takeReport("gvins: estimator stages", diagnostics.status[0]);
+    if (GNSS_ENABLE)
+    {
+        // totals since the start
+        const std::pair<const char *, uint64_t> gnss_counts[] = {{"gnss_timeout_frames", num_gnss_timeouts},
+            {"late_gnss_attached", num_late_gnss_attached}, {"late_gnss_dropped", num_late_gnss_dropped},
+            {"gnss_psr_rejected", estimator_ptr->num_gnss_psr_rejected},
+            {"gnss_dopp_rejected", estimator_ptr->num_gnss_dopp_rejected}};
+        for (const std::pair<const char *, uint64_t> &count : gnss_counts)
+        {
+            diagnostic_msgs::KeyValue kv;
+            kv.key = count.first;
+            kv.value = std::to_string(count.second);
+            diagnostics.status[0].values.push_back(kv);
+        }
+    }
+    if (SOLVER_WATCHDOG)
+    {
+        // solves stopped early since the start, by reason
+        for (int r = SolverWatchdog::NONE + 1; r < SolverWatchdog::NUM_REASONS; r++)
+        {
+            const SolverWatchdog::Reason reason = static_cast<SolverWatchdog::Reason>(r);
+            diagnostic_msgs::KeyValue kv;
+            kv.key = std::string("solver_stopped_") + SolverWatchdog::REASON_NAMES[r];
+            kv.value = std::to_string(estimator_ptr->solver_watchdog.count(reason));
+            diagnostics.status[0].values.push_back(kv);
+        }
+    }
+    // not advertised offline
+    if (pub_diagnostics)
+        pub_diagnostics.publish(diagnostics);
+}
+
+/**
+ * @brief 处理 getMeasurements 取出的一帧: IMU 预积分, GNSS, 后端优化, 发布和 IMU 递推的更新
+ *        在线时由 process() 线程调用, 离线时由估计流水级调用
+ */
+void processMeasurement(const std::vector<sensor_msgs::ImuConstPtr> &imu_msg, const FeatureFrameConstPtr &img_msg,
+                        const std::vector<std::vector<ObsPtr>> &gnss_msgs, DeadlineMonitor &frame_deadline)
+{
+    GVINS_TRACE_ZONE("processMeasurement");
+    m_estimator.lock();
+    applyPendingProfile();
+    // tracking and transport of this frame, measured against the image stamp
+    estimator_ptr->latency_governor.beginFrame((ros::Time::now().toSec() - img_msg->header.stamp.toSec()) * 1000.0);
+
+    // 从上次运行的检查点恢复, 第一段 IMU 积分跨过停机的间隔, 间隔太长则冷启动
+    if (current_time < 0 && estimator_ptr->latest_checkpoint && !imu_msg.empty())
+    {
+        const double gap = imu_msg.front()->header.stamp.toSec() - estimator_ptr->latest_checkpoint_time;
+        if (gap >= 0 && gap <= CHECKPOINT_MAX_GAP && estimator_ptr->resumeFromCheckpoint())
+            current_time = estimator_ptr->latest_checkpoint_time;
+        else
+        {
+            ROS_WARN("checkpoint %.3f s before the first IMU sample, cold start", gap);
+            estimator_ptr->discardCheckpoint();
+        }
+    }
+
+    // Step 2. 执行IMU预积分
+    TicToc t_stage;
+    double dx = 0, dy = 0, dz = 0, rx = 0, ry = 0, rz = 0;
+    for (auto &imu_data : imu_msg)
+    {
+        double t = imu_data->header.stamp.toSec();
+        double img_t = img_msg->header.stamp.toSec() + estimator_ptr->td;   // estimator_ptr->td = 0.0
+        if (t <= img_t)
+        { 
+            if (current_time < 0)
+                current_time = t;
+            double dt = t - current_time;
+            ROS_ASSERT(dt >= 0);
+            current_time = t;
+            dx = imu_data->linear_acceleration.x;
+            dy = imu_data->linear_acceleration.y;
+            dz = imu_data->linear_acceleration.z;
+            rx = imu_data->angular_velocity.x;
+            ry = imu_data->angular_velocity.y;
+            rz = imu_data->angular_velocity.z;
+            estimator_ptr->processIMU(dt, Vector3d(dx, dy, dz), Vector3d(rx, ry, rz));
+            //printf("imu: dt:%f a: %f %f %f w: %f %f %f\n",dt, dx, dy, dz, rx, ry, rz);
+
+        }
+        else    // 针对最后一个imu数据，做一个简单的线性插值（插值到图像时间戳）
+        {
+            double dt_1 = img_t - current_time;
+            double dt_2 = t - img_t;
+            current_time = img_t;
+            ROS_ASSERT(dt_1 >= 0);
+            ROS_ASSERT(dt_2 >= 0);
+            ROS_ASSERT(dt_1 + dt_2 > 0);
+            double w1 = dt_2 / (dt_1 + dt_2);
+            double w2 = dt_1 / (dt_1 + dt_2);
+            dx = w1 * dx + w2 * imu_data->linear_acceleration.x;
+            dy = w1 * dy + w2 * imu_data->linear_acceleration.y;
+            dz = w1 * dz + w2 * imu_data->linear_acceleration.z;
+            rx = w1 * rx + w2 * imu_data->angular_velocity.x;
+            ry = w1 * ry + w2 * imu_data->angular_velocity.y;
+            rz = w1 * rz + w2 * imu_data->angular_velocity.z;
+            estimator_ptr->processIMU(dt_1, Vector3d(dx, dy, dz), Vector3d(rx, ry, rz));
+            //printf("dimu: dt:%f a: %f %f %f w: %f %f %f\n",dt_1, dx, dy, dz, rx, ry, rz);
+        }
+    }
+
+    last_frame_timing.preintegration_ms = t_stage.toc();
+
+    // Step 3. 处理GNSS观测和星历信息，放到estimator的类成员变量中
+    t_stage.tic();
+    if (GNSS_ENABLE)
+    {
+        // 先补迟到的 (更早的) 历元, 卫星的跟踪计数仍按时间顺序
+        for (const std::vector<ObsPtr> &late_msg : late_gnss_msgs)
+        {
+            if (estimator_ptr->processLateGNSS(late_msg, MAX_GNSS_CAMERA_DELAY))
+                num_late_gnss_attached++;
+            else
+                num_late_gnss_dropped++;
+        }
+        if (!late_gnss_msgs.empty())
+            ROS_DEBUG("late gnss: %lu attached, %lu dropped in total", num_late_gnss_attached, num_late_gnss_dropped);
+        late_gnss_msgs.clear();
+        if (shared_ephem_reader)
+            pollSharedEphem(img_msg->header.stamp.toSec());
+        for (const std::vector<ObsPtr> &gnss_msg : gnss_msgs)
+            estimator_ptr->processGNSS(gnss_msg);
+    }
+    last_frame_timing.gnss_ms = t_stage.toc();
+
+    ROS_DEBUG("processing vision data with stamp %f \n", img_msg->header.stamp.toSec());
+
+    // Step 4. 前端的特征点追踪信息已在回调中转换好
+    TicToc t_s;
+
+    // 上一次提交的关键帧的重定位结果, 在本帧的优化中作为约束; 本帧的描述子在初始化时即可用于地图定位
+    if (relocalizer)
+    {
+        relocalizer->addFrameDescriptors(fromRosHeader(img_msg->header).stamp, img_msg->descriptor_ids, img_msg->descriptors);
+        relocalizer->poll(relo_buf);
+        for (const ReloResult &result : relo_buf)
+            estimator_ptr->setReloFrame(result);
+        relo_buf.clear();
+    }
+
+    // Step 5. 重点：后端优化
+    estimator_ptr->processImage(img_msg->image, fromRosHeader(img_msg->header));
+
+    if (relocalizer)
+    {
+        ReloKeyframe keyframe;
+        if (estimator_ptr->reloKeyframe(keyframe))
+            relocalizer->addKeyframe(std::move(keyframe));
+    }
+
+    // Step 6. 一次处理完成，进行一些统计信息计算
+    double whole_t = t_s.toc();
+    last_frame_timing.estimate_ms = whole_t;
+    frame_deadline.record(whole_t);
+    printStatistics(*estimator_ptr, whole_t);
+    pubEstimatorLoad(img_msg->header, whole_t);
+    if (estimator_ptr->solver_flag == Estimator::SolverFlag::NON_LINEAR)
+    {
+        const Estimator::SolverStatistics &stats = estimator_ptr->solver_stats;
+        const double stamp_ns = img_msg->header.stamp.toSec() * 1e9;
+        const double solver_result[10] = {whole_t, stats.solver_ms, stats.marginalization_ms,
+            static_cast<double>(stats.iterations), stats.initial_cost, stats.final_cost,
+            static_cast<double>(stats.residual_blocks), static_cast<double>(stats.parameter_blocks),
+            static_cast<double>(estimator_ptr->f_manager.getFeatureCount()),
+            estimator_ptr->marginalization_flag == Estimator::MarginalizationFlag::MARGIN_OLD ? 1.0 : 0.0};
+        ResultLogger::instance().log(ResultLogger::FACTOR_GRAPH, &stamp_ns, solver_result);
+    }
+    std_msgs::Header header = img_msg->header;
+    header.frame_id = "world";
+
+    t_stage.tic();
+    {
+        GVINS_TRACE_ZONE("pubEstimatorResults");
+        pubEstimatorResults(*estimator_ptr, header);
+    }
+    Eigen::Matrix3d R_map;
+    Eigen::Vector3d t_map;
+    if (relocalizer && estimator_ptr->solver_flag == Estimator::SolverFlag::NON_LINEAR &&
+        relocalizer->mapAlignment(estimator_ptr->world_generation, R_map, t_map))
+        pubRelocalizedOdometry(*estimator_ptr, R_map, t_map, header);
+    last_frame_timing.publish_ms = t_stage.toc();
+    m_estimator.unlock();
+    m_state.lock();
+    if (estimator_ptr->solver_flag == Estimator::SolverFlag::NON_LINEAR)
+        update();
+    else
+    {
+        imu_propagator.discardBefore(current_time);
+        odometry_output.invalidate();
+    }
+    m_state.unlock();
+    estimator_ptr->latency_governor.endFrame();
+    size_t num_gnss_obs = 0;
+    for (const std::vector<ObsPtr> &gnss_msg : gnss_msgs)
+        num_gnss_obs += gnss_msg.size();
+    profileFrame(img_msg->header, num_gnss_obs);
+    GVINS_TRACE_FRAME("estimator");
+}
+
 /**
  * @brief GVINS主程序，包含初始化，因子图优化
  */
 void process()
 {
+    applyThreadConfig(PROCESS_THREAD, "process");
+    GVINS_TRACE_THREAD("process");
+    DeadlineMonitor frame_deadline("process", PROCESS_THREAD.deadline_ms);
     while (true)
     {
-        std::vector<std::pair<std::vector<sensor_msgs::ImuConstPtr>, sensor_msgs::PointCloudConstPtr>> measurements;
         std::vector<sensor_msgs::ImuConstPtr> imu_msg;
-        sensor_msgs::PointCloudConstPtr img_msg;    
-        std::vector<ObsPtr> gnss_msg;               // gnss的观测信息，对于一个图像帧，会有多个卫星的观测，因此是vector
+        FeatureFrameConstPtr img_msg;    
+        std::vector<std::vector<ObsPtr>> gnss_msgs; // gnss的观测信息，一个图像帧可以有多个历元，每个历元有多个卫星的观测
 
         // Step 1. 同步IMU、图像和GNSS数据
-        std::unique_lock<std::mutex> lk(m_buf);
-        con.wait(lk, [&]
+        buf_notifier.wait([&]
                  {  // 这帧图像和上一帧图像之间包括：一帧图像特征点、多个IMU数据、多个gnss数据
-                    return getMeasurements(imu_msg, img_msg, gnss_msg);
+                    return !process_running || getMeasurements(imu_msg, img_msg, gnss_msgs);
                  });
-        lk.unlock();
-        m_estimator.lock();
-
-        // Step 2. 执行IMU预积分
-        double dx = 0, dy = 0, dz = 0, rx = 0, ry = 0, rz = 0;
-        for (auto &imu_data : imu_msg)
-        {
-            double t = imu_data->header.stamp.toSec();
-            double img_t = img_msg->header.stamp.toSec() + estimator_ptr->td;   // estimator_ptr->td = 0.0
-            if (t <= img_t)
-            { 
-                if (current_time < 0)
-                    current_time = t;
-                double dt = t - current_time;
-                ROS_ASSERT(dt >= 0);
-                current_time = t;
-                dx = imu_data->linear_acceleration.x;
-                dy = imu_data->linear_acceleration.y;
-                dz = imu_data->linear_acceleration.z;
-                rx = imu_data->angular_velocity.x;
-                ry = imu_data->angular_velocity.y;
-                rz = imu_data->angular_velocity.z;
-                estimator_ptr->processIMU(dt, Vector3d(dx, dy, dz), Vector3d(rx, ry, rz));
-                //printf("imu: dt:%f a: %f %f %f w: %f %f %f\n",dt, dx, dy, dz, rx, ry, rz);
+        if (!process_running)
+            break;
+        processMeasurement(imu_msg, img_msg, gnss_msgs, frame_deadline);
+    }
+}
 
-            }
-            else    // 针对最后一个imu数据，做一个简单的线性插值（插值到图像时间戳）
-            {
-                double dt_1 = img_t - current_time;
-                double dt_2 = t - img_t;
-                current_time = img_t;
-                ROS_ASSERT(dt_1 >= 0);
-                ROS_ASSERT(dt_2 >= 0);
-                ROS_ASSERT(dt_1 + dt_2 > 0);
-                double w1 = dt_2 / (dt_1 + dt_2);
-                double w2 = dt_1 / (dt_1 + dt_2);
-                dx = w1 * dx + w2 * imu_data->linear_acceleration.x;
-                dy = w1 * dy + w2 * imu_data->linear_acceleration.y;
-                dz = w1 * dz + w2 * imu_data->linear_acceleration.z;
-                rx = w1 * rx + w2 * imu_data->angular_velocity.x;
-                ry = w1 * ry + w2 * imu_data->angular_velocity.y;
-                rz = w1 * rz + w2 * imu_data->angular_velocity.z;
-                estimator_ptr->processIMU(dt_1, Vector3d(dx, dy, dz), Vector3d(rx, ry, rz));
-                //printf("dimu: dt:%f a: %f %f %f w: %f %f %f\n",dt_1, dx, dy, dz, rx, ry, rz);
-            }
-        }
+template <typename T>
+T readParam(ros::NodeHandle &n, std::string name)
+{
+    T ans;
+    if (n.getParam(name, ans))
+    {
+        ROS_INFO_STREAM("Loaded " << name << ": " << ans);
+    }
+    else
+    {
+        ROS_ERROR_STREAM("Failed to load " << name);
+        n.shutdown();
+    }
+    return ans;
+}
 
-        // Step 3. 处理GNSS观测和星历信息，放到estimator的类成员变量中
-        if (GNSS_ENABLE && !gnss_msg.empty())
-            estimator_ptr->processGNSS(gnss_msg);
+// the YAML named by the config_file parameter into PROCESS_CONFIG
+void readParameters(ros::NodeHandle &n)
+{
+    std::string config_file;
+    config_file = readParam<std::string>(n, "config_file");
+    readParameters(config_file);
+}
 
-        ROS_DEBUG("processing vision data with stamp %f \n", img_msg->header.stamp.toSec());
+/**
+ * @brief 窗口大小是编译期常量, 如果 YAML 要求的窗口大小与本可执行文件不一致,
+ *        切换到同目录下对应的预编译版本 (gvins / gvins_w<N>)
+ * 
+ * @param orig_args ros::init 之前的原始命令行参数
+ * @return 只有在切换失败时才返回
+ */
+void execWindowVariant(const std::vector<std::string> &orig_args)
+{
+    char self_path[4096];
+    ssize_t len = readlink("/proc/self/exe", self_path, sizeof(self_path)-1);
+    if (len <= 0)
+        return;
+    self_path[len] = '\0';
+    std::string dir(self_path);
+    dir = dir.substr(0, dir.find_last_of('/'));
+    std::string variant = dir + "/gvins";
+    if (CONFIG_WINDOW_SIZE != 10)
+        variant += "_w" + std::to_string(CONFIG_WINDOW_SIZE);
+    if (access(variant.c_str(), X_OK) != 0)
+    {
+        ROS_ERROR("window_size %d requested but %s is not built", CONFIG_WINDOW_SIZE, variant.c_str());
+        return;
+    }
 
-        // Step 4. 统计前端的特征点追踪信息
-        TicToc t_s;
-        map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> image;
-        for (unsigned int i = 0; i < img_msg->points.size(); i++)
-        {
-            int v = img_msg->channels[0].values[i] + 0.5;
-            int feature_id = v / NUM_OF_CAM;
-            int camera_id = v % NUM_OF_CAM;
-            double x = img_msg->points[i].x;
-            double y = img_msg->points[i].y;
-            double z = img_msg->points[i].z;
-            double p_u = img_msg->channels[1].values[i];
-            double p_v = img_msg->channels[2].values[i];
-            double velocity_x = img_msg->channels[3].values[i];
-            double velocity_y = img_msg->channels[4].values[i];
-            ROS_ASSERT(z == 1);
-            Eigen::Matrix<double, 7, 1> xyz_uv_velocity;
-            xyz_uv_velocity << x, y, z, p_u, p_v, velocity_x, velocity_y;
-            image[feature_id].emplace_back(camera_id,  xyz_uv_velocity);
-        }
+    ROS_INFO("window_size %d, switching to %s", CONFIG_WINDOW_SIZE, variant.c_str());
+    std::vector<char*> exec_args;
+    for (const std::string &arg : orig_args)
+        exec_args.push_back(const_cast<char*>(arg.c_str()));
+    exec_args.push_back(nullptr);
+    ros::shutdown();
+    execv(variant.c_str(), exec_args.data());
+    ROS_ERROR("failed to start %s", variant.c_str());
+}
 
-        // Step 5. 重点：后端优化
-        estimator_ptr->processImage(image, img_msg->header);
-
-        // Step 6. 一次处理完成，进行一些统计信息计算
-        double whole_t = t_s.toc();
-        printStatistics(*estimator_ptr, whole_t);
-        std_msgs::Header header = img_msg->header;
-        header.frame_id = "world";
-
-        pubOdometry(*estimator_ptr, header);
-        pubKeyPoses(*estimator_ptr, header);
-        pubCameraPose(*estimator_ptr, header);
-        pubPointCloud(*estimator_ptr, header);
-        pubTF(*estimator_ptr, header);
-        pubKeyframe(*estimator_ptr);
-        m_estimator.unlock();
-        m_buf.lock();
-        m_state.lock();
-        if (estimator_ptr->solver_flag == Estimator::SolverFlag::NON_LINEAR)
-            update();
-        m_state.unlock();
-        m_buf.unlock();
-    }
+/**
+ * @brief 关闭时写出关键帧地图 (relo_map_save), 有 GNSS 时关键帧转到当前锚点的 ENU 系; process() 须已停止或空闲
+ */
+void saveReloMap()
+{
+    if (!relocalizer || !RELO_MAP_SAVE || RELO_MAP_PATH.empty())
+        return;
+    std::lock_guard<std::mutex> lock(m_estimator);
+    const Estimator &estimator = *estimator_ptr;
+    const bool anchored = estimator.gnss_ready;
+    const Eigen::Matrix3d R_enu_world(Eigen::AngleAxisd(estimator.yaw_enu_local, Eigen::Vector3d::UnitZ()));
+    relocalizer->saveMap(RELO_MAP_PATH, estimator.world_generation, anchored, R_enu_world,
+                         estimator.anc_ecef, estimator.R_ecef_enu);
 }
 
-int main(int argc, char **argv)
+/**
+ * @brief 创建估计器, 打开结果文件, 初始化时间同步状态; 不涉及 ROS 通信, 参数须已由 readParameters 读取
+ */
+void initEstimator()
 {
-    ros::init(argc, argv, "gvins");
-    ros::NodeHandle n("~");
-    ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME, ros::console::levels::Info);
-    readParameters(n);
     estimator_ptr.reset(new Estimator());
     estimator_ptr->setParameter();
+    if (WARM_START)
+        estimator_ptr->readCheckpointFile(CHECKPOINT_PATH);
+    if (RELOCALIZATION)
+    {
+        relocalizer.reset(new Relocalizer(RELO_MAX_KEYFRAMES, RELO_MIN_INLIERS, RELO_SKIP_RECENT));
+        if (!RELO_MAP_PATH.empty())
+            relocalizer->loadMap(RELO_MAP_PATH);
+        relocalizer->setDeterministic(DETERMINISTIC);
+        estimator_ptr->relocalizer = relocalizer.get();
+    }
 #ifdef EIGEN_DONT_PARALLELIZE
     ROS_DEBUG("EIGEN_DONT_PARALLELIZE");
 #endif
 
-    registerPub(n);
+    ResultLogger::instance().open(ResultLogger::VINS_RESULT, VINS_RESULT_PATH, RESULT_BINARY);
+    ResultLogger::instance().open(ResultLogger::FACTOR_GRAPH, FACTOR_GRAPH_RESULT_PATH, RESULT_BINARY);
+    if (GNSS_ENABLE)
+    {
+        ResultLogger::instance().open(ResultLogger::GNSS_RESULT, GNSS_RESULT_PATH, RESULT_BINARY);
+        if (!GNSS_RINEX_ARCHIVE_PATH.empty())
+            gnss_rinex_writer.reset(new RinexObsWriter(GNSS_RINEX_ARCHIVE_PATH));
+    }
 
     next_pulse_time_valid = false;
     time_diff_valid = false;
@@ -563,43 +1050,516 @@ int main(int argc, char **argv)
     else
         skip_parameter = 0;
 
-    ros::Subscriber sub_imu = n.subscribe(IMU_TOPIC, 2000, imu_callback, ros::TransportHints().tcpNoDelay());
-    ros::Subscriber sub_feature = n.subscribe("/gvins_feature_tracker/feature", 2000, feature_callback);
-    ros::Subscriber sub_restart = n.subscribe("/gvins_feature_tracker/restart", 2000, restart_callback);
+    // 没有在线同步时, 时间差直接取配置值
+    if (GNSS_ENABLE && !GNSS_LOCAL_ONLINE_SYNC)
+    {
+        time_diff_gnss_local = GNSS_LOCAL_TIME_DIFF;
+        estimator_ptr->inputGNSSTimeDiff(time_diff_gnss_local);
+        time_diff_valid = true;
+    }
+}
+
+/**
+ * @brief 创建估计器, 注册发布者和全部订阅, 独立节点和 nodelet 共用
+ * 
+ * @param n 私有命名空间的 NodeHandle, 参数须已由 readParameters 读取
+ * @return 订阅者, 调用者需要一直持有
+ */
+std::vector<ros::Subscriber> startEstimator(ros::NodeHandle &n)
+{
+    initEstimator();
+
+    registerPub(n);
+    pub_estimator_load = n.advertise<gvins_feature_tracker::EstimatorLoad>("estimator_load", 100);
+    if (PERFORMANCE_PROFILES.size() > 1)
+    {
+        pub_performance_profile = n.advertise<std_msgs::String>("performance_profile", 1, true);
+        std_msgs::String profile_msg;
+        profile_msg.data = PERFORMANCE_PROFILE;
+        pub_performance_profile.publish(profile_msg);
+        srv_performance_profile = n.advertiseService("set_performance_profile", set_performance_profile_callback);
+    }
+    StageProfiler::instance().setPeriod(DIAGNOSTICS_PERIOD);
+    if (DIAGNOSTICS_PERIOD > 0)
+        pub_diagnostics = n.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 10);
+    startVisualization();
+    odometry_output.start(ODOMETRY_RATE, ODOMETRY_MAX_EXTRAPOLATION,
+        [](const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, const Eigen::Vector3d &V, double stamp)
+        {
+            std_msgs::Header header;
+            header.stamp = ros::Time(stamp);
+            header.frame_id = "world";
+            pubLatestOdometry(P, Q, V, header);
+        });
+
+    std::vector<ros::Subscriber> subs;
+    subs.push_back(n.subscribe(IMU_TOPIC, 2000, imu_callback, ros::TransportHints().tcpNoDelay()));
+    if (COMPACT_FEATURE_MSG)
+        subs.push_back(n.subscribe("/gvins_feature_tracker/feature_tracks", 2000, feature_tracks_callback));
+    else
+        subs.push_back(n.subscribe("/gvins_feature_tracker/feature", 2000, feature_callback));
+    subs.push_back(n.subscribe("/gvins_feature_tracker/restart", 2000, restart_callback));
 
-    ros::Subscriber sub_ephem, sub_glo_ephem, sub_gnss_meas, sub_gnss_iono_params;
-    ros::Subscriber sub_gnss_time_pluse_info, sub_local_trigger_info;
-    
     // GNSS相关
     if (GNSS_ENABLE)
     {
-        // 1.订阅星历信息：卫星的位置、速度、时间偏差等信息
-        sub_ephem = n.subscribe(GNSS_EPHEM_TOPIC, 100, gnss_ephem_callback);                        //GPS, Galileo, BeiDou ephemeris
-        sub_glo_ephem = n.subscribe(GNSS_GLO_EPHEM_TOPIC, 100, gnss_glo_ephem_callback);            //GLONASS ephemeris
+        // 1.订阅星历信息：卫星的位置、速度、时间偏差等信息; 共享星历的读者从共享内存取, 不订阅星历和电离层话题
+        shared_ephem_reader = !GNSS_SHARED_EPHEM.empty() && !GNSS_SHARED_EPHEM_PUBLISH;
+        if (!GNSS_SHARED_EPHEM.empty() && GNSS_SHARED_EPHEM_PUBLISH)
+        {
+            shared_ephem = SharedEphemSegment::create(GNSS_SHARED_EPHEM);
+            if (shared_ephem)
+                ROS_INFO("publishing ephemerides to shared memory %s", GNSS_SHARED_EPHEM.c_str());
+        }
+        if (!shared_ephem_reader)
+        {
+            subs.push_back(n.subscribe(GNSS_EPHEM_TOPIC, 100, gnss_ephem_callback));                        //GPS, Galileo, BeiDou ephemeris
+            subs.push_back(n.subscribe(GNSS_GLO_EPHEM_TOPIC, 100, gnss_glo_ephem_callback));            //GLONASS ephemeris
+        }
 
         // 2.订阅卫星的观测信息
-        sub_gnss_meas = n.subscribe(GNSS_MEAS_TOPIC, 100, gnss_meas_callback);                      //GNSS raw measurement topic
+        subs.push_back(n.subscribe(GNSS_MEAS_TOPIC, 100, gnss_meas_callback));                      //GNSS raw measurement topic
         
         // 3.订阅电离层延时相关信息
-        sub_gnss_iono_params = n.subscribe(GNSS_IONO_PARAMS_TOPIC, 100, gnss_iono_params_callback); //GNSS broadcast ionospheric parameters
+        if (!shared_ephem_reader)
+            subs.push_back(n.subscribe(GNSS_IONO_PARAMS_TOPIC, 100, gnss_iono_params_callback)); //GNSS broadcast ionospheric parameters
 
         if (GNSS_LOCAL_ONLINE_SYNC)
         {
-            sub_gnss_time_pluse_info = n.subscribe(GNSS_TP_INFO_TOPIC, 100, 
-                gnss_tp_info_callback);
-            sub_local_trigger_info = n.subscribe(LOCAL_TRIGGER_INFO_TOPIC, 100, 
-                local_trigger_info_callback);
-        }
-        else
-        {
-            time_diff_gnss_local = GNSS_LOCAL_TIME_DIFF;
-            estimator_ptr->inputGNSSTimeDiff(time_diff_gnss_local);
-            time_diff_valid = true;
+            subs.push_back(n.subscribe(GNSS_TP_INFO_TOPIC, 100, 
+                gnss_tp_info_callback));
+            subs.push_back(n.subscribe(LOCAL_TRIGGER_INFO_TOPIC, 100, 
+                local_trigger_info_callback));
         }
     }
+    return subs;
+}
+
+#if !defined(GVINS_NODELET) && !defined(GVINS_OFFLINE)
+int main(int argc, char **argv)
+{
+    const std::vector<std::string> orig_args(argv, argv+argc);
+    ros::init(argc, argv, "gvins");
+    ros::NodeHandle n("~");
+    ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME, ros::console::levels::Info);
+    gvins_log::installRosLogSink();
+    readParameters(n);
+    if (CONFIG_WINDOW_SIZE != WINDOW_SIZE)
+    {
+        execWindowVariant(orig_args);
+        return 1;
+    }
+    std::vector<ros::Subscriber> subs = startEstimator(n);
 
     std::thread measurement_process{process};
     ros::spin();
+    saveReloMap();
+    gnss_rinex_writer.reset();      // writes out the buffered epochs
 
     return 0;
 }
+#elif defined(GVINS_NODELET)
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+namespace gvins
+{
+/**
+ * @brief 估计器 nodelet: 与 gvins_feature_tracker nodelet 放入同一个 manager 时,
+ *        特征消息以共享指针在进程内传递, 不经过序列化
+ */
+class EstimatorNodelet : public nodelet::Nodelet
+{
+  public:
+    ~EstimatorNodelet()
+    {
+        if (!measurement_process.joinable())
+            return;
+        process_running = false;
+        buf_notifier.wake();
+        measurement_process.join();
+        saveReloMap();
+        odometry_output.stop();
+        stopVisualization();
+        ResultLogger::instance().close();
+    }
+
+  private:
+    virtual void onInit()
+    {
+        ros::NodeHandle &n = getPrivateNodeHandle();
+        gvins_log::installRosLogSink();
+        readParameters(n);
+        // a nodelet cannot exec another binary, only the compiled window size is available
+        if (CONFIG_WINDOW_SIZE != WINDOW_SIZE)
+        {
+            NODELET_ERROR("window_size %d requested but this nodelet is built with %d, run the gvins node instead",
+                CONFIG_WINDOW_SIZE, WINDOW_SIZE);
+            return;
+        }
+        subs = startEstimator(n);
+        measurement_process = std::thread(process);
+    }
+
+    std::vector<ros::Subscriber> subs;
+    std::thread measurement_process;
+};
+}
+
+PLUGINLIB_EXPORT_CLASS(gvins::EstimatorNodelet, nodelet::Nodelet)
+#else
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <gvins_feature_tracker/offline_tracker.h>
+#include "utility/pipeline_stage.h"
+#include "utility/run_statistics.h"
+
+/**
+ * 离线批处理 (gvins_offline): 直接读取 bag, 不经过 ROS 通信, 处理速度只受 CPU 限制
+ * bag 以图像为界分段, 三级流水: 主线程读取并反序列化第 k+1 段, 跟踪级处理第 k 段的图像,
+ * 估计级按 bag 顺序把第 k-1 段的消息交给上面的回调, 再处理所有已就绪的帧;
+ * 每一级内部按顺序执行, 各回调看到的消息顺序与 bag 相同, 结果与流水线的时序无关
+ */
+struct BagSegment
+{
+    BagSegment() : track_ms(0) {}
+
+    std::vector<std::function<void()>> inputs;          // estimator callbacks of the messages before the image, in bag order
+    std::vector<sensor_msgs::ImuConstPtr> imu;          // gyroscope prior of the tracker
+    sensor_msgs::ImageConstPtr image;                   // null for the tail of the bag
+    sensor_msgs::CompressedImageConstPtr compressed_image;  // instead of image, with image_compressed
+    gvins_feature_tracker::OfflineTrackResult track;    // written by the tracking stage
+    double track_ms;
+};
+typedef std::shared_ptr<BagSegment> BagSegmentPtr;
+
+// --stats: 各阶段每帧的耗时和每帧结束时的最新位置, 跟踪级的样本在主线程, 其余在估计级中记录
+struct OfflineStats
+{
+    SampleSeries tracking, preintegration, gnss, estimate, solver, marginalization, publish;
+    std::vector<std::pair<double, Eigen::Vector3d>> trajectory;
+};
+
+template <typename MsgConstPtr>
+static void addBagInput(const rosbag::MessageInstance &m, BagSegment &segment, void (*callback)(const MsgConstPtr &))
+{
+    MsgConstPtr msg = m.instantiate<typename std::remove_const<typename MsgConstPtr::element_type>::type>();
+    if (msg)
+        segment.inputs.push_back([msg, callback]{ callback(msg); });
+}
+
+static void trackSegment(BagSegment &segment)
+{
+    GVINS_TRACE_ZONE("trackSegment");
+    for (const sensor_msgs::ImuConstPtr &imu_msg : segment.imu)
+        gvins_feature_tracker::offlineTrackerInputImu(imu_msg);
+    if (!segment.image && !segment.compressed_image)
+        return;
+    TicToc t_track;
+    if (segment.image)
+        segment.track = gvins_feature_tracker::offlineTrackImage(segment.image);
+    else
+        segment.track = gvins_feature_tracker::offlineTrackCompressedImage(segment.compressed_image);
+    segment.track_ms = t_track.toc();
+}
+
+// returns the number of frames processed
+static size_t estimateSegment(const BagSegment &segment, DeadlineMonitor &frame_deadline, OfflineStats &stats)
+{
+    GVINS_TRACE_ZONE("estimateSegment");
+    for (const std::function<void()> &input : segment.inputs)
+        input();
+    if (segment.track.restart)
+    {
+        std_msgs::BoolPtr restart_msg(new std_msgs::Bool);
+        restart_msg->data = true;
+        restart_callback(restart_msg);
+    }
+    if (segment.track.tracks)
+        feature_tracks_callback(segment.track.tracks);
+
+    size_t num_frames = 0;
+    while (true)
+    {
+        std::vector<sensor_msgs::ImuConstPtr> imu_msg;
+        FeatureFrameConstPtr img_msg;
+        std::vector<std::vector<ObsPtr>> gnss_msgs;
+        if (!getMeasurements(imu_msg, img_msg, gnss_msgs))
+            break;
+        processMeasurement(imu_msg, img_msg, gnss_msgs, frame_deadline);
+        num_frames++;
+
+        stats.preintegration.add(last_frame_timing.preintegration_ms);
+        if (!gnss_msgs.empty())
+            stats.gnss.add(last_frame_timing.gnss_ms);
+        stats.estimate.add(last_frame_timing.estimate_ms);
+        stats.publish.add(last_frame_timing.publish_ms);
+        if (estimator_ptr->solver_flag == Estimator::SolverFlag::NON_LINEAR)
+        {
+            stats.solver.add(estimator_ptr->solver_stats.solver_ms);
+            stats.marginalization.add(estimator_ptr->solver_stats.marginalization_ms);
+            stats.trajectory.emplace_back(estimator_ptr->Headers[WINDOW_SIZE].stamp.toSec(), estimator_ptr->Ps[WINDOW_SIZE]);
+        }
+    }
+    return num_frames;
+}
+
+static bool writeOfflineStats(const std::string &path, const std::string &config_file, const std::string &bag_file,
+                              const std::string &ground_truth_file, const OfflineStats &stats,
+                              size_t num_images, size_t num_frames, double data_s, double wall_s)
+{
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file)
+        return false;
+    fprintf(file, "{\n  \"config\": \"%s\",\n  \"bag\": \"%s\",\n", jsonEscape(config_file).c_str(), jsonEscape(bag_file).c_str());
+    fprintf(file, "  \"window_size\": %d,\n  \"images\": %zu,\n  \"frames\": %zu,\n  \"nonlinear_frames\": %zu,\n",
+            WINDOW_SIZE, num_images, num_frames, stats.trajectory.size());
+    fprintf(file, "  \"data_s\": %.3f,\n  \"wall_s\": %.3f,\n  \"realtime_factor\": %.3f,\n  \"peak_rss_kb\": %ld,\n",
+            data_s, wall_s, wall_s > 0 ? data_s / wall_s : 0.0, peakRssKb());
+
+    // ms per image (tracking) or per frame, solver and marginalization of the frames after the initialization;
+    // named as the stages of the online StageProfiler
+    const std::pair<StageProfiler::Stage, const SampleSeries *> stages[] = {
+        {StageProfiler::TRACKING, &stats.tracking}, {StageProfiler::PREINTEGRATION, &stats.preintegration},
+        {StageProfiler::GNSS, &stats.gnss}, {StageProfiler::ESTIMATE, &stats.estimate},
+        {StageProfiler::SOLVER, &stats.solver}, {StageProfiler::MARGINALIZATION, &stats.marginalization},
+        {StageProfiler::PUBLISH, &stats.publish}};
+    fprintf(file, "  \"stages_ms\": {\n");
+    for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); ++i)
+    {
+        fprintf(file, "    ");
+        writeJsonSummary(file, StageProfiler::stageName(stages[i].first), *stages[i].second);
+        fprintf(file, i + 1 < sizeof(stages) / sizeof(stages[0]) ? ",\n" : "\n");
+    }
+    fprintf(file, "  },\n");
+
+    if (ground_truth_file.empty())
+        fprintf(file, "  \"accuracy\": null\n");
+    else
+    {
+        const TrajectoryError error = compareTrajectory(stats.trajectory, ground_truth_file, 0.2);
+        fprintf(file, "  \"accuracy\": {\"ground_truth\": \"%s\", \"matched\": %zu, \"ate_rmse\": %.4f, "
+                      "\"ate_mean\": %.4f, \"ate_max\": %.4f}\n",
+                jsonEscape(ground_truth_file).c_str(), error.num_matched, error.rmse, error.mean, error.max);
+        if (error.num_matched == 0)
+            ROS_WARN("no estimate could be compared with %s", ground_truth_file.c_str());
+    }
+    fprintf(file, "}\n");
+    return fclose(file) == 0;
+}
+
+static void printOfflineUsage()
+{
+    std::cerr << "usage: gvins_offline <config_file> <bag> [--gvins_folder <dir>] [--output <dir>] [--feature_topic <topic>]\n"
+                 "                     [--start <s>] [--duration <s>] [--deterministic] [--stats <json>] [--ground_truth <csv>]\n"
+                 "  --output         result directory instead of output_dir of the config\n"
+                 "  --feature_topic  feature tracks (PointCloud or FeatureTracks) recorded in the bag, e.g. by the\n"
+                 "                   simulator, are used instead of tracking the images\n"
+                 "  --start          skip the first <s> seconds of the bag\n"
+                 "  --duration       process <s> seconds only\n"
+                 "  --deterministic  bit-identical runs, as deterministic: 1 of the config: solves bounded by\n"
+                 "                   max_num_iterations only, one ceres thread, fixed marginalization reductions\n"
+                 "  --stats          per-stage timing distributions, peak memory and accuracy as JSON\n"
+                 "  --ground_truth   \"t, x, y, z\" per line, the ATE of the estimated positions goes to --stats\n";
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> positional;
+    std::string gvins_folder, output_dir, feature_topic, stats_file, ground_truth_file;
+    double start_offset = 0, duration = -1;
+    bool deterministic = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg(argv[i]);
+        if (arg == "--gvins_folder" && i + 1 < argc)
+            gvins_folder = argv[++i];
+        else if (arg == "--output" && i + 1 < argc)
+            output_dir = argv[++i];
+        else if (arg == "--feature_topic" && i + 1 < argc)
+            feature_topic = argv[++i];
+        else if (arg == "--start" && i + 1 < argc)
+            start_offset = std::atof(argv[++i]);
+        else if (arg == "--duration" && i + 1 < argc)
+            duration = std::atof(argv[++i]);
+        else if (arg == "--deterministic")
+            deterministic = true;
+        else if (arg == "--stats" && i + 1 < argc)
+            stats_file = argv[++i];
+        else if (arg == "--ground_truth" && i + 1 < argc)
+            ground_truth_file = argv[++i];
+        else if (arg.compare(0, 2, "--") == 0)
+        {
+            printOfflineUsage();
+            return 1;
+        }
+        else
+            positional.push_back(arg);
+    }
+    if (positional.size() != 2)
+    {
+        printOfflineUsage();
+        return 1;
+    }
+    const std::string &config_file = positional[0];
+    const std::string &bag_file = positional[1];
+
+    // wall clock only, there is no ROS master
+    ros::Time::init();
+    ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME, ros::console::levels::Info);
+    gvins_log::installRosLogSink();
+    readParameters(config_file, output_dir);
+    if (CONFIG_WINDOW_SIZE != WINDOW_SIZE)
+    {
+        ROS_ERROR("window_size %d requested but gvins_offline is built with %d", CONFIG_WINDOW_SIZE, WINDOW_SIZE);
+        return 1;
+    }
+    // frame admission and the latency target follow the wall-clock backlog, offline every frame is processed in full
+    ADMISSION_MAX_LATENCY = 0;
+    LATENCY_TARGET = 0;
+    if (deterministic)
+        applyDeterministicMode(PROCESS_CONFIG);
+
+    std::string image_topic;
+    if (feature_topic.empty())
+        image_topic = gvins_feature_tracker::offlineTrackerInit(config_file, gvins_folder);
+    initEstimator();
+    registerOfflinePub();
+
+    rosbag::Bag bag;
+    try
+    {
+        bag.open(bag_file, rosbag::bagmode::Read);
+    }
+    catch (const rosbag::BagException &e)
+    {
+        ROS_ERROR("cannot open %s: %s", bag_file.c_str(), e.what());
+        return 1;
+    }
+
+    std::vector<std::string> topics = {feature_topic.empty() ? image_topic : feature_topic, IMU_TOPIC};
+    if (GNSS_ENABLE)
+    {
+        topics.insert(topics.end(), {GNSS_EPHEM_TOPIC, GNSS_GLO_EPHEM_TOPIC, GNSS_MEAS_TOPIC, GNSS_IONO_PARAMS_TOPIC});
+        if (GNSS_LOCAL_ONLINE_SYNC)
+            topics.insert(topics.end(), {GNSS_TP_INFO_TOPIC, LOCAL_TRIGGER_INFO_TOPIC});
+    }
+    rosbag::View full_view(bag);
+    if (full_view.size() == 0)
+    {
+        ROS_ERROR("%s is empty", bag_file.c_str());
+        return 1;
+    }
+    const ros::Time begin_time = full_view.getBeginTime() + ros::Duration(start_offset);
+    const ros::Time end_time = (duration > 0 ? begin_time + ros::Duration(duration) : ros::TIME_MAX);
+    rosbag::View view(bag, rosbag::TopicQuery(topics), begin_time, end_time);
+
+    PipelineStage tracking_stage, estimation_stage;
+    tracking_stage.submit([]{ GVINS_TRACE_THREAD("tracking stage"); });
+    estimation_stage.submit([]{ GVINS_TRACE_THREAD("estimation stage"); });
+    DeadlineMonitor frame_deadline("process", PROCESS_THREAD.deadline_ms);
+    size_t num_images = 0, num_frames = 0;
+    double sum_track_ms = 0, sum_estimate_ms = 0;
+    OfflineStats stats;
+    BagSegmentPtr tracked;      // segment on the tracking stage, estimated next
+
+    // hands the tracked segment on to the estimation stage and starts tracking the next one
+    auto dispatch = [&](const BagSegmentPtr &next)
+    {
+        tracking_stage.wait();
+        if (tracked)
+        {
+            sum_track_ms += tracked->track_ms;
+            if (tracked->image || tracked->compressed_image)
+                stats.tracking.add(tracked->track_ms);
+            BagSegmentPtr segment = tracked;
+            estimation_stage.submit([segment, &frame_deadline, &num_frames, &sum_estimate_ms, &stats]
+            {
+                TicToc t_estimate;
+                num_frames += estimateSegment(*segment, frame_deadline, stats);
+                sum_estimate_ms += t_estimate.toc();
+            });
+        }
+        tracked = next;
+        if (next)
+            tracking_stage.submit([next]{ trackSegment(*next); });
+    };
+
+    TicToc t_wall;
+    BagSegmentPtr segment(new BagSegment());
+    for (const rosbag::MessageInstance &m : view)
+    {
+        const std::string &topic = m.getTopic();
+        if (topic == image_topic)
+        {
+            segment->image = m.instantiate<sensor_msgs::Image>();
+            if (!segment->image)
+                segment->compressed_image = m.instantiate<sensor_msgs::CompressedImage>();
+            if (!segment->image && !segment->compressed_image)
+                continue;
+            num_images++;
+            dispatch(segment);
+            segment.reset(new BagSegment());
+        }
+        else if (topic == feature_topic)
+        {
+            // already tracked, passes the tracking stage untouched
+            gvins_feature_tracker::FeatureTracksConstPtr tracks_msg = m.instantiate<gvins_feature_tracker::FeatureTracks>();
+            sensor_msgs::PointCloudConstPtr feature_msg = m.instantiate<sensor_msgs::PointCloud>();
+            if (tracks_msg)
+                segment->inputs.push_back([tracks_msg]{ feature_tracks_callback(tracks_msg); });
+            else if (feature_msg)
+                segment->inputs.push_back([feature_msg]{ feature_callback(feature_msg); });
+            else
+                continue;
+            num_images++;
+            dispatch(segment);
+            segment.reset(new BagSegment());
+        }
+        else if (topic == IMU_TOPIC)
+        {
+            sensor_msgs::ImuConstPtr imu_msg = m.instantiate<sensor_msgs::Imu>();
+            if (!imu_msg)
+                continue;
+            if (feature_topic.empty())
+                segment->imu.push_back(imu_msg);
+            segment->inputs.push_back([imu_msg]{ imu_callback(imu_msg); });
+        }
+        else if (topic == GNSS_EPHEM_TOPIC)
+            addBagInput(m, *segment, gnss_ephem_callback);
+        else if (topic == GNSS_GLO_EPHEM_TOPIC)
+            addBagInput(m, *segment, gnss_glo_ephem_callback);
+        else if (topic == GNSS_MEAS_TOPIC)
+            addBagInput(m, *segment, gnss_meas_callback);
+        else if (topic == GNSS_IONO_PARAMS_TOPIC)
+            addBagInput(m, *segment, gnss_iono_params_callback);
+        else if (topic == GNSS_TP_INFO_TOPIC)
+            addBagInput(m, *segment, gnss_tp_info_callback);
+        else if (topic == LOCAL_TRIGGER_INFO_TOPIC)
+            addBagInput(m, *segment, local_trigger_info_callback);
+    }
+    // the messages after the last image, then drain both stages
+    dispatch(segment);
+    dispatch(nullptr);
+    estimation_stage.wait();
+    const double wall_s = t_wall.toc() / 1000.0;
+
+    saveReloMap();
+    gnss_rinex_writer.reset();
+    ResultLogger::instance().close();
+    bag.close();
+
+    const double data_s = (view.size() > 0 ? (view.getEndTime() - view.getBeginTime()).toSec() : 0.0);
+    printf("offline: %zu images, %zu frames estimated, %.1f s of data in %.1f s (%.1fx real time)\n",
+           num_images, num_frames, data_s, wall_s, wall_s > 0 ? data_s / wall_s : 0.0);
+    printf("offline: tracking %.2f ms per image, estimation %.2f ms per image\n",
+           num_images ? sum_track_ms / num_images : 0.0, num_images ? sum_estimate_ms / num_images : 0.0);
+    if (!stats_file.empty() && !writeOfflineStats(stats_file, config_file, bag_file, ground_truth_file, stats,
+                                                  num_images, num_frames, data_s, wall_s))
+    {
+        ROS_ERROR("cannot write %s", stats_file.c_str());
+        return 1;
+    }
+    return 0;
+}
+#endif
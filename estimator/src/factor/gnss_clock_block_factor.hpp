@@ -0,0 +1,114 @@
+#ifndef GNSS_CLOCK_BLOCK_FACTOR_H_
+#define GNSS_CLOCK_BLOCK_FACTOR_H_
+
+#include <utility>
+#include <vector>
+#include <Eigen/Dense>
+#include <ceres/ceres.h>
+
+#define RCV_CLOCK_DDT_IDX                   4
+
+/*
+**  把 Factor 中接收机钟差相关的 1 维参数块 (各系统的 rcv_dt 和 rcv_ddt) 映射到每个历元一个 5 维钟差块
+**  [dt_GPS, dt_GLO, dt_GAL, dt_BDS, ddt] 上, 其余参数块原样透传, Factor 本身不需要修改.
+**  5 维钟差块放在 Factor 第一个钟差参数块的位置, 例如 GnssPsrDoppFactor 变为
+**
+**  parameters[0]: position and orientation at time k
+**  parameters[1]: velocity and acc/gyro bias at time k
+**  parameters[2]: position and orientation at time k+1
+**  parameters[3]: velocity and acc/gyro bias at time k+1
+**  parameters[4]: receiver clock [dt (m) of GPS/GLO/GAL/BDS, ddt (m/s)]
+**  parameters[5]: yaw difference between ENU and local coordinate (rad)
+**  parameters[6]: anchor point's ECEF coordinate
+**
+**  加入 ceres::Problem 之前须 setClockComponents
+ */
+template <typename Factor>
+class GnssClockBlockFactor : public ceres::CostFunction
+{
+    public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        template <typename... Args>
+        explicit GnssClockBlockFactor(Args &&... args) : factor(std::forward<Args>(args)...), clock_block(-1) {}
+
+        // clock component of each parameter block of Factor, -1 passes the block through
+        void setClockComponents(const std::vector<int> &components)
+        {
+            const std::vector<int32_t> &factor_sizes = factor.parameter_block_sizes();
+            clock_components = components;
+            outer_blocks.clear();
+            clock_block = -1;
+            std::vector<int32_t> *sizes = mutable_parameter_block_sizes();
+            sizes->clear();
+            for (size_t b = 0; b < factor_sizes.size(); ++b)
+            {
+                if (clock_components[b] >= 0 && clock_block >= 0)
+                {
+                    outer_blocks.push_back(clock_block);
+                    continue;
+                }
+                if (clock_components[b] >= 0)
+                {
+                    clock_block = static_cast<int>(sizes->size());
+                    sizes->push_back(RCV_CLOCK_DDT_IDX + 1);
+                }
+                else
+                    sizes->push_back(factor_sizes[b]);
+                outer_blocks.push_back(static_cast<int>(sizes->size()) - 1);
+            }
+            set_num_residuals(factor.num_residuals());
+        }
+
+        Factor &inner() { return factor; }
+
+        virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
+        {
+            const size_t num_blocks = clock_components.size();
+            const int num_res = num_residuals();
+            const bool clock_jacobian = (jacobians && jacobians[clock_block]);
+            std::vector<const double *> factor_parameters(num_blocks);
+            std::vector<double *> factor_jacobians(num_blocks, nullptr);
+            // column of each clock component, num_res values per 1-D block of Factor
+            std::vector<double> clock_columns(clock_jacobian ? num_blocks * num_res : 0);
+            for (size_t b = 0; b < num_blocks; ++b)
+            {
+                const int outer = outer_blocks[b];
+                if (clock_components[b] < 0)
+                {
+                    factor_parameters[b] = parameters[outer];
+                    if (jacobians)
+                        factor_jacobians[b] = jacobians[outer];
+                }
+                else
+                {
+                    factor_parameters[b] = parameters[outer] + clock_components[b];
+                    if (clock_jacobian)
+                        factor_jacobians[b] = clock_columns.data() + b * num_res;
+                }
+            }
+            if (!factor.Evaluate(factor_parameters.data(), residuals, jacobians ? factor_jacobians.data() : nullptr))
+                return false;
+
+            if (clock_jacobian)
+            {
+                Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, RCV_CLOCK_DDT_IDX + 1, Eigen::RowMajor>> 
+                    jacobian_clock(jacobians[clock_block], num_res, RCV_CLOCK_DDT_IDX + 1);
+                jacobian_clock.setZero();
+                for (size_t b = 0; b < num_blocks; ++b)
+                {
+                    if (clock_components[b] >= 0)
+                        jacobian_clock.col(clock_components[b]) += 
+                            Eigen::Map<const Eigen::VectorXd>(clock_columns.data() + b * num_res, num_res);
+                }
+            }
+            return true;
+        }
+
+    private:
+        Factor factor;
+        std::vector<int> clock_components;
+        std::vector<int> outer_blocks;      // parameter block of this factor for each block of Factor
+        int clock_block;
+};
+
+#endif
@@ -0,0 +1,175 @@
+#include "gnss_epoch_factor.hpp"
+#include "gnss_receiver_state.hpp"
+
+GnssEpochFactor::GnssEpochFactor(const std::vector<ObsPtr> &_obs, const std::vector<EphemBasePtr> &_ephems,
+    const std::vector<SatStatePtr> &_sat_states, std::vector<double> &_iono_paras, const double _ratio)
+        : iono_paras(_iono_paras), ratio(_ratio)
+{
+    LOG_IF(FATAL, _obs.empty() || _obs.size() != _ephems.size() || _obs.size() != _sat_states.size()) 
+        << "Invalid epoch observations.";
+    obs_time = _obs.front()->time;
+
+    sats.resize(_obs.size());
+    for (size_t k = 0; k < _obs.size(); ++k)
+    {
+        SatInfo &sat = sats[k];
+        sat.obs = _obs[k];
+        const double freq = L1_freq(sat.obs, &sat.freq_idx);
+        LOG_IF(FATAL, freq < 0) << "No L1 observation found.";
+        sat.wavelength = LIGHT_SPEED / freq;
+
+        const uint32_t sys = satsys(sat.obs->sat, NULL);
+        sat.sv_pos = _sat_states[k]->pos;
+        sat.sv_vel = _sat_states[k]->vel;
+        sat.svdt = _sat_states[k]->dt;
+        sat.svddt = _sat_states[k]->ddt;
+        sat.tgd = _sat_states[k]->tgd;
+
+        // identical to GnssPsrDoppFactor
+        const double pr_std_ratio = sat.obs->psr_std[sat.freq_idx] / 0.16;
+        const double dp_std_ratio = sat.obs->dopp_std[sat.freq_idx] / 0.256;
+        if (sys == SYS_GLO)
+        {
+            sat.pr_uura = 2.0 * pr_std_ratio;
+            sat.dp_uura = 2.0 * dp_std_ratio;
+        }
+        else
+        {
+            EphemPtr eph = std::dynamic_pointer_cast<Ephem>(_ephems[k]);
+            const double ura_offset = (sys == SYS_GAL ? 2.0 : 1.0);
+            sat.pr_uura = (eph->ura - ura_offset) * pr_std_ratio;
+            sat.dp_uura = (eph->ura - ura_offset) * dp_std_ratio;
+        }
+        LOG_IF(FATAL, sat.pr_uura <= 0) << "pr_uura is " << sat.pr_uura;
+        LOG_IF(FATAL, sat.dp_uura <= 0) << "dp_uura is " << sat.dp_uura;
+
+        // one rcv_dt parameter block per constellation present in this epoch
+        const uint32_t sys_idx = gnss_comm::sys2idx.at(sys);
+        uint32_t slot = 0;
+        while (slot < sys_idx_list.size() && sys_idx_list[slot] != sys_idx)
+            ++slot;
+        if (slot == sys_idx_list.size())
+            sys_idx_list.push_back(sys_idx);
+        sat.dt_slot = slot;
+    }
+    relative_sqrt_info = 10.0;
+
+    set_num_residuals(static_cast<int>(2 * sats.size()));
+    std::vector<int> *block_sizes = mutable_parameter_block_sizes();
+    *block_sizes = std::vector<int>{7, 9, 7, 9, 1, 1, 3};
+    block_sizes->insert(block_sizes->end(), sys_idx_list.size(), 1);
+}
+
+bool GnssEpochFactor::Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
+{
+    const int num_res = num_residuals();
+    double rcv_ddt = parameters[4][0];
+
+    // receiver side, shared by all satellites of the epoch
+    const GnssReceiverState &rcv = gnssReceiverState(parameters[0], parameters[1], parameters[2], 
+        parameters[3], ratio, parameters[5][0], parameters[6]);
+    const Eigen::Matrix3d &R_ecef_local = rcv.R_ecef_local;
+    const Eigen::Vector3d &P_ecef = rcv.P_ecef;
+    const Eigen::Vector3d &V_ecef = rcv.V_ecef;
+
+    if (jacobians)
+    {
+        for (size_t b = 0; b < 7 + sys_idx_list.size(); ++b)
+        {
+            if (jacobians[b])
+                std::fill(jacobians[b], jacobians[b] + num_res * parameter_block_sizes()[b], 0.0);
+        }
+    }
+
+    for (size_t k = 0; k < sats.size(); ++k)
+    {
+        const SatInfo &sat = sats[k];
+        const double rcv_dt = parameters[7+sat.dt_slot][0];
+        const int r_psr = static_cast<int>(2*k), r_dopp = r_psr + 1;
+
+        Eigen::Vector3d rcv2sat_ecef = sat.sv_pos - P_ecef;
+        const double rcv2sat_norm = rcv2sat_ecef.norm();
+        Eigen::Vector3d rcv2sat_unit = rcv2sat_ecef / rcv2sat_norm;
+
+        double ion_delay = 0, tro_delay = 0;
+        double azel[2] = {0, M_PI/2.0};
+        if (rcv.valid)
+        {
+            gnssSatAzel(rcv, rcv2sat_unit, azel);
+            gnssAtmosDelay(rcv, sat.obs->sat, obs_time, azel, iono_paras, ion_delay, tro_delay);
+        }
+        double sin_el = sin(azel[1]);
+        double sin_el_2 = sin_el*sin_el;
+        double pr_weight = sin_el_2 / sat.pr_uura * relative_sqrt_info;
+        double dp_weight = sin_el_2 / sat.dp_uura * relative_sqrt_info * PSR_TO_DOPP_RATIO;
+
+        const double psr_sagnac = EARTH_OMG_GPS*(sat.sv_pos(0)*P_ecef(1)-sat.sv_pos(1)*P_ecef(0))/LIGHT_SPEED;
+        double psr_estimated = rcv2sat_norm + psr_sagnac + rcv_dt - sat.svdt*LIGHT_SPEED +
+                                    ion_delay + tro_delay + sat.tgd*LIGHT_SPEED;
+        residuals[r_psr] = (psr_estimated - sat.obs->psr[sat.freq_idx]) * pr_weight;
+
+        const Eigen::Vector3d rel_vel = sat.sv_vel - V_ecef;
+        const double dopp_sagnac = EARTH_OMG_GPS/LIGHT_SPEED*(sat.sv_vel(0)*P_ecef(1)+
+                sat.sv_pos(0)*V_ecef(1) - sat.sv_vel(1)*P_ecef(0) - sat.sv_pos(1)*V_ecef(0));
+        double dopp_estimated = rel_vel.dot(rcv2sat_unit) + dopp_sagnac + rcv_ddt - sat.svddt*LIGHT_SPEED;
+        residuals[r_dopp] = (dopp_estimated + sat.obs->dopp[sat.freq_idx]*sat.wavelength) * dp_weight;
+
+        if (!jacobians)
+            continue;
+
+        // d(unit vector)/d(receiver position) = -(I - u*u^T) / |r|
+        const Eigen::RowVector3d psr_pos_row = -rcv2sat_unit.transpose() * R_ecef_local * pr_weight;
+        const Eigen::RowVector3d dopp_pos_row = -(rel_vel - rcv2sat_unit*rcv2sat_unit.dot(rel_vel)).transpose() /
+            rcv2sat_norm * R_ecef_local * dp_weight;
+        const Eigen::RowVector3d dopp_vel_row = -rcv2sat_unit.transpose() * R_ecef_local * dp_weight;
+
+        // J_Pi, J_Pj
+        if (jacobians[0])
+        {
+            Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 7, Eigen::RowMajor>> J_Pi(jacobians[0], num_res, 7);
+            J_Pi.block<1, 3>(r_psr, 0) = psr_pos_row * ratio;
+            J_Pi.block<1, 3>(r_dopp, 0) = dopp_pos_row * ratio;
+        }
+        if (jacobians[2])
+        {
+            Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 7, Eigen::RowMajor>> J_Pj(jacobians[2], num_res, 7);
+            J_Pj.block<1, 3>(r_psr, 0) = psr_pos_row * (1.0-ratio);
+            J_Pj.block<1, 3>(r_dopp, 0) = dopp_pos_row * (1.0-ratio);
+        }
+
+        // J_Vi, J_Vj
+        if (jacobians[1])
+        {
+            Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 9, Eigen::RowMajor>> J_Vi(jacobians[1], num_res, 9);
+            J_Vi.block<1, 3>(r_dopp, 0) = dopp_vel_row * ratio;
+        }
+        if (jacobians[3])
+        {
+            Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 9, Eigen::RowMajor>> J_Vj(jacobians[3], num_res, 9);
+            J_Vj.block<1, 3>(r_dopp, 0) = dopp_vel_row * (1.0-ratio);
+        }
+
+        // J_rcv_ddt
+        if (jacobians[4])
+            jacobians[4][r_dopp] = 1.0 * dp_weight;
+
+        // J_yaw_diff
+        if (jacobians[5])
+        {
+            jacobians[5][r_psr] = -rcv2sat_unit.dot(rcv.yaw_pos) * pr_weight;
+            jacobians[5][r_dopp] = -rcv2sat_unit.dot(rcv.yaw_vel) * dp_weight;
+        }
+
+        // J_ref_ecef, approximation for simplicity
+        if (jacobians[6])
+        {
+            Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 3, Eigen::RowMajor>> J_ref_ecef(jacobians[6], num_res, 3);
+            J_ref_ecef.row(r_psr) = -rcv2sat_unit.transpose() * pr_weight;
+        }
+
+        // J_rcv_dt
+        if (jacobians[7+sat.dt_slot])
+            jacobians[7+sat.dt_slot][r_psr] = 1.0 * pr_weight;
+    }
+    return true;
+}
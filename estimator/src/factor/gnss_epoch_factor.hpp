@@ -0,0 +1,65 @@
+#ifndef GNSS_EPOCH_FACTOR_H_
+#define GNSS_EPOCH_FACTOR_H_
+
+#include <vector>
+#include <Eigen/Dense>
+#include <ceres/ceres.h>
+
+#include <gnss_comm/gnss_constant.hpp>
+#include <gnss_comm/gnss_utility.hpp>
+
+#include "gnss_psr_dopp_factor.hpp"
+
+using namespace gnss_comm;
+
+/*
+**  同一 GNSS 历元内所有卫星的伪距/多普勒残差合并为一个代价函数, 接收机端的量 (插值位姿,
+**  ENU 旋转, ecef2geo) 每个历元只算一次. 残差按卫星依次排列 [psr_0, dopp_0, psr_1, dopp_1, ...]
+**
+**  parameters[0]: position and orientation at time k
+**  parameters[1]: velocity and acc/gyro bias at time k
+**  parameters[2]: position and orientation at time k+1
+**  parameters[3]: velocity and acc/gyro bias at time k+1
+**  parameters[4]: receiver clock bias change rate in clock bias light travelling distance per second (m/s)
+**  parameters[5]: yaw difference between ENU and local coordinate (rad)
+**  parameters[6]: anchor point's ECEF coordinate
+**  parameters[7+s]: receiver clock bias (m) of constellation sys_indices()[s]
+**
+ */
+class GnssEpochFactor : public ceres::CostFunction
+{
+    public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        GnssEpochFactor() = delete;
+        // all observations must share the same receive time, i.e. the same interpolation ratio.
+        // _sat_states holds the cached sat_states() output of each observation
+        GnssEpochFactor(const std::vector<ObsPtr> &_obs, const std::vector<EphemBasePtr> &_ephems,
+            const std::vector<SatStatePtr> &_sat_states, std::vector<double> &_iono_paras, const double _ratio);
+        virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const;
+
+        // constellation index (gnss_comm::sys2idx) of each rcv_dt parameter block, starting at parameters[7]
+        const std::vector<uint32_t> &sys_indices() const { return sys_idx_list; }
+        size_t num_sats() const { return sats.size(); }
+
+    private:
+        struct SatInfo
+        {
+            ObsPtr obs;
+            int freq_idx;
+            double wavelength;
+            Eigen::Vector3d sv_pos;
+            Eigen::Vector3d sv_vel;
+            double svdt, svddt, tgd;
+            double pr_uura, dp_uura;
+            uint32_t dt_slot;
+        };
+
+        std::vector<SatInfo> sats;
+        std::vector<uint32_t> sys_idx_list;
+        const std::vector<double> &iono_paras;
+        gtime_t obs_time;
+        double ratio;
+        double relative_sqrt_info;
+};
+
+#endif
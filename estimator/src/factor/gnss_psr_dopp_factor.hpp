@@ -30,6 +30,9 @@ class GnssPsrDoppFactor : public ceres::SizedCostFunction<2, 7, 9, 7, 9, 1, 1, 1
         GnssPsrDoppFactor() = delete;
         GnssPsrDoppFactor(const ObsPtr &_obs, const EphemBasePtr &_ephem, std::vector<double> &_iono_paras, 
             const double _ratio);
+        // _sat_state is the cached output of sat_states() for this observation
+        GnssPsrDoppFactor(const ObsPtr &_obs, const EphemBasePtr &_ephem, const SatStatePtr &_sat_state, 
+            std::vector<double> &_iono_paras, const double _ratio);
         virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const;
         bool check_gradients(const std::vector<const double*> &parameters) const;
     private:
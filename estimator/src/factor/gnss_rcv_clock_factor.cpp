@@ -0,0 +1,45 @@
+#include "gnss_rcv_clock_factor.hpp"
+
+RcvClockFactor::RcvClockFactor(const double delta_t_, const double ddt_weight_) 
+    : delta_t(delta_t_), ddt_weight(ddt_weight_), dt_info_coeff(50) {}
+
+bool RcvClockFactor::Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
+{
+    const double *clock_i = parameters[0];
+    const double *clock_j = parameters[1];
+    const double rev_ddt_i = clock_i[RCV_CLOCK_DDT_IDX];
+    const double rev_ddt_j = clock_j[RCV_CLOCK_DDT_IDX];
+
+    const double average_ddt = 0.5 * (rev_ddt_i + rev_ddt_j);
+    for (int k = 0; k < RCV_CLOCK_DDT_IDX; ++k)
+        residuals[k] = (clock_j[k] - clock_i[k] - average_ddt * delta_t) * dt_info_coeff;
+    residuals[RCV_CLOCK_DDT_IDX] = (rev_ddt_i - rev_ddt_j) * ddt_weight;
+
+    if (jacobians)
+    {
+        if (jacobians[0])
+        {
+            Eigen::Map<Eigen::Matrix<double, 5, 5, Eigen::RowMajor>> J_clock_i(jacobians[0]);
+            J_clock_i.setZero();
+            for (int k = 0; k < RCV_CLOCK_DDT_IDX; ++k)
+            {
+                J_clock_i(k, k) = -dt_info_coeff;
+                J_clock_i(k, RCV_CLOCK_DDT_IDX) = -0.5 * delta_t * dt_info_coeff;
+            }
+            J_clock_i(RCV_CLOCK_DDT_IDX, RCV_CLOCK_DDT_IDX) = ddt_weight;
+        }
+        if (jacobians[1])
+        {
+            Eigen::Map<Eigen::Matrix<double, 5, 5, Eigen::RowMajor>> J_clock_j(jacobians[1]);
+            J_clock_j.setZero();
+            for (int k = 0; k < RCV_CLOCK_DDT_IDX; ++k)
+            {
+                J_clock_j(k, k) = dt_info_coeff;
+                J_clock_j(k, RCV_CLOCK_DDT_IDX) = -0.5 * delta_t * dt_info_coeff;
+            }
+            J_clock_j(RCV_CLOCK_DDT_IDX, RCV_CLOCK_DDT_IDX) = -ddt_weight;
+        }
+    }
+
+    return true;
+}
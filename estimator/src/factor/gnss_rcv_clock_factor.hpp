@@ -0,0 +1,29 @@
+#ifndef GNSS_RCV_CLOCK_FACTOR_H_
+#define GNSS_RCV_CLOCK_FACTOR_H_
+
+#include <Eigen/Dense>
+#include <ceres/ceres.h>
+
+#include "gnss_clock_block_factor.hpp"
+
+/*
+**  相邻两个历元 5 维钟差块之间的约束, 等价于 4 个 DtDdtFactor 加 1 个 DdtSmoothFactor:
+**  residuals[k], k < 4: (dt_j - dt_i - 0.5 * (ddt_i + ddt_j) * delta_t) * dt_info_coeff
+**  residuals[4]:        (ddt_i - ddt_j) * ddt_weight
+**
+**  parameters[0]: receiver clock (t)   [dt (m) of GPS/GLO/GAL/BDS, ddt (m/s)]
+**  parameters[1]: receiver clock (t+1)
+ */
+class RcvClockFactor : public ceres::SizedCostFunction<5, 5, 5>
+{
+    public: 
+        RcvClockFactor() = delete;
+        RcvClockFactor(const double delta_t_, const double ddt_weight_);
+        virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const;
+    private:
+        double delta_t;
+        double ddt_weight;
+        double dt_info_coeff;
+};
+
+#endif
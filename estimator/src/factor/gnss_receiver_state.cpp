@@ -0,0 +1,188 @@
+#include "gnss_receiver_state.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <unordered_map>
+
+namespace
+{
+    // position/velocity of both frames, ratio, yaw difference and anchor
+    const int RCV_KEY_SIZE = 3 + 3 + 3 + 3 + 1 + 1 + 3;
+    // factors of a few epochs may be evaluated interleaved
+    const int RCV_CACHE_SIZE = 4;
+
+    struct ReceiverCache
+    {
+        struct Entry
+        {
+            double key[RCV_KEY_SIZE];
+            GnssReceiverState state;
+        };
+        Entry entries[RCV_CACHE_SIZE];
+        int num_entries = 0;
+        int next_entry = 0;
+    };
+
+    // epochs which left the window are never looked up again, the table is dropped once it is this large
+    const size_t ATMOS_CACHE_MAX_ENTRIES = 8192;
+    // lookups counted locally before they are added to the shared totals
+    const uint32_t ATMOS_STATS_BATCH = 256;
+
+    struct AtmosCache
+    {
+        struct Entry
+        {
+            Eigen::Vector3d P_ecef;     // receiver position the delays were computed at
+            double ion_delay, tro_delay;
+        };
+        std::unordered_map<int64_t, Entry> entries;
+        std::vector<double> iono_paras;
+        uint32_t hits = 0, misses = 0;
+    };
+
+    std::atomic<double> atmos_cache_thres(0.0);
+    std::atomic<uint64_t> atmos_cache_hits(0), atmos_cache_misses(0);
+
+    void flushAtmosStats(AtmosCache &cache)
+    {
+        atmos_cache_hits.fetch_add(cache.hits, std::memory_order_relaxed);
+        atmos_cache_misses.fetch_add(cache.misses, std::memory_order_relaxed);
+        cache.hits = cache.misses = 0;
+    }
+
+    void computeReceiverState(const double *key, GnssReceiverState &rcv)
+    {
+        const Eigen::Vector3d Pi(key[0], key[1], key[2]);
+        const Eigen::Vector3d Vi(key[3], key[4], key[5]);
+        const Eigen::Vector3d Pj(key[6], key[7], key[8]);
+        const Eigen::Vector3d Vj(key[9], key[10], key[11]);
+        const double ratio = key[12];
+        const double yaw_diff = key[13];
+        const Eigen::Vector3d ref_ecef(key[14], key[15], key[16]);
+
+        rcv.local_pos = ratio*Pi + (1.0-ratio)*Pj;
+        rcv.local_vel = ratio*Vi + (1.0-ratio)*Vj;
+
+        const double sin_yaw_diff = std::sin(yaw_diff);
+        const double cos_yaw_diff = std::cos(yaw_diff);
+        Eigen::Matrix3d R_enu_local;
+        R_enu_local << cos_yaw_diff, -sin_yaw_diff, 0,
+                       sin_yaw_diff,  cos_yaw_diff, 0,
+                       0           ,  0           , 1;
+        rcv.R_ecef_enu = ecef2rotation(ref_ecef);
+        rcv.R_ecef_local = rcv.R_ecef_enu * R_enu_local;
+
+        rcv.P_ecef = rcv.R_ecef_local * rcv.local_pos + ref_ecef;
+        rcv.V_ecef = rcv.R_ecef_local * rcv.local_vel;
+
+        rcv.valid = (rcv.P_ecef.norm() > 0);
+        rcv.rcv_lla.setZero();
+        rcv.R_rcv_enu_ecef.setIdentity();
+        if (rcv.valid)
+        {
+            rcv.rcv_lla = ecef2geo(rcv.P_ecef);
+            rcv.R_rcv_enu_ecef = geo2rotation(rcv.rcv_lla).transpose();
+        }
+
+        Eigen::Matrix3d d_yaw;
+        d_yaw << -sin_yaw_diff, -cos_yaw_diff, 0,
+                  cos_yaw_diff, -sin_yaw_diff, 0,
+                  0           ,  0           , 0;
+        rcv.yaw_pos = rcv.R_ecef_enu * d_yaw * rcv.local_pos;
+        rcv.yaw_vel = rcv.R_ecef_enu * d_yaw * rcv.local_vel;
+    }
+}
+
+const GnssReceiverState &gnssReceiverState(const double *pose_i, const double *speed_bias_i, 
+    const double *pose_j, const double *speed_bias_j, double ratio, double yaw_diff, const double *ref_ecef)
+{
+    double key[RCV_KEY_SIZE];
+    std::copy(pose_i, pose_i + 3, key);
+    std::copy(speed_bias_i, speed_bias_i + 3, key + 3);
+    std::copy(pose_j, pose_j + 3, key + 6);
+    std::copy(speed_bias_j, speed_bias_j + 3, key + 9);
+    key[12] = ratio;
+    key[13] = yaw_diff;
+    std::copy(ref_ecef, ref_ecef + 3, key + 14);
+
+    thread_local ReceiverCache cache;
+    for (int e = 0; e < cache.num_entries; ++e)
+    {
+        if (std::equal(key, key + RCV_KEY_SIZE, cache.entries[e].key))
+            return cache.entries[e].state;
+    }
+
+    ReceiverCache::Entry &entry = cache.entries[cache.next_entry];
+    cache.next_entry = (cache.next_entry + 1) % RCV_CACHE_SIZE;
+    cache.num_entries = std::min(cache.num_entries + 1, RCV_CACHE_SIZE);
+    std::copy(key, key + RCV_KEY_SIZE, entry.key);
+    computeReceiverState(key, entry.state);
+    return entry.state;
+}
+
+void gnssSatAzel(const GnssReceiverState &rcv, const Eigen::Vector3d &rcv2sat_unit, double *azel)
+{
+    const Eigen::Vector3d rcv2sat_enu = rcv.R_rcv_enu_ecef * rcv2sat_unit;
+    azel[0] = rcv2sat_unit.head<2>().norm() < 1e-12 ? 0.0 : atan2(rcv2sat_enu.x(), rcv2sat_enu.y());
+    azel[0] += (azel[0] < 0 ? 2*M_PI : 0);
+    azel[1] = asin(rcv2sat_enu.z());
+}
+
+void gnssAtmosDelay(const GnssReceiverState &rcv, uint32_t sat, const gtime_t &time, const double *azel, 
+    const std::vector<double> &iono_paras, double &ion_delay, double &tro_delay)
+{
+    const double thres = atmos_cache_thres.load(std::memory_order_relaxed);
+    if (thres <= 0)
+    {
+        tro_delay = calculate_trop_delay(time, rcv.rcv_lla, azel);
+        ion_delay = calculate_ion_delay(time, iono_paras, rcv.rcv_lla, azel);
+        return;
+    }
+
+    thread_local AtmosCache cache;
+    if (cache.iono_paras != iono_paras)
+    {
+        cache.entries.clear();
+        cache.iono_paras = iono_paras;
+    }
+    else if (cache.entries.size() >= ATMOS_CACHE_MAX_ENTRIES)
+    {
+        cache.entries.clear();
+    }
+
+    // epoch in milliseconds and satellite number
+    const int64_t key = static_cast<int64_t>(std::llround(time2sec(time) * 1e3)) * (MAX_SAT + 1) + sat;
+    auto it = cache.entries.find(key);
+    if (it != cache.entries.end() && (it->second.P_ecef - rcv.P_ecef).norm() <= thres)
+    {
+        ++cache.hits;
+    }
+    else
+    {
+        ++cache.misses;
+        if (it == cache.entries.end())
+            it = cache.entries.emplace(key, AtmosCache::Entry()).first;
+        it->second.P_ecef = rcv.P_ecef;
+        it->second.tro_delay = calculate_trop_delay(time, rcv.rcv_lla, azel);
+        it->second.ion_delay = calculate_ion_delay(time, iono_paras, rcv.rcv_lla, azel);
+    }
+    ion_delay = it->second.ion_delay;
+    tro_delay = it->second.tro_delay;
+
+    if (cache.hits + cache.misses >= ATMOS_STATS_BATCH)
+        flushAtmosStats(cache);
+}
+
+void setGnssAtmosCacheThres(double thres)
+{
+    atmos_cache_thres.store(std::max(thres, 0.0), std::memory_order_relaxed);
+}
+
+GnssAtmosCacheStats takeGnssAtmosCacheStats()
+{
+    GnssAtmosCacheStats stats;
+    stats.hits = atmos_cache_hits.exchange(0, std::memory_order_relaxed);
+    stats.misses = atmos_cache_misses.exchange(0, std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,58 @@
+#ifndef GNSS_RECEIVER_STATE_H_
+#define GNSS_RECEIVER_STATE_H_
+
+#include <cstdint>
+#include <vector>
+#include <Eigen/Dense>
+
+#include <gnss_comm/gnss_constant.hpp>
+#include <gnss_comm/gnss_utility.hpp>
+
+using namespace gnss_comm;
+
+/*
+**  GNSS 残差中只与接收机有关的量: 插值后的局部位置/速度, ENU 旋转, ECEF 下的位置/速度, ecef2geo 等.
+**  同一历元的所有卫星在一次 ceres 评估中参数完全相同, 按参数块的值缓存, 每个历元每次迭代只算一次.
+**  缓存是线程局部的, ceres 多线程评估时各线程互不影响; 对流层/电离层延迟依赖各卫星的仰角, 仍按卫星计算
+ */
+struct GnssReceiverState
+{
+    Eigen::Vector3d local_pos, local_vel;
+    Eigen::Matrix3d R_ecef_enu, R_ecef_local;
+    Eigen::Vector3d P_ecef, V_ecef;
+    bool valid;                         // P_ecef is not the earth center, rcv_lla and R_rcv_enu_ecef are set
+    Eigen::Vector3d rcv_lla;
+    Eigen::Matrix3d R_rcv_enu_ecef;
+    Eigen::Vector3d yaw_pos, yaw_vel;   // derivatives of P_ecef and V_ecef w.r.t. the yaw difference
+};
+
+/*
+**  pose_i/speed_bias_i/pose_j/speed_bias_j/yaw_diff/ref_ecef are the parameter blocks of GnssPsrDoppFactor,
+**  ratio interpolates between frame i and j. The reference stays valid until the next call on this thread
+ */
+const GnssReceiverState &gnssReceiverState(const double *pose_i, const double *speed_bias_i, 
+    const double *pose_j, const double *speed_bias_j, double ratio, double yaw_diff, const double *ref_ecef);
+
+// same as sat_azel() without recomputing ecef2geo per satellite
+void gnssSatAzel(const GnssReceiverState &rcv, const Eigen::Vector3d &rcv2sat_unit, double *azel);
+
+/*
+**  电离层 (Klobuchar) 和对流层 (Saastamoinen) 延迟, 按 (卫星, 历元) 缓存.
+**  接收机位置相对计算时的位置变化不超过阈值时直接复用, 否则重新计算; 阈值为 0 时不缓存.
+**  缓存是线程局部的, 广播电离层参数变化时清空
+ */
+void gnssAtmosDelay(const GnssReceiverState &rcv, uint32_t sat, const gtime_t &time, const double *azel, 
+    const std::vector<double> &iono_paras, double &ion_delay, double &tro_delay);
+
+// receiver displacement (m) before the cached delays of a satellite are recomputed, 0 disables the cache
+void setGnssAtmosCacheThres(double thres);
+
+struct GnssAtmosCacheStats
+{
+    uint64_t hits;
+    uint64_t misses;
+};
+// totals over all threads since the last call, counts of running threads are added in batches
+GnssAtmosCacheStats takeGnssAtmosCacheStats();
+
+#endif
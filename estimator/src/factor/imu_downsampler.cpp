@@ -0,0 +1,67 @@
+#include "imu_downsampler.h"
+
+ImuDownsampler::ImuDownsampler() : interval(0)
+{
+    reset();
+}
+
+void ImuDownsampler::setInterval(double _interval)
+{
+    interval = _interval;
+    reset();
+}
+
+void ImuDownsampler::reset()
+{
+    sum_dt = 0;
+    num_samples = 0;
+    alpha.setZero();
+    beta.setZero();
+    upsilon.setZero();
+    sculling.setZero();
+    last_dtheta.setZero();
+    last_dv.setZero();
+}
+
+bool ImuDownsampler::add(double dt, const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
+                         const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr)
+{
+    const Eigen::Vector3d dtheta = 0.5 * (_gyr_0 + gyr) * dt;
+    const Eigen::Vector3d dv = 0.5 * (_acc_0 + acc) * dt;
+
+    // the previous increment is zero for the first sample of an interval
+    const Eigen::Vector3d alpha_c = alpha + last_dtheta / 6.0;
+    const Eigen::Vector3d upsilon_c = upsilon + last_dv / 6.0;
+    beta += 0.5 * alpha_c.cross(dtheta);
+    sculling += 0.5 * (alpha_c.cross(dv) + upsilon_c.cross(dtheta));
+    alpha += dtheta;
+    upsilon += dv;
+    last_dtheta = dtheta;
+    last_dv = dv;
+
+    sum_dt += dt;
+    num_samples++;
+    // half a sample early, the intervals do not drift by one sample against the rate
+    return sum_dt >= interval - 0.5 * dt;
+}
+
+bool ImuDownsampler::flush(double &dt, Eigen::Vector3d &acc, Eigen::Vector3d &gyr, int &_num_samples)
+{
+    if (num_samples == 0 || sum_dt <= 0)
+    {
+        reset();
+        return false;
+    }
+    // rotation vector and velocity increment in the body frame at the start of the interval
+    const Eigen::Vector3d phi = alpha + beta;
+    const Eigen::Vector3d delta_v = upsilon + 0.5 * alpha.cross(upsilon) + sculling;
+
+    // constant rates reproducing them: a constant specific force rotated by the constant rate
+    // integrates to (I + [phi]x / 2) * acc * dt to first order
+    dt = sum_dt;
+    gyr = phi / dt;
+    acc = (delta_v - 0.5 * phi.cross(delta_v)) / dt;
+    _num_samples = num_samples;
+    reset();
+    return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <Eigen/Dense>
+
+/**
+ * 高频 IMU 降采样: 把连续的原始采样合并为一个区间, 预积分每个区间只做一次协方差/雅可比传播
+ * 区间内的角增量/速度增量按中点积分累加, 并做圆锥 (coning) 和划桨 (sculling) 补偿 (Savage 的两子样递推),
+ * 输出区间内等效的常值角速度/比力, 以常值区间的方式输入 IntegrationBase::push_back (噪声按采样数缩放)
+ * 补偿在原始测量上计算, 不含零偏, 零偏变化的影响由预积分的一阶雅可比修正
+ */
+class ImuDownsampler
+{
+  public:
+    ImuDownsampler();
+
+    // s, 0 disables the downsampling
+    void setInterval(double _interval);
+    bool enabled() const { return interval > 0; }
+    void reset();
+
+    /**
+     * 一个原始采样, _acc_0/_gyr_0 是上一个采样
+     * @return true when the samples added since the last flush span the interval
+     */
+    bool add(double dt, const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
+             const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr);
+
+    /**
+     * 取出合并后的区间并清空, 没有采样时返回 false
+     * @param acc, gyr  equivalent constant specific force and angular rate over dt
+     */
+    bool flush(double &dt, Eigen::Vector3d &acc, Eigen::Vector3d &gyr, int &_num_samples);
+
+  private:
+    double interval;
+
+    double sum_dt;
+    int num_samples;
+    Eigen::Vector3d alpha, beta;        // summed angle increments, coning
+    Eigen::Vector3d upsilon, sculling;  // summed velocity increments, sculling
+    Eigen::Vector3d last_dtheta, last_dv;
+};
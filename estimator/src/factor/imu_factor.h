@@ -1,5 +1,5 @@
 #pragma once
-#include <ros/assert.h>
+#include <gvins_feature_tracker/log.h>
 #include <iostream>
 #include <eigen3/Eigen/Dense>
 
@@ -78,9 +78,9 @@ class IMUFactor : public ceres::SizedCostFunction<15, 7, 9, 7, 9>
 
             if (pre_integration->jacobian.maxCoeff() > 1e8 || pre_integration->jacobian.minCoeff() < -1e8)
             {
-                ROS_WARN("numerical unstable in preintegration");
+                GVINS_WARN("numerical unstable in preintegration");
                 //std::cout << pre_integration->jacobian << std::endl;
-///                ROS_BREAK();
+///                GVINS_BREAK();
             }
 
             if (jacobians[0])
@@ -89,7 +89,7 @@ class IMUFactor : public ceres::SizedCostFunction<15, 7, 9, 7, 9>
                 jacobian_pose_i.setZero();
 
                 jacobian_pose_i.block<3, 3>(O_P, O_P) = -Qi.inverse().toRotationMatrix();
-                jacobian_pose_i.block<3, 3>(O_P, O_R) = Utility::skewSymmetric(Qi.inverse() * (0.5 * G * sum_dt * sum_dt + Pj - Pi - Vi * sum_dt));
+                jacobian_pose_i.block<3, 3>(O_P, O_R) = Utility::skewSymmetric(Qi.inverse() * (0.5 * pre_integration->gravity * sum_dt * sum_dt + Pj - Pi - Vi * sum_dt));
 
 #if 0
             jacobian_pose_i.block<3, 3>(O_R, O_R) = -(Qj.inverse() * Qi).toRotationMatrix();
@@ -98,15 +98,15 @@ class IMUFactor : public ceres::SizedCostFunction<15, 7, 9, 7, 9>
                 jacobian_pose_i.block<3, 3>(O_R, O_R) = -(Utility::Qleft(Qj.inverse() * Qi) * Utility::Qright(corrected_delta_q)).bottomRightCorner<3, 3>();
 #endif
 
-                jacobian_pose_i.block<3, 3>(O_V, O_R) = Utility::skewSymmetric(Qi.inverse() * (G * sum_dt + Vj - Vi));
+                jacobian_pose_i.block<3, 3>(O_V, O_R) = Utility::skewSymmetric(Qi.inverse() * (pre_integration->gravity * sum_dt + Vj - Vi));
 
                 jacobian_pose_i = sqrt_info * jacobian_pose_i;
 
                 if (jacobian_pose_i.maxCoeff() > 1e8 || jacobian_pose_i.minCoeff() < -1e8)
                 {
-                    ROS_WARN("numerical unstable in preintegration");
+                    GVINS_WARN("numerical unstable in preintegration");
                     //std::cout << sqrt_info << std::endl;
-                    //ROS_BREAK();
+                    //GVINS_BREAK();
                 }
             }
             if (jacobians[1])
@@ -135,8 +135,8 @@ class IMUFactor : public ceres::SizedCostFunction<15, 7, 9, 7, 9>
 
                 jacobian_speedbias_i = sqrt_info * jacobian_speedbias_i;
 
-                //ROS_ASSERT(fabs(jacobian_speedbias_i.maxCoeff()) < 1e8);
-                //ROS_ASSERT(fabs(jacobian_speedbias_i.minCoeff()) < 1e8);
+                //GVINS_ASSERT(fabs(jacobian_speedbias_i.maxCoeff()) < 1e8);
+                //GVINS_ASSERT(fabs(jacobian_speedbias_i.minCoeff()) < 1e8);
             }
             if (jacobians[2])
             {
@@ -154,8 +154,8 @@ class IMUFactor : public ceres::SizedCostFunction<15, 7, 9, 7, 9>
 
                 jacobian_pose_j = sqrt_info * jacobian_pose_j;
 
-                //ROS_ASSERT(fabs(jacobian_pose_j.maxCoeff()) < 1e8);
-                //ROS_ASSERT(fabs(jacobian_pose_j.minCoeff()) < 1e8);
+                //GVINS_ASSERT(fabs(jacobian_pose_j.maxCoeff()) < 1e8);
+                //GVINS_ASSERT(fabs(jacobian_pose_j.minCoeff()) < 1e8);
             }
             if (jacobians[3])
             {
@@ -170,8 +170,8 @@ class IMUFactor : public ceres::SizedCostFunction<15, 7, 9, 7, 9>
 
                 jacobian_speedbias_j = sqrt_info * jacobian_speedbias_j;
 
-                //ROS_ASSERT(fabs(jacobian_speedbias_j.maxCoeff()) < 1e8);
-                //ROS_ASSERT(fabs(jacobian_speedbias_j.minCoeff()) < 1e8);
+                //GVINS_ASSERT(fabs(jacobian_speedbias_j.maxCoeff()) < 1e8);
+                //GVINS_ASSERT(fabs(jacobian_speedbias_j.minCoeff()) < 1e8);
             }
         }
 
@@ -10,29 +10,59 @@ class IntegrationBase
 {
   public:
     IntegrationBase() = delete;
+    // the noise densities and gravity are taken from config
     IntegrationBase(const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
-                    const Eigen::Vector3d &_linearized_ba, const Eigen::Vector3d &_linearized_bg)
+                    const Eigen::Vector3d &_linearized_ba, const Eigen::Vector3d &_linearized_bg,
+                    const EstimatorConfig &config = PROCESS_CONFIG)
         : acc_0{_acc_0}, gyr_0{_gyr_0}, linearized_acc{_acc_0}, linearized_gyr{_gyr_0},
           linearized_ba{_linearized_ba}, linearized_bg{_linearized_bg},
             jacobian{Eigen::Matrix<double, 15, 15>::Identity()}, covariance{Eigen::Matrix<double, 15, 15>::Zero()},
-          sum_dt{0.0}, delta_p{Eigen::Vector3d::Zero()}, delta_q{Eigen::Quaterniond::Identity()}, delta_v{Eigen::Vector3d::Zero()}
+          sum_dt{0.0}, delta_p{Eigen::Vector3d::Zero()}, delta_q{Eigen::Quaterniond::Identity()}, delta_v{Eigen::Vector3d::Zero()},
+          dense_jacobian{false}, noise_scale{1.0}, acc_n{config.ACC_N}, acc_w{config.ACC_W}, gyr_n{config.GYR_N}, gyr_w{config.GYR_W},
+          gravity{config.G}
 
     {
         noise = Eigen::Matrix<double, 18, 18>::Zero();
-        noise.block<3, 3>(0, 0) =  (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(3, 3) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(6, 6) =  (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(9, 9) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(12, 12) =  (ACC_W * ACC_W) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(15, 15) =  (GYR_W * GYR_W) * Eigen::Matrix3d::Identity();
+        noise.block<3, 3>(0, 0) =  (acc_n * acc_n) * Eigen::Matrix3d::Identity();
+        noise.block<3, 3>(3, 3) =  (gyr_n * gyr_n) * Eigen::Matrix3d::Identity();
+        noise.block<3, 3>(6, 6) =  (acc_n * acc_n) * Eigen::Matrix3d::Identity();
+        noise.block<3, 3>(9, 9) =  (gyr_n * gyr_n) * Eigen::Matrix3d::Identity();
+        noise.block<3, 3>(12, 12) =  (acc_w * acc_w) * Eigen::Matrix3d::Identity();
+        noise.block<3, 3>(15, 15) =  (gyr_w * gyr_w) * Eigen::Matrix3d::Identity();
     }
 
-    void push_back(double dt, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr)
+    // 滑窗时复用已有对象, 等价于重新构造, 但保留 dt_buf/acc_buf/gyr_buf 已分配的容量
+    void reset(const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
+               const Eigen::Vector3d &_linearized_ba, const Eigen::Vector3d &_linearized_bg)
+    {
+        acc_0 = linearized_acc = _acc_0;
+        gyr_0 = linearized_gyr = _gyr_0;
+        linearized_ba = _linearized_ba;
+        linearized_bg = _linearized_bg;
+        jacobian.setIdentity();
+        covariance.setZero();
+        sum_dt = 0.0;
+        delta_p.setZero();
+        delta_q.setIdentity();
+        delta_v.setZero();
+        dt_buf.clear();
+        acc_buf.clear();
+        gyr_buf.clear();
+        samples_buf.clear();
+    }
+
+    /**
+     * num_samples 为 0 时 acc/gyr 是一个原始采样, 与上一个采样取中点积分;
+     * 大于 0 时是 ImuDownsampler 合并 num_samples 个原始采样得到的区间, acc/gyr 为区间内的等效常值,
+     * 每步注入的噪声方差按 1/num_samples 缩放, 与逐个积分这些原始采样的协方差一致
+     */
+    void push_back(double dt, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr, int num_samples = 0)
     {
         dt_buf.push_back(dt);
         acc_buf.push_back(acc);
         gyr_buf.push_back(gyr);
-        propagate(dt, acc, gyr);
+        samples_buf.push_back(num_samples);
+        propagate(dt, acc, gyr, num_samples);
     }
 
     void repropagate(const Eigen::Vector3d &_linearized_ba, const Eigen::Vector3d &_linearized_bg)
@@ -48,7 +78,7 @@ class IntegrationBase
         jacobian.setIdentity();
         covariance.setZero();
         for (int i = 0; i < static_cast<int>(dt_buf.size()); i++)
-            propagate(dt_buf[i], acc_buf[i], gyr_buf[i]);
+            propagate(dt_buf[i], acc_buf[i], gyr_buf[i], samples_buf[i]);
     }
 
     void midPointIntegration(double _dt, 
@@ -59,7 +89,7 @@ class IntegrationBase
                             Eigen::Vector3d &result_delta_p, Eigen::Quaterniond &result_delta_q, Eigen::Vector3d &result_delta_v,
                             Eigen::Vector3d &result_linearized_ba, Eigen::Vector3d &result_linearized_bg, bool update_jacobian)
     {
-        //ROS_INFO("midpoint integration");
+        //GVINS_INFO("midpoint integration");
         Vector3d un_acc_0 = delta_q * (_acc_0 - linearized_ba);
         Vector3d un_gyr = 0.5 * (_gyr_0 + _gyr_1) - linearized_bg;
         result_delta_q = delta_q * Quaterniond(1, un_gyr(0) * _dt / 2, un_gyr(1) * _dt / 2, un_gyr(2) * _dt / 2);
@@ -72,63 +102,156 @@ class IntegrationBase
 
         if(update_jacobian)
         {
-            Vector3d w_x = 0.5 * (_gyr_0 + _gyr_1) - linearized_bg;
-            Vector3d a_0_x = _acc_0 - linearized_ba;
-            Vector3d a_1_x = _acc_1 - linearized_ba;
-            Matrix3d R_w_x, R_a_0_x, R_a_1_x;
+            if (dense_jacobian)
+                denseJacobianUpdate(_dt, _acc_0, _gyr_0, _acc_1, _gyr_1, delta_q, result_delta_q, 
+                                    linearized_ba, linearized_bg);
+            else
+                sparseJacobianUpdate(_dt, _acc_0, _gyr_0, _acc_1, _gyr_1, delta_q, result_delta_q, 
+                                     linearized_ba, linearized_bg);
+        }
 
-            R_w_x<<0, -w_x(2), w_x(1),
-                w_x(2), 0, -w_x(0),
-                -w_x(1), w_x(0), 0;
-            R_a_0_x<<0, -a_0_x(2), a_0_x(1),
-                a_0_x(2), 0, -a_0_x(0),
-                -a_0_x(1), a_0_x(0), 0;
-            R_a_1_x<<0, -a_1_x(2), a_1_x(1),
-                a_1_x(2), 0, -a_1_x(0),
-                -a_1_x(1), a_1_x(0), 0;
-
-            MatrixXd F = MatrixXd::Zero(15, 15);
-            F.block<3, 3>(0, 0) = Matrix3d::Identity();
-            F.block<3, 3>(0, 3) = -0.25 * delta_q.toRotationMatrix() * R_a_0_x * _dt * _dt + 
-                                  -0.25 * result_delta_q.toRotationMatrix() * R_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt * _dt;
-            F.block<3, 3>(0, 6) = MatrixXd::Identity(3,3) * _dt;
-            F.block<3, 3>(0, 9) = -0.25 * (delta_q.toRotationMatrix() + result_delta_q.toRotationMatrix()) * _dt * _dt;
-            F.block<3, 3>(0, 12) = -0.25 * result_delta_q.toRotationMatrix() * R_a_1_x * _dt * _dt * -_dt;
-            F.block<3, 3>(3, 3) = Matrix3d::Identity() - R_w_x * _dt;
-            F.block<3, 3>(3, 12) = -1.0 * MatrixXd::Identity(3,3) * _dt;
-            F.block<3, 3>(6, 3) = -0.5 * delta_q.toRotationMatrix() * R_a_0_x * _dt + 
-                                  -0.5 * result_delta_q.toRotationMatrix() * R_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt;
-            F.block<3, 3>(6, 6) = Matrix3d::Identity();
-            F.block<3, 3>(6, 9) = -0.5 * (delta_q.toRotationMatrix() + result_delta_q.toRotationMatrix()) * _dt;
-            F.block<3, 3>(6, 12) = -0.5 * result_delta_q.toRotationMatrix() * R_a_1_x * _dt * -_dt;
-            F.block<3, 3>(9, 9) = Matrix3d::Identity();
-            F.block<3, 3>(12, 12) = Matrix3d::Identity();
-            //cout<<"A"<<endl<<A<<endl;
+    }
 
-            MatrixXd V = MatrixXd::Zero(15,18);
-            V.block<3, 3>(0, 0) =  0.25 * delta_q.toRotationMatrix() * _dt * _dt;
-            V.block<3, 3>(0, 3) =  0.25 * -result_delta_q.toRotationMatrix() * R_a_1_x  * _dt * _dt * 0.5 * _dt;
-            V.block<3, 3>(0, 6) =  0.25 * result_delta_q.toRotationMatrix() * _dt * _dt;
-            V.block<3, 3>(0, 9) =  V.block<3, 3>(0, 3);
-            V.block<3, 3>(3, 3) =  0.5 * MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(3, 9) =  0.5 * MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(6, 0) =  0.5 * delta_q.toRotationMatrix() * _dt;
-            V.block<3, 3>(6, 3) =  0.5 * -result_delta_q.toRotationMatrix() * R_a_1_x  * _dt * 0.5 * _dt;
-            V.block<3, 3>(6, 6) =  0.5 * result_delta_q.toRotationMatrix() * _dt;
-            V.block<3, 3>(6, 9) =  V.block<3, 3>(6, 3);
-            V.block<3, 3>(9, 12) = MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(12, 15) = MatrixXd::Identity(3,3) * _dt;
-
-            //step_jacobian = F;
-            //step_V = V;
-            jacobian = F * jacobian;
-            covariance = F * covariance * F.transpose() + V * noise * V.transpose();
-        }
+    /**
+     * F 只有 P/R/V 三行块非平凡, BA/BG 两行为单位阵, 直接按块更新 jacobian = F * jacobian 和
+     * covariance = F * covariance * F^T + V * noise * V^T, 全部为定长矩阵, 不在堆上分配
+     */
+    void sparseJacobianUpdate(double _dt, 
+                              const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
+                              const Eigen::Vector3d &_acc_1, const Eigen::Vector3d &_gyr_1,
+                              const Eigen::Quaterniond &delta_q, const Eigen::Quaterniond &result_delta_q,
+                              const Eigen::Vector3d &linearized_ba, const Eigen::Vector3d &linearized_bg)
+    {
+        const Matrix3d R_w_x = Utility::skewSymmetric(0.5 * (_gyr_0 + _gyr_1) - linearized_bg);
+        const Matrix3d R_a_0_x = Utility::skewSymmetric(_acc_0 - linearized_ba);
+        const Matrix3d R_a_1_x = Utility::skewSymmetric(_acc_1 - linearized_ba);
+        const Matrix3d R_0 = delta_q.toRotationMatrix();
+        const Matrix3d R_1 = result_delta_q.toRotationMatrix();
+        const double dt2 = _dt * _dt;
+
+        const Matrix3d R_1_a_1_x = R_1 * R_a_1_x;
+        const Matrix3d F_rr = Matrix3d::Identity() - R_w_x * _dt;
+        const Matrix3d F_vr = -0.5 * R_0 * R_a_0_x * _dt - 0.5 * R_1_a_1_x * F_rr * _dt;
+        const Matrix3d F_vba = -0.5 * (R_0 + R_1) * _dt;
+        const Matrix3d F_vbg = 0.5 * R_1_a_1_x * dt2;
+        // the P row blocks are the V row blocks scaled by dt/2
+        const Matrix3d F_pr = 0.5 * _dt * F_vr;
+        const Matrix3d F_pba = 0.5 * _dt * F_vba;
+        const Matrix3d F_pbg = 0.5 * _dt * F_vbg;
+
+        auto applyF = [&](Eigen::Matrix<double, 15, 15> &X)
+        {
+            const Eigen::Matrix<double, 3, 15> X_r = X.block<3, 15>(O_R, 0);
+            const Eigen::Matrix<double, 3, 15> X_ba = X.block<3, 15>(O_BA, 0);
+            const Eigen::Matrix<double, 3, 15> X_bg = X.block<3, 15>(O_BG, 0);
+            X.block<3, 15>(O_P, 0).noalias() += F_pr * X_r + _dt * X.block<3, 15>(O_V, 0) + 
+                                               F_pba * X_ba + F_pbg * X_bg;
+            X.block<3, 15>(O_V, 0).noalias() += F_vr * X_r + F_vba * X_ba + F_vbg * X_bg;
+            X.block<3, 15>(O_R, 0) = F_rr * X_r - _dt * X_bg;
+        };
+
+        applyF(jacobian);
+        applyF(covariance);
+        covariance.transposeInPlace();
+        applyF(covariance);
+
+        // V * noise * V^T with the block diagonal noise of the constructor. The P rows of V are the
+        // V rows scaled by dt/2, so every block follows from the V-V and V-R blocks
+        const double q_a0 = noise_scale * noise(0, 0), q_g0 = noise_scale * noise(3, 3);
+        const double q_a1 = noise_scale * noise(6, 6), q_g1 = noise_scale * noise(9, 9);
+        const double q_g = q_g0 + q_g1;
+        const Matrix3d V_a0 = 0.5 * R_0 * _dt;
+        const Matrix3d V_a1 = 0.5 * R_1 * _dt;
+        const Matrix3d V_g = -0.25 * R_1_a_1_x * dt2;
+        const Matrix3d Q_vv = q_a0 * V_a0 * V_a0.transpose() + q_a1 * V_a1 * V_a1.transpose() + 
+                              q_g * V_g * V_g.transpose();
+        const Matrix3d Q_vr = 0.5 * _dt * q_g * V_g;
+        const double s = 0.5 * _dt;
+
+        covariance.block<3, 3>(O_P, O_P) += s * s * Q_vv;
+        covariance.block<3, 3>(O_P, O_V) += s * Q_vv;
+        covariance.block<3, 3>(O_V, O_P) += s * Q_vv;
+        covariance.block<3, 3>(O_V, O_V) += Q_vv;
+        covariance.block<3, 3>(O_P, O_R) += s * Q_vr;
+        covariance.block<3, 3>(O_R, O_P) += s * Q_vr.transpose();
+        covariance.block<3, 3>(O_V, O_R) += Q_vr;
+        covariance.block<3, 3>(O_R, O_V) += Q_vr.transpose();
+        covariance.block<3, 3>(O_R, O_R).diagonal().array() += 0.25 * dt2 * q_g;
+        covariance.block<3, 3>(O_BA, O_BA).diagonal().array() += noise_scale * dt2 * noise(12, 12);
+        covariance.block<3, 3>(O_BG, O_BG).diagonal().array() += noise_scale * dt2 * noise(15, 15);
+    }
 
+    // original dense implementation, kept as reference for the preintegration benchmark
+    void denseJacobianUpdate(double _dt, 
+                             const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
+                             const Eigen::Vector3d &_acc_1, const Eigen::Vector3d &_gyr_1,
+                             const Eigen::Quaterniond &delta_q, const Eigen::Quaterniond &result_delta_q,
+                             const Eigen::Vector3d &linearized_ba, const Eigen::Vector3d &linearized_bg)
+    {
+        Vector3d w_x = 0.5 * (_gyr_0 + _gyr_1) - linearized_bg;
+        Vector3d a_0_x = _acc_0 - linearized_ba;
+        Vector3d a_1_x = _acc_1 - linearized_ba;
+        Matrix3d R_w_x, R_a_0_x, R_a_1_x;
+
+        R_w_x<<0, -w_x(2), w_x(1),
+            w_x(2), 0, -w_x(0),
+            -w_x(1), w_x(0), 0;
+        R_a_0_x<<0, -a_0_x(2), a_0_x(1),
+            a_0_x(2), 0, -a_0_x(0),
+            -a_0_x(1), a_0_x(0), 0;
+        R_a_1_x<<0, -a_1_x(2), a_1_x(1),
+            a_1_x(2), 0, -a_1_x(0),
+            -a_1_x(1), a_1_x(0), 0;
+
+        MatrixXd F = MatrixXd::Zero(15, 15);
+        F.block<3, 3>(0, 0) = Matrix3d::Identity();
+        F.block<3, 3>(0, 3) = -0.25 * delta_q.toRotationMatrix() * R_a_0_x * _dt * _dt + 
+                              -0.25 * result_delta_q.toRotationMatrix() * R_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt * _dt;
+        F.block<3, 3>(0, 6) = MatrixXd::Identity(3,3) * _dt;
+        F.block<3, 3>(0, 9) = -0.25 * (delta_q.toRotationMatrix() + result_delta_q.toRotationMatrix()) * _dt * _dt;
+        F.block<3, 3>(0, 12) = -0.25 * result_delta_q.toRotationMatrix() * R_a_1_x * _dt * _dt * -_dt;
+        F.block<3, 3>(3, 3) = Matrix3d::Identity() - R_w_x * _dt;
+        F.block<3, 3>(3, 12) = -1.0 * MatrixXd::Identity(3,3) * _dt;
+        F.block<3, 3>(6, 3) = -0.5 * delta_q.toRotationMatrix() * R_a_0_x * _dt + 
+                              -0.5 * result_delta_q.toRotationMatrix() * R_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt;
+        F.block<3, 3>(6, 6) = Matrix3d::Identity();
+        F.block<3, 3>(6, 9) = -0.5 * (delta_q.toRotationMatrix() + result_delta_q.toRotationMatrix()) * _dt;
+        F.block<3, 3>(6, 12) = -0.5 * result_delta_q.toRotationMatrix() * R_a_1_x * _dt * -_dt;
+        F.block<3, 3>(9, 9) = Matrix3d::Identity();
+        F.block<3, 3>(12, 12) = Matrix3d::Identity();
+        //cout<<"A"<<endl<<A<<endl;
+
+        MatrixXd V = MatrixXd::Zero(15,18);
+        V.block<3, 3>(0, 0) =  0.25 * delta_q.toRotationMatrix() * _dt * _dt;
+        V.block<3, 3>(0, 3) =  0.25 * -result_delta_q.toRotationMatrix() * R_a_1_x  * _dt * _dt * 0.5 * _dt;
+        V.block<3, 3>(0, 6) =  0.25 * result_delta_q.toRotationMatrix() * _dt * _dt;
+        V.block<3, 3>(0, 9) =  V.block<3, 3>(0, 3);
+        V.block<3, 3>(3, 3) =  0.5 * MatrixXd::Identity(3,3) * _dt;
+        V.block<3, 3>(3, 9) =  0.5 * MatrixXd::Identity(3,3) * _dt;
+        V.block<3, 3>(6, 0) =  0.5 * delta_q.toRotationMatrix() * _dt;
+        V.block<3, 3>(6, 3) =  0.5 * -result_delta_q.toRotationMatrix() * R_a_1_x  * _dt * 0.5 * _dt;
+        V.block<3, 3>(6, 6) =  0.5 * result_delta_q.toRotationMatrix() * _dt;
+        V.block<3, 3>(6, 9) =  V.block<3, 3>(6, 3);
+        V.block<3, 3>(9, 12) = MatrixXd::Identity(3,3) * _dt;
+        V.block<3, 3>(12, 15) = MatrixXd::Identity(3,3) * _dt;
+
+        //step_jacobian = F;
+        //step_V = V;
+        jacobian = F * jacobian;
+        covariance = F * covariance * F.transpose() + noise_scale * V * noise * V.transpose();
     }
 
-    void propagate(double _dt, const Eigen::Vector3d &_acc_1, const Eigen::Vector3d &_gyr_1)
+    void propagate(double _dt, const Eigen::Vector3d &_acc_1, const Eigen::Vector3d &_gyr_1, int num_samples = 0)
     {
+        if (num_samples > 0)
+        {
+            // a constant interval, not the midpoint with the previous sample
+            acc_0 = _acc_1;
+            gyr_0 = _gyr_1;
+            noise_scale = 1.0 / num_samples;
+        }
+        else
+            noise_scale = 1.0;
         dt = _dt;
         acc_1 = _acc_1;
         gyr_1 = _gyr_1;
@@ -177,9 +300,9 @@ class IntegrationBase
         Eigen::Vector3d corrected_delta_v = delta_v + dv_dba * dba + dv_dbg * dbg;
         Eigen::Vector3d corrected_delta_p = delta_p + dp_dba * dba + dp_dbg * dbg;
 
-        residuals.block<3, 1>(O_P, 0) = Qi.inverse() * (0.5 * G * sum_dt * sum_dt + Pj - Pi - Vi * sum_dt) - corrected_delta_p;
+        residuals.block<3, 1>(O_P, 0) = Qi.inverse() * (0.5 * gravity * sum_dt * sum_dt + Pj - Pi - Vi * sum_dt) - corrected_delta_p;
         residuals.block<3, 1>(O_R, 0) = 2 * (corrected_delta_q.inverse() * (Qi.inverse() * Qj)).vec();
-        residuals.block<3, 1>(O_V, 0) = Qi.inverse() * (G * sum_dt + Vj - Vi) - corrected_delta_v;
+        residuals.block<3, 1>(O_V, 0) = Qi.inverse() * (gravity * sum_dt + Vj - Vi) - corrected_delta_v;
         residuals.block<3, 1>(O_BA, 0) = Baj - Bai;
         residuals.block<3, 1>(O_BG, 0) = Bgj - Bgi;
         return residuals;
@@ -189,7 +312,7 @@ class IntegrationBase
     Eigen::Vector3d acc_0, gyr_0;
     Eigen::Vector3d acc_1, gyr_1;
 
-    const Eigen::Vector3d linearized_acc, linearized_gyr;
+    Eigen::Vector3d linearized_acc, linearized_gyr;
     Eigen::Vector3d linearized_ba, linearized_bg;
 
     Eigen::Matrix<double, 15, 15> jacobian, covariance;
@@ -205,7 +328,15 @@ class IntegrationBase
     std::vector<double> dt_buf;
     std::vector<Eigen::Vector3d> acc_buf;
     std::vector<Eigen::Vector3d> gyr_buf;
+    std::vector<int> samples_buf;       // see push_back
+
+    // use denseJacobianUpdate instead of sparseJacobianUpdate, only for benchmarking
+    bool dense_jacobian;
+
+    double noise_scale;     // of the step being propagated
 
+    double acc_n, acc_w, gyr_n, gyr_w;
+    Eigen::Vector3d gravity;
 };
 /*
 
@@ -258,10 +389,10 @@ class IntegrationBase
 
             // put outside
             Eigen::Matrix<double, 12, 12> noise = Eigen::Matrix<double, 12, 12>::Zero();
-            noise.block<3, 3>(0, 0) =  (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
-            noise.block<3, 3>(3, 3) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
-            noise.block<3, 3>(6, 6) =  (ACC_W * ACC_W) * Eigen::Matrix3d::Identity();
-            noise.block<3, 3>(9, 9) =  (GYR_W * GYR_W) * Eigen::Matrix3d::Identity();
+            noise.block<3, 3>(0, 0) =  (acc_n * acc_n) * Eigen::Matrix3d::Identity();
+            noise.block<3, 3>(3, 3) =  (gyr_n * gyr_n) * Eigen::Matrix3d::Identity();
+            noise.block<3, 3>(6, 6) =  (acc_w * acc_w) * Eigen::Matrix3d::Identity();
+            noise.block<3, 3>(9, 9) =  (gyr_w * gyr_w) * Eigen::Matrix3d::Identity();
 
             //write F directly
             MatrixXd F, V;
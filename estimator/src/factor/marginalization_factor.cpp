@@ -1,20 +1,31 @@
 #include "marginalization_factor.h"
+#include <gvins_feature_tracker/trace_zones.h>
+#include "../utility/gpu_dense.h"
 
-void ResidualBlockInfo::Evaluate()
+size_t ResidualBlockInfo::bufferSize() const
 {
-    residuals.resize(cost_function->num_residuals());
-
-    std::vector<int> block_sizes = cost_function->parameter_block_sizes();
-    raw_jacobians = new double *[block_sizes.size()];
-    jacobians.resize(block_sizes.size());
+    const std::vector<int> &block_sizes = cost_function->parameter_block_sizes();
+    return static_cast<size_t>(cost_function->num_residuals()) * 
+        (1 + std::accumulate(block_sizes.begin(), block_sizes.end(), 0));
+}
 
+void ResidualBlockInfo::setBuffers(double *buffer, double **jacobian_ptrs)
+{
+    const int num_residuals = cost_function->num_residuals();
+    const std::vector<int> &block_sizes = cost_function->parameter_block_sizes();
+    residual_data = buffer;
+    raw_jacobians = jacobian_ptrs;
+    double *data = buffer + num_residuals;
     for (int i = 0; i < static_cast<int>(block_sizes.size()); i++)
     {
-        jacobians[i].resize(cost_function->num_residuals(), block_sizes[i]);
-        raw_jacobians[i] = jacobians[i].data();
-        //dim += block_sizes[i] == 7 ? 6 : block_sizes[i];
+        raw_jacobians[i] = data;
+        data += num_residuals * block_sizes[i];
     }
-    cost_function->Evaluate(parameter_blocks.data(), residuals.data(), raw_jacobians);
+}
+
+void ResidualBlockInfo::Evaluate()
+{
+    cost_function->Evaluate(parameter_blocks.data(), residual_data, raw_jacobians);
 
     //std::vector<int> tmp_idx(block_sizes.size());
     //Eigen::MatrixXd tmp(dim, dim);
@@ -32,7 +43,7 @@ void ResidualBlockInfo::Evaluate()
     //}
     //Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes(tmp);
     //std::cout << saes.eigenvalues() << std::endl;
-    //ROS_ASSERT(saes.eigenvalues().minCoeff() >= -1e-6);
+    //GVINS_ASSERT(saes.eigenvalues().minCoeff() >= -1e-6);
 
     if (loss_function)
     {
@@ -40,6 +51,7 @@ void ResidualBlockInfo::Evaluate()
 
         double sq_norm, rho[3];
 
+        Eigen::Map<Eigen::VectorXd> residuals = this->residuals();
         sq_norm = residuals.squaredNorm();
         loss_function->Evaluate(sq_norm, rho);
         //printf("sq_norm: %f, rho[0]: %f, rho[1]: %f, rho[2]: %f\n", sq_norm, rho[0], rho[1], rho[2]);
@@ -61,7 +73,8 @@ void ResidualBlockInfo::Evaluate()
 
         for (int i = 0; i < static_cast<int>(parameter_blocks.size()); i++)
         {
-            jacobians[i] = sqrt_rho1_ * (jacobians[i] - alpha_sq_norm_ * residuals * (residuals.transpose() * jacobians[i]));
+            Eigen::Map<JacobianMatrix> jacobian_i = jacobian(i);
+            jacobian_i = sqrt_rho1_ * (jacobian_i - alpha_sq_norm_ * residuals * (residuals.transpose() * jacobian_i));
         }
 
         residuals *= residual_scaling_;
@@ -70,20 +83,12 @@ void ResidualBlockInfo::Evaluate()
 
 MarginalizationInfo::~MarginalizationInfo()
 {
-    //ROS_WARN("release marginlizationinfo");
+    //GVINS_WARN("release marginlizationinfo");
     
     for (auto it = parameter_block_data.begin(); it != parameter_block_data.end(); ++it)
         delete[] it->second;
 
-    for (int i = 0; i < (int)factors.size(); i++)
-    {
-
-        delete[] factors[i]->raw_jacobians;
-        
-        delete factors[i]->cost_function;
-
-        delete factors[i];
-    }
+    // the factors and their evaluation buffers are released with the arena
 }
 
 void MarginalizationInfo::addResidualBlockInfo(ResidualBlockInfo *residual_block_info)
@@ -107,12 +112,65 @@ void MarginalizationInfo::addResidualBlockInfo(ResidualBlockInfo *residual_block
     }
 }
 
+// split factors into buckets of similar total cost, largest factors first
+static std::vector<std::vector<ResidualBlockInfo *>> splitByCost(const std::vector<ResidualBlockInfo *> &factors, 
+    const std::vector<double> &costs, int num_buckets)
+{
+    std::vector<int> order(factors.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int a, int b){return costs[a] > costs[b];});
+
+    std::vector<std::vector<ResidualBlockInfo *>> buckets(num_buckets);
+    std::vector<double> bucket_cost(num_buckets, 0.0);
+    for (int k : order)
+    {
+        int lightest = static_cast<int>(std::min_element(bucket_cost.begin(), bucket_cost.end()) - bucket_cost.begin());
+        buckets[lightest].push_back(factors[k]);
+        bucket_cost[lightest] += costs[k];
+    }
+    return buckets;
+}
+
 void MarginalizationInfo::preMarginalize()
 {
+    GVINS_TRACE_ZONE("preMarginalize");
+    // cost of one evaluation is about the size of the jacobian
+    std::vector<double> costs;
+    costs.reserve(factors.size());
     for (auto it : factors)
     {
-        it->Evaluate();
+        const std::vector<int> &block_sizes = it->cost_function->parameter_block_sizes();
+        costs.push_back(static_cast<double>(it->cost_function->num_residuals()) * 
+            std::accumulate(block_sizes.begin(), block_sizes.end(), 0));
+    }
+    std::vector<std::vector<ResidualBlockInfo *>> buckets = 
+        splitByCost(factors, costs, WorkerPool::instance().numThreads());
 
+    // one arena buffer for every residual and jacobian, its chunks are reused by the next frame's arena
+    size_t buffer_size = 0, num_ptrs = 0;
+    for (auto it : factors)
+    {
+        buffer_size += it->bufferSize();
+        num_ptrs += it->parameter_blocks.size();
+    }
+    double *buffer = arena.createArray<double>(buffer_size);
+    double **jacobian_ptrs = arena.createArray<double *>(num_ptrs);
+    for (auto it : factors)
+    {
+        it->setBuffers(buffer, jacobian_ptrs);
+        buffer += it->bufferSize();
+        jacobian_ptrs += it->parameter_blocks.size();
+    }
+
+    WorkerPool::instance().parallelFor(static_cast<int>(buckets.size()), [&](int k)
+    {
+        GVINS_TRACE_ZONE("evaluateResiduals");
+        for (auto it : buckets[k])
+            it->Evaluate();
+    });
+
+    for (auto it : factors)
+    {
         std::vector<int> block_sizes = it->cost_function->parameter_block_sizes();
         for (int i = 0; i < static_cast<int>(block_sizes.size()); i++)
         {
@@ -138,157 +196,375 @@ int MarginalizationInfo::globalSize(int size) const
     return size == 6 ? 7 : size;
 }
 
-void* ThreadsConstructA(void* threadsstruct)
+void ThreadsConstructA(ThreadsStruct* p)
 {
-    ThreadsStruct* p = ((ThreadsStruct*)threadsstruct);
     for (auto it : p->sub_factors)
     {
         for (int i = 0; i < static_cast<int>(it->parameter_blocks.size()); i++)
         {
-            int idx_i = p->parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[i])];
-            int size_i = p->parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[i])];
-            if (size_i == 7)
-                size_i = 6;
-            Eigen::MatrixXd jacobian_i = it->jacobians[i].leftCols(size_i);
+            int id_i = it->block_id[i];
+            int size_i = it->block_local_size[i];
+            Eigen::MatrixXd jacobian_i = it->jacobian(i).leftCols(size_i);
             for (int j = i; j < static_cast<int>(it->parameter_blocks.size()); j++)
             {
-                int idx_j = p->parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[j])];
-                int size_j = p->parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[j])];
-                if (size_j == 7)
-                    size_j = 6;
-                Eigen::MatrixXd jacobian_j = it->jacobians[j].leftCols(size_j);
-                if (i == j)
-                    p->A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j;
+                int id_j = it->block_id[j];
+                int size_j = it->block_local_size[j];
+                Eigen::MatrixXd jacobian_j = it->jacobian(j).leftCols(size_j);
+                if (id_i <= id_j)
+                {
+                    Eigen::MatrixXd &A_ij = p->A[std::make_pair(id_i, id_j)];
+                    if (A_ij.size() == 0)
+                        A_ij = Eigen::MatrixXd::Zero(size_i, size_j);
+                    A_ij += jacobian_i.transpose() * jacobian_j;
+                }
                 else
                 {
-                    p->A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j;
-                    p->A.block(idx_j, idx_i, size_j, size_i) = p->A.block(idx_i, idx_j, size_i, size_j).transpose();
+                    Eigen::MatrixXd &A_ji = p->A[std::make_pair(id_j, id_i)];
+                    if (A_ji.size() == 0)
+                        A_ji = Eigen::MatrixXd::Zero(size_j, size_i);
+                    A_ji += jacobian_j.transpose() * jacobian_i;
                 }
             }
-            p->b.segment(idx_i, size_i) += jacobian_i.transpose() * it->residuals;
+            p->b[id_i] += jacobian_i.transpose() * it->residuals();
         }
     }
-    return threadsstruct;
+}
+
+// block (u, v) of the symmetric A, zero if the two blocks are not connected
+static Eigen::MatrixXd getBlock(const BlockMatrix &A, const std::vector<int> &block_dim, int u, int v)
+{
+    if (u <= v)
+    {
+        auto it = A.find(std::make_pair(u, v));
+        if (it == A.end())
+            return Eigen::MatrixXd::Zero(block_dim[u], block_dim[v]);
+        return it->second;
+    }
+    auto it = A.find(std::make_pair(v, u));
+    if (it == A.end())
+        return Eigen::MatrixXd::Zero(block_dim[u], block_dim[v]);
+    return it->second.transpose();
+}
+
+static void addToBlock(BlockMatrix &A, const std::vector<int> &block_dim, int u, int v, const Eigen::MatrixXd &value)
+{
+    Eigen::MatrixXd &A_uv = (u <= v ? A[std::make_pair(u, v)] : A[std::make_pair(v, u)]);
+    if (A_uv.size() == 0)
+        A_uv = (u <= v ? Eigen::MatrixXd::Zero(block_dim[u], block_dim[v]) : Eigen::MatrixXd::Zero(block_dim[v], block_dim[u]));
+    if (u <= v)
+        A_uv += value;
+    else
+        A_uv += value.transpose();
+}
+
+int MarginalizationInfo::gpu_min_size = 0;
+bool MarginalizationInfo::fixed_partition = false;
+
+// below the size the transfers cost more than the GPU saves
+bool MarginalizationInfo::useGpu(int size)
+{
+    return gpu_min_size > 0 && size >= gpu_min_size && GpuDense::available();
+}
+
+// LDLT is only trusted when every pivot is clearly positive, otherwise the eigen decomposition is used
+static bool stableLDLT(const Eigen::MatrixXd &M, Eigen::LDLT<Eigen::MatrixXd> &ldlt, const double eps)
+{
+    if (M.rows() == 0)
+        return true;
+    ldlt.compute(M);
+    if (ldlt.info() != Eigen::Success)
+        return false;
+    const Eigen::VectorXd D = ldlt.vectorD();
+    return D.minCoeff() > eps && D.minCoeff() > 1e-12 * D.maxCoeff();
 }
 
 void MarginalizationInfo::marginalize()
 {
+    GVINS_TRACE_ZONE("marginalize");
+    // positions follow the first appearance of the blocks in factors, marginalized blocks first; the maps are
+    // keyed by address, iterating them would order A (and round its sums) differently from run to run
+    std::vector<long> marg_addr, keep_addr;
+    std::unordered_set<long> seen;
+    for (auto it : factors)
+    {
+        for (double *block : it->parameter_blocks)
+        {
+            const long addr = reinterpret_cast<long>(block);
+            if (!seen.insert(addr).second)
+                continue;
+            if (parameter_block_idx.find(addr) != parameter_block_idx.end())
+                marg_addr.push_back(addr);
+            else
+                keep_addr.push_back(addr);
+        }
+    }
+
     int pos = 0;
-    for (auto &it : parameter_block_idx)
+    for (long addr : marg_addr)
     {
-        it.second = pos;
-        pos += localSize(parameter_block_size[it.first]);
+        parameter_block_idx[addr] = pos;
+        pos += localSize(parameter_block_size[addr]);
     }
 
     m = pos;
 
-    for (const auto &it : parameter_block_size)
+    for (long addr : keep_addr)
     {
-        if (parameter_block_idx.find(it.first) == parameter_block_idx.end())
-        {
-            parameter_block_idx[it.first] = pos;
-            pos += localSize(it.second);
-        }
+        parameter_block_idx[addr] = pos;
+        pos += localSize(parameter_block_size[addr]);
     }
 
     n = pos - m;
 
-    //ROS_DEBUG("marginalization, pos: %d, m: %d, n: %d, size: %d", pos, m, n, (int)parameter_block_idx.size());
+    //GVINS_DEBUG("marginalization, pos: %d, m: %d, n: %d, size: %d", pos, m, n, (int)parameter_block_idx.size());
 
-    TicToc t_summing;
-    Eigen::MatrixXd A(pos, pos);
-    Eigen::VectorXd b(pos);
-    A.setZero();
-    b.setZero();
-    /*
+    // block ids follow the order in A, so the marginalized blocks come first
+    std::vector<std::pair<int, long>> idx_addr;
+    for (const auto &it : parameter_block_idx)
+        idx_addr.emplace_back(it.second, it.first);
+    std::sort(idx_addr.begin(), idx_addr.end());
+    const int num_blocks = static_cast<int>(idx_addr.size());
+    std::unordered_map<long, int> block_id;
+    std::vector<int> block_pos(num_blocks), block_dim(num_blocks);
+    int num_marg_blocks = 0;
+    for (int k = 0; k < num_blocks; ++k)
+    {
+        block_id[idx_addr[k].second] = k;
+        block_pos[k] = idx_addr[k].first;
+        block_dim[k] = localSize(parameter_block_size[idx_addr[k].second]);
+        if (block_pos[k] < m)
+            ++num_marg_blocks;
+    }
+
+    TicToc t_thread_summing;
+    // index tables are resolved once here, the workers only read them
+    std::vector<double> costs;
+    costs.reserve(factors.size());
     for (auto it : factors)
     {
+        it->block_id.resize(it->parameter_blocks.size());
+        it->block_local_size.resize(it->parameter_blocks.size());
+        int dim = 0;
         for (int i = 0; i < static_cast<int>(it->parameter_blocks.size()); i++)
         {
-            int idx_i = parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[i])];
-            int size_i = localSize(parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[i])]);
-            Eigen::MatrixXd jacobian_i = it->jacobians[i].leftCols(size_i);
-            for (int j = i; j < static_cast<int>(it->parameter_blocks.size()); j++)
-            {
-                int idx_j = parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[j])];
-                int size_j = localSize(parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[j])]);
-                Eigen::MatrixXd jacobian_j = it->jacobians[j].leftCols(size_j);
-                if (i == j)
-                    A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j;
-                else
-                {
-                    A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j;
-                    A.block(idx_j, idx_i, size_j, size_i) = A.block(idx_i, idx_j, size_i, size_j).transpose();
-                }
-            }
-            b.segment(idx_i, size_i) += jacobian_i.transpose() * it->residuals;
+            int k = block_id[reinterpret_cast<long>(it->parameter_blocks[i])];
+            it->block_id[i] = k;
+            it->block_local_size[i] = block_dim[k];
+            dim += block_dim[k];
         }
+        costs.push_back(static_cast<double>(it->cost_function->num_residuals()) * dim * dim);
     }
-    ROS_INFO("summing up costs %f ms", t_summing.toc());
-    */
-    //multi thread
 
+    const int num_threads = fixed_partition ? FIXED_BUCKETS : WorkerPool::instance().numThreads();
+    std::vector<std::vector<ResidualBlockInfo *>> buckets = splitByCost(factors, costs, num_threads);
+    std::vector<ThreadsStruct> threadsstruct(num_threads);
+    WorkerPool::instance().parallelFor(num_threads, [&](int k)
+    {
+        threadsstruct[k].sub_factors = buckets[k];
+        threadsstruct[k].b.resize(num_blocks);
+        for (int i = 0; i < num_blocks; ++i)
+            threadsstruct[k].b[i] = Eigen::VectorXd::Zero(block_dim[i]);
+        ThreadsConstructA(&threadsstruct[k]);
+    });
+    BlockMatrix A_blocks;
+    std::vector<Eigen::VectorXd> b_blocks(num_blocks);
+    for (int i = 0; i < num_blocks; ++i)
+        b_blocks[i] = Eigen::VectorXd::Zero(block_dim[i]);
+    for (int i = num_threads - 1; i >= 0; i--)
+    {
+        for (auto &it : threadsstruct[i].A)
+        {
+            auto found = A_blocks.find(it.first);
+            if (found == A_blocks.end())
+                A_blocks.insert(std::make_pair(it.first, std::move(it.second)));
+            else
+                found->second += it.second;
+        }
+        for (int k = 0; k < num_blocks; ++k)
+            b_blocks[k] += threadsstruct[i].b[k];
+    }
+    //GVINS_DEBUG("thread summing up costs %f ms", t_thread_summing.toc());
 
-    TicToc t_thread_summing;
-    pthread_t tids[NUM_THREADS];
-    ThreadsStruct threadsstruct[NUM_THREADS];
-    int i = 0;
-    for (auto it : factors)
+    std::vector<std::vector<int>> neighbors(num_blocks);
+    for (const auto &it : A_blocks)
     {
-        threadsstruct[i].sub_factors.push_back(it);
-        i++;
-        i = i % NUM_THREADS;
+        if (it.first.first == it.first.second)
+            continue;
+        neighbors[it.first.first].push_back(it.first.second);
+        neighbors[it.first.second].push_back(it.first.first);
     }
-    for (int i = 0; i < NUM_THREADS; i++)
+
+    // marginalized blocks not connected to each other (feature depths) make Amm partly block diagonal,
+    // they are eliminated one by one before the dense Schur complement on the rest
+    std::vector<int> marg_order(num_marg_blocks);
+    std::iota(marg_order.begin(), marg_order.end(), 0);
+    std::stable_sort(marg_order.begin(), marg_order.end(), [&](int a, int b)
+        {return neighbors[a].size() < neighbors[b].size();});
+    std::vector<bool> is_diag(num_blocks, false);
+    for (int k : marg_order)
     {
-        TicToc zero_matrix;
-        threadsstruct[i].A = Eigen::MatrixXd::Zero(pos,pos);
-        threadsstruct[i].b = Eigen::VectorXd::Zero(pos);
-        threadsstruct[i].parameter_block_size = parameter_block_size;
-        threadsstruct[i].parameter_block_idx = parameter_block_idx;
-        int ret = pthread_create( &tids[i], NULL, ThreadsConstructA ,(void*)&(threadsstruct[i]));
-        if (ret != 0)
+        bool independent = true;
+        for (int u : neighbors[k])
         {
-            ROS_WARN("pthread_create error");
-            ROS_BREAK();
+            if (is_diag[u])
+            {
+                independent = false;
+                break;
+            }
         }
+        is_diag[k] = independent;
     }
-    for( int i = NUM_THREADS - 1; i >= 0; i--)  
+
+    TicToc t_schur;
+    for (int d = 0; d < num_marg_blocks; ++d)
     {
-        pthread_join( tids[i], NULL ); 
-        A += threadsstruct[i].A;
-        b += threadsstruct[i].b;
+        if (!is_diag[d])
+            continue;
+        Eigen::MatrixXd A_dd = getBlock(A_blocks, block_dim, d, d);
+        Eigen::MatrixXd A_dd_inv;
+        if (block_dim[d] == 1)
+            A_dd_inv = Eigen::MatrixXd::Constant(1, 1, A_dd(0, 0) > eps ? 1.0 / A_dd(0, 0) : 0.0);
+        else
+        {
+            Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes_d(0.5 * (A_dd + A_dd.transpose()));
+            A_dd_inv = saes_d.eigenvectors() * Eigen::VectorXd((saes_d.eigenvalues().array() > eps).select(saes_d.eigenvalues().array().inverse(), 0)).asDiagonal() * saes_d.eigenvectors().transpose();
+        }
+
+        const std::vector<int> &N = neighbors[d];
+        std::vector<Eigen::MatrixXd> A_ud(N.size());
+        for (size_t i = 0; i < N.size(); ++i)
+            A_ud[i] = getBlock(A_blocks, block_dim, N[i], d);
+        for (size_t i = 0; i < N.size(); ++i)
+        {
+            Eigen::MatrixXd W = A_ud[i] * A_dd_inv;
+            b_blocks[N[i]] -= W * b_blocks[d];
+            for (size_t j = i; j < N.size(); ++j)
+                addToBlock(A_blocks, block_dim, N[i], N[j], -W * A_ud[j].transpose());
+        }
     }
-    //ROS_DEBUG("thread summing up costs %f ms", t_thread_summing.toc());
-    //ROS_INFO("A diff %f , b diff %f ", (A - tmp_A).sum(), (b - tmp_b).sum());
 
+    // dense Schur complement for the remaining marginalized blocks
+    std::vector<int> dense_marg_blocks;
+    int dense_m = 0;
+    for (int k = 0; k < num_marg_blocks; ++k)
+    {
+        if (!is_diag[k])
+        {
+            dense_marg_blocks.push_back(k);
+            dense_m += block_dim[k];
+        }
+    }
+    std::vector<int> dense_pos(num_blocks, -1);
+    int tmp_pos = 0;
+    for (int k : dense_marg_blocks)
+    {
+        dense_pos[k] = tmp_pos;
+        tmp_pos += block_dim[k];
+    }
+    for (int k = num_marg_blocks; k < num_blocks; ++k)
+        dense_pos[k] = dense_m + block_pos[k] - m;
 
-    //TODO
-    Eigen::MatrixXd Amm = 0.5 * (A.block(0, 0, m, m) + A.block(0, 0, m, m).transpose());
-    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes(Amm);
+    Eigen::MatrixXd A = Eigen::MatrixXd::Zero(dense_m + n, dense_m + n);
+    Eigen::VectorXd b = Eigen::VectorXd::Zero(dense_m + n);
+    for (const auto &it : A_blocks)
+    {
+        int u = it.first.first, v = it.first.second;
+        if (dense_pos[u] < 0 || dense_pos[v] < 0)
+            continue;
+        A.block(dense_pos[u], dense_pos[v], block_dim[u], block_dim[v]) = it.second;
+        if (u != v)
+            A.block(dense_pos[v], dense_pos[u], block_dim[v], block_dim[u]) = it.second.transpose();
+    }
+    for (int k = 0; k < num_blocks; ++k)
+    {
+        if (dense_pos[k] >= 0)
+            b.segment(dense_pos[k], block_dim[k]) = b_blocks[k];
+    }
 
-    //ROS_ASSERT_MSG(saes.eigenvalues().minCoeff() >= -1e-4, "min eigenvalue %f", saes.eigenvalues().minCoeff());
+    TicToc t_schur_solve;
+    schur_by_cholesky = true;
+    schur_on_gpu = false;
+    if (dense_m > 0)
+    {
+        Eigen::MatrixXd Amm = 0.5 * (A.block(0, 0, dense_m, dense_m) + A.block(0, 0, dense_m, dense_m).transpose());
+        Eigen::VectorXd bmm = b.segment(0, dense_m);
+        Eigen::MatrixXd Amr = A.block(0, dense_m, dense_m, n);
+        Eigen::MatrixXd Arm = A.block(dense_m, 0, n, dense_m);
+        Eigen::MatrixXd Arr = A.block(dense_m, dense_m, n, n);
+        Eigen::VectorXd brr = b.segment(dense_m, n);
+
+        Eigen::LDLT<Eigen::MatrixXd> ldlt;
+        if (useGpu(dense_m + n) && GpuDense::schurComplement(Amm, Amr, Arr, bmm, brr, eps, A, b))
+            schur_on_gpu = true;
+        else if (stableLDLT(Amm, ldlt, eps))
+        {
+            A = Arr - Arm * ldlt.solve(Amr);
+            b = brr - Arm * ldlt.solve(bmm);
+        }
+        else
+        {
+            schur_by_cholesky = false;
+            Eigen::VectorXd values;
+            Eigen::MatrixXd vectors;
+            if (!(useGpu(dense_m) && GpuDense::symmetricEigen(Amm, values, vectors)))
+            {
+                Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes(Amm);
+                values = saes.eigenvalues();
+                vectors = saes.eigenvectors();
+            }
 
-    Eigen::MatrixXd Amm_inv = saes.eigenvectors() * Eigen::VectorXd((saes.eigenvalues().array() > eps).select(saes.eigenvalues().array().inverse(), 0)).asDiagonal() * saes.eigenvectors().transpose();
-    //printf("error1: %f\n", (Amm * Amm_inv - Eigen::MatrixXd::Identity(m, m)).sum());
+            //GVINS_ASSERT_MSG(values.minCoeff() >= -1e-4, "min eigenvalue %f", values.minCoeff());
 
-    Eigen::VectorXd bmm = b.segment(0, m);
-    Eigen::MatrixXd Amr = A.block(0, m, m, n);
-    Eigen::MatrixXd Arm = A.block(m, 0, n, m);
-    Eigen::MatrixXd Arr = A.block(m, m, n, n);
-    Eigen::VectorXd brr = b.segment(m, n);
-    A = Arr - Arm * Amm_inv * Amr;
-    b = brr - Arm * Amm_inv * bmm;
+            Eigen::MatrixXd Amm_inv = vectors * Eigen::VectorXd((values.array() > eps).select(values.array().inverse(), 0)).asDiagonal() * vectors.transpose();
+            //printf("error1: %f\n", (Amm * Amm_inv - Eigen::MatrixXd::Identity(m, m)).sum());
 
-    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes2(A);
-    Eigen::VectorXd S = Eigen::VectorXd((saes2.eigenvalues().array() > eps).select(saes2.eigenvalues().array(), 0));
-    Eigen::VectorXd S_inv = Eigen::VectorXd((saes2.eigenvalues().array() > eps).select(saes2.eigenvalues().array().inverse(), 0));
+            A = Arr - Arm * Amm_inv * Amr;
+            b = brr - Arm * Amm_inv * bmm;
+        }
+    }
+    t_schur_solve_ms = t_schur_solve.toc();
+    GVINS_DEBUG("marginalization schur costs %f ms, %d of %d marginalized blocks eliminated sparsely", 
+        t_schur.toc(), num_marg_blocks - static_cast<int>(dense_marg_blocks.size()), num_marg_blocks);
+
+    // factor the prior A = J^T J, with LDLT A = P^T L D L^T P gives J = D^(1/2) L^T P
+    TicToc t_prior_solve;
+    Eigen::MatrixXd A_sym = 0.5 * (A + A.transpose());
+    Eigen::LDLT<Eigen::MatrixXd> ldlt_prior;
+    // on the GPU without pivoting, J = L^T of A = L L^T
+    prior_on_gpu = useGpu(n) && GpuDense::factorPrior(A_sym, b, eps, linearized_jacobians, linearized_residuals);
+    prior_by_cholesky = prior_on_gpu || stableLDLT(A_sym, ldlt_prior, eps);
+    if (!prior_on_gpu && prior_by_cholesky)
+    {
+        Eigen::MatrixXd P = ldlt_prior.transpositionsP() * Eigen::MatrixXd::Identity(n, n);
+        Eigen::VectorXd D_sqrt = ldlt_prior.vectorD().cwiseSqrt();
+        Eigen::MatrixXd Lt = ldlt_prior.matrixU();
+        linearized_jacobians = D_sqrt.asDiagonal() * Lt * P;
+        Eigen::VectorXd Pb = P * b;
+        linearized_residuals = D_sqrt.cwiseInverse().asDiagonal() * ldlt_prior.matrixL().solve(Pb);
+    }
+    else if (!prior_by_cholesky)
+    {
+        Eigen::VectorXd values;
+        Eigen::MatrixXd vectors;
+        if (!(useGpu(n) && GpuDense::symmetricEigen(A_sym, values, vectors)))
+        {
+            Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes2(A);
+            values = saes2.eigenvalues();
+            vectors = saes2.eigenvectors();
+        }
+        Eigen::VectorXd S = Eigen::VectorXd((values.array() > eps).select(values.array(), 0));
+        Eigen::VectorXd S_inv = Eigen::VectorXd((values.array() > eps).select(values.array().inverse(), 0));
 
-    Eigen::VectorXd S_sqrt = S.cwiseSqrt();
-    Eigen::VectorXd S_inv_sqrt = S_inv.cwiseSqrt();
+        Eigen::VectorXd S_sqrt = S.cwiseSqrt();
+        Eigen::VectorXd S_inv_sqrt = S_inv.cwiseSqrt();
 
-    linearized_jacobians = S_sqrt.asDiagonal() * saes2.eigenvectors().transpose();
-    linearized_residuals = S_inv_sqrt.asDiagonal() * saes2.eigenvectors().transpose() * b;
+        linearized_jacobians = S_sqrt.asDiagonal() * vectors.transpose();
+        linearized_residuals = S_inv_sqrt.asDiagonal() * vectors.transpose() * b;
+    }
+    t_prior_solve_ms = t_prior_solve.toc();
+    GVINS_DEBUG("marginalization solve: schur by %s%s %f ms, prior by %s%s %f ms", 
+        schur_by_cholesky ? "cholesky" : "eigen", schur_on_gpu ? " (gpu)" : "", t_schur_solve_ms, 
+        prior_by_cholesky ? "cholesky" : "eigen", prior_on_gpu ? " (gpu)" : "", t_prior_solve_ms);
     //std::cout << A << std::endl
     //          << std::endl;
     //std::cout << linearized_jacobians << std::endl;
@@ -303,31 +579,205 @@ std::vector<double *> MarginalizationInfo::getParameterBlocks(std::unordered_map
     keep_block_idx.clear();
     keep_block_data.clear();
 
+    // in the order of A, not of the address-keyed map
+    std::vector<std::pair<int, long>> keep_idx_addr;
     for (const auto &it : parameter_block_idx)
     {
         if (it.second >= m)
-        {
-            keep_block_size.push_back(parameter_block_size[it.first]);
-            keep_block_idx.push_back(parameter_block_idx[it.first]);
-            keep_block_data.push_back(parameter_block_data[it.first]);
-            keep_block_addr.push_back(addr_shift[it.first]);
-        }
+            keep_idx_addr.emplace_back(it.second, it.first);
+    }
+    std::sort(keep_idx_addr.begin(), keep_idx_addr.end());
+    for (const auto &it : keep_idx_addr)
+    {
+        keep_block_size.push_back(parameter_block_size[it.second]);
+        keep_block_idx.push_back(it.first);
+        keep_block_data.push_back(parameter_block_data[it.second]);
+        keep_block_addr.push_back(addr_shift[it.second]);
     }
     sum_block_size = std::accumulate(std::begin(keep_block_size), std::end(keep_block_size), 0);
 
     return keep_block_addr;
 }
 
-MarginalizationFactor::MarginalizationFactor(MarginalizationInfo* _marginalization_info):marginalization_info(_marginalization_info)
+std::vector<int> MarginalizationInfo::priorFactors() const
+{
+    if (prior_pieces.empty())
+        return std::vector<int>{-1};
+    std::vector<int> pieces(prior_pieces.size());
+    std::iota(pieces.begin(), pieces.end(), 0);
+    return pieces;
+}
+
+std::vector<int> MarginalizationInfo::priorBlocks(int piece) const
+{
+    if (piece >= 0)
+        return prior_pieces[piece].blocks;
+    std::vector<int> blocks(keep_block_size.size());
+    std::iota(blocks.begin(), blocks.end(), 0);
+    return blocks;
+}
+
+// rows/columns idx of a symmetric matrix
+static Eigen::MatrixXd gatherBlock(const Eigen::MatrixXd &M, const std::vector<int> &idx)
+{
+    Eigen::MatrixXd G(idx.size(), idx.size());
+    for (int i = 0; i < static_cast<int>(idx.size()); i++)
+        for (int j = 0; j < static_cast<int>(idx.size()); j++)
+            G(i, j) = M(idx[i], idx[j]);
+    return G;
+}
+
+static Eigen::MatrixXd inverseSPD(const Eigen::MatrixXd &M)
+{
+    Eigen::MatrixXd M_sym = 0.5 * (M + M.transpose());
+    return M_sym.ldlt().solve(Eigen::MatrixXd::Identity(M.rows(), M.cols()));
+}
+
+static double logDet(const Eigen::MatrixXd &M)
+{
+    Eigen::LDLT<Eigen::MatrixXd> ldlt(0.5 * (M + M.transpose()));
+    return ldlt.vectorD().array().log().sum();
+}
+
+// mean time of one evaluation with jacobians at the linearization point
+static double evaluationTime(const MarginalizationFactor &factor, const std::vector<double *> &parameters)
+{
+    const int repeats = 10;
+    std::vector<double> residuals(factor.num_residuals());
+    std::vector<std::vector<double>> jacobian_data;
+    std::vector<double *> jacobians;
+    for (int size : factor.parameter_block_sizes())
+        jacobian_data.emplace_back(factor.num_residuals() * size);
+    for (auto &it : jacobian_data)
+        jacobians.push_back(it.data());
+    TicToc t_eval;
+    for (int k = 0; k < repeats; k++)
+        factor.Evaluate(parameters.data(), residuals.data(), jacobians.data());
+    return t_eval.toc() / repeats;
+}
+
+/**
+ * 先验的稀疏化: 保留块按帧分组, 组间只保留相邻帧的关系, 所有帧共享的块 (外参, td, yaw_enu_local, anc_ecef) 进入每个因子;
+ * 这是以相邻帧为团的链式连接树, KL 散度最优的近似在每个团上与稠密先验的边缘协方差一致 (Mazuran et al. 的非线性因子恢复),
+ * 信息矩阵为 sum inv(Sigma_C) - sum inv(Sigma_S), 按团拆成 "帧 k 在 (共享块, 帧 k+1) 条件下" 的条件因子和最后一个团的边缘因子;
+ * 均值保持不变, 不可观方向以很小的对角项正则化
+ */
+bool MarginalizationInfo::sparsify(const std::vector<int> &block_group)
+{
+    TicToc t_sparsify;
+    prior_pieces.clear();
+    sparsify_kl = 0;
+    t_dense_eval_ms = t_sparse_eval_ms = t_sparsify_ms = 0;
+
+    std::vector<int> shared;
+    std::map<int, std::vector<int>> frames;
+    for (int i = 0; i < static_cast<int>(block_group.size()); i++)
+    {
+        if (block_group[i] < 0)
+            shared.push_back(i);
+        else
+            frames[block_group[i]].push_back(i);
+    }
+    if (frames.size() < 3)
+        return false;
+    std::vector<std::vector<int>> groups;
+    for (const auto &it : frames)
+        groups.push_back(it.second);
+
+    // columns of each kept block in the dense prior
+    std::vector<int> block_col(keep_block_size.size()), block_dim(keep_block_size.size());
+    for (int i = 0; i < static_cast<int>(keep_block_size.size()); i++)
+    {
+        block_col[i] = keep_block_idx[i] - m;
+        block_dim[i] = localSize(keep_block_size[i]);
+    }
+    auto columns = [&](const std::vector<int> &blocks)
+    {
+        std::vector<int> idx;
+        for (int k : blocks)
+            for (int c = 0; c < block_dim[k]; c++)
+                idx.push_back(block_col[k] + c);
+        return idx;
+    };
+
+    const Eigen::MatrixXd A = linearized_jacobians.transpose() * linearized_jacobians;
+    const Eigen::VectorXd b = linearized_jacobians.transpose() * linearized_residuals;
+    const double ridge = std::max(eps, 1e-10 * A.diagonal().maxCoeff());
+    const Eigen::MatrixXd A_reg = A + ridge * Eigen::MatrixXd::Identity(n, n);
+    const Eigen::LDLT<Eigen::MatrixXd> ldlt(A_reg);
+    const Eigen::MatrixXd Sigma = ldlt.solve(Eigen::MatrixXd::Identity(n, n));
+    // the minimum of the prior is at dx = -mean
+    const Eigen::VectorXd mean = ldlt.solve(b);
+
+    std::vector<PriorPiece> pieces;
+    Eigen::MatrixXd A_sparse = Eigen::MatrixXd::Zero(n, n);
+    for (int k = 0; k + 1 < static_cast<int>(groups.size()); k++)
+    {
+        // frame k first, then the separator (shared blocks, frame k + 1) it is conditioned on
+        std::vector<int> separator = shared;
+        separator.insert(separator.end(), groups[k + 1].begin(), groups[k + 1].end());
+        PriorPiece piece;
+        piece.blocks = groups[k];
+        piece.blocks.insert(piece.blocks.end(), separator.begin(), separator.end());
+        const std::vector<int> idx = columns(piece.blocks);
+        Eigen::MatrixXd info = inverseSPD(gatherBlock(Sigma, idx));
+        if (k + 2 < static_cast<int>(groups.size()))
+        {
+            const int s = static_cast<int>(columns(separator).size());
+            info.bottomRightCorner(s, s) -= inverseSPD(gatherBlock(Sigma, columns(separator)));
+        }
+        Eigen::VectorXd mean_piece(idx.size());
+        for (int i = 0; i < static_cast<int>(idx.size()); i++)
+            mean_piece(i) = mean(idx[i]);
+        const Eigen::VectorXd b_piece = info * mean_piece;
+
+        Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes(0.5 * (info + info.transpose()));
+        const Eigen::VectorXd S = Eigen::VectorXd((saes.eigenvalues().array() > eps).select(saes.eigenvalues().array(), 0));
+        const Eigen::VectorXd S_inv = Eigen::VectorXd((saes.eigenvalues().array() > eps).select(saes.eigenvalues().array().inverse(), 0));
+        piece.linearized_jacobians = S.cwiseSqrt().asDiagonal() * saes.eigenvectors().transpose();
+        piece.linearized_residuals = S_inv.cwiseSqrt().asDiagonal() * saes.eigenvectors().transpose() * b_piece;
+
+        const Eigen::MatrixXd info_kept = piece.linearized_jacobians.transpose() * piece.linearized_jacobians;
+        for (int i = 0; i < static_cast<int>(idx.size()); i++)
+            for (int j = 0; j < static_cast<int>(idx.size()); j++)
+                A_sparse(idx[i], idx[j]) += info_kept(i, j);
+        pieces.push_back(piece);
+    }
+
+    // KL(p_dense || q_sparse) of two gaussians with the same mean
+    const Eigen::MatrixXd A_sparse_reg = A_sparse + ridge * Eigen::MatrixXd::Identity(n, n);
+    sparsify_kl = 0.5 * ((A_sparse_reg * Sigma).trace() - n + logDet(A_reg) - logDet(A_sparse_reg));
+
+    t_dense_eval_ms = evaluationTime(MarginalizationFactor(this), keep_block_data);
+    prior_pieces.swap(pieces);
+    for (int piece = 0; piece < static_cast<int>(prior_pieces.size()); piece++)
+    {
+        std::vector<double *> parameters;
+        for (int k : prior_pieces[piece].blocks)
+            parameters.push_back(keep_block_data[k]);
+        t_sparse_eval_ms += evaluationTime(MarginalizationFactor(this, piece), parameters);
+    }
+    t_sparsify_ms = t_sparsify.toc();
+    GVINS_DEBUG("prior sparsified into %d factors in %f ms, KL %f, evaluation %f -> %f ms", 
+        static_cast<int>(prior_pieces.size()), t_sparsify_ms, sparsify_kl, t_dense_eval_ms, t_sparse_eval_ms);
+    return true;
+}
+
+MarginalizationFactor::MarginalizationFactor(MarginalizationInfo* _marginalization_info, int _piece)
+    : marginalization_info(_marginalization_info), piece(_piece)
 {
     int cnt = 0;
-    for (auto it : marginalization_info->keep_block_size)
+    blocks = marginalization_info->priorBlocks(piece);
+    for (int k : blocks)
     {
-        mutable_parameter_block_sizes()->push_back(it);
-        cnt += it;
+        mutable_parameter_block_sizes()->push_back(marginalization_info->keep_block_size[k]);
+        // the dense prior keeps the order of marginalize(), a piece the order of its blocks
+        cols.push_back(piece < 0 ? marginalization_info->keep_block_idx[k] - marginalization_info->m : cnt);
+        cnt += marginalization_info->localSize(marginalization_info->keep_block_size[k]);
     }
     //printf("residual size: %d, %d\n", cnt, n);
-    set_num_residuals(marginalization_info->n);
+    set_num_residuals(piece < 0 ? marginalization_info->n : 
+                      static_cast<int>(marginalization_info->prior_pieces[piece].linearized_residuals.size()));
 };
 
 bool MarginalizationFactor::Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
@@ -340,15 +790,19 @@ bool MarginalizationFactor::Evaluate(double const *const *parameters, double *re
     //printf("jacobian %x\n", reinterpret_cast<long>(jacobians));
     //printf("residual %x\n", reinterpret_cast<long>(residuals));
     //}
-    int n = marginalization_info->n;
-    int m = marginalization_info->m;
+    const Eigen::MatrixXd &linearized_jacobians = (piece < 0 ? marginalization_info->linearized_jacobians :
+                                                   marginalization_info->prior_pieces[piece].linearized_jacobians);
+    const Eigen::VectorXd &linearized_residuals = (piece < 0 ? marginalization_info->linearized_residuals :
+                                                   marginalization_info->prior_pieces[piece].linearized_residuals);
+    int n = static_cast<int>(linearized_jacobians.cols());
+    int num_residuals = static_cast<int>(linearized_residuals.size());
     Eigen::VectorXd dx(n);
-    for (int i = 0; i < static_cast<int>(marginalization_info->keep_block_size.size()); i++)
+    for (int i = 0; i < static_cast<int>(blocks.size()); i++)
     {
-        int size = marginalization_info->keep_block_size[i];
-        int idx = marginalization_info->keep_block_idx[i] - m;
+        int size = marginalization_info->keep_block_size[blocks[i]];
+        int idx = cols[i];
         Eigen::VectorXd x = Eigen::Map<const Eigen::VectorXd>(parameters[i], size);
-        Eigen::VectorXd x0 = Eigen::Map<const Eigen::VectorXd>(marginalization_info->keep_block_data[i], size);
+        Eigen::VectorXd x0 = Eigen::Map<const Eigen::VectorXd>(marginalization_info->keep_block_data[blocks[i]], size);
         if (size != 7)
             dx.segment(idx, size) = x - x0;
         else
@@ -361,19 +815,19 @@ bool MarginalizationFactor::Evaluate(double const *const *parameters, double *re
             }
         }
     }
-    Eigen::Map<Eigen::VectorXd>(residuals, n) = marginalization_info->linearized_residuals + marginalization_info->linearized_jacobians * dx;
+    Eigen::Map<Eigen::VectorXd>(residuals, num_residuals) = linearized_residuals + linearized_jacobians * dx;
     if (jacobians)
     {
 
-        for (int i = 0; i < static_cast<int>(marginalization_info->keep_block_size.size()); i++)
+        for (int i = 0; i < static_cast<int>(blocks.size()); i++)
         {
             if (jacobians[i])
             {
-                int size = marginalization_info->keep_block_size[i], local_size = marginalization_info->localSize(size);
-                int idx = marginalization_info->keep_block_idx[i] - m;
-                Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> jacobian(jacobians[i], n, size);
+                int size = marginalization_info->keep_block_size[blocks[i]], local_size = marginalization_info->localSize(size);
+                int idx = cols[i];
+                Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> jacobian(jacobians[i], num_residuals, size);
                 jacobian.setZero();
-                jacobian.leftCols(local_size) = marginalization_info->linearized_jacobians.middleCols(idx, local_size);
+                jacobian.leftCols(local_size) = linearized_jacobians.middleCols(idx, local_size);
             }
         }
     }
@@ -1,32 +1,54 @@
 #pragma once
 
-#include <ros/ros.h>
-#include <ros/console.h>
+#include <gvins_feature_tracker/log.h>
 #include <cstdlib>
-#include <pthread.h>
 #include <ceres/ceres.h>
 #include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <numeric>
+#include <algorithm>
 
 #include "../utility/utility.h"
 #include "../utility/tic_toc.h"
-
-const int NUM_THREADS = 4;
+#include "../utility/worker_pool.h"
+#include "../utility/object_arena.h"
 
 struct ResidualBlockInfo
 {
+    typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> JacobianMatrix;
+
     ResidualBlockInfo(ceres::CostFunction *_cost_function, ceres::LossFunction *_loss_function, std::vector<double *> _parameter_blocks, std::vector<int> _drop_set)
-        : cost_function(_cost_function), loss_function(_loss_function), parameter_blocks(_parameter_blocks), drop_set(_drop_set) {}
+        : cost_function(_cost_function), loss_function(_loss_function), parameter_blocks(_parameter_blocks), drop_set(_drop_set),
+          residual_data(nullptr), raw_jacobians(nullptr) {}
 
+    // doubles needed for the residuals and all jacobians of one evaluation
+    size_t bufferSize() const;
+    // where Evaluate() writes: buffer of bufferSize() doubles and one pointer per parameter block, owned by the caller
+    void setBuffers(double *buffer, double **jacobian_ptrs);
     void Evaluate();
 
+    Eigen::Map<Eigen::VectorXd> residuals() const
+    {
+        return Eigen::Map<Eigen::VectorXd>(residual_data, cost_function->num_residuals());
+    }
+    Eigen::Map<JacobianMatrix> jacobian(int i) const
+    {
+        return Eigen::Map<JacobianMatrix>(raw_jacobians[i], cost_function->num_residuals(),
+                                          cost_function->parameter_block_sizes()[i]);
+    }
+
     ceres::CostFunction *cost_function;
     ceres::LossFunction *loss_function;
     std::vector<double *> parameter_blocks;
     std::vector<int> drop_set;
 
+    double *residual_data;
     double **raw_jacobians;
-    std::vector<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> jacobians;
-    Eigen::VectorXd residuals;
+
+    // block id and local size of each parameter block in A, filled by MarginalizationInfo::marginalize
+    std::vector<int> block_id;
+    std::vector<int> block_local_size;
 
     int localSize(int size)
     {
@@ -34,13 +56,14 @@ struct ResidualBlockInfo
     }
 };
 
+// upper triangle of A stored per (row block id, col block id), row id <= col id
+typedef std::map<std::pair<int, int>, Eigen::MatrixXd> BlockMatrix;
+
 struct ThreadsStruct
 {
     std::vector<ResidualBlockInfo *> sub_factors;
-    Eigen::MatrixXd A;
-    Eigen::VectorXd b;
-    std::unordered_map<long, int> parameter_block_size; //global size
-    std::unordered_map<long, int> parameter_block_idx; //local size
+    BlockMatrix A;
+    std::vector<Eigen::VectorXd> b;
 };
 
 class MarginalizationInfo
@@ -49,10 +72,30 @@ class MarginalizationInfo
     ~MarginalizationInfo();
     int localSize(int size) const;
     int globalSize(int size) const;
+    // the factors and their ResidualBlockInfo are created here and released together with this object
+    template <typename T, typename... Args>
+    T *create(Args &&... args)
+    {
+        return arena.create<T>(std::forward<Args>(args)...);
+    }
     void addResidualBlockInfo(ResidualBlockInfo *residual_block_info);
     void preMarginalize();
     void marginalize();
     std::vector<double *> getParameterBlocks(std::unordered_map<long, double *> &addr_shift);
+    // replaces the dense prior by relative factors, block_group is the window frame of each kept block (-1 for the
+    // blocks shared by all frames); false if there are too few frames to gain anything
+    bool sparsify(const std::vector<int> &block_group);
+    // factors the prior is added as: {-1} for the dense prior, otherwise one per piece of the sparsified prior
+    std::vector<int> priorFactors() const;
+    // kept blocks (indices into keep_block_*) of one of priorFactors()
+    std::vector<int> priorBlocks(int piece) const;
+
+    // dense systems from this dimension are decomposed on the GPU (GpuDense) when there is one, 0 never
+    static int gpu_min_size;
+    static bool useGpu(int size);
+    // the Hessian is summed over FIXED_BUCKETS buckets instead of one per pool thread, the same sums on any machine
+    static bool fixed_partition;
+    static const int FIXED_BUCKETS = 8;
 
     std::vector<ResidualBlockInfo *> factors;
     int m, n;
@@ -65,17 +108,40 @@ class MarginalizationInfo
     std::vector<int> keep_block_idx;  //local size
     std::vector<double *> keep_block_data;
 
+    ObjectArena arena;
+
     Eigen::MatrixXd linearized_jacobians;
     Eigen::VectorXd linearized_residuals;
     const double eps = 1e-8;
 
+    // which decomposition the last marginalize() used and how long it took
+    bool schur_by_cholesky, prior_by_cholesky;
+    bool schur_on_gpu, prior_on_gpu;
+    double t_schur_solve_ms, t_prior_solve_ms;
+
+    // one relative factor of the sparsified prior: the kept blocks it connects, their columns follow this order
+    struct PriorPiece
+    {
+        std::vector<int> blocks;
+        Eigen::MatrixXd linearized_jacobians;
+        Eigen::VectorXd linearized_residuals;
+    };
+    std::vector<PriorPiece> prior_pieces;
+    // KL divergence of the sparsified prior from the dense one (nats), one evaluation with jacobians of each form
+    double sparsify_kl;
+    double t_dense_eval_ms, t_sparse_eval_ms, t_sparsify_ms;
+
 };
 
 class MarginalizationFactor : public ceres::CostFunction
 {
   public:
-    MarginalizationFactor(MarginalizationInfo* _marginalization_info);
+    // piece -1 is the dense prior, otherwise one piece of the sparsified prior
+    MarginalizationFactor(MarginalizationInfo* _marginalization_info, int _piece = -1);
     virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const;
 
     MarginalizationInfo* marginalization_info;
+    int piece;
+    // kept block and column in the jacobian of each parameter block
+    std::vector<int> blocks, cols;
 };
@@ -1,6 +1,7 @@
 #include "pose_anchor_factor.h"
 
-PoseAnchorFactor::PoseAnchorFactor(const std::vector<double> anchor_value)
+PoseAnchorFactor::PoseAnchorFactor(const std::vector<double> anchor_value, double _sqrt_info)
+    : sqrt_info(_sqrt_info)
 {
     for (int i = 0; i < 7; ++i)     _anchor_point(i) = anchor_value[i];
 }
@@ -11,11 +11,11 @@ class PoseAnchorFactor : public ceres::SizedCostFunction<6, 7>
 {
     public: 
         PoseAnchorFactor() = delete;
-        PoseAnchorFactor(const std::vector<double> anchor_value);
+        PoseAnchorFactor(const std::vector<double> anchor_value, double _sqrt_info = 120);
         virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const;
     private:
         Eigen::Matrix<double, 7, 1> _anchor_point;
-        constexpr static double sqrt_info = 120;
+        double sqrt_info;
 };
 
 #endif
\ No newline at end of file
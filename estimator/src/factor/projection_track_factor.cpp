@@ -0,0 +1,217 @@
+#include "projection_track_factor.h"
+#include "projection_factor.h"
+#include "projection_td_factor.h"
+#include "../utility/float_pack.h"
+
+bool ProjectionTrackFactor::packed_evaluation = false;
+
+namespace
+{
+    // every observation of a track fits, rounded up to whole packs
+    const int PACKED_CAPACITY = (WINDOW_SIZE + FloatPack::SIZE) / FloatPack::SIZE * FloatPack::SIZE;
+}
+
+ProjectionTrackFactor::ProjectionTrackFactor(const Eigen::Vector3d &_pts_i, const Eigen::Vector2d &_velocity_i,
+                                             double _td_i, bool _with_td)
+    : pts_i(_pts_i), td_i(_td_i), with_td(_with_td)
+{
+    velocity_i << _velocity_i.x(), _velocity_i.y(), 0;
+    std::vector<int> *block_sizes = mutable_parameter_block_sizes();
+    *block_sizes = std::vector<int>{7, 7, 1};
+    if (with_td)
+        block_sizes->push_back(1);
+    set_num_residuals(0);
+}
+
+void ProjectionTrackFactor::addObservation(const Eigen::Vector3d &pts_j, const Eigen::Vector2d &velocity_j, double td_j)
+{
+    Observation obs;
+    obs.pts_j = pts_j;
+    obs.velocity_j << velocity_j.x(), velocity_j.y(), 0;
+    obs.td_j = td_j;
+    observations.push_back(obs);
+    mutable_parameter_block_sizes()->push_back(7);
+    set_num_residuals(static_cast<int>(2 * observations.size()));
+}
+
+// only the image plane residual, UNIT_SPHERE_ERROR is not supported
+bool ProjectionTrackFactor::Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
+{
+    const Eigen::Matrix2d &sqrt_info = (with_td ? ProjectionTdFactor::sqrt_info : ProjectionFactor::sqrt_info);
+    const int num_res = num_residuals();
+    const int pose_block = first_pose_block();
+
+    Eigen::Vector3d Pi(parameters[0][0], parameters[0][1], parameters[0][2]);
+    Eigen::Quaterniond Qi(parameters[0][6], parameters[0][3], parameters[0][4], parameters[0][5]);
+    Eigen::Vector3d tic(parameters[1][0], parameters[1][1], parameters[1][2]);
+    Eigen::Quaterniond qic(parameters[1][6], parameters[1][3], parameters[1][4], parameters[1][5]);
+    double inv_dep_i = parameters[2][0];
+    double td = (with_td ? parameters[3][0] : 0.0);
+
+    // host side, shared by all observations
+    const Eigen::Vector3d pts_i_td = (with_td ? Eigen::Vector3d(pts_i - (td - td_i) * velocity_i) : pts_i);
+    const Eigen::Vector3d pts_camera_i = pts_i_td / inv_dep_i;
+    const Eigen::Vector3d pts_imu_i = qic * pts_camera_i + tic;
+    const Eigen::Vector3d pts_w = Qi * pts_imu_i + Pi;
+    const Eigen::Quaterniond qic_inv = qic.inverse();
+
+    if (!jacobians && packed_evaluation && observations.size() <= static_cast<size_t>(PACKED_CAPACITY))
+    {
+        packedResiduals(parameters, pts_w, qic.toRotationMatrix().transpose(), tic, td, sqrt_info, residuals);
+        return true;
+    }
+
+    Eigen::Matrix3d Ri, ric, ric_t, Ri_ric, skew_imu_i, skew_camera_i;
+    Eigen::Vector3d Ri_tic_Pi, dpw_dinv, dpw_dtd;
+    if (jacobians)
+    {
+        Ri = Qi.toRotationMatrix();
+        ric = qic.toRotationMatrix();
+        ric_t = ric.transpose();
+        Ri_ric = Ri * ric;
+        skew_imu_i = Utility::skewSymmetric(pts_imu_i);
+        skew_camera_i = Utility::skewSymmetric(pts_camera_i);
+        Ri_tic_Pi = Ri * tic + Pi;
+        dpw_dinv = Ri_ric * pts_i_td * -1.0 / (inv_dep_i * inv_dep_i);
+        dpw_dtd = Ri_ric * velocity_i / inv_dep_i * -1.0;
+
+        // the shared blocks are filled row by row below
+        for (int b = 0; b < pose_block; ++b)
+        {
+            if (jacobians[b])
+                std::fill(jacobians[b], jacobians[b] + num_res * parameter_block_sizes()[b], 0.0);
+        }
+    }
+
+    for (size_t k = 0; k < observations.size(); ++k)
+    {
+        const Observation &obs = observations[k];
+        const double *pose_j = parameters[pose_block + k];
+        Eigen::Vector3d Pj(pose_j[0], pose_j[1], pose_j[2]);
+        Eigen::Quaterniond Qj(pose_j[6], pose_j[3], pose_j[4], pose_j[5]);
+
+        const Eigen::Vector3d pts_j_td = (with_td ? Eigen::Vector3d(obs.pts_j - (td - obs.td_j) * obs.velocity_j) : obs.pts_j);
+        const Eigen::Vector3d pts_imu_j = Qj.inverse() * (pts_w - Pj);
+        const Eigen::Vector3d pts_camera_j = qic_inv * (pts_imu_j - tic);
+        const double dep_j = pts_camera_j.z();
+        Eigen::Map<Eigen::Vector2d> residual(residuals + 2 * k);
+        residual = sqrt_info * ((pts_camera_j / dep_j).head<2>() - pts_j_td.head<2>());
+
+        if (!jacobians)
+            continue;
+
+        const Eigen::Matrix3d Rj_t = Qj.toRotationMatrix().transpose();
+        const Eigen::Matrix3d ric_t_Rj_t = ric_t * Rj_t;
+        Eigen::Matrix<double, 2, 3> reduce;
+        reduce << 1. / dep_j, 0, -pts_camera_j(0) / (dep_j * dep_j),
+            0, 1. / dep_j, -pts_camera_j(1) / (dep_j * dep_j);
+        reduce = sqrt_info * reduce;
+
+        if (jacobians[0])
+        {
+            Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 7, Eigen::RowMajor>> jacobian_pose_i(jacobians[0], num_res, 7);
+            Eigen::Matrix<double, 3, 6> jaco_i;
+            jaco_i.leftCols<3>() = ric_t_Rj_t;
+            jaco_i.rightCols<3>() = ric_t_Rj_t * Ri * -skew_imu_i;
+            jacobian_pose_i.block<2, 6>(2 * k, 0) = reduce * jaco_i;
+        }
+        if (jacobians[1])
+        {
+            Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 7, Eigen::RowMajor>> jacobian_ex_pose(jacobians[1], num_res, 7);
+            Eigen::Matrix<double, 3, 6> jaco_ex;
+            jaco_ex.leftCols<3>() = ric_t * (Rj_t * Ri - Eigen::Matrix3d::Identity());
+            Eigen::Matrix3d tmp_r = ric_t_Rj_t * Ri_ric;
+            jaco_ex.rightCols<3>() = -tmp_r * skew_camera_i + Utility::skewSymmetric(tmp_r * pts_camera_i) +
+                                     Utility::skewSymmetric(ric_t * (Rj_t * (Ri_tic_Pi - Pj) - tic));
+            jacobian_ex_pose.block<2, 6>(2 * k, 0) = reduce * jaco_ex;
+        }
+        if (jacobians[2])
+        {
+            Eigen::Map<Eigen::VectorXd> jacobian_feature(jacobians[2], num_res);
+            jacobian_feature.segment<2>(2 * k) = reduce * ric_t_Rj_t * dpw_dinv;
+        }
+        if (with_td && jacobians[3])
+        {
+            Eigen::Map<Eigen::VectorXd> jacobian_td(jacobians[3], num_res);
+            jacobian_td.segment<2>(2 * k) = reduce * ric_t_Rj_t * dpw_dtd + sqrt_info * obs.velocity_j.head<2>();
+        }
+        if (jacobians[pose_block + k])
+        {
+            Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 7, Eigen::RowMajor>> jacobian_pose_j(jacobians[pose_block + k], num_res, 7);
+            jacobian_pose_j.setZero();
+            Eigen::Matrix<double, 3, 6> jaco_j;
+            jaco_j.leftCols<3>() = -ric_t_Rj_t;
+            jaco_j.rightCols<3>() = ric_t * Utility::skewSymmetric(pts_imu_j);
+            jacobian_pose_j.block<2, 6>(2 * k, 0) = reduce * jaco_j;
+        }
+    }
+    return true;
+}
+
+void ProjectionTrackFactor::packedResiduals(double const *const *parameters, const Eigen::Vector3d &pts_w,
+                                            const Eigen::Matrix3d &ric_t, const Eigen::Vector3d &tic, double td,
+                                            const Eigen::Matrix2d &sqrt_info, double *residuals) const
+{
+    const int pose_block = first_pose_block();
+    const int num_obs = static_cast<int>(observations.size());
+    const int num_packed = (num_obs + FloatPack::SIZE - 1) / FloatPack::SIZE * FloatPack::SIZE;
+
+    // SoA per observation: pts_w - Pj (subtracted in double, the difference is small) and Qj,
+    // the padding lanes hold a valid identity rotation
+    float dx[PACKED_CAPACITY], dy[PACKED_CAPACITY], dz[PACKED_CAPACITY];
+    float qx[PACKED_CAPACITY], qy[PACKED_CAPACITY], qz[PACKED_CAPACITY], qw[PACKED_CAPACITY];
+    for (int k = 0; k < num_packed; ++k)
+    {
+        if (k >= num_obs)
+        {
+            dx[k] = dy[k] = qx[k] = qy[k] = qz[k] = 0.0f;
+            dz[k] = qw[k] = 1.0f;
+            continue;
+        }
+        const double *pose_j = parameters[pose_block + k];
+        dx[k] = static_cast<float>(pts_w.x() - pose_j[0]);
+        dy[k] = static_cast<float>(pts_w.y() - pose_j[1]);
+        dz[k] = static_cast<float>(pts_w.z() - pose_j[2]);
+        qx[k] = static_cast<float>(pose_j[3]);
+        qy[k] = static_cast<float>(pose_j[4]);
+        qz[k] = static_cast<float>(pose_j[5]);
+        qw[k] = static_cast<float>(pose_j[6]);
+    }
+
+    // pts_camera_j = ric^T * (Qj^-1 * (pts_w - Pj)) - ric^T * tic
+    const Eigen::Vector3d t_ci = -ric_t * tic;
+    FloatPack R[3][3], t[3];
+    for (int r = 0; r < 3; ++r)
+    {
+        for (int c = 0; c < 3; ++c)
+            R[r][c] = FloatPack::broadcast(static_cast<float>(ric_t(r, c)));
+        t[r] = FloatPack::broadcast(static_cast<float>(t_ci(r)));
+    }
+    const FloatPack two = FloatPack::broadcast(2.0f);
+    float cx[PACKED_CAPACITY], cy[PACKED_CAPACITY], cz[PACKED_CAPACITY];
+    for (int k = 0; k < num_packed; k += FloatPack::SIZE)
+    {
+        const FloatPack vx = FloatPack::load(dx + k), vy = FloatPack::load(dy + k), vz = FloatPack::load(dz + k);
+        const FloatPack ux = FloatPack::load(qx + k), uy = FloatPack::load(qy + k), uz = FloatPack::load(qz + k);
+        const FloatPack w = FloatPack::load(qw + k);
+        // rotation by the conjugate of a unit quaternion: t = 2 v x u, v' = v + w t + t x u
+        const FloatPack tx = two * (vy * uz - vz * uy);
+        const FloatPack ty = two * (vz * ux - vx * uz);
+        const FloatPack tz = two * (vx * uy - vy * ux);
+        const FloatPack ix = vx + w * tx + (ty * uz - tz * uy);
+        const FloatPack iy = vy + w * ty + (tz * ux - tx * uz);
+        const FloatPack iz = vz + w * tz + (tx * uy - ty * ux);
+        (R[0][0] * ix + R[0][1] * iy + R[0][2] * iz + t[0]).store(cx + k);
+        (R[1][0] * ix + R[1][1] * iy + R[1][2] * iz + t[1]).store(cy + k);
+        (R[2][0] * ix + R[2][1] * iy + R[2][2] * iz + t[2]).store(cz + k);
+    }
+
+    for (int k = 0; k < num_obs; ++k)
+    {
+        const Observation &obs = observations[k];
+        const Eigen::Vector3d pts_j_td = (with_td ? Eigen::Vector3d(obs.pts_j - (td - obs.td_j) * obs.velocity_j) : obs.pts_j);
+        const double dep_j = cz[k];
+        Eigen::Map<Eigen::Vector2d> residual(residuals + 2 * k);
+        residual = sqrt_info * (Eigen::Vector2d(cx[k] / dep_j, cy[k] / dep_j) - pts_j_td.head<2>());
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+#include <ceres/ceres.h>
+#include <Eigen/Dense>
+#include "../utility/utility.h"
+#include "../utility/tic_toc.h"
+#include "../parameters.h"
+
+/**
+ * 一个特征在窗口内的所有观测合并为一个代价函数, 起始帧一侧的反投影/世界坐标/外参变换每次 Evaluate 只算一次
+ * 残差按观测依次排列 [r_0, r_1, ...], 每个观测与 ProjectionFactor (with_td 时 ProjectionTdFactor) 的残差相同
+ * 鲁棒核作用在整条轨迹的残差上, 即按特征而不是按观测降权
+ *
+ *  parameters[0]: pose of the start frame i
+ *  parameters[1]: camera-IMU extrinsic
+ *  parameters[2]: inverse depth in frame i
+ *  parameters[3]: td, only with with_td
+ *  parameters[first_pose_block() + k]: pose of the frame of observation k
+ *
+ * 所有观测须在加入 ceres::Problem 之前 addObservation
+ * packed_evaluation 时只求残差的 Evaluate (ceres 的试探步) 按观测打包批量计算: pts_w - Pj 用 double,
+ * 到相机 j 的旋转用 float 的 SIMD 包, 投影和残差用 double; 误差在 1e-4 像素量级, 远低于 ceres 的函数容差.
+ * 求雅可比的 Evaluate 仍全部用 double
+ */
+class ProjectionTrackFactor : public ceres::CostFunction
+{
+  public:
+    ProjectionTrackFactor(const Eigen::Vector3d &_pts_i, const Eigen::Vector2d &_velocity_i, double _td_i, bool _with_td);
+    void addObservation(const Eigen::Vector3d &pts_j, const Eigen::Vector2d &velocity_j, double td_j);
+    virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const;
+
+    int first_pose_block() const { return with_td ? 4 : 3; }
+    size_t num_observations() const { return observations.size(); }
+
+    static bool packed_evaluation;
+
+  private:
+    struct Observation
+    {
+        Eigen::Vector3d pts_j;
+        Eigen::Vector3d velocity_j;
+        double td_j;
+    };
+
+    void packedResiduals(double const *const *parameters, const Eigen::Vector3d &pts_w, const Eigen::Matrix3d &ric_t,
+                         const Eigen::Vector3d &tic, double td, const Eigen::Matrix2d &sqrt_info, double *residuals) const;
+
+    Eigen::Vector3d pts_i, velocity_i;
+    double td_i;
+    bool with_td;
+    std::vector<Observation> observations;
+};
@@ -0,0 +1,104 @@
+#include "structureless_track_factor.h"
+
+#include <cmath>
+
+StructurelessTrackFactor::StructurelessTrackFactor(const Eigen::Vector3d &_pts_i, const Eigen::Vector2d &_velocity_i,
+                                                   double _td_i, bool _with_td, double _inv_dep_i)
+    : track(_pts_i, _velocity_i, _td_i, _with_td), with_td(_with_td), inv_dep_i(_inv_dep_i)
+{
+    std::vector<int> *block_sizes = mutable_parameter_block_sizes();
+    *block_sizes = std::vector<int>{7, 7};
+    if (with_td)
+        block_sizes->push_back(1);
+    set_num_residuals(0);
+}
+
+void StructurelessTrackFactor::addObservation(const Eigen::Vector3d &pts_j, const Eigen::Vector2d &velocity_j, double td_j)
+{
+    track.addObservation(pts_j, velocity_j, td_j);
+    mutable_parameter_block_sizes()->push_back(7);
+    set_num_residuals(static_cast<int>(2 * track.num_observations() - 1));
+}
+
+void StructurelessTrackFactor::trackParameters(double const *const *parameters, const double *inv_dep,
+                                               std::vector<const double *> &track_parameters) const
+{
+    const int num_blocks = static_cast<int>(parameter_block_sizes().size());
+    track_parameters.assign(parameters, parameters + num_blocks);
+    track_parameters.insert(track_parameters.begin() + 2, inv_dep);
+}
+
+double StructurelessTrackFactor::inverseDepth(double const *const *parameters) const
+{
+    const int num_res = 2 * static_cast<int>(track.num_observations());
+    const int num_track_blocks = static_cast<int>(parameter_block_sizes().size()) + 1;
+    Eigen::VectorXd r(num_res), J_l(num_res);
+    std::vector<double *> track_jacobians(num_track_blocks, nullptr);
+    track_jacobians[2] = J_l.data();
+
+    double inv_dep = inv_dep_i;
+    std::vector<const double *> track_parameters;
+    trackParameters(parameters, &inv_dep, track_parameters);
+    for (int iter = 0; iter < DEPTH_ITERATIONS; iter++)
+    {
+        track.Evaluate(track_parameters.data(), r.data(), track_jacobians.data());
+        const double information = J_l.squaredNorm();
+        if (!(information > 0))
+            break;
+        const double updated = inv_dep - J_l.dot(r) / information;
+        // behind the camera or unobservable, keep the last estimate
+        if (!std::isfinite(updated) || updated <= 0)
+            break;
+        inv_dep = updated;
+    }
+    return inv_dep;
+}
+
+bool StructurelessTrackFactor::Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
+{
+    const int num_res = 2 * static_cast<int>(track.num_observations());
+    const int num_blocks = static_cast<int>(parameter_block_sizes().size());
+
+    double inv_dep = inverseDepth(parameters);
+    std::vector<const double *> track_parameters;
+    trackParameters(parameters, &inv_dep, track_parameters);
+
+    typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrix;
+    Eigen::VectorXd r(num_res), J_l(num_res);
+    std::vector<RowMatrix> J(num_blocks);
+    std::vector<double *> track_jacobians(num_blocks + 1, nullptr);
+    track_jacobians[2] = J_l.data();
+    for (int b = 0; jacobians && b < num_blocks; b++)
+    {
+        if (!jacobians[b])
+            continue;
+        J[b].resize(num_res, parameter_block_sizes()[b]);
+        track_jacobians[b < 2 ? b : b + 1] = J[b].data();
+    }
+    if (!track.Evaluate(track_parameters.data(), r.data(), track_jacobians.data()))
+        return false;
+
+    // Householder reflection H = I - 2 v v^T / v^T v mapping J_l onto the first axis,
+    // the other rows of H span the left null space of J_l
+    Eigen::VectorXd v = J_l;
+    const double norm = J_l.norm();
+    if (norm > 1e-12)
+        v(0) += (J_l(0) >= 0 ? norm : -norm);
+    else
+    {
+        v.setZero();
+        v(0) = 1.0;
+    }
+    const double beta = 2.0 / v.squaredNorm();
+
+    Eigen::Map<Eigen::VectorXd> residual(residuals, num_res - 1);
+    residual = (r - beta * v * v.dot(r)).tail(num_res - 1);
+    for (int b = 0; jacobians && b < num_blocks; b++)
+    {
+        if (!jacobians[b])
+            continue;
+        Eigen::Map<RowMatrix> jacobian(jacobians[b], num_res - 1, parameter_block_sizes()[b]);
+        jacobian = (J[b] - beta * v * (v.transpose() * J[b])).bottomRows(num_res - 1);
+    }
+    return true;
+}
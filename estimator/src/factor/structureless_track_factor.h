@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <ceres/ceres.h>
+#include <Eigen/Dense>
+#include "projection_track_factor.h"
+
+/**
+ * 不含路标的视觉因子: 一个特征的所有观测 (ProjectionTrackFactor) 中逆深度被解析地消去, 只约束位姿/外参/td
+ * 每次 Evaluate 从构造时的逆深度出发, 在当前位姿下按一维 Gauss-Newton 求最优逆深度 (不修改自身, 可多线程求值),
+ * 再把残差和雅可比投影到逆深度雅可比 J_l 的左零空间 (Householder, MSCKF 的零空间投影): r' = N^T r, J' = N^T J,
+ * 残差维数 2m - 1. 最优逆深度处 J_l^T r = 0, 投影后的代价与消去路标后的代价一阶一致
+ *
+ *  parameters[0]: pose of the start frame i
+ *  parameters[1]: camera-IMU extrinsic
+ *  parameters[2]: td, only with with_td
+ *  parameters[first_pose_block() + k]: pose of the frame of observation k
+ *
+ * 所有观测须在加入 ceres::Problem 或 MarginalizationInfo 之前 addObservation
+ */
+class StructurelessTrackFactor : public ceres::CostFunction
+{
+  public:
+    StructurelessTrackFactor(const Eigen::Vector3d &_pts_i, const Eigen::Vector2d &_velocity_i, double _td_i,
+                             bool _with_td, double _inv_dep_i);
+    void addObservation(const Eigen::Vector3d &pts_j, const Eigen::Vector2d &velocity_j, double td_j);
+    virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const;
+
+    int first_pose_block() const { return with_td ? 3 : 2; }
+    // the inverse depth in frame i eliminated at these parameters, written back to the feature after the solve
+    double inverseDepth(double const *const *parameters) const;
+
+  private:
+    static const int DEPTH_ITERATIONS = 3;
+
+    // the parameters of track with the inverse depth block inserted
+    void trackParameters(double const *const *parameters, const double *inv_dep,
+                         std::vector<const double *> &track_parameters) const;
+
+    ProjectionTrackFactor track;
+    bool with_td;
+    double inv_dep_i;
+};
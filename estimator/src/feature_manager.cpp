@@ -1,12 +1,13 @@
 #include "feature_manager.h"
+#include "utility/worker_pool.h"
 
 int FeaturePerId::endFrame()
 {
     return start_frame + feature_per_frame.size() - 1;
 }
 
-FeatureManager::FeatureManager(Matrix3d _Rs[])
-    : Rs(_Rs)
+FeatureManager::FeatureManager(const WindowArray<Matrix3d, WINDOW_SIZE + 1> &_Rs, const EstimatorConfig &_config)
+    : Rs(_Rs), config(_config)
 {
     for (int i = 0; i < NUM_OF_CAM; i++)
         ric[i].setIdentity();
@@ -44,27 +45,23 @@ int FeatureManager::getFeatureCount()
 
 bool FeatureManager::addFeatureCheckParallax(int frame_count, const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image, double td)
 {
-    ROS_DEBUG("input feature: %d", (int)image.size());
-    ROS_DEBUG("num of feature: %d", getFeatureCount());
+    GVINS_DEBUG("input feature: %d", (int)image.size());
+    GVINS_DEBUG("num of feature: %d", getFeatureCount());
     double parallax_sum = 0;
     int parallax_num = 0;
     last_track_num = 0;
     for (auto &id_pts : image)
     {
         FeaturePerFrame f_per_fra(id_pts.second[0].second, td);
+        if (id_pts.second.size() > 1 && id_pts.second[1].first == 1)
+            f_per_fra.rightObservation(id_pts.second[1].second);
 
         int feature_id = id_pts.first;
-        auto it = find_if(feature.begin(), feature.end(), [feature_id](const FeaturePerId &it)
-                          {
-            return it.feature_id == feature_id;
-                          });
+        FeaturePerId *it = feature.find(feature_id);
 
-        if (it == feature.end())
-        {
-            feature.push_back(FeaturePerId(feature_id, frame_count));
-            feature.back().feature_per_frame.push_back(f_per_fra);
-        }
-        else if (it->feature_id == feature_id)
+        if (it == nullptr)
+            feature.add(feature_id, frame_count).feature_per_frame.push_back(f_per_fra);
+        else
         {
             it->feature_per_frame.push_back(f_per_fra);
             last_track_num++;
@@ -90,30 +87,30 @@ bool FeatureManager::addFeatureCheckParallax(int frame_count, const map<int, vec
     }
     else
     {
-        ROS_DEBUG("parallax_sum: %lf, parallax_num: %d", parallax_sum, parallax_num);
-        ROS_DEBUG("current parallax: %lf", parallax_sum / parallax_num * FOCAL_LENGTH);
-        return parallax_sum / parallax_num >= MIN_PARALLAX;
+        GVINS_DEBUG("parallax_sum: %lf, parallax_num: %d", parallax_sum, parallax_num);
+        GVINS_DEBUG("current parallax: %lf", parallax_sum / parallax_num * FOCAL_LENGTH);
+        return parallax_sum / parallax_num >= config.MIN_PARALLAX;
     }
 }
 
 void FeatureManager::debugShow()
 {
-    ROS_DEBUG("debug show");
+    GVINS_DEBUG("debug show");
     for (auto &it : feature)
     {
-        ROS_ASSERT(it.feature_per_frame.size() != 0);
-        ROS_ASSERT(it.start_frame >= 0);
-        ROS_ASSERT(it.used_num >= 0);
+        GVINS_ASSERT(it.feature_per_frame.size() != 0);
+        GVINS_ASSERT(it.start_frame >= 0);
+        GVINS_ASSERT(it.used_num >= 0);
 
-        ROS_DEBUG("%d,%d,%d ", it.feature_id, it.used_num, it.start_frame);
+        GVINS_DEBUG("%d,%d,%d ", it.feature_id, it.used_num, it.start_frame);
         int sum = 0;
         for (auto &j : it.feature_per_frame)
         {
-            ROS_DEBUG("%d,", int(j.is_used));
+            GVINS_DEBUG("%d,", int(j.is_used));
             sum += j.is_used;
             printf("(%lf,%lf) ",j.point(0), j.point(1));
         }
-        ROS_ASSERT(it.used_num == sum);
+        GVINS_ASSERT(it.used_num == sum);
     }
 }
 
@@ -138,7 +135,7 @@ vector<pair<Vector3d, Vector3d>> FeatureManager::getCorresponding(int frame_coun
     return corres;
 }
 
-void FeatureManager::setDepth(const VectorXd &x)
+void FeatureManager::setInverseDepths(const double (*inv_depths)[SIZE_FEATURE])
 {
     int feature_index = -1;
     for (auto &it_per_id : feature)
@@ -147,8 +144,8 @@ void FeatureManager::setDepth(const VectorXd &x)
         if (!(it_per_id.used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
             continue;
 
-        it_per_id.estimated_depth = 1.0 / x(++feature_index);
-        //ROS_INFO("feature id %d , start_frame %d, depth %f ", it_per_id->feature_id, it_per_id-> start_frame, it_per_id->estimated_depth);
+        it_per_id.estimated_depth = 1.0 / inv_depths[++feature_index][0];
+        //GVINS_INFO("feature id %d , start_frame %d, depth %f ", it_per_id->feature_id, it_per_id-> start_frame, it_per_id->estimated_depth);
         if (it_per_id.estimated_depth < 0)
         {
             it_per_id.solve_flag = 2;
@@ -160,13 +157,7 @@ void FeatureManager::setDepth(const VectorXd &x)
 
 void FeatureManager::removeFailures()
 {
-    for (auto it = feature.begin(), it_next = feature.begin();
-         it != feature.end(); it = it_next)
-    {
-        it_next++;
-        if (it->solve_flag == 2)
-            feature.erase(it);
-    }
+    feature.removeIf([](const FeaturePerId &it) { return it.solve_flag == 2; });
 }
 
 void FeatureManager::clearDepth(const VectorXd &x)
@@ -199,86 +190,186 @@ VectorXd FeatureManager::getDepthVector()
     return dep_vec;
 }
 
-void FeatureManager::triangulate(Vector3d Ps[], Vector3d tic[], Matrix3d ric[])
+void FeatureManager::getInverseDepths(double (*inv_depths)[SIZE_FEATURE])
 {
+    int feature_index = -1;
     for (auto &it_per_id : feature)
     {
         it_per_id.used_num = it_per_id.feature_per_frame.size();
         if (!(it_per_id.used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
             continue;
+        inv_depths[++feature_index][0] = 1. / it_per_id.estimated_depth;
+    }
+}
 
-        if (it_per_id.estimated_depth > 0)
-            continue;
-        int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
-
-        ROS_ASSERT(NUM_OF_CAM == 1);
-        Eigen::MatrixXd svd_A(2 * it_per_id.feature_per_frame.size(), 4);
-        int svd_idx = 0;
-
-        Eigen::Matrix<double, 3, 4> P0;
-        Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[0];
-        Eigen::Matrix3d R0 = Rs[imu_i] * ric[0];
-        P0.leftCols<3>() = Eigen::Matrix3d::Identity();
-        P0.rightCols<1>() = Eigen::Vector3d::Zero();
+namespace
+{
+    // features per parallelFor job
+    const int TRIANGULATION_BATCH = 16;
+
+    /**
+     * DLT 三角化: 每个观测的两行约束直接累加到 4x4 正规矩阵 A^T A, 其最小特征值对应的特征向量
+     * 即 svd(A) 的最后一个右奇异向量; 不再为每个特征分配 2n x 4 的动态矩阵
+     * 返回最小两个奇异值之比, 越接近 1 零空间越不确定 (视差太小或观测太少)
+     */
+    double triangulateFeature(FeaturePerId &it_per_id, const Vector3d t_cam[], const Matrix3d R_cam[], double init_depth)
+    {
+        const int imu_i = it_per_id.start_frame;
+        const Vector3d &t0 = t_cam[imu_i];
+        const Matrix3d &R0 = R_cam[imu_i];
 
-        for (auto &it_per_frame : it_per_id.feature_per_frame)
+        Matrix4d normal = Matrix4d::Zero();
+        int imu_j = imu_i;
+        for (const FeaturePerFrame &it_per_frame : it_per_id.feature_per_frame)
         {
-            imu_j++;
-
-            Eigen::Vector3d t1 = Ps[imu_j] + Rs[imu_j] * tic[0];
-            Eigen::Matrix3d R1 = Rs[imu_j] * ric[0];
-            Eigen::Vector3d t = R0.transpose() * (t1 - t0);
-            Eigen::Matrix3d R = R0.transpose() * R1;
+            const Vector3d t = R0.transpose() * (t_cam[imu_j] - t0);
+            const Matrix3d R = R0.transpose() * R_cam[imu_j];
             Eigen::Matrix<double, 3, 4> P;
             P.leftCols<3>() = R.transpose();
             P.rightCols<1>() = -R.transpose() * t;
-            Eigen::Vector3d f = it_per_frame.point.normalized();
-            svd_A.row(svd_idx++) = f[0] * P.row(2) - f[2] * P.row(0);
-            svd_A.row(svd_idx++) = f[1] * P.row(2) - f[2] * P.row(1);
-
-            if (imu_i == imu_j)
-                continue;
+            const Vector3d f = it_per_frame.point.normalized();
+            const Eigen::RowVector4d row_0 = f[0] * P.row(2) - f[2] * P.row(0);
+            const Eigen::RowVector4d row_1 = f[1] * P.row(2) - f[2] * P.row(1);
+            normal.noalias() += row_0.transpose() * row_0 + row_1.transpose() * row_1;
+            ++imu_j;
         }
-        ROS_ASSERT(svd_idx == svd_A.rows());
-        Eigen::Vector4d svd_V = Eigen::JacobiSVD<Eigen::MatrixXd>(svd_A, Eigen::ComputeThinV).matrixV().rightCols<1>();
-        double svd_method = svd_V[2] / svd_V[3];
-        //it_per_id->estimated_depth = -b / A;
-        //it_per_id->estimated_depth = svd_V[2] / svd_V[3];
-
-        it_per_id.estimated_depth = svd_method;
-        //it_per_id->estimated_depth = INIT_DEPTH;
 
+        Eigen::SelfAdjointEigenSolver<Matrix4d> solver(normal);
+        const Vector4d &eigenvalues = solver.eigenvalues();
+        const Vector4d svd_V = solver.eigenvectors().col(0);
+        it_per_id.estimated_depth = svd_V[2] / svd_V[3];
         if (it_per_id.estimated_depth < 0.1)
-        {
-            it_per_id.estimated_depth = INIT_DEPTH;
-        }
+            it_per_id.estimated_depth = init_depth;
+        return eigenvalues[1] > 0 ? std::sqrt(std::max(eigenvalues[0], 0.0) / eigenvalues[1]) : 1.0;
+    }
+}
 
+void FeatureManager::triangulate(const WindowArray<Vector3d, WINDOW_SIZE + 1> &Ps, Vector3d tic[], Matrix3d ric[])
+{
+    // camera 0 only, camera 1 is used for the stereo initialization
+    vector<FeaturePerId *> pending;
+    for (auto &it_per_id : feature)
+    {
+        it_per_id.used_num = it_per_id.feature_per_frame.size();
+        if (!(it_per_id.used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
+            continue;
+
+        if (it_per_id.estimated_depth > 0)
+            continue;
+        pending.push_back(&it_per_id);
     }
+    if (pending.empty())
+        return;
+
+    // camera poses once per call, not once per observation
+    Vector3d t_cam[WINDOW_SIZE + 1];
+    Matrix3d R_cam[WINDOW_SIZE + 1];
+    for (int i = 0; i <= WINDOW_SIZE; i++)
+    {
+        t_cam[i] = Ps[i] + Rs[i] * tic[0];
+        R_cam[i] = Rs[i] * ric[0];
+    }
+
+    const int num_pending = static_cast<int>(pending.size());
+    WorkerPool::instance().parallelFor((num_pending + TRIANGULATION_BATCH - 1) / TRIANGULATION_BATCH, [&](int job)
+    {
+        const int end = std::min(num_pending, (job + 1) * TRIANGULATION_BATCH);
+        for (int k = job * TRIANGULATION_BATCH; k < end; ++k)
+            pending[k]->triangulation_ratio = triangulateFeature(*pending[k], t_cam, R_cam, config.INIT_DEPTH);
+    });
+    GVINS_DEBUG("triangulated %d features", num_pending);
 }
 
-void FeatureManager::removeOutlier()
+/**
+ * 按信息量挑选参与优化的特征, 其余特征仍然保留在窗口里继续跟踪, 只是本帧不加入 problem:
+ *   得分 = sqrt(观测数) * 视差项 * 残差项
+ *   视差项: 首末观测经旋转补偿后的视差 (像素), 在 LANDMARK_FULL_PARALLAX 处饱和, 纯旋转/远点也保留一个下限
+ *   残差项: 用当前状态把起始帧的点投影到最新帧, 与观测之差 (像素) 的滑动平均越大得分越低
+ * 图像按 LANDMARK_GRID 划分网格, 先从每个格子取得分最高的, 再取每格第二高的, 依此类推, 保证空间覆盖
+ */
+int FeatureManager::selectLandmarks(int max_features, const WindowArray<Vector3d, WINDOW_SIZE + 1> &Ps, Vector3d tic[], Matrix3d ric[])
 {
-    ROS_BREAK();
-    int i = -1;
-    for (auto it = feature.begin(), it_next = feature.begin();
-         it != feature.end(); it = it_next)
+    const double LANDMARK_FULL_PARALLAX = 20.0;     // px
+    const double LANDMARK_RESIDUAL_SCALE = 2.0;     // px
+    const int LANDMARK_GRID_COLS = 8, LANDMARK_GRID_ROWS = 6;
+
+    struct Candidate
     {
-        it_next++;
-        i += it->used_num != 0;
-        if (it->used_num != 0 && it->is_outlier == true)
+        FeaturePerId *feature;
+        double score;
+        int cell, rank;
+    };
+    vector<Candidate> candidates;
+    for (auto &it_per_id : feature)
+    {
+        it_per_id.used_num = it_per_id.feature_per_frame.size();
+        it_per_id.selected = true;
+        if (!(it_per_id.used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
+            continue;
+        Candidate c;
+        c.feature = &it_per_id;
+        c.score = 0;
+        c.rank = 0;
+        c.cell = 0;
+        candidates.push_back(c);
+    }
+    if (max_features <= 0 || static_cast<int>(candidates.size()) <= max_features)
+        return static_cast<int>(candidates.size());
+
+    vector<int> cell_count(LANDMARK_GRID_COLS * LANDMARK_GRID_ROWS, 0);
+    for (Candidate &c : candidates)
+    {
+        FeaturePerId &it_per_id = *c.feature;
+        const FeaturePerFrame &first = it_per_id.feature_per_frame.front();
+        const FeaturePerFrame &last = it_per_id.feature_per_frame.back();
+        const int imu_i = it_per_id.start_frame, imu_j = it_per_id.endFrame();
+        const Matrix3d R_i = Rs[imu_i] * ric[0], R_j = Rs[imu_j] * ric[0];
+
+        // rotation compensated parallax between the first and the newest observation
+        const Vector3d f_i = R_j.transpose() * R_i * first.point;
+        const double parallax = (f_i.head<2>() / f_i.z() - last.point.head<2>()).norm() * FOCAL_LENGTH;
+        const double parallax_term = 0.1 + std::min(parallax / LANDMARK_FULL_PARALLAX, 1.0);
+
+        double residual_term = 1.0;
+        if (it_per_id.estimated_depth > 0)
         {
-            feature.erase(it);
+            const Vector3d w_pts = R_i * (first.point * it_per_id.estimated_depth) + Rs[imu_i] * tic[0] + Ps[imu_i];
+            const Vector3d pts_j = R_j.transpose() * (w_pts - Ps[imu_j] - Rs[imu_j] * tic[0]);
+            const double residual = pts_j.z() > 0 ?
+                (pts_j.head<2>() / pts_j.z() - last.point.head<2>()).norm() * FOCAL_LENGTH : 10.0 * LANDMARK_RESIDUAL_SCALE;
+            it_per_id.residual_history = (it_per_id.residual_history < 0 ? residual : 0.7 * it_per_id.residual_history + 0.3 * residual);
+            const double r = it_per_id.residual_history / LANDMARK_RESIDUAL_SCALE;
+            residual_term = 1.0 / (1.0 + r * r);
         }
+        c.score = std::sqrt(static_cast<double>(it_per_id.used_num)) * parallax_term * residual_term;
+
+        const int col = std::min(std::max(static_cast<int>(last.uv.x() / config.COL * LANDMARK_GRID_COLS), 0), LANDMARK_GRID_COLS - 1);
+        const int row = std::min(std::max(static_cast<int>(last.uv.y() / ROW * LANDMARK_GRID_ROWS), 0), LANDMARK_GRID_ROWS - 1);
+        c.cell = row * LANDMARK_GRID_COLS + col;
     }
+
+    // rank within the cell, then take the best of every cell before the second best of any
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) { return a.score > b.score; });
+    for (Candidate &c : candidates)
+        c.rank = cell_count[c.cell]++;
+    std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) { return a.rank < b.rank; });
+    for (size_t k = max_features; k < candidates.size(); ++k)
+        candidates[k].feature->selected = false;
+    GVINS_DEBUG("selected %d of %d landmarks", max_features, static_cast<int>(candidates.size()));
+    return max_features;
+}
+
+void FeatureManager::removeOutlier()
+{
+    GVINS_BREAK();
+    feature.removeIf([](const FeaturePerId &it) { return it.used_num != 0 && it.is_outlier == true; });
 }
 
 void FeatureManager::removeBackShiftDepth(Eigen::Matrix3d marg_R, Eigen::Vector3d marg_P, Eigen::Matrix3d new_R, Eigen::Vector3d new_P)
 {
-    for (auto it = feature.begin(), it_next = feature.begin();
-         it != feature.end(); it = it_next)
+    feature.removeIf([&](FeaturePerId &feature_per_id)
     {
-        it_next++;
-
+        FeaturePerId *it = &feature_per_id;
         if (it->start_frame != 0)
             it->start_frame--;
         else
@@ -286,10 +377,7 @@ void FeatureManager::removeBackShiftDepth(Eigen::Matrix3d marg_R, Eigen::Vector3
             Eigen::Vector3d uv_i = it->feature_per_frame[0].point;  
             it->feature_per_frame.erase(it->feature_per_frame.begin());
             if (it->feature_per_frame.size() < 2)
-            {
-                feature.erase(it);
-                continue;
-            }
+                return true;
             else
             {
                 Eigen::Vector3d pts_i = uv_i * it->estimated_depth;
@@ -299,7 +387,7 @@ void FeatureManager::removeBackShiftDepth(Eigen::Matrix3d marg_R, Eigen::Vector3
                 if (dep_j > 0)
                     it->estimated_depth = dep_j;
                 else
-                    it->estimated_depth = INIT_DEPTH;
+                    it->estimated_depth = config.INIT_DEPTH;
             }
         }
         // remove tracking-lost feature after marginalize
@@ -309,47 +397,43 @@ void FeatureManager::removeBackShiftDepth(Eigen::Matrix3d marg_R, Eigen::Vector3
             feature.erase(it);
         }
         */
-    }
+        return false;
+    });
 }
 
 void FeatureManager::removeBack()
 {
-    for (auto it = feature.begin(), it_next = feature.begin();
-         it != feature.end(); it = it_next)
+    feature.removeIf([](FeaturePerId &it)
     {
-        it_next++;
-
-        if (it->start_frame != 0)
-            it->start_frame--;
+        if (it.start_frame != 0)
+            it.start_frame--;
         else
         {
-            it->feature_per_frame.erase(it->feature_per_frame.begin());
-            if (it->feature_per_frame.size() == 0)
-                feature.erase(it);
+            it.feature_per_frame.erase(it.feature_per_frame.begin());
+            return it.feature_per_frame.size() == 0;
         }
-    }
+        return false;
+    });
 }
 
 void FeatureManager::removeFront(int frame_count)
 {
-    for (auto it = feature.begin(), it_next = feature.begin(); it != feature.end(); it = it_next)
+    feature.removeIf([frame_count](FeaturePerId &it)
     {
-        it_next++;
-
-        if (it->start_frame == frame_count)
+        if (it.start_frame == frame_count)
         {
-            it->start_frame--;
+            it.start_frame--;
         }
         else
         {
-            int j = WINDOW_SIZE - 1 - it->start_frame;
-            if (it->endFrame() < frame_count - 1)
-                continue;
-            it->feature_per_frame.erase(it->feature_per_frame.begin() + j);
-            if (it->feature_per_frame.size() == 0)
-                feature.erase(it);
+            int j = WINDOW_SIZE - 1 - it.start_frame;
+            if (it.endFrame() < frame_count - 1)
+                return false;
+            it.feature_per_frame.erase(it.feature_per_frame.begin() + j);
+            return it.feature_per_frame.size() == 0;
         }
-    }
+        return false;
+    });
 }
 
 double FeatureManager::compensatedParallax2(const FeaturePerId &it_per_id, int frame_count)
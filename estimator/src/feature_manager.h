@@ -1,23 +1,25 @@
 #ifndef FEATURE_MANAGER_H
 #define FEATURE_MANAGER_H
 
-#include <list>
 #include <algorithm>
 #include <vector>
 #include <numeric>
+#include <unordered_map>
 using namespace std;
 
 #include <eigen3/Eigen/Dense>
 using namespace Eigen;
 
-#include <ros/console.h>
-#include <ros/assert.h>
+#include <gvins_feature_tracker/log.h>
 
 #include "parameters.h"
+#include "utility/window_array.h"
+#include "utility/fixed_vector.h"
 
 class FeaturePerFrame
 {
   public:
+    FeaturePerFrame() : cur_td(0), is_used(false), is_stereo(false) {}
     FeaturePerFrame(const Eigen::Matrix<double, 7, 1> &_point, double td)
     {
         point.x() = _point(0);
@@ -28,47 +30,121 @@ class FeaturePerFrame
         velocity.x() = _point(5); 
         velocity.y() = _point(6); 
         cur_td = td;
+        is_used = false;
+        is_stereo = false;
+    }
+    void rightObservation(const Eigen::Matrix<double, 7, 1> &_point)
+    {
+        point_right = _point.head<3>();
+        is_stereo = true;
     }
     double cur_td;
     Vector3d point;
     Vector2d uv;
     Vector2d velocity;
-    double z;
     bool is_used;
-    double parallax;
-    MatrixXd A;
-    VectorXd b;
-    double dep_gradient;
+    bool is_stereo;             // camera 1 saw the feature in this frame too (stereo_track)
+    Vector3d point_right;       // normalized plane of camera 1
 };
 
 class FeaturePerId
 {
   public:
-    const int feature_id;
+    int feature_id;
     int start_frame;
-    vector<FeaturePerFrame> feature_per_frame;
+    // one observation per frame from start_frame on, at most the whole window
+    FixedVector<FeaturePerFrame, WINDOW_SIZE + 1> feature_per_frame;
 
     int used_num;
     bool is_outlier;
     bool is_margin;
     double estimated_depth;
     int solve_flag; // 0 haven't solve yet; 1 solve succ; 2 solve fail;
-
-    Vector3d gt_p;
+    double triangulation_ratio; // smallest/second singular value of the last triangulation, near 1 is poorly constrained
+    bool selected;              // optimized in this frame, see FeatureManager::selectLandmarks
+    double residual_history;    // moving average of the reprojection error in the newest observation (px)
 
     FeaturePerId(int _feature_id, int _start_frame)
         : feature_id(_feature_id), start_frame(_start_frame),
-          used_num(0), estimated_depth(-1.0), solve_flag(0)
+          used_num(0), is_outlier(false), is_margin(false), estimated_depth(-1.0), solve_flag(0), triangulation_ratio(1.0),
+          selected(true), residual_history(-1.0)
     {
     }
 
     int endFrame();
 };
 
+/**
+ * 特征按加入顺序连续存放在 vector 中, feature_id 到下标的哈希索引使关联为 O(1);
+ * removeIf 保序压缩并更新索引, 不在遍历中逐个删除. 遍历顺序与原来的 list 相同,
+ * 因此 getDepthVector/getInverseDepths/setInverseDepths/optimization 中的 feature_index 编号不变
+ */
+class FeatureStore
+{
+  public:
+    typedef vector<FeaturePerId>::iterator iterator;
+    typedef vector<FeaturePerId>::const_iterator const_iterator;
+
+    FeatureStore() { slots.reserve(NUM_OF_F); index.reserve(NUM_OF_F); }
+
+    iterator begin() { return slots.begin(); }
+    iterator end() { return slots.end(); }
+    const_iterator begin() const { return slots.begin(); }
+    const_iterator end() const { return slots.end(); }
+    size_t size() const { return slots.size(); }
+    bool empty() const { return slots.empty(); }
+
+    void clear()
+    {
+        slots.clear();
+        index.clear();
+    }
+
+    // nullptr if the feature is not in the window
+    FeaturePerId *find(int feature_id)
+    {
+        auto it = index.find(feature_id);
+        return it == index.end() ? nullptr : &slots[it->second];
+    }
+
+    FeaturePerId &add(int feature_id, int start_frame)
+    {
+        index[feature_id] = static_cast<int>(slots.size());
+        slots.emplace_back(feature_id, start_frame);
+        return slots.back();
+    }
+
+    // drops every feature pred returns true for, the others keep their order
+    template <typename Pred>
+    void removeIf(Pred pred)
+    {
+        size_t kept = 0;
+        for (size_t k = 0; k < slots.size(); ++k)
+        {
+            if (pred(slots[k]))
+            {
+                index.erase(slots[k].feature_id);
+                continue;
+            }
+            if (kept != k)
+            {
+                slots[kept] = std::move(slots[k]);
+                index[slots[kept].feature_id] = static_cast<int>(kept);
+            }
+            ++kept;
+        }
+        slots.erase(slots.begin() + kept, slots.end());
+    }
+
+  private:
+    vector<FeaturePerId> slots;
+    std::unordered_map<int, int> index;
+};
+
 class FeatureManager
 {
   public:
-    FeatureManager(Matrix3d _Rs[]);
+    FeatureManager(const WindowArray<Matrix3d, WINDOW_SIZE + 1> &_Rs, const EstimatorConfig &_config);
 
     void setRic(Matrix3d _ric[]);
 
@@ -81,21 +157,26 @@ class FeatureManager
     vector<pair<Vector3d, Vector3d>> getCorresponding(int frame_count_l, int frame_count_r);
 
     //void updateDepth(const VectorXd &x);
-    void setDepth(const VectorXd &x);
     void removeFailures();
     void clearDepth(const VectorXd &x);
     VectorXd getDepthVector();
-    void triangulate(Vector3d Ps[], Vector3d tic[], Matrix3d ric[]);
+    // inverse depths read from/written to the ceres parameter blocks (para_Feature) directly, without a temporary vector
+    void getInverseDepths(double (*inv_depths)[SIZE_FEATURE]);
+    void setInverseDepths(const double (*inv_depths)[SIZE_FEATURE]);
+    void triangulate(const WindowArray<Vector3d, WINDOW_SIZE + 1> &Ps, Vector3d tic[], Matrix3d ric[]);
+    // marks at most max_features optimizable features as selected, 0 selects all; returns the number selected
+    int selectLandmarks(int max_features, const WindowArray<Vector3d, WINDOW_SIZE + 1> &Ps, Vector3d tic[], Matrix3d ric[]);
     void removeBackShiftDepth(Eigen::Matrix3d marg_R, Eigen::Vector3d marg_P, Eigen::Matrix3d new_R, Eigen::Vector3d new_P);
     void removeBack();
     void removeFront(int frame_count);
     void removeOutlier();
-    list<FeaturePerId> feature;
+    FeatureStore feature;
     int last_track_num;
 
   private:
     double compensatedParallax2(const FeaturePerId &it_per_id, int frame_count);
-    const Matrix3d *Rs;
+    const WindowArray<Matrix3d, WINDOW_SIZE + 1> &Rs;
+    const EstimatorConfig &config;      // of the owning Estimator
     Matrix3d ric[NUM_OF_CAM];
 };
 
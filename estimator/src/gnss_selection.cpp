@@ -0,0 +1,185 @@
+#include "gnss_selection.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <gnss_comm/gnss_spp.hpp>
+
+namespace
+{
+    // 3 position columns and one clock column per system
+    const int NUM_DOP_STATES = 7;
+    typedef Eigen::Matrix<double, NUM_DOP_STATES, 1> DopRow;
+    typedef Eigen::Matrix<double, NUM_DOP_STATES, NUM_DOP_STATES> DopMatrix;
+
+    int clockColumn(uint32_t sys)
+    {
+        switch (sys)
+        {
+            case SYS_GPS: return 3;
+            case SYS_GLO: return 4;
+            case SYS_GAL: return 5;
+            default:      return 6;
+        }
+    }
+
+    // normal matrix of the satellites in use, systems without satellites get a unit diagonal so it stays invertible
+    DopMatrix normalMatrix(const std::vector<DopRow> &rows, const std::vector<double> &weights,
+                           const std::vector<bool> &in_use, bool weighted)
+    {
+        DopMatrix N = DopMatrix::Zero();
+        for (size_t i = 0; i < rows.size(); ++i)
+        {
+            if (in_use[i])
+                N += (weighted ? weights[i] : 1.0) * rows[i] * rows[i].transpose();
+        }
+        for (int k = 3; k < NUM_DOP_STATES; ++k)
+        {
+            if (N(k, k) == 0)
+                N(k, k) = 1.0;
+        }
+        return N;
+    }
+
+    double median(std::vector<double> values)
+    {
+        const size_t mid = values.size() / 2;
+        std::nth_element(values.begin(), values.begin() + mid, values.end());
+        if (values.size() % 2 == 1)
+            return values[mid];
+        return 0.5 * (values[mid] + *std::max_element(values.begin(), values.begin() + mid));
+    }
+
+    const size_t MIN_SCREENING_SATS = 3;
+}
+
+GnssSelection selectSatellites(const Eigen::Vector3d &rcv_ecef, const std::vector<Eigen::Vector3d> &sat_pos,
+                               const std::vector<uint32_t> &sat_sys, const std::vector<double> &sat_weight,
+                               size_t max_sats)
+{
+    const size_t num_sats = sat_pos.size();
+    std::vector<DopRow> rows(num_sats, DopRow::Zero());
+    std::vector<int> sys_count(NUM_DOP_STATES, 0);
+    for (size_t i = 0; i < num_sats; ++i)
+    {
+        rows[i].head<3>() = (rcv_ecef - sat_pos[i]).normalized();
+        rows[i](clockColumn(sat_sys[i])) = 1.0;
+        ++sys_count[clockColumn(sat_sys[i])];
+    }
+
+    std::vector<bool> in_use(num_sats, true);
+    DopMatrix N_inv = normalMatrix(rows, sat_weight, in_use, true).inverse();
+    GnssSelection selection;
+    selection.full_pdop = std::sqrt(N_inv.topLeftCorner<3, 3>().trace());
+
+    size_t num_used = num_sats;
+    while (max_sats > 0 && num_used > max_sats)
+    {
+        // removing row h with weight w: N'^-1 = N^-1 + w N^-1 h h^T N^-1 / (1 - w h^T N^-1 h)
+        size_t best = num_sats;
+        double best_increase = std::numeric_limits<double>::max();
+        for (size_t i = 0; i < num_sats; ++i)
+        {
+            if (!in_use[i] || sys_count[clockColumn(sat_sys[i])] <= 1)
+                continue;
+            const DopRow N_inv_h = N_inv * rows[i];
+            const double denominator = 1.0 - sat_weight[i] * rows[i].dot(N_inv_h);
+            if (denominator < 1e-9)
+                continue;
+            const double increase = sat_weight[i] * N_inv_h.head<3>().squaredNorm() / denominator;
+            if (increase < best_increase)
+            {
+                best_increase = increase;
+                best = i;
+            }
+        }
+        if (best == num_sats)
+            break;      // every remaining satellite is needed for observability
+        in_use[best] = false;
+        --sys_count[clockColumn(sat_sys[best])];
+        --num_used;
+        // recomputed instead of updated, the downdate accumulates rounding errors
+        N_inv = normalMatrix(rows, sat_weight, in_use, true).inverse();
+    }
+
+    for (size_t i = 0; i < num_sats; ++i)
+    {
+        if (in_use[i])
+            selection.indices.push_back(i);
+    }
+    selection.pdop = std::sqrt(N_inv.topLeftCorner<3, 3>().trace());
+    // unit diagonal of the unused clock columns is excluded from the trace
+    const DopMatrix Q = normalMatrix(rows, sat_weight, in_use, false).inverse();
+    double gdop2 = Q.topLeftCorner<3, 3>().trace();
+    for (int k = 3; k < NUM_DOP_STATES; ++k)
+    {
+        if (sys_count[k] > 0)
+            gdop2 += Q(k, k);
+    }
+    selection.gdop = std::sqrt(gdop2);
+    return selection;
+}
+
+GnssScreening screenOutliers(const Eigen::Vector3d &rcv_ecef, const Eigen::Vector3d &rcv_vel_ecef,
+                             const std::vector<ObsPtr> &obs, const std::vector<SatStatePtr> &sat_states,
+                             const std::vector<double> &iono_params, double psr_thres, double dopp_thres)
+{
+    const size_t num_sats = obs.size();
+    std::vector<bool> psr_ok(num_sats, true), dopp_ok(num_sats, true);
+
+    if (psr_thres > 0)
+    {
+        // with zero clocks the residual of a consistent satellite is minus its system clock bias
+        Eigen::Matrix<double, 7, 1> rcv_state = Eigen::Matrix<double, 7, 1>::Zero();
+        rcv_state.head<3>() = rcv_ecef;
+        Eigen::VectorXd res;
+        Eigen::MatrixXd J;
+        std::vector<Eigen::Vector2d> atmos_delay, sv_azel;
+        psr_res(rcv_state, obs, sat_states, iono_params, res, J, atmos_delay, sv_azel);
+        std::vector<std::vector<double>> sys_res(4);
+        std::vector<uint32_t> sys_idx(num_sats);
+        for (size_t i = 0; i < num_sats; ++i)
+        {
+            sys_idx[i] = sys2idx.at(satsys(obs[i]->sat, NULL));
+            sys_res[sys_idx[i]].push_back(res(i));
+        }
+        std::vector<double> sys_clock(4, 0);
+        for (size_t k = 0; k < 4; ++k)
+        {
+            if (sys_res[k].size() >= MIN_SCREENING_SATS)
+                sys_clock[k] = median(sys_res[k]);
+        }
+        for (size_t i = 0; i < num_sats; ++i)
+        {
+            if (sys_res[sys_idx[i]].size() >= MIN_SCREENING_SATS)
+                psr_ok[i] = std::fabs(res(i) - sys_clock[sys_idx[i]]) <= psr_thres;
+        }
+    }
+
+    if (dopp_thres > 0 && num_sats >= MIN_SCREENING_SATS)
+    {
+        // one clock drift shared by all systems
+        Eigen::Matrix<double, 4, 1> rcv_state = Eigen::Matrix<double, 4, 1>::Zero();
+        rcv_state.head<3>() = rcv_vel_ecef;
+        Eigen::VectorXd res;
+        Eigen::MatrixXd J;
+        dopp_res(rcv_state, rcv_ecef, obs, sat_states, res, J);
+        const double drift = median(std::vector<double>(res.data(), res.data() + num_sats));
+        for (size_t i = 0; i < num_sats; ++i)
+            dopp_ok[i] = std::fabs(res(i) - drift) <= dopp_thres;
+    }
+
+    GnssScreening screening;
+    screening.num_psr_rejected = screening.num_dopp_rejected = 0;
+    for (size_t i = 0; i < num_sats; ++i)
+    {
+        if (!psr_ok[i])
+            ++screening.num_psr_rejected;
+        else if (!dopp_ok[i])
+            ++screening.num_dopp_rejected;
+        else
+            screening.indices.push_back(i);
+    }
+    return screening;
+}
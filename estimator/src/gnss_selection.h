@@ -0,0 +1,48 @@
+#ifndef GNSS_SELECTION_H
+#define GNSS_SELECTION_H
+
+#include <vector>
+#include <Eigen/Dense>
+
+#include <gnss_comm/gnss_constant.hpp>
+#include <gnss_comm/gnss_utility.hpp>
+
+using namespace gnss_comm;
+
+/**
+ * 按几何构型和观测质量挑选每个历元参与优化的卫星子集
+ * 从全部卫星出发贪心删除: 每次删掉使加权 PDOP 增加最少的一颗, 直到剩 max_sats 颗
+ * 几何矩阵每行为 [视线方向, 所属系统的钟差], 权重为 1/(psr_std^2 + dopp_std^2)
+ * 不会删除某个系统的最后一颗卫星, 否则该系统的钟差不可观
+ */
+struct GnssSelection
+{
+    std::vector<size_t> indices;    // selected satellites, in input order
+    double full_pdop;               // weighted PDOP of all input satellites
+    double pdop;                    // weighted PDOP of the selection
+    double gdop;                    // unweighted GDOP of the selection
+};
+
+// sat_pos and sys pair with sat_weight, max_sats == 0 or not more satellites than that selects all
+GnssSelection selectSatellites(const Eigen::Vector3d &rcv_ecef, const std::vector<Eigen::Vector3d> &sat_pos,
+                               const std::vector<uint32_t> &sat_sys, const std::vector<double> &sat_weight,
+                               size_t max_sats);
+
+/**
+ * 构造因子之前的粗差筛查 (RAIM 式一致性检验): 以预测的接收机位置/速度计算伪距和多普勒残差,
+ * 未知的钟差和钟漂分别取各系统 / 全部卫星残差的中位数, 偏离中位数超过阈值的卫星被剔除
+ * 中位数可容忍不到一半的粗差; 卫星数少于 3 的系统 (或全部卫星少于 3 颗时的多普勒) 无法判断, 不做筛查
+ */
+struct GnssScreening
+{
+    std::vector<size_t> indices;    // satellites passing both tests, in input order
+    size_t num_psr_rejected;        // a satellite failing both tests counts as a pseudorange rejection
+    size_t num_dopp_rejected;
+};
+
+// obs pairs with sat_states, a threshold of 0 turns that test off
+GnssScreening screenOutliers(const Eigen::Vector3d &rcv_ecef, const Eigen::Vector3d &rcv_vel_ecef,
+                             const std::vector<ObsPtr> &obs, const std::vector<SatStatePtr> &sat_states,
+                             const std::vector<double> &iono_params, double psr_thres, double dopp_thres);
+
+#endif
@@ -0,0 +1,207 @@
+#include "imu_propagator.h"
+
+#include "utility/utility.h"
+
+namespace
+{
+    // rebase when the samples after the corrected frame are this few, the re-integration is
+    // then cheaper than keeping the first-order bias correction over a long anchor interval
+    const size_t MAX_CHEAP_REBASE = 32;
+    // otherwise rebase at least this often (seconds of IMU time since the anchor)
+    const double MAX_ANCHOR_AGE = 1.0;
+    // history kept while no correction arrives
+    const size_t MAX_HISTORY = 8192;
+}
+
+ImuPropagator::ImuPropagator()
+{
+    reset();
+}
+
+void ImuPropagator::reset()
+{
+    history.clear();
+    has_anchor = false;
+    has_base = false;
+    latest_t = -1;
+    num_rebases = 0;
+}
+
+void ImuPropagator::resetDelta(Delta &d)
+{
+    d.alpha.setZero();
+    d.beta.setZero();
+    d.gamma.setIdentity();
+    d.J_alpha_ba.setZero();
+    d.J_alpha_bg.setZero();
+    d.J_beta_ba.setZero();
+    d.J_beta_bg.setZero();
+    d.J_gamma_bg.setZero();
+}
+
+// mid-point step of IntegrationBase, bias jacobians only
+void ImuPropagator::integrate(const Delta &d0, const Eigen::Vector3d &acc0, const Eigen::Vector3d &gyr0,
+                              const Eigen::Vector3d &acc1, const Eigen::Vector3d &gyr1, double dt, Delta &d1) const
+{
+    const Eigen::Vector3d un_gyr = 0.5 * (gyr0 + gyr1) - anchor_bg;
+    const Eigen::Quaterniond dq = Utility::deltaQ(un_gyr * dt);
+    d1.gamma = (d0.gamma * dq).normalized();
+
+    const Eigen::Matrix3d R0 = d0.gamma.toRotationMatrix();
+    const Eigen::Matrix3d R1 = d1.gamma.toRotationMatrix();
+    const Eigen::Vector3d a0 = acc0 - anchor_ba, a1 = acc1 - anchor_ba;
+    const Eigen::Vector3d un_acc = 0.5 * (R0 * a0 + R1 * a1);
+    d1.alpha = d0.alpha + d0.beta * dt + 0.5 * un_acc * dt * dt;
+    d1.beta = d0.beta + un_acc * dt;
+
+    d1.J_gamma_bg = dq.toRotationMatrix().transpose() * d0.J_gamma_bg - Eigen::Matrix3d::Identity() * dt;
+    const Eigen::Matrix3d dacc_dba = -0.5 * (R0 + R1);
+    const Eigen::Matrix3d dacc_dbg = -0.5 * (R0 * Utility::skewSymmetric(a0) * d0.J_gamma_bg +
+                                             R1 * Utility::skewSymmetric(a1) * d1.J_gamma_bg);
+    d1.J_alpha_ba = d0.J_alpha_ba + d0.J_beta_ba * dt + 0.5 * dacc_dba * dt * dt;
+    d1.J_alpha_bg = d0.J_alpha_bg + d0.J_beta_bg * dt + 0.5 * dacc_dbg * dt * dt;
+    d1.J_beta_ba = d0.J_beta_ba + dacc_dba * dt;
+    d1.J_beta_bg = d0.J_beta_bg + dacc_dbg * dt;
+}
+
+// first-order correction from the anchor bias to the bias of the latest correction
+void ImuPropagator::biasCorrect(const Delta &d, Eigen::Vector3d &alpha, Eigen::Vector3d &beta,
+                                Eigen::Quaterniond &gamma) const
+{
+    const Eigen::Vector3d dba = base_ba - anchor_ba, dbg = base_bg - anchor_bg;
+    alpha = d.alpha + d.J_alpha_ba * dba + d.J_alpha_bg * dbg;
+    beta = d.beta + d.J_beta_ba * dba + d.J_beta_bg * dbg;
+    gamma = d.gamma * Utility::deltaQ(d.J_gamma_bg * dbg);
+}
+
+void ImuPropagator::propagate(const Sample &s)
+{
+    Eigen::Vector3d alpha, beta;
+    Eigen::Quaterniond gamma;
+    biasCorrect(s.delta, alpha, beta, gamma);
+
+    // compose (anchor -> base)^-1 with (anchor -> sample), then apply it to the base state
+    const double T = s.t - base_t;
+    latest_t = s.t;
+    latest_Q = Eigen::Quaterniond(base_R * gamma.toRotationMatrix()).normalized();
+    latest_V = base_V - base_g * T + base_R * (beta - base_beta);
+    latest_P = base_P + base_V * T - 0.5 * base_g * T * T + base_R * (alpha - base_alpha - base_beta * T);
+    latest_acc = latest_Q * (s.acc - base_ba) - base_g;
+    latest_gyr = s.gyr - base_bg;
+}
+
+void ImuPropagator::push(double t, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr)
+{
+    Sample s;
+    s.t = t;
+    s.acc = acc;
+    s.gyr = gyr;
+    if (has_anchor && history.empty())
+    {
+        Delta d0;
+        resetDelta(d0);
+        integrate(d0, anchor_acc, anchor_gyr, acc, gyr, t - anchor_t, s.delta);
+    }
+    else if (has_anchor)
+    {
+        const Sample &prev = history.back();
+        integrate(prev.delta, prev.acc, prev.gyr, acc, gyr, t - prev.t, s.delta);
+    }
+    history.push_back(s);
+    if (!has_anchor && history.size() > MAX_HISTORY)
+        history.pop_front();
+
+    if (has_base)
+        propagate(history.back());
+}
+
+void ImuPropagator::rebase(double t, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr)
+{
+    anchor_t = t;
+    anchor_acc = acc;
+    anchor_gyr = gyr;
+    anchor_ba = base_ba;
+    anchor_bg = base_bg;
+    has_anchor = true;
+    ++num_rebases;
+
+    while (!history.empty() && history.front().t <= t)
+        history.pop_front();
+    Delta d0;
+    resetDelta(d0);
+    double t0 = t;
+    Eigen::Vector3d acc0 = acc, gyr0 = gyr;
+    for (Sample &s : history)
+    {
+        integrate(d0, acc0, gyr0, s.acc, s.gyr, s.t - t0, s.delta);
+        d0 = s.delta;
+        t0 = s.t;
+        acc0 = s.acc;
+        gyr0 = s.gyr;
+    }
+}
+
+void ImuPropagator::correct(double t, const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, const Eigen::Vector3d &V,
+                            const Eigen::Vector3d &Ba, const Eigen::Vector3d &Bg,
+                            const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr, const Eigen::Vector3d &g)
+{
+    base_t = t;
+    base_P = P;
+    base_V = V;
+    base_g = g;
+    base_ba = Ba;
+    base_bg = Bg;
+    has_base = true;
+
+    // last cached sample at or before t, older ones are not needed by any later correction
+    History::iterator after = history.begin();
+    while (after != history.end() && after->t <= t)
+        ++after;
+    if (has_anchor && after != history.begin())
+        after = history.erase(history.begin(), after - 1) + 1;
+    const size_t num_after = history.end() - after;
+
+    if (!has_anchor || t <= anchor_t || num_after <= MAX_CHEAP_REBASE || t - anchor_t > MAX_ANCHOR_AGE)
+    {
+        rebase(t, acc, gyr);
+        base_R = Q.toRotationMatrix();
+        base_alpha.setZero();
+        base_beta.setZero();
+    }
+    else
+    {
+        // delta from the anchor to t: last sample before t plus a partial step to the interpolated sample
+        Delta d_prev, d_base;
+        const bool from_anchor = (after == history.begin());
+        if (from_anchor)
+            resetDelta(d_prev);
+        else
+            d_prev = (after - 1)->delta;
+        integrate(d_prev, from_anchor ? anchor_acc : (after - 1)->acc, from_anchor ? anchor_gyr : (after - 1)->gyr,
+                  acc, gyr, t - (from_anchor ? anchor_t : (after - 1)->t), d_base);
+        Eigen::Quaterniond gamma;
+        biasCorrect(d_base, base_alpha, base_beta, gamma);
+        base_R = Q.toRotationMatrix() * gamma.toRotationMatrix().transpose();
+    }
+
+    if (history.empty() || history.back().t <= t)
+    {
+        latest_t = t;
+        latest_P = P;
+        latest_Q = Q;
+        latest_V = V;
+        latest_acc = Q * (acc - Ba) - g;
+        latest_gyr = gyr - Bg;
+    }
+    else
+        propagate(history.back());
+}
+
+void ImuPropagator::discardBefore(double t)
+{
+    // the estimator is (re)initializing, the old anchor and base are stale
+    has_anchor = false;
+    has_base = false;
+    while (history.size() > 1 && history[1].t <= t)
+        history.pop_front();
+}
@@ -0,0 +1,97 @@
+#ifndef IMU_PROPAGATOR_H
+#define IMU_PROPAGATOR_H
+
+#include <deque>
+
+#include <eigen3/Eigen/Dense>
+
+/**
+ * 高频里程计的 IMU 前向递推
+ * 每个 IMU 采样在 push 时积分一次, 缓存相对锚点时刻的预积分量 (alpha, beta, gamma) 及其对零偏的雅可比;
+ * 优化后 correct 只需把新的帧状态与缓存的预积分量组合, 不再重放整个 IMU 队列
+ * 锚点之后的采样不多或锚点过老时, 才按新的零偏从该帧重新积分 (rebase)
+ * 不加锁, 调用者负责 push 与 correct 之间的互斥
+ */
+class ImuPropagator
+{
+  public:
+    ImuPropagator();
+
+    // integrate one IMU sample, the propagated state is valid only after the first correct()
+    void push(double t, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr);
+
+    // optimized state of the newest frame at time t; acc/gyr is the IMU sample interpolated at t,
+    // g the gravity the estimator subtracts
+    void correct(double t, const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, const Eigen::Vector3d &V,
+                 const Eigen::Vector3d &Ba, const Eigen::Vector3d &Bg,
+                 const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr, const Eigen::Vector3d &g);
+
+    // while the estimator is not initialized: forget the last correction and drop samples up to t
+    void discardBefore(double t);
+
+    void reset();
+
+    bool valid() const { return has_base; }
+    double latestTime() const { return latest_t; }
+    const Eigen::Vector3d &latestP() const { return latest_P; }
+    const Eigen::Quaterniond &latestQ() const { return latest_Q; }
+    const Eigen::Vector3d &latestV() const { return latest_V; }
+    // newest sample with the bias removed: acceleration in the world frame without gravity, body angular rate
+    const Eigen::Vector3d &latestAcc() const { return latest_acc; }
+    const Eigen::Vector3d &latestGyr() const { return latest_gyr; }
+
+    size_t historySize() const { return history.size(); }
+    size_t numRebases() const { return num_rebases; }
+
+  private:
+    // preintegration from the anchor to one sample, linearized at anchor_ba/anchor_bg
+    struct Delta
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        Eigen::Vector3d alpha, beta;
+        Eigen::Quaterniond gamma;
+        Eigen::Matrix3d J_alpha_ba, J_alpha_bg, J_beta_ba, J_beta_bg, J_gamma_bg;
+    };
+
+    struct Sample
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        double t;
+        Eigen::Vector3d acc, gyr;
+        Delta delta;
+    };
+
+    typedef std::deque<Sample, Eigen::aligned_allocator<Sample>> History;
+
+    static void resetDelta(Delta &d);
+    void integrate(const Delta &d0, const Eigen::Vector3d &acc0, const Eigen::Vector3d &gyr0,
+                   const Eigen::Vector3d &acc1, const Eigen::Vector3d &gyr1, double dt, Delta &d1) const;
+    void biasCorrect(const Delta &d, Eigen::Vector3d &alpha, Eigen::Vector3d &beta, Eigen::Quaterniond &gamma) const;
+    void rebase(double t, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr);
+    void propagate(const Sample &s);
+
+    History history;                // samples after the anchor, oldest first
+
+    // anchor of the cached deltas
+    bool has_anchor;
+    double anchor_t;
+    Eigen::Vector3d anchor_acc, anchor_gyr;
+    Eigen::Vector3d anchor_ba, anchor_bg;
+
+    // latest correction, folded with the delta from the anchor to it
+    bool has_base;
+    double base_t;
+    Eigen::Vector3d base_P, base_V, base_g;
+    Eigen::Vector3d base_ba, base_bg;
+    Eigen::Matrix3d base_R;         // Q * gamma_ak^-1
+    Eigen::Vector3d base_alpha, base_beta;
+
+    double latest_t;
+    Eigen::Vector3d latest_P, latest_V;
+    Eigen::Quaterniond latest_Q;
+    Eigen::Vector3d latest_acc, latest_gyr;
+
+    size_t num_rebases;
+};
+
+#endif
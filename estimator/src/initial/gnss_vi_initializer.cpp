@@ -1,4 +1,5 @@
 #include "gnss_vi_initializer.h"
+#include "../utility/worker_pool.h"
 
 GNSSVIInitializer::GNSSVIInitializer(const std::vector<std::vector<ObsPtr>> &gnss_meas_buf_, 
     const std::vector<std::vector<EphemBasePtr>> &gnss_ephem_buf_, const std::vector<double> &iono_params_)
@@ -13,17 +14,32 @@ GNSSVIInitializer::GNSSVIInitializer(const std::vector<std::vector<ObsPtr>> &gns
     }
 }
 
+GNSSVIInitializer::GNSSVIInitializer(const std::vector<std::vector<ObsPtr>> &gnss_meas_buf_, 
+    const std::vector<std::vector<EphemBasePtr>> &gnss_ephem_buf_, 
+    const std::vector<std::vector<SatStatePtr>> &gnss_sat_state_buf_, const std::vector<double> &iono_params_)
+        : gnss_meas_buf(gnss_meas_buf_), gnss_ephem_buf(gnss_ephem_buf_), iono_params(iono_params_), 
+          all_sat_states(gnss_sat_state_buf_)
+{
+    num_all_meas = 0;
+    for (uint32_t i = 0; i < gnss_meas_buf.size(); ++i)
+        num_all_meas += gnss_meas_buf[i].size();
+}
+
 bool GNSSVIInitializer::coarse_localization(Eigen::Matrix<double, 7, 1> &result)
 {
     result.setZero();
     std::vector<ObsPtr> accum_obs;
     std::vector<EphemBasePtr> accum_ephems;
+    std::vector<SatStatePtr> accum_sat_states;
     for (uint32_t i = 0; i < gnss_meas_buf.size(); ++i)
     {
         std::copy(gnss_meas_buf[i].begin(), gnss_meas_buf[i].end(), std::back_inserter(accum_obs));
         std::copy(gnss_ephem_buf[i].begin(), gnss_ephem_buf[i].end(), std::back_inserter(accum_ephems));
+        std::copy(all_sat_states[i].begin(), all_sat_states[i].end(), std::back_inserter(accum_sat_states));
     }
-    Eigen::Matrix<double, 7, 1> xyzt = psr_pos(accum_obs, accum_ephems, iono_params);
+    // the satellite states of the window are computed already
+    SppSolver spp_solver;
+    Eigen::Matrix<double, 7, 1> xyzt = spp_solver.psr_pos(accum_obs, accum_ephems, accum_sat_states, iono_params);
     if (xyzt.topLeftCorner<3, 1>().norm() == 0)
     {
         std::cerr << "Failed to obtain a rough reference location.\n";
@@ -40,65 +56,93 @@ bool GNSSVIInitializer::coarse_localization(Eigen::Matrix<double, 7, 1> &result)
     return true;
 }
 
+/**
+ * 从 NUM_YAW_HYPOTHESES 个均匀分布的初始 yaw 并行做 Gauss-Newton, 取收敛解中多普勒残差平方和最小的一个;
+ * 未知量只有 [yaw, ddt], 法方程按观测累加为 2x2, 不构造整个窗口的雅可比矩阵
+ */
 bool GNSSVIInitializer::yaw_alignment(const std::vector<Eigen::Vector3d> &local_vs, 
     const Eigen::Vector3d &rough_anchor_ecef, double &aligned_yaw, double &rcv_ddt)
 {
     aligned_yaw = 0;
     rcv_ddt = 0;
 
-    double est_yaw = 0;
-    double est_rcv_ddt = 0;
+    struct Hypothesis
+    {
+        double yaw, rcv_ddt, cost;
+        bool converged;
+    };
+    std::vector<Hypothesis> hypotheses(NUM_YAW_HYPOTHESES);
 
-    Eigen::Matrix3d rough_R_ecef_enu = ecef2rotation(rough_anchor_ecef);
-    uint32_t align_iter = 0;
-    double align_dx_norm = 1.0;
-    while (align_iter < MAX_ITERATION && align_dx_norm > CONVERGENCE_EPSILON)
-    {
-        Eigen::MatrixXd align_G(num_all_meas, 2);
-        align_G.setZero();
-        align_G.col(1).setOnes();
-        Eigen::VectorXd align_b(num_all_meas);
-        align_b.setZero();
-        Eigen::Matrix3d align_R_enu_local(Eigen::AngleAxisd(est_yaw, Eigen::Vector3d::UnitZ()));
-        Eigen::Matrix3d align_tmp_M;
-        align_tmp_M << -sin(est_yaw), -cos(est_yaw), 0,
-                        cos(est_yaw), -sin(est_yaw), 0,
-                        0       , 0        , 0;
-        
-        uint32_t align_counter = 0;
-        for (uint32_t i = 0; i < gnss_meas_buf.size(); ++i)
+    const Eigen::Matrix3d rough_R_ecef_enu = ecef2rotation(rough_anchor_ecef);
+    WorkerPool::instance().parallelFor(NUM_YAW_HYPOTHESES, [&](int h)
+    {
+        Hypothesis &hypothesis = hypotheses[h];
+        double est_yaw = -M_PI + 2.0 * M_PI * h / NUM_YAW_HYPOTHESES;
+        double est_rcv_ddt = 0;
+        hypothesis.converged = false;
+        for (uint32_t align_iter = 0; align_iter < MAX_ITERATION; ++align_iter)
         {
-            Eigen::Matrix<double, 4, 1> ecef_vel_ddt;
-            ecef_vel_ddt.head<3>() = rough_R_ecef_enu * align_R_enu_local * local_vs[i];
-            ecef_vel_ddt(3) = est_rcv_ddt;
-            Eigen::VectorXd epoch_res;
-            Eigen::MatrixXd epoch_J;
-            dopp_res(ecef_vel_ddt, rough_anchor_ecef, gnss_meas_buf[i], all_sat_states[i], epoch_res, epoch_J);
-            align_b.segment(align_counter, gnss_meas_buf[i].size()) = epoch_res;
-            align_G.block(align_counter, 0, gnss_meas_buf[i].size(), 1) = 
-                epoch_J.leftCols(3)*rough_R_ecef_enu*align_tmp_M*local_vs[i];
-            align_counter += gnss_meas_buf[i].size();
+            const Eigen::Matrix3d align_R_enu_local(Eigen::AngleAxisd(est_yaw, Eigen::Vector3d::UnitZ()));
+            Eigen::Matrix3d align_tmp_M;
+            align_tmp_M << -sin(est_yaw), -cos(est_yaw), 0,
+                            cos(est_yaw), -sin(est_yaw), 0,
+                            0       , 0        , 0;
+
+            Eigen::Matrix2d H = Eigen::Matrix2d::Zero();
+            Eigen::Vector2d b = Eigen::Vector2d::Zero();
+            double cost = 0;
+            for (uint32_t i = 0; i < gnss_meas_buf.size(); ++i)
+            {
+                Eigen::Matrix<double, 4, 1> ecef_vel_ddt;
+                ecef_vel_ddt.head<3>() = rough_R_ecef_enu * align_R_enu_local * local_vs[i];
+                ecef_vel_ddt(3) = est_rcv_ddt;
+                Eigen::VectorXd epoch_res;
+                Eigen::MatrixXd epoch_J;
+                dopp_res(ecef_vel_ddt, rough_anchor_ecef, gnss_meas_buf[i], all_sat_states[i], epoch_res, epoch_J);
+                const Eigen::Vector3d d_vel_d_yaw = rough_R_ecef_enu * align_tmp_M * local_vs[i];
+                for (int k = 0; k < epoch_res.size(); ++k)
+                {
+                    const Eigen::Vector2d J_k(epoch_J.row(k).head<3>().dot(d_vel_d_yaw), 1.0);
+                    H += J_k * J_k.transpose();
+                    b += J_k * epoch_res(k);
+                    cost += epoch_res(k) * epoch_res(k);
+                }
+            }
+            hypothesis.cost = cost;
+            if (std::abs(H.determinant()) < 1e-12)
+                return;     // no velocity excitation
+            const Eigen::Vector2d dx = -H.inverse() * b;
+            est_yaw += dx(0);
+            est_rcv_ddt += dx(1);
+            if (dx.norm() <= CONVERGENCE_EPSILON)
+            {
+                hypothesis.converged = true;
+                break;
+            }
         }
-        Eigen::VectorXd dx = -(align_G.transpose()*align_G).inverse() * align_G.transpose() * align_b;
-        est_yaw += dx(0);
-        est_rcv_ddt += dx(1);
-        align_dx_norm = dx.norm();
-        ++ align_iter;
-    }
+        hypothesis.yaw = est_yaw;
+        hypothesis.rcv_ddt = est_rcv_ddt;
+    });
 
-    if (align_iter > MAX_ITERATION)
+    const Hypothesis *best = nullptr;
+    for (const Hypothesis &hypothesis : hypotheses)
+    {
+        if (hypothesis.converged && (!best || hypothesis.cost < best->cost))
+            best = &hypothesis;
+    }
+    if (!best)
     {
         std::cerr << "Fail to initialize yaw offset.\n";
         return false;
     }
 
-    aligned_yaw = est_yaw;
+    aligned_yaw = best->yaw;
     if (aligned_yaw > M_PI)
-        aligned_yaw -= floor(est_yaw/(2.0*M_PI) + 0.5) * (2.0*M_PI);
+        aligned_yaw -= floor(aligned_yaw/(2.0*M_PI) + 0.5) * (2.0*M_PI);
     else if (aligned_yaw < -M_PI)
-        aligned_yaw -=  ceil(est_yaw/(2.0*M_PI) - 0.5) * (2.0*M_PI);
+        aligned_yaw -=  ceil(aligned_yaw/(2.0*M_PI) - 0.5) * (2.0*M_PI);
 
-    rcv_ddt = est_rcv_ddt;
+    rcv_ddt = best->rcv_ddt;
 
     return true;
 }
@@ -171,4 +215,96 @@ bool GNSSVIInitializer::anchor_refinement(const std::vector<Eigen::Vector3d> &lo
     refined_ecef_dt.tail<4>() = refine_dt;
 
     return true;
-}
\ No newline at end of file
+}
+
+bool GNSSVIInitializer::clock_alignment(const std::vector<Eigen::Vector3d> &local_ps, 
+    const std::vector<Eigen::Vector3d> &local_vs, const Eigen::Vector3d &anchor_ecef, 
+    const Eigen::Matrix<double, 7, 1> &rough_ecef_dt, Eigen::Matrix<double, 7, 1> &refined_ecef_dt, double &rcv_ddt)
+{
+    refined_ecef_dt.setZero();
+    rcv_ddt = 0;
+    const Eigen::Matrix3d R_ecef_enu = ecef2rotation(anchor_ecef);
+
+    // 1. clock drift from the Doppler shifts of the known velocities
+    double est_rcv_ddt = 0;
+    uint32_t drift_iter = 0;
+    double drift_dx_norm = 1.0;
+    while (drift_iter < MAX_ITERATION && drift_dx_norm > CONVERGENCE_EPSILON)
+    {
+        double sum_res = 0;
+        for (uint32_t i = 0; i < gnss_meas_buf.size(); ++i)
+        {
+            Eigen::Matrix<double, 4, 1> ecef_vel_ddt;
+            ecef_vel_ddt.head<3>() = R_ecef_enu * local_vs[i];
+            ecef_vel_ddt(3) = est_rcv_ddt;
+            Eigen::VectorXd epoch_res;
+            Eigen::MatrixXd epoch_J;
+            dopp_res(ecef_vel_ddt, anchor_ecef, gnss_meas_buf[i], all_sat_states[i], epoch_res, epoch_J);
+            sum_res += epoch_res.sum();
+        }
+        const double dx = -sum_res / num_all_meas;
+        est_rcv_ddt += dx;
+        drift_dx_norm = fabs(dx);
+        ++ drift_iter;
+    }
+    if (drift_iter > MAX_ITERATION)
+    {
+        std::cerr << "Fail to estimate the receiver clock drift.\n";
+        return false;
+    }
+
+    // 2. clock biases with the positions fixed
+    Eigen::Vector4d refine_dt = rough_ecef_dt.tail<4>();
+    std::vector<uint32_t> unobserved_sys;
+    for (uint32_t k = 0; k < 4; ++k)
+    {
+        if (rough_ecef_dt(3+k) == 0)
+            unobserved_sys.push_back(k);
+    }
+    uint32_t refine_iter = 0;
+    double refine_dx_norm = 1.0;
+    while (refine_iter < MAX_ITERATION && refine_dx_norm > CONVERGENCE_EPSILON)
+    {
+        Eigen::MatrixXd refine_G(num_all_meas+unobserved_sys.size(), 4);
+        Eigen::VectorXd refine_b(num_all_meas+unobserved_sys.size());
+        refine_G.setZero();
+        refine_b.setZero();
+        uint32_t refine_counter = 0;
+        for (uint32_t i = 0; i < gnss_meas_buf.size(); ++i)
+        {
+            Eigen::Matrix<double, 7, 1> ecef_xyz_dt;
+            ecef_xyz_dt.head<3>() = R_ecef_enu * local_ps[i] + anchor_ecef;
+            ecef_xyz_dt.tail<4>() = refine_dt + est_rcv_ddt * i * Eigen::Vector4d::Ones();
+
+            Eigen::VectorXd epoch_res;
+            Eigen::MatrixXd epoch_J;
+            std::vector<Eigen::Vector2d> tmp_atmos_delay, tmp_sv_azel;
+            psr_res(ecef_xyz_dt, gnss_meas_buf[i], all_sat_states[i], iono_params, 
+                epoch_res, epoch_J, tmp_atmos_delay, tmp_sv_azel);
+            refine_b.segment(refine_counter, gnss_meas_buf[i].size()) = epoch_res;
+            refine_G.middleRows(refine_counter, gnss_meas_buf[i].size()) = epoch_J.rightCols(4);
+            refine_counter += gnss_meas_buf[i].size();
+        }
+        for (uint32_t k : unobserved_sys)
+        {
+            refine_b(refine_counter) = 0;
+            refine_G(refine_counter, k) = 1.0;
+            ++ refine_counter;
+        }
+
+        Eigen::Vector4d dx = -(refine_G.transpose()*refine_G).inverse() * refine_G.transpose() * refine_b;
+        refine_dt += dx;
+        refine_dx_norm = dx.norm();
+        ++ refine_iter;
+    }
+    if (refine_iter > MAX_ITERATION)
+    {
+        std::cerr << "Fail to align receiver clocks.\n";
+        return false;
+    }
+
+    refined_ecef_dt.head<3>() = anchor_ecef;
+    refined_ecef_dt.tail<4>() = refine_dt;
+    rcv_ddt = est_rcv_ddt;
+    return true;
+}
@@ -17,6 +17,11 @@ class GNSSVIInitializer
         GNSSVIInitializer(const std::vector<std::vector<ObsPtr>> &gnss_meas_buf_, 
             const std::vector<std::vector<EphemBasePtr>> &gnss_ephem_buf_, 
             const std::vector<double> &iono_params_);
+        // reuse satellite states already computed by the estimator (one entry per observation)
+        GNSSVIInitializer(const std::vector<std::vector<ObsPtr>> &gnss_meas_buf_, 
+            const std::vector<std::vector<EphemBasePtr>> &gnss_ephem_buf_, 
+            const std::vector<std::vector<SatStatePtr>> &gnss_sat_state_buf_, 
+            const std::vector<double> &iono_params_);
         GNSSVIInitializer(const GNSSVIInitializer&) = delete;
         GNSSVIInitializer& operator=(const GNSSVIInitializer&) = delete;
         ~GNSSVIInitializer() {};
@@ -28,6 +33,10 @@ class GNSSVIInitializer
         bool anchor_refinement(const std::vector<Eigen::Vector3d> &local_ps, 
             const double aligned_yaw, const double aligned_ddt, 
             const Eigen::Matrix<double, 7, 1> &rough_ecef_dt, Eigen::Matrix<double, 7, 1> &refined_ecef_dt);
+        // receiver clock bias and drift with the local frame fixed at a known anchor (yaw 0, local frame is its ENU)
+        bool clock_alignment(const std::vector<Eigen::Vector3d> &local_ps, const std::vector<Eigen::Vector3d> &local_vs, 
+            const Eigen::Vector3d &anchor_ecef, const Eigen::Matrix<double, 7, 1> &rough_ecef_dt, 
+            Eigen::Matrix<double, 7, 1> &refined_ecef_dt, double &rcv_ddt);
     
     private:
         const std::vector<std::vector<ObsPtr>> &gnss_meas_buf;
@@ -39,6 +48,7 @@ class GNSSVIInitializer
 
         static constexpr uint32_t MAX_ITERATION = 10;
         static constexpr double   CONVERGENCE_EPSILON = 1e-5;
+        static constexpr int      NUM_YAW_HYPOTHESES = 8;     // initial yaws of yaw_alignment, evenly spaced
 };
 
 
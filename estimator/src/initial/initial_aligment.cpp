@@ -1,6 +1,6 @@
 #include "initial_alignment.h"
 
-void solveGyroscopeBias(map<double, ImageFrame> &all_image_frame, Vector3d* Bgs)
+void solveGyroscopeBias(map<double, ImageFrame> &all_image_frame, WindowArray<Vector3d, WINDOW_SIZE + 1> &Bgs)
 {
     Matrix3d A;
     Vector3d b;
@@ -12,10 +12,8 @@ void solveGyroscopeBias(map<double, ImageFrame> &all_image_frame, Vector3d* Bgs)
     for (frame_i = all_image_frame.begin(); next(frame_i) != all_image_frame.end(); frame_i++)
     {
         frame_j = next(frame_i);
-        MatrixXd tmp_A(3, 3);
-        tmp_A.setZero();
-        VectorXd tmp_b(3);
-        tmp_b.setZero();
+        Matrix3d tmp_A;
+        Vector3d tmp_b;
         Eigen::Quaterniond q_ij(frame_i->second.R.transpose() * frame_j->second.R);
         tmp_A = frame_j->second.pre_integration->jacobian.template block<3, 3>(O_R, O_BG);
         tmp_b = 2 * (frame_j->second.pre_integration->delta_q.inverse() * q_ij).vec();
@@ -24,7 +22,7 @@ void solveGyroscopeBias(map<double, ImageFrame> &all_image_frame, Vector3d* Bgs)
 
     }
     delta_bg = A.ldlt().solve(b);
-    ROS_WARN_STREAM("gyroscope bias initial calibration " << delta_bg.transpose());
+    GVINS_WARN_STREAM("gyroscope bias initial calibration " << delta_bg.transpose());
 
     for (int i = 0; i <= WINDOW_SIZE; i++)
         Bgs[i] += delta_bg;
@@ -37,7 +35,7 @@ void solveGyroscopeBias(map<double, ImageFrame> &all_image_frame, Vector3d* Bgs)
 }
 
 
-MatrixXd TangentBasis(Vector3d &g0)
+Matrix<double, 3, 2> TangentBasis(Vector3d &g0)
 {
     Vector3d b, c;
     Vector3d a = g0.normalized();
@@ -46,18 +44,52 @@ MatrixXd TangentBasis(Vector3d &g0)
         tmp << 1, 0, 0;
     b = (tmp - a * (a.transpose() * tmp)).normalized();
     c = a.cross(b);
-    MatrixXd bc(3, 2);
+    Matrix<double, 3, 2> bc;
     bc.block<3, 1>(0, 0) = b;
     bc.block<3, 1>(0, 1) = c;
     return bc;
 }
 
-void RefineGravity(map<double, ImageFrame> &all_image_frame, Vector3d &g, VectorXd &x)
+/**
+ * 相邻两帧之间与重力/速度/尺度无关的量, LinearAlignment 和 RefineGravity 的 4 次迭代共用, 只计算一次
+ */
+struct AlignmentPair
 {
-    Vector3d g0 = g.normalized() * G.norm();
+    double dt;
+    Matrix3d Ri_T;              // R_i^T
+    Matrix3d Ri_T_Rj;           // R_i^T * R_j
+    Vector3d scale_col;         // R_i^T * (T_j - T_i) / 100
+    Vector3d delta_p_tic;       // delta_p + R_i^T * R_j * TIC - TIC
+    Vector3d delta_v;
+};
+
+static void collectAlignmentPairs(map<double, ImageFrame> &all_image_frame, const EstimatorConfig &config,
+                                  vector<AlignmentPair> &pairs)
+{
+    pairs.clear();
+    pairs.reserve(all_image_frame.size());
+    map<double, ImageFrame>::iterator frame_i;
+    map<double, ImageFrame>::iterator frame_j;
+    for (frame_i = all_image_frame.begin(); next(frame_i) != all_image_frame.end(); frame_i++)
+    {
+        frame_j = next(frame_i);
+        AlignmentPair pair;
+        pair.dt = frame_j->second.pre_integration->sum_dt;
+        pair.Ri_T = frame_i->second.R.transpose();
+        pair.Ri_T_Rj = pair.Ri_T * frame_j->second.R;
+        pair.scale_col = pair.Ri_T * (frame_j->second.T - frame_i->second.T) / 100.0;
+        pair.delta_p_tic = frame_j->second.pre_integration->delta_p + pair.Ri_T_Rj * config.TIC[0] - config.TIC[0];
+        pair.delta_v = frame_j->second.pre_integration->delta_v;
+        pairs.push_back(pair);
+    }
+}
+
+void RefineGravity(const vector<AlignmentPair> &pairs, const EstimatorConfig &config, Vector3d &g, VectorXd &x)
+{
+    Vector3d g0 = g.normalized() * config.G.norm();
     Vector3d lx, ly;
     //VectorXd x;
-    int all_frame_count = all_image_frame.size();
+    int all_frame_count = pairs.size() + 1;
     int n_state = all_frame_count * 3 + 2 + 1;
 
     MatrixXd A{n_state, n_state};
@@ -65,43 +97,33 @@ void RefineGravity(map<double, ImageFrame> &all_image_frame, Vector3d &g, Vector
     VectorXd b{n_state};
     b.setZero();
 
-    map<double, ImageFrame>::iterator frame_i;
-    map<double, ImageFrame>::iterator frame_j;
     for(int k = 0; k < 4; k++)
     {
-        MatrixXd lxly(3, 2);
+        Matrix<double, 3, 2> lxly;
         lxly = TangentBasis(g0);
-        int i = 0;
-        for (frame_i = all_image_frame.begin(); next(frame_i) != all_image_frame.end(); frame_i++, i++)
+        for (int i = 0; i < int(pairs.size()); i++)
         {
-            frame_j = next(frame_i);
+            const AlignmentPair &pair = pairs[i];
+            const double dt = pair.dt;
 
-            MatrixXd tmp_A(6, 9);
+            Matrix<double, 6, 9> tmp_A;
             tmp_A.setZero();
-            VectorXd tmp_b(6);
+            Matrix<double, 6, 1> tmp_b;
             tmp_b.setZero();
 
-            double dt = frame_j->second.pre_integration->sum_dt;
-
-
             tmp_A.block<3, 3>(0, 0) = -dt * Matrix3d::Identity();
-            tmp_A.block<3, 2>(0, 6) = frame_i->second.R.transpose() * dt * dt / 2 * Matrix3d::Identity() * lxly;
-            tmp_A.block<3, 1>(0, 8) = frame_i->second.R.transpose() * (frame_j->second.T - frame_i->second.T) / 100.0;     
-            tmp_b.block<3, 1>(0, 0) = frame_j->second.pre_integration->delta_p + frame_i->second.R.transpose() * frame_j->second.R * TIC[0] - TIC[0] - frame_i->second.R.transpose() * dt * dt / 2 * g0;
+            tmp_A.block<3, 2>(0, 6) = pair.Ri_T * dt * dt / 2 * lxly;
+            tmp_A.block<3, 1>(0, 8) = pair.scale_col;     
+            tmp_b.block<3, 1>(0, 0) = pair.delta_p_tic - pair.Ri_T * dt * dt / 2 * g0;
 
             tmp_A.block<3, 3>(3, 0) = -Matrix3d::Identity();
-            tmp_A.block<3, 3>(3, 3) = frame_i->second.R.transpose() * frame_j->second.R;
-            tmp_A.block<3, 2>(3, 6) = frame_i->second.R.transpose() * dt * Matrix3d::Identity() * lxly;
-            tmp_b.block<3, 1>(3, 0) = frame_j->second.pre_integration->delta_v - frame_i->second.R.transpose() * dt * Matrix3d::Identity() * g0;
-
-
-            Matrix<double, 6, 6> cov_inv = Matrix<double, 6, 6>::Zero();
-            //cov.block<6, 6>(0, 0) = IMU_cov[i + 1];
-            //MatrixXd cov_inv = cov.inverse();
-            cov_inv.setIdentity();
+            tmp_A.block<3, 3>(3, 3) = pair.Ri_T_Rj;
+            tmp_A.block<3, 2>(3, 6) = pair.Ri_T * dt * lxly;
+            tmp_b.block<3, 1>(3, 0) = pair.delta_v - pair.Ri_T * dt * g0;
 
-            MatrixXd r_A = tmp_A.transpose() * cov_inv * tmp_A;
-            VectorXd r_b = tmp_A.transpose() * cov_inv * tmp_b;
+            // cov_inv is the identity
+            const Matrix<double, 9, 9> r_A = tmp_A.transpose() * tmp_A;
+            const Matrix<double, 9, 1> r_b = tmp_A.transpose() * tmp_b;
 
             A.block<6, 6>(i * 3, i * 3) += r_A.topLeftCorner<6, 6>();
             b.segment<6>(i * 3) += r_b.head<6>();
@@ -115,15 +137,18 @@ void RefineGravity(map<double, ImageFrame> &all_image_frame, Vector3d &g, Vector
             A = A * 1000.0;
             b = b * 1000.0;
             x = A.ldlt().solve(b);
-            VectorXd dg = x.segment<2>(n_state - 3);
-            g0 = (g0 + lxly * dg).normalized() * G.norm();
+            Vector2d dg = x.segment<2>(n_state - 3);
+            g0 = (g0 + lxly * dg).normalized() * config.G.norm();
             //double s = x(n_state - 1);
     }   
     g = g0;
 }
 
-bool LinearAlignment(map<double, ImageFrame> &all_image_frame, Vector3d &g, VectorXd &x)
+bool LinearAlignment(map<double, ImageFrame> &all_image_frame, const EstimatorConfig &config, Vector3d &g, VectorXd &x)
 {
+    vector<AlignmentPair> pairs;
+    collectAlignmentPairs(all_image_frame, config, pairs);
+
     int all_frame_count = all_image_frame.size();
     int n_state = all_frame_count * 3 + 3 + 1;
 
@@ -132,38 +157,30 @@ bool LinearAlignment(map<double, ImageFrame> &all_image_frame, Vector3d &g, Vect
     VectorXd b{n_state};
     b.setZero();
 
-    map<double, ImageFrame>::iterator frame_i;
-    map<double, ImageFrame>::iterator frame_j;
-    int i = 0;
-    for (frame_i = all_image_frame.begin(); next(frame_i) != all_image_frame.end(); frame_i++, i++)
+    for (int i = 0; i < int(pairs.size()); i++)
     {
-        frame_j = next(frame_i);
+        const AlignmentPair &pair = pairs[i];
+        const double dt = pair.dt;
 
-        MatrixXd tmp_A(6, 10);
+        Matrix<double, 6, 10> tmp_A;
         tmp_A.setZero();
-        VectorXd tmp_b(6);
+        Matrix<double, 6, 1> tmp_b;
         tmp_b.setZero();
 
-        double dt = frame_j->second.pre_integration->sum_dt;
-
         tmp_A.block<3, 3>(0, 0) = -dt * Matrix3d::Identity();
-        tmp_A.block<3, 3>(0, 6) = frame_i->second.R.transpose() * dt * dt / 2 * Matrix3d::Identity();
-        tmp_A.block<3, 1>(0, 9) = frame_i->second.R.transpose() * (frame_j->second.T - frame_i->second.T) / 100.0;     
-        tmp_b.block<3, 1>(0, 0) = frame_j->second.pre_integration->delta_p + frame_i->second.R.transpose() * frame_j->second.R * TIC[0] - TIC[0];
+        tmp_A.block<3, 3>(0, 6) = pair.Ri_T * dt * dt / 2;
+        tmp_A.block<3, 1>(0, 9) = pair.scale_col;     
+        tmp_b.block<3, 1>(0, 0) = pair.delta_p_tic;
         //cout << "delta_p   " << frame_j->second.pre_integration->delta_p.transpose() << endl;
         tmp_A.block<3, 3>(3, 0) = -Matrix3d::Identity();
-        tmp_A.block<3, 3>(3, 3) = frame_i->second.R.transpose() * frame_j->second.R;
-        tmp_A.block<3, 3>(3, 6) = frame_i->second.R.transpose() * dt * Matrix3d::Identity();
-        tmp_b.block<3, 1>(3, 0) = frame_j->second.pre_integration->delta_v;
+        tmp_A.block<3, 3>(3, 3) = pair.Ri_T_Rj;
+        tmp_A.block<3, 3>(3, 6) = pair.Ri_T * dt;
+        tmp_b.block<3, 1>(3, 0) = pair.delta_v;
         //cout << "delta_v   " << frame_j->second.pre_integration->delta_v.transpose() << endl;
 
-        Matrix<double, 6, 6> cov_inv = Matrix<double, 6, 6>::Zero();
-        //cov.block<6, 6>(0, 0) = IMU_cov[i + 1];
-        //MatrixXd cov_inv = cov.inverse();
-        cov_inv.setIdentity();
-
-        MatrixXd r_A = tmp_A.transpose() * cov_inv * tmp_A;
-        VectorXd r_b = tmp_A.transpose() * cov_inv * tmp_b;
+        // cov_inv is the identity
+        const Matrix<double, 10, 10> r_A = tmp_A.transpose() * tmp_A;
+        const Matrix<double, 10, 1> r_b = tmp_A.transpose() * tmp_b;
 
         A.block<6, 6>(i * 3, i * 3) += r_A.topLeftCorner<6, 6>();
         b.segment<6>(i * 3) += r_b.head<6>();
@@ -178,29 +195,30 @@ bool LinearAlignment(map<double, ImageFrame> &all_image_frame, Vector3d &g, Vect
     b = b * 1000.0;
     x = A.ldlt().solve(b);
     double s = x(n_state - 1) / 100.0;
-    ROS_DEBUG("estimated scale: %f", s);
+    GVINS_DEBUG("estimated scale: %f", s);
     g = x.segment<3>(n_state - 4);
-    ROS_DEBUG_STREAM(" result g     " << g.norm() << " " << g.transpose());
-    if(fabs(g.norm() - G.norm()) > 1.0 || s < 0)
+    GVINS_DEBUG_STREAM(" result g     " << g.norm() << " " << g.transpose());
+    if(fabs(g.norm() - config.G.norm()) > 1.0 || s < 0)
     {
         return false;
     }
 
-    RefineGravity(all_image_frame, g, x);
+    RefineGravity(pairs, config, g, x);
     s = (x.tail<1>())(0) / 100.0;
     (x.tail<1>())(0) = s;
-    ROS_DEBUG_STREAM(" refine     " << g.norm() << " " << g.transpose());
+    GVINS_DEBUG_STREAM(" refine     " << g.norm() << " " << g.transpose());
     if(s < 0.0 )
         return false;   
     else
         return true;
 }
 
-bool VisualIMUAlignment(map<double, ImageFrame> &all_image_frame, Vector3d* Bgs, Vector3d &g, VectorXd &x)
+bool VisualIMUAlignment(map<double, ImageFrame> &all_image_frame, WindowArray<Vector3d, WINDOW_SIZE + 1> &Bgs, 
+    const EstimatorConfig &config, Vector3d &g, VectorXd &x)
 {
     solveGyroscopeBias(all_image_frame, Bgs);
 
-    if(LinearAlignment(all_image_frame, g, x))
+    if(LinearAlignment(all_image_frame, config, g, x))
         return true;
     else 
         return false;
@@ -3,7 +3,7 @@
 #include <iostream>
 #include "../factor/imu_factor.h"
 #include "../utility/utility.h"
-#include <ros/ros.h>
+#include <gvins_feature_tracker/log.h>
 #include <map>
 #include "../feature_manager.h"
 
@@ -26,4 +26,9 @@ class ImageFrame
         bool is_key_frame;
 };
 
-bool VisualIMUAlignment(map<double, ImageFrame> &all_image_frame, Vector3d* Bgs, Vector3d &g, VectorXd &x);
\ No newline at end of file
+// gyroscope bias from the rotations R of consecutive frames, the preintegrations of all_image_frame repropagated
+void solveGyroscopeBias(map<double, ImageFrame> &all_image_frame, WindowArray<Vector3d, WINDOW_SIZE + 1> &Bgs);
+
+// the camera-IMU translation and the gravity magnitude come from config
+bool VisualIMUAlignment(map<double, ImageFrame> &all_image_frame, WindowArray<Vector3d, WINDOW_SIZE + 1> &Bgs, 
+    const EstimatorConfig &config, Vector3d &g, VectorXd &x);
\ No newline at end of file
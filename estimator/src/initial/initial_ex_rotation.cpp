@@ -2,61 +2,54 @@
 
 InitialEXRotation::InitialEXRotation(){
     frame_count = 0;
-    Rc.push_back(Matrix3d::Identity());
-    Rc_g.push_back(Matrix3d::Identity());
-    Rimu.push_back(Matrix3d::Identity());
+    AtA.setZero();
+    ric_cov.setZero();
     ric = Matrix3d::Identity();
 }
 
 bool InitialEXRotation::CalibrationExRotation(vector<pair<Vector3d, Vector3d>> corres, Quaterniond delta_q_imu, Matrix3d &calib_ric_result)
 {
     frame_count++;
-    Rc.push_back(solveRelativeR(corres));
-    Rimu.push_back(delta_q_imu.toRotationMatrix());
-    Rc_g.push_back(ric.inverse() * delta_q_imu * ric);
+    const Matrix3d Rc = solveRelativeR(corres);
+    const Matrix3d Rimu = delta_q_imu.toRotationMatrix();
+    // the huber weight only depends on this pair and the estimate at the time it is added
+    const Matrix3d Rc_g = ric.inverse() * delta_q_imu * ric;
 
-    Eigen::MatrixXd A(frame_count * 4, 4);
-    A.setZero();
-    int sum_ok = 0;
-    for (int i = 1; i <= frame_count; i++)
-    {
-        Quaterniond r1(Rc[i]);
-        Quaterniond r2(Rc_g[i]);
+    Quaterniond r1(Rc);
+    Quaterniond r2(Rc_g);
 
-        double angular_distance = 180 / M_PI * r1.angularDistance(r2);
-        ROS_DEBUG(
-            "%d %f", i, angular_distance);
+    double angular_distance = 180 / M_PI * r1.angularDistance(r2);
+    GVINS_DEBUG(
+        "%d %f", frame_count, angular_distance);
 
-        double huber = angular_distance > 5.0 ? 5.0 / angular_distance : 1.0;
-        ++sum_ok;
-        Matrix4d L, R;
+    double huber = angular_distance > 5.0 ? 5.0 / angular_distance : 1.0;
+    Matrix4d L, R;
 
-        double w = Quaterniond(Rc[i]).w();
-        Vector3d q = Quaterniond(Rc[i]).vec();
-        L.block<3, 3>(0, 0) = w * Matrix3d::Identity() + Utility::skewSymmetric(q);
-        L.block<3, 1>(0, 3) = q;
-        L.block<1, 3>(3, 0) = -q.transpose();
-        L(3, 3) = w;
+    double w = r1.w();
+    Vector3d q = r1.vec();
+    L.block<3, 3>(0, 0) = w * Matrix3d::Identity() + Utility::skewSymmetric(q);
+    L.block<3, 1>(0, 3) = q;
+    L.block<1, 3>(3, 0) = -q.transpose();
+    L(3, 3) = w;
 
-        Quaterniond R_ij(Rimu[i]);
-        w = R_ij.w();
-        q = R_ij.vec();
-        R.block<3, 3>(0, 0) = w * Matrix3d::Identity() - Utility::skewSymmetric(q);
-        R.block<3, 1>(0, 3) = q;
-        R.block<1, 3>(3, 0) = -q.transpose();
-        R(3, 3) = w;
+    Quaterniond R_ij(Rimu);
+    w = R_ij.w();
+    q = R_ij.vec();
+    R.block<3, 3>(0, 0) = w * Matrix3d::Identity() - Utility::skewSymmetric(q);
+    R.block<3, 1>(0, 3) = q;
+    R.block<1, 3>(3, 0) = -q.transpose();
+    R(3, 3) = w;
 
-        A.block<4, 4>((i - 1) * 4, 0) = huber * (L - R);
-    }
+    const Matrix4d A_i = huber * (L - R);
+    AtA.noalias() += A_i.transpose() * A_i;
 
-    JacobiSVD<MatrixXd> svd(A, ComputeFullU | ComputeFullV);
-    Matrix<double, 4, 1> x = svd.matrixV().col(3);
+    // singular values / right singular vectors of A are the square roots / eigenvectors of A^T*A (ascending)
+    SelfAdjointEigenSolver<Matrix4d> eig(AtA);
+    Matrix<double, 4, 1> x = eig.eigenvectors().col(0);
     Quaterniond estimated_R(x);
     ric = estimated_R.toRotationMatrix().inverse();
-    //cout << svd.singularValues().transpose() << endl;
-    //cout << ric << endl;
-    Vector3d ric_cov;
-    ric_cov = svd.singularValues().tail<3>();
+    const Vector4d sv = eig.eigenvalues().cwiseMax(0.0).cwiseSqrt();
+    ric_cov << sv(2), sv(1), sv(0);
     if (frame_count >= WINDOW_SIZE && ric_cov(1) > 0.25)
     {
         calib_ric_result = ric;
@@ -120,7 +113,7 @@ double InitialEXRotation::testTriangulation(const vector<cv::Point2f> &l,
         if (p_3d_l(2) > 0 && p_3d_r(2) > 0)
             front_count++;
     }
-    ROS_DEBUG("MotionEstimator: %f", 1.0 * front_count / pointcloud.cols);
+    GVINS_DEBUG("MotionEstimator: %f", 1.0 * front_count / pointcloud.cols);
     return 1.0 * front_count / pointcloud.cols;
 }
 
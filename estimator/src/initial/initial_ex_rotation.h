@@ -8,14 +8,18 @@ using namespace std;
 
 #include <eigen3/Eigen/Dense>
 using namespace Eigen;
-#include <ros/console.h>
+#include <gvins_feature_tracker/log.h>
 
 /* This class help you to calibrate extrinsic rotation between imu and camera when your totally don't konw the extrinsic parameter */
+/* 每对旋转的约束在加入时累加到 4x4 法方程 A^T*A 中, 每次更新的代价与已加入的帧数无关 */
 class InitialEXRotation
 {
 public:
 	InitialEXRotation();
     bool CalibrationExRotation(vector<pair<Vector3d, Vector3d>> corres, Quaterniond delta_q_imu, Matrix3d &calib_ric_result);
+    // second smallest singular value of the stacked system, the result is accepted once it exceeds 0.25
+    double convergence() const { return ric_cov(1); }
+    int frameCount() const { return frame_count; }
 private:
 	Matrix3d solveRelativeR(const vector<pair<Vector3d, Vector3d>> &corres);
 
@@ -27,9 +31,8 @@ private:
                     cv::Mat_<double> &t1, cv::Mat_<double> &t2);
     int frame_count;
 
-    vector< Matrix3d > Rc;
-    vector< Matrix3d > Rimu;
-    vector< Matrix3d > Rc_g;
+    Matrix4d AtA;       // sum of huber^2 * (L - R)^T * (L - R) over all rotation pairs
+    Vector3d ric_cov;   // the three smallest singular values of A, descending (tail of the SVD spectrum)
     Matrix3d ric;
 };
 
@@ -1,6 +1,6 @@
 #include "initial_sfm.h"
 
-GlobalSFM::GlobalSFM(){}
+GlobalSFM::GlobalSFM() : max_solver_time(0.2), feature_num(0), num_prior_points(0) {}
 
 void GlobalSFM::triangulatePoint(Eigen::Matrix<double, 3, 4> &Pose0, Eigen::Matrix<double, 3, 4> &Pose1,
 						Vector2d &point0, Vector2d &point1, Vector3d &point_3d)
@@ -109,6 +109,59 @@ void GlobalSFM::triangulateTwoFrames(int frame0, Eigen::Matrix<double, 3, 4> &Po
 	}
 }
 
+/*
+ * 前一次尝试的 SFM 与本次只差一个相似变换: 用两次都有的帧的相机中心 (umeyama) 求出它,
+ * 把前一次 BA 优化过的特征点变换过来替换两帧三角化的结果. 对齐误差大或点不在所有观测相机前方时不用
+ */
+void GlobalSFM::applyPrior(int frame_num, const Matrix3d *c_Rotation, const Vector3d *c_Translation,
+						   vector<SFMFeature> &sfm_f, const SFMPrior &prior)
+{
+	Matrix<double, 3, Dynamic> src(3, prior.centers.size()), dst(3, prior.centers.size());
+	int num_centers = 0;
+	for (auto &center : prior.centers)
+	{
+		if (center.first < 0 || center.first >= frame_num)
+			continue;
+		src.col(num_centers) = center.second;
+		dst.col(num_centers) = -c_Rotation[center.first].transpose() * c_Translation[center.first];
+		num_centers++;
+	}
+	if (num_centers < 3)
+		return;
+	src.conservativeResize(3, num_centers);
+	dst.conservativeResize(3, num_centers);
+
+	const Matrix4d S = umeyama(src, dst, true);
+	const Matrix3d sR = S.topLeftCorner<3, 3>();
+	const Vector3d st = S.topRightCorner<3, 1>();
+	const double spread = (dst.colwise() - dst.rowwise().mean()).norm();
+	const double residual = ((sR * src).colwise() + st - dst).norm();
+	if (!(residual < 0.05 * spread))
+		return;
+
+	for (int j = 0; j < feature_num; j++)
+	{
+		if (sfm_f[j].state != true)
+			continue;
+		auto it = prior.points.find(sfm_f[j].id);
+		if (it == prior.points.end())
+			continue;
+		const Vector3d point_3d = sR * it->second + st;
+		bool in_front = true;
+		for (int k = 0; k < (int)sfm_f[j].observation.size() && in_front; k++)
+		{
+			const int frame = sfm_f[j].observation[k].first;
+			in_front = (c_Rotation[frame] * point_3d + c_Translation[frame]).z() > 0;
+		}
+		if (!in_front)
+			continue;
+		sfm_f[j].position[0] = point_3d(0);
+		sfm_f[j].position[1] = point_3d(1);
+		sfm_f[j].position[2] = point_3d(2);
+		num_prior_points++;
+	}
+}
+
 // 	 q w_R_cam t w_R_cam
 //  c_rotation cam_R_w 
 //  c_translation cam_R_w
@@ -116,9 +169,11 @@ void GlobalSFM::triangulateTwoFrames(int frame0, Eigen::Matrix<double, 3, 4> &Po
 // relative_t[i][j]  j_t_ji  (j < i)
 bool GlobalSFM::construct(int frame_num, Quaterniond* q, Vector3d* T, int l,
 			  const Matrix3d relative_R, const Vector3d relative_T,
-			  vector<SFMFeature> &sfm_f, map<int, Vector3d> &sfm_tracked_points)
+			  vector<SFMFeature> &sfm_f, map<int, Vector3d> &sfm_tracked_points,
+			  const SFMPrior *prior)
 {
 	feature_num = sfm_f.size();
+	num_prior_points = 0;
 	//cout << "set 0 and " << l << " as known " << endl;
 	// have relative_r relative_t
 	// intial two view
@@ -215,6 +270,8 @@ bool GlobalSFM::construct(int frame_num, Quaterniond* q, Vector3d* T, int l,
 			//cout << "trangulated : " << frame_0 << " " << frame_1 << "  3d point : "  << j << "  " << point_3d.transpose() << endl;
 		}		
 	}
+	if (prior)
+		applyPrior(frame_num, c_Rotation, c_Translation, sfm_f, *prior);
 
 /*
 	for (int i = 0; i < frame_num; i++)
@@ -274,7 +331,7 @@ bool GlobalSFM::construct(int frame_num, Quaterniond* q, Vector3d* T, int l,
 	ceres::Solver::Options options;
 	options.linear_solver_type = ceres::DENSE_SCHUR;
 	//options.minimizer_progress_to_stdout = true;
-	options.max_solver_time_in_seconds = 0.2;
+	options.max_solver_time_in_seconds = max_solver_time;
 	ceres::Solver::Summary summary;
 	ceres::Solve(options, &problem, &summary);
 	//std::cout << summary.BriefReport() << "\n";
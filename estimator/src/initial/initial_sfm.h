@@ -53,15 +53,30 @@ struct ReprojectionError3D
 	double observed_v;
 };
 
+// result of an earlier attempt (camera centres and points in the SFM frame of that attempt), used as the BA initial value
+struct SFMPrior
+{
+	map<int, Vector3d> centers;		// by frame index of the construct() call
+	map<int, Vector3d> points;		// by feature id
+};
+
 class GlobalSFM
 {
 public:
 	GlobalSFM();
 	bool construct(int frame_num, Quaterniond* q, Vector3d* T, int l,
 			  const Matrix3d relative_R, const Vector3d relative_T,
-			  vector<SFMFeature> &sfm_f, map<int, Vector3d> &sfm_tracked_points);
+			  vector<SFMFeature> &sfm_f, map<int, Vector3d> &sfm_tracked_points,
+			  const SFMPrior *prior = nullptr);
+	// points of the last construct() initialised from the prior
+	int numPriorPoints() const { return num_prior_points; }
+
+	double max_solver_time;		// s, time limit of the full BA besides the default iteration limit
 
 private:
+	void applyPrior(int frame_num, const Matrix3d *c_Rotation, const Vector3d *c_Translation,
+					vector<SFMFeature> &sfm_f, const SFMPrior &prior);
+
 	bool solveFrameByPnP(Matrix3d &R_initial, Vector3d &P_initial, int i, vector<SFMFeature> &sfm_f);
 
 	void triangulatePoint(Eigen::Matrix<double, 3, 4> &Pose0, Eigen::Matrix<double, 3, 4> &Pose1,
@@ -71,4 +86,5 @@ private:
 							  vector<SFMFeature> &sfm_f);
 
 	int feature_num;
+	int num_prior_points;
 };
\ No newline at end of file
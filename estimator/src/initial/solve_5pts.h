@@ -8,13 +8,15 @@ using namespace std;
 #include <eigen3/Eigen/Dense>
 using namespace Eigen;
 
-#include <ros/console.h>
+#include <gvins_feature_tracker/log.h>
 
 class MotionEstimator
 {
   public:
 
     bool solveRelativeRT(const vector<pair<Vector3d, Vector3d>> &corres, Matrix3d &R, Vector3d &T);
+    // inlier_cnt: correspondences consistent with the recovered pose, 0 if there are too few to try
+    bool solveRelativeRT(const vector<pair<Vector3d, Vector3d>> &corres, Matrix3d &R, Vector3d &T, int &inlier_cnt);
 
   private:
     double testTriangulation(const vector<cv::Point2f> &l,
@@ -0,0 +1,188 @@
+#include "odometry_output.h"
+
+#include <chrono>
+
+#include <ros/ros.h>
+
+#include "utility/tic_toc.h"
+#include "utility/utility.h"
+
+namespace
+{
+    // seconds between two latency reports
+    const double STATS_PERIOD = 10.0;
+}
+
+OdometryOutput::OdometryOutput()
+    : seq(0), has_state(false), rate(0), max_extrapolation(0), running(false),
+      stats_start(-1), num_published(0), num_stale(0), sum_age(0), max_age(0),
+      sum_publish(0), max_publish(0), max_jitter(0)
+{
+    for (std::atomic<double> &x : slots)
+        x.store(0, std::memory_order_relaxed);
+}
+
+OdometryOutput::~OdometryOutput()
+{
+    stop();
+}
+
+void OdometryOutput::update(double t, const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, const Eigen::Vector3d &V,
+                            const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr)
+{
+    const double values[STATE_SIZE] = {t, P.x(), P.y(), P.z(), Q.w(), Q.x(), Q.y(), Q.z(),
+                                       V.x(), V.y(), V.z(), acc.x(), acc.y(), acc.z(), gyr.x(), gyr.y(), gyr.z()};
+    const unsigned s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int i = 0; i < STATE_SIZE; ++i)
+        slots[i].store(values[i], std::memory_order_relaxed);
+    has_state.store(true, std::memory_order_relaxed);
+    seq.store(s + 2, std::memory_order_release);
+}
+
+void OdometryOutput::invalidate()
+{
+    const unsigned s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    has_state.store(false, std::memory_order_relaxed);
+    seq.store(s + 2, std::memory_order_release);
+}
+
+bool OdometryOutput::load(State &s) const
+{
+    double values[STATE_SIZE];
+    bool valid;
+    unsigned s0, s1;
+    do
+    {
+        s0 = seq.load(std::memory_order_acquire);
+        valid = has_state.load(std::memory_order_relaxed);
+        for (int i = 0; i < STATE_SIZE; ++i)
+            values[i] = slots[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        s1 = seq.load(std::memory_order_relaxed);
+    } while ((s0 & 1) || s0 != s1);
+    if (!valid)
+        return false;
+
+    s.t = values[0];
+    s.P = Eigen::Vector3d(values[1], values[2], values[3]);
+    s.Q = Eigen::Quaterniond(values[4], values[5], values[6], values[7]);
+    s.V = Eigen::Vector3d(values[8], values[9], values[10]);
+    s.acc = Eigen::Vector3d(values[11], values[12], values[13]);
+    s.gyr = Eigen::Vector3d(values[14], values[15], values[16]);
+    return true;
+}
+
+bool OdometryOutput::query(double t, Eigen::Vector3d &P, Eigen::Quaterniond &Q, Eigen::Vector3d &V, double *stamp) const
+{
+    State s;
+    if (!load(s))
+        return false;
+    const double dt = std::max(t - s.t, 0.0);
+    if (dt > max_extrapolation)
+        return false;
+
+    P = s.P + s.V * dt + 0.5 * s.acc * dt * dt;
+    V = s.V + s.acc * dt;
+    Q = (s.Q * Utility::deltaQ(s.gyr * dt)).normalized();
+    if (stamp)
+        *stamp = s.t + dt;
+    return true;
+}
+
+void OdometryOutput::start(double rate_, double max_extrapolation_, const Publisher &publisher_)
+{
+    stop();
+    rate = rate_;
+    max_extrapolation = max_extrapolation_;
+    publisher = publisher_;
+    if (rate <= 0)
+        return;
+    running = true;
+    output_thread = std::thread(&OdometryOutput::run, this);
+}
+
+void OdometryOutput::stop()
+{
+    running = false;
+    if (output_thread.joinable())
+        output_thread.join();
+}
+
+void OdometryOutput::publish(double t)
+{
+    State s;
+    if (!publisher || !load(s))
+        return;
+    Eigen::Vector3d P, V;
+    Eigen::Quaterniond Q;
+    double stamp;
+    const bool fresh = query(t, P, Q, V, &stamp);
+    TicToc t_publish;
+    if (fresh)
+        publisher(P, Q, V, stamp);
+    record(t, t - s.t, t_publish.toc(), 0, !fresh);
+}
+
+void OdometryOutput::run()
+{
+    typedef std::chrono::steady_clock Clock;
+    const Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate));
+    Clock::time_point next = Clock::now() + period;
+    while (running && ros::ok())
+    {
+        std::this_thread::sleep_until(next);
+        const double jitter_ms = std::chrono::duration<double, std::milli>(Clock::now() - next).count();
+        next += period;
+        // fell more than one period behind, do not burst to catch up
+        if (Clock::now() > next)
+            next = Clock::now() + period;
+
+        State s;
+        if (!load(s))
+            continue;
+        const double now = ros::Time::now().toSec();
+        Eigen::Vector3d P, V;
+        Eigen::Quaterniond Q;
+        double stamp;
+        const bool fresh = query(now, P, Q, V, &stamp);
+        TicToc t_publish;
+        if (fresh)
+            publisher(P, Q, V, stamp);
+        record(now, now - s.t, t_publish.toc(), jitter_ms, !fresh);
+    }
+}
+
+void OdometryOutput::record(double now, double stamp_age, double publish_ms, double jitter_ms, bool stale)
+{
+    if (stats_start < 0)
+        stats_start = now;
+    if (stale)
+        ++num_stale;
+    else
+    {
+        const double age_ms = std::max(stamp_age, 0.0) * 1000.0;
+        ++num_published;
+        sum_age += age_ms;
+        max_age = std::max(max_age, age_ms);
+        sum_publish += publish_ms;
+        max_publish = std::max(max_publish, publish_ms);
+    }
+    max_jitter = std::max(max_jitter, jitter_ms);
+
+    if (now - stats_start < STATS_PERIOD)
+        return;
+    if (num_published > 0)
+        ROS_INFO("odometry output: %zu published (%.1f Hz), %zu stale, extrapolation mean %.2f max %.2f ms, "
+                 "publish mean %.3f max %.3f ms, tick jitter max %.3f ms",
+                 num_published, num_published / (now - stats_start), num_stale, sum_age / num_published, max_age,
+                 sum_publish / num_published, max_publish, max_jitter);
+    else
+        ROS_WARN("odometry output: nothing published in %.1f s, %zu stale", now - stats_start, num_stale);
+    stats_start = now;
+    num_published = num_stale = 0;
+    sum_age = max_age = sum_publish = max_publish = max_jitter = 0;
+}
@@ -0,0 +1,83 @@
+#ifndef ODOMETRY_OUTPUT_H
+#define ODOMETRY_OUTPUT_H
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <thread>
+
+#include <eigen3/Eigen/Dense>
+
+/**
+ * 高频里程计输出级
+ * ImuPropagator 每次 push/correct 之后把最新状态写入一个 seqlock 快照, 读端不加锁, 写端不会被读端阻塞;
+ * start(rate) 后由独立线程按固定频率读快照, 以恒定加速度/角速度外推到当前时刻再发布,
+ * 不再依赖 IMU 回调的调度; rate 为 0 时仍在 IMU 回调中逐帧 publish()
+ * 快照比 max_extrapolation 更老时不外推也不发布 (计入 stale), 并周期性输出发布延迟统计
+ */
+class OdometryOutput
+{
+  public:
+    // P, Q, V at stamp
+    typedef std::function<void(const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, const Eigen::Vector3d &V,
+                               double stamp)> Publisher;
+
+    OdometryOutput();
+    ~OdometryOutput();
+
+    // writer, one thread at a time (the caller's state mutex); acc is world frame without gravity,
+    // gyr the unbiased body rate, both of the sample at t
+    void update(double t, const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, const Eigen::Vector3d &V,
+                const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr);
+    void invalidate();
+
+    // any thread: state extrapolated to t, false if there is no state or t is beyond the latency budget;
+    // t before the snapshot returns the snapshot itself, stamp (optional) is the time actually returned
+    bool query(double t, Eigen::Vector3d &P, Eigen::Quaterniond &Q, Eigen::Vector3d &V, double *stamp = nullptr) const;
+
+    // rate > 0: publish from an own thread at rate Hz; rate == 0: only publish() does
+    void start(double rate, double max_extrapolation, const Publisher &publisher);
+    void stop();
+    bool threaded() const { return output_thread.joinable(); }
+
+    // synchronous output of the snapshot at t, used when no output thread runs
+    void publish(double t);
+
+  private:
+    // t, P(3), Q(4), V(3), acc(3), gyr(3)
+    enum { STATE_SIZE = 17 };
+
+    struct State
+    {
+        double t;
+        Eigen::Vector3d P, V, acc, gyr;
+        Eigen::Quaterniond Q;
+    };
+
+    OdometryOutput(const OdometryOutput&) = delete;
+    OdometryOutput& operator=(const OdometryOutput&) = delete;
+
+    bool load(State &s) const;
+    void run();
+    void record(double now, double stamp_age, double publish_ms, double jitter_ms, bool stale);
+
+    // seqlock: odd while the writer is inside update(), slots are relaxed atomics so readers never race
+    alignas(64) std::atomic<unsigned> seq;
+    std::atomic<bool> has_state;
+    std::array<std::atomic<double>, STATE_SIZE> slots;
+
+    double rate;
+    double max_extrapolation;
+    Publisher publisher;
+    std::atomic<bool> running;
+    std::thread output_thread;
+
+    // publish statistics, touched only by the publishing thread
+    double stats_start;
+    size_t num_published, num_stale;
+    double sum_age, max_age;            // ms between the newest IMU sample and the published stamp
+    double sum_publish, max_publish;    // ms spent in the publisher
+    double max_jitter;                  // ms a tick woke up late
+};
+
+#endif
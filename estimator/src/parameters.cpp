@@ -1,80 +1,245 @@
 #include "parameters.h"
 
-double INIT_DEPTH;
-double MIN_PARALLAX;
-double ACC_N, ACC_W;
-double GYR_N, GYR_W;
-
-std::vector<Eigen::Matrix3d> RIC;
-std::vector<Eigen::Vector3d> TIC;
-
-Eigen::Vector3d G{0.0, 0.0, 9.8};
-
-double BIAS_ACC_THRESHOLD;
-double BIAS_GYR_THRESHOLD;
-double SOLVER_TIME;
-int NUM_ITERATIONS;
-int ESTIMATE_EXTRINSIC;
-int ESTIMATE_TD;
-std::string EX_CALIB_RESULT_PATH;
-std::string VINS_RESULT_PATH;
-std::string FACTOR_GRAPH_RESULT_PATH;
-std::string IMU_TOPIC;
-double ROW, COL;
-double TD;
-
-bool GNSS_ENABLE;
-std::string GNSS_EPHEM_TOPIC;
-std::string GNSS_GLO_EPHEM_TOPIC;
-std::string GNSS_MEAS_TOPIC;
-std::string GNSS_IONO_PARAMS_TOPIC;
-std::string GNSS_TP_INFO_TOPIC;
-std::vector<double> GNSS_IONO_DEFAULT_PARAMS;
-bool GNSS_LOCAL_ONLINE_SYNC;
-std::string LOCAL_TRIGGER_INFO_TOPIC;
-double GNSS_LOCAL_TIME_DIFF;
-double GNSS_ELEVATION_THRES;
-double GNSS_PSR_STD_THRES;
-double GNSS_DOPP_STD_THRES;
-uint32_t GNSS_TRACK_NUM_THRES;
-double GNSS_DDT_WEIGHT;
-std::string GNSS_RESULT_PATH;
-
-template <typename T>
-T readParam(ros::NodeHandle &n, std::string name)
+EstimatorConfig PROCESS_CONFIG;
+
+double &INIT_DEPTH = PROCESS_CONFIG.INIT_DEPTH;
+double &MIN_PARALLAX = PROCESS_CONFIG.MIN_PARALLAX;
+double &ACC_N = PROCESS_CONFIG.ACC_N;
+double &ACC_W = PROCESS_CONFIG.ACC_W;
+double &GYR_N = PROCESS_CONFIG.GYR_N;
+double &GYR_W = PROCESS_CONFIG.GYR_W;
+
+std::vector<Eigen::Matrix3d> &RIC = PROCESS_CONFIG.RIC;
+std::vector<Eigen::Vector3d> &TIC = PROCESS_CONFIG.TIC;
+
+Eigen::Vector3d &G = PROCESS_CONFIG.G;
+
+double &BIAS_ACC_THRESHOLD = PROCESS_CONFIG.BIAS_ACC_THRESHOLD;
+double &BIAS_GYR_THRESHOLD = PROCESS_CONFIG.BIAS_GYR_THRESHOLD;
+double &SOLVER_TIME = PROCESS_CONFIG.SOLVER_TIME;
+int &NUM_ITERATIONS = PROCESS_CONFIG.NUM_ITERATIONS;
+double &LATENCY_TARGET = PROCESS_CONFIG.LATENCY_TARGET;
+double &MIN_SOLVER_TIME = PROCESS_CONFIG.MIN_SOLVER_TIME;
+double &SOLVER_STALL_RATIO = PROCESS_CONFIG.SOLVER_STALL_RATIO;
+bool &SOLVER_WATCHDOG = PROCESS_CONFIG.SOLVER_WATCHDOG;
+double &SOLVER_DIVERGENCE_RATIO = PROCESS_CONFIG.SOLVER_DIVERGENCE_RATIO;
+double &SOLVER_MAX_VELOCITY = PROCESS_CONFIG.SOLVER_MAX_VELOCITY;
+bool &INCREMENTAL_PROBLEM = PROCESS_CONFIG.INCREMENTAL_PROBLEM;
+int &NUM_SOLVER_THREADS = PROCESS_CONFIG.NUM_SOLVER_THREADS;
+std::string &LINEAR_SOLVER = PROCESS_CONFIG.LINEAR_SOLVER;
+int &MAX_OPTIMIZED_FEATURES = PROCESS_CONFIG.MAX_OPTIMIZED_FEATURES;
+bool &VISUAL_TRACK_FACTOR = PROCESS_CONFIG.VISUAL_TRACK_FACTOR;
+bool &STRUCTURELESS_VISUAL = PROCESS_CONFIG.STRUCTURELESS_VISUAL;
+bool &GPU_DENSE = PROCESS_CONFIG.GPU_DENSE;
+int &GPU_DENSE_MIN_SIZE = PROCESS_CONFIG.GPU_DENSE_MIN_SIZE;
+std::vector<PerformanceProfile> &PERFORMANCE_PROFILES = PROCESS_CONFIG.PERFORMANCE_PROFILES;
+std::string &PERFORMANCE_PROFILE = PROCESS_CONFIG.PERFORMANCE_PROFILE;
+bool &VISUAL_PACKED_EVAL = PROCESS_CONFIG.VISUAL_PACKED_EVAL;
+int &NUM_WORKER_THREADS = PROCESS_CONFIG.NUM_WORKER_THREADS;
+bool &DETERMINISTIC = PROCESS_CONFIG.DETERMINISTIC;
+ThreadConfig &PROCESS_THREAD = PROCESS_CONFIG.PROCESS_THREAD;
+ThreadConfig &MARGINALIZATION_THREADS = PROCESS_CONFIG.MARGINALIZATION_THREADS;
+ThreadConfig &CERES_THREADS = PROCESS_CONFIG.CERES_THREADS;
+bool &PIPELINE_MARGINALIZATION = PROCESS_CONFIG.PIPELINE_MARGINALIZATION;
+bool &SPARSIFY_PRIOR = PROCESS_CONFIG.SPARSIFY_PRIOR;
+int &MOTION_ONLY_FRAMES = PROCESS_CONFIG.MOTION_ONLY_FRAMES;
+bool &COMPACT_FEATURE_MSG = PROCESS_CONFIG.COMPACT_FEATURE_MSG;
+int &CONFIG_WINDOW_SIZE = PROCESS_CONFIG.CONFIG_WINDOW_SIZE;
+double &ODOMETRY_RATE = PROCESS_CONFIG.ODOMETRY_RATE;
+double &ODOMETRY_MAX_EXTRAPOLATION = PROCESS_CONFIG.ODOMETRY_MAX_EXTRAPOLATION;
+bool &ASYNC_VISUALIZATION = PROCESS_CONFIG.ASYNC_VISUALIZATION;
+std::map<std::string, double> &VISUALIZATION_RATES = PROCESS_CONFIG.VISUALIZATION_RATES;
+bool &PATH_FULL_HISTORY = PROCESS_CONFIG.PATH_FULL_HISTORY;
+int &PATH_MAX_POSES = PROCESS_CONFIG.PATH_MAX_POSES;
+double &PATH_MAX_AGE = PROCESS_CONFIG.PATH_MAX_AGE;
+double &PATH_HISTORY_SPACING = PROCESS_CONFIG.PATH_HISTORY_SPACING;
+double &ADMISSION_MAX_LATENCY = PROCESS_CONFIG.ADMISSION_MAX_LATENCY;
+double &DIAGNOSTICS_PERIOD = PROCESS_CONFIG.DIAGNOSTICS_PERIOD;
+double &CHECKPOINT_INTERVAL = PROCESS_CONFIG.CHECKPOINT_INTERVAL;
+double &CHECKPOINT_MAX_GAP = PROCESS_CONFIG.CHECKPOINT_MAX_GAP;
+bool &WARM_START = PROCESS_CONFIG.WARM_START;
+std::string &CHECKPOINT_PATH = PROCESS_CONFIG.CHECKPOINT_PATH;
+bool &RELOCALIZATION = PROCESS_CONFIG.RELOCALIZATION;
+int &RELO_MAX_KEYFRAMES = PROCESS_CONFIG.RELO_MAX_KEYFRAMES;
+int &RELO_MIN_INLIERS = PROCESS_CONFIG.RELO_MIN_INLIERS;
+double &RELO_SKIP_RECENT = PROCESS_CONFIG.RELO_SKIP_RECENT;
+double &RELO_POSE_WEIGHT = PROCESS_CONFIG.RELO_POSE_WEIGHT;
+std::string &RELO_MAP_PATH = PROCESS_CONFIG.RELO_MAP_PATH;
+bool &RELO_MAP_SAVE = PROCESS_CONFIG.RELO_MAP_SAVE;
+bool &STEREO_INIT = PROCESS_CONFIG.STEREO_INIT;
+double &STEREO_MAX_DEPTH = PROCESS_CONFIG.STEREO_MAX_DEPTH;
+double &IMU_PREINT_RATE = PROCESS_CONFIG.IMU_PREINT_RATE;
+int &ESTIMATE_EXTRINSIC = PROCESS_CONFIG.ESTIMATE_EXTRINSIC;
+int &ESTIMATE_TD = PROCESS_CONFIG.ESTIMATE_TD;
+std::string &EX_CALIB_RESULT_PATH = PROCESS_CONFIG.EX_CALIB_RESULT_PATH;
+std::string &VINS_RESULT_PATH = PROCESS_CONFIG.VINS_RESULT_PATH;
+std::string &FACTOR_GRAPH_RESULT_PATH = PROCESS_CONFIG.FACTOR_GRAPH_RESULT_PATH;
+std::string &IMU_TOPIC = PROCESS_CONFIG.IMU_TOPIC;
+double &ROW = PROCESS_CONFIG.ROW;
+double &COL = PROCESS_CONFIG.COL;
+double &TD = PROCESS_CONFIG.TD;
+
+bool &GNSS_ENABLE = PROCESS_CONFIG.GNSS_ENABLE;
+std::string &GNSS_EPHEM_TOPIC = PROCESS_CONFIG.GNSS_EPHEM_TOPIC;
+std::string &GNSS_GLO_EPHEM_TOPIC = PROCESS_CONFIG.GNSS_GLO_EPHEM_TOPIC;
+std::string &GNSS_MEAS_TOPIC = PROCESS_CONFIG.GNSS_MEAS_TOPIC;
+std::string &GNSS_IONO_PARAMS_TOPIC = PROCESS_CONFIG.GNSS_IONO_PARAMS_TOPIC;
+std::string &GNSS_TP_INFO_TOPIC = PROCESS_CONFIG.GNSS_TP_INFO_TOPIC;
+std::vector<double> &GNSS_IONO_DEFAULT_PARAMS = PROCESS_CONFIG.GNSS_IONO_DEFAULT_PARAMS;
+bool &GNSS_LOCAL_ONLINE_SYNC = PROCESS_CONFIG.GNSS_LOCAL_ONLINE_SYNC;
+std::string &LOCAL_TRIGGER_INFO_TOPIC = PROCESS_CONFIG.LOCAL_TRIGGER_INFO_TOPIC;
+double &GNSS_LOCAL_TIME_DIFF = PROCESS_CONFIG.GNSS_LOCAL_TIME_DIFF;
+double &GNSS_ELEVATION_THRES = PROCESS_CONFIG.GNSS_ELEVATION_THRES;
+double &GNSS_PSR_STD_THRES = PROCESS_CONFIG.GNSS_PSR_STD_THRES;
+double &GNSS_DOPP_STD_THRES = PROCESS_CONFIG.GNSS_DOPP_STD_THRES;
+uint32_t &GNSS_TRACK_NUM_THRES = PROCESS_CONFIG.GNSS_TRACK_NUM_THRES;
+uint32_t &GNSS_MAX_SATS = PROCESS_CONFIG.GNSS_MAX_SATS;
+double &GNSS_PSR_OUTLIER_THRES = PROCESS_CONFIG.GNSS_PSR_OUTLIER_THRES;
+double &GNSS_DOPP_OUTLIER_THRES = PROCESS_CONFIG.GNSS_DOPP_OUTLIER_THRES;
+double &GNSS_DDT_WEIGHT = PROCESS_CONFIG.GNSS_DDT_WEIGHT;
+bool &GNSS_EPOCH_FACTOR = PROCESS_CONFIG.GNSS_EPOCH_FACTOR;
+bool &GNSS_MERGED_CLOCK = PROCESS_CONFIG.GNSS_MERGED_CLOCK;
+double &GNSS_WAIT_DEADLINE = PROCESS_CONFIG.GNSS_WAIT_DEADLINE;
+double &GNSS_ATMOS_CACHE_THRES = PROCESS_CONFIG.GNSS_ATMOS_CACHE_THRES;
+bool &GNSS_ASYNC_INIT = PROCESS_CONFIG.GNSS_ASYNC_INIT;
+std::string &GNSS_RESULT_PATH = PROCESS_CONFIG.GNSS_RESULT_PATH;
+std::string &GNSS_RINEX_ARCHIVE_PATH = PROCESS_CONFIG.GNSS_RINEX_ARCHIVE_PATH;
+std::string &GNSS_SHARED_EPHEM = PROCESS_CONFIG.GNSS_SHARED_EPHEM;
+bool &GNSS_SHARED_EPHEM_PUBLISH = PROCESS_CONFIG.GNSS_SHARED_EPHEM_PUBLISH;
+bool &RESULT_BINARY = PROCESS_CONFIG.RESULT_BINARY;
+
+// one group of thread_config, an absent group keeps the default scheduling
+void readThreadConfig(const cv::FileNode &node, ThreadConfig &config)
 {
-    T ans;
-    if (n.getParam(name, ans))
+    config = ThreadConfig();
+    if (!node.isMap())
+        return;
+    cv::FileNode cores = node["cores"];
+    if (cores.isSeq())
     {
-        ROS_INFO_STREAM("Loaded " << name << ": " << ans);
+        for (cv::FileNodeIterator it = cores.begin(); it != cores.end(); ++it)
+            config.cores.push_back(static_cast<int>(*it));
     }
-    else
-    {
-        ROS_ERROR_STREAM("Failed to load " << name);
-        n.shutdown();
-    }
-    return ans;
+    config.priority = node["priority"];
+    config.deadline_ms = node["deadline"];
+}
+
+void readParameters(const std::string &config_file, const std::string &output_dir)
+{
+    loadConfig(config_file, output_dir, PROCESS_CONFIG);
 }
 
-void readParameters(ros::NodeHandle &n)
+void loadConfig(const std::string &config_file, const std::string &output_dir, EstimatorConfig &config)
 {
-    std::string config_file;
-    config_file = readParam<std::string>(n, "config_file");
+    config = EstimatorConfig();
     cv::FileStorage fsSettings(config_file, cv::FileStorage::READ);
     if(!fsSettings.isOpened())
     {
         std::cerr << "ERROR: Wrong path to settings" << std::endl;
     }
 
-    fsSettings["imu_topic"] >> IMU_TOPIC;
+    fsSettings["imu_topic"] >> config.IMU_TOPIC;
+    int compact_feature_msg_value = fsSettings["compact_feature_msg"];
+    config.COMPACT_FEATURE_MSG = (compact_feature_msg_value == 0 ? false : true);
 
-    SOLVER_TIME = fsSettings["max_solver_time"];
-    NUM_ITERATIONS = fsSettings["max_num_iterations"];
-    MIN_PARALLAX = fsSettings["keyframe_parallax"];
-    MIN_PARALLAX = MIN_PARALLAX / FOCAL_LENGTH;
+    config.SOLVER_TIME = fsSettings["max_solver_time"];
+    config.NUM_ITERATIONS = fsSettings["max_num_iterations"];
+    config.LATENCY_TARGET = fsSettings["latency_target"];
+    if (fsSettings["min_solver_time"].empty())
+        config.MIN_SOLVER_TIME = 0.01;
+    else
+        config.MIN_SOLVER_TIME = fsSettings["min_solver_time"];
+    if (fsSettings["solver_stall_ratio"].empty())
+        config.SOLVER_STALL_RATIO = 1e-6;
+    else
+        config.SOLVER_STALL_RATIO = fsSettings["solver_stall_ratio"];
+    int solver_watchdog_value = fsSettings["solver_watchdog"];
+    config.SOLVER_WATCHDOG = (solver_watchdog_value == 0 ? false : true);
+    config.SOLVER_DIVERGENCE_RATIO = fsSettings["solver_divergence_ratio"].empty() ? 100.0 :
+        static_cast<double>(fsSettings["solver_divergence_ratio"]);
+    config.SOLVER_MAX_VELOCITY = fsSettings["solver_max_velocity"].empty() ? 50.0 :
+        static_cast<double>(fsSettings["solver_max_velocity"]);
+    int incremental_problem_value = fsSettings["incremental_problem"];
+    config.INCREMENTAL_PROBLEM = (incremental_problem_value == 0 ? false : true);
+    if (fsSettings["num_solver_threads"].empty())
+        config.NUM_SOLVER_THREADS = 1;
+    else
+        config.NUM_SOLVER_THREADS = fsSettings["num_solver_threads"];
+    config.LINEAR_SOLVER = "auto";
+    if (!fsSettings["linear_solver"].empty())
+        fsSettings["linear_solver"] >> config.LINEAR_SOLVER;
+    config.MAX_OPTIMIZED_FEATURES = fsSettings["max_optimized_features"];
+    int visual_track_factor_value = fsSettings["visual_track_factor"];
+    config.VISUAL_TRACK_FACTOR = (visual_track_factor_value == 0 ? false : true);
+    int visual_packed_eval_value = fsSettings["visual_packed_eval"];
+    config.VISUAL_PACKED_EVAL = (visual_packed_eval_value == 0 ? false : true);
+    int structureless_visual_value = fsSettings["structureless_visual"];
+    config.STRUCTURELESS_VISUAL = (structureless_visual_value == 0 ? false : true);
+    if (config.STRUCTURELESS_VISUAL && config.INCREMENTAL_PROBLEM)
+    {
+        // the depths are written back from the factors of the frame, a kept residual has none
+        GVINS_WARN("incremental_problem is not supported with structureless_visual, disabled");
+        config.INCREMENTAL_PROBLEM = false;
+    }
+    int gpu_dense_value = fsSettings["gpu_dense"];
+    config.GPU_DENSE = (gpu_dense_value == 0 ? false : true);
+    config.GPU_DENSE_MIN_SIZE = fsSettings["gpu_dense_min_size"].empty() ? 300 :
+        static_cast<int>(fsSettings["gpu_dense_min_size"]);
+    if (fsSettings["num_worker_threads"].empty())
+        config.NUM_WORKER_THREADS = 4;
+    else
+        config.NUM_WORKER_THREADS = fsSettings["num_worker_threads"];
+    int deterministic_value = fsSettings["deterministic"];
+    config.DETERMINISTIC = (deterministic_value == 0 ? false : true);
+    cv::FileNode thread_config = fsSettings["thread_config"];
+    readThreadConfig(thread_config["process"], config.PROCESS_THREAD);
+    readThreadConfig(thread_config["marginalization"], config.MARGINALIZATION_THREADS);
+    readThreadConfig(thread_config["ceres"], config.CERES_THREADS);
+    int pipeline_marginalization_value = fsSettings["pipeline_marginalization"];
+    config.PIPELINE_MARGINALIZATION = (pipeline_marginalization_value == 0 ? false : true);
+    int sparsify_prior_value = fsSettings["sparsify_prior"];
+    config.SPARSIFY_PRIOR = (sparsify_prior_value == 0 ? false : true);
+    if (fsSettings["motion_only_frames"].empty())
+        config.MOTION_ONLY_FRAMES = 0;
+    else
+        config.MOTION_ONLY_FRAMES = fsSettings["motion_only_frames"];
+    if (fsSettings["window_size"].empty())
+        config.CONFIG_WINDOW_SIZE = WINDOW_SIZE;
+    else
+        config.CONFIG_WINDOW_SIZE = fsSettings["window_size"];
+    if (fsSettings["odometry_rate"].empty())
+        config.ODOMETRY_RATE = 0;
+    else
+        config.ODOMETRY_RATE = fsSettings["odometry_rate"];
+    if (fsSettings["odometry_max_extrapolation"].empty())
+        config.ODOMETRY_MAX_EXTRAPOLATION = 0.02;
+    else
+        config.ODOMETRY_MAX_EXTRAPOLATION = fsSettings["odometry_max_extrapolation"];
+    int async_visualization_value = fsSettings["async_visualization"];
+    config.ASYNC_VISUALIZATION = (async_visualization_value == 0 ? false : true);
+    config.VISUALIZATION_RATES.clear();
+    cv::FileNode visualization_rates = fsSettings["visualization_rates"];
+    if (visualization_rates.isMap())
+    {
+        for (cv::FileNodeIterator it = visualization_rates.begin(); it != visualization_rates.end(); ++it)
+            config.VISUALIZATION_RATES[(*it).name()] = static_cast<double>(*it);
+    }
+    int path_full_history_value = fsSettings["path_full_history"];
+    config.PATH_FULL_HISTORY = (path_full_history_value == 0 ? false : true);
+    config.PATH_MAX_POSES = fsSettings["path_max_poses"].empty() ? 2000 : static_cast<int>(fsSettings["path_max_poses"]);
+    config.PATH_MAX_AGE = fsSettings["path_max_age"];
+    config.PATH_HISTORY_SPACING = fsSettings["path_history_spacing"].empty() ? 1.0 :
+        static_cast<double>(fsSettings["path_history_spacing"]);
+    config.ADMISSION_MAX_LATENCY = fsSettings["admission_max_latency"];
+    config.DIAGNOSTICS_PERIOD = fsSettings["diagnostics_period"];
+    config.MIN_PARALLAX = fsSettings["keyframe_parallax"];
+    config.MIN_PARALLAX = config.MIN_PARALLAX / FOCAL_LENGTH;
 
-    std::string tmp_output_dir;
-    fsSettings["output_dir"] >> tmp_output_dir;
+    std::string tmp_output_dir = output_dir;
+    if (tmp_output_dir.empty())
+        fsSettings["output_dir"] >> tmp_output_dir;
+    else
+        FileSystemHelper::createDirectoryIfNotExists(tmp_output_dir.c_str());     // realpath needs it to exist
     assert(!tmp_output_dir.empty() && "Output directory cannot be empty.\n");
     if (tmp_output_dir[0] == '~')
         tmp_output_dir.replace(0, 1, getenv("HOME"));
@@ -84,107 +249,231 @@ void readParameters(ros::NodeHandle &n)
     std::string OUTPUT_DIR(actual_output_dir);
     FileSystemHelper::createDirectoryIfNotExists(OUTPUT_DIR.c_str());
 
-    VINS_RESULT_PATH = OUTPUT_DIR + "/vins_result_no_loop.csv";
-    std::ofstream fout1(VINS_RESULT_PATH, std::ios::out);
+    int result_binary_value = fsSettings["result_binary"];
+    config.RESULT_BINARY = (result_binary_value == 0 ? false : true);
+    const std::string result_ext = (config.RESULT_BINARY ? ".bin" : ".csv");
+    config.VINS_RESULT_PATH = OUTPUT_DIR + "/vins_result_no_loop" + result_ext;
+    std::ofstream fout1(config.VINS_RESULT_PATH, std::ios::out);
     fout1.close();
-    std::cout << "result path " << VINS_RESULT_PATH << std::endl;
+    std::cout << "result path " << config.VINS_RESULT_PATH << std::endl;
 
-    FACTOR_GRAPH_RESULT_PATH = OUTPUT_DIR + "/factor_graph_result.txt";
-    std::ofstream fout2(FACTOR_GRAPH_RESULT_PATH, std::ios::out);
+    config.FACTOR_GRAPH_RESULT_PATH = OUTPUT_DIR + "/factor_graph_result" + result_ext;
+    std::ofstream fout2(config.FACTOR_GRAPH_RESULT_PATH, std::ios::out);
     fout2.close();
 
+    // not truncated here, a warm start reads the one of the previous run
+    config.CHECKPOINT_PATH = OUTPUT_DIR + "/checkpoint.bin";
+    if (fsSettings["checkpoint_interval"].empty())
+        config.CHECKPOINT_INTERVAL = 0;
+    else
+        config.CHECKPOINT_INTERVAL = fsSettings["checkpoint_interval"];
+    if (fsSettings["checkpoint_max_gap"].empty())
+        config.CHECKPOINT_MAX_GAP = 0.5;
+    else
+        config.CHECKPOINT_MAX_GAP = fsSettings["checkpoint_max_gap"];
+    int warm_start_value = fsSettings["warm_start"];
+    config.WARM_START = (warm_start_value == 0 ? false : true);
+    int relocalization_value = fsSettings["relocalization"];
+    config.RELOCALIZATION = (relocalization_value == 0 ? false : true);
+    config.RELO_MAX_KEYFRAMES = fsSettings["relo_max_keyframes"].empty() ? 2000 :
+        static_cast<int>(fsSettings["relo_max_keyframes"]);
+    config.RELO_MIN_INLIERS = fsSettings["relo_min_inliers"].empty() ? 25 :
+        static_cast<int>(fsSettings["relo_min_inliers"]);
+    config.RELO_SKIP_RECENT = fsSettings["relo_skip_recent"].empty() ? 30.0 :
+        static_cast<double>(fsSettings["relo_skip_recent"]);
+    config.RELO_POSE_WEIGHT = fsSettings["relo_pose_weight"].empty() ? 10.0 :
+        static_cast<double>(fsSettings["relo_pose_weight"]);
+    config.RELO_MAP_PATH.clear();
+    if (!fsSettings["relo_map"].empty())
+        fsSettings["relo_map"] >> config.RELO_MAP_PATH;
+    int relo_map_save_value = fsSettings["relo_map_save"];
+    config.RELO_MAP_SAVE = (relo_map_save_value == 0 ? false : true);
+    if (config.RELOCALIZATION && !config.COMPACT_FEATURE_MSG)
+        GVINS_WARN("relocalization needs compact_feature_msg for the feature descriptors, no keyframe is matched");
+    int stereo_init_value = fsSettings["stereo_init"];
+    config.STEREO_INIT = (stereo_init_value == 0 ? false : true);
+    config.STEREO_MAX_DEPTH = fsSettings["stereo_max_depth"].empty() ? 20.0 :
+        static_cast<double>(fsSettings["stereo_max_depth"]);
+    if (config.STEREO_INIT && NUM_OF_CAM < 2)
+    {
+        GVINS_WARN("stereo_init needs an estimator built with GVINS_NUM_OF_CAM=2, disabled");
+        config.STEREO_INIT = false;
+    }
+
     ACC_N = fsSettings["acc_n"];
-    ACC_W = fsSettings["acc_w"];
+    config.ACC_W = fsSettings["acc_w"];
     GYR_N = fsSettings["gyr_n"];
-    GYR_W = fsSettings["gyr_w"];
-    G.z() = fsSettings["g_norm"];
+    config.GYR_W = fsSettings["gyr_w"];
+    config.G.z() = fsSettings["g_norm"];
+    config.IMU_PREINT_RATE = fsSettings["imu_preint_rate"].empty() ? 0.0 :
+        static_cast<double>(fsSettings["imu_preint_rate"]);
     ROW = fsSettings["image_height"];
-    COL = fsSettings["image_width"];
-    ROS_INFO("ROW: %f COL: %f ", ROW, COL);
+    config.COL = fsSettings["image_width"];
+    GVINS_INFO("ROW: %f COL: %f ", ROW, config.COL);
 
-    ESTIMATE_EXTRINSIC = fsSettings["estimate_extrinsic"];
-    if (ESTIMATE_EXTRINSIC == 2)
+    config.ESTIMATE_EXTRINSIC = fsSettings["estimate_extrinsic"];
+    if (config.ESTIMATE_EXTRINSIC == 2)
     {
-        ROS_WARN("have no prior about extrinsic param, calibrate extrinsic param");
-        RIC.push_back(Eigen::Matrix3d::Identity());
-        TIC.push_back(Eigen::Vector3d::Zero());
-        EX_CALIB_RESULT_PATH = OUTPUT_DIR + "/extrinsic_parameter.csv";
+        GVINS_WARN("have no prior about extrinsic param, calibrate extrinsic param");
+        for (int i = 0; i < NUM_OF_CAM; i++)
+        {
+            config.RIC.push_back(Eigen::Matrix3d::Identity());
+            config.TIC.push_back(Eigen::Vector3d::Zero());
+        }
+        config.EX_CALIB_RESULT_PATH = OUTPUT_DIR + "/extrinsic_parameter.csv";
 
     }
     else 
     {
-        if ( ESTIMATE_EXTRINSIC == 1)
+        if ( config.ESTIMATE_EXTRINSIC == 1)
+        {
+            GVINS_WARN(" Optimize extrinsic param around initial guess!");
+            config.EX_CALIB_RESULT_PATH = OUTPUT_DIR + "/extrinsic_parameter.csv";
+        }
+        if (config.ESTIMATE_EXTRINSIC == 0)
+            GVINS_WARN(" fix extrinsic param ");
+
+        // camera i > 0: extrinsicRotation_<i>, extrinsicTranslation_<i>
+        for (int i = 0; i < NUM_OF_CAM; i++)
         {
-            ROS_WARN(" Optimize extrinsic param around initial guess!");
-            EX_CALIB_RESULT_PATH = OUTPUT_DIR + "/extrinsic_parameter.csv";
+            const std::string suffix = i == 0 ? "" : "_" + std::to_string(i);
+            cv::Mat cv_R, cv_T;
+            fsSettings["extrinsicRotation" + suffix] >> cv_R;
+            fsSettings["extrinsicTranslation" + suffix] >> cv_T;
+            Eigen::Matrix3d eigen_R;
+            Eigen::Vector3d eigen_T;
+            cv::cv2eigen(cv_R, eigen_R);
+            cv::cv2eigen(cv_T, eigen_T);
+            Eigen::Quaterniond Q(eigen_R);
+            eigen_R = Q.normalized();
+            config.RIC.push_back(eigen_R);
+            config.TIC.push_back(eigen_T);
+            GVINS_INFO_STREAM("Extrinsic_R" << suffix << " : " << std::endl << config.RIC[i]);
+            GVINS_INFO_STREAM("Extrinsic_T" << suffix << " : " << std::endl << config.TIC[i].transpose());
         }
-        if (ESTIMATE_EXTRINSIC == 0)
-            ROS_WARN(" fix extrinsic param ");
-
-        cv::Mat cv_R, cv_T;
-        fsSettings["extrinsicRotation"] >> cv_R;
-        fsSettings["extrinsicTranslation"] >> cv_T;
-        Eigen::Matrix3d eigen_R;
-        Eigen::Vector3d eigen_T;
-        cv::cv2eigen(cv_R, eigen_R);
-        cv::cv2eigen(cv_T, eigen_T);
-        Eigen::Quaterniond Q(eigen_R);
-        eigen_R = Q.normalized();
-        RIC.push_back(eigen_R);
-        TIC.push_back(eigen_T);
-        ROS_INFO_STREAM("Extrinsic_R : " << std::endl << RIC[0]);
-        ROS_INFO_STREAM("Extrinsic_T : " << std::endl << TIC[0].transpose());
         
     } 
 
-    INIT_DEPTH = 5.0;
-    BIAS_ACC_THRESHOLD = 0.1;
-    BIAS_GYR_THRESHOLD = 0.1;
+    config.INIT_DEPTH = 5.0;
+    config.BIAS_ACC_THRESHOLD = 0.1;
+    config.BIAS_GYR_THRESHOLD = 0.1;
 
-    TD = fsSettings["td"];
-    ESTIMATE_TD = fsSettings["estimate_td"];
-    if (ESTIMATE_TD)
-        ROS_INFO_STREAM("Unsynchronized sensors, online estimate time offset, initial td: " << TD);
+    config.TD = fsSettings["td"];
+    config.ESTIMATE_TD = fsSettings["estimate_td"];
+    if (config.ESTIMATE_TD)
+        GVINS_INFO_STREAM("Unsynchronized sensors, online estimate time offset, initial td: " << config.TD);
     else
-        ROS_INFO_STREAM("Synchronized sensors, fix time offset: " << TD);
+        GVINS_INFO_STREAM("Synchronized sensors, fix time offset: " << config.TD);
 
     int gnss_enable_value = fsSettings["gnss_enable"];
-    GNSS_ENABLE = (gnss_enable_value == 0 ? false : true);
+    config.GNSS_ENABLE = (gnss_enable_value == 0 ? false : true);
 
-    if (GNSS_ENABLE)
+    if (config.GNSS_ENABLE)
     {
-        fsSettings["gnss_ephem_topic"] >> GNSS_EPHEM_TOPIC;
-        fsSettings["gnss_glo_ephem_topic"] >> GNSS_GLO_EPHEM_TOPIC;
-        fsSettings["gnss_meas_topic"] >> GNSS_MEAS_TOPIC;
-        fsSettings["gnss_iono_params_topic"] >> GNSS_IONO_PARAMS_TOPIC;
+        fsSettings["gnss_ephem_topic"] >> config.GNSS_EPHEM_TOPIC;
+        fsSettings["gnss_glo_ephem_topic"] >> config.GNSS_GLO_EPHEM_TOPIC;
+        fsSettings["gnss_meas_topic"] >> config.GNSS_MEAS_TOPIC;
+        fsSettings["gnss_iono_params_topic"] >> config.GNSS_IONO_PARAMS_TOPIC;
         cv::Mat cv_iono;
         fsSettings["gnss_iono_default_parameters"] >> cv_iono;
         Eigen::Matrix<double, 1, 8> eigen_iono;
         cv::cv2eigen(cv_iono, eigen_iono);
         for (uint32_t i = 0; i < 8; ++i)
-            GNSS_IONO_DEFAULT_PARAMS.push_back(eigen_iono(0, i));
+            config.GNSS_IONO_DEFAULT_PARAMS.push_back(eigen_iono(0, i));
         
-        fsSettings["gnss_tp_info_topic"] >> GNSS_TP_INFO_TOPIC;
+        fsSettings["gnss_tp_info_topic"] >> config.GNSS_TP_INFO_TOPIC;
         int gnss_local_online_sync_value = fsSettings["gnss_local_online_sync"];
-        GNSS_LOCAL_ONLINE_SYNC = (gnss_local_online_sync_value == 0 ? false : true);
-        if (GNSS_LOCAL_ONLINE_SYNC)
-            fsSettings["local_trigger_info_topic"] >> LOCAL_TRIGGER_INFO_TOPIC;
+        config.GNSS_LOCAL_ONLINE_SYNC = (gnss_local_online_sync_value == 0 ? false : true);
+        if (config.GNSS_LOCAL_ONLINE_SYNC)
+            fsSettings["local_trigger_info_topic"] >> config.LOCAL_TRIGGER_INFO_TOPIC;
         else
-            GNSS_LOCAL_TIME_DIFF = fsSettings["gnss_local_time_diff"];
+            config.GNSS_LOCAL_TIME_DIFF = fsSettings["gnss_local_time_diff"];
 
-        GNSS_ELEVATION_THRES = fsSettings["gnss_elevation_thres"];
+        config.GNSS_ELEVATION_THRES = fsSettings["gnss_elevation_thres"];
         const double gnss_ddt_sigma = fsSettings["gnss_ddt_sigma"];
-        GNSS_PSR_STD_THRES = fsSettings["gnss_psr_std_thres"];
-        GNSS_DOPP_STD_THRES = fsSettings["gnss_dopp_std_thres"];
+        config.GNSS_PSR_STD_THRES = fsSettings["gnss_psr_std_thres"];
+        config.GNSS_DOPP_STD_THRES = fsSettings["gnss_dopp_std_thres"];
         const double track_thres = fsSettings["gnss_track_num_thres"];
-        GNSS_TRACK_NUM_THRES = static_cast<uint32_t>(track_thres);
-        GNSS_DDT_WEIGHT = 1.0 / gnss_ddt_sigma;
-        GNSS_RESULT_PATH = OUTPUT_DIR + "/gnss_result.csv";
+        config.GNSS_TRACK_NUM_THRES = static_cast<uint32_t>(track_thres);
+        int max_sats = fsSettings["gnss_max_sats"];
+        config.GNSS_MAX_SATS = static_cast<uint32_t>(max_sats > 0 ? max_sats : 0);
+        config.GNSS_PSR_OUTLIER_THRES = fsSettings["gnss_psr_outlier_thres"].empty() ? 0.0 :
+            static_cast<double>(fsSettings["gnss_psr_outlier_thres"]);
+        config.GNSS_DOPP_OUTLIER_THRES = fsSettings["gnss_dopp_outlier_thres"].empty() ? 0.0 :
+            static_cast<double>(fsSettings["gnss_dopp_outlier_thres"]);
+        config.GNSS_DDT_WEIGHT = 1.0 / gnss_ddt_sigma;
+        int gnss_epoch_factor_value = fsSettings["gnss_epoch_factor"];
+        config.GNSS_EPOCH_FACTOR = (gnss_epoch_factor_value == 0 ? false : true);
+        int gnss_merged_clock_value = fsSettings["gnss_merged_clock"];
+        config.GNSS_MERGED_CLOCK = (gnss_merged_clock_value == 0 ? false : true);
+        config.GNSS_ATMOS_CACHE_THRES = fsSettings["gnss_atmos_cache_thres"];
+        config.GNSS_WAIT_DEADLINE = fsSettings["gnss_wait_deadline"].empty() ? -1.0 :
+            static_cast<double>(fsSettings["gnss_wait_deadline"]);
+        int gnss_async_init_value = fsSettings["gnss_async_init"];
+        config.GNSS_ASYNC_INIT = (gnss_async_init_value == 0 ? false : true);
+        config.GNSS_RESULT_PATH = OUTPUT_DIR + "/gnss_result" + result_ext;
         // clear output file
-        std::ofstream gnss_output(GNSS_RESULT_PATH, std::ios::out);
+        std::ofstream gnss_output(config.GNSS_RESULT_PATH, std::ios::out);
         gnss_output.close();
-        ROS_INFO_STREAM("GNSS enabled");
+        int gnss_archive_rinex_value = fsSettings["gnss_archive_rinex"];
+        config.GNSS_RINEX_ARCHIVE_PATH = (gnss_archive_rinex_value == 0 ? "" : OUTPUT_DIR + "/gnss_meas.rnx");
+        config.GNSS_SHARED_EPHEM.clear();
+        if (!fsSettings["gnss_shared_ephem"].empty())
+            fsSettings["gnss_shared_ephem"] >> config.GNSS_SHARED_EPHEM;
+        int gnss_shared_ephem_publish_value = fsSettings["gnss_shared_ephem_publish"];
+        config.GNSS_SHARED_EPHEM_PUBLISH = (gnss_shared_ephem_publish_value == 0 ? false : true);
+        GVINS_INFO_STREAM("GNSS enabled");
     }
 
+    // the top-level values are the default profile, the GNSS thresholds only with GNSS
+    PerformanceProfile base;
+    base.max_solver_time = config.SOLVER_TIME;
+    base.max_num_iterations = config.NUM_ITERATIONS;
+    if (config.GNSS_ENABLE)
+    {
+        base.gnss_elevation_thres = config.GNSS_ELEVATION_THRES;
+        base.gnss_track_num_thres = static_cast<int>(config.GNSS_TRACK_NUM_THRES);
+    }
+    config.PERFORMANCE_PROFILES = readPerformanceProfiles(fsSettings, base);
+    std::string profile_name = "default";
+    if (!fsSettings["performance_profile"].empty())
+        fsSettings["performance_profile"] >> profile_name;
+    if (!applyPerformanceProfile(profile_name, config))
+    {
+        GVINS_WARN("performance_profile %s is not in performance_profiles, default used", profile_name.c_str());
+        applyPerformanceProfile("default", config);
+    }
+    if (config.DETERMINISTIC)
+        applyDeterministicMode(config);
+
     fsSettings.release();
 }
+
+bool applyPerformanceProfile(const std::string &name, EstimatorConfig &config)
+{
+    PerformanceProfile profile;
+    if (!resolvePerformanceProfile(config.PERFORMANCE_PROFILES, name, profile))
+        return false;
+    config.SOLVER_TIME = profile.max_solver_time;
+    config.NUM_ITERATIONS = profile.max_num_iterations;
+    if (config.GNSS_ENABLE && profile.gnss_elevation_thres >= 0)
+        config.GNSS_ELEVATION_THRES = profile.gnss_elevation_thres;
+    if (config.GNSS_ENABLE && profile.gnss_track_num_thres >= 0)
+        config.GNSS_TRACK_NUM_THRES = static_cast<uint32_t>(profile.gnss_track_num_thres);
+    config.PERFORMANCE_PROFILE = name;
+    return true;
+}
+
+/**
+ * 可复现模式: 求解只受迭代次数限制, 边缘化按固定的分组求和, 后台的重定位/GNSS 对齐结果在固定的帧取回 (Estimator);
+ * 这里关掉其余依赖墙钟的部分. 工作线程池照常多线程, 只有 ceres 单线程 (多线程 Schur 消元的累加顺序不固定)
+ */
+void applyDeterministicMode(EstimatorConfig &config)
+{
+    config.DETERMINISTIC = true;
+    config.LATENCY_TARGET = 0;
+    config.ADMISSION_MAX_LATENCY = 0;
+    config.NUM_SOLVER_THREADS = 1;
+    // the delay cache is per worker thread, which worker evaluates a satellite varies between runs
+    config.GNSS_ATMOS_CACHE_THRES = 0;
+}
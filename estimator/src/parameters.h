@@ -1,18 +1,37 @@
 #pragma once
 
 #include <cstdlib>
-#include <ros/ros.h>
+#include <map>
 #include <vector>
 #include <eigen3/Eigen/Dense>
 #include "utility/utility.h"
+#include "utility/thread_config.h"
+#include <gvins_feature_tracker/log.h>
+#include <gvins_feature_tracker/performance_profile.h>
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/eigen.hpp>
 #include <fstream>
+#include <iostream>
+
+// 窗口大小/相机数/特征数是编译期常量, 数组和循环按固定大小展开.
+// CMake 为每个窗口大小编译一个可执行文件 (GVINS_WINDOW_SIZE), 由 YAML 中的 window_size 选择
+#ifndef GVINS_WINDOW_SIZE
+#define GVINS_WINDOW_SIZE 10
+#endif
+#ifndef GVINS_NUM_OF_CAM
+#define GVINS_NUM_OF_CAM 1
+#endif
+#ifndef GVINS_NUM_OF_F
+#define GVINS_NUM_OF_F 1000
+#endif
 
 const double FOCAL_LENGTH = 460.0;
-const int WINDOW_SIZE = 10;
-const int NUM_OF_CAM = 1;
-const int NUM_OF_F = 1000;
+const int WINDOW_SIZE = GVINS_WINDOW_SIZE;
+const int NUM_OF_CAM = GVINS_NUM_OF_CAM;
+const int NUM_OF_F = GVINS_NUM_OF_F;
+// bias estimates beyond these are a failure (failureDetection, SolverWatchdog)
+const double MAX_ACC_BIAS = 2.5;
+const double MAX_GYR_BIAS = 1.0;
 //#define UNIT_SPHERE_ERROR
 
 /**
@@ -23,53 +42,241 @@ const int NUM_OF_F = 1000;
  * 4.函数声明默认就是 extern 的，所以通常不需要显式写出
  */
 
-extern double INIT_DEPTH;
-extern double MIN_PARALLAX;
-extern int ESTIMATE_EXTRINSIC;
-
-extern double ACC_N, ACC_W;
-extern double GYR_N, GYR_W;
-
-extern std::vector<Eigen::Matrix3d> RIC;
-extern std::vector<Eigen::Vector3d> TIC;
-extern Eigen::Vector3d G;
-
-extern double BIAS_ACC_THRESHOLD;
-extern double BIAS_GYR_THRESHOLD;
-extern double SOLVER_TIME;
-extern int NUM_ITERATIONS;
-extern std::string EX_CALIB_RESULT_PATH;
-extern std::string VINS_RESULT_PATH;
-extern std::string FACTOR_GRAPH_RESULT_PATH;
-extern std::string IMU_TOPIC;
-extern double TD;
-extern int ESTIMATE_TD;
-extern double ROW, COL;
-
-extern bool GNSS_ENABLE;
-extern std::string GNSS_EPHEM_TOPIC;
-extern std::string GNSS_GLO_EPHEM_TOPIC;
-extern std::string GNSS_MEAS_TOPIC;
-extern std::string GNSS_IONO_PARAMS_TOPIC;
-extern std::string GNSS_TP_INFO_TOPIC;
-extern std::vector<double> GNSS_IONO_DEFAULT_PARAMS;
-extern bool GNSS_LOCAL_ONLINE_SYNC;
-extern std::string LOCAL_TRIGGER_INFO_TOPIC;
-extern double GNSS_LOCAL_TIME_DIFF;
-extern double GNSS_ELEVATION_THRES;
-extern double GNSS_PSR_STD_THRES;
-extern double GNSS_DOPP_STD_THRES;
-extern uint32_t GNSS_TRACK_NUM_THRES;
-extern double GNSS_DDT_WEIGHT;
-extern std::string GNSS_RESULT_PATH;
-
-void readParameters(ros::NodeHandle &n);
+/**
+ * 一条估计器流水线的全部配置, 由 loadConfig 从 YAML 读取. Estimator 及其特征管理/预积分/初始化只读自己持有的一份,
+ * 因此同一进程中可以运行多个配置不同的估计器 (共用工作线程池, 可共用星历). 字段名与下面的全局参数相同
+ */
+struct EstimatorConfig
+{
+    double INIT_DEPTH;
+    double MIN_PARALLAX;
+    int ESTIMATE_EXTRINSIC;
+
+    double ACC_N, ACC_W;
+    double GYR_N, GYR_W;
+
+    std::vector<Eigen::Matrix3d> RIC;
+    std::vector<Eigen::Vector3d> TIC;
+    Eigen::Vector3d G{0.0, 0.0, 9.8};
+
+    double BIAS_ACC_THRESHOLD;
+    double BIAS_GYR_THRESHOLD;
+    double SOLVER_TIME;
+    int NUM_ITERATIONS;
+    double LATENCY_TARGET;       // ms from image stamp to published result, 0 keeps the solver time fixed at SOLVER_TIME
+    double MIN_SOLVER_TIME;      // s, lower bound of the solver time the latency target may leave
+    double SOLVER_STALL_RATIO;   // stop once an iteration decreases the cost by less than this fraction
+    bool SOLVER_WATCHDOG;        // stop ceres::Solve early on divergence or when the rest of the budget would be wasted
+    double SOLVER_DIVERGENCE_RATIO;  // a cost above this multiple of the initial cost is divergence
+    double SOLVER_MAX_VELOCITY;  // m/s, a window velocity above this is divergence
+    bool INCREMENTAL_PROBLEM;
+    int NUM_SOLVER_THREADS;          // ceres num_threads (jacobian evaluation and Schur elimination)
+    std::string LINEAR_SOLVER;       // auto, dense_schur, sparse_schur or iterative_schur
+    int MAX_OPTIMIZED_FEATURES;     // landmarks added to the problem per frame, chosen by information, 0 is all
+    bool VISUAL_TRACK_FACTOR;        // one ProjectionTrackFactor per feature instead of one factor per observation
+    bool VISUAL_PACKED_EVAL;         // residual-only track factor evaluation in float SIMD packs
+    bool STRUCTURELESS_VISUAL;       // landmarks projected out of the visual factors, only poses in the problem and the prior
+    bool GPU_DENSE;                  // dense solve / marginalization on the GPU, needs a GVINS_CUDA_DENSE build
+    int GPU_DENSE_MIN_SIZE;          // dimension from which the GPU is used, smaller systems stay on the CPU
+    std::vector<PerformanceProfile> PERFORMANCE_PROFILES;   // performance_profiles of the YAML, "default" first
+    std::string PERFORMANCE_PROFILE;  // the one SOLVER_TIME, NUM_ITERATIONS and the GNSS thresholds are from
+    int NUM_WORKER_THREADS;
+    bool DETERMINISTIC;      // bit-identical runs: iteration-bounded solves, fixed reductions, background results at fixed frames
+    ThreadConfig PROCESS_THREAD;            // measurement thread running processImage
+    ThreadConfig MARGINALIZATION_THREADS;   // worker pool and pipelined marginalization stage
+    ThreadConfig CERES_THREADS;             // estimator thread and the threads ceres starts during Solve
+    bool PIPELINE_MARGINALIZATION;    // Schur complement of frame k overlaps with assembling frame k+1
+    bool SPARSIFY_PRIOR;     // approximate the dense prior by relative factors between neighbouring frames
+    int MOTION_ONLY_FRAMES;  // consecutive non-keyframes that only update the newest pose, 0 runs the full window each frame
+    bool COMPACT_FEATURE_MSG;     // feature tracks as gvins_feature_tracker/FeatureTracks instead of PointCloud
+    int CONFIG_WINDOW_SIZE;     // window_size requested by the YAML, WINDOW_SIZE if absent
+    double ODOMETRY_RATE;                // Hz of the imu_propagate output thread, 0 publishes once per IMU message
+    double ODOMETRY_MAX_EXTRAPOLATION;   // s past the newest IMU sample the output may extrapolate
+    bool ASYNC_VISUALIZATION;            // build and publish visualization messages on a background thread
+    std::map<std::string, double> VISUALIZATION_RATES;   // max Hz per visualization topic, absent or 0 is every frame
+    bool PATH_FULL_HISTORY;          // path/gnss_enu_path keep every pose since the start
+    int PATH_MAX_POSES;              // recent poses kept at full rate in the paths, 0 is no limit
+    double PATH_MAX_AGE;             // s of recent poses kept at full rate, 0 is no limit
+    double PATH_HISTORY_SPACING;     // m between the thinned older poses of the paths, 0 drops them
+    double DIAGNOSTICS_PERIOD;     // s between the stage latency reports on /diagnostics, 0 disables the profiler
+    double ADMISSION_MAX_LATENCY;    // s of queued feature frames before non-keyframes are skipped, 0 disables
+    double CHECKPOINT_INTERVAL;  // s between window checkpoints, 0 disables checkpoints and warm restarts
+    double CHECKPOINT_MAX_GAP;   // s between a checkpoint and the resumed IMU data, larger gaps cold start
+    bool WARM_START;             // resume from CHECKPOINT_PATH at startup
+    std::string CHECKPOINT_PATH;
+    bool RELOCALIZATION;         // keyframe database and relocalization queries on a background thread
+    int RELO_MAX_KEYFRAMES;      // keyframes kept in the database, the oldest are dropped
+    int RELO_MIN_INLIERS;        // PnP inliers of an accepted match
+    double RELO_SKIP_RECENT;     // s, keyframes of the same session this recent are not matched
+    double RELO_POSE_WEIGHT;     // sqrt information (1/m, 1/rad) of the prior from a relocalization
+    std::string RELO_MAP_PATH;   // keyframe map loaded at startup if present, empty for none
+    bool RELO_MAP_SAVE;          // write the database to RELO_MAP_PATH at shutdown
+    bool STEREO_INIT;            // initialize from the stereo depth of camera 1 (NUM_OF_CAM >= 2), monocular SfM otherwise
+    double STEREO_MAX_DEPTH;     // m, stereo triangulations farther away are not used
+    double IMU_PREINT_RATE;      // Hz, raw IMU samples are combined (coning/sculling) into preintegration steps at this rate, 0 integrates every sample
+    std::string EX_CALIB_RESULT_PATH;
+    std::string VINS_RESULT_PATH;
+    std::string FACTOR_GRAPH_RESULT_PATH;
+    std::string IMU_TOPIC;
+    double TD;
+    int ESTIMATE_TD;
+    double ROW, COL;
+
+    bool GNSS_ENABLE;
+    std::string GNSS_EPHEM_TOPIC;
+    std::string GNSS_GLO_EPHEM_TOPIC;
+    std::string GNSS_MEAS_TOPIC;
+    std::string GNSS_IONO_PARAMS_TOPIC;
+    std::string GNSS_TP_INFO_TOPIC;
+    std::vector<double> GNSS_IONO_DEFAULT_PARAMS;
+    bool GNSS_LOCAL_ONLINE_SYNC;
+    std::string LOCAL_TRIGGER_INFO_TOPIC;
+    double GNSS_LOCAL_TIME_DIFF;
+    double GNSS_ELEVATION_THRES;
+    double GNSS_PSR_STD_THRES;
+    double GNSS_DOPP_STD_THRES;
+    uint32_t GNSS_TRACK_NUM_THRES;
+    uint32_t GNSS_MAX_SATS;          // satellites kept per epoch by DOP, 0 keeps all
+    double GNSS_PSR_OUTLIER_THRES;   // m of pseudorange residual against the predicted state, 0 disables
+    double GNSS_DOPP_OUTLIER_THRES;  // m/s of Doppler residual against the predicted state, 0 disables
+    double GNSS_DDT_WEIGHT;
+    bool GNSS_EPOCH_FACTOR;
+    bool GNSS_MERGED_CLOCK;      // one 5-D clock block (4 system biases + drift) per epoch
+    double GNSS_WAIT_DEADLINE;     // s of IMU past a frame before it goes ahead without GNSS, < 0 waits indefinitely
+    double GNSS_ATMOS_CACHE_THRES;   // m of receiver motion before cached iono/tropo delays are recomputed, 0 disables
+    bool GNSS_ASYNC_INIT;          // GNSS-VI alignment on a background thread, applied at a later frame
+    std::string GNSS_RESULT_PATH;
+    std::string GNSS_RINEX_ARCHIVE_PATH;    // raw GNSS measurements archived as RINEX, empty disables
+    std::string GNSS_SHARED_EPHEM;          // POSIX shm name of the ephemerides shared between estimators, empty disables
+    bool GNSS_SHARED_EPHEM_PUBLISH;         // this estimator subscribes the ephemeris topics and publishes them to the segment
+    bool RESULT_BINARY;          // vins/gnss results as binary records (.bin) instead of CSV
+};
+
+/**
+ * 节点 (ROS 节点, nodelet, 离线批处理) 只运行一个估计器, 它的配置即 PROCESS_CONFIG,
+ * 下面的全局参数是 PROCESS_CONFIG 中同名字段的引用, 由 readParameters 填写
+ */
+extern EstimatorConfig PROCESS_CONFIG;
+
+extern double &INIT_DEPTH;
+extern double &MIN_PARALLAX;
+extern int &ESTIMATE_EXTRINSIC;
+
+extern double &ACC_N, &ACC_W;
+extern double &GYR_N, &GYR_W;
+
+extern std::vector<Eigen::Matrix3d> &RIC;
+extern std::vector<Eigen::Vector3d> &TIC;
+extern Eigen::Vector3d &G;
+
+extern double &BIAS_ACC_THRESHOLD;
+extern double &BIAS_GYR_THRESHOLD;
+extern double &SOLVER_TIME;
+extern int &NUM_ITERATIONS;
+extern double &LATENCY_TARGET;
+extern double &MIN_SOLVER_TIME;
+extern double &SOLVER_STALL_RATIO;
+extern bool &SOLVER_WATCHDOG;
+extern double &SOLVER_DIVERGENCE_RATIO;
+extern double &SOLVER_MAX_VELOCITY;
+extern bool &INCREMENTAL_PROBLEM;
+extern int &NUM_SOLVER_THREADS;
+extern std::string &LINEAR_SOLVER;
+extern int &MAX_OPTIMIZED_FEATURES;
+extern bool &VISUAL_TRACK_FACTOR;
+extern bool &STRUCTURELESS_VISUAL;
+extern bool &GPU_DENSE;
+extern int &GPU_DENSE_MIN_SIZE;
+extern std::vector<PerformanceProfile> &PERFORMANCE_PROFILES;
+extern std::string &PERFORMANCE_PROFILE;
+extern bool &VISUAL_PACKED_EVAL;
+extern int &NUM_WORKER_THREADS;
+extern bool &DETERMINISTIC;
+extern ThreadConfig &PROCESS_THREAD;
+extern ThreadConfig &MARGINALIZATION_THREADS;
+extern ThreadConfig &CERES_THREADS;
+extern bool &PIPELINE_MARGINALIZATION;
+extern bool &SPARSIFY_PRIOR;
+extern int &MOTION_ONLY_FRAMES;
+extern bool &COMPACT_FEATURE_MSG;
+extern int &CONFIG_WINDOW_SIZE;
+extern double &ODOMETRY_RATE;
+extern double &ODOMETRY_MAX_EXTRAPOLATION;
+extern bool &ASYNC_VISUALIZATION;
+extern std::map<std::string, double> &VISUALIZATION_RATES;
+extern bool &PATH_FULL_HISTORY;
+extern int &PATH_MAX_POSES;
+extern double &PATH_MAX_AGE;
+extern double &PATH_HISTORY_SPACING;
+extern double &DIAGNOSTICS_PERIOD;
+extern double &ADMISSION_MAX_LATENCY;
+extern double &CHECKPOINT_INTERVAL;
+extern double &CHECKPOINT_MAX_GAP;
+extern bool &WARM_START;
+extern std::string &CHECKPOINT_PATH;
+extern bool &RELOCALIZATION;
+extern int &RELO_MAX_KEYFRAMES;
+extern int &RELO_MIN_INLIERS;
+extern double &RELO_SKIP_RECENT;
+extern double &RELO_POSE_WEIGHT;
+extern std::string &RELO_MAP_PATH;
+extern bool &RELO_MAP_SAVE;
+extern bool &STEREO_INIT;
+extern double &STEREO_MAX_DEPTH;
+extern double &IMU_PREINT_RATE;
+extern std::string &EX_CALIB_RESULT_PATH;
+extern std::string &VINS_RESULT_PATH;
+extern std::string &FACTOR_GRAPH_RESULT_PATH;
+extern std::string &IMU_TOPIC;
+extern double &TD;
+extern int &ESTIMATE_TD;
+extern double &ROW, &COL;
+
+extern bool &GNSS_ENABLE;
+extern std::string &GNSS_EPHEM_TOPIC;
+extern std::string &GNSS_GLO_EPHEM_TOPIC;
+extern std::string &GNSS_MEAS_TOPIC;
+extern std::string &GNSS_IONO_PARAMS_TOPIC;
+extern std::string &GNSS_TP_INFO_TOPIC;
+extern std::vector<double> &GNSS_IONO_DEFAULT_PARAMS;
+extern bool &GNSS_LOCAL_ONLINE_SYNC;
+extern std::string &LOCAL_TRIGGER_INFO_TOPIC;
+extern double &GNSS_LOCAL_TIME_DIFF;
+extern double &GNSS_ELEVATION_THRES;
+extern double &GNSS_PSR_STD_THRES;
+extern double &GNSS_DOPP_STD_THRES;
+extern uint32_t &GNSS_TRACK_NUM_THRES;
+extern uint32_t &GNSS_MAX_SATS;
+extern double &GNSS_PSR_OUTLIER_THRES;
+extern double &GNSS_DOPP_OUTLIER_THRES;
+extern double &GNSS_DDT_WEIGHT;
+extern bool &GNSS_EPOCH_FACTOR;
+extern bool &GNSS_MERGED_CLOCK;
+extern double &GNSS_WAIT_DEADLINE;
+extern double &GNSS_ATMOS_CACHE_THRES;
+extern bool &GNSS_ASYNC_INIT;
+extern std::string &GNSS_RESULT_PATH;
+extern std::string &GNSS_RINEX_ARCHIVE_PATH;
+extern std::string &GNSS_SHARED_EPHEM;
+extern bool &GNSS_SHARED_EPHEM_PUBLISH;
+extern bool &RESULT_BINARY;
+
+// a non-empty output_dir replaces the one of the YAML
+void loadConfig(const std::string &config_file, const std::string &output_dir, EstimatorConfig &config);
+// loadConfig into PROCESS_CONFIG; the nodes take config_file from the ROS parameter server (estimator_node)
+void readParameters(const std::string &config_file, const std::string &output_dir = "");
+// SOLVER_TIME, NUM_ITERATIONS and the GNSS thresholds of one of config.PERFORMANCE_PROFILES, false if there is none of that name
+bool applyPerformanceProfile(const std::string &name, EstimatorConfig &config);
+// DETERMINISTIC, and off whatever follows the wall clock or the thread: latency target, frame admission,
+// parallel ceres, the per-thread atmospheric delay cache
+void applyDeterministicMode(EstimatorConfig &config);
 
 enum SIZE_PARAMETERIZATION
 {
     SIZE_POSE = 7,
     SIZE_SPEEDBIAS = 9,
-    SIZE_FEATURE = 1
+    SIZE_FEATURE = 1,
+    SIZE_RCV_CLOCK = 5
 };
 
 enum StateOrder
@@ -0,0 +1,220 @@
+#include "relocalizer.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gvins_feature_tracker/log.h>
+
+namespace
+{
+const uint64_t MAP_MAGIC = 0x50414d4f4c45524full;     // "ORELOMAP"
+const uint32_t MAP_VERSION = 1;
+
+// the file is these records back to back: header, keyframes, then the features of all keyframes
+struct MapHeader
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t anchored;          // keyframes in the ENU frame of anc_ecef, otherwise in the map frame
+    uint64_t num_keyframes;
+    uint64_t num_features;
+    double anc_ecef[3];
+    double R_ecef_enu[9];       // row major
+};
+
+struct MapKeyframe
+{
+    uint32_t sec, nsec;
+    uint64_t first_feature;
+    uint32_t num_features;
+    uint32_t reserved;
+    double P[3];                // camera
+    double q[4];                // x, y, z, w
+};
+
+struct MapFeature
+{
+    double point[3];
+    float observation[2];       // normalized plane
+    int32_t feature_id;
+    uint8_t descriptor[RELO_DESCRIPTOR_SIZE];
+    uint32_t reserved;
+};
+
+static_assert(sizeof(MapHeader) % 8 == 0 && sizeof(MapKeyframe) % 8 == 0 && sizeof(MapFeature) % 8 == 0,
+              "map records keep the doubles of the next record aligned");
+}
+
+bool Relocalizer::loadMap(const std::string &path)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        GVINS_INFO("no keyframe map at %s", path.c_str());
+        return false;
+    }
+    struct stat st;
+    void *addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(MapHeader)))
+        addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        GVINS_WARN("cannot map keyframe map %s", path.c_str());
+        return false;
+    }
+    const size_t size = st.st_size;
+    const char *data = static_cast<const char *>(addr);
+    const MapHeader &header = *reinterpret_cast<const MapHeader *>(data);
+    const size_t expected = sizeof(MapHeader) + header.num_keyframes * sizeof(MapKeyframe) +
+                            header.num_features * sizeof(MapFeature);
+    if (header.magic != MAP_MAGIC || header.version != MAP_VERSION || size != expected)
+    {
+        GVINS_WARN("keyframe map %s is not a map of this version", path.c_str());
+        munmap(addr, size);
+        return false;
+    }
+    const MapKeyframe *keyframes = reinterpret_cast<const MapKeyframe *>(data + sizeof(MapHeader));
+    const MapFeature *features = reinterpret_cast<const MapFeature *>(keyframes + header.num_keyframes);
+
+    stage.wait();
+    // the newest keyframes if the map is larger than the database
+    const uint64_t first = header.num_keyframes > max_keyframes ? header.num_keyframes - max_keyframes : 0;
+    for (uint64_t k = first; k < header.num_keyframes; k++)
+    {
+        const MapKeyframe &record = keyframes[k];
+        if (record.first_feature + record.num_features > header.num_features)
+            continue;
+        ReloKeyframe keyframe;
+        keyframe.stamp = Timestamp(record.sec, record.nsec);
+        keyframe.generation = MAP_GENERATION;
+        keyframe.P = Eigen::Vector3d(record.P[0], record.P[1], record.P[2]);
+        keyframe.R = Eigen::Quaterniond(record.q[3], record.q[0], record.q[1], record.q[2]).normalized().toRotationMatrix();
+        for (uint32_t i = 0; i < record.num_features; i++)
+        {
+            const MapFeature &feature = features[record.first_feature + i];
+            keyframe.feature_ids.push_back(feature.feature_id);
+            keyframe.points.push_back(Eigen::Vector3d(feature.point[0], feature.point[1], feature.point[2]));
+            keyframe.observations.push_back(Eigen::Vector2d(feature.observation[0], feature.observation[1]));
+            ReloDescriptor descriptor;
+            memcpy(descriptor.data(), feature.descriptor, RELO_DESCRIPTOR_SIZE);
+            keyframe.descriptors.push_back(descriptor);
+        }
+        std::vector<uint32_t> words;
+        describeWords(keyframe.descriptors, words);
+        insert(std::move(keyframe), std::move(words));
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_relo);
+        // the frame of the file is the map frame
+        Alignment &a = alignments[MAP_GENERATION];
+        a.R.setIdentity();
+        a.t.setZero();
+        map_loaded = true;
+        map_anchored = header.anchored != 0;
+        map_anc_ecef = Eigen::Vector3d(header.anc_ecef[0], header.anc_ecef[1], header.anc_ecef[2]);
+        map_R_ecef_enu = Eigen::Map<const Eigen::Matrix<double, 3, 3, Eigen::RowMajor>>(header.R_ecef_enu);
+    }
+    munmap(addr, size);
+    GVINS_INFO("loaded %lu keyframes from the keyframe map %s%s", static_cast<unsigned long>(database.size()),
+               path.c_str(), map_anchored ? "" : " (no GNSS anchor)");
+    return true;
+}
+
+// written next to the target and renamed, as the checkpoint
+bool Relocalizer::saveMap(const std::string &path, int generation, bool anchored, const Eigen::Matrix3d &R_enu_world,
+                          const Eigen::Vector3d &anc_ecef, const Eigen::Matrix3d &R_ecef_enu)
+{
+    stage.wait();
+    Eigen::Matrix3d R_cur;
+    Eigen::Vector3d t_cur;
+    if (!mapAlignment(generation, R_cur, t_cur))
+    {
+        GVINS_WARN("the session is not aligned to the map, the keyframe map is not saved");
+        return false;
+    }
+    // map frame -> the frame of the file
+    Eigen::Matrix3d R_file_map = Eigen::Matrix3d::Identity();
+    Eigen::Vector3d t_file_map = Eigen::Vector3d::Zero();
+    if (anchored)
+    {
+        R_file_map = R_enu_world * R_cur.transpose();
+        t_file_map = -R_file_map * t_cur;
+    }
+
+    std::vector<MapKeyframe> keyframes;
+    std::vector<MapFeature> features;
+    for (const Entry &entry : database)
+    {
+        const ReloKeyframe &keyframe = entry.keyframe;
+        Eigen::Matrix3d R_map;
+        Eigen::Vector3d t_map;
+        if (!mapAlignment(keyframe.generation, R_map, t_map))
+            continue;   // a session never relocalized against the map
+        const Eigen::Matrix3d R = R_file_map * R_map;
+        const Eigen::Vector3d t = R_file_map * t_map + t_file_map;
+
+        MapKeyframe record = {};
+        record.sec = keyframe.stamp.sec;
+        record.nsec = keyframe.stamp.nsec;
+        record.first_feature = features.size();
+        record.num_features = keyframe.feature_ids.size();
+        const Eigen::Vector3d P = R * keyframe.P + t;
+        const Eigen::Quaterniond q(R * keyframe.R);
+        for (int k = 0; k < 3; k++)
+            record.P[k] = P(k);
+        record.q[0] = q.x();
+        record.q[1] = q.y();
+        record.q[2] = q.z();
+        record.q[3] = q.w();
+        keyframes.push_back(record);
+        for (size_t i = 0; i < keyframe.feature_ids.size(); i++)
+        {
+            MapFeature feature = {};
+            const Eigen::Vector3d point = R * keyframe.points[i] + t;
+            for (int k = 0; k < 3; k++)
+                feature.point[k] = point(k);
+            feature.observation[0] = keyframe.observations[i].x();
+            feature.observation[1] = keyframe.observations[i].y();
+            feature.feature_id = keyframe.feature_ids[i];
+            memcpy(feature.descriptor, keyframe.descriptors[i].data(), RELO_DESCRIPTOR_SIZE);
+            features.push_back(feature);
+        }
+    }
+
+    MapHeader header = {};
+    header.magic = MAP_MAGIC;
+    header.version = MAP_VERSION;
+    header.anchored = anchored ? 1 : 0;
+    header.num_keyframes = keyframes.size();
+    header.num_features = features.size();
+    for (int k = 0; k < 3; k++)
+        header.anc_ecef[k] = anchored ? anc_ecef(k) : 0.0;
+    Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>>(header.R_ecef_enu) =
+        anchored ? R_ecef_enu : Eigen::Matrix3d::Identity();
+
+    const std::string tmp_path = path + ".tmp";
+    FILE *file = fopen(tmp_path.c_str(), "wb");
+    if (!file)
+    {
+        GVINS_WARN("cannot write keyframe map %s: %s", tmp_path.c_str(), strerror(errno));
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    written = written && fwrite(keyframes.data(), sizeof(MapKeyframe), keyframes.size(), file) == keyframes.size();
+    written = written && fwrite(features.data(), sizeof(MapFeature), features.size(), file) == features.size();
+    written = written && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    fclose(file);
+    if (!written || rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        GVINS_WARN("cannot write keyframe map %s", path.c_str());
+        return false;
+    }
+    GVINS_INFO("saved %lu keyframes to the keyframe map %s", static_cast<unsigned long>(keyframes.size()), path.c_str());
+    return true;
+}
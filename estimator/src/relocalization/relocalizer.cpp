@@ -0,0 +1,438 @@
+#include "relocalizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/core/eigen.hpp>
+#include <gvins_feature_tracker/log.h>
+
+#include "../parameters.h"
+#include "../utility/utility.h"
+
+namespace
+{
+const int MAX_CANDIDATES = 3;           // best scored keyframes verified per query
+const int MAX_MATCH_DISTANCE = 50;      // bits of 256
+const double MATCH_RATIO = 0.8;         // best to second best distance
+const int PNP_ITERATIONS = 100;
+const double PNP_REPROJECTION_THRES = 3.0 / FOCAL_LENGTH;  // on the normalized plane
+
+int hammingDistance(const ReloDescriptor &a, const ReloDescriptor &b)
+{
+    int distance = 0;
+    for (int k = 0; k < RELO_DESCRIPTOR_SIZE; k += 8)
+    {
+        uint64_t x, y;
+        memcpy(&x, a.data() + k, 8);
+        memcpy(&y, b.data() + k, 8);
+        distance += __builtin_popcountll(x ^ y);
+    }
+    return distance;
+}
+}
+
+Relocalizer::Relocalizer(size_t _max_keyframes, int _min_inliers, double _skip_recent)
+    : max_keyframes(std::max<size_t>(_max_keyframes, 1)), min_inliers(std::max(_min_inliers, 6)),
+      skip_recent(_skip_recent), deterministic(false), first_serial(0), postings(NUM_WORD_TABLES << WORD_BITS), num_keyframes(0),
+      map_loaded(false), map_anchored(false)
+{
+    map_anc_ecef.setZero();
+    map_R_ecef_enu.setIdentity();
+}
+
+void Relocalizer::addFrameDescriptors(const Timestamp &stamp, const std::vector<int> &feature_ids,
+                                      const std::vector<uint8_t> &descriptors)
+{
+    if (descriptors.size() != feature_ids.size() * RELO_DESCRIPTOR_SIZE)
+        return;
+    static const ReloDescriptor none = {};
+    recent_frames.emplace_back(stamp, std::map<int, ReloDescriptor>());
+    std::map<int, ReloDescriptor> &frame = recent_frames.back().second;
+    for (size_t i = 0; i < feature_ids.size(); i++)
+    {
+        ReloDescriptor descriptor;
+        memcpy(descriptor.data(), &descriptors[i * RELO_DESCRIPTOR_SIZE], RELO_DESCRIPTOR_SIZE);
+        // all zero: the tracker could not describe the point
+        if (descriptor != none)
+            frame.emplace_hint(frame.end(), feature_ids[i], descriptor);
+    }
+    while (recent_frames.size() > NUM_RECENT_FRAMES)
+        recent_frames.pop_front();
+}
+
+bool Relocalizer::attachDescriptors(ReloKeyframe &keyframe) const
+{
+    auto frame = std::find_if(recent_frames.begin(), recent_frames.end(),
+        [&](const std::pair<Timestamp, std::map<int, ReloDescriptor>> &f) { return f.first == keyframe.stamp; });
+    if (frame == recent_frames.end())
+        return false;
+
+    // only the features the tracker described
+    const bool has_points = !keyframe.points.empty();
+    size_t n = 0;
+    keyframe.descriptors.resize(keyframe.feature_ids.size());
+    for (size_t i = 0; i < keyframe.feature_ids.size(); i++)
+    {
+        auto it = frame->second.find(keyframe.feature_ids[i]);
+        if (it == frame->second.end())
+            continue;
+        keyframe.feature_ids[n] = keyframe.feature_ids[i];
+        if (has_points)
+            keyframe.points[n] = keyframe.points[i];
+        keyframe.observations[n] = keyframe.observations[i];
+        keyframe.descriptors[n] = it->second;
+        n++;
+    }
+    keyframe.feature_ids.resize(n);
+    if (has_points)
+        keyframe.points.resize(n);
+    keyframe.observations.resize(n);
+    keyframe.descriptors.resize(n);
+    return static_cast<int>(n) >= min_inliers;
+}
+
+void Relocalizer::addKeyframe(ReloKeyframe keyframe)
+{
+    if (!attachDescriptors(keyframe))
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_relo);
+        if (pending.size() >= MAX_PENDING_KEYFRAMES)
+        {
+            pending.pop_front();
+            GVINS_WARN_THROTTLE(10.0, "relocalization falls behind, keyframes dropped");
+        }
+        pending.push_back(std::move(keyframe));
+    }
+    kick();
+}
+
+void Relocalizer::poll(std::vector<ReloResult> &results)
+{
+    // until the queue is drained, a keyframe may have been queued while the last job was finishing
+    while (deterministic)
+    {
+        kick();
+        stage.wait();
+        std::lock_guard<std::mutex> lock(m_relo);
+        if (pending.empty())
+            break;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_relo);
+        results.insert(results.end(), finished.begin(), finished.end());
+        finished.clear();
+    }
+    // keyframes queued while the last job was finishing
+    kick();
+}
+
+bool Relocalizer::mapAlignment(int generation, Eigen::Matrix3d &R, Eigen::Vector3d &t) const
+{
+    std::lock_guard<std::mutex> lock(m_relo);
+    auto it = alignments.find(generation);
+    if (it == alignments.end())
+        return false;
+    R = it->second.R;
+    t = it->second.t;
+    return true;
+}
+
+void Relocalizer::setMapAlignment(int generation, const Eigen::Matrix3d &R, const Eigen::Vector3d &t)
+{
+    std::lock_guard<std::mutex> lock(m_relo);
+    Alignment &a = alignments[generation];
+    a.R = R;
+    a.t = t;
+}
+
+bool Relocalizer::hasMap() const
+{
+    std::lock_guard<std::mutex> lock(m_relo);
+    return map_loaded;
+}
+
+bool Relocalizer::mapAnchor(Eigen::Vector3d &anc_ecef, Eigen::Matrix3d &R_ecef_enu) const
+{
+    std::lock_guard<std::mutex> lock(m_relo);
+    if (!map_anchored)
+        return false;
+    anc_ecef = map_anc_ecef;
+    R_ecef_enu = map_R_ecef_enu;
+    return true;
+}
+
+size_t Relocalizer::numKeyframes() const
+{
+    std::lock_guard<std::mutex> lock(m_relo);
+    return num_keyframes;
+}
+
+bool Relocalizer::localize(const Timestamp &stamp, const std::vector<int> &feature_ids,
+                           const std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>> &observations,
+                           Eigen::Matrix3d &R, Eigen::Vector3d &P)
+{
+    ReloKeyframe frame;
+    frame.stamp = stamp;
+    frame.generation = -1;      // matched against every session
+    frame.feature_ids = feature_ids;
+    frame.observations = observations;
+    if (!attachDescriptors(frame))
+        return false;
+    std::vector<uint32_t> words;
+    describeWords(frame.descriptors, words);
+
+    // the database is only touched by the stage, which stays idle until this thread kicks it again
+    stage.wait();
+    ReloResult result;
+    if (!query(frame, words, result))
+        return false;
+    Eigen::Matrix3d R_map;
+    Eigen::Vector3d t_map;
+    if (!mapAlignment(result.old_generation, R_map, t_map))
+        return false;
+    R = R_map * result.R;
+    P = R_map * result.P + t_map;
+    return true;
+}
+
+void Relocalizer::kick()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_relo);
+        if (pending.empty())
+            return;
+    }
+    if (stage.idle())
+        stage.submit([this]() { processPending(); });
+}
+
+void Relocalizer::processPending()
+{
+    while (true)
+    {
+        ReloKeyframe keyframe;
+        {
+            std::lock_guard<std::mutex> lock(m_relo);
+            if (pending.empty())
+                return;
+            keyframe = std::move(pending.front());
+            pending.pop_front();
+        }
+        std::vector<uint32_t> words;
+        describeWords(keyframe.descriptors, words);
+        ReloResult result;
+        if (query(keyframe, words, result))
+        {
+            align(keyframe, result);
+            GVINS_INFO("relocalized keyframe %f against %f (session %d / %d), %d inliers",
+                       keyframe.stamp.toSec(), result.old_stamp.toSec(), keyframe.generation,
+                       result.old_generation, result.inliers);
+            std::lock_guard<std::mutex> lock(m_relo);
+            finished.push_back(result);
+        }
+        insert(std::move(keyframe), std::move(words));
+    }
+}
+
+// one word per table: WORD_BITS fixed bits of the descriptor, spread over its 256 bits
+void Relocalizer::describeWords(const std::vector<ReloDescriptor> &descriptors, std::vector<uint32_t> &words)
+{
+    words.clear();
+    words.reserve(descriptors.size() * NUM_WORD_TABLES);
+    for (const ReloDescriptor &descriptor : descriptors)
+    {
+        for (int t = 0; t < NUM_WORD_TABLES; t++)
+        {
+            uint32_t key = 0;
+            for (int b = 0; b < WORD_BITS; b++)
+            {
+                const int pos = ((t * WORD_BITS + b) * 97) % (RELO_DESCRIPTOR_SIZE * 8);
+                key |= static_cast<uint32_t>((descriptor[pos >> 3] >> (pos & 7)) & 1) << b;
+            }
+            words.push_back((static_cast<uint32_t>(t) << WORD_BITS) | key);
+        }
+    }
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+}
+
+bool Relocalizer::query(const ReloKeyframe &keyframe, const std::vector<uint32_t> &words, ReloResult &result)
+{
+    if (database.empty() || words.empty())
+        return false;
+    const double num_entries = static_cast<double>(database.size());
+    std::unordered_map<uint64_t, double> scores;
+    for (uint32_t word : words)
+    {
+        const std::vector<uint64_t> &serials = postings[word];
+        if (serials.empty())
+            continue;
+        const double idf = std::log(num_entries / serials.size());
+        for (uint64_t serial : serials)
+        {
+            const ReloKeyframe &candidate = database[serial - first_serial].keyframe;
+            if (candidate.generation == keyframe.generation &&
+                std::fabs(candidate.stamp.toSec() - keyframe.stamp.toSec()) < skip_recent)
+                continue;
+            scores[serial] += idf;
+        }
+    }
+
+    std::vector<std::pair<double, uint64_t>> ranked;
+    ranked.reserve(scores.size());
+    for (const std::pair<const uint64_t, double> &score : scores)
+    {
+        const Entry &entry = database[score.first - first_serial];
+        ranked.emplace_back(score.second / std::sqrt(static_cast<double>(words.size() * entry.words.size())),
+                            score.first);
+    }
+    const size_t num_candidates = std::min<size_t>(MAX_CANDIDATES, ranked.size());
+    std::partial_sort(ranked.begin(), ranked.begin() + num_candidates, ranked.end(),
+        [](const std::pair<double, uint64_t> &a, const std::pair<double, uint64_t> &b) { return a.first > b.first; });
+    for (size_t i = 0; i < num_candidates; i++)
+    {
+        if (verify(keyframe, database[ranked[i].second - first_serial].keyframe, result))
+            return true;
+    }
+    return false;
+}
+
+bool Relocalizer::verify(const ReloKeyframe &keyframe, const ReloKeyframe &candidate, ReloResult &result) const
+{
+    std::vector<cv::Point3f> object_points;
+    std::vector<cv::Point2f> image_points;
+    for (size_t i = 0; i < keyframe.descriptors.size(); i++)
+    {
+        int best = MAX_MATCH_DISTANCE + 1, second = RELO_DESCRIPTOR_SIZE * 8;
+        size_t best_j = 0;
+        for (size_t j = 0; j < candidate.descriptors.size(); j++)
+        {
+            const int distance = hammingDistance(keyframe.descriptors[i], candidate.descriptors[j]);
+            if (distance < best)
+            {
+                second = best;
+                best = distance;
+                best_j = j;
+            }
+            else if (distance < second)
+                second = distance;
+        }
+        if (best > MAX_MATCH_DISTANCE || best >= MATCH_RATIO * second)
+            continue;
+        const Eigen::Vector3d &point = candidate.points[best_j];
+        object_points.push_back(cv::Point3f(point.x(), point.y(), point.z()));
+        image_points.push_back(cv::Point2f(keyframe.observations[i].x(), keyframe.observations[i].y()));
+    }
+    if (static_cast<int>(object_points.size()) < min_inliers)
+        return false;
+
+    cv::Mat K = (cv::Mat_<double>(3, 3) << 1, 0, 0, 0, 1, 0, 0, 0, 1);
+    cv::Mat rvec, tvec;
+    std::vector<int> inliers;
+    if (!cv::solvePnPRansac(object_points, image_points, K, cv::Mat(), rvec, tvec, false,
+                            PNP_ITERATIONS, PNP_REPROJECTION_THRES, 0.99, inliers) ||
+        static_cast<int>(inliers.size()) < min_inliers)
+        return false;
+
+    cv::Mat r;
+    cv::Rodrigues(rvec, r);
+    Eigen::Matrix3d R_cw;
+    Eigen::Vector3d t_cw;
+    cv::cv2eigen(r, R_cw);
+    cv::cv2eigen(tvec, t_cw);
+    result.stamp = keyframe.stamp;
+    result.generation = keyframe.generation;
+    result.old_stamp = candidate.stamp;
+    result.old_generation = candidate.generation;
+    result.R = R_cw.transpose();
+    result.P = -result.R * t_cw;
+    result.inliers = static_cast<int>(inliers.size());
+    result.constraint = false;
+    return true;
+}
+
+/**
+ * result 的位姿在旧关键帧会话 h 的世界系中, 转换到查询关键帧的会话 g; h != g 时需要两个会话到地图系的变换,
+ * 只知道其中一个时由这次匹配求出另一个 (只取 yaw, 重力方向在两个会话中一致), 此时结果只是对齐, 不作为约束
+ */
+void Relocalizer::align(const ReloKeyframe &keyframe, ReloResult &result)
+{
+    const int h = result.old_generation, g = keyframe.generation;
+    if (h == g)
+    {
+        result.constraint = true;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_relo);
+    auto it_h = alignments.find(h), it_g = alignments.find(g);
+    const bool known = (it_h != alignments.end() && it_g != alignments.end());
+    if (!known)
+    {
+        // session g -> session h from the relocalized camera
+        const double yaw = Utility::R2ypr(result.R * keyframe.R.transpose()).x();
+        const Eigen::Matrix3d R_hg = Utility::ypr2R(Eigen::Vector3d(yaw, 0, 0));
+        const Eigen::Vector3d t_hg = result.P - R_hg * keyframe.P;
+        if (it_h != alignments.end())
+        {
+            Alignment &a = alignments[g];
+            a.R = it_h->second.R * R_hg;
+            a.t = it_h->second.R * t_hg + it_h->second.t;
+        }
+        else if (it_g != alignments.end())
+        {
+            Alignment &a = alignments[h];
+            a.R = it_g->second.R * R_hg.transpose();
+            a.t = it_g->second.t - a.R * t_hg;
+        }
+        else
+            return;     // neither session is on the map yet, P/R stay in session h
+        const bool aligned_g = (it_g == alignments.end());
+        it_h = alignments.find(h);
+        it_g = alignments.find(g);
+        GVINS_INFO("session %d aligned to the map through session %d", aligned_g ? g : h, aligned_g ? h : g);
+    }
+    const Alignment &a_h = it_h->second, &a_g = it_g->second;
+    result.R = a_g.R.transpose() * a_h.R * result.R;
+    result.P = a_g.R.transpose() * (a_h.R * result.P + a_h.t - a_g.t);
+    result.generation = g;
+    result.constraint = known;
+}
+
+void Relocalizer::insert(ReloKeyframe keyframe, std::vector<uint32_t> words)
+{
+    const uint64_t serial = first_serial + database.size();
+    for (uint32_t word : words)
+        postings[word].push_back(serial);
+    {
+        std::lock_guard<std::mutex> lock(m_relo);
+        // the first session defines the map frame
+        if (alignments.empty())
+        {
+            Alignment &a = alignments[keyframe.generation];
+            a.R.setIdentity();
+            a.t.setZero();
+        }
+    }
+    database.push_back(Entry{std::move(keyframe), std::move(words)});
+
+    if (database.size() > max_keyframes)
+    {
+        const Entry &oldest = database.front();
+        for (uint32_t word : oldest.words)
+        {
+            std::vector<uint64_t> &serials = postings[word];
+            if (!serials.empty() && serials.front() == first_serial)
+                serials.erase(serials.begin());
+        }
+        database.pop_front();
+        first_serial++;
+    }
+    std::lock_guard<std::mutex> lock(m_relo);
+    num_keyframes = database.size();
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "../utility/pipeline_stage.h"
+#include "../utility/timestamp.h"
+
+const int RELO_DESCRIPTOR_SIZE = 32;        // upright ORB from the feature tracker
+typedef std::array<uint8_t, RELO_DESCRIPTOR_SIZE> ReloDescriptor;
+
+/**
+ * 一个关键帧 (窗口中的 WINDOW_SIZE - 2 帧, MARGIN_OLD 时): 相机位姿和已三角化特征的世界坐标/归一化平面观测,
+ * 坐标系是它所属会话 (generation, 每次 clearState 后重新初始化的世界系) 的世界系
+ */
+struct ReloKeyframe
+{
+    Timestamp stamp;
+    int generation;
+    Eigen::Vector3d P;          // camera
+    Eigen::Matrix3d R;
+    std::vector<int> feature_ids;
+    std::vector<Eigen::Vector3d> points;
+    std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>> observations;   // normalized plane
+    std::vector<ReloDescriptor> descriptors;    // filled by the relocalizer from the frame's descriptors
+};
+
+// 一次重定位: 关键帧 stamp 的相机在其会话世界系中的位姿, 由数据库中 old_stamp 的关键帧 PnP 得到
+struct ReloResult
+{
+    Timestamp stamp;
+    int generation;
+    Timestamp old_stamp;
+    int old_generation;
+    Eigen::Vector3d P;          // camera, in the world frame of generation
+    Eigen::Matrix3d R;
+    int inliers;
+    bool constraint;            // false when the match only aligned the session to the map, P/R restate its own estimate
+};
+
+/**
+ * 后台重定位: 有界的关键帧数据库 + 二进制描述子的词袋倒排索引, 查询和插入在自己的线程 (PipelineStage) 上异步进行,
+ * 估计器线程只提交关键帧和取回结果, 不等待
+ * 词典不需要训练: 每个描述子在 NUM_WORD_TABLES 组固定的 WORD_BITS 位上各取一个词 (LSH), 按 TF-IDF 打分选出候选,
+ * 再用描述子匹配 + PnP RANSAC 验证
+ * 地图系是第一个会话的世界系; 失败重新初始化后的会话与旧关键帧匹配成功时求出它到地图系的 4 自由度 (yaw + 平移) 变换,
+ * 之后该会话的匹配可转换为本会话世界系中的位姿约束. 同一会话中 RELO_SKIP_RECENT 以内的关键帧不参与匹配
+ */
+class Relocalizer
+{
+  public:
+    Relocalizer(size_t _max_keyframes, int _min_inliers, double _skip_recent);
+
+    // descriptors of the features of one frame, kept for the recent frames until the frame becomes a keyframe
+    void addFrameDescriptors(const Timestamp &stamp, const std::vector<int> &feature_ids,
+                             const std::vector<uint8_t> &descriptors);
+    // queries the database with the keyframe, then inserts it; returns at once
+    void addKeyframe(ReloKeyframe keyframe);
+    // results of the queries finished since the last poll are appended
+    void poll(std::vector<ReloResult> &results);
+    // poll first waits for every keyframe added before it, the results come at the same frames in every run
+    void setDeterministic(bool _deterministic) { deterministic = _deterministic; }
+
+    // session frame -> map frame, false until the session has been relocalized against the map
+    bool mapAlignment(int generation, Eigen::Matrix3d &R, Eigen::Vector3d &t) const;
+    // a session started in the map frame, e.g. initialized from a loaded map
+    void setMapAlignment(int generation, const Eigen::Matrix3d &R, const Eigen::Vector3d &t);
+    size_t numKeyframes() const;
+
+    /**
+     * 同步定位一帧 (没有三角化的特征, 如初始化前的帧): 与数据库查询并 PnP, 不插入数据库, 等待后台的任务完成后在调用者线程执行
+     * @param R, P  camera pose in the map frame
+     */
+    bool localize(const Timestamp &stamp, const std::vector<int> &feature_ids,
+                  const std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>> &observations,
+                  Eigen::Matrix3d &R, Eigen::Vector3d &P);
+
+    /**
+     * 关键帧地图文件 (keyframe_map.cpp): 定长记录, 可直接 mmap; 有 GNSS 锚点时关键帧在锚点 anc_ecef 的 ENU 系中
+     * (R_ecef_enu 一并保存), 否则在地图系中. 加载的关键帧属于 MAP_GENERATION, 其坐标系即地图系
+     */
+    bool loadMap(const std::string &path);
+    // keyframes of the sessions aligned to the map; R_enu_world is the world frame of generation in the ENU frame
+    bool saveMap(const std::string &path, int generation, bool anchored, const Eigen::Matrix3d &R_enu_world,
+                 const Eigen::Vector3d &anc_ecef, const Eigen::Matrix3d &R_ecef_enu);
+    bool hasMap() const;
+    // GNSS anchor of the loaded map, false without one
+    bool mapAnchor(Eigen::Vector3d &anc_ecef, Eigen::Matrix3d &R_ecef_enu) const;
+
+    static const int MAP_GENERATION = 0;    // below the estimator's world generations
+
+  private:
+    static const int NUM_WORD_TABLES = 2;
+    static const int WORD_BITS = 11;
+    static const size_t NUM_RECENT_FRAMES = 16;
+    static const size_t MAX_PENDING_KEYFRAMES = 8;
+
+    struct Entry
+    {
+        ReloKeyframe keyframe;
+        std::vector<uint32_t> words;    // unique
+    };
+
+    struct Alignment
+    {
+        Eigen::Matrix3d R;
+        Eigen::Vector3d t;
+    };
+
+    static void describeWords(const std::vector<ReloDescriptor> &descriptors, std::vector<uint32_t> &words);
+    // descriptors of the keyframe's features from recent_frames, the features without one are dropped
+    bool attachDescriptors(ReloKeyframe &keyframe) const;
+    void kick();
+    void processPending();
+    bool query(const ReloKeyframe &keyframe, const std::vector<uint32_t> &words, ReloResult &result);
+    bool verify(const ReloKeyframe &keyframe, const ReloKeyframe &candidate, ReloResult &result) const;
+    void align(const ReloKeyframe &keyframe, ReloResult &result);
+    void insert(ReloKeyframe keyframe, std::vector<uint32_t> words);
+
+    const size_t max_keyframes;
+    const int min_inliers;
+    const double skip_recent;
+
+    // estimator thread only
+    std::deque<std::pair<Timestamp, std::map<int, ReloDescriptor>>> recent_frames;
+    bool deterministic;
+
+    // database, relocalization thread only
+    std::deque<Entry> database;
+    uint64_t first_serial;                          // serial of database.front()
+    std::vector<std::vector<uint64_t>> postings;    // word -> serials of the keyframes containing it, ascending
+
+    mutable std::mutex m_relo;                      // the members below
+    std::deque<ReloKeyframe> pending;
+    std::vector<ReloResult> finished;
+    std::map<int, Alignment> alignments;
+    size_t num_keyframes;
+    bool map_loaded, map_anchored;
+    Eigen::Vector3d map_anc_ecef;
+    Eigen::Matrix3d map_R_ecef_enu;
+
+    PipelineStage stage;        // last, joined before the members above are destroyed
+};
@@ -0,0 +1,252 @@
+#include "shared_ephem.h"
+#include "ephem_fields.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gvins_feature_tracker/log.h>
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the shared segment needs lock-free 64-bit atomics");
+
+namespace
+{
+const uint64_t SEGMENT_MAGIC = 0x4d45485053564e47ull;  // "GNVSPHEM"
+const uint32_t SEGMENT_VERSION = 1;
+const uint32_t CAPACITY = 1024;
+const uint32_t RECORD_DATA_SIZE = 384;
+const uint32_t IONO_PARAMS_SIZE = 8;
+
+struct FieldWriter
+{
+    char *data;
+    uint32_t size;
+    bool ok;
+    template <typename T> void operator()(const T &x)
+    {
+        if (size + sizeof(T) > RECORD_DATA_SIZE)
+        {
+            ok = false;
+            return;
+        }
+        memcpy(data + size, &x, sizeof(T));
+        size += sizeof(T);
+    }
+};
+
+struct FieldReader
+{
+    const char *data;
+    uint32_t size, pos;
+    bool ok;
+    template <typename T> void operator()(T &x)
+    {
+        if (pos + sizeof(T) > size)
+        {
+            ok = false;
+            return;
+        }
+        memcpy(&x, data + pos, sizeof(T));
+        pos += sizeof(T);
+    }
+};
+}
+
+struct SharedEphemSegment::Layout
+{
+    // record i of the publisher's sequence sits in slot i % CAPACITY, seq is 2i+1 while it is written and 2i+2 after
+    struct Record
+    {
+        std::atomic<uint64_t> seq;
+        uint32_t size;
+        uint8_t glo;
+        char data[RECORD_DATA_SIZE];
+    };
+
+    uint64_t magic;
+    uint32_t version, capacity;
+    std::atomic<uint64_t> session;      // 0 while the publisher initializes the segment
+    std::atomic<uint64_t> count;        // records published in this session
+    std::atomic<uint64_t> iono_seq;     // odd while iono_params is written, 0 before the first
+    double iono_params[IONO_PARAMS_SIZE];
+    Record records[CAPACITY];
+};
+
+SharedEphemSegment::SharedEphemSegment(Layout *_layout, bool _writable)
+    : layout(_layout), writable(_writable), session(0), read_count(0), iono_seq(0), num_missed(0)
+{
+}
+
+SharedEphemSegment::~SharedEphemSegment()
+{
+    // the segment stays in /dev/shm for readers that still map it and for the next publisher
+    munmap(layout, sizeof(Layout));
+}
+
+std::unique_ptr<SharedEphemSegment> SharedEphemSegment::create(const std::string &name)
+{
+    const int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        GVINS_ERROR("cannot create shared ephemeris segment %s: %s", name.c_str(), strerror(errno));
+        return nullptr;
+    }
+    void *addr = MAP_FAILED;
+    if (ftruncate(fd, sizeof(Layout)) == 0)
+        addr = mmap(nullptr, sizeof(Layout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        GVINS_ERROR("cannot map shared ephemeris segment %s: %s", name.c_str(), strerror(errno));
+        return nullptr;
+    }
+
+    // a new session: readers of a previous publisher start over from the first record
+    Layout *layout = static_cast<Layout *>(addr);
+    layout->session.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    layout->magic = SEGMENT_MAGIC;
+    layout->version = SEGMENT_VERSION;
+    layout->capacity = CAPACITY;
+    layout->count.store(0, std::memory_order_relaxed);
+    layout->iono_seq.store(0, std::memory_order_relaxed);
+    for (uint32_t i = 0; i < CAPACITY; ++i)
+        layout->records[i].seq.store(0, std::memory_order_relaxed);
+    const uint64_t session = static_cast<uint64_t>(
+        std::chrono::system_clock::now().time_since_epoch().count()) | 1;
+    layout->session.store(session, std::memory_order_release);
+    return std::unique_ptr<SharedEphemSegment>(new SharedEphemSegment(layout, true));
+}
+
+std::unique_ptr<SharedEphemSegment> SharedEphemSegment::open(const std::string &name)
+{
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    void *addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size == static_cast<off_t>(sizeof(Layout)))
+        addr = mmap(nullptr, sizeof(Layout), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return nullptr;
+    Layout *layout = static_cast<Layout *>(addr);
+    if (layout->magic != SEGMENT_MAGIC || layout->version != SEGMENT_VERSION || layout->capacity != CAPACITY)
+    {
+        GVINS_WARN("shared ephemeris segment %s has an incompatible layout", name.c_str());
+        munmap(addr, sizeof(Layout));
+        return nullptr;
+    }
+    return std::unique_ptr<SharedEphemSegment>(new SharedEphemSegment(layout, false));
+}
+
+void SharedEphemSegment::publish(const EphemBasePtr &ephem)
+{
+    GVINS_ASSERT(writable);
+    char data[RECORD_DATA_SIZE];
+    FieldWriter field_writer{data, 0, true};
+    const GloEphemPtr glo_ephem = std::dynamic_pointer_cast<GloEphem>(ephem);
+    if (glo_ephem)
+        visitGloEphem(static_cast<const GloEphem &>(*glo_ephem), field_writer);
+    else
+        visitEphem(static_cast<const Ephem &>(*std::dynamic_pointer_cast<Ephem>(ephem)), field_writer);
+    GVINS_ASSERT(field_writer.ok);
+
+    // the only writer, so count is not contended
+    const uint64_t n = layout->count.load(std::memory_order_relaxed);
+    Layout::Record &record = layout->records[n % CAPACITY];
+    record.seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    record.size = field_writer.size;
+    record.glo = glo_ephem ? 1 : 0;
+    memcpy(record.data, data, field_writer.size);
+    record.seq.store(2 * n + 2, std::memory_order_release);
+    layout->count.store(n + 1, std::memory_order_release);
+}
+
+void SharedEphemSegment::publishIonoParams(const std::vector<double> &iono_params)
+{
+    GVINS_ASSERT(writable);
+    if (iono_params.size() != IONO_PARAMS_SIZE)
+        return;
+    const uint64_t seq = layout->iono_seq.load(std::memory_order_relaxed);
+    layout->iono_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(layout->iono_params, iono_params.data(), sizeof(layout->iono_params));
+    layout->iono_seq.store(seq + 2, std::memory_order_release);
+}
+
+void SharedEphemSegment::poll(std::vector<EphemBasePtr> &ephems, std::vector<double> &iono_params)
+{
+    const uint64_t current_session = layout->session.load(std::memory_order_acquire);
+    if (current_session == 0)
+        return;
+    const uint64_t count = layout->count.load(std::memory_order_acquire);
+    // after a restart of the publisher, count may also be seen reset before the new session
+    if (current_session != session || count < read_count)
+    {
+        session = current_session;
+        read_count = 0;
+        iono_seq = 0;
+    }
+
+    if (count - read_count > CAPACITY)
+    {
+        num_missed += count - CAPACITY - read_count;
+        read_count = count - CAPACITY;
+    }
+    char data[RECORD_DATA_SIZE];
+    for (; read_count < count; ++read_count)
+    {
+        const Layout::Record &record = layout->records[read_count % CAPACITY];
+        const uint64_t seq = record.seq.load(std::memory_order_acquire);
+        if (seq != 2 * read_count + 2)
+        {
+            ++num_missed;   // overwritten by a newer record
+            continue;
+        }
+        const uint32_t size = std::min(record.size, RECORD_DATA_SIZE);
+        const bool glo = record.glo != 0;
+        memcpy(data, record.data, size);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (record.seq.load(std::memory_order_relaxed) != seq)
+        {
+            ++num_missed;
+            continue;
+        }
+
+        FieldReader field_reader{data, size, 0, true};
+        EphemBasePtr ephem;
+        if (glo)
+        {
+            GloEphemPtr glo_ephem(new GloEphem());
+            visitGloEphem(*glo_ephem, field_reader);
+            ephem = glo_ephem;
+        }
+        else
+        {
+            EphemPtr gps_ephem(new Ephem());
+            visitEphem(*gps_ephem, field_reader);
+            ephem = gps_ephem;
+        }
+        if (field_reader.ok)
+            ephems.push_back(ephem);
+    }
+
+    const uint64_t seq = layout->iono_seq.load(std::memory_order_acquire);
+    if (seq == iono_seq || (seq & 1))
+        return;
+    double params[IONO_PARAMS_SIZE];
+    memcpy(params, layout->iono_params, sizeof(params));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (layout->iono_seq.load(std::memory_order_relaxed) != seq)
+        return;     // being rewritten, taken at the next poll
+    iono_seq = seq;
+    iono_params.assign(params, params + IONO_PARAMS_SIZE);
+}
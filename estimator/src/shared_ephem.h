@@ -0,0 +1,48 @@
+#ifndef SHARED_EPHEM_H
+#define SHARED_EPHEM_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gnss_comm/gnss_constant.hpp>
+
+using namespace gnss_comm;
+
+/**
+ * 同一台机器上多个估计器共用的星历/电离层参数: 一个进程 (订阅星历话题的那个) 把收到的星历写入
+ * POSIX 共享内存 (/dev/shm/<name>), 其它进程只读映射, 每帧取回新增的星历放入自己的 EphemStore, 不再订阅和解码星历话题
+ * 星历按到达顺序写入环形缓冲区 (最近 CAPACITY 条), 每条记录和电离层参数各有一个 seqlock, 读者不加锁也不阻塞写者;
+ * 读者落后超过 CAPACITY 条时跳过被覆盖的部分 (计入 numMissed()). 发布者重启时重新初始化同一段内存, 读者检测到后从头读取
+ * 卫星位置/钟差不共享: 其计算依赖各接收机自己的伪距 (信号发射时刻)
+ */
+class SharedEphemSegment
+{
+  public:
+    // the publisher creates the segment or takes over an existing one, nullptr on failure
+    static std::unique_ptr<SharedEphemSegment> create(const std::string &name);
+    // readers map an existing segment read-only, nullptr until a publisher has created it
+    static std::unique_ptr<SharedEphemSegment> open(const std::string &name);
+    ~SharedEphemSegment();
+
+    void publish(const EphemBasePtr &ephem);
+    void publishIonoParams(const std::vector<double> &iono_params);
+
+    // ephemerides published since the last poll, oldest first; iono_params is filled only if they changed
+    void poll(std::vector<EphemBasePtr> &ephems, std::vector<double> &iono_params);
+    uint64_t numMissed() const { return num_missed; }
+
+  private:
+    struct Layout;
+
+    SharedEphemSegment(Layout *layout, bool writable);
+
+    Layout *layout;
+    bool writable;
+    uint64_t session;       // of the publisher the read cursors belong to
+    uint64_t read_count;
+    uint64_t iono_seq;
+    uint64_t num_missed;
+};
+
+#endif
@@ -0,0 +1,161 @@
+/**
+ * 把 result_binary 写出的二进制结果文件 (result_format.h) 转成 CSV
+ *   gvins_result_to_csv <input.bin> [output.csv] [--all]
+ * 默认输出与 result_binary: 0 时完全相同的 CSV, --all 输出全部列并带表头
+ * 文件以 mmap 方式只读打开; 估计器异常退出时末尾不完整的一条记录被丢弃
+ */
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../utility/result_format.h"
+
+namespace
+{
+
+int usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s <input.bin> [output.csv] [--all]\n", prog);
+    return 1;
+}
+
+// the layout stored in the file, checked against the one compiled in
+bool readLayout(const char *data, size_t size, result_format::StreamLayout &l, const result_format::FileHeader *&h)
+{
+    if (size < sizeof(result_format::FileHeader))
+    {
+        fprintf(stderr, "file too short for a header\n");
+        return false;
+    }
+    h = reinterpret_cast<const result_format::FileHeader *>(data);
+    if (memcmp(h->magic, result_format::MAGIC, sizeof(result_format::MAGIC)) != 0)
+    {
+        fprintf(stderr, "not a GVINS result file\n");
+        return false;
+    }
+    if (h->version != result_format::VERSION)
+    {
+        fprintf(stderr, "unsupported version %u, this tool reads version %u\n", h->version, result_format::VERSION);
+        return false;
+    }
+    if (h->stream < result_format::TRAJECTORY || h->stream > result_format::SOLVER)
+    {
+        fprintf(stderr, "unknown stream %u\n", h->stream);
+        return false;
+    }
+    l = result_format::layout(static_cast<result_format::StreamId>(h->stream));
+    if (h->num_stamps != l.num_stamps || h->num_values != l.num_values ||
+        static_cast<int>(h->record_size) != result_format::recordSize(l) ||
+        static_cast<int>(h->header_size) != result_format::headerSize(l) || h->header_size > size)
+    {
+        fprintf(stderr, "inconsistent header\n");
+        return false;
+    }
+    l.num_csv_values = h->num_csv_values;
+    l.csv_trailing_separator = h->csv_trailing_separator != 0;
+    return true;
+}
+
+void writeColumnNames(const char *data, const result_format::StreamLayout &l, FILE *out)
+{
+    const char *names = data + sizeof(result_format::FileHeader);
+    for (int k = 0; k < l.num_stamps + l.num_values; ++k)
+    {
+        const char *name = names + k * result_format::COLUMN_NAME_SIZE;
+        fprintf(out, "%.*s%c", static_cast<int>(strnlen(name, result_format::COLUMN_NAME_SIZE)), name,
+                k + 1 < l.num_stamps + l.num_values ? ',' : '\n');
+    }
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    const char *input = nullptr, *output = nullptr;
+    bool all_columns = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--all") == 0)
+            all_columns = true;
+        else if (!input)
+            input = argv[i];
+        else if (!output)
+            output = argv[i];
+        else
+            return usage(argv[0]);
+    }
+    if (!input)
+        return usage(argv[0]);
+
+    int fd = open(input, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(input);
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        fprintf(stderr, "%s: empty or unreadable\n", input);
+        close(fd);
+        return 1;
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+    const char *data = static_cast<const char *>(map);
+
+    result_format::StreamLayout l;
+    const result_format::FileHeader *h;
+    if (!readLayout(data, size, l, h))
+    {
+        munmap(map, size);
+        return 1;
+    }
+    const size_t num_records = (size - h->header_size) / h->record_size;
+    if ((size - h->header_size) % h->record_size)
+        fprintf(stderr, "dropping a partial record at the end of %s\n", input);
+
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (!out)
+    {
+        perror(output);
+        munmap(map, size);
+        return 1;
+    }
+    if (all_columns)
+    {
+        writeColumnNames(data, l, out);
+        l.num_csv_values = l.num_values;
+        l.csv_trailing_separator = false;
+    }
+
+    int64_t stamps[2];
+    double values[result_format::MAX_COLUMNS];
+    std::string line;
+    for (size_t i = 0; i < num_records; ++i)
+    {
+        // records are not aligned in the file
+        const char *r = data + h->header_size + i * h->record_size;
+        memcpy(stamps, r, sizeof(int64_t) * l.num_stamps);
+        memcpy(values, r + sizeof(int64_t) * l.num_stamps, sizeof(double) * l.num_values);
+        line.clear();
+        result_format::appendCsv(l, stamps, values, line);
+        fwrite(line.data(), 1, line.size(), out);
+    }
+
+    if (output)
+        fclose(out);
+    munmap(map, size);
+    return 0;
+}
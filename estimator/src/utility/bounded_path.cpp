@@ -0,0 +1,71 @@
+#include "bounded_path.h"
+
+BoundedPath::BoundedPath()
+    : full_history(true), max_poses(0), max_age(0), history_spacing(0)
+{
+}
+
+void BoundedPath::configure(bool _full_history, size_t _max_poses, double _max_age, double _history_spacing)
+{
+    full_history = _full_history;
+    max_poses = _max_poses;
+    max_age = _max_age;
+    history_spacing = _history_spacing;
+}
+
+bool BoundedPath::tooOld(const Pose &oldest, const Pose &newest) const
+{
+    if (max_poses > 0 && recent.size() > max_poses)
+        return true;
+    return max_age > 0 && newest.stamp.toSec() - oldest.stamp.toSec() > max_age;
+}
+
+void BoundedPath::keepInHistory(const Pose &pose)
+{
+    if (history_spacing <= 0)
+        return;
+    if (!history.empty())
+    {
+        const geometry_msgs::Point &p = pose.pose.position, &q = history.back().pose.position;
+        const double dx = p.x - q.x, dy = p.y - q.y, dz = p.z - q.z;
+        if (dx * dx + dy * dy + dz * dz < history_spacing * history_spacing)
+            return;
+    }
+    history.push_back(pose);
+    if (max_poses > 0 && history.size() > max_poses)
+        history.pop_front();
+}
+
+void BoundedPath::push(const geometry_msgs::PoseStamped &pose)
+{
+    frame_id = pose.header.frame_id;
+    Pose p;
+    p.stamp = pose.header.stamp;
+    p.pose = pose.pose;
+    recent.push_back(p);
+    if (full_history)
+        return;
+    while (recent.size() > 1 && tooOld(recent.front(), recent.back()))
+    {
+        keepInHistory(recent.front());
+        recent.pop_front();
+    }
+}
+
+void BoundedPath::toMsg(nav_msgs::Path &msg) const
+{
+    msg.header.frame_id = frame_id;
+    msg.header.stamp = recent.empty() ? ros::Time() : recent.back().stamp;
+    msg.poses.resize(size());
+    size_t i = 0;
+    for (const std::deque<Pose> *poses : {&history, &recent})
+    {
+        for (const Pose &p : *poses)
+        {
+            geometry_msgs::PoseStamped &pose = msg.poses[i++];
+            pose.header.stamp = p.stamp;
+            pose.header.frame_id = frame_id;
+            pose.pose = p.pose;
+        }
+    }
+}
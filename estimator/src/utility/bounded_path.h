@@ -0,0 +1,42 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <geometry_msgs/PoseStamped.h>
+#include <nav_msgs/Path.h>
+
+/**
+ * 有界的轨迹: 最近的 max_poses 个 (或 max_age 秒内的) 位姿逐帧保留, 更早的按 history_spacing 米抽稀,
+ * 抽稀后的历史同样最多 max_poses 个; full_history 为 true 时保留全部位姿 (原来的行为)
+ * 内存和每次发布的消息大小因此不随运行时间增长; 只由发布线程访问
+ */
+class BoundedPath
+{
+  public:
+    BoundedPath();
+
+    // max_poses/max_age of 0 disable that limit, history_spacing of 0 drops the older poses
+    void configure(bool full_history, size_t max_poses, double max_age, double history_spacing);
+
+    void push(const geometry_msgs::PoseStamped &pose);
+    // the thinned history and then the recent poses, stamped with the newest pose
+    void toMsg(nav_msgs::Path &msg) const;
+    size_t size() const { return history.size() + recent.size(); }
+
+  private:
+    struct Pose
+    {
+        ros::Time stamp;
+        geometry_msgs::Pose pose;
+    };
+
+    bool tooOld(const Pose &oldest, const Pose &newest) const;
+    void keepInHistory(const Pose &pose);
+
+    bool full_history;
+    size_t max_poses;
+    double max_age;
+    double history_spacing;
+    std::string frame_id;
+    std::deque<Pose> history, recent;
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <utility>
+
+/**
+ * 容量固定为 N 的 vector, 元素存放在对象内部, 不做堆分配; 接口是 std::vector 的子集
+ * 用于每个特征在窗口内的观测 (最多 WINDOW_SIZE + 1 个), T 需可默认构造
+ */
+template <typename T, int N>
+class FixedVector
+{
+  public:
+    typedef T *iterator;
+    typedef const T *const_iterator;
+
+    FixedVector() : count(0) {}
+
+    iterator begin() { return items.data(); }
+    iterator end() { return items.data() + count; }
+    const_iterator begin() const { return items.data(); }
+    const_iterator end() const { return items.data() + count; }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    static constexpr int capacity() { return N; }
+
+    T &operator[](size_t i) { return items[i]; }
+    const T &operator[](size_t i) const { return items[i]; }
+    T &front() { return items[0]; }
+    const T &front() const { return items[0]; }
+    T &back() { return items[count - 1]; }
+    const T &back() const { return items[count - 1]; }
+
+    void push_back(const T &item)
+    {
+        assert(count < N);
+        items[count++] = item;
+    }
+
+    // keeps the order of the remaining elements
+    iterator erase(iterator pos)
+    {
+        for (iterator it = pos; it + 1 != end(); ++it)
+            *it = std::move(*(it + 1));
+        --count;
+        return pos;
+    }
+
+    void clear() { count = 0; }
+
+  private:
+    std::array<T, N> items;
+    size_t count;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define GVINS_FLOAT_PACK_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GVINS_FLOAT_PACK_NEON
+#endif
+
+/**
+ * 4 个 float 的 SIMD 包, x86 上为 SSE, ARM 上为 NEON, 其它平台退化为标量循环; 只提供逐元素的四则运算
+ * 用于按观测打包 (SoA) 的批量计算, 一条轨迹最多 WINDOW_SIZE + 1 个观测, 4 路比 8 路 (AVX) 的空槽更少
+ * load/store 不要求对齐
+ */
+struct FloatPack
+{
+    static const int SIZE = 4;
+
+#if defined(GVINS_FLOAT_PACK_SSE)
+    __m128 v;
+    static FloatPack load(const float *p) { FloatPack r; r.v = _mm_loadu_ps(p); return r; }
+    static FloatPack broadcast(float x) { FloatPack r; r.v = _mm_set1_ps(x); return r; }
+    void store(float *p) const { _mm_storeu_ps(p, v); }
+    friend FloatPack operator+(FloatPack a, FloatPack b) { a.v = _mm_add_ps(a.v, b.v); return a; }
+    friend FloatPack operator-(FloatPack a, FloatPack b) { a.v = _mm_sub_ps(a.v, b.v); return a; }
+    friend FloatPack operator*(FloatPack a, FloatPack b) { a.v = _mm_mul_ps(a.v, b.v); return a; }
+#elif defined(GVINS_FLOAT_PACK_NEON)
+    float32x4_t v;
+    static FloatPack load(const float *p) { FloatPack r; r.v = vld1q_f32(p); return r; }
+    static FloatPack broadcast(float x) { FloatPack r; r.v = vdupq_n_f32(x); return r; }
+    void store(float *p) const { vst1q_f32(p, v); }
+    friend FloatPack operator+(FloatPack a, FloatPack b) { a.v = vaddq_f32(a.v, b.v); return a; }
+    friend FloatPack operator-(FloatPack a, FloatPack b) { a.v = vsubq_f32(a.v, b.v); return a; }
+    friend FloatPack operator*(FloatPack a, FloatPack b) { a.v = vmulq_f32(a.v, b.v); return a; }
+#else
+    float v[SIZE];
+    static FloatPack load(const float *p) { FloatPack r; for (int i = 0; i < SIZE; ++i) r.v[i] = p[i]; return r; }
+    static FloatPack broadcast(float x) { FloatPack r; for (int i = 0; i < SIZE; ++i) r.v[i] = x; return r; }
+    void store(float *p) const { for (int i = 0; i < SIZE; ++i) p[i] = v[i]; }
+    friend FloatPack operator+(FloatPack a, FloatPack b) { for (int i = 0; i < SIZE; ++i) a.v[i] += b.v[i]; return a; }
+    friend FloatPack operator-(FloatPack a, FloatPack b) { for (int i = 0; i < SIZE; ++i) a.v[i] -= b.v[i]; return a; }
+    friend FloatPack operator*(FloatPack a, FloatPack b) { for (int i = 0; i < SIZE; ++i) a.v[i] *= b.v[i]; return a; }
+#endif
+};
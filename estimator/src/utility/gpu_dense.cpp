@@ -0,0 +1,221 @@
+#include "gpu_dense.h"
+
+#ifdef GVINS_CUDA_DENSE
+#include <mutex>
+#include <cublas_v2.h>
+#include <cuda_runtime_api.h>
+#include <cusolverDn.h>
+#endif
+
+#include <gvins_feature_tracker/log.h>
+
+#ifdef GVINS_CUDA_DENSE
+namespace
+{
+// device memory that only grows, as the image decoder's
+struct DeviceBuffer
+{
+    double *data = nullptr;
+    size_t size = 0;
+
+    bool reserve(size_t count)
+    {
+        if (count <= size)
+            return true;
+        cudaFree(data);
+        data = nullptr;
+        size = 0;
+        if (cudaMalloc(reinterpret_cast<void **>(&data), count * sizeof(double)) != cudaSuccess)
+            return false;
+        size = count;
+        return true;
+    }
+};
+
+struct Context
+{
+    bool ok = false;
+    std::mutex mutex;
+    cusolverDnHandle_t solver;
+    cublasHandle_t blas;
+    cudaStream_t stream;
+    DeviceBuffer a, b, c, work, vec;
+    int *info = nullptr;
+
+    Context()
+    {
+        int num_devices = 0;
+        if (cudaGetDeviceCount(&num_devices) != cudaSuccess || num_devices <= 0)
+            return;
+        if (cusolverDnCreate(&solver) != CUSOLVER_STATUS_SUCCESS)
+            return;
+        if (cublasCreate(&blas) != CUBLAS_STATUS_SUCCESS)
+        {
+            cusolverDnDestroy(solver);
+            return;
+        }
+        cudaStreamCreate(&stream);
+        cusolverDnSetStream(solver, stream);
+        cublasSetStream(blas, stream);
+        ok = cudaMalloc(reinterpret_cast<void **>(&info), sizeof(int)) == cudaSuccess;
+        GVINS_INFO("marginalization dense algebra on the GPU %s", ok ? "enabled" : "unavailable");
+    }
+
+    ~Context()
+    {
+        if (!ok)
+            return;
+        cudaFree(a.data);
+        cudaFree(b.data);
+        cudaFree(c.data);
+        cudaFree(work.data);
+        cudaFree(vec.data);
+        cudaFree(info);
+        cudaStreamDestroy(stream);
+        cublasDestroy(blas);
+        cusolverDnDestroy(solver);
+    }
+
+    bool upload(DeviceBuffer &buffer, const double *data, size_t count)
+    {
+        return buffer.reserve(count) &&
+               cudaMemcpyAsync(buffer.data, data, count * sizeof(double), cudaMemcpyHostToDevice, stream) == cudaSuccess;
+    }
+
+    bool download(double *data, const DeviceBuffer &buffer, size_t count)
+    {
+        return cudaMemcpyAsync(data, buffer.data, count * sizeof(double), cudaMemcpyDeviceToHost, stream) == cudaSuccess &&
+               cudaStreamSynchronize(stream) == cudaSuccess;
+    }
+
+    // lower Cholesky factor of the n x n matrix in a, in place; the pivots are checked as by stableLDLT
+    bool potrf(int n, double eps)
+    {
+        int lwork = 0;
+        if (cusolverDnDpotrf_bufferSize(solver, CUBLAS_FILL_MODE_LOWER, n, a.data, n, &lwork) != CUSOLVER_STATUS_SUCCESS ||
+            !work.reserve(lwork) || !vec.reserve(n))
+            return false;
+        if (cusolverDnDpotrf(solver, CUBLAS_FILL_MODE_LOWER, n, a.data, n, work.data, lwork, info) != CUSOLVER_STATUS_SUCCESS)
+            return false;
+        int host_info = 0;
+        if (cublasDcopy(blas, n, a.data, n + 1, vec.data, 1) != CUBLAS_STATUS_SUCCESS)
+            return false;
+        Eigen::VectorXd diag(n);
+        if (cudaMemcpyAsync(&host_info, info, sizeof(int), cudaMemcpyDeviceToHost, stream) != cudaSuccess ||
+            !download(diag.data(), vec, n) || host_info != 0)
+            return false;
+        const Eigen::VectorXd D = diag.cwiseAbs2();
+        return D.minCoeff() > eps && D.minCoeff() > 1e-12 * D.maxCoeff();
+    }
+};
+
+Context &context()
+{
+    static Context instance;
+    return instance;
+}
+}
+#endif
+
+namespace GpuDense
+{
+bool available()
+{
+#ifdef GVINS_CUDA_DENSE
+    return context().ok;
+#else
+    return false;
+#endif
+}
+
+bool schurComplement(const Eigen::MatrixXd &Amm, const Eigen::MatrixXd &Amr, const Eigen::MatrixXd &Arr,
+                     const Eigen::VectorXd &bmm, const Eigen::VectorXd &brr, double eps,
+                     Eigen::MatrixXd &A, Eigen::VectorXd &b)
+{
+#ifdef GVINS_CUDA_DENSE
+    Context &ctx = context();
+    if (!ctx.ok)
+        return false;
+    std::lock_guard<std::mutex> lock(ctx.mutex);
+    const int m = Amm.rows(), n = Arr.rows();
+    // [Amr bmm] and [Arr brr] side by side, the vector is solved along with the matrix
+    Eigen::MatrixXd B(m, n + 1), C(n, n + 1);
+    B << Amr, bmm;
+    C << Arr, brr;
+    if (!ctx.upload(ctx.a, Amm.data(), Amm.size()) || !ctx.potrf(m, eps))
+        return false;
+    if (!ctx.upload(ctx.b, B.data(), B.size()) || !ctx.upload(ctx.c, C.data(), C.size()))
+        return false;
+    // Y = L^-1 [Amr bmm], then [A b] = [Arr brr] - Y_r^T Y
+    const double one = 1.0, minus_one = -1.0;
+    if (cublasDtrsm(ctx.blas, CUBLAS_SIDE_LEFT, CUBLAS_FILL_MODE_LOWER, CUBLAS_OP_N, CUBLAS_DIAG_NON_UNIT,
+                    m, n + 1, &one, ctx.a.data, m, ctx.b.data, m) != CUBLAS_STATUS_SUCCESS ||
+        cublasDgemm(ctx.blas, CUBLAS_OP_T, CUBLAS_OP_N, n, n + 1, m, &minus_one, ctx.b.data, m, ctx.b.data, m,
+                    &one, ctx.c.data, n) != CUBLAS_STATUS_SUCCESS)
+        return false;
+    if (!ctx.download(C.data(), ctx.c, C.size()))
+        return false;
+    A = C.leftCols(n);
+    b = C.col(n);
+    return true;
+#else
+    (void)Amm; (void)Amr; (void)Arr; (void)bmm; (void)brr; (void)eps; (void)A; (void)b;
+    return false;
+#endif
+}
+
+bool factorPrior(const Eigen::MatrixXd &A, const Eigen::VectorXd &b, double eps, Eigen::MatrixXd &J, Eigen::VectorXd &r)
+{
+#ifdef GVINS_CUDA_DENSE
+    Context &ctx = context();
+    if (!ctx.ok)
+        return false;
+    std::lock_guard<std::mutex> lock(ctx.mutex);
+    const int n = A.rows();
+    if (!ctx.upload(ctx.a, A.data(), A.size()) || !ctx.potrf(n, eps) || !ctx.upload(ctx.b, b.data(), n))
+        return false;
+    if (cublasDtrsv(ctx.blas, CUBLAS_FILL_MODE_LOWER, CUBLAS_OP_N, CUBLAS_DIAG_NON_UNIT, n, ctx.a.data, n,
+                    ctx.b.data, 1) != CUBLAS_STATUS_SUCCESS)
+        return false;
+    Eigen::MatrixXd L(n, n);
+    r.resize(n);
+    if (!ctx.download(L.data(), ctx.a, L.size()) || !ctx.download(r.data(), ctx.b, n))
+        return false;
+    // potrf leaves the strict upper triangle untouched
+    J = L.triangularView<Eigen::Lower>().transpose();
+    return true;
+#else
+    (void)A; (void)b; (void)eps; (void)J; (void)r;
+    return false;
+#endif
+}
+
+bool symmetricEigen(const Eigen::MatrixXd &M, Eigen::VectorXd &values, Eigen::MatrixXd &vectors)
+{
+#ifdef GVINS_CUDA_DENSE
+    Context &ctx = context();
+    if (!ctx.ok)
+        return false;
+    std::lock_guard<std::mutex> lock(ctx.mutex);
+    const int n = M.rows();
+    int lwork = 0, host_info = 0;
+    if (!ctx.upload(ctx.a, M.data(), M.size()) || !ctx.vec.reserve(n) ||
+        cusolverDnDsyevd_bufferSize(ctx.solver, CUSOLVER_EIG_MODE_VECTOR, CUBLAS_FILL_MODE_LOWER, n, ctx.a.data, n,
+                                    ctx.vec.data, &lwork) != CUSOLVER_STATUS_SUCCESS ||
+        !ctx.work.reserve(lwork))
+        return false;
+    if (cusolverDnDsyevd(ctx.solver, CUSOLVER_EIG_MODE_VECTOR, CUBLAS_FILL_MODE_LOWER, n, ctx.a.data, n,
+                         ctx.vec.data, ctx.work.data, lwork, ctx.info) != CUSOLVER_STATUS_SUCCESS)
+        return false;
+    values.resize(n);
+    vectors.resize(n, n);
+    if (cudaMemcpyAsync(&host_info, ctx.info, sizeof(int), cudaMemcpyDeviceToHost, ctx.stream) != cudaSuccess ||
+        !ctx.download(values.data(), ctx.vec, n) || !ctx.download(vectors.data(), ctx.a, vectors.size()))
+        return false;
+    return host_info == 0;
+#else
+    (void)M; (void)values; (void)vectors;
+    return false;
+#endif
+}
+}
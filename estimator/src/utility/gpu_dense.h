@@ -0,0 +1,28 @@
+#pragma once
+
+#include <Eigen/Dense>
+
+/**
+ * 边缘化中随维数立方增长的稠密运算的 GPU 实现 (cuSOLVER/cuBLAS): Schur 补, 先验的分解和对称特征分解
+ * 以 GVINS_CUDA_DENSE 编译且有 CUDA 设备时可用, 否则 (及 GPU 计算失败或矩阵不正定时) 各函数返回 false,
+ * 调用者照常用 Eigen 在 CPU 上计算. 进程中只有一个 GPU 上下文, 各函数互斥执行 (边缘化可能在多个线程上进行)
+ * 传输的开销在小矩阵上高于计算, 是否调用 (MarginalizationInfo::gpu_min_size) 由调用者决定
+ */
+namespace GpuDense
+{
+bool available();
+
+/**
+ * A = Arr - Amr^T Amm^-1 Amr, b = brr - Amr^T Amm^-1 bmm by the Cholesky factor of Amm
+ * @return false if Amm is not positive definite, its pivots as in the LDLT check of the CPU path
+ */
+bool schurComplement(const Eigen::MatrixXd &Amm, const Eigen::MatrixXd &Amr, const Eigen::MatrixXd &Arr,
+                     const Eigen::VectorXd &bmm, const Eigen::VectorXd &brr, double eps,
+                     Eigen::MatrixXd &A, Eigen::VectorXd &b);
+
+// J^T J = A, J^T r = b with J = L^T of the Cholesky factor; false if A is not positive definite
+bool factorPrior(const Eigen::MatrixXd &A, const Eigen::VectorXd &b, double eps, Eigen::MatrixXd &J, Eigen::VectorXd &r);
+
+// eigenvalues in ascending order, as Eigen::SelfAdjointEigenSolver
+bool symmetricEigen(const Eigen::MatrixXd &M, Eigen::VectorXd &values, Eigen::MatrixXd &vectors);
+}
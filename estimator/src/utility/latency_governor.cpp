@@ -0,0 +1,59 @@
+#include "latency_governor.h"
+
+#include <algorithm>
+
+namespace
+{
+    // weight of the newest frame in the post-solve average
+    const double POST_SOLVE_SMOOTHING = 0.2;
+}
+
+LatencyGovernor::LatencyGovernor()
+    : target_ms(0), min_solver_ms(0), max_solver_ms(0), arrival_ms(0), post_solve_ms(0),
+      last_budget_ms(0), in_frame(false), solved(false)
+{
+}
+
+void LatencyGovernor::setTarget(double target, double min_solver, double max_solver)
+{
+    target_ms = target;
+    max_solver_ms = max_solver;
+    min_solver_ms = std::min(min_solver, max_solver);
+}
+
+void LatencyGovernor::beginFrame(double arrival)
+{
+    arrival_ms = std::max(arrival, 0.0);
+    in_frame = true;
+    solved = false;
+    t_frame.tic();
+}
+
+double LatencyGovernor::solverBudget()
+{
+    if (!enabled() || !in_frame)
+        last_budget_ms = max_solver_ms;
+    else
+    {
+        const double left = target_ms - arrival_ms - t_frame.toc() - post_solve_ms;
+        last_budget_ms = std::min(std::max(left, min_solver_ms), max_solver_ms);
+    }
+    return last_budget_ms;
+}
+
+void LatencyGovernor::endSolve()
+{
+    solved = true;
+    t_post_solve.tic();
+}
+
+void LatencyGovernor::endFrame()
+{
+    // frames without a solve (initialization) say nothing about the post-solve cost
+    if (in_frame && solved)
+    {
+        const double post = t_post_solve.toc();
+        post_solve_ms = (post_solve_ms == 0 ? post : (1 - POST_SOLVE_SMOOTHING) * post_solve_ms + POST_SOLVE_SMOOTHING * post);
+    }
+    in_frame = false;
+}
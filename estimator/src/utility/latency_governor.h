@@ -0,0 +1,37 @@
+#pragma once
+
+#include "tic_toc.h"
+
+/**
+ * 按端到端延迟目标分配每帧的求解时间:
+ *   预算 = 目标 - (图像时间戳到取出该帧的延迟, 即跟踪和传输) - 本帧求解前已用时间 (预积分/GNSS/特征管理/等待边缘化)
+ *          - 求解之后的预计用时 (边缘化/滑窗/发布, 取前几帧的滑动平均)
+ * 预算限制在 [min_solver_ms, max_solver_ms]; target_ms 为 0 时不启用, 总是返回 max_solver_ms
+ * beginFrame/solverBudget/endSolve/endFrame 都在估计线程中按顺序调用
+ */
+class LatencyGovernor
+{
+  public:
+    LatencyGovernor();
+
+    void setTarget(double target_ms, double min_solver_ms, double max_solver_ms);
+    bool enabled() const { return target_ms > 0; }
+
+    // arrival_ms: time from the image stamp until the frame was taken off the queue
+    void beginFrame(double arrival_ms);
+    // ms left for ceres::Solve in this frame
+    double solverBudget();
+    void endSolve();
+    void endFrame();
+
+    double lastBudget() const { return last_budget_ms; }
+    double expectedPostSolve() const { return post_solve_ms; }
+
+  private:
+    double target_ms, min_solver_ms, max_solver_ms;
+    double arrival_ms;
+    double post_solve_ms;       // moving average of endSolve -> endFrame
+    double last_budget_ms;
+    bool in_frame, solved;
+    TicToc t_frame, t_post_solve;
+};
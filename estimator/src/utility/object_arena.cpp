@@ -0,0 +1,115 @@
+#include "object_arena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+
+namespace
+{
+    // a frame of the 10-frame window needs a few of these
+    const size_t CHUNK_SIZE = 64 * 1024;
+    // free chunks kept for other arenas, the rest goes back to the heap
+    const size_t MAX_CACHED_CHUNKS = 64;
+
+    struct FreeChunks
+    {
+        std::mutex m_chunks;
+        std::vector<std::pair<char *, size_t>> chunks;
+    };
+
+    // never destroyed, arenas of static objects may release their chunks after main returns
+    FreeChunks &freeChunks()
+    {
+        static FreeChunks *free_chunks = new FreeChunks();
+        return *free_chunks;
+    }
+}
+
+ObjectArena::ObjectArena() : curr_chunk(0), curr_offset(0), num_objects(0)
+{
+}
+
+ObjectArena::~ObjectArena()
+{
+    reset();
+    for (const Chunk &chunk : chunks)
+        releaseChunk(chunk);
+}
+
+void ObjectArena::reset()
+{
+    for (auto it = destructors.rbegin(); it != destructors.rend(); ++it)
+        it->first(it->second);
+    destructors.clear();
+    curr_chunk = 0;
+    curr_offset = 0;
+    num_objects = 0;
+}
+
+size_t ObjectArena::capacity() const
+{
+    size_t total = 0;
+    for (const Chunk &chunk : chunks)
+        total += chunk.size;
+    return total;
+}
+
+void *ObjectArena::allocate(size_t size, size_t align)
+{
+    ++num_objects;
+    // first chunk from the current one on with room for the aligned object
+    for (; curr_chunk < chunks.size(); ++curr_chunk, curr_offset = 0)
+    {
+        const Chunk &chunk = chunks[curr_chunk];
+        const uintptr_t base = reinterpret_cast<uintptr_t>(chunk.data);
+        const size_t offset = ((base + curr_offset + align - 1) & ~(uintptr_t)(align - 1)) - base;
+        if (offset + size <= chunk.size)
+        {
+            curr_offset = offset + size;
+            return chunk.data + offset;
+        }
+    }
+    chunks.push_back(acquireChunk(size + align));
+    const Chunk &chunk = chunks.back();
+    const uintptr_t base = reinterpret_cast<uintptr_t>(chunk.data);
+    const size_t offset = ((base + align - 1) & ~(uintptr_t)(align - 1)) - base;
+    curr_offset = offset + size;
+    return chunk.data + offset;
+}
+
+ObjectArena::Chunk ObjectArena::acquireChunk(size_t min_size)
+{
+    FreeChunks &free_chunks = freeChunks();
+    {
+        std::lock_guard<std::mutex> lk(free_chunks.m_chunks);
+        for (auto it = free_chunks.chunks.begin(); it != free_chunks.chunks.end(); ++it)
+        {
+            if (it->second >= min_size)
+            {
+                Chunk chunk{it->first, it->second};
+                free_chunks.chunks.erase(it);
+                return chunk;
+            }
+        }
+    }
+    const size_t size = std::max(CHUNK_SIZE, min_size);
+    char *data = static_cast<char *>(std::malloc(size));
+    if (!data)
+        throw std::bad_alloc();
+    return Chunk{data, size};
+}
+
+void ObjectArena::releaseChunk(const Chunk &chunk)
+{
+    FreeChunks &free_chunks = freeChunks();
+    {
+        std::lock_guard<std::mutex> lk(free_chunks.m_chunks);
+        if (free_chunks.chunks.size() < MAX_CACHED_CHUNKS)
+        {
+            free_chunks.chunks.emplace_back(chunk.data, chunk.size);
+            return;
+        }
+    }
+    std::free(chunk.data);
+}
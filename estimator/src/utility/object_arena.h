@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * 每帧的因子/损失函数/局部参数化等小对象的分配区: create 在大块内存上顺序 placement new, reset 逆序调用析构后
+ * 整体回收, 块保留给下一帧复用; 析构时块归还进程内的空闲块缓存, 由下一个分配区取用, 不再交还给堆
+ * 对象不能单独 delete, 传给 ceres 时 Problem 需设置 DO_NOT_TAKE_OWNERSHIP
+ * 非线程安全, 同一时刻只能由一个线程 create/reset
+ */
+class ObjectArena
+{
+  public:
+    ObjectArena();
+    ~ObjectArena();
+
+    template <typename T, typename... Args>
+    T *create(Args &&... args)
+    {
+        T *object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value)
+            destructors.emplace_back(&ObjectArena::destroy<T>, object);
+        return object;
+    }
+
+    // uninitialized storage for n trivially destructible values, released with the other objects
+    template <typename T>
+    T *createArray(size_t n)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "array elements are never destroyed");
+        return static_cast<T *>(allocate(sizeof(T) * n, alignof(T)));
+    }
+
+    // destroys every object, the memory is kept for the next frame
+    void reset();
+
+    size_t numObjects() const { return num_objects; }
+    size_t capacity() const;
+
+  private:
+    ObjectArena(const ObjectArena&) = delete;
+    ObjectArena& operator=(const ObjectArena&) = delete;
+
+    struct Chunk
+    {
+        char *data;
+        size_t size;
+    };
+
+    void *allocate(size_t size, size_t align);
+    template <typename T>
+    static void destroy(void *object)
+    {
+        static_cast<T *>(object)->~T();
+    }
+    static Chunk acquireChunk(size_t min_size);
+    static void releaseChunk(const Chunk &chunk);
+
+    std::vector<Chunk> chunks;
+    size_t curr_chunk, curr_offset;
+    size_t num_objects;
+    std::vector<std::pair<void (*)(void *), void *>> destructors;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/**
+ * 单线程流水级: submit 把一个任务交给常驻线程后立即返回, wait 是下一级依赖它的结果之前的屏障
+ * 同一时刻最多一个任务在执行, submit 前会先等上一个任务完成, 任务按提交顺序执行
+ * submit/wait 只能由同一个 (上游) 线程调用
+ */
+class PipelineStage
+{
+  public:
+    PipelineStage() : busy(false), stop(false)
+    {
+        worker = std::thread(&PipelineStage::run, this);
+    }
+
+    ~PipelineStage()
+    {
+        {
+            std::lock_guard<std::mutex> lk(m_stage);
+            stop = true;
+        }
+        con.notify_all();
+        worker.join();
+    }
+
+    void submit(std::function<void()> job)
+    {
+        std::unique_lock<std::mutex> lk(m_stage);
+        con.wait(lk, [&]{return !busy;});
+        pending = std::move(job);
+        busy = true;
+        con.notify_all();
+    }
+
+    // returns once the submitted job, if any, has finished
+    void wait()
+    {
+        std::unique_lock<std::mutex> lk(m_stage);
+        con.wait(lk, [&]{return !busy;});
+    }
+
+    // true if no job is queued or running, never blocks on the job
+    bool idle()
+    {
+        std::lock_guard<std::mutex> lk(m_stage);
+        return !busy;
+    }
+
+  private:
+    PipelineStage(const PipelineStage&) = delete;
+    PipelineStage& operator=(const PipelineStage&) = delete;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lk(m_stage);
+        while (true)
+        {
+            con.wait(lk, [&]{return busy || stop;});
+            if (!busy)
+                return;
+            std::function<void()> job = std::move(pending);
+            lk.unlock();
+            job();
+            lk.lock();
+            busy = false;
+            con.notify_all();
+        }
+    }
+
+    std::mutex m_stage;
+    std::condition_variable con;
+    std::function<void()> pending;
+    bool busy;
+    bool stop;
+    std::thread worker;
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+/**
+ * 结果文件的二进制格式 (version 1), 只追加写入, 不依赖 ROS, 供估计器和 gvins_result_to_csv 共用
+ *   FileHeader | ColumnName * (num_stamps + num_values) | Record * N
+ * 每个文件只有一种流, 记录定长 (record_size 字节): int64 时间戳 (ns) 在前, double 数值在后, 本机字节序 (小端),
+ * 因此 mmap 后第 i 条记录位于 header_size + i * record_size; 异常退出时末尾不完整的记录由读端丢弃
+ * 列的顺序和含义见 layout(), 新增列只能追加在末尾并提高 VERSION
+ */
+namespace result_format
+{
+
+const char MAGIC[8] = {'G', 'V', 'I', 'N', 'S', 'L', 'O', 'G'};
+const uint32_t VERSION = 1;
+const int COLUMN_NAME_SIZE = 24;
+const int MAX_COLUMNS = 24;
+
+enum StreamId
+{
+    TRAJECTORY = 1,     // vins_result_no_loop
+    GNSS = 2,           // gnss_result
+    SOLVER = 3          // factor_graph_result, per-frame solver statistics
+};
+
+#pragma pack(push, 1)
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t stream;
+    uint32_t header_size;       // offset of the first record
+    uint32_t record_size;
+    uint16_t num_stamps;
+    uint16_t num_values;
+    uint16_t num_csv_values;    // leading values written by the CSV form
+    uint8_t csv_trailing_separator;
+    uint8_t reserved[9];
+};
+#pragma pack(pop)
+static_assert(sizeof(FileHeader) == 40, "result file header must stay 40 bytes");
+
+struct StreamLayout
+{
+    StreamId id;
+    int num_stamps;
+    int num_values;
+    int num_csv_values;
+    bool csv_trailing_separator;    // the historic vins_result lines end with ','
+    const char *const *columns;
+};
+
+inline const StreamLayout &layout(StreamId id)
+{
+    static const char *const trajectory_columns[] = {"stamp_ns",
+        "p_x", "p_y", "p_z", "q_w", "q_x", "q_y", "q_z", "v_x", "v_y", "v_z",
+        "ba_x", "ba_y", "ba_z", "bg_x", "bg_y", "bg_z"};
+    static const char *const gnss_columns[] = {"stamp_ns", "gnss_stamp_ns",
+        "ecef_x", "ecef_y", "ecef_z", "yaw_enu_local",
+        "rcv_dt_gps", "rcv_dt_glo", "rcv_dt_gal", "rcv_dt_bds", "rcv_ddt",
+        "anc_ecef_x", "anc_ecef_y", "anc_ecef_z"};
+    static const char *const solver_columns[] = {"stamp_ns",
+        "frame_ms", "solver_ms", "marginalization_ms", "iterations", "initial_cost", "final_cost",
+        "residual_blocks", "parameter_blocks", "features", "keyframe"};
+    static const StreamLayout layouts[] = {
+        {TRAJECTORY, 1, 16, 10, true, trajectory_columns},
+        {GNSS, 2, 12, 12, false, gnss_columns},
+        {SOLVER, 1, 10, 10, false, solver_columns}};
+    return layouts[id - TRAJECTORY];
+}
+
+inline int recordSize(const StreamLayout &l)
+{
+    return static_cast<int>(sizeof(int64_t) * l.num_stamps + sizeof(double) * l.num_values);
+}
+
+inline int headerSize(const StreamLayout &l)
+{
+    return static_cast<int>(sizeof(FileHeader)) + COLUMN_NAME_SIZE * (l.num_stamps + l.num_values);
+}
+
+// file header and column names
+inline std::string makeHeader(const StreamLayout &l)
+{
+    FileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version = VERSION;
+    h.stream = l.id;
+    h.header_size = headerSize(l);
+    h.record_size = recordSize(l);
+    h.num_stamps = l.num_stamps;
+    h.num_values = l.num_values;
+    h.num_csv_values = l.num_csv_values;
+    h.csv_trailing_separator = l.csv_trailing_separator;
+    std::string out(reinterpret_cast<const char *>(&h), sizeof(h));
+    for (int k = 0; k < l.num_stamps + l.num_values; ++k)
+    {
+        char name[COLUMN_NAME_SIZE] = {0};
+        strncpy(name, l.columns[k], COLUMN_NAME_SIZE - 1);
+        out.append(name, COLUMN_NAME_SIZE);
+    }
+    return out;
+}
+
+inline int64_t toNs(double stamp_ns)
+{
+    return static_cast<int64_t>(std::llround(stamp_ns));
+}
+
+inline void appendRecord(const StreamLayout &l, const int64_t *stamps, const double *values, std::string &out)
+{
+    out.append(reinterpret_cast<const char *>(stamps), sizeof(int64_t) * l.num_stamps);
+    out.append(reinterpret_cast<const char *>(values), sizeof(double) * l.num_values);
+}
+
+// one line of the historic CSV: stamps without decimals, values with 5 decimals
+inline void appendCsv(const StreamLayout &l, const int64_t *stamps, const double *values, std::string &out)
+{
+    char field[64];
+    const int num_columns = l.num_stamps + l.num_csv_values;
+    for (int k = 0; k < num_columns; ++k)
+    {
+        int len = (k < l.num_stamps ? snprintf(field, sizeof(field), "%lld", static_cast<long long>(stamps[k]))
+                                    : snprintf(field, sizeof(field), "%.5f", values[k - l.num_stamps]));
+        out.append(field, len < static_cast<int>(sizeof(field)) ? len : sizeof(field) - 1);
+        if (k + 1 < num_columns || l.csv_trailing_separator)
+            out.push_back(',');
+    }
+    out.push_back('\n');
+}
+
+}
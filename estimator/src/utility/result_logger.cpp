@@ -0,0 +1,122 @@
+#include "result_logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include <ros/ros.h>
+
+namespace
+{
+    // records kept per stream, ~7 min of 10 Hz results before anything is dropped
+    const size_t QUEUE_CAPACITY = 4096;
+    // batches are written at most this often
+    const std::chrono::milliseconds FLUSH_PERIOD(50);
+}
+
+ResultLogger &ResultLogger::instance()
+{
+    static ResultLogger logger;
+    return logger;
+}
+
+ResultLogger::ResultLogger()
+    : vins_queue(QUEUE_CAPACITY), gnss_queue(QUEUE_CAPACITY), factor_graph_queue(QUEUE_CAPACITY),
+      queues{&vins_queue, &gnss_queue, &factor_graph_queue}, running(false)
+{
+    for (int i = 0; i < NUM_STREAMS; ++i)
+    {
+        outputs[i].file = nullptr;
+        outputs[i].binary = false;
+    }
+}
+
+ResultLogger::~ResultLogger()
+{
+    close();
+}
+
+void ResultLogger::open(Stream stream, const std::string &path, bool binary)
+{
+    std::lock_guard<std::mutex> lk(m_files);
+    Output &out = outputs[stream];
+    if (out.file)
+        fclose(out.file);
+    out.file = fopen(path.c_str(), "wb");
+    if (!out.file)
+        ROS_ERROR("cannot open result file %s", path.c_str());
+    out.binary = binary;
+    out.buffer.reserve(1 << 16);
+    if (out.file && binary)
+    {
+        const std::string header = result_format::makeHeader(layout(stream));
+        fwrite(header.data(), 1, header.size(), out.file);
+        fflush(out.file);
+    }
+    if (!running.exchange(true))
+        writer = std::thread(&ResultLogger::run, this);
+}
+
+void ResultLogger::close()
+{
+    if (running.exchange(false))
+        writer.join();
+    std::lock_guard<std::mutex> lk(m_files);
+    drain();
+    for (int i = 0; i < NUM_STREAMS; ++i)
+    {
+        if (outputs[i].file)
+            fclose(outputs[i].file);
+        outputs[i].file = nullptr;
+    }
+}
+
+bool ResultLogger::log(Stream stream, const double *stamps_ns, const double *values)
+{
+    const result_format::StreamLayout &l = layout(stream);
+    Record r;
+    for (int k = 0; k < l.num_stamps; ++k)
+        r.stamps[k] = result_format::toNs(stamps_ns[k]);
+    std::copy(values, values + l.num_values, r.values);
+    if (!queues[stream]->push(r))
+    {
+        ROS_WARN_THROTTLE(1.0, "result logger stream %d full, %zu records dropped", stream, queues[stream]->overflows());
+        return false;
+    }
+    return true;
+}
+
+void ResultLogger::run()
+{
+    while (running)
+    {
+        std::this_thread::sleep_for(FLUSH_PERIOD);
+        std::lock_guard<std::mutex> lk(m_files);
+        drain();
+    }
+}
+
+void ResultLogger::drain()
+{
+    for (int i = 0; i < NUM_STREAMS; ++i)
+    {
+        Output &out = outputs[i];
+        SpscQueue<Record> &q = *queues[i];
+        const result_format::StreamLayout &l = layout(i);
+        out.buffer.clear();
+        while (!q.empty())
+        {
+            const Record &r = q.front();
+            if (out.binary)
+                result_format::appendRecord(l, r.stamps, r.values, out.buffer);
+            else
+                result_format::appendCsv(l, r.stamps, r.values, out.buffer);
+            q.pop();
+        }
+        if (out.file && !out.buffer.empty())
+        {
+            fwrite(out.buffer.data(), 1, out.buffer.size(), out.file);
+            fflush(out.file);
+        }
+    }
+}
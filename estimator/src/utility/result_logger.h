@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "spsc_queue.h"
+#include "result_format.h"
+
+/**
+ * 结果文件的异步写入: 每个输出流一个预分配的 SpscQueue<Record>, log() 只复制一条定长记录, 不做格式化和 IO;
+ * 后台线程每 FLUSH_PERIOD 把所有队列取空, 在线程内格式化后一次 fwrite, 存储的延迟尖峰不再进入估计线程
+ * 文本输出与原来 ofstream 的 CSV 一致; binary 为 true 时写 result_format.h 中带版本号的定长记录
+ * 每个流只能有一个调用 log() 的线程
+ */
+class ResultLogger
+{
+  public:
+    // column layouts are result_format::layout(TRAJECTORY/GNSS/SOLVER)
+    enum Stream
+    {
+        VINS_RESULT = 0,
+        GNSS_RESULT = 1,
+        FACTOR_GRAPH = 2,
+        NUM_STREAMS
+    };
+
+    struct Record
+    {
+        int64_t stamps[2];
+        double values[result_format::MAX_COLUMNS];
+    };
+
+    static ResultLogger &instance();
+    ~ResultLogger();
+
+    // truncates path, a binary file starts with the result_format header
+    void open(Stream stream, const std::string &path, bool binary);
+    // writes everything still queued and closes all streams
+    void close();
+
+    // stamps in ns, as many stamps and values as the layout of the stream has
+    bool log(Stream stream, const double *stamps_ns, const double *values);
+    size_t dropped(Stream stream) const { return queues[stream]->overflows(); }
+
+  private:
+    ResultLogger();
+    ResultLogger(const ResultLogger&) = delete;
+    ResultLogger& operator=(const ResultLogger&) = delete;
+
+    void run();
+    void drain();
+    static const result_format::StreamLayout &layout(int stream)
+    {
+        return result_format::layout(static_cast<result_format::StreamId>(result_format::TRAJECTORY + stream));
+    }
+
+    struct Output
+    {
+        FILE *file;
+        bool binary;
+        std::string buffer;     // one batch, reused
+    };
+
+    // by value: the queues are cache line aligned, which new does not honour before C++17
+    SpscQueue<Record> vins_queue, gnss_queue, factor_graph_queue;
+    SpscQueue<Record> *const queues[NUM_STREAMS];
+    Output outputs[NUM_STREAMS];
+    std::mutex m_files;         // open/close against the writer thread
+    std::atomic<bool> running;
+    std::thread writer;
+};
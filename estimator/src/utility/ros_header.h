@@ -0,0 +1,22 @@
+#pragma once
+
+#include <std_msgs/Header.h>
+#include "timestamp.h"
+
+// 节点一侧: 核心库的 FrameHeader 与 std_msgs::Header 互相转换, 时间戳不经过 double
+
+inline FrameHeader fromRosHeader(const std_msgs::Header &header)
+{
+    FrameHeader frame_header;
+    frame_header.stamp = Timestamp(header.stamp.sec, header.stamp.nsec);
+    frame_header.frame_id = header.frame_id;
+    return frame_header;
+}
+
+inline std_msgs::Header toRosHeader(const FrameHeader &frame_header)
+{
+    std_msgs::Header header;
+    header.stamp = ros::Time(frame_header.stamp.sec, frame_header.stamp.nsec);
+    header.frame_id = frame_header.frame_id;
+    return header;
+}
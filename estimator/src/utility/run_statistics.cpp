@@ -0,0 +1,147 @@
+#include "run_statistics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <sys/resource.h>
+#include <eigen3/Eigen/Geometry>
+
+namespace
+{
+    // nearest rank on sorted samples
+    double percentile(const std::vector<double> &sorted, double p)
+    {
+        const size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+        return sorted[std::min(std::max(rank, static_cast<size_t>(1)), sorted.size()) - 1];
+    }
+
+    bool readGroundTruth(const std::string &path, std::vector<std::pair<double, Eigen::Vector3d>> &poses)
+    {
+        std::ifstream file(path);
+        if (!file)
+            return false;
+        std::string line;
+        while (std::getline(file, line))
+        {
+            std::replace(line.begin(), line.end(), ',', ' ');
+            std::istringstream fields(line);
+            double t;
+            Eigen::Vector3d p;
+            if (!(fields >> t >> p.x() >> p.y() >> p.z()))
+                continue;
+            poses.emplace_back(t > 1e12 ? t * 1e-9 : t, p);
+        }
+        std::sort(poses.begin(), poses.end(),
+                  [](const std::pair<double, Eigen::Vector3d> &a, const std::pair<double, Eigen::Vector3d> &b)
+                  { return a.first < b.first; });
+        return true;
+    }
+}
+
+SampleSeries::Summary SampleSeries::summarize() const
+{
+    Summary s;
+    s.count = samples.size();
+    s.mean = s.p50 = s.p90 = s.p99 = s.max = s.total = 0;
+    if (samples.empty())
+        return s;
+    std::vector<double> sorted(samples);
+    std::sort(sorted.begin(), sorted.end());
+    for (double v : sorted)
+        s.total += v;
+    s.mean = s.total / s.count;
+    s.p50 = percentile(sorted, 0.5);
+    s.p90 = percentile(sorted, 0.9);
+    s.p99 = percentile(sorted, 0.99);
+    s.max = sorted.back();
+    return s;
+}
+
+TrajectoryError compareTrajectory(const std::vector<std::pair<double, Eigen::Vector3d>> &estimated,
+                                  const std::string &ground_truth_file, double max_gap_s)
+{
+    TrajectoryError error;
+    error.num_matched = 0;
+    error.rmse = error.mean = error.max = 0;
+
+    std::vector<std::pair<double, Eigen::Vector3d>> truth;
+    if (!readGroundTruth(ground_truth_file, truth) || truth.size() < 2)
+        return error;
+
+    std::vector<Eigen::Vector3d> est_matched, truth_matched;
+    for (const auto &est : estimated)
+    {
+        auto upper = std::lower_bound(truth.begin(), truth.end(), est.first,
+                                      [](const std::pair<double, Eigen::Vector3d> &gt, double t) { return gt.first < t; });
+        if (upper == truth.begin() || upper == truth.end())
+            continue;
+        auto lower = upper - 1;
+        const double gap = upper->first - lower->first;
+        if (gap <= 0 || gap > max_gap_s)
+            continue;
+        const double ratio = (est.first - lower->first) / gap;
+        est_matched.push_back(est.second);
+        truth_matched.push_back((1.0 - ratio) * lower->second + ratio * upper->second);
+    }
+    // the rigid alignment needs at least three points
+    if (est_matched.size() < 3)
+        return error;
+
+    Eigen::Matrix3Xd src(3, est_matched.size()), dst(3, truth_matched.size());
+    for (size_t i = 0; i < est_matched.size(); ++i)
+    {
+        src.col(i) = est_matched[i];
+        dst.col(i) = truth_matched[i];
+    }
+    // centred first, ECEF ground truth would cost the alignment most of its precision otherwise
+    const Eigen::Vector3d src_mean = src.rowwise().mean(), dst_mean = dst.rowwise().mean();
+    src.colwise() -= src_mean;
+    dst.colwise() -= dst_mean;
+    const Eigen::Matrix4d T = Eigen::umeyama(src, dst, false);
+    const Eigen::Matrix3Xd residual = (T.topLeftCorner<3, 3>() * src).colwise() + T.topRightCorner<3, 1>() - dst;
+
+    double sum_sq = 0, sum = 0;
+    for (int i = 0; i < residual.cols(); ++i)
+    {
+        const double e = residual.col(i).norm();
+        sum_sq += e * e;
+        sum += e;
+        error.max = std::max(error.max, e);
+    }
+    error.num_matched = residual.cols();
+    error.rmse = std::sqrt(sum_sq / error.num_matched);
+    error.mean = sum / error.num_matched;
+    return error;
+}
+
+void writeJsonSummary(FILE *file, const char *name, const SampleSeries &series)
+{
+    const SampleSeries::Summary s = series.summarize();
+    fprintf(file, "\"%s\": {\"count\": %zu, \"mean\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, "
+                  "\"max\": %.4f, \"total\": %.3f}",
+            name, s.count, s.mean, s.p50, s.p90, s.p99, s.max, s.total);
+}
+
+std::string jsonEscape(const std::string &text)
+{
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            escaped.push_back('\\');
+        if (static_cast<unsigned char>(c) >= 0x20)
+            escaped.push_back(c);
+    }
+    return escaped;
+}
+
+long peakRssKb()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+    return usage.ru_maxrss;     // kB on Linux
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+#include <eigen3/Eigen/Dense>
+
+/**
+ * 离线运行的统计 (gvins_offline --stats): 各处理阶段每次的耗时分布, 轨迹相对真值的精度, 以 JSON 输出,
+ * gvins_benchmark_suite 汇总多个数据集的结果后用于不同提交之间的比较
+ */
+class SampleSeries
+{
+  public:
+    struct Summary
+    {
+        size_t count;
+        double mean, p50, p90, p99, max, total;
+    };
+
+    void add(double value) { samples.push_back(value); }
+    size_t size() const { return samples.size(); }
+    Summary summarize() const;
+
+  private:
+    std::vector<double> samples;
+};
+
+struct TrajectoryError
+{
+    size_t num_matched;     // estimated positions with a ground truth sample, 0 if none could be compared
+    double rmse, mean, max; // m, after the rigid alignment of the matched positions
+};
+
+/**
+ * 估计的位置与真值比较 (ATE): 真值按时间线性插值到估计的时间戳, 两者做一次刚体对齐 (无尺度) 后统计误差;
+ * 真值文件每行 "t, x, y, z, ...", 逗号或空格分隔, 时间与 bag 时间戳同一时钟 (s, 大于 1e12 时按 ns),
+ * 无法解析的行 (表头) 被跳过; 估计与真值的坐标系可以不同
+ *
+ * @param max_gap_s 用于插值的两个真值样本最多相隔的时间, 否则这个估计不参与比较
+ */
+TrajectoryError compareTrajectory(const std::vector<std::pair<double, Eigen::Vector3d>> &estimated,
+                                  const std::string &ground_truth_file, double max_gap_s);
+
+// "name": {"count": .., "mean": .., ...}, the values in ms are printed as they are
+void writeJsonSummary(FILE *file, const char *name, const SampleSeries &series);
+std::string jsonEscape(const std::string &text);
+// peak resident set size of this process
+long peakRssKb();
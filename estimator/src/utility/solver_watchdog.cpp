@@ -0,0 +1,79 @@
+#include "solver_watchdog.h"
+
+#include <cmath>
+
+const char *const SolverWatchdog::REASON_NAMES[NUM_REASONS] = {
+    "none", "diverged_cost", "diverged_state", "rejected_steps", "budget"};
+
+SolverWatchdog::SolverWatchdog()
+    : divergence_ratio(0), max_velocity(0), speed_bias(nullptr), budget_s(0), initial_cost(0),
+      rejected_steps(0), reason(NONE)
+{
+    for (int i = 0; i < NUM_REASONS; i++)
+        counts[i] = 0;
+}
+
+void SolverWatchdog::setLimits(double _divergence_ratio, double _max_velocity)
+{
+    divergence_ratio = _divergence_ratio;
+    max_velocity = _max_velocity;
+}
+
+void SolverWatchdog::begin(const double (*_speed_bias)[SIZE_SPEEDBIAS], double _budget_s)
+{
+    speed_bias = _speed_bias;
+    budget_s = _budget_s;
+    initial_cost = 0;
+    rejected_steps = 0;
+    reason = NONE;
+}
+
+ceres::CallbackReturnType SolverWatchdog::operator()(const ceres::IterationSummary &summary)
+{
+    // iteration 0 only evaluates the initial state
+    if (summary.iteration == 0)
+    {
+        initial_cost = summary.cost;
+        return ceres::SOLVER_CONTINUE;
+    }
+    if (!std::isfinite(summary.cost) || !std::isfinite(summary.step_norm) ||
+        (divergence_ratio > 0 && summary.cost > divergence_ratio * initial_cost))
+        return stop(DIVERGED_COST);
+
+    if (summary.step_is_successful)
+    {
+        rejected_steps = 0;
+        if (stateDiverged())
+            return stop(DIVERGED_STATE);
+    }
+    else if (++rejected_steps >= MAX_REJECTED_STEPS)
+        return stop(REJECTED_STEPS);
+
+    // ceres checks max_solver_time_in_seconds only after an iteration, the next one would overrun it
+    if (budget_s > 0 && summary.cumulative_time_in_seconds + summary.iteration_time_in_seconds > budget_s)
+        return stop(BUDGET);
+    return ceres::SOLVER_CONTINUE;
+}
+
+ceres::CallbackReturnType SolverWatchdog::stop(Reason r)
+{
+    reason = r;
+    counts[r]++;
+    return diverged() ? ceres::SOLVER_ABORT : ceres::SOLVER_TERMINATE_SUCCESSFULLY;
+}
+
+// the limits of failureDetection, checked on every frame of the window
+bool SolverWatchdog::stateDiverged() const
+{
+    if (!speed_bias)
+        return false;
+    for (int i = 0; i <= WINDOW_SIZE; i++)
+    {
+        const Eigen::Map<const Eigen::Vector3d> V(speed_bias[i]), Ba(speed_bias[i] + 3), Bg(speed_bias[i] + 6);
+        // written so that NaN counts as diverged
+        if (!V.allFinite() || (max_velocity > 0 && V.norm() > max_velocity) ||
+            !(Ba.norm() <= MAX_ACC_BIAS) || !(Bg.norm() <= MAX_GYR_BIAS))
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+
+#include <ceres/ceres.h>
+
+#include "../parameters.h"
+
+/**
+ * ceres::Solve 的迭代回调: 每次迭代后检查代价, 步长, 窗口各帧的速度/零偏和剩余的求解预算
+ *   发散 (代价或步长不是有限值, 代价超过初始代价的 divergence_ratio 倍, 速度/零偏超出界限): 中止求解,
+ *   diverged() 为真, 发散的状态不写回也不边缘化, 由 failureDetection 交给失败处理 (恢复检查点或重启)
+ *   浪费预算 (连续 MAX_REJECTED_STEPS 次步长被拒绝, 或下一次迭代按本次的用时会超出预算): 提前结束, 保留当前的解
+ * 检查速度/零偏需要 update_state_every_iteration, 每次迭代后 para_* 即为当前的解: 中止时 para_* 已是发散的迭代,
+ * 调用者须把它们恢复为求解之前的值 (Estimator::restoreDivergedSolve)
+ */
+class SolverWatchdog : public ceres::IterationCallback
+{
+  public:
+    enum Reason
+    {
+        NONE = 0,
+        DIVERGED_COST,
+        DIVERGED_STATE,
+        REJECTED_STEPS,
+        BUDGET,
+        NUM_REASONS
+    };
+    static const char *const REASON_NAMES[NUM_REASONS];
+
+    SolverWatchdog();
+
+    void setLimits(double _divergence_ratio, double _max_velocity);
+    // before ceres::Solve; speed_bias is para_SpeedBias of the window
+    void begin(const double (*_speed_bias)[SIZE_SPEEDBIAS], double _budget_s);
+    // forgets the reason of the last solve, the counts are kept
+    void reset() { reason = NONE; }
+
+    ceres::CallbackReturnType operator()(const ceres::IterationSummary &summary) override;
+
+    Reason lastReason() const { return reason; }
+    bool diverged() const { return reason == DIVERGED_COST || reason == DIVERGED_STATE; }
+    // solves stopped for the reason since the start
+    uint64_t count(Reason r) const { return counts[r]; }
+
+  private:
+    static const int MAX_REJECTED_STEPS = 4;
+
+    ceres::CallbackReturnType stop(Reason r);
+    bool stateDiverged() const;
+
+    double divergence_ratio, max_velocity;
+
+    const double (*speed_bias)[SIZE_SPEEDBIAS];
+    double budget_s;
+    double initial_cost;
+    int rejected_steps;
+    Reason reason;
+    uint64_t counts[NUM_REASONS];
+};
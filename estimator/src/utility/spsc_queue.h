@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+/**
+ * 有界无锁单生产者/单消费者环形队列, 每个传感器数据流一个
+ * push 只能在生产者线程 (该话题的 ROS 回调) 调用, 其余接口只能在消费者线程 (process) 调用
+ * 队列满时丢弃新数据并累加 overflows(), 不阻塞回调线程
+ */
+template <typename T>
+class SpscQueue
+{
+  public:
+    // capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity) : head(0), tail(0), num_overflows(0)
+    {
+        size_t n = 1;
+        while (n < capacity)
+            n <<= 1;
+        slots.resize(n);
+        mask = n - 1;
+    }
+
+    // producer
+    bool push(T value)
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == slots.size())
+        {
+            num_overflows.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slots[t & mask] = std::move(value);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer
+    bool empty() const { return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire); }
+    size_t size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_relaxed); }
+    // i-th element from the front, i < size()
+    const T &at(size_t i) const { return slots[(head.load(std::memory_order_relaxed) + i) & mask]; }
+    const T &front() const { return at(0); }
+    const T &back() const { return slots[(tail.load(std::memory_order_acquire) - 1) & mask]; }
+    void pop()
+    {
+        const size_t h = head.load(std::memory_order_relaxed);
+        slots[h & mask] = T();      // release the payload before the slot is reused
+        head.store(h + 1, std::memory_order_release);
+    }
+    void clear()
+    {
+        while (!empty())
+            pop();
+    }
+
+    // any thread
+    size_t capacity() const { return slots.size(); }
+    size_t overflows() const { return num_overflows.load(std::memory_order_relaxed); }
+
+  private:
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    std::vector<T> slots;
+    size_t mask;
+    // head is written by the consumer only, tail by the producer only, kept on separate cache lines
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    alignas(64) std::atomic<size_t> num_overflows;
+};
+
+/**
+ * SpscQueue 消费者的唤醒: 生产者 notify() 只在消费者真正睡眠时才加锁和 notify_one,
+ * 平时只是一次原子读, 回调线程与消费者之间没有互斥锁竞争
+ */
+class SpscNotifier
+{
+  public:
+    SpscNotifier() : waiting(false) {}
+
+    // producer, after push
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed))
+            wake();
+    }
+
+    // any thread, unconditional (e.g. shutdown)
+    void wake()
+    {
+        std::lock_guard<std::mutex> lk(m_wait);
+        con.notify_one();
+    }
+
+    // consumer, returns once ready() is true; ready() only reads the queues
+    template <typename Predicate>
+    void wait(Predicate ready)
+    {
+        if (ready())
+            return;
+        std::unique_lock<std::mutex> lk(m_wait);
+        waiting.store(true, std::memory_order_relaxed);
+        // pairs with the fence in notify(): either the producer sees waiting or ready() sees its push
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        con.wait(lk, ready);
+        waiting.store(false, std::memory_order_relaxed);
+    }
+
+  private:
+    std::mutex m_wait;
+    std::condition_variable con;
+    std::atomic<bool> waiting;
+};
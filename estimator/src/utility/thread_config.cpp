@@ -0,0 +1,166 @@
+#include "thread_config.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <set>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <gvins_feature_tracker/log.h>
+
+namespace
+{
+    // statistics are printed at most this often
+    const std::chrono::seconds REPORT_PERIOD(10);
+
+    // a scope applied on every solve reports only the first time, warnings included
+    bool firstReport(const std::string &name)
+    {
+        static std::mutex mutex;
+        static std::set<std::string> reported;
+        std::lock_guard<std::mutex> lock(mutex);
+        return reported.insert(name).second;
+    }
+
+    bool setAffinity(const std::vector<int> &cores, const std::string &name, bool report)
+    {
+        const int num_cores = static_cast<int>(sysconf(_SC_NPROCESSORS_CONF));
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int core : cores)
+        {
+            if (core < 0 || core >= num_cores || core >= CPU_SETSIZE)
+            {
+                if (report)
+                    GVINS_WARN("%s thread: core %d does not exist (%d cores)", name.c_str(), core, num_cores);
+                continue;
+            }
+            CPU_SET(core, &set);
+        }
+        if (CPU_COUNT(&set) == 0)
+            return false;
+        const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0)
+        {
+            if (report)
+                GVINS_WARN("%s thread: cannot set the CPU affinity: %s", name.c_str(), strerror(err));
+            return false;
+        }
+        return true;
+    }
+
+    bool setPriority(int policy, int priority, const std::string &name, bool report)
+    {
+        sched_param param;
+        param.sched_priority = priority;
+        const int err = pthread_setschedparam(pthread_self(), policy, &param);
+        if (err != 0)
+        {
+            if (report)
+                GVINS_WARN("%s thread: cannot set priority %d: %s%s", name.c_str(), priority, strerror(err),
+                         err == EPERM ? " (needs CAP_SYS_NICE or an rtprio limit)" : "");
+            return false;
+        }
+        return true;
+    }
+
+    std::vector<int> currentCores()
+    {
+        std::vector<int> cores;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+        {
+            for (int core = 0; core < CPU_SETSIZE; ++core)
+                if (CPU_ISSET(core, &set))
+                    cores.push_back(core);
+        }
+        return cores;
+    }
+}
+
+void applyThreadConfig(const ThreadConfig &config, const std::string &name)
+{
+    if (config.cores.empty() && config.priority <= 0)
+        return;
+    const bool report = firstReport(name);
+    std::string applied;
+    if (!config.cores.empty() && setAffinity(config.cores, name, report))
+    {
+        applied += " cores";
+        for (int core : config.cores)
+            applied += " " + std::to_string(core);
+    }
+    if (config.priority > 0)
+    {
+        const int priority = std::min(std::max(config.priority, sched_get_priority_min(SCHED_FIFO)),
+                                      sched_get_priority_max(SCHED_FIFO));
+        if (setPriority(SCHED_FIFO, priority, name, report))
+            applied += " SCHED_FIFO " + std::to_string(priority);
+    }
+    if (report && !applied.empty())
+        GVINS_INFO("%s thread %ld:%s", name.c_str(), static_cast<long>(syscall(SYS_gettid)), applied.c_str());
+}
+
+ScopedThreadConfig::ScopedThreadConfig(const ThreadConfig &config, const std::string &name)
+    : active(!config.cores.empty() || config.priority > 0), saved_policy(SCHED_OTHER), saved_priority(0)
+{
+    if (!active)
+        return;
+    saved_cores = currentCores();
+    sched_param param;
+    if (pthread_getschedparam(pthread_self(), &saved_policy, &param) == 0)
+        saved_priority = param.sched_priority;
+    applyThreadConfig(config, name);
+}
+
+ScopedThreadConfig::~ScopedThreadConfig()
+{
+    if (!active)
+        return;
+    if (!saved_cores.empty())
+        setAffinity(saved_cores, "restored", false);
+    setPriority(saved_policy, saved_priority, "restored", false);
+}
+
+DeadlineMonitor::DeadlineMonitor(const std::string &name, double deadline_ms)
+    : name(name), deadline_ms(deadline_ms), count(0), misses(0), sum_ms(0), max_ms(0),
+      last_report(std::chrono::steady_clock::now())
+{
+}
+
+void DeadlineMonitor::setDeadline(double deadline)
+{
+    deadline_ms = deadline;
+}
+
+void DeadlineMonitor::record(double elapsed_ms)
+{
+    if (deadline_ms <= 0)
+        return;
+    ++count;
+    sum_ms += elapsed_ms;
+    max_ms = std::max(max_ms, elapsed_ms);
+    if (elapsed_ms > deadline_ms)
+    {
+        ++misses;
+        GVINS_DEBUG("%s: %.2f ms over the %.1f ms deadline", name.c_str(), elapsed_ms, deadline_ms);
+    }
+    if (std::chrono::steady_clock::now() - last_report >= REPORT_PERIOD)
+        report();
+}
+
+void DeadlineMonitor::report()
+{
+    GVINS_INFO("%s thread %ld: %zu runs, %zu over the %.1f ms deadline (%.1f%%), mean %.2f ms, max %.2f ms",
+             name.c_str(), static_cast<long>(syscall(SYS_gettid)), count, misses, deadline_ms,
+             100.0 * misses / count, sum_ms / count, max_ms);
+    count = misses = 0;
+    sum_ms = max_ms = 0;
+    last_report = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+/**
+ * 一组线程 (测量处理线程/边缘化线程/ceres 线程) 的 CPU 绑定和实时优先级, 以及每次执行的截止时间
+ * cores 为空时不绑核; priority 为 0 时保持 SCHED_OTHER, 否则使用 SCHED_FIFO (需要 rtprio 权限, 失败只告警)
+ * deadline_ms 为 0 时不统计超时
+ */
+struct ThreadConfig
+{
+    ThreadConfig() : priority(0), deadline_ms(0) {}
+
+    bool operator==(const ThreadConfig &other) const
+    {
+        return cores == other.cores && priority == other.priority && deadline_ms == other.deadline_ms;
+    }
+    bool operator!=(const ThreadConfig &other) const { return !(*this == other); }
+
+    std::vector<int> cores;
+    int priority;
+    double deadline_ms;
+};
+
+// applies cores/priority to the calling thread, name is only used in the log: the first thread of each name logs the
+// result and any failure, the later ones of the same name (pool workers, per-solve scopes) stay quiet
+void applyThreadConfig(const ThreadConfig &config, const std::string &name);
+
+/**
+ * 在作用域内把调用线程切换到 config 的绑核和优先级, 析构时恢复原来的设置
+ * 作用域内创建的线程 (如 ceres 的线程池) 继承这一设置
+ */
+class ScopedThreadConfig
+{
+  public:
+    ScopedThreadConfig(const ThreadConfig &config, const std::string &name);
+    ~ScopedThreadConfig();
+
+  private:
+    ScopedThreadConfig(const ScopedThreadConfig&) = delete;
+    ScopedThreadConfig& operator=(const ScopedThreadConfig&) = delete;
+
+    bool active;
+    std::vector<int> saved_cores;
+    int saved_policy;
+    int saved_priority;
+};
+
+/**
+ * 每次执行耗时与截止时间比较, 每 REPORT_PERIOD 输出一次次数/超时次数/平均和最大耗时
+ * 只能由一个线程调用 record (可以是不同时刻的不同线程, 但不能并发)
+ */
+class DeadlineMonitor
+{
+  public:
+    DeadlineMonitor(const std::string &name, double deadline_ms = 0);
+
+    void setDeadline(double deadline_ms);
+    void record(double elapsed_ms);
+
+  private:
+    void report();
+
+    std::string name;
+    double deadline_ms;
+    size_t count, misses;
+    double sum_ms, max_ms;
+    std::chrono::steady_clock::time_point last_report;
+};
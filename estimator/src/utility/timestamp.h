@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+/**
+ * 核心库的时间戳, 与 ros::Time 相同的秒/纳秒表示, 节点与核心之间的转换没有精度损失
+ * (下游按关键帧的时间戳匹配, 经 double 往返会差 1 ns)
+ */
+struct Timestamp
+{
+    uint32_t sec, nsec;
+
+    Timestamp() : sec(0), nsec(0) {}
+    Timestamp(uint32_t _sec, uint32_t _nsec) : sec(_sec), nsec(_nsec) {}
+    explicit Timestamp(double t)
+    {
+        // as ros::Time(double): whole seconds first, t * 1e9 would not keep the nanoseconds
+        const double whole = std::floor(t);
+        int64_t ns = static_cast<int64_t>(std::llround((t - whole) * 1e9));
+        int64_t s = static_cast<int64_t>(whole);
+        if (ns >= 1000000000)
+        {
+            ++s;
+            ns -= 1000000000;
+        }
+        sec = static_cast<uint32_t>(s);
+        nsec = static_cast<uint32_t>(ns);
+    }
+
+    double toSec() const { return static_cast<double>(sec) + 1e-9 * static_cast<double>(nsec); }
+
+    bool operator==(const Timestamp &other) const { return sec == other.sec && nsec == other.nsec; }
+    bool operator!=(const Timestamp &other) const { return !(*this == other); }
+    bool operator<(const Timestamp &other) const { return sec < other.sec || (sec == other.sec && nsec < other.nsec); }
+};
+
+// header of one image frame in the window, the fields of std_msgs::Header the estimator uses
+struct FrameHeader
+{
+    Timestamp stamp;
+    std::string frame_id;
+};
@@ -1,14 +1,21 @@
 #include "visualization.h"
 
+#include <atomic>
+#include <thread>
+
+#include "spsc_queue.h"
+#include "result_logger.h"
+#include "bounded_path.h"
+
 using namespace ros;
 using namespace Eigen;
-ros::Publisher pub_odometry, pub_latest_odometry;
-ros::Publisher pub_path;
+ros::Publisher pub_odometry, pub_latest_odometry, pub_relocalized_odometry;
+ros::Publisher pub_path, pub_path_pose;
 ros::Publisher pub_point_cloud, pub_margin_cloud;
 ros::Publisher pub_key_poses;
 ros::Publisher pub_camera_pose;
 ros::Publisher pub_camera_pose_visual;
-nav_msgs::Path path;
+static BoundedPath path;
 
 ros::Publisher pub_keyframe_pose;
 ros::Publisher pub_keyframe_point;
@@ -16,7 +23,8 @@ ros::Publisher pub_extrinsic;
 
 ros::Publisher pub_gnss_lla;
 ros::Publisher pub_enu_path, pub_rtk_enu_path;
-nav_msgs::Path enu_path, rtk_enu_path;
+static BoundedPath enu_path;
+nav_msgs::Path rtk_enu_path;
 ros::Publisher pub_anc_lla;
 ros::Publisher pub_enu_pose;
 ros::Publisher pub_sat_info;
@@ -27,11 +35,78 @@ CameraPoseVisualization keyframebasevisual(0.0, 0.0, 1.0, 1.0);
 static double sum_of_path = 0;
 static Vector3d last_path(0.0, 0.0, 0.0);
 
+/**
+ * 话题的发布门限: 没有订阅者时跳过 (pub 为空表示无法统计订阅者, 如 tf),
+ * VISUALIZATION_RATES 中配置了频率的话题按消息时间戳限频; 只在估计线程中使用
+ */
+struct TopicGate
+{
+    const ros::Publisher *pub;
+    double period;
+    double last_stamp;
+};
+
+static bool due(TopicGate &gate, double stamp)
+{
+    if (gate.pub && gate.pub->getNumSubscribers() == 0)
+        return false;
+    if (gate.period > 0 && gate.last_stamp >= 0 && stamp - gate.last_stamp < gate.period)
+        return false;
+    gate.last_stamp = stamp;
+    return true;
+}
+
+static TopicGate makeGate(const ros::Publisher *pub, const std::string &topic)
+{
+    TopicGate gate;
+    gate.pub = pub;
+    auto it = VISUALIZATION_RATES.find(topic);
+    gate.period = (it != VISUALIZATION_RATES.end() && it->second > 0 ? 1.0 / it->second : 0);
+    gate.last_stamp = -1;
+    return gate;
+}
+
+static TopicGate gate_odometry, gate_path, gate_path_pose, gate_key_poses, gate_camera_pose, gate_camera_pose_visual;
+static TopicGate gate_point_cloud, gate_margin_cloud, gate_keyframe, gate_tf, gate_extrinsic;
+static TopicGate gate_gnss_lla, gate_anc_lla, gate_enu_pose, gate_enu_path;
+
+// 后台可视化线程: 估计线程是唯一的生产者
+static SpscQueue<std::shared_ptr<const VisualizationFrame>> viz_buf(64);
+static SpscNotifier viz_notifier;
+static std::atomic<bool> viz_running(false);
+static std::thread viz_thread;
+
+static void makeGates(const ros::Publisher *tf_pub)
+{
+    gate_odometry = makeGate(&pub_odometry, "odometry");
+    gate_path = makeGate(&pub_path, "path");
+    gate_path_pose = makeGate(&pub_path_pose, "path_pose");
+    gate_key_poses = makeGate(&pub_key_poses, "key_poses");
+    gate_camera_pose = makeGate(&pub_camera_pose, "camera_pose");
+    gate_camera_pose_visual = makeGate(&pub_camera_pose_visual, "camera_pose_visual");
+    gate_point_cloud = makeGate(&pub_point_cloud, "point_cloud");
+    gate_margin_cloud = makeGate(&pub_margin_cloud, "history_cloud");
+    // keyframe pose and points feed the pose graph together
+    gate_keyframe = makeGate(&pub_keyframe_pose, "keyframe_pose");
+    gate_tf = makeGate(tf_pub, "tf");
+    gate_extrinsic = makeGate(&pub_extrinsic, "extrinsic");
+    gate_gnss_lla = makeGate(&pub_gnss_lla, "gnss_fused_lla");
+    gate_anc_lla = makeGate(&pub_anc_lla, "gnss_anchor_lla");
+    gate_enu_pose = makeGate(&pub_enu_pose, "enu_pose");
+    gate_enu_path = makeGate(&pub_enu_path, "gnss_enu_path");
+
+    path.configure(PATH_FULL_HISTORY, static_cast<size_t>(std::max(PATH_MAX_POSES, 0)), PATH_MAX_AGE, PATH_HISTORY_SPACING);
+    enu_path.configure(PATH_FULL_HISTORY, static_cast<size_t>(std::max(PATH_MAX_POSES, 0)), PATH_MAX_AGE, PATH_HISTORY_SPACING);
+}
+
 void registerPub(ros::NodeHandle &n)
 {
     pub_latest_odometry = n.advertise<nav_msgs::Odometry>("imu_propagate", 1000);
     pub_path = n.advertise<nav_msgs::Path>("path", 1000);
+    pub_path_pose = n.advertise<geometry_msgs::PoseStamped>("path_pose", 1000);
     pub_odometry = n.advertise<nav_msgs::Odometry>("odometry", 1000);
+    if (RELOCALIZATION)
+        pub_relocalized_odometry = n.advertise<nav_msgs::Odometry>("relocalized_odometry", 1000);
     pub_point_cloud = n.advertise<sensor_msgs::PointCloud>("point_cloud", 1000);
     pub_margin_cloud = n.advertise<sensor_msgs::PointCloud>("history_cloud", 1000);
     pub_key_poses = n.advertise<visualization_msgs::Marker>("key_poses", 1000);
@@ -45,12 +120,167 @@ void registerPub(ros::NodeHandle &n)
     pub_anc_lla = n.advertise<sensor_msgs::NavSatFix>("gnss_anchor_lla", 1000);
     pub_enu_pose = n.advertise<geometry_msgs::PoseStamped>("enu_pose", 1000);
 
+    makeGates(nullptr);
+
     cameraposevisual.setScale(1);
     cameraposevisual.setLineWidth(0.05);
     keyframebasevisual.setScale(0.1);
     keyframebasevisual.setLineWidth(0.01);
 }
 
+void registerOfflinePub()
+{
+    // none of the publishers is advertised, so no topic has subscribers; tf is gated on one of them too
+    makeGates(&pub_odometry);
+}
+
+static void publishFrame(const VisualizationFrame &frame)
+{
+    pubOdometry(frame);
+    pubKeyPoses(frame);
+    pubCameraPose(frame);
+    pubPointCloud(frame);
+    pubTF(frame);
+    pubKeyframe(frame);
+}
+
+static void visualizationLoop()
+{
+    while (true)
+    {
+        viz_notifier.wait([&]{return !viz_running || !viz_buf.empty();});
+        // frames still queued at shutdown are published before the thread exits
+        if (!viz_running && viz_buf.empty())
+            return;
+        std::shared_ptr<const VisualizationFrame> frame = viz_buf.front();
+        viz_buf.pop();
+        publishFrame(*frame);
+    }
+}
+
+void startVisualization()
+{
+    if (!ASYNC_VISUALIZATION || viz_thread.joinable())
+        return;
+    viz_running = true;
+    viz_thread = std::thread(visualizationLoop);
+}
+
+void stopVisualization()
+{
+    if (!viz_thread.joinable())
+        return;
+    viz_running = false;
+    viz_notifier.wake();
+    viz_thread.join();
+}
+
+// the thread has to be joined before the queue and publishers above are destroyed
+static struct VisualizationThreadGuard
+{
+    ~VisualizationThreadGuard() { stopVisualization(); }
+} viz_thread_guard;
+
+static Vector3d toWorld(const Estimator &estimator, const FeaturePerId &it_per_id)
+{
+    int imu_i = it_per_id.start_frame;
+    Vector3d pts_i = it_per_id.feature_per_frame[0].point * it_per_id.estimated_depth;
+    return estimator.Rs[imu_i] * (estimator.ric[0] * pts_i + estimator.tic[0]) + estimator.Ps[imu_i];
+}
+
+void pubEstimatorResults(const Estimator &estimator, const std_msgs::Header &header)
+{
+    std::shared_ptr<VisualizationFrame> frame(new VisualizationFrame());
+    VisualizationFrame &f = *frame;
+    const double t = header.stamp.toSec();
+    f.header = header;
+    f.non_linear = (estimator.solver_flag == Estimator::SolverFlag::NON_LINEAR);
+    f.keyframe = (estimator.marginalization_flag == 0);
+
+    f.P = estimator.Ps[WINDOW_SIZE];
+    f.V = estimator.Vs[WINDOW_SIZE];
+    f.R = estimator.Rs[WINDOW_SIZE];
+    f.Ba = estimator.Bas[WINDOW_SIZE];
+    f.Bg = estimator.Bgs[WINDOW_SIZE];
+    f.camera_P = estimator.Ps[WINDOW_SIZE - 1] + estimator.Rs[WINDOW_SIZE - 1] * estimator.tic[0];
+    f.camera_R = estimator.Rs[WINDOW_SIZE - 1] * estimator.ric[0];
+    f.keyframe_header = toRosHeader(estimator.Headers[WINDOW_SIZE - 2]);
+    f.keyframe_P = estimator.Ps[WINDOW_SIZE - 2];
+    f.keyframe_R = estimator.Rs[WINDOW_SIZE - 2];
+    f.tic = estimator.tic[0];
+    f.ric = estimator.ric[0];
+
+    f.gnss_ready = estimator.gnss_ready;
+    f.gnss_ts = estimator.Headers[WINDOW_SIZE].stamp.toSec() + estimator.diff_t_gnss_local;
+    f.ecef_pos = estimator.ecef_pos;
+    f.anc_ecef = estimator.anc_ecef;
+    f.enu_pos = estimator.enu_pos;
+    f.R_enu_local = estimator.R_enu_local;
+    f.yaw_enu_local = estimator.yaw_enu_local;
+    for (int k = 0; k < 4; ++k)
+        f.rcv_dt[k] = estimator.para_rcv_dt[WINDOW_SIZE*4+k];
+    f.rcv_ddt = estimator.para_rcv_ddt[WINDOW_SIZE];
+
+    // the odometry path and the result files need every frame, only the message is gated
+    f.odometry_due = f.non_linear && due(gate_odometry, t);
+    f.path_due = f.non_linear && due(gate_path, t);
+    f.path_pose_due = f.non_linear && due(gate_path_pose, t);
+    f.key_poses_due = !estimator.key_poses.empty() && due(gate_key_poses, t);
+    f.camera_pose_due = f.non_linear && due(gate_camera_pose, t);
+    f.camera_pose_visual_due = f.non_linear && due(gate_camera_pose_visual, t);
+    f.point_cloud_due = due(gate_point_cloud, t);
+    f.margin_cloud_due = due(gate_margin_cloud, t);
+    f.keyframe_due = f.non_linear && f.keyframe && due(gate_keyframe, t);
+    f.tf_due = f.non_linear && due(gate_tf, t);
+    f.extrinsic_due = f.non_linear && due(gate_extrinsic, t);
+    const bool gnss = f.non_linear && f.gnss_ready;
+    f.gnss_lla_due = gnss && due(gate_gnss_lla, t);
+    f.anc_lla_due = gnss && due(gate_anc_lla, t);
+    f.enu_pose_due = gnss && due(gate_enu_pose, t);
+    f.enu_path_due = gnss && due(gate_enu_path, t);
+
+    if (f.key_poses_due)
+        f.key_poses = estimator.key_poses;
+    const bool need_features = f.point_cloud_due || f.margin_cloud_due || f.keyframe_due;
+    for (auto &it_per_id : estimator.f_manager.feature)
+    {
+        if (!need_features)
+            break;
+        int used_num;
+        used_num = it_per_id.feature_per_frame.size();
+        if (f.point_cloud_due && used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2 &&
+            !(it_per_id.start_frame > WINDOW_SIZE * 3.0 / 4.0 || it_per_id.solve_flag != 1))
+            f.point_cloud.push_back(toWorld(estimator, it_per_id));
+        // pub margined potin
+        if (f.margin_cloud_due && used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2 &&
+            it_per_id.start_frame == 0 && it_per_id.feature_per_frame.size() <= 2 && it_per_id.solve_flag == 1)
+            f.margin_cloud.push_back(toWorld(estimator, it_per_id));
+        int frame_size = used_num;
+        if (f.keyframe_due && it_per_id.start_frame < WINDOW_SIZE - 2 &&
+            it_per_id.start_frame + frame_size - 1 >= WINDOW_SIZE - 2 && it_per_id.solve_flag == 1)
+        {
+            f.keyframe_points.push_back(toWorld(estimator, it_per_id));
+            int imu_j = WINDOW_SIZE - 2 - it_per_id.start_frame;
+            const std::array<float, 5> p_2d = {{
+                static_cast<float>(it_per_id.feature_per_frame[imu_j].point.x()),
+                static_cast<float>(it_per_id.feature_per_frame[imu_j].point.y()),
+                static_cast<float>(it_per_id.feature_per_frame[imu_j].uv.x()),
+                static_cast<float>(it_per_id.feature_per_frame[imu_j].uv.y()),
+                static_cast<float>(it_per_id.feature_id)}};
+            f.keyframe_channels.push_back(p_2d);
+        }
+    }
+
+    if (!viz_thread.joinable())
+    {
+        publishFrame(f);
+        return;
+    }
+    if (!viz_buf.push(frame))
+        ROS_WARN_THROTTLE(1.0, "visualization queue full, %zu frames dropped", viz_buf.overflows());
+    viz_notifier.notify();
+}
+
 void pubLatestOdometry(const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, const Eigen::Vector3d &V, const std_msgs::Header &header)
 {
     Eigen::Quaterniond quadrotor_Q = Q ;
@@ -71,6 +301,32 @@ void pubLatestOdometry(const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, co
     pub_latest_odometry.publish(odometry);
 }
 
+void pubRelocalizedOdometry(const Estimator &estimator, const Eigen::Matrix3d &R_map, const Eigen::Vector3d &t_map,
+                            const std_msgs::Header &header)
+{
+    if (pub_relocalized_odometry.getNumSubscribers() == 0)
+        return;
+    const Eigen::Vector3d P = R_map * estimator.Ps[WINDOW_SIZE] + t_map;
+    const Eigen::Quaterniond Q(R_map * estimator.Rs[WINDOW_SIZE]);
+    const Eigen::Vector3d V = R_map * estimator.Vs[WINDOW_SIZE];
+
+    nav_msgs::Odometry odometry;
+    odometry.header = header;
+    odometry.header.frame_id = "map";
+    odometry.child_frame_id = "world";
+    odometry.pose.pose.position.x = P.x();
+    odometry.pose.pose.position.y = P.y();
+    odometry.pose.pose.position.z = P.z();
+    odometry.pose.pose.orientation.x = Q.x();
+    odometry.pose.pose.orientation.y = Q.y();
+    odometry.pose.pose.orientation.z = Q.z();
+    odometry.pose.pose.orientation.w = Q.w();
+    odometry.twist.twist.linear.x = V.x();
+    odometry.twist.twist.linear.y = V.y();
+    odometry.twist.twist.linear.z = V.z();
+    pub_relocalized_odometry.publish(odometry);
+}
+
 void printStatistics(const Estimator &estimator, double t)
 {
     if (estimator.solver_flag != Estimator::SolverFlag::NON_LINEAR)
@@ -88,9 +344,9 @@ void printStatistics(const Estimator &estimator, double t)
         //ROS_DEBUG("calibration result for camera %d", i);
         ROS_DEBUG_STREAM("extirnsic tic: " << estimator.tic[i].transpose());
         ROS_DEBUG_STREAM("extrinsic ric: " << Utility::R2ypr(estimator.ric[i]).transpose());
-        if (ESTIMATE_EXTRINSIC)
+        if (estimator.config.ESTIMATE_EXTRINSIC)
         {
-            cv::FileStorage fs(EX_CALIB_RESULT_PATH, cv::FileStorage::WRITE);
+            cv::FileStorage fs(estimator.config.EX_CALIB_RESULT_PATH, cv::FileStorage::WRITE);
             Eigen::Matrix3d eigen_R;
             Eigen::Vector3d eigen_T;
             eigen_R = estimator.ric[i];
@@ -113,70 +369,69 @@ void printStatistics(const Estimator &estimator, double t)
     sum_of_path += (estimator.Ps[WINDOW_SIZE] - last_path).norm();
     last_path = estimator.Ps[WINDOW_SIZE];
     ROS_DEBUG("sum of path %f", sum_of_path);
-    if (ESTIMATE_TD)
+    if (estimator.config.ESTIMATE_TD)
         ROS_INFO("td %f", estimator.td);
 }
 
-void pubOdometry(const Estimator &estimator, const std_msgs::Header &header)
+void pubOdometry(const VisualizationFrame &frame)
 {
-    if (estimator.solver_flag == Estimator::SolverFlag::NON_LINEAR)
+    if (frame.non_linear)
     {
+        const std_msgs::Header &header = frame.header;
         nav_msgs::Odometry odometry;
         odometry.header = header;
         odometry.header.frame_id = "world";
         odometry.child_frame_id = "world";
         Quaterniond tmp_Q;
-        tmp_Q = Quaterniond(estimator.Rs[WINDOW_SIZE]);
-        odometry.pose.pose.position.x = estimator.Ps[WINDOW_SIZE].x();
-        odometry.pose.pose.position.y = estimator.Ps[WINDOW_SIZE].y();
-        odometry.pose.pose.position.z = estimator.Ps[WINDOW_SIZE].z();
+        tmp_Q = Quaterniond(frame.R);
+        odometry.pose.pose.position.x = frame.P.x();
+        odometry.pose.pose.position.y = frame.P.y();
+        odometry.pose.pose.position.z = frame.P.z();
         odometry.pose.pose.orientation.x = tmp_Q.x();
         odometry.pose.pose.orientation.y = tmp_Q.y();
         odometry.pose.pose.orientation.z = tmp_Q.z();
         odometry.pose.pose.orientation.w = tmp_Q.w();
-        odometry.twist.twist.linear.x = estimator.Vs[WINDOW_SIZE].x();
-        odometry.twist.twist.linear.y = estimator.Vs[WINDOW_SIZE].y();
-        odometry.twist.twist.linear.z = estimator.Vs[WINDOW_SIZE].z();
-        pub_odometry.publish(odometry);
+        odometry.twist.twist.linear.x = frame.V.x();
+        odometry.twist.twist.linear.y = frame.V.y();
+        odometry.twist.twist.linear.z = frame.V.z();
+        if (frame.odometry_due)
+            pub_odometry.publish(odometry);
 
         geometry_msgs::PoseStamped pose_stamped;
         pose_stamped.header = header;
         pose_stamped.header.frame_id = "world";
         pose_stamped.pose = odometry.pose.pose;
-        path.header = header;
-        path.header.frame_id = "world";
-        path.poses.push_back(pose_stamped);
-        pub_path.publish(path);
-
-        // write result to file
-        ofstream foutC(VINS_RESULT_PATH, ios::app);
-        foutC.setf(ios::fixed, ios::floatfield);
-        foutC.precision(0);
-        foutC << header.stamp.toSec() * 1e9 << ",";
-        foutC.precision(5);
-        foutC << estimator.Ps[WINDOW_SIZE].x() << ","
-              << estimator.Ps[WINDOW_SIZE].y() << ","
-              << estimator.Ps[WINDOW_SIZE].z() << ","
-              << tmp_Q.w() << ","
-              << tmp_Q.x() << ","
-              << tmp_Q.y() << ","
-              << tmp_Q.z() << ","
-              << estimator.Vs[WINDOW_SIZE].x() << ","
-              << estimator.Vs[WINDOW_SIZE].y() << ","
-              << estimator.Vs[WINDOW_SIZE].z() << "," << endl;
-        foutC.close();
-
-        pubGnssResult(estimator, header);
+        path.push(pose_stamped);
+        if (frame.path_pose_due)
+            pub_path_pose.publish(pose_stamped);
+        if (frame.path_due)
+        {
+            nav_msgs::Path path_msg;
+            path.toMsg(path_msg);
+            pub_path.publish(path_msg);
+        }
+
+        // write result to file, formatted and written by the logger thread
+        const double stamp_ns = header.stamp.toSec() * 1e9;
+        // the CSV keeps the first 10 columns, the binary form has the biases too
+        const double result[16] = {frame.P.x(), frame.P.y(), frame.P.z(),
+                                   tmp_Q.w(), tmp_Q.x(), tmp_Q.y(), tmp_Q.z(),
+                                   frame.V.x(), frame.V.y(), frame.V.z(),
+                                   frame.Ba.x(), frame.Ba.y(), frame.Ba.z(),
+                                   frame.Bg.x(), frame.Bg.y(), frame.Bg.z()};
+        ResultLogger::instance().log(ResultLogger::VINS_RESULT, &stamp_ns, result);
+
+        pubGnssResult(frame);
     }
 }
 
-void pubGnssResult(const Estimator &estimator, const std_msgs::Header &header)
+void pubGnssResult(const VisualizationFrame &frame)
 {
-    if (!estimator.gnss_ready)      return;
+    if (!frame.gnss_ready)      return;
+    const std_msgs::Header &header = frame.header;
     // publish GNSS LLA
-    const double gnss_ts = estimator.Headers[WINDOW_SIZE].stamp.toSec() + 
-        estimator.diff_t_gnss_local;
-    Eigen::Vector3d lla_pos = ecef2geo(estimator.ecef_pos);
+    const double gnss_ts = frame.gnss_ts;
+    Eigen::Vector3d lla_pos = ecef2geo(frame.ecef_pos);
     printf("global time: %f\n", gnss_ts);
     printf("latitude longitude altitude: %f, %f, %f\n", lla_pos.x(), lla_pos.y(), lla_pos.z());
     sensor_msgs::NavSatFix gnss_lla_msg;
@@ -185,16 +440,20 @@ void pubGnssResult(const Estimator &estimator, const std_msgs::Header &header)
     gnss_lla_msg.latitude = lla_pos.x();
     gnss_lla_msg.longitude = lla_pos.y();
     gnss_lla_msg.altitude = lla_pos.z();
-    pub_gnss_lla.publish(gnss_lla_msg);
+    if (frame.gnss_lla_due)
+        pub_gnss_lla.publish(gnss_lla_msg);
 
     // publish anchor LLA
-    const Eigen::Vector3d anc_lla = ecef2geo(estimator.anc_ecef);
-    sensor_msgs::NavSatFix anc_lla_msg;
-    anc_lla_msg.header = gnss_lla_msg.header;
-    anc_lla_msg.latitude = anc_lla.x();
-    anc_lla_msg.longitude = anc_lla.y();
-    anc_lla_msg.altitude = anc_lla.z();
-    pub_anc_lla.publish(anc_lla_msg);
+    if (frame.anc_lla_due)
+    {
+        const Eigen::Vector3d anc_lla = ecef2geo(frame.anc_ecef);
+        sensor_msgs::NavSatFix anc_lla_msg;
+        anc_lla_msg.header = gnss_lla_msg.header;
+        anc_lla_msg.latitude = anc_lla.x();
+        anc_lla_msg.longitude = anc_lla.y();
+        anc_lla_msg.altitude = anc_lla.z();
+        pub_anc_lla.publish(anc_lla_msg);
+    }
 
     // publish ENU pose and path
     geometry_msgs::PoseStamped enu_pose_msg;
@@ -203,65 +462,62 @@ void pubGnssResult(const Estimator &estimator, const std_msgs::Header &header)
     R_s_c <<  0,  0,  1,
              -1,  0,  0,
               0, -1,  0;
-    Eigen::Matrix3d R_w_sensor = estimator.Rs[WINDOW_SIZE] * estimator.ric[0] * R_s_c.transpose();
-    Eigen::Quaterniond enu_ori(estimator.R_enu_local * R_w_sensor);
+    Eigen::Matrix3d R_w_sensor = frame.R * frame.ric * R_s_c.transpose();
+    Eigen::Quaterniond enu_ori(frame.R_enu_local * R_w_sensor);
     enu_pose_msg.header.stamp = header.stamp;
     enu_pose_msg.header.frame_id = "world";     // "enu" will more meaningful, but for viz
-    enu_pose_msg.pose.position.x = estimator.enu_pos.x();
-    enu_pose_msg.pose.position.y = estimator.enu_pos.y();
-    enu_pose_msg.pose.position.z = estimator.enu_pos.z();
+    enu_pose_msg.pose.position.x = frame.enu_pos.x();
+    enu_pose_msg.pose.position.y = frame.enu_pos.y();
+    enu_pose_msg.pose.position.z = frame.enu_pos.z();
     enu_pose_msg.pose.orientation.x = enu_ori.x();
     enu_pose_msg.pose.orientation.y = enu_ori.y();
     enu_pose_msg.pose.orientation.z = enu_ori.z();
     enu_pose_msg.pose.orientation.w = enu_ori.w();
-    pub_enu_pose.publish(enu_pose_msg);
+    if (frame.enu_pose_due)
+        pub_enu_pose.publish(enu_pose_msg);
 
-    enu_path.header = enu_pose_msg.header;
-    enu_path.poses.push_back(enu_pose_msg);
-    pub_enu_path.publish(enu_path);
+    // enu_pose is the incremental form of the path
+    enu_path.push(enu_pose_msg);
+    if (frame.enu_path_due)
+    {
+        nav_msgs::Path enu_path_msg;
+        enu_path.toMsg(enu_path_msg);
+        pub_enu_path.publish(enu_path_msg);
+    }
 
     // publish ENU-local tf
-    Eigen::Quaterniond q_enu_world(estimator.R_enu_local);
-    static tf::TransformBroadcaster br;
-    tf::Transform transform_enu_world;
-
-    transform_enu_world.setOrigin(tf::Vector3(0, 0, 0));
-    tf::Quaternion tf_q;
-    tf_q.setW(q_enu_world.w());
-    tf_q.setX(q_enu_world.x());
-    tf_q.setY(q_enu_world.y());
-    tf_q.setZ(q_enu_world.z());
-    transform_enu_world.setRotation(tf_q);
-    br.sendTransform(tf::StampedTransform(transform_enu_world, header.stamp, "enu", "world"));
+    if (frame.tf_due)
+    {
+        Eigen::Quaterniond q_enu_world(frame.R_enu_local);
+        static tf::TransformBroadcaster br;
+        tf::Transform transform_enu_world;
+
+        transform_enu_world.setOrigin(tf::Vector3(0, 0, 0));
+        tf::Quaternion tf_q;
+        tf_q.setW(q_enu_world.w());
+        tf_q.setX(q_enu_world.x());
+        tf_q.setY(q_enu_world.y());
+        tf_q.setZ(q_enu_world.z());
+        transform_enu_world.setRotation(tf_q);
+        br.sendTransform(tf::StampedTransform(transform_enu_world, header.stamp, "enu", "world"));
+    }
 
     // write GNSS result to file
-    ofstream gnss_output(GNSS_RESULT_PATH, ios::app);
-    gnss_output.setf(ios::fixed, ios::floatfield);
-    gnss_output.precision(0);
-    gnss_output << header.stamp.toSec() * 1e9 << ',';
-    gnss_output << gnss_ts * 1e9 << ',';
-    gnss_output.precision(5);
-    gnss_output << estimator.ecef_pos(0) << ','
-                << estimator.ecef_pos(1) << ','
-                << estimator.ecef_pos(2) << ','
-                << estimator.yaw_enu_local << ','
-                << estimator.para_rcv_dt[(WINDOW_SIZE)*4+0] << ','
-                << estimator.para_rcv_dt[(WINDOW_SIZE)*4+1] << ','
-                << estimator.para_rcv_dt[(WINDOW_SIZE)*4+2] << ','
-                << estimator.para_rcv_dt[(WINDOW_SIZE)*4+3] << ','
-                << estimator.para_rcv_ddt[WINDOW_SIZE] << ','
-                << estimator.anc_ecef(0) << ','
-                << estimator.anc_ecef(1) << ','
-                << estimator.anc_ecef(2) << '\n';
-    gnss_output.close();
+    const double stamps_ns[2] = {header.stamp.toSec() * 1e9, gnss_ts * 1e9};
+    const double gnss_result[12] = {frame.ecef_pos(0), frame.ecef_pos(1), frame.ecef_pos(2),
+                                    frame.yaw_enu_local,
+                                    frame.rcv_dt[0], frame.rcv_dt[1], frame.rcv_dt[2], frame.rcv_dt[3],
+                                    frame.rcv_ddt,
+                                    frame.anc_ecef(0), frame.anc_ecef(1), frame.anc_ecef(2)};
+    ResultLogger::instance().log(ResultLogger::GNSS_RESULT, stamps_ns, gnss_result);
 }
 
-void pubKeyPoses(const Estimator &estimator, const std_msgs::Header &header)
+void pubKeyPoses(const VisualizationFrame &frame)
 {
-    if (estimator.key_poses.size() == 0)
+    if (!frame.key_poses_due)
         return;
     visualization_msgs::Marker key_poses;
-    key_poses.header = header;
+    key_poses.header = frame.header;
     key_poses.header.frame_id = "world";
     key_poses.ns = "key_poses";
     key_poses.type = visualization_msgs::Marker::SPHERE_LIST;
@@ -281,7 +537,7 @@ void pubKeyPoses(const Estimator &estimator, const std_msgs::Header &header)
     {
         geometry_msgs::Point pose_marker;
         Vector3d correct_pose;
-        correct_pose = estimator.key_poses[i];
+        correct_pose = frame.key_poses[i];
         pose_marker.x = correct_pose.x();
         pose_marker.y = correct_pose.y();
         pose_marker.z = correct_pose.z();
@@ -290,18 +546,15 @@ void pubKeyPoses(const Estimator &estimator, const std_msgs::Header &header)
     pub_key_poses.publish(key_poses);
 }
 
-void pubCameraPose(const Estimator &estimator, const std_msgs::Header &header)
+void pubCameraPose(const VisualizationFrame &frame)
 {
-    int idx2 = WINDOW_SIZE - 1;
-
-    if (estimator.solver_flag == Estimator::SolverFlag::NON_LINEAR)
+    if (frame.camera_pose_due || frame.camera_pose_visual_due)
     {
-        int i = idx2;
-        Vector3d P = estimator.Ps[i] + estimator.Rs[i] * estimator.tic[0];
-        Quaterniond R = Quaterniond(estimator.Rs[i] * estimator.ric[0]);
+        Vector3d P = frame.camera_P;
+        Quaterniond R = Quaterniond(frame.camera_R);
 
         nav_msgs::Odometry odometry;
-        odometry.header = header;
+        odometry.header = frame.header;
         odometry.header.frame_id = "world";
         odometry.pose.pose.position.x = P.x();
         odometry.pose.pose.position.y = P.y();
@@ -311,135 +564,118 @@ void pubCameraPose(const Estimator &estimator, const std_msgs::Header &header)
         odometry.pose.pose.orientation.z = R.z();
         odometry.pose.pose.orientation.w = R.w();
 
-        pub_camera_pose.publish(odometry);
+        if (frame.camera_pose_due)
+            pub_camera_pose.publish(odometry);
 
-        cameraposevisual.reset();
-        cameraposevisual.add_pose(P, R);
-        cameraposevisual.publish_by(pub_camera_pose_visual, odometry.header);
+        if (frame.camera_pose_visual_due)
+        {
+            cameraposevisual.reset();
+            cameraposevisual.add_pose(P, R);
+            cameraposevisual.publish_by(pub_camera_pose_visual, odometry.header);
+        }
     }
 }
 
-
-void pubPointCloud(const Estimator &estimator, const std_msgs::Header &header)
+static void toPointCloud(const std::vector<Vector3d> &points, sensor_msgs::PointCloud &cloud)
 {
-    sensor_msgs::PointCloud point_cloud, loop_point_cloud;
-    point_cloud.header = header;
-    loop_point_cloud.header = header;
-
-
-    for (auto &it_per_id : estimator.f_manager.feature)
+    cloud.points.reserve(points.size());
+    for (const Vector3d &w_pts_i : points)
     {
-        int used_num;
-        used_num = it_per_id.feature_per_frame.size();
-        if (!(used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
-            continue;
-        if (it_per_id.start_frame > WINDOW_SIZE * 3.0 / 4.0 || it_per_id.solve_flag != 1)
-            continue;
-        int imu_i = it_per_id.start_frame;
-        Vector3d pts_i = it_per_id.feature_per_frame[0].point * it_per_id.estimated_depth;
-        Vector3d w_pts_i = estimator.Rs[imu_i] * (estimator.ric[0] * pts_i + estimator.tic[0]) + estimator.Ps[imu_i];
-
         geometry_msgs::Point32 p;
         p.x = w_pts_i(0);
         p.y = w_pts_i(1);
         p.z = w_pts_i(2);
-        point_cloud.points.push_back(p);
+        cloud.points.push_back(p);
     }
-    pub_point_cloud.publish(point_cloud);
+}
 
+void pubPointCloud(const VisualizationFrame &frame)
+{
+    if (frame.point_cloud_due)
+    {
+        sensor_msgs::PointCloud point_cloud;
+        point_cloud.header = frame.header;
+        toPointCloud(frame.point_cloud, point_cloud);
+        pub_point_cloud.publish(point_cloud);
+    }
 
     // pub margined potin
-    sensor_msgs::PointCloud margin_cloud;
-    margin_cloud.header = header;
-
-    for (auto &it_per_id : estimator.f_manager.feature)
-    { 
-        int used_num;
-        used_num = it_per_id.feature_per_frame.size();
-        if (!(used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
-            continue;
-        //if (it_per_id->start_frame > WINDOW_SIZE * 3.0 / 4.0 || it_per_id->solve_flag != 1)
-        //        continue;
-
-        if (it_per_id.start_frame == 0 && it_per_id.feature_per_frame.size() <= 2 
-            && it_per_id.solve_flag == 1 )
-        {
-            int imu_i = it_per_id.start_frame;
-            Vector3d pts_i = it_per_id.feature_per_frame[0].point * it_per_id.estimated_depth;
-            Vector3d w_pts_i = estimator.Rs[imu_i] * (estimator.ric[0] * pts_i + estimator.tic[0]) + estimator.Ps[imu_i];
-
-            geometry_msgs::Point32 p;
-            p.x = w_pts_i(0);
-            p.y = w_pts_i(1);
-            p.z = w_pts_i(2);
-            margin_cloud.points.push_back(p);
-        }
+    if (frame.margin_cloud_due)
+    {
+        sensor_msgs::PointCloud margin_cloud;
+        margin_cloud.header = frame.header;
+        toPointCloud(frame.margin_cloud, margin_cloud);
+        pub_margin_cloud.publish(margin_cloud);
     }
-    pub_margin_cloud.publish(margin_cloud);
 }
 
 
-void pubTF(const Estimator &estimator, const std_msgs::Header &header)
+void pubTF(const VisualizationFrame &frame)
 {
-    if( estimator.solver_flag != Estimator::SolverFlag::NON_LINEAR)
+    if (!frame.non_linear)
         return;
-    static tf::TransformBroadcaster br;
-    tf::Transform transform;
-    tf::Quaternion q;
-    // body frame
-    Vector3d correct_t;
-    Quaterniond correct_q;
-    correct_t = estimator.Ps[WINDOW_SIZE];
-    correct_q = estimator.Rs[WINDOW_SIZE];
-
-    transform.setOrigin(tf::Vector3(correct_t(0),
-                                    correct_t(1),
-                                    correct_t(2)));
-    q.setW(correct_q.w());
-    q.setX(correct_q.x());
-    q.setY(correct_q.y());
-    q.setZ(correct_q.z());
-    transform.setRotation(q);
-    br.sendTransform(tf::StampedTransform(transform, header.stamp, "world", "body"));
-
-    // camera frame
-    transform.setOrigin(tf::Vector3(estimator.tic[0].x(),
-                                    estimator.tic[0].y(),
-                                    estimator.tic[0].z()));
-    q.setW(Quaterniond(estimator.ric[0]).w());
-    q.setX(Quaterniond(estimator.ric[0]).x());
-    q.setY(Quaterniond(estimator.ric[0]).y());
-    q.setZ(Quaterniond(estimator.ric[0]).z());
-    transform.setRotation(q);
-    br.sendTransform(tf::StampedTransform(transform, header.stamp, "body", "camera"));
-
-    nav_msgs::Odometry odometry;
-    odometry.header = header;
-    odometry.header.frame_id = "world";
-    odometry.pose.pose.position.x = estimator.tic[0].x();
-    odometry.pose.pose.position.y = estimator.tic[0].y();
-    odometry.pose.pose.position.z = estimator.tic[0].z();
-    Quaterniond tmp_q{estimator.ric[0]};
-    odometry.pose.pose.orientation.x = tmp_q.x();
-    odometry.pose.pose.orientation.y = tmp_q.y();
-    odometry.pose.pose.orientation.z = tmp_q.z();
-    odometry.pose.pose.orientation.w = tmp_q.w();
-    pub_extrinsic.publish(odometry);
+    const std_msgs::Header &header = frame.header;
+    if (frame.tf_due)
+    {
+        static tf::TransformBroadcaster br;
+        tf::Transform transform;
+        tf::Quaternion q;
+        // body frame
+        Vector3d correct_t;
+        Quaterniond correct_q;
+        correct_t = frame.P;
+        correct_q = frame.R;
+
+        transform.setOrigin(tf::Vector3(correct_t(0),
+                                        correct_t(1),
+                                        correct_t(2)));
+        q.setW(correct_q.w());
+        q.setX(correct_q.x());
+        q.setY(correct_q.y());
+        q.setZ(correct_q.z());
+        transform.setRotation(q);
+        br.sendTransform(tf::StampedTransform(transform, header.stamp, "world", "body"));
+
+        // camera frame
+        transform.setOrigin(tf::Vector3(frame.tic.x(),
+                                        frame.tic.y(),
+                                        frame.tic.z()));
+        q.setW(Quaterniond(frame.ric).w());
+        q.setX(Quaterniond(frame.ric).x());
+        q.setY(Quaterniond(frame.ric).y());
+        q.setZ(Quaterniond(frame.ric).z());
+        transform.setRotation(q);
+        br.sendTransform(tf::StampedTransform(transform, header.stamp, "body", "camera"));
+    }
 
+    if (frame.extrinsic_due)
+    {
+        nav_msgs::Odometry odometry;
+        odometry.header = header;
+        odometry.header.frame_id = "world";
+        odometry.pose.pose.position.x = frame.tic.x();
+        odometry.pose.pose.position.y = frame.tic.y();
+        odometry.pose.pose.position.z = frame.tic.z();
+        Quaterniond tmp_q{frame.ric};
+        odometry.pose.pose.orientation.x = tmp_q.x();
+        odometry.pose.pose.orientation.y = tmp_q.y();
+        odometry.pose.pose.orientation.z = tmp_q.z();
+        odometry.pose.pose.orientation.w = tmp_q.w();
+        pub_extrinsic.publish(odometry);
+    }
 }
 
-void pubKeyframe(const Estimator &estimator)
+void pubKeyframe(const VisualizationFrame &frame)
 {
     // pub camera pose, 2D-3D points of keyframe
-    if (estimator.solver_flag == Estimator::SolverFlag::NON_LINEAR && estimator.marginalization_flag == 0)
+    if (frame.keyframe_due)
     {
-        int i = WINDOW_SIZE - 2;
         //Vector3d P = estimator.Ps[i] + estimator.Rs[i] * estimator.tic[0];
-        Vector3d P = estimator.Ps[i];
-        Quaterniond R = Quaterniond(estimator.Rs[i]);
+        Vector3d P = frame.keyframe_P;
+        Quaterniond R = Quaterniond(frame.keyframe_R);
 
         nav_msgs::Odometry odometry;
-        odometry.header = estimator.Headers[WINDOW_SIZE - 2];
+        odometry.header = frame.keyframe_header;
         odometry.header.frame_id = "world";
         odometry.pose.pose.position.x = P.x();
         odometry.pose.pose.position.y = P.y();
@@ -454,34 +690,14 @@ void pubKeyframe(const Estimator &estimator)
 
 
         sensor_msgs::PointCloud point_cloud;
-        point_cloud.header = estimator.Headers[WINDOW_SIZE - 2];
-        for (auto &it_per_id : estimator.f_manager.feature)
+        point_cloud.header = frame.keyframe_header;
+        toPointCloud(frame.keyframe_points, point_cloud);
+        for (const std::array<float, 5> &values : frame.keyframe_channels)
         {
-            int frame_size = it_per_id.feature_per_frame.size();
-            if(it_per_id.start_frame < WINDOW_SIZE - 2 && it_per_id.start_frame + frame_size - 1 >= WINDOW_SIZE - 2 && it_per_id.solve_flag == 1)
-            {
-
-                int imu_i = it_per_id.start_frame;
-                Vector3d pts_i = it_per_id.feature_per_frame[0].point * it_per_id.estimated_depth;
-                Vector3d w_pts_i = estimator.Rs[imu_i] * (estimator.ric[0] * pts_i + estimator.tic[0])
-                                      + estimator.Ps[imu_i];
-                geometry_msgs::Point32 p;
-                p.x = w_pts_i(0);
-                p.y = w_pts_i(1);
-                p.z = w_pts_i(2);
-                point_cloud.points.push_back(p);
-
-                int imu_j = WINDOW_SIZE - 2 - it_per_id.start_frame;
-                sensor_msgs::ChannelFloat32 p_2d;
-                p_2d.values.push_back(it_per_id.feature_per_frame[imu_j].point.x());
-                p_2d.values.push_back(it_per_id.feature_per_frame[imu_j].point.y());
-                p_2d.values.push_back(it_per_id.feature_per_frame[imu_j].uv.x());
-                p_2d.values.push_back(it_per_id.feature_per_frame[imu_j].uv.y());
-                p_2d.values.push_back(it_per_id.feature_id);
-                point_cloud.channels.push_back(p_2d);
-            }
-
+            sensor_msgs::ChannelFloat32 p_2d;
+            p_2d.values.assign(values.begin(), values.end());
+            point_cloud.channels.push_back(p_2d);
         }
         pub_keyframe_point.publish(point_cloud);
     }
-}
\ No newline at end of file
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <fstream>
 #include <ros/ros.h>
 #include <std_msgs/Header.h>
@@ -16,6 +17,7 @@
 #include <visualization_msgs/Marker.h>
 #include <tf/transform_broadcaster.h>
 #include "CameraPoseVisualization.h"
+#include "ros_header.h"
 #include <eigen3/Eigen/Dense>
 #include <gnss_comm/gnss_ros.hpp>
 
@@ -28,28 +30,79 @@ extern ros::Publisher pub_cloud, pub_map;
 extern ros::Publisher pub_key_poses;
 extern ros::Publisher pub_ref_pose, pub_cur_pose;
 extern ros::Publisher pub_key;
-extern nav_msgs::Path path;
 extern ros::Publisher pub_pose_graph;
 extern int IMAGE_ROW, IMAGE_COL;
 
+/**
+ * 一帧估计结果的只读快照, 由估计线程在 m_estimator 内复制, 后台可视化线程据此构造并发布消息
+ * 特征点的世界坐标只在对应话题有订阅者且未被限频时才计算, 对应的 *_due 为 false 时为空
+ */
+struct VisualizationFrame
+{
+    std_msgs::Header header;
+    bool non_linear;            // solver_flag == NON_LINEAR
+    bool keyframe;              // marginalization_flag == MARGIN_OLD
+
+    Eigen::Vector3d P, V;       // newest frame (WINDOW_SIZE)
+    Eigen::Matrix3d R;
+    Eigen::Vector3d Ba, Bg;
+    Eigen::Vector3d camera_P;   // WINDOW_SIZE - 1, camera frame
+    Eigen::Matrix3d camera_R;
+    std_msgs::Header keyframe_header;   // WINDOW_SIZE - 2
+    Eigen::Vector3d keyframe_P;
+    Eigen::Matrix3d keyframe_R;
+    Eigen::Vector3d tic;
+    Eigen::Matrix3d ric;
+    std::vector<Eigen::Vector3d> key_poses;
+
+    // GNSS
+    bool gnss_ready;
+    double gnss_ts;
+    Eigen::Vector3d ecef_pos, anc_ecef, enu_pos;
+    Eigen::Matrix3d R_enu_local;
+    double yaw_enu_local;
+    double rcv_dt[4], rcv_ddt;
+
+    // per-topic decisions: subscribed and not rate limited
+    bool odometry_due, path_due, path_pose_due, key_poses_due, camera_pose_due, camera_pose_visual_due;
+    bool point_cloud_due, margin_cloud_due, keyframe_due, tf_due, extrinsic_due;
+    bool gnss_lla_due, anc_lla_due, enu_pose_due, enu_path_due;
+
+    std::vector<Eigen::Vector3d> point_cloud, margin_cloud;
+    std::vector<Eigen::Vector3d> keyframe_points;
+    std::vector<std::array<float, 5>> keyframe_channels;   // normalized x, y, pixel u, v, feature id
+};
+
 void registerPub(ros::NodeHandle &n);
+// without a node (offline driver): no message is ever due, only the result files are written
+void registerOfflinePub();
+
+// background publishing thread, used when ASYNC_VISUALIZATION is set
+void startVisualization();
+void stopVisualization();
+
+// snapshot the estimator (caller holds m_estimator) and publish it from the background thread,
+// or publish it in place without ASYNC_VISUALIZATION
+void pubEstimatorResults(const Estimator &estimator, const std_msgs::Header &header);
 
 void pubLatestOdometry(const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, const Eigen::Vector3d &V, const std_msgs::Header &header);
 
-void printStatistics(const Estimator &estimator, double t);
+// newest frame in the map frame of the relocalizer (caller holds m_estimator)
+void pubRelocalizedOdometry(const Estimator &estimator, const Eigen::Matrix3d &R_map, const Eigen::Vector3d &t_map,
+                            const std_msgs::Header &header);
 
-void pubOdometry(const Estimator &estimator, const std_msgs::Header &header);
+void printStatistics(const Estimator &estimator, double t);
 
-void pubGnssResult(const Estimator &estimator, const std_msgs::Header &header);
+void pubOdometry(const VisualizationFrame &frame);
 
-void pubInitialGuess(const Estimator &estimator, const std_msgs::Header &header);
+void pubGnssResult(const VisualizationFrame &frame);
 
-void pubKeyPoses(const Estimator &estimator, const std_msgs::Header &header);
+void pubKeyPoses(const VisualizationFrame &frame);
 
-void pubCameraPose(const Estimator &estimator, const std_msgs::Header &header);
+void pubCameraPose(const VisualizationFrame &frame);
 
-void pubPointCloud(const Estimator &estimator, const std_msgs::Header &header);
+void pubPointCloud(const VisualizationFrame &frame);
 
-void pubTF(const Estimator &estimator, const std_msgs::Header &header);
+void pubTF(const VisualizationFrame &frame);
 
-void pubKeyframe(const Estimator &estimator);
\ No newline at end of file
+void pubKeyframe(const VisualizationFrame &frame);
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <array>
+
+/**
+ * 滑动窗口内每帧状态的环形存储, operator[] 使用窗口内的逻辑帧号 (0 为最老帧)
+ * rotate() 把逻辑帧整体前移一位, 原来的第 0 帧槽位变成第 N-1 帧, O(1) 且不拷贝/交换内容,
+ * 槽位中的旧数据由调用者重置
+ */
+template <typename T, int N>
+class WindowArray
+{
+  public:
+    WindowArray() : head(0) {}
+
+    T &operator[](int i) { return slots[physical(i)]; }
+    const T &operator[](int i) const { return slots[physical(i)]; }
+
+    void rotate() { head = (head + 1 == N ? 0 : head + 1); }
+    static constexpr int size() { return N; }
+
+  private:
+    int physical(int i) const { return (head + i < N ? head + i : head + i - N); }
+
+    std::array<T, N> slots;
+    int head;
+};
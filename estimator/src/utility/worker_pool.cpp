@@ -0,0 +1,113 @@
+#include "worker_pool.h"
+#include <gvins_feature_tracker/trace_zones.h>
+
+WorkerPool &WorkerPool::instance()
+{
+    static WorkerPool pool;
+    return pool;
+}
+
+WorkerPool::WorkerPool() : curr_job(nullptr), total_jobs(0), next_job(0),
+    active_workers(0), generation(0), stop(false)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    stopWorkers();
+}
+
+void WorkerPool::setNumThreads(int num_threads, const ThreadConfig &config)
+{
+    std::lock_guard<std::mutex> call_lock(m_call);
+    if (num_threads < 1)
+        num_threads = 1;
+    if (static_cast<int>(workers.size()) == num_threads - 1 && worker_config == config)
+        return;
+
+    stopWorkers();
+    stop = false;
+    worker_config = config;
+    for (int i = 0; i < num_threads - 1; ++i)
+        workers.emplace_back(&WorkerPool::workerLoop, this, i, generation);
+}
+
+int WorkerPool::numThreads() const
+{
+    return static_cast<int>(workers.size()) + 1;
+}
+
+void WorkerPool::parallelFor(int num_jobs, const std::function<void(int)> &job)
+{
+    if (num_jobs <= 0)
+        return;
+
+    std::lock_guard<std::mutex> call_lock(m_call);
+    if (workers.empty() || num_jobs == 1)
+    {
+        for (int k = 0; k < num_jobs; ++k)
+            job(k);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(m_pool);
+        curr_job = &job;
+        total_jobs = num_jobs;
+        next_job = 0;
+        active_workers = static_cast<int>(workers.size());
+        ++generation;
+    }
+    con_start.notify_all();
+
+    GVINS_TRACE_ZONE("parallelFor");
+    runJobs();
+
+    std::unique_lock<std::mutex> lk(m_pool);
+    con_done.wait(lk, [&]{return active_workers == 0;});
+    curr_job = nullptr;
+}
+
+void WorkerPool::stopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lk(m_pool);
+        stop = true;
+    }
+    con_start.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+    workers.clear();
+}
+
+void WorkerPool::workerLoop(int index, unsigned long seen_generation)
+{
+    const std::string name = "worker " + std::to_string(index);
+    applyThreadConfig(worker_config, name);
+    GVINS_TRACE_THREAD(name.c_str());
+    while (true)
+    {
+        std::unique_lock<std::mutex> lk(m_pool);
+        con_start.wait(lk, [&]{return stop || generation != seen_generation;});
+        if (stop)
+            return;
+        seen_generation = generation;
+        lk.unlock();
+
+        {
+            GVINS_TRACE_ZONE("workerJobs");
+            runJobs();
+        }
+
+        lk.lock();
+        if (--active_workers == 0)
+            con_done.notify_one();
+    }
+}
+
+void WorkerPool::runJobs()
+{
+    int k;
+    while ((k = next_job.fetch_add(1)) < total_jobs)
+        (*curr_job)(k);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "thread_config.h"
+
+/**
+ * 进程内共享的线程池，marginalization 的 preMarginalize/marginalize 共用
+ * 线程在 setNumThreads 时创建，之后每次 parallelFor 只是唤醒，不再 pthread_create/join
+ * parallelFor 阻塞直到所有任务返回，调用线程自身也参与执行；不可嵌套调用
+ */
+class WorkerPool
+{
+  public:
+    static WorkerPool &instance();
+    ~WorkerPool();
+
+    // total number of threads taking part in parallelFor, including the caller;
+    // the workers are pinned and prioritised by config, the caller keeps its own setting
+    void setNumThreads(int num_threads, const ThreadConfig &config = ThreadConfig());
+    int numThreads() const;
+
+    // run job(0) ... job(num_jobs-1) on the pool and wait for all of them
+    void parallelFor(int num_jobs, const std::function<void(int)> &job);
+
+  private:
+    WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void stopWorkers();
+    void workerLoop(int index, unsigned long seen_generation);
+    void runJobs();
+
+    std::vector<std::thread> workers;
+    ThreadConfig worker_config;
+    std::mutex m_call;
+    std::mutex m_pool;
+    std::condition_variable con_start, con_done;
+
+    const std::function<void(int)> *curr_job;
+    int total_jobs;
+    std::atomic<int> next_job;
+    int active_workers;
+    unsigned long generation;
+    bool stop;
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+/**
+ * 核心库 (估计器, 因子, 初始化, 前端算法) 的日志, 不依赖 ROS: 默认写到 stderr, 阈值为 INFO;
+ * ROS 节点启动时用 log_ros.h 的 installRosLogSink() 转发到 rosconsole, 其它运行环境可用 setSink() 接入自己的日志
+ * 低于阈值的消息不做格式化; sink 和阈值每个模块一份 (nodelet 中因符号隐藏各自独立), 应在启动时设置一次
+ * GVINS_ASSERT 与 ROS_ASSERT 相同, 定义 NDEBUG 时不检查
+ */
+namespace gvins_log
+{
+enum Level
+{
+    DEBUG = 0,
+    INFO,
+    WARN,
+    ERROR,
+    FATAL
+};
+
+typedef void (*Sink)(Level level, const char *message);
+
+inline const char *levelName(Level level)
+{
+    static const char *const names[] = {"DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
+    return names[level];
+}
+
+inline void stderrSink(Level level, const char *message)
+{
+    fprintf(stderr, "[%s] %s\n", levelName(level), message);
+}
+
+struct LogState
+{
+    std::atomic<int> threshold;
+    std::atomic<Sink> sink;
+};
+
+inline LogState &logState()
+{
+    static LogState state{{INFO}, {stderrSink}};
+    return state;
+}
+
+inline void setSink(Sink sink, Level threshold)
+{
+    logState().sink.store(sink ? sink : stderrSink);
+    logState().threshold.store(threshold);
+}
+
+inline bool enabled(Level level)
+{
+    return level >= logState().threshold.load(std::memory_order_relaxed);
+}
+
+inline void write(Level level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+inline void write(Level level, const char *fmt, ...)
+{
+    char message[1024];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+    logState().sink.load()(level, message);
+}
+
+// true at most once per period_s for one call site, last holds the site's previous time in ns
+inline bool throttle(std::atomic<int64_t> &last, double period_s)
+{
+    const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t prev = last.load(std::memory_order_relaxed);
+    if (prev != 0 && now - prev < static_cast<int64_t>(period_s * 1e9))
+        return false;
+    return last.compare_exchange_strong(prev, now, std::memory_order_relaxed);
+}
+
+[[noreturn]] inline void fail(const char *file, int line, const char *what)
+{
+    write(FATAL, "%s at %s:%d", what, file, line);
+    std::abort();
+}
+}
+
+#define GVINS_LOG(level, ...) \
+    do { if (gvins_log::enabled(level)) gvins_log::write(level, __VA_ARGS__); } while (0)
+#define GVINS_LOG_STREAM(level, args) \
+    do { if (gvins_log::enabled(level)) { std::ostringstream gvins_log_ss; gvins_log_ss << args; \
+        gvins_log::write(level, "%s", gvins_log_ss.str().c_str()); } } while (0)
+#define GVINS_LOG_THROTTLE(level, period, ...) \
+    do { static std::atomic<int64_t> gvins_log_last(0); \
+        if (gvins_log::enabled(level) && gvins_log::throttle(gvins_log_last, period)) \
+            gvins_log::write(level, __VA_ARGS__); } while (0)
+
+#define GVINS_DEBUG(...) GVINS_LOG(gvins_log::DEBUG, __VA_ARGS__)
+#define GVINS_INFO(...) GVINS_LOG(gvins_log::INFO, __VA_ARGS__)
+#define GVINS_WARN(...) GVINS_LOG(gvins_log::WARN, __VA_ARGS__)
+#define GVINS_ERROR(...) GVINS_LOG(gvins_log::ERROR, __VA_ARGS__)
+#define GVINS_DEBUG_STREAM(args) GVINS_LOG_STREAM(gvins_log::DEBUG, args)
+#define GVINS_INFO_STREAM(args) GVINS_LOG_STREAM(gvins_log::INFO, args)
+#define GVINS_WARN_STREAM(args) GVINS_LOG_STREAM(gvins_log::WARN, args)
+#define GVINS_ERROR_STREAM(args) GVINS_LOG_STREAM(gvins_log::ERROR, args)
+#define GVINS_WARN_THROTTLE(period, ...) GVINS_LOG_THROTTLE(gvins_log::WARN, period, __VA_ARGS__)
+
+#define GVINS_BREAK() gvins_log::fail(__FILE__, __LINE__, "GVINS_BREAK")
+#ifdef NDEBUG
+#define GVINS_ASSERT(cond) do {} while (0)
+#define GVINS_ASSERT_MSG(cond, ...) do {} while (0)
+#else
+#define GVINS_ASSERT(cond) \
+    do { if (!(cond)) gvins_log::fail(__FILE__, __LINE__, "assertion failed: " #cond); } while (0)
+#define GVINS_ASSERT_MSG(cond, ...) \
+    do { if (!(cond)) { gvins_log::write(gvins_log::FATAL, __VA_ARGS__); \
+        gvins_log::fail(__FILE__, __LINE__, "assertion failed: " #cond); } } while (0)
+#endif
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <ros/console.h>
+#include "log.h"
+
+/**
+ * 节点一侧: 核心库的日志 (log.h) 转发到 rosconsole 的默认 logger, 阈值取该 logger 当前的级别
+ * (在 installRosLogSink() 时读取一次, 之后用 rqt_logger_level 修改的级别不再同步)
+ */
+namespace gvins_log
+{
+inline void rosSink(Level level, const char *message)
+{
+    switch (level)
+    {
+    case DEBUG: ROS_DEBUG("%s", message); break;
+    case INFO: ROS_INFO("%s", message); break;
+    case WARN: ROS_WARN("%s", message); break;
+    case ERROR: ROS_ERROR("%s", message); break;
+    default: ROS_FATAL("%s", message); break;
+    }
+}
+
+inline void installRosLogSink()
+{
+    Level threshold = INFO;
+    std::map<std::string, ros::console::levels::Level> loggers;
+    if (ros::console::get_loggers(loggers))
+    {
+        std::map<std::string, ros::console::levels::Level>::const_iterator it = loggers.find(ROSCONSOLE_DEFAULT_NAME);
+        if (it != loggers.end())
+            threshold = static_cast<Level>(std::min(static_cast<int>(it->second), static_cast<int>(FATAL)));
+    }
+    setSink(rosSink, threshold);
+}
+}
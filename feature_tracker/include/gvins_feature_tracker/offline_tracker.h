@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/CompressedImage.h>
+#include <sensor_msgs/Imu.h>
+#include <gvins_feature_tracker/FeatureTracks.h>
+
+#define GVINS_TRACKER_EXPORT __attribute__((visibility("default")))
+
+/**
+ * 不经过 ROS 通信的前端, 由离线批处理 (gvins_offline) 在自己的流水线线程中直接调用,
+ * 处理流程与 feature_tracker 节点相同; 库以 -fvisibility=hidden 编译, 只导出下面几个函数,
+ * 前端的全局参数 (ROW, COL, WINDOW_SIZE, ...) 不会与估计器的冲突
+ * 这些函数须在同一个线程中按 bag 顺序调用
+ */
+namespace gvins_feature_tracker
+{
+struct OfflineTrackResult
+{
+    OfflineTrackResult() : restart(false) {}
+
+    FeatureTracksConstPtr tracks;   // null when the frame is not published (first image, frequency control)
+    bool restart;                   // image stream discontinuity, the estimator has to restart
+};
+
+// reads the tracker parameters and camera model from the YAML, returns the image topic
+GVINS_TRACKER_EXPORT std::string offlineTrackerInit(const std::string &config_file, const std::string &gvins_folder);
+
+// gyroscope input of the IMU aided tracking, ignored without imu_aided_tracking
+GVINS_TRACKER_EXPORT void offlineTrackerInputImu(const sensor_msgs::ImuConstPtr &imu_msg);
+
+GVINS_TRACKER_EXPORT OfflineTrackResult offlineTrackImage(const sensor_msgs::ImageConstPtr &img_msg);
+
+// image_compressed: the image topic of the bag carries sensor_msgs/CompressedImage
+GVINS_TRACKER_EXPORT OfflineTrackResult offlineTrackCompressedImage(const sensor_msgs::CompressedImageConstPtr &img_msg);
+}
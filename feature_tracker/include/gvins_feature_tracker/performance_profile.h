@@ -0,0 +1,101 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+/**
+ * 性能档位: YAML 中 performance_profiles 下的命名参数组, 前端和估计器共用 (各取自己的字段, 不依赖 ROS)
+ * 档位中没有的键保持 YAML 顶层的值; "default" 档位即顶层的值, 总是存在
+ * 运行中由估计器节点的 set_performance_profile 服务切换: 估计器在两帧之间应用, 再在 /gvins/performance_profile
+ * 上公布档位名 (latched), 前端在下一帧图像之前应用
+ */
+struct PerformanceProfile
+{
+    std::string name;
+
+    // feature tracker: max_cnt, min_dist, freq; negative keeps the value of the base profile
+    int max_cnt = -1;
+    int min_dist = -1;
+    int freq = -1;
+    // estimator: max_solver_time (s), max_num_iterations, gnss_elevation_thres (degree), gnss_track_num_thres
+    double max_solver_time = -1;
+    int max_num_iterations = -1;
+    double gnss_elevation_thres = -1;
+    int gnss_track_num_thres = -1;
+
+    // the fields set in other replace those of this profile
+    void overlay(const PerformanceProfile &other)
+    {
+        if (other.max_cnt >= 0)
+            max_cnt = other.max_cnt;
+        if (other.min_dist >= 0)
+            min_dist = other.min_dist;
+        if (other.freq >= 0)
+            freq = other.freq;
+        if (other.max_solver_time >= 0)
+            max_solver_time = other.max_solver_time;
+        if (other.max_num_iterations >= 0)
+            max_num_iterations = other.max_num_iterations;
+        if (other.gnss_elevation_thres >= 0)
+            gnss_elevation_thres = other.gnss_elevation_thres;
+        if (other.gnss_track_num_thres >= 0)
+            gnss_track_num_thres = other.gnss_track_num_thres;
+    }
+};
+
+/**
+ * @brief 读取 fsSettings["performance_profiles"] 中的档位
+ * @param base  "default" 档位, 调用者填好自己的顶层参数值, 作为返回值的第一项
+ */
+inline std::vector<PerformanceProfile> readPerformanceProfiles(const cv::FileStorage &fsSettings, const PerformanceProfile &base)
+{
+    std::vector<PerformanceProfile> profiles(1, base);
+    profiles[0].name = "default";
+    const cv::FileNode node = fsSettings["performance_profiles"];
+    if (!node.isMap())
+        return profiles;
+    for (cv::FileNodeIterator it = node.begin(); it != node.end(); ++it)
+    {
+        const cv::FileNode p = *it;
+        PerformanceProfile profile;
+        profile.name = p.name();
+        if (!p["max_cnt"].empty())
+            profile.max_cnt = static_cast<int>(p["max_cnt"]);
+        if (!p["min_dist"].empty())
+            profile.min_dist = static_cast<int>(p["min_dist"]);
+        if (!p["freq"].empty())
+            profile.freq = static_cast<int>(p["freq"]);
+        if (!p["max_solver_time"].empty())
+            profile.max_solver_time = static_cast<double>(p["max_solver_time"]);
+        if (!p["max_num_iterations"].empty())
+            profile.max_num_iterations = static_cast<int>(p["max_num_iterations"]);
+        if (!p["gnss_elevation_thres"].empty())
+            profile.gnss_elevation_thres = static_cast<double>(p["gnss_elevation_thres"]);
+        if (!p["gnss_track_num_thres"].empty())
+            profile.gnss_track_num_thres = static_cast<int>(p["gnss_track_num_thres"]);
+        // "default" stays the top-level values
+        if (profile.name != "default")
+            profiles.push_back(profile);
+    }
+    return profiles;
+}
+
+/**
+ * @brief 档位 name 覆盖在 "default" 上的完整参数
+ * @return false: 没有这个档位, profile 不变
+ */
+inline bool resolvePerformanceProfile(const std::vector<PerformanceProfile> &profiles, const std::string &name,
+                                      PerformanceProfile &profile)
+{
+    for (const PerformanceProfile &p : profiles)
+    {
+        if (p.name != name)
+            continue;
+        profile = profiles[0];
+        profile.overlay(p);
+        profile.name = name;
+        return true;
+    }
+    return false;
+}
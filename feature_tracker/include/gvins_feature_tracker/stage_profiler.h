@@ -0,0 +1,261 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+/**
+ * 各处理阶段的耗时直方图 (p50/p95/p99/max) 和每帧计数, 前端和估计器各一个实例 (同一进程的 nodelet 中因符号隐藏也各自独立),
+ * 每 diagnostics_period 汇总一次并以 diagnostic_msgs 发布到 /diagnostics, 之后重新统计; 本身不依赖 ROS, 核心库中只计数
+ * 阶段名与 gvins_offline --stats / gvins_benchmark_suite 的 stages_ms 相同
+ * 未启用时 record()/ScopedStage 只读一个标志, 不取时间; record() 无锁, 可在任意线程调用
+ */
+class StageProfiler
+{
+  public:
+    enum Stage
+    {
+        TRACKING = 0,
+        PREINTEGRATION,
+        GNSS,
+        ESTIMATE,
+        SOLVER,
+        MARGINALIZATION,
+        PUBLISH,
+        OUTLIER_REJECTION,
+        NUM_STAGES
+    };
+
+    enum Counter
+    {
+        RESIDUAL_BLOCKS = 0,
+        ITERATIONS,
+        FEATURES,
+        SATELLITES,
+        IMU_LAG,            // ms from the stamp of a message to its arrival, per stream
+        FEATURE_LAG,
+        GNSS_LAG,
+        PRIOR_INFO_LOSS,    // nats of KL divergence and us per evaluation saved by the sparsified prior
+        PRIOR_EVAL_SAVED,
+        INLIER_RATIO,       // tracks kept by the outlier rejection, and its RANSAC hypotheses
+        RANSAC_HYPOTHESES,
+        IMAGE_ALLOCATIONS,  // image buffers the tracker (re)allocated for one frame, 0 in steady state
+        NUM_COUNTERS
+    };
+
+    static const char *stageName(int stage)
+    {
+        static const char *const names[NUM_STAGES] = {"tracking", "preintegration", "gnss", "estimate",
+                                                      "solver", "marginalization", "publish", "outlier_rejection"};
+        return names[stage];
+    }
+
+    static const char *counterName(int counter)
+    {
+        static const char *const names[NUM_COUNTERS] = {"residual_blocks", "iterations", "features", "satellites",
+                                                        "imu_lag_ms", "feature_lag_ms", "gnss_lag_ms",
+                                                        "prior_info_loss_nats", "prior_eval_saved_us",
+                                                        "inlier_ratio", "ransac_hypotheses", "image_allocations"};
+        return names[counter];
+    }
+
+    static StageProfiler &instance()
+    {
+        static StageProfiler profiler;
+        return profiler;
+    }
+
+    // period_s <= 0 disables the profiler
+    void setPeriod(double period_s)
+    {
+        period = period_s;
+        last_report = std::chrono::steady_clock::now();
+        is_enabled.store(period_s > 0, std::memory_order_relaxed);
+    }
+    bool enabled() const { return is_enabled.load(std::memory_order_relaxed); }
+
+    void record(Stage stage, double ms)
+    {
+        if (enabled())
+            stages[stage].add(ms);
+    }
+    void count(Counter counter, double value)
+    {
+        if (enabled())
+            counters[counter].add(value);
+    }
+
+    // true once per period, for the thread that publishes the report
+    bool due()
+    {
+        if (!enabled())
+            return false;
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (std::chrono::duration<double>(now - last_report).count() < period)
+            return false;
+        last_report = now;
+        return true;
+    }
+
+    // summary of the period as key/values ("<stage>.p50_ms", "<counter>.mean", ...), the period restarts;
+    // Status is diagnostic_msgs::DiagnosticStatus or a type with the same fields
+    template <typename Status>
+    void takeReport(const std::string &name, Status &status)
+    {
+        status.level = Status::OK;
+        status.name = name;
+        status.hardware_id = "";
+        status.values.clear();
+        size_t num_frames = 0;
+        for (int s = 0; s < NUM_STAGES; ++s)
+        {
+            const Histogram::Summary summary = stages[s].take();
+            if (summary.count == 0)
+                continue;
+            num_frames = std::max(num_frames, static_cast<size_t>(summary.count));
+            const std::string prefix = std::string(stageName(s)) + ".";
+            addValue(status, prefix + "count", summary.count);
+            addValue(status, prefix + "mean_ms", summary.mean);
+            addValue(status, prefix + "p50_ms", summary.p50);
+            addValue(status, prefix + "p95_ms", summary.p95);
+            addValue(status, prefix + "p99_ms", summary.p99);
+            addValue(status, prefix + "max_ms", summary.max);
+        }
+        for (int c = 0; c < NUM_COUNTERS; ++c)
+        {
+            const Histogram::Summary summary = counters[c].take();
+            if (summary.count == 0)
+                continue;
+            const std::string prefix = std::string(counterName(c)) + ".";
+            addValue(status, prefix + "mean", summary.mean);
+            addValue(status, prefix + "p50", summary.p50);
+            addValue(status, prefix + "max", summary.max);
+        }
+        char message[64];
+        snprintf(message, sizeof(message), "%zu frames in %.1f s", num_frames, period);
+        status.message = message;
+    }
+
+  private:
+    /**
+     * 对数分桶: 每 2 倍 4 个桶 (分位数的相对误差 < 10%), 从 1e-3 到约 1.6e4 (ms 或计数), 超出的落入两端的桶;
+     * 总和与最大值以 1e-3 为单位精确累计
+     */
+    class Histogram
+    {
+      public:
+        struct Summary
+        {
+            uint64_t count;
+            double mean, p50, p95, p99, max;
+        };
+
+        Histogram() : sum(0), max_value(0)
+        {
+            for (int i = 0; i < NUM_BUCKETS; ++i)
+                buckets[i].store(0, std::memory_order_relaxed);
+        }
+
+        void add(double value)
+        {
+            const uint64_t fixed = static_cast<uint64_t>(std::max(value, 0.0) * 1e3 + 0.5);
+            const int bucket = fixed < 1 ? 0 : std::min(NUM_BUCKETS - 1,
+                static_cast<int>(BUCKETS_PER_OCTAVE * std::log2(static_cast<double>(fixed))));
+            buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+            sum.fetch_add(fixed, std::memory_order_relaxed);
+            uint64_t prev = max_value.load(std::memory_order_relaxed);
+            while (fixed > prev && !max_value.compare_exchange_weak(prev, fixed, std::memory_order_relaxed))
+                ;
+        }
+
+        Summary take()
+        {
+            uint64_t counts[NUM_BUCKETS];
+            Summary s;
+            s.count = 0;
+            for (int i = 0; i < NUM_BUCKETS; ++i)
+            {
+                counts[i] = buckets[i].exchange(0, std::memory_order_relaxed);
+                s.count += counts[i];
+            }
+            const double total = sum.exchange(0, std::memory_order_relaxed) * 1e-3;
+            s.max = max_value.exchange(0, std::memory_order_relaxed) * 1e-3;
+            s.mean = (s.count ? total / s.count : 0.0);
+            s.p50 = percentile(counts, s.count, 0.50, s.max);
+            s.p95 = percentile(counts, s.count, 0.95, s.max);
+            s.p99 = percentile(counts, s.count, 0.99, s.max);
+            return s;
+        }
+
+      private:
+        static const int BUCKETS_PER_OCTAVE = 4;
+        static const int NUM_BUCKETS = 96;
+
+        // geometric centre of the bucket holding the rank, never above the exact maximum
+        static double percentile(const uint64_t *counts, uint64_t total, double p, double max)
+        {
+            if (total == 0)
+                return 0.0;
+            const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p * total)));
+            uint64_t seen = 0;
+            for (int i = 0; i < NUM_BUCKETS; ++i)
+            {
+                seen += counts[i];
+                if (seen >= rank)
+                    return std::min(max, std::exp2((i + 0.5) / BUCKETS_PER_OCTAVE) * 1e-3);
+            }
+            return max;
+        }
+
+        std::atomic<uint64_t> buckets[NUM_BUCKETS];
+        std::atomic<uint64_t> sum, max_value;
+    };
+
+    StageProfiler() : is_enabled(false), period(0) {}
+    StageProfiler(const StageProfiler&) = delete;
+    StageProfiler& operator=(const StageProfiler&) = delete;
+
+    template <typename Status>
+    static void addValue(Status &status, const std::string &key, double value)
+    {
+        char text[32];
+        snprintf(text, sizeof(text), "%.3f", value);
+        typename decltype(status.values)::value_type kv;
+        kv.key = key;
+        kv.value = text;
+        status.values.push_back(kv);
+    }
+
+    std::atomic<bool> is_enabled;
+    double period;
+    std::chrono::steady_clock::time_point last_report;
+    Histogram stages[NUM_STAGES];
+    Histogram counters[NUM_COUNTERS];
+};
+
+// times the enclosing scope as one sample of stage, reads no clock while the profiler is disabled
+class ScopedStage
+{
+  public:
+    explicit ScopedStage(StageProfiler::Stage _stage)
+        : stage(_stage), active(StageProfiler::instance().enabled())
+    {
+        if (active)
+            start = std::chrono::steady_clock::now();
+    }
+    ~ScopedStage()
+    {
+        if (active)
+            StageProfiler::instance().record(stage,
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+
+  private:
+    StageProfiler::Stage stage;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+};
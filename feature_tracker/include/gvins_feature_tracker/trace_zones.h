@@ -0,0 +1,32 @@
+#pragma once
+
+/**
+ * 追踪分析器 (Tracy) 的区段标注, 用于在同一时间线上查看某一帧超时的原因: ROS 回调, 前端各阶段,
+ * process() 线程, 优化与 Ceres 迭代, 边缘化和工作线程
+ * 仅在以 -DGVINS_TRACE=ON 编译时启用 (定义 GVINS_TRACE 和 TRACY_ENABLE, 链接 TracyClient),
+ * 否则所有宏展开为空, 不引入任何代码; 名字须为字符串字面量
+ */
+#ifdef GVINS_TRACE
+
+#include <tracy/Tracy.hpp>
+
+// the enclosing scope as one zone
+#define GVINS_TRACE_ZONE(name) ZoneScopedN(name)
+// end of one frame of the named sequence ("image", "estimator", ...)
+#define GVINS_TRACE_FRAME(name) FrameMarkNamed(name)
+// an instant event on the current thread's timeline
+#define GVINS_TRACE_MESSAGE(text) TracyMessageL(text)
+// one sample of a value plotted over time
+#define GVINS_TRACE_PLOT(name, value) TracyPlot(name, value)
+// label of the calling thread in the timeline
+#define GVINS_TRACE_THREAD(name) tracy::SetThreadName(name)
+
+#else
+
+#define GVINS_TRACE_ZONE(name)
+#define GVINS_TRACE_FRAME(name)
+#define GVINS_TRACE_MESSAGE(text)
+#define GVINS_TRACE_PLOT(name, value)
+#define GVINS_TRACE_THREAD(name)
+
+#endif
@@ -1,13 +1,19 @@
 #include "feature_tracker.h"
+#include <random>
+#include <gvins_feature_tracker/stage_profiler.h>
+#include <gvins_feature_tracker/trace_zones.h>
 
 int FeatureTracker::n_id = 0;
 
-bool inBorder(const cv::Point2f &pt)
+static const cv::Size LK_WIN_SIZE(21, 21);
+static const int LK_MAX_LEVEL = 3;
+
+bool FeatureTracker::inBorder(const cv::Point2f &pt) const
 {
     const int BORDER_SIZE = 1;
     int img_x = cvRound(pt.x);
     int img_y = cvRound(pt.y);
-    return BORDER_SIZE <= img_x && img_x < COL - BORDER_SIZE && BORDER_SIZE <= img_y && img_y < ROW - BORDER_SIZE;
+    return BORDER_SIZE <= img_x && img_x < config.COL - BORDER_SIZE && BORDER_SIZE <= img_y && img_y < config.ROW - BORDER_SIZE;
 }
 
 void reduceVector(vector<cv::Point2f> &v, vector<uchar> status)
@@ -29,79 +35,423 @@ void reduceVector(vector<int> &v, vector<uchar> status)
 }
 
 
-FeatureTracker::FeatureTracker()
+FeatureTracker::FeatureTracker(const TrackerConfig &_config)
+    : config(_config), clahe(cv::createCLAHE(3.0, cv::Size(8, 8))), num_image_allocations(0), frame_allocations(0),
+      use_gpu(false), has_rotation_prior(false)
+{
+}
+
+std::shared_ptr<cv::Mat> FeatureTracker::freeFrameBuffer()
+{
+    // a header copy (e.g. the image of a pending detection) raises the pixel refcount, not use_count
+    for (const std::shared_ptr<cv::Mat> &buffer : frame_buffers)
+        if (buffer.use_count() == 1 && (!buffer->u || buffer->u->refcount == 1))
+            return buffer;
+    frame_buffers.push_back(std::make_shared<cv::Mat>());
+    return frame_buffers.back();
+}
+
+void FeatureTracker::countAllocation(const cv::Mat &buffer, const uchar *last_data)
+{
+    if (buffer.data != last_data)
+    {
+        num_image_allocations++;
+        frame_allocations++;
+    }
+}
+
+void FeatureTracker::preprocess(const cv::Mat &_img, const std::shared_ptr<const void> &_img_owner,
+                                cv::Mat &img, std::shared_ptr<const void> &img_owner)
 {
+    if (!config.EQUALIZE && _img_owner)
+    {
+        // zero-copy, the owner keeps the buffer valid as long as the image is used
+        img = _img;
+        img_owner = _img_owner;
+        return;
+    }
+    std::shared_ptr<cv::Mat> buffer = freeFrameBuffer();
+    const uchar *last_data = buffer->data;
+    if (config.EQUALIZE)
+    {
+        GVINS_TRACE_ZONE("clahe");
+        TicToc t_c;
+        clahe->apply(_img, *buffer);
+        GVINS_DEBUG("CLAHE costs: %fms", t_c.toc());
+    }
+    else
+        _img.copyTo(*buffer);
+    countAllocation(*buffer, last_data);
+    img = *buffer;
+    img_owner = buffer;
+}
+
+void FeatureTracker::readStereoImage(const cv::Mat &_img)
+{
+    cv::Mat img;
+    std::shared_ptr<const void> img_owner;
+    frame_allocations = 0;
+    preprocess(_img, nullptr, img, img_owner);
+    cur_img = img;
+    cur_img_owner = img_owner;
+}
+
+void FeatureTracker::setRotationPrior(const Eigen::Matrix3d &_R_cur_forw)
+{
+    R_cur_forw = _R_cur_forw;
+    has_rotation_prior = true;
+}
+
+void FeatureTracker::predictPoints()
+{
+    // rotate the undistorted rays of cur_pts into the next camera frame and project them,
+    // translation is ignored which is fine for the short baseline between two images
+    forw_pts.resize(cur_pts.size());
+    for (unsigned int i = 0; i < cur_pts.size(); i++)
+    {
+        Eigen::Vector3d forw_ray = R_cur_forw.transpose() * Eigen::Vector3d(cur_un_pts[i].x, cur_un_pts[i].y, 1.0);
+        if (forw_ray.z() <= 0)
+        {
+            forw_pts[i] = cur_pts[i];
+            continue;
+        }
+        Eigen::Vector2d uv;
+        m_camera->spaceToPlane(forw_ray, uv);
+        forw_pts[i] = cv::Point2f(uv.x(), uv.y());
+    }
+}
+
+bool FeatureTracker::enableGpu()
+{
+#ifdef HAVE_OPENCV_CUDAOPTFLOW
+    if (cv::cuda::getCudaEnabledDeviceCount() <= 0)
+        return false;
+    gpu_lk = cv::cuda::SparsePyrLKOpticalFlow::create(LK_WIN_SIZE, LK_MAX_LEVEL);
+    gpu_detector = cv::cuda::createGoodFeaturesToTrackDetector(CV_8UC1, config.MAX_CNT, 0.01, config.MIN_DIST);
+    use_gpu = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void FeatureTracker::updateDetector()
+{
+    finishDetection();
+#ifdef HAVE_OPENCV_CUDAOPTFLOW
+    if (use_gpu)
+        gpu_detector = cv::cuda::createGoodFeaturesToTrackDetector(CV_8UC1, config.MAX_CNT, 0.01, config.MIN_DIST);
+#endif
+}
+
+void FeatureTracker::trackPoints(vector<uchar> &status)
+{
+    GVINS_TRACE_ZONE("trackPoints");
+#ifdef HAVE_OPENCV_CUDAOPTFLOW
+    if (use_gpu)
+    {
+        gpu_cur_pts.upload(cv::Mat(1, static_cast<int>(cur_pts.size()), CV_32FC2, cur_pts.data()));
+        gpu_lk->setUseInitialFlow(has_rotation_prior);
+        gpu_lk->setMaxLevel(has_rotation_prior ? std::min(config.IMU_LK_MAX_LEVEL, LK_MAX_LEVEL) : LK_MAX_LEVEL);
+        if (has_rotation_prior)
+        {
+            predictPoints();
+            gpu_forw_pts.upload(cv::Mat(1, static_cast<int>(forw_pts.size()), CV_32FC2, forw_pts.data()));
+        }
+        gpu_lk->calc(cur_gpu_img, forw_gpu_img, gpu_cur_pts, gpu_forw_pts, gpu_status);
+        cv::Mat forw_pts_mat, status_mat;
+        gpu_forw_pts.download(forw_pts_mat);
+        gpu_status.download(status_mat);
+        forw_pts.assign(forw_pts_mat.ptr<cv::Point2f>(), forw_pts_mat.ptr<cv::Point2f>() + forw_pts_mat.cols);
+        status.assign(status_mat.ptr<uchar>(), status_mat.ptr<uchar>() + status_mat.cols);
+        return;
+    }
+#endif
+    vector<float> err;
+    int max_level = LK_MAX_LEVEL;
+    int flags = 0;
+    if (has_rotation_prior)
+    {
+        // the prediction absorbs most of the rotational flow, the coarse levels are not needed
+        predictPoints();
+        max_level = std::min(config.IMU_LK_MAX_LEVEL, LK_MAX_LEVEL);
+        flags = cv::OPTFLOW_USE_INITIAL_FLOW;
+    }
+    cv::calcOpticalFlowPyrLK(cur_pyr, forw_pyr, cur_pts, forw_pts, status, err, LK_WIN_SIZE, max_level,
+                             cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.01), flags);
+}
+
+void FeatureTracker::detectPoints(const cv::Mat &img, int n_max_cnt)
+{
+    GVINS_TRACE_ZONE("detectPoints");
+#ifdef HAVE_OPENCV_CUDAOPTFLOW
+    if (use_gpu)
+    {
+        // the detector is built for MAX_CNT corners, sorted by response, keep the best n_max_cnt
+        gpu_mask.upload(mask);
+        gpu_detector->detect(forw_gpu_img, gpu_corners, gpu_mask);
+        n_pts.clear();
+        if (gpu_corners.empty())
+            return;
+        cv::Mat corners;
+        gpu_corners.download(corners);
+        const int n = std::min(corners.cols, n_max_cnt);
+        n_pts.assign(corners.ptr<cv::Point2f>(), corners.ptr<cv::Point2f>() + n);
+        return;
+    }
+#endif
+    cv::goodFeaturesToTrack(img, n_pts, n_max_cnt, 0.01, config.MIN_DIST, mask);
+}
+
+// goodFeaturesToTrack on the under-filled grid cells, one cell per task
+class GridDetector : public cv::ParallelLoopBody
+{
+  public:
+    GridDetector(const TrackerConfig &_config, const cv::Mat &_img, const cv::Mat &_fisheye_mask,
+                 const vector<vector<cv::Point2f>> &_grid_pts, vector<vector<cv::Point2f>> &_candidates,
+                 int _cell_quota, int _cell_w, int _cell_h)
+        : config(_config), img(_img), fisheye_mask(_fisheye_mask), grid_pts(_grid_pts), candidates(_candidates),
+          cell_quota(_cell_quota), cell_w(_cell_w), cell_h(_cell_h)
+    {
+    }
+
+    virtual void operator()(const cv::Range &range) const
+    {
+        for (int cell = range.start; cell < range.end; cell++)
+        {
+            const int num_occupied = static_cast<int>(grid_pts[cell].size());
+            if (num_occupied >= cell_quota)
+                continue;
+            const int cx = cell % config.GRID_COLS, cy = cell / config.GRID_COLS;
+            const cv::Rect roi(cx * cell_w, cy * cell_h,
+                               (cx == config.GRID_COLS - 1 ? config.COL - cx * cell_w : cell_w),
+                               (cy == config.GRID_ROWS - 1 ? config.ROW - cy * cell_h : cell_h));
+            vector<cv::Point2f> &cell_pts = candidates[cell];
+            if (config.FISHEYE)
+                cv::goodFeaturesToTrack(img(roi), cell_pts, cell_quota, 0.01, config.MIN_DIST, fisheye_mask(roi));
+            else
+                cv::goodFeaturesToTrack(img(roi), cell_pts, cell_quota, 0.01, config.MIN_DIST);
+            for (cv::Point2f &p : cell_pts)
+                p += cv::Point2f(roi.x, roi.y);
+        }
+    }
+
+  private:
+    const TrackerConfig &config;
+    const cv::Mat &img;
+    const cv::Mat &fisheye_mask;
+    const vector<vector<cv::Point2f>> &grid_pts;
+    vector<vector<cv::Point2f>> &candidates;
+    const int cell_quota, cell_w, cell_h;
+};
+
+int FeatureTracker::gridCell(const cv::Point2f &pt) const
+{
+    const int cx = std::min(std::max(static_cast<int>(pt.x) / grid_cell_w, 0), config.GRID_COLS - 1);
+    const int cy = std::min(std::max(static_cast<int>(pt.y) / grid_cell_h, 0), config.GRID_ROWS - 1);
+    return cy * config.GRID_COLS + cx;
+}
+
+// same rule as the circles painted by setMask: no accepted point within MIN_DIST,
+// only the cells that a MIN_DIST circle can reach are checked
+bool FeatureTracker::gridFree(const cv::Point2f &pt) const
+{
+    if (config.FISHEYE && fisheye_mask.at<uchar>(pt) != 255)
+        return false;
+    const int cell = gridCell(pt);
+    const int cx = cell % config.GRID_COLS, cy = cell / config.GRID_COLS;
+    const float min_dist2 = static_cast<float>(config.MIN_DIST * config.MIN_DIST);
+    for (int y = std::max(cy - grid_reach_y, 0); y <= std::min(cy + grid_reach_y, config.GRID_ROWS - 1); y++)
+        for (int x = std::max(cx - grid_reach_x, 0); x <= std::min(cx + grid_reach_x, config.GRID_COLS - 1); x++)
+            for (const cv::Point2f &q : grid_pts[y * config.GRID_COLS + x])
+            {
+                const cv::Point2f d = q - pt;
+                if (d.x * d.x + d.y * d.y <= min_dist2)
+                    return false;
+            }
+    return true;
+}
+
+void FeatureTracker::detectGrid(const cv::Mat &img, int n_max_cnt)
+{
+    GVINS_TRACE_ZONE("detectGrid");
+    const int num_cells = config.GRID_ROWS * config.GRID_COLS;
+    const int cell_quota = (config.MAX_CNT + num_cells - 1) / num_cells;
+    vector<vector<cv::Point2f>> candidates(num_cells);
+
+    // only under-filled cells are searched, in parallel; extra candidates make up for
+    // the ones rejected next to existing tracks
+    cv::parallel_for_(cv::Range(0, num_cells), GridDetector(config, img, fisheye_mask, grid_pts, candidates,
+                                                            cell_quota, grid_cell_w, grid_cell_h));
+
+    // serial merge keeps MIN_DIST across cell borders and the global budget
+    n_pts.clear();
+    for (int cell = 0; cell < num_cells && static_cast<int>(n_pts.size()) < n_max_cnt; cell++)
+    {
+        for (const cv::Point2f &p : candidates[cell])
+        {
+            if (static_cast<int>(grid_pts[cell].size()) >= cell_quota || static_cast<int>(n_pts.size()) >= n_max_cnt)
+                break;
+            if (!gridFree(p))
+                continue;
+            grid_pts[cell].push_back(p);
+            n_pts.push_back(p);
+        }
+    }
 }
 
 void FeatureTracker::setMask()
 {
-    if(FISHEYE)
-        mask = fisheye_mask.clone();
+    GVINS_TRACE_ZONE("setMask");
+    if (config.GRID_DETECTION)
+    {
+        grid_cell_w = std::max(config.COL / config.GRID_COLS, 1);
+        grid_cell_h = std::max(config.ROW / config.GRID_ROWS, 1);
+        grid_reach_x = (config.MIN_DIST + grid_cell_w - 1) / grid_cell_w;
+        grid_reach_y = (config.MIN_DIST + grid_cell_h - 1) / grid_cell_h;
+        grid_pts.assign(config.GRID_ROWS * config.GRID_COLS, vector<cv::Point2f>());
+    }
     else
-        mask = cv::Mat(ROW, COL, CV_8UC1, cv::Scalar(255));
+    {
+        // painted over in place, the pending detection that read it was joined before
+        const uchar *last_data = mask.data;
+        if (config.FISHEYE)
+            fisheye_mask.copyTo(mask);
+        else
+        {
+            mask.create(config.ROW, config.COL, CV_8UC1);
+            mask.setTo(cv::Scalar(255));
+        }
+        countAllocation(mask, last_data);
+    }
     
 
-    // prefer to keep features that are tracked for long time
-    vector<pair<int, pair<cv::Point2f, int>>> cnt_pts_id;
-
+    // prefer to keep features that are tracked for long time,
+    // the per-track arrays are permuted through one sorted index list
+    vector<int> order(forw_pts.size());
     for (unsigned int i = 0; i < forw_pts.size(); i++)
-        cnt_pts_id.push_back(make_pair(track_cnt[i], make_pair(forw_pts[i], ids[i])));
+        order[i] = i;
 
-    sort(cnt_pts_id.begin(), cnt_pts_id.end(), [](const pair<int, pair<cv::Point2f, int>> &a, const pair<int, pair<cv::Point2f, int>> &b)
+    sort(order.begin(), order.end(), [this](int a, int b)
          {
-            return a.first > b.first;
+            return track_cnt[a] > track_cnt[b];
          });
 
-    forw_pts.clear();
-    ids.clear();
-    track_cnt.clear();
+    vector<cv::Point2f> old_pts, old_un_pts, old_velocity;
+    vector<int> old_ids, old_cnt;
+    old_pts.swap(forw_pts);
+    old_un_pts.swap(forw_un_pts);
+    old_velocity.swap(pts_velocity);
+    old_ids.swap(ids);
+    old_cnt.swap(track_cnt);
 
-    for (auto &it : cnt_pts_id)
+    for (int i : order)
     {
-        if (mask.at<uchar>(it.second.first) == 255)
+        const cv::Point2f &pt = old_pts[i];
+        if (config.GRID_DETECTION ? gridFree(pt) : mask.at<uchar>(pt) == 255)
         {
-            forw_pts.push_back(it.second.first);
-            ids.push_back(it.second.second);
-            track_cnt.push_back(it.first);
-            cv::circle(mask, it.second.first, MIN_DIST, 0, -1);
+            forw_pts.push_back(pt);
+            forw_un_pts.push_back(old_un_pts[i]);
+            pts_velocity.push_back(old_velocity[i]);
+            ids.push_back(old_ids[i]);
+            track_cnt.push_back(old_cnt[i]);
+            if (config.GRID_DETECTION)
+                grid_pts[gridCell(pt)].push_back(pt);
+            else
+                cv::circle(mask, pt, config.MIN_DIST, 0, -1);
         }
     }
 }
 
 void FeatureTracker::addPoints()
 {
-    for (auto &p : n_pts)
+    GVINS_TRACE_ZONE("addPoints");
+    // new points are lifted once here, tracked ones were lifted by undistortedPoints
+    vector<cv::Point2f> n_un_pts;
+    liftProjective(n_pts, n_un_pts);
+    for (unsigned int i = 0; i < n_pts.size(); i++)
     {
-        forw_pts.push_back(p);
+        forw_pts.push_back(n_pts[i]);
+        forw_un_pts.push_back(n_un_pts[i]);
+        pts_velocity.push_back(cv::Point2f(0, 0));
         ids.push_back(-1);
         track_cnt.push_back(1);
     }
 }
 
-void FeatureTracker::readImage(const cv::Mat &_img, double _cur_time)
+void FeatureTracker::detect(const cv::Mat &img, int n_max_cnt)
+{
+    GVINS_DEBUG("detect feature begins");
+    TicToc t_t;
+    if (n_max_cnt > 0 && config.GRID_DETECTION)
+        detectGrid(img, n_max_cnt);
+    else if (n_max_cnt > 0)
+    {
+        if(mask.empty())
+            cout << "mask is empty " << endl;
+        if (mask.type() != CV_8UC1)
+            cout << "mask type wrong " << endl;
+        if (mask.size() != img.size())
+            cout << "wrong size " << endl;
+        detectPoints(img, n_max_cnt);
+    }
+    else
+        n_pts.clear();
+    GVINS_DEBUG("detect feature costs: %fms", t_t.toc());
+}
+
+void FeatureTracker::finishDetection()
+{
+    if (!pending_detection.valid())
+        return;
+    GVINS_TRACE_ZONE("finishDetection");
+    pending_detection.get();
+    // the tracks of the last image are cur_* already, addPoints appends to forw_pts/forw_un_pts
+    prev_pts.insert(prev_pts.end(), n_pts.begin(), n_pts.end());
+    forw_pts.swap(cur_pts);
+    forw_un_pts.swap(cur_un_pts);
+    addPoints();
+    forw_pts.swap(cur_pts);
+    forw_un_pts.swap(cur_un_pts);
+}
+
+void FeatureTracker::readImage(const cv::Mat &_img, double _cur_time, const std::shared_ptr<const void> &_img_owner)
 {
+    GVINS_TRACE_ZONE("readImage");
     cv::Mat img;
+    std::shared_ptr<const void> img_owner;
     TicToc t_r;
     cur_time = _cur_time;
+    frame_allocations = 0;
 
-    if (EQUALIZE)
-    {
-        cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(3.0, cv::Size(8, 8));
-        TicToc t_c;
-        clahe->apply(_img, img);
-        ROS_DEBUG("CLAHE costs: %fms", t_c.toc());
-    }
-    else
-        img = _img;
+    preprocess(_img, _img_owner, img, img_owner);
 
     if (forw_img.empty())
     {
         prev_img = cur_img = forw_img = img;
+        prev_img_owner = cur_img_owner = forw_img_owner = img_owner;
     }
     else
     {
         forw_img = img;
+        forw_img_owner = img_owner;
+    }
+
+#ifdef HAVE_OPENCV_CUDAOPTFLOW
+    if (use_gpu)
+        forw_gpu_img.upload(forw_img);
+#endif
+    if (!use_gpu)
+    {
+        GVINS_TRACE_ZONE("buildPyramid");
+        TicToc t_p;
+        const uchar *last_data = forw_pyr.empty() ? nullptr : forw_pyr[0].data;
+        cv::buildOpticalFlowPyramid(forw_img, forw_pyr, LK_WIN_SIZE, LK_MAX_LEVEL);
+        countAllocation(forw_pyr[0], last_data);
+        GVINS_DEBUG("build pyramid costs: %fms", t_p.toc());
     }
+    // equalization and pyramid of this image overlapped the detection of the last one
+    finishDetection();
 
     forw_pts.clear();
 
@@ -109,8 +459,7 @@ void FeatureTracker::readImage(const cv::Mat &_img, double _cur_time)
     {
         TicToc t_o;
         vector<uchar> status;
-        vector<float> err;
-        cv::calcOpticalFlowPyrLK(cur_img, forw_img, cur_pts, forw_pts, status, err, cv::Size(21, 21), 3);
+        trackPoints(status);
 
         for (int i = 0; i < int(forw_pts.size()); i++)
             if (status[i] && !inBorder(forw_pts[i]))
@@ -121,84 +470,171 @@ void FeatureTracker::readImage(const cv::Mat &_img, double _cur_time)
         reduceVector(ids, status);
         reduceVector(cur_un_pts, status);
         reduceVector(track_cnt, status);
-        ROS_DEBUG("temporal optical flow costs: %fms", t_o.toc());
+        GVINS_DEBUG("temporal optical flow costs: %fms", t_o.toc());
     }
 
+    TicToc t_u;
+    undistortedPoints();
+    GVINS_DEBUG("undistortion costs: %fms", t_u.toc());
+
     for (auto &n : track_cnt)
         n++;
 
-    if (PUB_THIS_FRAME)
+    if (config.PUB_THIS_FRAME)
     {
         rejectWithF();
-        ROS_DEBUG("set mask begins");
+        GVINS_DEBUG("set mask begins");
         TicToc t_m;
         setMask();
-        ROS_DEBUG("set mask costs %fms", t_m.toc());
+        GVINS_DEBUG("set mask costs %fms", t_m.toc());
 
-        ROS_DEBUG("detect feature begins");
-        TicToc t_t;
-        int n_max_cnt = MAX_CNT - static_cast<int>(forw_pts.size());
-        if (n_max_cnt > 0)
+        const int n_max_cnt = config.MAX_CNT - static_cast<int>(forw_pts.size());
+        if (config.PIPELINED_TRACKING && !use_gpu)
         {
-            if(mask.empty())
-                cout << "mask is empty " << endl;
-            if (mask.type() != CV_8UC1)
-                cout << "mask type wrong " << endl;
-            if (mask.size() != forw_img.size())
-                cout << "wrong size " << endl;
-            cv::goodFeaturesToTrack(forw_img, n_pts, MAX_CNT - forw_pts.size(), 0.01, MIN_DIST, mask);
+            // the new corners have no track yet and are not published with this image,
+            // they join the tracks in the next readImage
+            const cv::Mat img = forw_img;
+            pending_detection = std::async(std::launch::async, [this, img, n_max_cnt]
+            {
+                GVINS_TRACE_ZONE("detectAsync");
+                detect(img, n_max_cnt);
+            });
         }
         else
-            n_pts.clear();
-        ROS_DEBUG("detect feature costs: %fms", t_t.toc());
-
-        ROS_DEBUG("add feature begins");
-        TicToc t_a;
-        addPoints();
-        ROS_DEBUG("selectFeature costs: %fms", t_a.toc());
+        {
+            detect(forw_img, n_max_cnt);
+            GVINS_DEBUG("add feature begins");
+            TicToc t_a;
+            addPoints();
+            GVINS_DEBUG("selectFeature costs: %fms", t_a.toc());
+        }
     }
     prev_img = cur_img;
+    prev_img_owner = cur_img_owner;
     prev_pts = cur_pts;
-    prev_un_pts = cur_un_pts;
+    prev_un_pts.swap(cur_un_pts);
+    cur_un_pts.swap(forw_un_pts);
     cur_img = forw_img;
+    cur_img_owner = forw_img_owner;
+    cur_pyr.swap(forw_pyr);
+    has_rotation_prior = false;
+#ifdef HAVE_OPENCV_CUDAOPTFLOW
+    if (use_gpu)
+        cur_gpu_img.swap(forw_gpu_img);
+#endif
     cur_pts = forw_pts;
-    undistortedPoints();
     prev_time = cur_time;
+    StageProfiler::instance().count(StageProfiler::IMAGE_ALLOCATIONS, frame_allocations);
 }
 
 void FeatureTracker::rejectWithF()
 {
+    GVINS_TRACE_ZONE("rejectWithF");
     if (forw_pts.size() >= 8)
     {
-        ROS_DEBUG("FM ransac begins");
+        GVINS_DEBUG("FM ransac begins");
         TicToc t_f;
-        vector<cv::Point2f> un_cur_pts(cur_pts.size()), un_forw_pts(forw_pts.size());
-        for (unsigned int i = 0; i < cur_pts.size(); i++)
+        vector<uchar> status;
+        int num_hypotheses = 0;
+        const bool rotation_ransac = config.ROTATION_RANSAC && has_rotation_prior;
+        if (rotation_ransac)
+            num_hypotheses = rejectWithRotation(status);
+        else
         {
-            Eigen::Vector3d tmp_p;
-            m_camera->liftProjective(Eigen::Vector2d(cur_pts[i].x, cur_pts[i].y), tmp_p);
-            tmp_p.x() = FOCAL_LENGTH * tmp_p.x() / tmp_p.z() + COL / 2.0;
-            tmp_p.y() = FOCAL_LENGTH * tmp_p.y() / tmp_p.z() + ROW / 2.0;
-            un_cur_pts[i] = cv::Point2f(tmp_p.x(), tmp_p.y());
-
-            m_camera->liftProjective(Eigen::Vector2d(forw_pts[i].x, forw_pts[i].y), tmp_p);
-            tmp_p.x() = FOCAL_LENGTH * tmp_p.x() / tmp_p.z() + COL / 2.0;
-            tmp_p.y() = FOCAL_LENGTH * tmp_p.y() / tmp_p.z() + ROW / 2.0;
-            un_forw_pts[i] = cv::Point2f(tmp_p.x(), tmp_p.y());
+            // cur_un_pts/forw_un_pts are already lifted, only the virtual pinhole projection is left
+            vector<cv::Point2f> un_cur_pts(cur_pts.size()), un_forw_pts(forw_pts.size());
+            for (unsigned int i = 0; i < cur_pts.size(); i++)
+            {
+                un_cur_pts[i] = cv::Point2f(config.FOCAL_LENGTH * cur_un_pts[i].x + config.COL / 2.0,
+                                            config.FOCAL_LENGTH * cur_un_pts[i].y + config.ROW / 2.0);
+                un_forw_pts[i] = cv::Point2f(config.FOCAL_LENGTH * forw_un_pts[i].x + config.COL / 2.0,
+                                             config.FOCAL_LENGTH * forw_un_pts[i].y + config.ROW / 2.0);
+            }
+            cv::findFundamentalMat(un_cur_pts, un_forw_pts, cv::FM_RANSAC, config.F_THRESHOLD, 0.99, status);
         }
-
-        vector<uchar> status;
-        cv::findFundamentalMat(un_cur_pts, un_forw_pts, cv::FM_RANSAC, F_THRESHOLD, 0.99, status);
         int size_a = cur_pts.size();
         reduceVector(prev_pts, status);
         reduceVector(cur_pts, status);
         reduceVector(forw_pts, status);
         reduceVector(cur_un_pts, status);
+        reduceVector(forw_un_pts, status);
+        reduceVector(pts_velocity, status);
         reduceVector(ids, status);
         reduceVector(track_cnt, status);
-        ROS_DEBUG("FM ransac: %d -> %lu: %f", size_a, forw_pts.size(), 1.0 * forw_pts.size() / size_a);
-        ROS_DEBUG("FM ransac costs: %fms", t_f.toc());
+        const double ms = t_f.toc();
+        StageProfiler &profiler = StageProfiler::instance();
+        profiler.record(StageProfiler::OUTLIER_REJECTION, ms);
+        profiler.count(StageProfiler::INLIER_RATIO, 1.0 * forw_pts.size() / size_a);
+        if (rotation_ransac)
+            profiler.count(StageProfiler::RANSAC_HYPOTHESES, num_hypotheses);
+        GVINS_DEBUG("%s ransac: %d -> %lu: %f", rotation_ransac ? "2-point" : "FM", size_a, forw_pts.size(),
+                    1.0 * forw_pts.size() / size_a);
+        GVINS_DEBUG("%s ransac costs: %fms", rotation_ransac ? "2-point" : "FM", ms);
+    }
+}
+
+/**
+ * 已知旋转 R (v_cur = R * v_forw) 时对极约束只剩平移方向: x_cur . (t x R x_forw) = 0, 即 t 与 a = R x_forw x x_cur 正交,
+ * 两个点的 a 叉积即得 t; 内点为到对极线的距离 (虚拟焦距 FOCAL_LENGTH 下) 不超过 F_THRESHOLD 的点, 与基础矩阵的阈值相同
+ * 假设数按当前最优内点率自适应 (置信度 0.99), 纯旋转时所有 a 接近 0, 所有点都是内点
+ */
+int FeatureTracker::rejectWithRotation(vector<uchar> &status) const
+{
+    const int MAX_HYPOTHESES = 200;
+    const double CONFIDENCE = 0.99;
+    const int n = static_cast<int>(forw_pts.size());
+    vector<Eigen::Vector3d> rotated(n), cur_rays(n), normals(n);
+    for (int i = 0; i < n; i++)
+    {
+        rotated[i] = R_cur_forw * Eigen::Vector3d(forw_un_pts[i].x, forw_un_pts[i].y, 1.0);
+        cur_rays[i] = Eigen::Vector3d(cur_un_pts[i].x, cur_un_pts[i].y, 1.0);
+        normals[i] = rotated[i].cross(cur_rays[i]);
+    }
+    const double threshold = config.F_THRESHOLD / config.FOCAL_LENGTH;
+    auto isInlier = [&](const Eigen::Vector3d &t, int i)
+    {
+        const Eigen::Vector3d line = t.cross(rotated[i]);
+        const double norm = line.head<2>().norm();
+        return norm < 1e-12 || std::abs(cur_rays[i].dot(line)) <= threshold * norm;
+    };
+
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> first(0, n - 1), second(0, n - 2);
+    int best_inliers = -1;
+    Eigen::Vector3d best_t = Eigen::Vector3d::Zero();
+    int max_hypotheses = MAX_HYPOTHESES, hypotheses = 0;
+    for (; hypotheses < max_hypotheses; hypotheses++)
+    {
+        const int i = first(rng);
+        int j = second(rng);
+        if (j >= i)
+            j++;
+        Eigen::Vector3d t = normals[i].cross(normals[j]);
+        if (t.norm() < 1e-12)
+            continue;
+        t.normalize();
+        int inliers = 0;
+        for (int k = 0; k < n; k++)
+            inliers += isInlier(t, k);
+        if (inliers > best_inliers)
+        {
+            best_inliers = inliers;
+            best_t = t;
+            const double w = 1.0 * inliers / n;
+            if (w >= 1.0)
+                max_hypotheses = 0;
+            else if (w > 0)
+                max_hypotheses = std::min(MAX_HYPOTHESES,
+                    static_cast<int>(std::ceil(std::log(1 - CONFIDENCE) / std::log(1 - w * w))));
+        }
     }
+
+    status.assign(n, 1);
+    if (best_inliers < 0)
+        return hypotheses;      // no translation direction: pure rotation, everything consistent
+    for (int k = 0; k < n; k++)
+        status[k] = isInlier(best_t, k);
+    return hypotheses;
 }
 
 bool FeatureTracker::updateID(unsigned int i)
@@ -215,92 +651,142 @@ bool FeatureTracker::updateID(unsigned int i)
 
 void FeatureTracker::readIntrinsicParameter(const string &calib_file)
 {
-    ROS_INFO("reading paramerter of camera %s", calib_file.c_str());
+    GVINS_INFO("reading paramerter of camera %s", calib_file.c_str());
     m_camera = CameraFactory::instance()->generateCameraFromYamlFile(calib_file);
+    if (config.UNDISTORTION_LUT)
+    {
+        TicToc t_l;
+        m_undistortion_lut.reset(new UndistortionLUT(m_camera));
+        GVINS_INFO("undistortion table: %zu bytes, built in %fms", m_undistortion_lut->bytes(), t_l.toc());
+    }
+}
+
+void FeatureTracker::liftProjective(const vector<cv::Point2f> &pts, vector<cv::Point2f> &un_pts) const
+{
+    vector<Eigen::Vector3d> rays;
+    liftProjective(pts, rays);
+    un_pts.resize(rays.size());
+    for (size_t i = 0; i < rays.size(); i++)
+        un_pts[i] = cv::Point2f(rays[i].x() / rays[i].z(), rays[i].y() / rays[i].z());
+}
+
+void FeatureTracker::liftProjective(const vector<cv::Point2f> &pts, vector<Eigen::Vector3d> &rays) const
+{
+    rays.resize(pts.size());
+    if (m_undistortion_lut)
+    {
+        for (size_t i = 0; i < pts.size(); i++)
+            m_undistortion_lut->liftProjective(Eigen::Vector2d(pts[i].x, pts[i].y), rays[i]);
+        return;
+    }
+    vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>> p(pts.size());
+    for (size_t i = 0; i < pts.size(); i++)
+        p[i] = Eigen::Vector2d(pts[i].x, pts[i].y);
+    m_camera->liftProjectiveBatch(p.data(), rays.data(), p.size());
 }
 
 void FeatureTracker::showUndistortion(const string &name)
 {
-    cv::Mat undistortedImg(ROW + 600, COL + 600, CV_8UC1, cv::Scalar(0));
-    vector<Eigen::Vector2d> distortedp, undistortedp;
-    for (int i = 0; i < COL; i++)
-        for (int j = 0; j < ROW; j++)
-        {
-            Eigen::Vector2d a(i, j);
-            Eigen::Vector3d b;
-            m_camera->liftProjective(a, b);
-            distortedp.push_back(a);
-            undistortedp.push_back(Eigen::Vector2d(b.x() / b.z(), b.y() / b.z()));
-            //printf("%f,%f->%f,%f,%f\n)\n", a.x(), a.y(), b.x(), b.y(), b.z());
-        }
+    cv::Mat undistortedImg(config.ROW + 600, config.COL + 600, CV_8UC1, cv::Scalar(0));
+    vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>> distortedp, undistortedp;
+    for (int i = 0; i < config.COL; i++)
+        for (int j = 0; j < config.ROW; j++)
+            distortedp.push_back(Eigen::Vector2d(i, j));
+    vector<Eigen::Vector3d> rays(distortedp.size());
+    m_camera->liftProjectiveBatch(distortedp.data(), rays.data(), distortedp.size());
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        const Eigen::Vector3d &b = rays[i];
+        undistortedp.push_back(Eigen::Vector2d(b.x() / b.z(), b.y() / b.z()));
+        //printf("%f,%f->%f,%f,%f\n)\n", distortedp[i].x(), distortedp[i].y(), b.x(), b.y(), b.z());
+    }
     for (int i = 0; i < int(undistortedp.size()); i++)
     {
         cv::Mat pp(3, 1, CV_32FC1);
-        pp.at<float>(0, 0) = undistortedp[i].x() * FOCAL_LENGTH + COL / 2;
-        pp.at<float>(1, 0) = undistortedp[i].y() * FOCAL_LENGTH + ROW / 2;
+        pp.at<float>(0, 0) = undistortedp[i].x() * config.FOCAL_LENGTH + config.COL / 2;
+        pp.at<float>(1, 0) = undistortedp[i].y() * config.FOCAL_LENGTH + config.ROW / 2;
         pp.at<float>(2, 0) = 1.0;
         //cout << trackerData[0].K << endl;
         //printf("%lf %lf\n", p.at<float>(1, 0), p.at<float>(0, 0));
         //printf("%lf %lf\n", pp.at<float>(1, 0), pp.at<float>(0, 0));
-        if (pp.at<float>(1, 0) + 300 >= 0 && pp.at<float>(1, 0) + 300 < ROW + 600 && pp.at<float>(0, 0) + 300 >= 0 && pp.at<float>(0, 0) + 300 < COL + 600)
+        if (pp.at<float>(1, 0) + 300 >= 0 && pp.at<float>(1, 0) + 300 < config.ROW + 600 && pp.at<float>(0, 0) + 300 >= 0 && pp.at<float>(0, 0) + 300 < config.COL + 600)
         {
             undistortedImg.at<uchar>(pp.at<float>(1, 0) + 300, pp.at<float>(0, 0) + 300) = cur_img.at<uchar>(distortedp[i].y(), distortedp[i].x());
         }
         else
         {
-            //ROS_ERROR("(%f %f) -> (%f %f)", distortedp[i].y, distortedp[i].x, pp.at<float>(1, 0), pp.at<float>(0, 0));
+            //GVINS_ERROR("(%f %f) -> (%f %f)", distortedp[i].y, distortedp[i].x, pp.at<float>(1, 0), pp.at<float>(0, 0));
         }
     }
     cv::imshow(name, undistortedImg);
     cv::waitKey(0);
 }
 
-void FeatureTracker::undistortedPoints()
+void FeatureTracker::describePoints(vector<uchar> &descriptors)
+{
+    GVINS_TRACE_ZONE("describePoints");
+    descriptors.assign(cur_pts.size() * DESCRIPTOR_SIZE, 0);
+    if (cur_pts.empty())
+        return;
+    if (orb.empty())
+        orb = cv::ORB::create();
+    // class_id keeps the index, compute drops the keypoints its patch does not fit around
+    vector<cv::KeyPoint> keypoints;
+    keypoints.reserve(cur_pts.size());
+    for (size_t i = 0; i < cur_pts.size(); i++)
+        keypoints.push_back(cv::KeyPoint(cur_pts[i], 31.0f, 0.0f, 0.0f, 0, static_cast<int>(i)));
+    cv::Mat orb_descriptors;
+    orb->compute(cur_img, keypoints, orb_descriptors);
+    for (size_t k = 0; k < keypoints.size(); k++)
+        memcpy(&descriptors[keypoints[k].class_id * DESCRIPTOR_SIZE], orb_descriptors.ptr<uchar>(k), DESCRIPTOR_SIZE);
+}
+
+void FeatureTracker::matchStereo(const FeatureTracker &left)
 {
+    GVINS_TRACE_ZONE("matchStereo");
+    cur_pts.clear();
+    ids.clear();
+    track_cnt.clear();
     cur_un_pts.clear();
-    cur_un_pts_map.clear();
-    //cv::undistortPoints(cur_pts, un_pts, K, cv::Mat());
-    for (unsigned int i = 0; i < cur_pts.size(); i++)
-    {
-        Eigen::Vector2d a(cur_pts[i].x, cur_pts[i].y);
-        Eigen::Vector3d b;
-        m_camera->liftProjective(a, b);
-        cur_un_pts.push_back(cv::Point2f(b.x() / b.z(), b.y() / b.z()));
-        cur_un_pts_map.insert(make_pair(ids[i], cv::Point2f(b.x() / b.z(), b.y() / b.z())));
-        //printf("cur pts id %d %f %f", ids[i], cur_un_pts[i].x, cur_un_pts[i].y);
-    }
-    // caculate points velocity
-    if (!prev_un_pts_map.empty())
+    pts_velocity.clear();
+    if (left.cur_pts.empty() || cur_img.empty())
+        return;
+
+    vector<cv::Point2f> right_pts, back_pts;
+    vector<uchar> status, back_status;
+    vector<float> err;
+    const cv::TermCriteria criteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.01);
+    cv::calcOpticalFlowPyrLK(left.cur_img, cur_img, left.cur_pts, right_pts, status, err, LK_WIN_SIZE,
+                             LK_MAX_LEVEL, criteria);
+    back_pts = left.cur_pts;
+    cv::calcOpticalFlowPyrLK(cur_img, left.cur_img, right_pts, back_pts, back_status, err, LK_WIN_SIZE,
+                             LK_MAX_LEVEL, criteria, cv::OPTFLOW_USE_INITIAL_FLOW);
+    for (size_t i = 0; i < right_pts.size(); i++)
     {
-        double dt = cur_time - prev_time;
-        pts_velocity.clear();
-        for (unsigned int i = 0; i < cur_un_pts.size(); i++)
-        {
-            if (ids[i] != -1)
-            {
-                std::map<int, cv::Point2f>::iterator it;
-                it = prev_un_pts_map.find(ids[i]);
-                if (it != prev_un_pts_map.end())
-                {
-                    double v_x = (cur_un_pts[i].x - it->second.x) / dt;
-                    double v_y = (cur_un_pts[i].y - it->second.y) / dt;
-                    pts_velocity.push_back(cv::Point2f(v_x, v_y));
-                }
-                else
-                    pts_velocity.push_back(cv::Point2f(0, 0));
-            }
-            else
-            {
-                pts_velocity.push_back(cv::Point2f(0, 0));
-            }
-        }
+        const cv::Point2f d = back_pts[i] - left.cur_pts[i];
+        if (status[i] && (!back_status[i] || !inBorder(right_pts[i]) || d.x * d.x + d.y * d.y > 0.25f))
+            status[i] = 0;
     }
-    else
+    cur_pts = right_pts;
+    ids = left.ids;
+    track_cnt = left.track_cnt;
+    reduceVector(cur_pts, status);
+    reduceVector(ids, status);
+    reduceVector(track_cnt, status);
+    liftProjective(cur_pts, cur_un_pts);
+    pts_velocity.assign(cur_pts.size(), cv::Point2f(0, 0));
+}
+
+void FeatureTracker::undistortedPoints()
+{
+    GVINS_TRACE_ZONE("undistortedPoints");
+    // forw_pts are still index-aligned with cur_pts/cur_un_pts here, so the velocity needs no id lookup
+    liftProjective(forw_pts, forw_un_pts);
+    pts_velocity.resize(forw_pts.size());
+    const double dt = cur_time - prev_time;
+    for (unsigned int i = 0; i < forw_pts.size(); i++)
     {
-        for (unsigned int i = 0; i < cur_pts.size(); i++)
-        {
-            pts_velocity.push_back(cv::Point2f(0, 0));
-        }
+        pts_velocity[i] = cv::Point2f((forw_un_pts[i].x - cur_un_pts[i].x) / dt,
+                                      (forw_un_pts[i].y - cur_un_pts[i].y) / dt);
     }
-    prev_un_pts_map = cur_un_pts_map;
 }
@@ -5,13 +5,20 @@
 #include <queue>
 #include <execinfo.h>
 #include <csignal>
+#include <memory>
+#include <future>
 
 #include <opencv2/opencv.hpp>
+#ifdef HAVE_OPENCV_CUDAOPTFLOW
+#include <opencv2/cudaoptflow.hpp>
+#include <opencv2/cudaimgproc.hpp>
+#endif
 #include <eigen3/Eigen/Dense>
 
 #include "camodocal/camera_models/CameraFactory.h"
 #include "camodocal/camera_models/CataCamera.h"
 #include "camodocal/camera_models/PinholeCamera.h"
+#include "camodocal/camera_models/UndistortionLUT.h"
 
 #include "parameters.h"
 #include "tic_toc.h"
@@ -20,7 +27,7 @@ using namespace std;
 using namespace camodocal;
 using namespace Eigen;
 
-bool inBorder(const cv::Point2f &pt);
+const int DESCRIPTOR_SIZE = 32;     // ORB
 
 void reduceVector(vector<cv::Point2f> &v, vector<uchar> status);
 void reduceVector(vector<int> &v, vector<uchar> status);
@@ -28,9 +35,19 @@ void reduceVector(vector<int> &v, vector<uchar> status);
 class FeatureTracker
 {
   public:
-    FeatureTracker();
+    // _config is referenced, not copied: the node's performance profile changes reach the tracker
+    explicit FeatureTracker(const TrackerConfig &_config = PROCESS_TRACKER_CONFIG);
 
-    void readImage(const cv::Mat &_img,double _cur_time);
+    // _img_owner keeps externally owned pixel data (e.g. the ROS message) alive while _img is
+    // referenced as forw/cur/prev image; without an owner a non-equalized image is cloned
+    void readImage(const cv::Mat &_img, double _cur_time,
+                   const std::shared_ptr<const void> &_img_owner = nullptr);
+
+    // stereo_track camera 1: only cur_img, equalized like readImage, matchStereo does the tracking
+    void readStereoImage(const cv::Mat &_img);
+
+    // image buffers allocated since construction (frame pool, mask, LK pyramid); constant in steady state
+    uint64_t imageAllocations() const { return num_image_allocations; }
 
     void setMask();
 
@@ -40,26 +57,114 @@ class FeatureTracker
 
     void readIntrinsicParameter(const string &calib_file);
 
+    // run LK and corner detection on the GPU, false if OpenCV has no CUDA optical flow
+    bool enableGpu();
+
+    // MAX_CNT/MIN_DIST changed (performance profile): waits for the pipelined detection of the last image,
+    // which used the old values, and rebuilds the GPU detector
+    void updateDetector();
+
+    // camera rotation between the current and the next image (v_cur = R_cur_forw * v_forw),
+    // used by the next readImage as LK initial flow
+    void setRotationPrior(const Eigen::Matrix3d &_R_cur_forw);
+
     void showUndistortion(const string &name);
 
+    // outliers of the LK tracks against cur_pts, by rejectWithRotation with rotation_ransac and a rotation prior
     void rejectWithF();
 
+    // lift the tracked forw_pts and compute their velocity against cur_un_pts
     void undistortedPoints();
 
+    // relocalization: upright ORB descriptors (DESCRIPTOR_SIZE bytes each) of cur_pts on cur_img,
+    // all zero for points too close to the border
+    void describePoints(vector<uchar> &descriptors);
+
+    // stereo_track: the features of left (camera 0) found in cur_img by LK with a left-right check,
+    // replacing cur_pts/ids/track_cnt/cur_un_pts of this (camera 1) tracker; no velocity
+    void matchStereo(const FeatureTracker &left);
+
     cv::Mat mask;
     cv::Mat fisheye_mask;
     cv::Mat prev_img, cur_img, forw_img;
+    std::shared_ptr<const void> prev_img_owner, cur_img_owner, forw_img_owner;
     vector<cv::Point2f> n_pts;
     vector<cv::Point2f> prev_pts, cur_pts, forw_pts;
-    vector<cv::Point2f> prev_un_pts, cur_un_pts;
-    vector<cv::Point2f> pts_velocity;
+    // undistorted coordinates are per-track state like ids/track_cnt, each point is lifted once
+    vector<cv::Point2f> prev_un_pts, cur_un_pts, forw_un_pts;
+    vector<cv::Point2f> pts_velocity;       // aligned with forw_pts inside readImage, with cur_pts after it
     vector<int> ids;
     vector<int> track_cnt;
-    map<int, cv::Point2f> cur_un_pts_map;
-    map<int, cv::Point2f> prev_un_pts_map;
     camodocal::CameraPtr m_camera;
+    camodocal::UndistortionLUTConstPtr m_undistortion_lut;
     double cur_time;
     double prev_time;
 
     static int n_id;
+
+  private:
+    const TrackerConfig &config;
+
+    bool inBorder(const cv::Point2f &pt) const;
+
+    // m_camera->liftProjective over all points, through the lookup table when undistortion_lut is set,
+    // otherwise in one call so the camera model runs its batched kernel
+    void liftProjective(const vector<cv::Point2f> &pts, vector<Eigen::Vector3d> &rays) const;
+    // same, as points on the normalized plane
+    void liftProjective(const vector<cv::Point2f> &pts, vector<cv::Point2f> &un_pts) const;
+
+    // grid_detection: cell bookkeeping replacing the full-image mask
+    int gridCell(const cv::Point2f &pt) const;
+    bool gridFree(const cv::Point2f &pt) const;
+    void detectGrid(const cv::Mat &img, int n_max_cnt);
+
+    // 2-point RANSAC over the translation direction, the rotation is R_cur_forw; returns the hypotheses tried
+    int rejectWithRotation(vector<uchar> &status) const;
+
+    void predictPoints();
+    void trackPoints(vector<uchar> &status);
+    void detectPoints(const cv::Mat &img, int n_max_cnt);
+    // n_pts on img, by grid or masked detection
+    void detect(const cv::Mat &img, int n_max_cnt);
+    // pipelined_tracking: adds the corners of the last image to the tracks, once its detection is done
+    void finishDetection();
+
+    // a frame pool image no cv::Mat refers to any more; the pool only grows up to the frames in use
+    std::shared_ptr<cv::Mat> freeFrameBuffer();
+    // _img equalized or copied into a frame pool image, unless _img_owner keeps _img alive
+    void preprocess(const cv::Mat &_img, const std::shared_ptr<const void> &_img_owner,
+                    cv::Mat &img, std::shared_ptr<const void> &img_owner);
+    // counts the buffer as allocated when its pixels moved
+    void countAllocation(const cv::Mat &buffer, const uchar *last_data);
+
+    // LK pyramids of cur/forw image, forw_pyr is built once per frame and becomes cur_pyr,
+    // swapping keeps the level buffers so buildOpticalFlowPyramid does not reallocate
+    vector<cv::Mat> cur_pyr, forw_pyr;
+
+    int grid_cell_w, grid_cell_h, grid_reach_x, grid_reach_y;
+    vector<vector<cv::Point2f>> grid_pts;       // tracked/accepted points per cell
+
+    cv::Ptr<cv::ORB> orb;      // created by the first describePoints
+
+    // equalized/copied images, held through the *_img_owner like the decoder's buffers; the CLAHE object
+    // keeps its internal buffers between frames
+    vector<std::shared_ptr<cv::Mat>> frame_buffers;
+    cv::Ptr<cv::CLAHE> clahe;
+    uint64_t num_image_allocations;
+    int frame_allocations;          // of the current readImage, for the image_allocations counter
+
+    bool use_gpu;
+    bool has_rotation_prior;
+    Eigen::Matrix3d R_cur_forw;
+#ifdef HAVE_OPENCV_CUDAOPTFLOW
+    // forw/cur images stay in device memory, the buffers are swapped instead of reallocated
+    cv::cuda::GpuMat cur_gpu_img, forw_gpu_img;
+    cv::cuda::GpuMat gpu_cur_pts, gpu_forw_pts, gpu_status, gpu_mask, gpu_corners;
+    cv::Ptr<cv::cuda::SparsePyrLKOpticalFlow> gpu_lk;
+    cv::Ptr<cv::cuda::CornersDetector> gpu_detector;
+#endif
+
+    // pipelined_tracking: the corner detection of the last image runs here while its tracks are published and the
+    // next image is equalized; it only writes n_pts (and grid_pts); last member, joined before the others are destroyed
+    std::future<void> pending_detection;
 };
@@ -1,22 +1,41 @@
 #include <ros/ros.h>
 #include <sensor_msgs/Image.h>
+#include <sensor_msgs/CompressedImage.h>
 #include <sensor_msgs/image_encodings.h>
 #include <sensor_msgs/PointCloud.h>
 #include <sensor_msgs/Imu.h>
 #include <std_msgs/Bool.h>
+#include <std_msgs/String.h>
+#include <gvins_feature_tracker/FeatureTracks.h>
+#include <gvins_feature_tracker/EstimatorLoad.h>
+#include <gvins_feature_tracker/log_ros.h>
+#include <gvins_feature_tracker/stage_profiler.h>
+#include <gvins_feature_tracker/trace_zones.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
 #include <cv_bridge/cv_bridge.h>
 #include <message_filters/subscriber.h>
+#include <mutex>
+#include <functional>
+#include <future>
 
 #include "feature_tracker.h"
+#include "image_decoder.h"
 
 #define SHOW_UNDISTORTION 0
 
 vector<uchar> r_status;
 vector<float> r_err;
 queue<sensor_msgs::ImageConstPtr> img_buf;
+deque<pair<double, Eigen::Vector3d>> gyr_buf;     // gyroscope samples since the last tracked image
+double last_track_time = -1;
 
 ros::Publisher pub_img,pub_match;
+ros::Publisher pub_tracks;
 ros::Publisher pub_restart;
+ros::Publisher pub_diagnostics;     // 跟踪和发布耗时的周期汇总 (StageProfiler)
+// 离线处理 (GVINS_OFFLINE) 时不经过 ROS 发布, 特征帧和 restart 直接交给这两个回调
+std::function<void(const gvins_feature_tracker::FeatureTracksConstPtr &)> tracks_sink;
+std::function<void()> restart_sink;
 
 FeatureTracker trackerData[NUM_OF_CAM];
 double first_image_time;
@@ -25,80 +44,387 @@ bool first_image_flag = true;
 double last_image_time = 0;
 bool init_pub = 0;
 
-void img_callback(const sensor_msgs::ImageConstPtr &img_msg)
+// 发布频率上限, 估计器积压时减半, 恢复后逐步回到 FREQ (AIMD)
+const double MIN_PUB_FREQ = 2.0;
+const double PUB_FREQ_STEP = 0.1;       // Hz per unloaded estimator report
+std::mutex m_pub_freq;
+double pub_freq;
+bool pub_freq_changed = false;         // restart the frequency control after a decrease
+double last_decrease_time = -1;
+double published_rate = 0;              // smoothed rate of the published frames
+double last_pub_time = -1;
+uint64_t num_throttled = 0;             // frames not published because of a lowered pub_freq
+
+std::mutex m_profile;
+std::string pending_profile;            // announced by the estimator, applied before the next image
+
+void imu_callback(const sensor_msgs::ImuConstPtr &imu_msg)
+{
+    GVINS_TRACE_ZONE("imu_callback");
+    gyr_buf.emplace_back(imu_msg->header.stamp.toSec(), Eigen::Vector3d(imu_msg->angular_velocity.x, 
+        imu_msg->angular_velocity.y, imu_msg->angular_velocity.z));
+    // no image for a long time, only keep the recent samples
+    while (gyr_buf.size() > 2000)
+        gyr_buf.pop_front();
+}
+
+/**
+ * @brief 积分 (t0, t1] 内的陀螺仪数据, 得到相机在 t1 相对 t0 的旋转 (v_c0 = R_c0_c1 * v_c1)
+ *        每个采样代表它之前一段时间的角速度, IMU 滞后于图像时沿用最后一个采样
+ */
+bool integrateGyro(double t0, double t1, Eigen::Matrix3d &R_c0_c1)
+{
+    if (gyr_buf.empty() || gyr_buf.back().first < t0)
+        return false;
+
+    Eigen::Quaterniond q_i0_i1 = Eigen::Quaterniond::Identity();
+    double t = t0;
+    for (unsigned int k = 0; k < gyr_buf.size() && t < t1; k++)
+    {
+        const double t_next = std::min(gyr_buf[k].first, t1);
+        if (t_next <= t)
+            continue;
+        const Eigen::Vector3d theta = gyr_buf[k].second * (t_next - t);
+        if (theta.norm() > 1e-12)
+            q_i0_i1 = q_i0_i1 * Eigen::Quaterniond(Eigen::AngleAxisd(theta.norm(), theta.normalized()));
+        t = t_next;
+    }
+    if (t < t1)
+    {
+        const Eigen::Vector3d theta = gyr_buf.back().second * (t1 - t);
+        if (theta.norm() > 1e-12)
+            q_i0_i1 = q_i0_i1 * Eigen::Quaterniond(Eigen::AngleAxisd(theta.norm(), theta.normalized()));
+    }
+    // keep the first sample after t1, it covers the beginning of the next interval
+    while (gyr_buf.size() > 1 && gyr_buf.front().first < t1)
+        gyr_buf.pop_front();
+
+    R_c0_c1 = RIC.transpose() * q_i0_i1.normalized().toRotationMatrix() * RIC;
+    return true;
+}
+
+// sensor_msgs::PointCloud, id/u/v/velocity in channels
+void pubFeaturePoints(const std_msgs::Header &header)
+{
+    sensor_msgs::PointCloudPtr feature_points(new sensor_msgs::PointCloud);
+    sensor_msgs::ChannelFloat32 id_of_point;
+    sensor_msgs::ChannelFloat32 u_of_point;
+    sensor_msgs::ChannelFloat32 v_of_point;
+    sensor_msgs::ChannelFloat32 velocity_x_of_point;
+    sensor_msgs::ChannelFloat32 velocity_y_of_point;
+
+    feature_points->header = header;
+    feature_points->header.frame_id = "world";
+
+    vector<set<int>> hash_ids(NUM_OF_CAM);
+    for (int i = 0; i < NUM_OF_CAM; i++)
+    {
+        auto &un_pts = trackerData[i].cur_un_pts;
+        auto &cur_pts = trackerData[i].cur_pts;
+        auto &ids = trackerData[i].ids;
+        auto &pts_velocity = trackerData[i].pts_velocity;
+        for (unsigned int j = 0; j < ids.size(); j++)
+        {
+            if (trackerData[i].track_cnt[j] > 1)
+            {
+                int p_id = ids[j];
+                hash_ids[i].insert(p_id);
+                geometry_msgs::Point32 p;
+                p.x = un_pts[j].x;
+                p.y = un_pts[j].y;
+                p.z = 1;
+
+                feature_points->points.push_back(p);
+                id_of_point.values.push_back(p_id * NUM_OF_CAM + i);
+                u_of_point.values.push_back(cur_pts[j].x);
+                v_of_point.values.push_back(cur_pts[j].y);
+                velocity_x_of_point.values.push_back(pts_velocity[j].x);
+                velocity_y_of_point.values.push_back(pts_velocity[j].y);
+            }
+        }
+    }
+    feature_points->channels.push_back(id_of_point);
+    feature_points->channels.push_back(u_of_point);
+    feature_points->channels.push_back(v_of_point);
+    feature_points->channels.push_back(velocity_x_of_point);
+    feature_points->channels.push_back(velocity_y_of_point);
+    ROS_DEBUG("publish %f, at %f", feature_points->header.stamp.toSec(), ros::Time::now().toSec());
+    // skip the first image; since no optical speed on frist image
+    if (!init_pub)
+    {
+        init_pub = 1;
+    }
+    else
+        pub_img.publish(feature_points);
+}
+
+// gvins_feature_tracker::FeatureTracks, one fixed-width entry per feature
+void pubFeatureTracks(const std_msgs::Header &header)
+{
+    gvins_feature_tracker::FeatureTracksPtr tracks(new gvins_feature_tracker::FeatureTracks);
+    tracks->header = header;
+    tracks->header.frame_id = "world";
+
+    size_t num_tracks = 0;
+    for (int i = 0; i < NUM_OF_CAM; i++)
+        num_tracks += trackerData[i].ids.size();
+    tracks->id.reserve(num_tracks);
+    tracks->x.reserve(num_tracks);
+    tracks->y.reserve(num_tracks);
+    tracks->u.reserve(num_tracks);
+    tracks->v.reserve(num_tracks);
+    tracks->velocity_x.reserve(num_tracks);
+    tracks->velocity_y.reserve(num_tracks);
+    if (RELOCALIZATION)
+        tracks->descriptors.reserve(num_tracks * DESCRIPTOR_SIZE);
+    vector<uchar> descriptors;
+    for (int i = 0; i < NUM_OF_CAM; i++)
+    {
+        FeatureTracker &tracker = trackerData[i];
+        if (RELOCALIZATION)
+            tracker.describePoints(descriptors);
+        for (unsigned int j = 0; j < tracker.ids.size(); j++)
+        {
+            if (tracker.track_cnt[j] > 1)
+            {
+                if (RELOCALIZATION)
+                    tracks->descriptors.insert(tracks->descriptors.end(), descriptors.begin() + j * DESCRIPTOR_SIZE,
+                                               descriptors.begin() + (j + 1) * DESCRIPTOR_SIZE);
+                tracks->id.push_back(tracker.ids[j] * NUM_OF_CAM + i);
+                tracks->x.push_back(tracker.cur_un_pts[j].x);
+                tracks->y.push_back(tracker.cur_un_pts[j].y);
+                tracks->u.push_back(tracker.cur_pts[j].x);
+                tracks->v.push_back(tracker.cur_pts[j].y);
+                tracks->velocity_x.push_back(tracker.pts_velocity[j].x);
+                tracks->velocity_y.push_back(tracker.pts_velocity[j].y);
+            }
+        }
+    }
+    ROS_DEBUG("publish %f, at %f", tracks->header.stamp.toSec(), ros::Time::now().toSec());
+    // skip the first image; since no optical speed on frist image
+    if (!init_pub)
+        init_pub = 1;
+    else if (tracks_sink)
+        tracks_sink(tracks);
+    else
+        pub_tracks.publish(tracks);
+}
+
+void performance_profile_callback(const std_msgs::StringConstPtr &profile_msg)
+{
+    std::lock_guard<std::mutex> lk(m_profile);
+    pending_profile = profile_msg->data;
+}
+
+/**
+ * @brief 估计器切换的性能档位在两帧图像之间应用: 等待上一帧的流水线检测, 重新开始频率控制
+ *        因负载降低了的发布频率保持, 不超过新的 FREQ
+ */
+void applyPendingProfile()
+{
+    std::string profile;
+    {
+        std::lock_guard<std::mutex> lk(m_profile);
+        profile.swap(pending_profile);
+    }
+    if (profile.empty() || profile == PERFORMANCE_PROFILE)
+        return;
+    const int last_freq = FREQ;
+    if (!applyPerformanceProfile(profile))
+    {
+        ROS_WARN("performance profile %s is not in the tracker's performance_profiles, kept %s",
+                 profile.c_str(), PERFORMANCE_PROFILE.c_str());
+        return;
+    }
+    for (int i = 0; i < NUM_OF_CAM; i++)
+        trackerData[i].updateDetector();
+    {
+        std::lock_guard<std::mutex> lk(m_pub_freq);
+        pub_freq = pub_freq >= last_freq ? FREQ : std::min(pub_freq, static_cast<double>(FREQ));
+        pub_freq_changed = true;
+    }
+    ROS_INFO("performance profile %s: max_cnt %d, min_dist %d, freq %d Hz", profile.c_str(), MAX_CNT, MIN_DIST, FREQ);
+}
+
+/**
+ * @brief 估计器负载回调: 积压超过 ADMISSION_MAX_LATENCY 的一半时把发布频率减半 (每 ADMISSION_MAX_LATENCY 至多一次),
+ *        积压不超过一帧时每次加 PUB_FREQ_STEP, 直到 FREQ
+ */
+void estimator_load_callback(const gvins_feature_tracker::EstimatorLoadConstPtr &load_msg)
+{
+    std::lock_guard<std::mutex> lk(m_pub_freq);
+    const double t = load_msg->header.stamp.toSec();
+    if (load_msg->backlog_span > 0.5 * ADMISSION_MAX_LATENCY)
+    {
+        if (last_decrease_time < 0 || t - last_decrease_time > ADMISSION_MAX_LATENCY || t < last_decrease_time)
+        {
+            const double rate = published_rate > 0 ? std::min(pub_freq, published_rate) : pub_freq;
+            pub_freq = std::max(MIN_PUB_FREQ, 0.5 * rate);
+            pub_freq_changed = true;
+            last_decrease_time = t;
+            ROS_WARN("estimator backlog %u frames (%.3f s, %.1f ms per frame, %lu merged), publish rate lowered to %.1f Hz, %lu frames throttled",
+                     load_msg->backlog, load_msg->backlog_span, load_msg->solve_time * 1000.0,
+                     load_msg->merged_frames, pub_freq, num_throttled);
+        }
+    }
+    else if (load_msg->backlog <= 1 && pub_freq < FREQ)
+    {
+        pub_freq = std::min(static_cast<double>(FREQ), pub_freq + PUB_FREQ_STEP);
+        if (pub_freq == FREQ)
+            ROS_INFO("estimator caught up, publish rate back to %d Hz, %lu frames throttled", FREQ, num_throttled);
+    }
+}
+
+// 一个相机的一帧灰度图, owner keeps the pixel buffer alive while the trackers reference it
+struct MonoImage
+{
+    std_msgs::Header header;
+    cv::Mat image;
+    std::shared_ptr<const void> owner;     // null: no image
+};
+
+ImageDecoder image_decoders[NUM_OF_CAM];    // image_compressed: one per camera topic
+
+MonoImage toMono(const sensor_msgs::ImageConstPtr &img_msg)
+{
+    MonoImage mono;
+    mono.header = img_msg->header;
+    if (img_msg->encoding == "8UC1" || img_msg->encoding == sensor_msgs::image_encodings::MONO8)
+    {
+        // already grayscale, wrap the message buffer instead of copying it
+        mono.owner = std::shared_ptr<const void>(img_msg.get(), [img_msg](const void *) {});
+        mono.image = cv::Mat(img_msg->height, img_msg->width, CV_8UC1,
+                             const_cast<uint8_t *>(img_msg->data.data()), img_msg->step);
+        return mono;
+    }
+    cv_bridge::CvImageConstPtr ptr = cv_bridge::toCvCopy(img_msg, sensor_msgs::image_encodings::MONO8);
+    mono.owner = std::shared_ptr<const void>(ptr.get(), [ptr](const void *) {});
+    mono.image = ptr->image;
+    return mono;
+}
+
+// decoded into a pool buffer of the camera's decoder, without an own image copy; owner stays null if it fails
+MonoImage toMono(int cam, const sensor_msgs::CompressedImageConstPtr &img_msg)
+{
+    GVINS_TRACE_ZONE("decodeImage");
+    MonoImage mono;
+    mono.header = img_msg->header;
+    image_decoders[cam].decode(img_msg->format, img_msg->data, mono.image, mono.owner);
+    return mono;
+}
+
+void trackCamera(int i, const cv::Mat &img, double stamp, const std::shared_ptr<const void> &img_owner)
 {
+    ROS_DEBUG("processing camera %d", i);
+    if (i != 1 || !STEREO_TRACK)
+        trackerData[i].readImage(img, stamp, img_owner);
+    else
+        trackerData[i].readStereoImage(img);
+
+#if SHOW_UNDISTORTION
+    trackerData[i].showUndistortion("undistrotion_" + std::to_string(i));
+#endif
+}
+
+/**
+ * @brief 一帧的所有相机: 一条消息时各相机的图像按行拼接 (ROW * i 起), 否则每个相机一条消息
+ *        各相机的跟踪互不依赖, 相机 1.. 各在一个线程中跟踪, 全部结束后再统一分配 ID 和发布
+ */
+void processImages(const std::vector<MonoImage> &images)
+{
+    const std_msgs::Header &header = images[0].header;
+    applyPendingProfile();
     if(first_image_flag)
     {
         first_image_flag = false;
-        first_image_time = img_msg->header.stamp.toSec();
-        last_image_time = img_msg->header.stamp.toSec();
+        first_image_time = header.stamp.toSec();
+        last_image_time = header.stamp.toSec();
         return;
     }
     // detect unstable camera stream
-    if (img_msg->header.stamp.toSec() - last_image_time > 1.0 || img_msg->header.stamp.toSec() < last_image_time)
+    if (header.stamp.toSec() - last_image_time > 1.0 || header.stamp.toSec() < last_image_time)
     {
         ROS_WARN("image discontinue! reset the feature tracker!");
         first_image_flag = true; 
         last_image_time = 0;
+        last_track_time = -1;
         pub_count = 1;
+        if (restart_sink)
+        {
+            restart_sink();
+            return;
+        }
         std_msgs::Bool restart_flag;
         restart_flag.data = true;
         pub_restart.publish(restart_flag);
         return;
     }
-    last_image_time = img_msg->header.stamp.toSec();
-    // frequency control
-    if (round(1.0 * pub_count / (img_msg->header.stamp.toSec() - first_image_time)) <= FREQ)
+    last_image_time = header.stamp.toSec();
+    // frequency control, the limit follows the estimator load
+    double freq;
+    {
+        std::lock_guard<std::mutex> lk(m_pub_freq);
+        freq = pub_freq;
+        if (pub_freq_changed)
+        {
+            pub_freq_changed = false;
+            first_image_time = header.stamp.toSec() - 1.0 / freq;
+            pub_count = 1;
+        }
+    }
+    if (round(1.0 * pub_count / (header.stamp.toSec() - first_image_time)) <= freq)
     {
         PUB_THIS_FRAME = true;
         // reset the frequency control
-        if (abs(1.0 * pub_count / (img_msg->header.stamp.toSec() - first_image_time) - FREQ) < 0.01 * FREQ)
+        if (abs(1.0 * pub_count / (header.stamp.toSec() - first_image_time) - freq) < 0.01 * freq)
         {
-            first_image_time = img_msg->header.stamp.toSec();
+            first_image_time = header.stamp.toSec();
             pub_count = 0;
         }
     }
     else
-        PUB_THIS_FRAME = false;
-
-    cv_bridge::CvImageConstPtr ptr;
-    if (img_msg->encoding == "8UC1")
     {
-        sensor_msgs::Image img;
-        img.header = img_msg->header;
-        img.height = img_msg->height;
-        img.width = img_msg->width;
-        img.is_bigendian = img_msg->is_bigendian;
-        img.step = img_msg->step;
-        img.data = img_msg->data;
-        img.encoding = "mono8";
-        ptr = cv_bridge::toCvCopy(img, sensor_msgs::image_encodings::MONO8);
+        PUB_THIS_FRAME = false;
+        if (freq < FREQ)
+        {
+            std::lock_guard<std::mutex> lk(m_pub_freq);
+            num_throttled++;
+        }
     }
-    else
-        ptr = cv_bridge::toCvCopy(img_msg, sensor_msgs::image_encodings::MONO8);
 
-    cv::Mat show_img = ptr->image;
-    TicToc t_r;
+    std::vector<cv::Mat> cam_images(NUM_OF_CAM);
+    std::vector<std::shared_ptr<const void>> img_owners(NUM_OF_CAM);
     for (int i = 0; i < NUM_OF_CAM; i++)
     {
-        ROS_DEBUG("processing camera %d", i);
-        if (i != 1 || !STEREO_TRACK)
-            trackerData[i].readImage(ptr->image.rowRange(ROW * i, ROW * (i + 1)), img_msg->header.stamp.toSec());
+        if (images.size() == 1)
+        {
+            img_owners[i] = images[0].owner;
+            cam_images[i] = images[0].image.rowRange(ROW * i, ROW * (i + 1));
+        }
         else
         {
-            if (EQUALIZE)
-            {
-                cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE();
-                clahe->apply(ptr->image.rowRange(ROW * i, ROW * (i + 1)), trackerData[i].cur_img);
-            }
-            else
-                trackerData[i].cur_img = ptr->image.rowRange(ROW * i, ROW * (i + 1));
+            img_owners[i] = images[i].owner;
+            cam_images[i] = images[i].image;
         }
+    }
 
-#if SHOW_UNDISTORTION
-        trackerData[i].showUndistortion("undistrotion_" + std::to_string(i));
-#endif
+    TicToc t_r;
+    const double track_time = header.stamp.toSec();
+    Eigen::Matrix3d R_cur_forw;
+    if (IMU_AIDED_TRACKING && last_track_time > 0 && integrateGyro(last_track_time, track_time, R_cur_forw))
+    {
+        for (int i = 0; i < NUM_OF_CAM; i++)
+            trackerData[i].setRotationPrior(R_cur_forw);
     }
+    last_track_time = track_time;
+    // camera 0 on this thread; the ids are assigned below, after all trackers are done
+    std::vector<std::future<void>> camera_workers;
+    for (int i = 1; i < NUM_OF_CAM; i++)
+        camera_workers.push_back(std::async(std::launch::async, trackCamera, i, std::cref(cam_images[i]),
+                                            track_time, std::cref(img_owners[i])));
+    trackCamera(0, cam_images[0], track_time, img_owners[0]);
+    for (std::future<void> &worker : camera_workers)
+        worker.get();
 
     for (unsigned int i = 0;; i++)
     {
@@ -109,71 +435,44 @@ void img_callback(const sensor_msgs::ImageConstPtr &img_msg)
         if (!completed)
             break;
     }
+    // camera 1 takes camera 0's features with their ids, the estimator's stereo depth
+    if (STEREO_TRACK)
+        trackerData[1].matchStereo(trackerData[0]);
+    StageProfiler &profiler = StageProfiler::instance();
+    if (profiler.enabled())
+    {
+        profiler.record(StageProfiler::TRACKING, t_r.toc());
+        profiler.count(StageProfiler::FEATURES, trackerData[0].cur_pts.size());
+    }
 
    if (PUB_THIS_FRAME)
    {
         pub_count++;
-        sensor_msgs::PointCloudPtr feature_points(new sensor_msgs::PointCloud);
-        sensor_msgs::ChannelFloat32 id_of_point;
-        sensor_msgs::ChannelFloat32 u_of_point;
-        sensor_msgs::ChannelFloat32 v_of_point;
-        sensor_msgs::ChannelFloat32 velocity_x_of_point;
-        sensor_msgs::ChannelFloat32 velocity_y_of_point;
-
-        feature_points->header = img_msg->header;
-        feature_points->header.frame_id = "world";
-
-        vector<set<int>> hash_ids(NUM_OF_CAM);
-        for (int i = 0; i < NUM_OF_CAM; i++)
         {
-            auto &un_pts = trackerData[i].cur_un_pts;
-            auto &cur_pts = trackerData[i].cur_pts;
-            auto &ids = trackerData[i].ids;
-            auto &pts_velocity = trackerData[i].pts_velocity;
-            for (unsigned int j = 0; j < ids.size(); j++)
-            {
-                if (trackerData[i].track_cnt[j] > 1)
-                {
-                    int p_id = ids[j];
-                    hash_ids[i].insert(p_id);
-                    geometry_msgs::Point32 p;
-                    p.x = un_pts[j].x;
-                    p.y = un_pts[j].y;
-                    p.z = 1;
-
-                    feature_points->points.push_back(p);
-                    id_of_point.values.push_back(p_id * NUM_OF_CAM + i);
-                    u_of_point.values.push_back(cur_pts[j].x);
-                    v_of_point.values.push_back(cur_pts[j].y);
-                    velocity_x_of_point.values.push_back(pts_velocity[j].x);
-                    velocity_y_of_point.values.push_back(pts_velocity[j].y);
-                }
-            }
+            std::lock_guard<std::mutex> lk(m_pub_freq);
+            const double t = header.stamp.toSec();
+            if (last_pub_time > 0 && t > last_pub_time)
+                published_rate = published_rate > 0 ? 0.9 * published_rate + 0.1 / (t - last_pub_time) : 1.0 / (t - last_pub_time);
+            last_pub_time = t;
         }
-        feature_points->channels.push_back(id_of_point);
-        feature_points->channels.push_back(u_of_point);
-        feature_points->channels.push_back(v_of_point);
-        feature_points->channels.push_back(velocity_x_of_point);
-        feature_points->channels.push_back(velocity_y_of_point);
-        ROS_DEBUG("publish %f, at %f", feature_points->header.stamp.toSec(), ros::Time::now().toSec());
-        // skip the first image; since no optical speed on frist image
-        if (!init_pub)
         {
-            init_pub = 1;
+            GVINS_TRACE_ZONE("publishFeatures");
+            ScopedStage publish_stage(StageProfiler::PUBLISH);
+            if (COMPACT_FEATURE_MSG)
+                pubFeatureTracks(header);
+            else
+                pubFeaturePoints(header);
         }
-        else
-            pub_img.publish(feature_points);
 
         if (SHOW_TRACK)
         {
-            ptr = cv_bridge::cvtColor(ptr, sensor_msgs::image_encodings::BGR8);
-            //cv::Mat stereo_img(ROW * NUM_OF_CAM, COL, CV_8UC3);
-            cv::Mat stereo_img = ptr->image;
+            GVINS_TRACE_ZONE("showTrack");
+            cv::Mat stereo_img(ROW * NUM_OF_CAM, COL, CV_8UC3);
 
             for (int i = 0; i < NUM_OF_CAM; i++)
             {
                 cv::Mat tmp_img = stereo_img.rowRange(i * ROW, (i + 1) * ROW);
-                cv::cvtColor(show_img, tmp_img, CV_GRAY2RGB);
+                cv::cvtColor(cam_images[i], tmp_img, CV_GRAY2RGB);
 
                 for (unsigned int j = 0; j < trackerData[i].cur_pts.size(); j++)
                 {
@@ -197,21 +496,106 @@ void img_callback(const sensor_msgs::ImageConstPtr &img_msg)
             }
             //cv::imshow("vis", stereo_img);
             //cv::waitKey(5);
-            pub_match.publish(ptr->toImageMsg());
+            pub_match.publish(cv_bridge::CvImage(header, sensor_msgs::image_encodings::BGR8,
+                                                 stereo_img).toImageMsg());
         }
     }
     ROS_INFO("whole feature tracker processing costs: %f", t_r.toc());
+
+    if (profiler.due() && pub_diagnostics)
+    {
+        diagnostic_msgs::DiagnosticArray diagnostics;
+        diagnostics.header = header;
+        diagnostics.status.resize(1);
+        profiler.takeReport("gvins: feature tracker stages", diagnostics.status[0]);
+        pub_diagnostics.publish(diagnostics);
+    }
+    GVINS_TRACE_FRAME("image");
 }
 
-int main(int argc, char **argv)
+void img_callback(const sensor_msgs::ImageConstPtr &img_msg)
 {
-    ros::init(argc, argv, "feature_tracker");
-    ros::NodeHandle n("~");
-    ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME, ros::console::levels::Info);
-    readParameters(n);
+    GVINS_TRACE_ZONE("img_callback");
+    processImages(std::vector<MonoImage>{toMono(img_msg)});
+}
+
+void compressed_img_callback(const sensor_msgs::CompressedImageConstPtr &img_msg)
+{
+    GVINS_TRACE_ZONE("img_callback");
+    MonoImage mono = toMono(0, img_msg);
+    if (mono.owner)
+        processImages(std::vector<MonoImage>{mono});
+}
+
+/**
+ * @brief 每个相机一个图像话题时: 各相机最新的一帧, 时间戳相同时作为一帧处理
+ *        更早的图像已不可能凑齐, 直接丢弃
+ */
+std::vector<MonoImage> pending_images(NUM_OF_CAM);
+
+void addCameraImage(int cam, const MonoImage &mono)
+{
+    pending_images[cam] = mono;
+    for (const MonoImage &pending : pending_images)
+    {
+        if (!pending.owner || pending.header.stamp != mono.header.stamp)
+            return;
+    }
+    std::vector<MonoImage> images(NUM_OF_CAM);
+    images.swap(pending_images);
+    processImages(images);
+}
+
+void camera_img_callback(int cam, const sensor_msgs::ImageConstPtr &img_msg)
+{
+    GVINS_TRACE_ZONE("img_callback");
+    addCameraImage(cam, toMono(img_msg));
+}
+
+void camera_compressed_img_callback(int cam, const sensor_msgs::CompressedImageConstPtr &img_msg)
+{
+    GVINS_TRACE_ZONE("img_callback");
+    MonoImage mono = toMono(cam, img_msg);
+    if (mono.owner)
+        addCameraImage(cam, mono);
+}
+
+template <typename T>
+T readParam(ros::NodeHandle &n, std::string name)
+{
+    T ans;
+    if (n.getParam(name, ans))
+    {
+        ROS_INFO_STREAM("Loaded " << name << ": " << ans);
+    }
+    else
+    {
+        ROS_ERROR_STREAM("Failed to load " << name);
+        n.shutdown();
+    }
+    return ans;
+}
+
+// the YAML named by the config_file parameter, gvins_folder locates the camera model and mask
+void readParameters(ros::NodeHandle &n)
+{
+    std::string config_file;
+    config_file = readParam<std::string>(n, "config_file");
+    std::string GVINS_FOLDER_PATH = readParam<std::string>(n, "gvins_folder");
+    readParameters(config_file, GVINS_FOLDER_PATH);
+}
 
+/**
+ * @brief 读取相机内参/掩膜, 参数须已由 readParameters 读取
+ */
+void initFeatureTracker()
+{
     for (int i = 0; i < NUM_OF_CAM; i++)
+    {
         trackerData[i].readIntrinsicParameter(CAM_NAMES[i]);
+        if (USE_GPU && !trackerData[i].enableGpu())
+            ROS_WARN("use_gpu is set but no CUDA device or OpenCV CUDA optical flow, tracking on the CPU");
+    }
 
     if(FISHEYE)
     {
@@ -228,18 +612,139 @@ int main(int argc, char **argv)
         }
     }
 
-    ros::Subscriber sub_img = n.subscribe(IMAGE_TOPIC, 100, img_callback);
+    pub_freq = FREQ;
+}
+
+/**
+ * @brief 初始化前端, 注册发布者和图像订阅, 独立节点和 nodelet 共用
+ */
+std::vector<ros::Subscriber> startFeatureTracker(ros::NodeHandle &n)
+{
+    initFeatureTracker();
+
+    std::vector<ros::Subscriber> subs;
+    if (IMAGE_COMPRESSED && image_decoders[0].hardware())
+        ROS_INFO("compressed images: JPEG decoded with nvJPEG");
+    if (CAMERA_IMAGE_TOPICS.empty())
+    {
+        if (IMAGE_COMPRESSED)
+            subs.push_back(n.subscribe(IMAGE_TOPIC, 100, compressed_img_callback));
+        else
+            subs.push_back(n.subscribe(IMAGE_TOPIC, 100, img_callback));
+    }
+    else
+    {
+        for (int i = 0; i < NUM_OF_CAM; i++)
+        {
+            if (IMAGE_COMPRESSED)
+                subs.push_back(n.subscribe<sensor_msgs::CompressedImage>(CAMERA_IMAGE_TOPICS[i], 100,
+                    std::bind(camera_compressed_img_callback, i, std::placeholders::_1)));
+            else
+                subs.push_back(n.subscribe<sensor_msgs::Image>(CAMERA_IMAGE_TOPICS[i], 100,
+                    std::bind(camera_img_callback, i, std::placeholders::_1)));
+        }
+    }
+    if (ADMISSION_MAX_LATENCY > 0)
+        subs.push_back(n.subscribe("/gvins/estimator_load", 100, estimator_load_callback));
+    if (IMU_AIDED_TRACKING)
+        subs.push_back(n.subscribe(IMU_TOPIC, 2000, imu_callback, ros::TransportHints().tcpNoDelay()));
+    if (PERFORMANCE_PROFILES.size() > 1)
+        subs.push_back(n.subscribe("/gvins/performance_profile", 10, performance_profile_callback));
 
-    pub_img = n.advertise<sensor_msgs::PointCloud>("feature", 1000);
+    if (COMPACT_FEATURE_MSG)
+        pub_tracks = n.advertise<gvins_feature_tracker::FeatureTracks>("feature_tracks", 1000);
+    else
+        pub_img = n.advertise<sensor_msgs::PointCloud>("feature", 1000);
     pub_match = n.advertise<sensor_msgs::Image>("feature_img",1000);
     pub_restart = n.advertise<std_msgs::Bool>("restart",1000);
+    StageProfiler::instance().setPeriod(DIAGNOSTICS_PERIOD);
+    if (DIAGNOSTICS_PERIOD > 0)
+        pub_diagnostics = n.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 10);
     /*
     if (SHOW_TRACK)
         cv::namedWindow("vis", cv::WINDOW_NORMAL);
     */
+    return subs;
+}
+
+#if !defined(GVINS_NODELET) && !defined(GVINS_OFFLINE)
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "feature_tracker");
+    ros::NodeHandle n("~");
+    ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME, ros::console::levels::Info);
+    gvins_log::installRosLogSink();
+    readParameters(n);
+
+    std::vector<ros::Subscriber> subs = startFeatureTracker(n);
     ros::spin();
     return 0;
 }
+#elif defined(GVINS_NODELET)
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+namespace gvins_feature_tracker
+{
+// 与 gvins 估计器 nodelet 放入同一个 manager 时, feature 消息以共享指针传给估计器, 不经过序列化
+class FeatureTrackerNodelet : public nodelet::Nodelet
+{
+  private:
+    virtual void onInit()
+    {
+        ros::NodeHandle &n = getPrivateNodeHandle();
+        gvins_log::installRosLogSink();
+        readParameters(n);
+        subs = startFeatureTracker(n);
+    }
+
+    std::vector<ros::Subscriber> subs;
+};
+}
+
+PLUGINLIB_EXPORT_CLASS(gvins_feature_tracker::FeatureTrackerNodelet, nodelet::Nodelet)
+#else
+#include <gvins_feature_tracker/offline_tracker.h>
+
+namespace gvins_feature_tracker
+{
+static OfflineTrackResult offline_result;
+
+std::string offlineTrackerInit(const std::string &config_file, const std::string &gvins_folder)
+{
+    gvins_log::installRosLogSink();
+    readParameters(config_file, gvins_folder);
+    // the images are not shown and the estimator load is not reported offline
+    SHOW_TRACK = 0;
+    ADMISSION_MAX_LATENCY = 0;
+    COMPACT_FEATURE_MSG = 1;
+    initFeatureTracker();
+    tracks_sink = [](const FeatureTracksConstPtr &tracks) { offline_result.tracks = tracks; };
+    restart_sink = [] { offline_result.restart = true; };
+    return IMAGE_TOPIC;
+}
+
+void offlineTrackerInputImu(const sensor_msgs::ImuConstPtr &imu_msg)
+{
+    if (IMU_AIDED_TRACKING)
+        imu_callback(imu_msg);
+}
+
+OfflineTrackResult offlineTrackImage(const sensor_msgs::ImageConstPtr &img_msg)
+{
+    offline_result = OfflineTrackResult();
+    img_callback(img_msg);
+    return offline_result;
+}
+
+OfflineTrackResult offlineTrackCompressedImage(const sensor_msgs::CompressedImageConstPtr &img_msg)
+{
+    offline_result = OfflineTrackResult();
+    compressed_img_callback(img_msg);
+    return offline_result;
+}
+}
+#endif
 
 
 // new points velocity is 0, pub or not?
@@ -0,0 +1,138 @@
+#include "image_decoder.h"
+
+#include <algorithm>
+#include <cctype>
+
+#ifdef GVINS_NVJPEG
+#include <cuda_runtime_api.h>
+#include <nvjpeg.h>
+#endif
+
+#include <gvins_feature_tracker/log.h>
+
+#ifdef GVINS_NVJPEG
+struct ImageDecoder::Nvjpeg
+{
+    nvjpegHandle_t handle;
+    nvjpegJpegState_t state;
+    cudaStream_t stream;
+    unsigned char *device_buffer;
+    size_t device_size;
+};
+#else
+struct ImageDecoder::Nvjpeg
+{
+};
+#endif
+
+ImageDecoder::ImageDecoder()
+{
+#ifdef GVINS_NVJPEG
+    int num_devices = 0;
+    if (cudaGetDeviceCount(&num_devices) != cudaSuccess || num_devices <= 0)
+        return;
+    std::unique_ptr<Nvjpeg> decoder(new Nvjpeg());
+    if (nvjpegCreateSimple(&decoder->handle) != NVJPEG_STATUS_SUCCESS)
+        return;
+    if (nvjpegJpegStateCreate(decoder->handle, &decoder->state) != NVJPEG_STATUS_SUCCESS)
+    {
+        nvjpegDestroy(decoder->handle);
+        return;
+    }
+    cudaStreamCreate(&decoder->stream);
+    decoder->device_buffer = nullptr;
+    decoder->device_size = 0;
+    nvjpeg = std::move(decoder);
+#endif
+}
+
+ImageDecoder::~ImageDecoder()
+{
+#ifdef GVINS_NVJPEG
+    if (nvjpeg)
+    {
+        cudaFree(nvjpeg->device_buffer);
+        cudaStreamDestroy(nvjpeg->stream);
+        nvjpegJpegStateDestroy(nvjpeg->state);
+        nvjpegDestroy(nvjpeg->handle);
+    }
+#endif
+}
+
+bool ImageDecoder::hardware() const
+{
+    return nvjpeg != nullptr;
+}
+
+// a pool image no frame holds any more, the pool only grows while the trackers keep more frames than it has
+std::shared_ptr<cv::Mat> ImageDecoder::freeBuffer()
+{
+    for (const std::shared_ptr<cv::Mat> &buffer : buffers)
+        if (buffer.use_count() == 1)
+            return buffer;
+    buffers.push_back(std::make_shared<cv::Mat>());
+    return buffers.back();
+}
+
+bool ImageDecoder::decode(const std::string &format, const std::vector<uint8_t> &data, cv::Mat &gray,
+                          std::shared_ptr<const void> &owner)
+{
+    std::string lower_format(format);
+    std::transform(lower_format.begin(), lower_format.end(), lower_format.begin(), ::tolower);
+    const bool jpeg = lower_format.find("jpeg") != std::string::npos || lower_format.find("jpg") != std::string::npos;
+
+    std::shared_ptr<cv::Mat> buffer = freeBuffer();
+    if (!(jpeg && nvjpeg && decodeHardware(data, *buffer)))
+    {
+        // decodes into the buffer, reusing its pixels when the size matches
+        cv::imdecode(data, cv::IMREAD_GRAYSCALE, buffer.get());
+    }
+    if (buffer->empty())
+    {
+        GVINS_WARN_THROTTLE(1.0, "cannot decode the compressed image (format \"%s\", %lu bytes)",
+                            format.c_str(), static_cast<unsigned long>(data.size()));
+        return false;
+    }
+    gray = *buffer;
+    owner = buffer;
+    return true;
+}
+
+bool ImageDecoder::decodeHardware(const std::vector<uint8_t> &data, cv::Mat &gray)
+{
+#ifdef GVINS_NVJPEG
+    int num_components = 0;
+    nvjpegChromaSubsampling_t subsampling;
+    int widths[NVJPEG_MAX_COMPONENT], heights[NVJPEG_MAX_COMPONENT];
+    if (nvjpegGetImageInfo(nvjpeg->handle, data.data(), data.size(), &num_components, &subsampling,
+                           widths, heights) != NVJPEG_STATUS_SUCCESS)
+        return false;
+    const int width = widths[0], height = heights[0];
+    const size_t size = static_cast<size_t>(width) * height;
+    if (size > nvjpeg->device_size)
+    {
+        cudaFree(nvjpeg->device_buffer);
+        nvjpeg->device_buffer = nullptr;
+        nvjpeg->device_size = 0;
+        if (cudaMalloc(reinterpret_cast<void **>(&nvjpeg->device_buffer), size) != cudaSuccess)
+            return false;
+        nvjpeg->device_size = size;
+    }
+
+    // luma only: the grayscale image without a color conversion
+    nvjpegImage_t output = {};
+    output.channel[0] = nvjpeg->device_buffer;
+    output.pitch[0] = width;
+    if (nvjpegDecode(nvjpeg->handle, nvjpeg->state, data.data(), data.size(), NVJPEG_OUTPUT_Y,
+                     &output, nvjpeg->stream) != NVJPEG_STATUS_SUCCESS)
+        return false;
+    gray.create(height, width, CV_8UC1);
+    cudaMemcpy2DAsync(gray.data, gray.step, nvjpeg->device_buffer, width, width, height,
+                      cudaMemcpyDeviceToHost, nvjpeg->stream);
+    return cudaStreamSynchronize(nvjpeg->stream) == cudaSuccess;
+#else
+    (void)data;
+    (void)gray;
+    return false;
+#endif
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * 压缩图像 (sensor_msgs/CompressedImage 的 JPEG/PNG) 直接解码为灰度图, 不再需要 image_transport republish 节点
+ * 解码结果写入缓冲池中的图像: 跟踪器通过 owner 持有上一帧, 池中没有空闲缓冲时才新分配, 稳定后不再分配内存
+ * 以 GVINS_NVJPEG 编译且有 CUDA 设备时 JPEG 由 nvJPEG 在 GPU 上解码 (只输出亮度通道), 否则及 PNG 用 cv::imdecode
+ * 每个相机一个解码器, 不能在多个线程中同时使用
+ */
+class ImageDecoder
+{
+  public:
+    ImageDecoder();
+    ~ImageDecoder();
+
+    /**
+     * @param format CompressedImage::format, e.g. "jpeg", "mono8; jpeg compressed mono8"
+     * @param gray  decoded grayscale image, valid as long as owner is held
+     * @return false if the data cannot be decoded
+     */
+    bool decode(const std::string &format, const std::vector<uint8_t> &data, cv::Mat &gray, std::shared_ptr<const void> &owner);
+
+    bool hardware() const;
+
+  private:
+    std::shared_ptr<cv::Mat> freeBuffer();
+    bool decodeHardware(const std::vector<uint8_t> &data, cv::Mat &gray);
+
+    std::vector<std::shared_ptr<cv::Mat>> buffers;
+
+    struct Nvjpeg;
+    std::unique_ptr<Nvjpeg> nvjpeg;     // null without GVINS_NVJPEG or a CUDA device
+};
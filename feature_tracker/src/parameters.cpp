@@ -1,74 +1,174 @@
 #include "parameters.h"
+#include <opencv2/core/eigen.hpp>
 
-std::string IMAGE_TOPIC;
-std::string IMU_TOPIC;
-std::vector<std::string> CAM_NAMES;
-std::string FISHEYE_MASK;
-int MAX_CNT;
-int MIN_DIST;
-int WINDOW_SIZE;
-int FREQ;
-double F_THRESHOLD;
-int SHOW_TRACK;
-int STEREO_TRACK;
-int EQUALIZE;
-int ROW;
-int COL;
-int FOCAL_LENGTH;
-int FISHEYE;
-bool PUB_THIS_FRAME;
+TrackerConfig PROCESS_TRACKER_CONFIG;
 
-template <typename T>
-T readParam(ros::NodeHandle &n, std::string name)
+std::string &IMAGE_TOPIC = PROCESS_TRACKER_CONFIG.IMAGE_TOPIC;
+std::vector<std::string> &CAMERA_IMAGE_TOPICS = PROCESS_TRACKER_CONFIG.CAMERA_IMAGE_TOPICS;
+int &IMAGE_COMPRESSED = PROCESS_TRACKER_CONFIG.IMAGE_COMPRESSED;
+std::string &IMU_TOPIC = PROCESS_TRACKER_CONFIG.IMU_TOPIC;
+std::string &FISHEYE_MASK = PROCESS_TRACKER_CONFIG.FISHEYE_MASK;
+std::vector<std::string> &CAM_NAMES = PROCESS_TRACKER_CONFIG.CAM_NAMES;
+int &ROW = PROCESS_TRACKER_CONFIG.ROW;
+int &COL = PROCESS_TRACKER_CONFIG.COL;
+int &FOCAL_LENGTH = PROCESS_TRACKER_CONFIG.FOCAL_LENGTH;
+int &MAX_CNT = PROCESS_TRACKER_CONFIG.MAX_CNT;
+int &MIN_DIST = PROCESS_TRACKER_CONFIG.MIN_DIST;
+int &WINDOW_SIZE = PROCESS_TRACKER_CONFIG.WINDOW_SIZE;
+int &FREQ = PROCESS_TRACKER_CONFIG.FREQ;
+double &ADMISSION_MAX_LATENCY = PROCESS_TRACKER_CONFIG.ADMISSION_MAX_LATENCY;
+double &DIAGNOSTICS_PERIOD = PROCESS_TRACKER_CONFIG.DIAGNOSTICS_PERIOD;
+double &F_THRESHOLD = PROCESS_TRACKER_CONFIG.F_THRESHOLD;
+int &SHOW_TRACK = PROCESS_TRACKER_CONFIG.SHOW_TRACK;
+int &STEREO_TRACK = PROCESS_TRACKER_CONFIG.STEREO_TRACK;
+int &EQUALIZE = PROCESS_TRACKER_CONFIG.EQUALIZE;
+int &FISHEYE = PROCESS_TRACKER_CONFIG.FISHEYE;
+bool &PUB_THIS_FRAME = PROCESS_TRACKER_CONFIG.PUB_THIS_FRAME;
+int &COMPACT_FEATURE_MSG = PROCESS_TRACKER_CONFIG.COMPACT_FEATURE_MSG;
+int &USE_GPU = PROCESS_TRACKER_CONFIG.USE_GPU;
+int &IMU_AIDED_TRACKING = PROCESS_TRACKER_CONFIG.IMU_AIDED_TRACKING;
+int &UNDISTORTION_LUT = PROCESS_TRACKER_CONFIG.UNDISTORTION_LUT;
+int &GRID_DETECTION = PROCESS_TRACKER_CONFIG.GRID_DETECTION;
+int &GRID_ROWS = PROCESS_TRACKER_CONFIG.GRID_ROWS;
+int &GRID_COLS = PROCESS_TRACKER_CONFIG.GRID_COLS;
+int &IMU_LK_MAX_LEVEL = PROCESS_TRACKER_CONFIG.IMU_LK_MAX_LEVEL;
+int &PIPELINED_TRACKING = PROCESS_TRACKER_CONFIG.PIPELINED_TRACKING;
+int &ROTATION_RANSAC = PROCESS_TRACKER_CONFIG.ROTATION_RANSAC;
+int &RELOCALIZATION = PROCESS_TRACKER_CONFIG.RELOCALIZATION;
+Eigen::Matrix3d &RIC = PROCESS_TRACKER_CONFIG.RIC;
+std::vector<PerformanceProfile> &PERFORMANCE_PROFILES = PROCESS_TRACKER_CONFIG.PERFORMANCE_PROFILES;
+std::string &PERFORMANCE_PROFILE = PROCESS_TRACKER_CONFIG.PERFORMANCE_PROFILE;
+
+void loadConfig(const std::string &config_file, const std::string &GVINS_FOLDER_PATH, TrackerConfig &config)
 {
-    T ans;
-    if (n.getParam(name, ans))
+    cv::FileStorage fsSettings(config_file, cv::FileStorage::READ);
+    if(!fsSettings.isOpened())
+    {
+        std::cerr << "ERROR: Wrong path to settings" << std::endl;
+    }
+
+    fsSettings["image_topic"] >> config.IMAGE_TOPIC;
+    fsSettings["imu_topic"] >> config.IMU_TOPIC;
+    // image_topic is camera 0, image_topic_<i> the others
+    config.CAMERA_IMAGE_TOPICS.clear();
+    if (NUM_OF_CAM > 1 && !fsSettings["image_topic_1"].empty())
     {
-        ROS_INFO_STREAM("Loaded " << name << ": " << ans);
+        config.CAMERA_IMAGE_TOPICS.push_back(config.IMAGE_TOPIC);
+        for (int i = 1; i < NUM_OF_CAM; i++)
+        {
+            std::string topic;
+            fsSettings["image_topic_" + std::to_string(i)] >> topic;
+            config.CAMERA_IMAGE_TOPICS.push_back(topic);
+        }
     }
+    config.IMAGE_COMPRESSED = fsSettings["image_compressed"];
+    config.MAX_CNT = fsSettings["max_cnt"];
+    config.MIN_DIST = fsSettings["min_dist"];
+    config.ROW = fsSettings["image_height"];
+    config.COL = fsSettings["image_width"];
+    config.FREQ = fsSettings["freq"];
+    config.ADMISSION_MAX_LATENCY = fsSettings["admission_max_latency"];
+    config.DIAGNOSTICS_PERIOD = fsSettings["diagnostics_period"];
+    config.F_THRESHOLD = fsSettings["F_threshold"];
+    config.SHOW_TRACK = fsSettings["show_track"];
+    config.EQUALIZE = fsSettings["equalize"];
+    config.FISHEYE = fsSettings["fisheye"];
+    config.COMPACT_FEATURE_MSG = fsSettings["compact_feature_msg"];
+    config.USE_GPU = fsSettings["use_gpu"];
+    config.UNDISTORTION_LUT = fsSettings["undistortion_lut"];
+    config.GRID_DETECTION = fsSettings["grid_detection"];
+    if (fsSettings["grid_rows"].empty())
+        config.GRID_ROWS = 4;
+    else
+        config.GRID_ROWS = fsSettings["grid_rows"];
+    if (fsSettings["grid_cols"].empty())
+        config.GRID_COLS = 5;
+    else
+        config.GRID_COLS = fsSettings["grid_cols"];
+    config.IMU_AIDED_TRACKING = fsSettings["imu_aided_tracking"];
+    config.RELOCALIZATION = fsSettings["relocalization"];
+    if (fsSettings["imu_lk_max_level"].empty())
+        config.IMU_LK_MAX_LEVEL = 1;
     else
+        config.IMU_LK_MAX_LEVEL = fsSettings["imu_lk_max_level"];
+    config.PIPELINED_TRACKING = fsSettings["pipelined_tracking"];
+    config.ROTATION_RANSAC = fsSettings["rotation_ransac"];
+    if (config.ROTATION_RANSAC && !config.IMU_AIDED_TRACKING)
+        GVINS_WARN("rotation_ransac needs the rotation of imu_aided_tracking, the fundamental matrix is used");
+    config.RIC.setIdentity();
+    if (config.IMU_AIDED_TRACKING)
     {
-        ROS_ERROR_STREAM("Failed to load " << name);
-        n.shutdown();
+        // the rotation prediction needs the camera-IMU rotation
+        cv::Mat cv_R;
+        fsSettings["extrinsicRotation"] >> cv_R;
+        if (cv_R.empty())
+        {
+            GVINS_WARN("imu_aided_tracking needs extrinsicRotation, disabled");
+            config.IMU_AIDED_TRACKING = 0;
+        }
+        else
+        {
+            cv::cv2eigen(cv_R, config.RIC);
+            config.RIC = Eigen::Quaterniond(config.RIC).normalized().toRotationMatrix();
+        }
     }
-    return ans;
-}
-
-void readParameters(ros::NodeHandle &n)
-{
-    std::string config_file;
-    config_file = readParam<std::string>(n, "config_file");
-    cv::FileStorage fsSettings(config_file, cv::FileStorage::READ);
-    if(!fsSettings.isOpened())
+    if (config.FISHEYE == 1)
+        config.FISHEYE_MASK = GVINS_FOLDER_PATH + "config/fisheye_mask.jpg";
+    config.CAM_NAMES.clear();
+    config.CAM_NAMES.push_back(config_file);
+    // camera_config_<i>: calibration of camera i, relative to the config directory; camera 0's without it
+    const std::string config_dir = config_file.substr(0, config_file.find_last_of('/') + 1);
+    for (int i = 1; i < NUM_OF_CAM; i++)
     {
-        std::cerr << "ERROR: Wrong path to settings" << std::endl;
+        std::string camera_config;
+        if (!fsSettings["camera_config_" + std::to_string(i)].empty())
+            fsSettings["camera_config_" + std::to_string(i)] >> camera_config;
+        config.CAM_NAMES.push_back(camera_config.empty() ? config_file : config_dir + camera_config);
     }
-    std::string GVINS_FOLDER_PATH = readParam<std::string>(n, "gvins_folder");
 
-    fsSettings["image_topic"] >> IMAGE_TOPIC;
-    fsSettings["imu_topic"] >> IMU_TOPIC;
-    MAX_CNT = fsSettings["max_cnt"];
-    MIN_DIST = fsSettings["min_dist"];
-    ROW = fsSettings["image_height"];
-    COL = fsSettings["image_width"];
-    FREQ = fsSettings["freq"];
-    F_THRESHOLD = fsSettings["F_threshold"];
-    SHOW_TRACK = fsSettings["show_track"];
-    EQUALIZE = fsSettings["equalize"];
-    FISHEYE = fsSettings["fisheye"];
-    if (FISHEYE == 1)
-        FISHEYE_MASK = GVINS_FOLDER_PATH + "config/fisheye_mask.jpg";
-    CAM_NAMES.push_back(config_file);
+    config.WINDOW_SIZE = 20;
+    int stereo_track_value = fsSettings["stereo_track"];
+    config.STEREO_TRACK = (NUM_OF_CAM == 2 && stereo_track_value != 0);
+    if (stereo_track_value != 0 && NUM_OF_CAM != 2)
+        GVINS_WARN("stereo_track needs a tracker built with GVINS_NUM_OF_CAM=2, disabled");
+    config.FOCAL_LENGTH = 460;
+    config.PUB_THIS_FRAME = false;
 
-    WINDOW_SIZE = 20;
-    STEREO_TRACK = false;
-    FOCAL_LENGTH = 460;
-    PUB_THIS_FRAME = false;
+    if (config.FREQ == 0)
+        config.FREQ = 100;
 
-    if (FREQ == 0)
-        FREQ = 100;
+    PerformanceProfile base;
+    base.max_cnt = config.MAX_CNT;
+    base.min_dist = config.MIN_DIST;
+    base.freq = config.FREQ;
+    config.PERFORMANCE_PROFILES = readPerformanceProfiles(fsSettings, base);
+    std::string profile_name = "default";
+    if (!fsSettings["performance_profile"].empty())
+        fsSettings["performance_profile"] >> profile_name;
+    if (!applyPerformanceProfile(profile_name, config))
+    {
+        GVINS_WARN("performance_profile %s is not in performance_profiles, default used", profile_name.c_str());
+        applyPerformanceProfile("default", config);
+    }
 
     fsSettings.release();
 
 
 }
+
+void readParameters(const std::string &config_file, const std::string &GVINS_FOLDER_PATH)
+{
+    loadConfig(config_file, GVINS_FOLDER_PATH, PROCESS_TRACKER_CONFIG);
+}
+
+bool applyPerformanceProfile(const std::string &name, TrackerConfig &config)
+{
+    PerformanceProfile profile;
+    if (!resolvePerformanceProfile(config.PERFORMANCE_PROFILES, name, profile))
+        return false;
+    config.MAX_CNT = profile.max_cnt;
+    config.MIN_DIST = profile.min_dist;
+    config.FREQ = profile.freq == 0 ? 100 : profile.freq;
+    config.PERFORMANCE_PROFILE = name;
+    return true;
+}
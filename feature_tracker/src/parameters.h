@@ -1,26 +1,105 @@
 #pragma once
-#include <ros/ros.h>
+#include <iostream>
+#include <string>
+#include <vector>
 #include <opencv2/highgui/highgui.hpp>
+#include <eigen3/Eigen/Dense>
+#include <gvins_feature_tracker/log.h>
+#include <gvins_feature_tracker/performance_profile.h>
 
-extern int ROW;
-extern int COL;
-extern int FOCAL_LENGTH;
-const int NUM_OF_CAM = 1;
+#ifndef GVINS_NUM_OF_CAM
+#define GVINS_NUM_OF_CAM 1
+#endif
+const int NUM_OF_CAM = GVINS_NUM_OF_CAM;
 
+/**
+ * 一个前端的全部参数, 由 loadConfig 从 YAML 填写; FeatureTracker 引用构造时给定的配置,
+ * 同一进程中的多个前端可以有不同的相机和设置
+ */
+struct TrackerConfig
+{
+    std::string IMAGE_TOPIC;
+    std::vector<std::string> CAMERA_IMAGE_TOPICS;  // one per camera, empty: the cameras are row-stacked in IMAGE_TOPIC
+    int IMAGE_COMPRESSED;                          // the image topics carry sensor_msgs/CompressedImage
+    std::string IMU_TOPIC;
+    std::string FISHEYE_MASK;
+    std::vector<std::string> CAM_NAMES;
+    int ROW;
+    int COL;
+    int FOCAL_LENGTH;
+    int MAX_CNT;
+    int MIN_DIST;
+    int WINDOW_SIZE;
+    int FREQ;
+    double ADMISSION_MAX_LATENCY;
+    double DIAGNOSTICS_PERIOD;
+    double F_THRESHOLD;
+    int SHOW_TRACK;
+    int STEREO_TRACK;                              // camera 1 is not tracked, camera 0's features are matched into it
+    int EQUALIZE;
+    int FISHEYE;
+    bool PUB_THIS_FRAME;                           // set by the node before readImage, by the frequency control
+    int COMPACT_FEATURE_MSG;
+    int USE_GPU;
+    int IMU_AIDED_TRACKING;
+    int UNDISTORTION_LUT;
+    int GRID_DETECTION;
+    int GRID_ROWS;
+    int GRID_COLS;
+    int IMU_LK_MAX_LEVEL;
+    int PIPELINED_TRACKING;   // corner detection in the background, overlapping the publishing and the next image
+    int ROTATION_RANSAC;      // 2-point translation RANSAC when the gyroscope rotation is known, else fundamental matrix
+    int RELOCALIZATION;       // feature descriptors for the estimator's keyframe database
+    Eigen::Matrix3d RIC;
+    std::vector<PerformanceProfile> PERFORMANCE_PROFILES;  // the YAML's, "default" first
+    std::string PERFORMANCE_PROFILE;                       // the one MAX_CNT, MIN_DIST and FREQ are from
+};
 
-extern std::string IMAGE_TOPIC;
-extern std::string IMU_TOPIC;
-extern std::string FISHEYE_MASK;
-extern std::vector<std::string> CAM_NAMES;
-extern int MAX_CNT;
-extern int MIN_DIST;
-extern int WINDOW_SIZE;
-extern int FREQ;
-extern double F_THRESHOLD;
-extern int SHOW_TRACK;
-extern int STEREO_TRACK;
-extern int EQUALIZE;
-extern int FISHEYE;
-extern bool PUB_THIS_FRAME;
+/**
+ * 前端节点 (ROS 节点, nodelet, 离线批处理) 的配置即 PROCESS_TRACKER_CONFIG,
+ * 下面的全局参数是其中同名字段的引用, 由 readParameters 填写
+ */
+extern TrackerConfig PROCESS_TRACKER_CONFIG;
 
-void readParameters(ros::NodeHandle &n);
+extern std::string &IMAGE_TOPIC;
+extern std::vector<std::string> &CAMERA_IMAGE_TOPICS;
+extern int &IMAGE_COMPRESSED;
+extern std::string &IMU_TOPIC;
+extern std::string &FISHEYE_MASK;
+extern std::vector<std::string> &CAM_NAMES;
+extern int &ROW;
+extern int &COL;
+extern int &FOCAL_LENGTH;
+extern int &MAX_CNT;
+extern int &MIN_DIST;
+extern int &WINDOW_SIZE;
+extern int &FREQ;
+extern double &ADMISSION_MAX_LATENCY;
+extern double &DIAGNOSTICS_PERIOD;
+extern double &F_THRESHOLD;
+extern int &SHOW_TRACK;
+extern int &STEREO_TRACK;
+extern int &EQUALIZE;
+extern int &FISHEYE;
+extern bool &PUB_THIS_FRAME;
+extern int &COMPACT_FEATURE_MSG;
+extern int &USE_GPU;
+extern int &IMU_AIDED_TRACKING;
+extern int &UNDISTORTION_LUT;
+extern int &GRID_DETECTION;
+extern int &GRID_ROWS;
+extern int &GRID_COLS;
+extern int &IMU_LK_MAX_LEVEL;
+extern int &PIPELINED_TRACKING;
+extern int &ROTATION_RANSAC;
+extern int &RELOCALIZATION;
+extern Eigen::Matrix3d &RIC;
+extern std::vector<PerformanceProfile> &PERFORMANCE_PROFILES;
+extern std::string &PERFORMANCE_PROFILE;
+
+// fills config from the YAML file directly
+void loadConfig(const std::string &config_file, const std::string &GVINS_FOLDER_PATH, TrackerConfig &config);
+// loadConfig into PROCESS_TRACKER_CONFIG; the nodes take config_file and gvins_folder from the ROS parameter server
+void readParameters(const std::string &config_file, const std::string &GVINS_FOLDER_PATH);
+// MAX_CNT, MIN_DIST and FREQ of one of config.PERFORMANCE_PROFILES, false if there is none of that name
+bool applyPerformanceProfile(const std::string &name, TrackerConfig &config = PROCESS_TRACKER_CONFIG);
@@ -216,6 +216,7 @@ namespace gnss_comm
     #define EPH_VALID_SECONDS       7200                // 2 hours ephemeris validity
     #define WEEK_SECONDS            604800              // Seconds within one week
     #define EPSILON_KEPLER          1e-14               // Kepler equation terminate condition
+    #define KEPLER_BATCH_ITER       8                   // fixed Kepler iterations of eph2state_batch, converged for e < 0.3
     #define MAX_ITER_KEPLER         30                  // Kepler equation maximum iteration number
     #define EPSILON_PVT             1e-8                // PVT terminate condition
     #define MAX_ITER_PVT            30                  // PVT maximum iteration number
@@ -311,6 +312,8 @@ namespace gnss_comm
     };
     typedef std::shared_ptr<EphemBase> EphemBasePtr;
 
+    class GloOrbitPropagator;
+
     struct GloEphem : EphemBase
     {
         int         freqo;              /* satellite frequency number, 卫星频率号, 标识 GLONASS 卫星的 ​​频分多址（FDMA）频率通道​​*/
@@ -320,6 +323,7 @@ namespace gnss_comm
         double      acc[3];             /* satellite acceleration (ecef) (m/s^2), 卫星在ECEF坐标系中的 ​​加速度分量​​ */
         double      tau_n, gamma;       /* SV clock bias (s)/relative freq bias, 卫星钟相对于GLONASS系统时间的钟差​ ​和 卫星钟的​相对频率偏差系数*/
         double      delta_tau_n;        /* delay between L1 and L2 (s), GLONASS 卫星 ​​L1 和 L2 信号间的硬件延迟差 */
+        std::shared_ptr<GloOrbitPropagator> orbit;  /* orbit integration cache, created by geph2state on first use, 之后星历参数不能再修改 */
     };
     typedef std::shared_ptr<GloEphem> GloEphemPtr;
 
@@ -74,6 +74,14 @@ namespace gnss_comm
     *-----------------------------------------------------------------------------*/
     std::vector<ObsPtr> msg2meas(const GnssMeasMsgConstPtr &gnss_meas_msg);
 
+    /* parse GNSS measurements from ros message into recycled objects -------------
+    * args   : GnssMeasConstPtr & gnss_meas_msg      I   GNSS measurement message
+    *          ObsPool &          obs_pool           IO  pool the Obs objects are taken from
+    *          std::vector<ObsPtr> & meas            O   cooresponding GNSS measurements
+    * return : none
+    *-----------------------------------------------------------------------------*/
+    void msg2meas(const GnssMeasMsgConstPtr &gnss_meas_msg, ObsPool &obs_pool, std::vector<ObsPtr> &meas);
+
     /* convert GNSS time pulse information to ros message ----------------------------------
     * args   : TimePulseInfoPtr tp_info      I   GNSS time pulse information
     * return : cooresponding GNSS time pulse information message
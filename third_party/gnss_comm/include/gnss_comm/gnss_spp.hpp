@@ -21,6 +21,7 @@
 #ifndef GNSS_SPS_HPP_
 #define GNSS_SPS_HPP_
 
+#include <vector>
 #include <eigen3/Eigen/Dense>
 #include "gnss_constant.hpp"
 
@@ -90,6 +91,62 @@ namespace gnss_comm
     *----------------------------------------------------------------------------------------------------*/
     Eigen::Matrix<double, 4, 1> dopp_vel(const std::vector<ObsPtr> &obs, 
         const std::vector<EphemBasePtr> &ephems, Eigen::Vector3d &ref_ecef);
+
+    /* single point positioning with preallocated workspaces --------------------------------------
+    * weighted least squares on the 7x7 (position and clocks) and 4x4 (velocity and clock drift) 
+    * normal equations, the per-satellite workspaces keep their capacity between calls, so solving 
+    * does not allocate once warmed up. Satellite states computed before (e.g. by sat_states, which 
+    * uses the batched ephemeris kernel) are reused. One solver per thread.
+    *---------------------------------------------------------------------------------------------*/
+    class SppSolver
+    {
+      public:
+        /* args   : std::vector<ObsPtr>&         obs         I   GNSS observation data
+        *          std::vector<EphemBasePtr>&   ephems      I   GNSS ephemeris data
+        *          std::vector<SatStatePtr>&    sv_states   I   satellite states of obs
+        *          std::vector<double>&         iono_params I   ionosphere parameters
+        * return : receiver position in ECEF and four clock bias for 4 constellations, zero on failure 
+        */
+        Eigen::Matrix<double, 7, 1> psr_pos(const std::vector<ObsPtr> &obs, 
+            const std::vector<EphemBasePtr> &ephems, const std::vector<SatStatePtr> &sv_states, 
+            const std::vector<double> &iono_params);
+
+        /* args   : std::vector<ObsPtr>&         obs         I   GNSS observation data
+        *          std::vector<EphemBasePtr>&   ephems      I   GNSS ephemeris data
+        *          std::vector<SatStatePtr>&    sv_states   I   satellite states of obs
+        *          Eigen::Vector3d&             ref_ecef    I   reference ECEF position
+        * return : receiver velocity in ECEF and clock bias changing rate, zero on failure 
+        */
+        Eigen::Matrix<double, 4, 1> dopp_vel(const std::vector<ObsPtr> &obs, 
+            const std::vector<EphemBasePtr> &ephems, const std::vector<SatStatePtr> &sv_states, 
+            const Eigen::Vector3d &ref_ecef);
+
+      private:
+        struct SvMeas
+        {
+            Eigen::Vector3d pos, vel;
+            double dt, ddt, tgd;
+            gtime_t ttx;
+            uint32_t sys_idx;
+            double psr, psr_weight;             // weight without the elevation term
+            double dopp_m, dopp_weight;         // Doppler in m/s
+        };
+        uint32_t load(const std::vector<ObsPtr> &obs, const std::vector<EphemBasePtr> &ephems, 
+            const std::vector<SatStatePtr> &sv_states);
+        std::vector<SvMeas> svs_;
+    };
+
+    /* positioning by pseudo-range localization of many epochs ------------------------------------
+    * args   : std::vector<std::vector<ObsPtr>>&        obs         I   GNSS observation data per epoch
+    *          std::vector<std::vector<EphemBasePtr>>&  ephems      I   GNSS ephemeris data per epoch
+    *          std::vector<double>&                     iono_params I   ionosphere parameters
+    *          std::vector<Eigen::Matrix<double,7,1>>&  results     O   psr_pos result per epoch
+    *          uint32_t                                 num_threads I   solver threads, 0 uses all hardware threads
+    * return : void
+    *---------------------------------------------------------------------------------------------*/
+    void psr_pos_batch(const std::vector<std::vector<ObsPtr>> &obs, 
+        const std::vector<std::vector<EphemBasePtr>> &ephems, const std::vector<double> &iono_params, 
+        std::vector<Eigen::Matrix<double, 7, 1>> &results, uint32_t num_threads = 0);
 }
 
 #endif
\ No newline at end of file
@@ -41,6 +41,7 @@
 #include <unistd.h>
 #include <cmath>
 #include <time.h>
+#include <mutex>
 #include <eigen3/Eigen/Dense>
 #include <glog/logging.h>
 
@@ -233,6 +234,51 @@ namespace gnss_comm
     *-----------------------------------------------------------------------------*/
     Eigen::Vector3d eph2vel(const gtime_t &curr_time, const EphemPtr ephem, double *svddt);
 
+    /* recycled Obs objects -----------------------------------------------------
+    * acquire() hands out an Obs no one else holds anymore, whose vectors keep their
+    * capacity, so at a steady satellite count filling it does not touch the heap.
+    * Released objects are found by use count, acquire() from one thread only
+    *-----------------------------------------------------------------------------*/
+    class ObsPool
+    {
+      public:
+        explicit ObsPool(size_t max_size = 4096) : max_size_(max_size), cursor_(0) {}
+        ObsPtr acquire();
+
+      private:
+        const size_t max_size_;
+        size_t cursor_;
+        std::vector<ObsPtr> pool_;
+    };
+
+    /* broadcast ephemeris states of many satellites ------------------------------
+    * output of eph2state_batch as structure of arrays, entry i belongs to ephemeris i.
+    * the work arrays are kept between calls so a reused batch does not allocate
+    *-----------------------------------------------------------------------------*/
+    struct EphemBatch
+    {
+        std::vector<double> pos_x, pos_y, pos_z;        /* satellite position in ECEF (m) */
+        std::vector<double> vel_x, vel_y, vel_z;        /* satellite velocity in ECEF (m/s) */
+        std::vector<double> dt, ddt;                    /* clock bias (s) and drift (s/s) with relativity correction */
+        std::vector<double> work;
+        std::vector<size_t> geo_indices;                /* BDS GEO satellites, rotated separately */
+        void resize(size_t num);
+    };
+
+    /* batch broadcast ephemeris evaluation ----------------------------------------
+    * eph2pos, eph2vel and their clock outputs for many satellites (GPS, GAL, BDS) at once,
+    * system dependent constants are gathered first so the main loop has no branches, and
+    * Kepler's equation takes a fixed number (KEPLER_BATCH_ITER) of Newton iterations
+    * args   : gtime_t     time            I   reference time, e.g. receive time of the epoch
+    *          double*     time_offset     I   time of satellite i is time + time_offset[i] (s)
+    *          EphemPtr*   ephems          I   satellite ephemerides (GPS, BDS, GAL)
+    *          size_t      num             I   number of satellites
+    *          EphemBatch& batch           O   satellite states
+    * return : none
+    *-----------------------------------------------------------------------------*/
+    void eph2state_batch(const gtime_t &time, const double *time_offset, const EphemPtr *ephems, 
+        size_t num, EphemBatch &batch);
+
     /* glonass orbit differential equations --------------------------------------*/
     void deq(const Eigen::Vector3d &pos, const Eigen::Vector3d &vel, const Eigen::Vector3d &acc,
              Eigen::Vector3d &pos_dot, Eigen::Vector3d &vel_dot);
@@ -266,6 +312,46 @@ namespace gnss_comm
     *-----------------------------------------------------------------------------*/
     Eigen::Vector3d geph2vel(const gtime_t &curr_time, const GloEphemPtr geph_ptr, double *svddt);
 
+    /* glonass orbit propagator ----------------------------------------------------
+    * integrates the orbit of one glonass ephemeris from toe and keeps the state after
+    * every full TSTEP step, a query continues from the node geph2pos would pass, so
+    * position, velocity and clock come from one integration and a query near an earlier
+    * one only takes the last partial step. results are identical to geph2pos/geph2vel.
+    * thread safe
+    *-----------------------------------------------------------------------------*/
+    class GloOrbitPropagator
+    {
+        public:
+            explicit GloOrbitPropagator(const GloEphem &geph);
+            void propagate(const gtime_t &curr_time, Eigen::Vector3d &sv_pos, Eigen::Vector3d &sv_vel, 
+                double *svdt, double *svddt);
+
+        private:
+            struct Node
+            {
+                Eigen::Vector3d pos, vel;
+            };
+
+            gtime_t toe;
+            double tau_n, gamma;
+            Eigen::Vector3d acc;
+            std::vector<Node> forward_nodes, backward_nodes;    /* state after k steps after/before toe */
+            std::mutex m_nodes;
+    };
+
+    /* glonass ephemeris to satellite position, velocity and clock -----------------
+    * geph2pos and geph2vel with one integration, through the propagator of the ephemeris
+    * args   : gtime_t curr_time    I       time (gpst)
+    *          geph_t  geph         I       glonass ephemeris
+    *          Vector3d &sv_pos     O       satellite position in ECEF
+    *          Vector3d &sv_vel     O       satellite velocity in ECEF
+    *          double *svdt         IO      output satellite clock bias in second (NULL: no output)
+    *          double *svddt        IO      output satellite clock bias change rate(s/s) (NULL: no output)
+    * return : none
+    *-----------------------------------------------------------------------------*/
+    void geph2state(const gtime_t &curr_time, const GloEphemPtr geph_ptr, Eigen::Vector3d &sv_pos, 
+        Eigen::Vector3d &sv_vel, double *svdt, double *svddt);
+
     /* satellite azimuth/elevation angle -------------------------------------------
     * compute satellite azimuth/elevation angle
     * args   : Eigen::Vector3d rev_pos  I   receiver position in ECEF
@@ -0,0 +1,81 @@
+/**
+* This file is part of gnss_comm.
+*
+* Copyright (C) 2021 Aerial Robotics Group, Hong Kong University of Science and Technology
+* Author: CAO Shaozu (shaozu.cao@gmail.com)
+*
+* gnss_comm is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* gnss_comm is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with gnss_comm. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RINEX_CACHE_HPP_
+#define RINEX_CACHE_HPP_
+
+#include <vector>
+#include <map>
+#include <string>
+
+#include "gnss_constant.hpp"
+
+namespace gnss_comm
+{
+    /* Binary cache of parsed RINEX files. A cache file starts with the size and a 64-bit hash 
+    * of the RINEX file it was parsed from, and is only used while both still match, so an edited
+    * or replaced RINEX file is parsed again and its cache rewritten. Cache files are written to 
+    * a temporary name and renamed, a crash never leaves a truncated cache behind.
+    */
+
+    /* hash RINEX file content  --------------------------------------------------------------------
+    * args   : std::string      filepath        I   file path
+    *          uint64_t*        file_size       O   file size in bytes (NULL: no output)
+    * return : 64-bit hash of the file content, 0 if the file cannot be read
+    *---------------------------------------------------------------------------------------------*/
+    uint64_t rinex_file_hash(const std::string &filepath, uint64_t *file_size);
+
+    /* save/load GNSS measurement cache  -----------------------------------------------------------
+    * args   : std::string                          cache_filepath        I   cache file path
+    *          std::string                          rinex_filepath        I   RINEX file the cache belongs to
+    *          std::vector<std::vector<ObsPtr>>&    rinex_meas            I/O GNSS measurement in time order
+    * return : true if the cache was written / is valid and loaded
+    *---------------------------------------------------------------------------------------------*/
+    bool save_obs_cache(const std::string &cache_filepath, const std::string &rinex_filepath, 
+        const std::vector<std::vector<ObsPtr>> &rinex_meas);
+    bool load_obs_cache(const std::string &cache_filepath, const std::string &rinex_filepath, 
+        std::vector<std::vector<ObsPtr>> &rinex_meas);
+
+    /* save/load ephemeris cache  -----------------------------------------------------------------
+    * args   : std::string                                  cache_filepath    I   cache file path
+    *          std::string                                  rinex_filepath    I   RINEX file the cache belongs to
+    *          std::map<uint32_t, std::vector<EphemBasePtr>>& sat2ephem       I/O satellite number to ephemeris
+    * return : true if the cache was written / is valid and loaded
+    *---------------------------------------------------------------------------------------------*/
+    bool save_ephem_cache(const std::string &cache_filepath, const std::string &rinex_filepath, 
+        const std::map<uint32_t, std::vector<EphemBasePtr>> &sat2ephem);
+    bool load_ephem_cache(const std::string &cache_filepath, const std::string &rinex_filepath, 
+        std::map<uint32_t, std::vector<EphemBasePtr>> &sat2ephem);
+
+    /* cached versions of rinex2obs, rinex2ephems and rinex2iono_params  ---------------------------
+    * load from cache_filepath when it matches the RINEX file, otherwise parse the RINEX file and
+    * write the cache for the next run. An empty cache_filepath is rinex_filepath + ".gcache", or
+    * rinex_filepath + ".iono.gcache" for the ionosphere parameters of a navigation file
+    *---------------------------------------------------------------------------------------------*/
+    void rinex2obs_cached(const std::string &rinex_filepath, 
+        std::vector<std::vector<ObsPtr>> &rinex_meas, const std::string &cache_filepath = "");
+    void rinex2ephems_cached(const std::string &rinex_filepath, 
+        std::map<uint32_t, std::vector<EphemBasePtr>> &sat2ephem, const std::string &cache_filepath = "");
+    void rinex2iono_params_cached(const std::string &rinex_filepath, 
+        std::vector<double> &iono_params, const std::string &cache_filepath = "");
+
+}   // namespace gnss_comm
+
+#endif
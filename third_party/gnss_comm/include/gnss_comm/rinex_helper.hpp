@@ -26,6 +26,12 @@
 #include <vector>
 #include <cmath>
 #include <map>
+#include <array>
+#include <functional>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <time.h>
 #include <glog/logging.h>
 
@@ -34,6 +40,59 @@
 
 namespace gnss_comm
 {
+    /* memory-mapped RINEX file  -----------------------------------------------------------------
+    * lines are handed out as pointers into the mapping, nothing is copied
+    *---------------------------------------------------------------------------------------------*/
+    class RinexFile
+    {
+      public:
+        explicit RinexFile(const std::string &rinex_filepath);
+        ~RinexFile();
+        bool valid() const { return data_ != nullptr; }
+        // next line without the line break, false at the end of the file
+        bool next_line(const char *&line, size_t &len);
+        const char *data() const { return data_; }
+        size_t size() const { return size_; }
+        size_t tell() const { return pos_; }
+        void seek(size_t pos) { pos_ = pos; }
+
+      private:
+        RinexFile(const RinexFile &) = delete;
+        RinexFile &operator=(const RinexFile &) = delete;
+        const char *data_;
+        size_t size_;
+        size_t pos_;
+    };
+
+    /* streaming reader of RINEX observation file  ------------------------------------------------
+    * parses one epoch per call to next(), the file is never loaded as a whole
+    *---------------------------------------------------------------------------------------------*/
+    class RinexObsReader
+    {
+      public:
+        explicit RinexObsReader(const std::string &rinex_filepath);
+        bool valid() const { return valid_; }
+        // measurements of the next epoch, false at the end of the file
+        bool next(std::vector<ObsPtr> &meas);
+        // all remaining epochs in time order, the rest of the file is split into chunks at epoch 
+        // headers and the chunks are parsed on num_threads threads (0 uses all hardware threads)
+        void read_all(std::vector<std::vector<ObsPtr>> &rinex_meas, uint32_t num_threads);
+
+      private:
+        struct ObsField
+        {
+            uint8_t type;       // 'C', 'L', 'D' or 'S'
+            double freq;        // carrier frequency of the field, negative if unknown
+        };
+        ObsPtr parse_obs(const char *line, size_t len) const;
+        // parses the epoch starting at cursor and advances it, false at end
+        bool parse_epoch(const char *&cursor, const char *end, std::vector<ObsPtr> &meas) const;
+
+        RinexFile file_;
+        bool valid_;
+        std::array<std::vector<ObsField>, 256> sys_fields_;    // observation types of each system character
+    };
+
     /* parse ephemeris from RINEX navigation file  ----------------------------------------------------------
     * args   : std::string                                  rinex_filepath        I   RINEX file path
     *          std::map<uint32_t, std::vecot<EphemBase>>&   sat2ephem             IO  satellite number to ephemeris
@@ -42,14 +101,70 @@ namespace gnss_comm
     void rinex2ephems(const std::string &rinex_filepath, 
         std::map<uint32_t, std::vector<EphemBasePtr>> &sat2ephem);
     
+    /* stream ephemeris from RINEX navigation file  ----------------------------------------------
+    * args   : std::string                                  rinex_filepath        I   RINEX file path
+    *          std::function<void(const EphemBasePtr&)>     ephem_callback        I   called for each ephemeris record
+    * return : None
+    *---------------------------------------------------------------------------------------------*/
+    void rinex2ephems(const std::string &rinex_filepath, 
+        const std::function<void(const EphemBasePtr&)> &ephem_callback);
+
     /* parse GNSS measurement from RINEX observation file  ---------------------------------------
     * args   : std::string                          rinex_filepath        I   RINEX file path
     *          std::vector<std::vector<ObsPtr>>&    rinex_meas            IO  GNSS measurement in time order
+    *          uint32_t                             num_threads           I   parsing threads, 0 uses all hardware 
+    *                                                                         threads, files below 8 MB use one
     * return : None
     *---------------------------------------------------------------------------------------------*/
     void rinex2obs(const std::string &rinex_filepath, 
-        std::vector<std::vector<ObsPtr>> &rinex_meas);
+        std::vector<std::vector<ObsPtr>> &rinex_meas, uint32_t num_threads = 0);
     
+    /* stream GNSS measurement from RINEX observation file  --------------------------------------
+    * args   : std::string                                          rinex_filepath    I   RINEX file path
+    *          std::function<bool(const std::vector<ObsPtr>&)>      epoch_callback    I   called for each epoch in 
+    *                                                                                     time order, false stops reading
+    * return : None
+    *---------------------------------------------------------------------------------------------*/
+    void rinex2obs(const std::string &rinex_filepath, 
+        const std::function<bool(const std::vector<ObsPtr>&)> &epoch_callback);
+
+    /* streaming writer of RINEX observation file  ------------------------------------------------
+    * epochs are formatted into a memory buffer, full buffers are written to disk by a background
+    * thread, so write() never waits for the disk. The header is written with the first epoch unless
+    * write_header() is called before. Not thread-safe, call from one thread only
+    *---------------------------------------------------------------------------------------------*/
+    class RinexObsWriter
+    {
+      public:
+        explicit RinexObsWriter(const std::string &rinex_filepath, size_t buffer_size = 1 << 20);
+        ~RinexObsWriter();      // flushes and closes the file
+        bool valid() const { return fp_ != nullptr; }
+        // first_time/last_time may be NULL, the GLONASS frequency numbers go to GLONASS SLOT / FRQ #
+        void write_header(const gtime_t *first_time, const gtime_t *last_time, 
+            const std::map<uint32_t, int> &glo_sat2freqo);
+        // append one epoch
+        void write(const std::vector<ObsPtr> &meas);
+        // write everything appended so far to disk, waits for the background thread
+        void flush();
+
+      private:
+        RinexObsWriter(const RinexObsWriter &) = delete;
+        RinexObsWriter &operator=(const RinexObsWriter &) = delete;
+        void hand_over(bool wait);
+        void flush_loop();
+
+        FILE *fp_;
+        const size_t buffer_size_;
+        bool header_written_;
+        std::string active_;         // being appended by write()
+        std::string pending_;        // being written by the background thread
+        std::vector<ObsPtr> sorted_meas_;
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        bool stop_, flushing_;
+        std::thread flush_thread_;
+    };
+
     /* output GNSS measurement to RINEX file  -----------------------------------------------------
     * args   : std::string                          rinex_filepath        I   RINEX file path
     *          std::vector<std::vector<ObsPtr>>&    rinex_meas            I   GNSS measurement in time order
@@ -59,6 +174,12 @@ namespace gnss_comm
     void obs2rinex(const std::string &rinex_filepath, 
         const std::vector<std::vector<ObsPtr>> &gnss_meas);
 
+    /* GLONASS frequency numbers found in GNSS measurement  ---------------------------------------
+    * args   : std::vector<std::vector<ObsPtr>>&    gnss_meas             I   GNSS measurement
+    * return : GLONASS satellite number to frequency number
+    *---------------------------------------------------------------------------------------------*/
+    std::map<uint32_t, int> get_glo_freqo(const std::vector<std::vector<ObsPtr>> &gnss_meas);
+
     /* parse GPS ionosphere from RINEX navigation file  ------------------------------------------
     * args   : std::string                      rinex_filepath        I   RINEX file path
     *          std::vector<double>              iono_params           IO  8 ionosphere parameters (alpha 1~4, beta 1~4)
@@ -202,32 +202,49 @@ namespace gnss_comm
         return gnss_meas_msg;
     }
 
+    static void msg2obs(const GnssObsMsg &obs_msg, Obs &obs)
+    {
+        obs.time = gpst2time(obs_msg.time.week, obs_msg.time.tow);
+        obs.sat  = obs_msg.sat;
+        // assign() reuses the capacity of a recycled Obs
+        obs.freqs.assign(obs_msg.freqs.begin(), obs_msg.freqs.end());
+        obs.CN0.assign(obs_msg.CN0.begin(), obs_msg.CN0.end());
+        obs.LLI.assign(obs_msg.LLI.begin(), obs_msg.LLI.end());
+        obs.code.assign(obs_msg.code.begin(), obs_msg.code.end());
+        obs.psr.assign(obs_msg.psr.begin(), obs_msg.psr.end());
+        obs.psr_std.assign(obs_msg.psr_std.begin(), obs_msg.psr_std.end());
+        obs.cp.assign(obs_msg.cp.begin(), obs_msg.cp.end());
+        obs.cp_std.assign(obs_msg.cp_std.begin(), obs_msg.cp_std.end());
+        obs.dopp.assign(obs_msg.dopp.begin(), obs_msg.dopp.end());
+        obs.dopp_std.assign(obs_msg.dopp_std.begin(), obs_msg.dopp_std.end());
+        obs.status.assign(obs_msg.status.begin(), obs_msg.status.end());
+    }
+
     std::vector<ObsPtr> msg2meas(const GnssMeasMsgConstPtr &gnss_meas_msg)
     {
         std::vector<ObsPtr> meas;
-        for (size_t i = 0; i < gnss_meas_msg->meas.size(); ++i)
+        meas.reserve(gnss_meas_msg->meas.size());
+        for (const GnssObsMsg &obs_msg : gnss_meas_msg->meas)
         {
-            GnssObsMsg obs_msg = gnss_meas_msg->meas[i];
             ObsPtr obs(new Obs());
-            obs->time       = gpst2time(obs_msg.time.week, obs_msg.time.tow);
-            obs->sat        = obs_msg.sat;
-            obs->freqs      = obs_msg.freqs;
-            obs->CN0        = obs_msg.CN0;
-            obs->LLI        = obs_msg.LLI;
-            obs->code       = obs_msg.code;
-            obs->psr        = obs_msg.psr;
-            obs->psr_std    = obs_msg.psr_std;
-            obs->cp         = obs_msg.cp;
-            obs->cp_std     = obs_msg.cp_std;
-            obs->dopp       = obs_msg.dopp;
-            obs->dopp_std   = obs_msg.dopp_std;
-            obs->status     = obs_msg.status;
-            
+            msg2obs(obs_msg, *obs);
             meas.push_back(obs);
         }
         return meas;
     }
 
+    void msg2meas(const GnssMeasMsgConstPtr &gnss_meas_msg, ObsPool &obs_pool, std::vector<ObsPtr> &meas)
+    {
+        meas.clear();
+        meas.reserve(gnss_meas_msg->meas.size());
+        for (const GnssObsMsg &obs_msg : gnss_meas_msg->meas)
+        {
+            ObsPtr obs = obs_pool.acquire();
+            msg2obs(obs_msg, *obs);
+            meas.push_back(obs);
+        }
+    }
+
     GnssTimePulseInfoMsg tp_info2msg(const TimePulseInfoPtr &tp_info)
     {
         GnssTimePulseInfoMsg tp_info_msg;
@@ -21,6 +21,7 @@
 #include "gnss_spp.hpp"
 #include "gnss_utility.hpp"
 #include <glog/logging.h>
+#include <thread>
 
 #define CUT_OFF_DEGREE 15.0
 
@@ -52,6 +53,18 @@ namespace gnss_comm
     {
         std::vector<SatStatePtr> all_sv_states;
         const uint32_t num_obs = obs.size();
+        if (num_obs == 0)   return all_sv_states;
+
+        // GPS/GAL/BDS satellites are evaluated together by eph2state_batch
+        thread_local EphemBatch batch;
+        thread_local std::vector<EphemPtr> batch_ephems;
+        thread_local std::vector<double> batch_offsets;
+        thread_local std::vector<uint32_t> batch_obs_idx;
+        batch_ephems.clear();
+        batch_offsets.clear();
+        batch_obs_idx.clear();
+        const gtime_t ref_time = obs.front()->time;
+
         for (size_t i = 0; i < num_obs; ++i)
         {
             SatStatePtr sat_state(new SatState());
@@ -74,17 +87,17 @@ namespace gnss_comm
                 GloEphemPtr glo_ephem = std::dynamic_pointer_cast<GloEphem>(ephems[i]);
                 svdt = geph2svdt(sv_tx, glo_ephem);
                 sv_tx = time_add(sv_tx, -svdt);
-                sv_pos = geph2pos(sv_tx, glo_ephem, &svdt);
-                sv_vel = geph2vel(sv_tx, glo_ephem, &svddt);
+                geph2state(sv_tx, glo_ephem, sv_pos, sv_vel, &svdt, &svddt);
             }
             else
             {
                 EphemPtr ephem = std::dynamic_pointer_cast<Ephem>(ephems[i]);
                 svdt = eph2svdt(sv_tx, ephem);
                 sv_tx = time_add(sv_tx, -svdt);
-                sv_pos = eph2pos(sv_tx, ephem, &svdt);
-                sv_vel = eph2vel(sv_tx, ephem, &svddt);
                 sat_state->tgd = ephem->tgd[0];
+                batch_ephems.push_back(ephem);
+                batch_offsets.push_back(time_diff(sv_tx, ref_time));
+                batch_obs_idx.push_back(i);
             }
             sat_state->sat_id = sat;
             sat_state->ttx    = sv_tx;
@@ -93,6 +106,17 @@ namespace gnss_comm
             sat_state->dt     = svdt;
             sat_state->ddt    = svddt;
         }
+
+        if (batch_ephems.empty())   return all_sv_states;
+        eph2state_batch(ref_time, batch_offsets.data(), batch_ephems.data(), batch_ephems.size(), batch);
+        for (size_t k = 0; k < batch_ephems.size(); ++k)
+        {
+            SatStatePtr &sat_state = all_sv_states[batch_obs_idx[k]];
+            sat_state->pos = Eigen::Vector3d(batch.pos_x[k], batch.pos_y[k], batch.pos_z[k]);
+            sat_state->vel = Eigen::Vector3d(batch.vel_x[k], batch.vel_y[k], batch.vel_z[k]);
+            sat_state->dt  = batch.dt[k];
+            sat_state->ddt = batch.ddt[k];
+        }
         return all_sv_states;
     }
 
@@ -145,22 +169,76 @@ namespace gnss_comm
         }
     }
 
-    Eigen::Matrix<double, 7, 1> psr_pos(const std::vector<ObsPtr> &obs, 
-        const std::vector<EphemBasePtr> &ephems, const std::vector<double> &iono_params)
+    uint32_t SppSolver::load(const std::vector<ObsPtr> &obs, const std::vector<EphemBasePtr> &ephems, 
+        const std::vector<SatStatePtr> &sv_states)
+    {
+        svs_.clear();
+        for (size_t i = 0; i < obs.size(); ++i)
+        {
+            const ObsPtr &this_obs = obs[i];
+            int l1_idx = -1;
+            const double l1_freq = L1_freq(this_obs, &l1_idx);
+            if (l1_idx < 0)     continue;
+            const uint32_t obs_sys = satsys(this_obs->sat, NULL);
+            if (sys2idx.count(obs_sys) == 0)    continue;
+
+            SvMeas sv;
+            const SatStatePtr &sat_state = sv_states[i];
+            sv.pos = sat_state->pos;
+            sv.vel = sat_state->vel;
+            sv.dt  = sat_state->dt;
+            sv.ddt = sat_state->ddt;
+            sv.tgd = sat_state->tgd;
+            sv.ttx = sat_state->ttx;
+            sv.sys_idx = sys2idx.at(obs_sys);
+            sv.psr = this_obs->psr[l1_idx];
+            sv.dopp_m = this_obs->dopp[l1_idx] * LIGHT_SPEED / l1_freq;
+
+            // compose weight, the elevation term is added per iteration
+            sv.psr_weight = sv.dopp_weight = 1.0;
+            if (this_obs->psr_std[l1_idx] > 0)
+                sv.psr_weight /= (this_obs->psr_std[l1_idx]/0.16);
+            if (this_obs->dopp_std[l1_idx] > 0)
+                sv.dopp_weight /= (this_obs->dopp_std[l1_idx]/0.256);
+            if (obs_sys == SYS_GPS || obs_sys == SYS_BDS)
+            {
+                sv.psr_weight /= ephems[i]->ura-1;
+                sv.dopp_weight /= ephems[i]->ura-1;
+            }
+            else if (obs_sys == SYS_GAL)
+            {
+                sv.psr_weight /= ephems[i]->ura-2;
+                sv.dopp_weight /= ephems[i]->ura-2;
+            }
+            else if (obs_sys == SYS_GLO)
+            {
+                sv.psr_weight /= 4;
+                sv.dopp_weight /= 2;
+            }
+            svs_.push_back(sv);
+        }
+        return svs_.size();
+    }
+
+    Eigen::Matrix<double, 7, 1> SppSolver::psr_pos(const std::vector<ObsPtr> &obs, 
+        const std::vector<EphemBasePtr> &ephems, const std::vector<SatStatePtr> &sv_states, 
+        const std::vector<double> &iono_params)
     {
         Eigen::Matrix<double, 7, 1> result;
         result.setZero();
-
-        std::vector<ObsPtr> valid_obs;
-        std::vector<EphemBasePtr> valid_ephems;
-        filter_L1(obs, ephems, valid_obs, valid_ephems);
-        if (valid_obs.size() < 4)
+        const uint32_t num_sv = load(obs, ephems, sv_states);
+        if (num_sv < 4)
         {
             LOG(ERROR) << "[gnss_comm::psr_pos] GNSS observation not enough.\n";
             return result;
         }
 
-        std::vector<SatStatePtr> all_sat_states = sat_states(valid_obs, valid_ephems);
+        int sys_mask[4] = {0, 0, 0, 0};
+        for (const SvMeas &sv : svs_)
+            sys_mask[sv.sys_idx] = 1;
+        uint32_t num_extra_constraint = 4;
+        for (uint32_t k = 0; k < 4; ++k)    num_extra_constraint -= sys_mask[k];
+        LOG_IF(FATAL, num_extra_constraint >= 4) << "[gnss_comm::psr_pos] too many extra-clock constraints.\n";
 
         Eigen::Matrix<double, 7, 1> xyzt;
         xyzt.setZero();
@@ -168,79 +246,51 @@ namespace gnss_comm
         uint32_t num_iter = 0;
         while(num_iter < MAX_ITER_PVT && dx_norm > EPSILON_PVT)
         {
-            Eigen::VectorXd b;
-            Eigen::MatrixXd G;
-            std::vector<Eigen::Vector2d> atmos_delay;
-            std::vector<Eigen::Vector2d> all_sv_azel;
-            psr_res(xyzt, valid_obs, all_sat_states, iono_params, b, G, atmos_delay, all_sv_azel);
-
-            std::vector<uint32_t> good_idx;
-            for (uint32_t i = 0; i < valid_obs.size(); ++i)
+            // normal equation H * dx = -g accumulated satellite by satellite
+            Eigen::Matrix<double, 7, 7> H = Eigen::Matrix<double, 7, 7>::Zero();
+            Eigen::Matrix<double, 7, 1> g = Eigen::Matrix<double, 7, 1>::Zero();
+            const Eigen::Vector3d rcv_pos = xyzt.head<3>();
+            const bool pos_known = rcv_pos.norm() > 0;
+            const Eigen::Vector3d rcv_lla = (pos_known ? ecef2geo(rcv_pos) : Eigen::Vector3d::Zero());
+            uint32_t good_num = 0;
+            for (const SvMeas &sv : svs_)
             {
-                if (G.row(i).norm() <= 0)   continue;       // res not computed
-                if (all_sv_azel[i].y() > CUT_OFF_DEGREE/180.0*M_PI)  
-                    good_idx.push_back(i);
-            }
-            int sys_mask[4] = {0, 0, 0, 0};
-            for (uint32_t i = 0; i < valid_obs.size(); ++i)
-            {
-                const uint32_t obs_sys = satsys(valid_obs[i]->sat, NULL);
-                sys_mask[sys2idx.at(obs_sys)] = 1;
+                double ion_delay=0, tro_delay=0;
+                double azel[2] = {0, M_PI/2.0};
+                if (pos_known)
+                {
+                    sat_azel(rcv_pos, sv.pos, azel);
+                    // use satellite signal transmit time instead
+                    tro_delay = calculate_trop_delay(sv.ttx, rcv_lla, azel);
+                    ion_delay = calculate_ion_delay(sv.ttx, iono_params, rcv_lla, azel);
+                }
+                if (azel[1] <= CUT_OFF_DEGREE/180.0*M_PI)   continue;
+
+                const Eigen::Vector3d rv2sv = sv.pos - rcv_pos;
+                const double sagnac_term = EARTH_OMG_GPS*(sv.pos(0)*rcv_pos(1)-sv.pos(1)*rcv_pos(0))/LIGHT_SPEED;
+                const double psr_estimated = rv2sv.norm() + sagnac_term + xyzt(3+sv.sys_idx) -
+                    sv.dt*LIGHT_SPEED + tro_delay + ion_delay + sv.tgd*LIGHT_SPEED;
+                Eigen::Matrix<double, 7, 1> J = Eigen::Matrix<double, 7, 1>::Zero();
+                J.head<3>() = -rv2sv.normalized();
+                J(3+sv.sys_idx) = 1.0;
+                const double sin_el = sin(azel[1]);
+                const double weight = sin_el*sin_el*sv.psr_weight;
+                H.noalias() += weight * J * J.transpose();
+                g.noalias() += weight * (psr_estimated - sv.psr) * J;
+                ++good_num;
             }
-            uint32_t num_extra_constraint = 4;
-            for (uint32_t k = 0; k < 4; ++k)    num_extra_constraint -= sys_mask[k];
-            LOG_IF(FATAL, num_extra_constraint >= 4) << "[gnss_comm::psr_pos] too many extra-clock constraints.\n";
-
-            const uint32_t good_num = good_idx.size();
             LOG_IF(ERROR, good_num < 4) << "too few good obs: " << good_num;
-
-            Eigen::MatrixXd good_G(good_num+num_extra_constraint, 7);
-            Eigen::VectorXd good_b(good_num+num_extra_constraint);
-            Eigen::MatrixXd good_W(good_num+num_extra_constraint, good_num+num_extra_constraint);
-            good_W.setZero();
-            for (uint32_t i = 0; i < good_num; ++i)
-            {
-                const uint32_t origin_idx = good_idx[i];
-                const ObsPtr &this_obs = valid_obs[origin_idx];
-                good_G.row(i) = G.row(origin_idx);
-                good_b(i) = b(origin_idx);
-                // compose weight
-                const double sin_el = sin(all_sv_azel[origin_idx].y());
-                double weight = sin_el*sin_el;
-                int l1_idx = -1;
-                L1_freq(this_obs, &l1_idx);
-                LOG_IF(FATAL, l1_idx < 0) << "[gnss_comm::psr_pos] no L1 observation found.\n";
-
-                if (this_obs->psr_std[l1_idx] > 0)
-                    weight /= (this_obs->psr_std[l1_idx]/0.16);
-                const uint32_t obs_sys = satsys(this_obs->sat, NULL);
-                if (obs_sys == SYS_GPS || obs_sys == SYS_BDS)
-                    weight /= valid_ephems[origin_idx]->ura-1;
-                else if (obs_sys == SYS_GAL)
-                    weight /= valid_ephems[origin_idx]->ura-2;
-                else if (obs_sys == SYS_GLO)
-                    weight /= 4;
-                good_W(i, i) = weight;
-            }
-            uint32_t tmp_count = good_num;
             // add extra pseudo measurement to contraint unobservable clock bias
             for (size_t k = 0; k < 4; ++k)
             {
                 if (!sys_mask[k])
-                {
-                    good_G.row(tmp_count).setZero();
-                    good_G(tmp_count, k+3) = 1.0;
-                    good_b(tmp_count) = 0;
-                    good_W(tmp_count, tmp_count) = 1000;       // large weight
-                    ++tmp_count;
-                }
+                    H(3+k, 3+k) += 1000;        // large weight
             }
 
             // ready for solving
-            Eigen::VectorXd dx = -(good_G.transpose()*good_W*good_G).inverse() * good_G.transpose() * good_W * good_b;
+            const Eigen::Matrix<double, 7, 1> dx = -H.ldlt().solve(g);
             dx_norm = dx.norm();
             xyzt += dx;
-            // LOG(INFO) << "cov is \n" << (G.transpose()*W*G).inverse();
             ++num_iter;
         }
         if (num_iter == MAX_ITER_PVT)
@@ -253,6 +303,112 @@ namespace gnss_comm
         return result;
     }
 
+    Eigen::Matrix<double, 4, 1> SppSolver::dopp_vel(const std::vector<ObsPtr> &obs, 
+        const std::vector<EphemBasePtr> &ephems, const std::vector<SatStatePtr> &sv_states, 
+        const Eigen::Vector3d &ref_ecef)
+    {
+        Eigen::Matrix<double, 4, 1> result;
+        result.setZero();
+        const uint32_t num_sv = load(obs, ephems, sv_states);
+        if (num_sv < 4)
+        {
+            LOG(ERROR) << "[gnss_comm::dopp_vel] GNSS observation not enough for velocity calculation.\n";
+            return result;
+        }
+
+        // line of sight and elevation weight are fixed by the reference position
+        for (SvMeas &sv : svs_)
+        {
+            double azel[2] = {0, 0};
+            sat_azel(ref_ecef, sv.pos, azel);
+            if (azel[1] <= CUT_OFF_DEGREE/180.0*M_PI)
+            {
+                sv.dopp_weight = 0;
+                continue;
+            }
+            const double sin_el = sin(azel[1]);
+            sv.dopp_weight *= sin_el*sin_el;
+        }
+
+        Eigen::Matrix<double, 4, 1> xyzt_dot;
+        xyzt_dot.setZero();
+        double dx_norm = 1.0;
+        uint32_t num_iter = 0;
+        while(num_iter < MAX_ITER_PVT && dx_norm > EPSILON_PVT)
+        {
+            Eigen::Matrix<double, 4, 4> H = Eigen::Matrix<double, 4, 4>::Zero();
+            Eigen::Matrix<double, 4, 1> g = Eigen::Matrix<double, 4, 1>::Zero();
+            for (const SvMeas &sv : svs_)
+            {
+                if (sv.dopp_weight <= 0)    continue;
+                const Eigen::Vector3d unit_rv2sv = (sv.pos - ref_ecef).normalized();
+                const double sagnac_term = EARTH_OMG_GPS/LIGHT_SPEED*(
+                    sv.vel(0)*ref_ecef(1)+ sv.pos(0)*xyzt_dot(1) - 
+                    sv.vel(1)*ref_ecef(0) - sv.pos(1)*xyzt_dot(0));
+                const double dopp_estimated = (sv.vel - xyzt_dot.head<3>()).dot(unit_rv2sv) + 
+                        xyzt_dot(3) + sagnac_term - sv.ddt*LIGHT_SPEED;
+                Eigen::Matrix<double, 4, 1> J;
+                J.head<3>() = -unit_rv2sv;
+                J(3) = 1.0;
+                H.noalias() += sv.dopp_weight * J * J.transpose();
+                g.noalias() += sv.dopp_weight * (dopp_estimated + sv.dopp_m) * J;
+            }
+
+            // solve
+            const Eigen::Matrix<double, 4, 1> dx = -H.ldlt().solve(g);
+            dx_norm = dx.norm();
+            xyzt_dot += dx;
+            ++num_iter;
+        }
+
+        if (num_iter == MAX_ITER_PVT)
+            LOG(WARNING) << "[gnss_comm::dopp_vel] XYZT solver reached maximum iterations.\n";
+        
+        result = xyzt_dot;
+        return result;
+    }
+
+    Eigen::Matrix<double, 7, 1> psr_pos(const std::vector<ObsPtr> &obs, 
+        const std::vector<EphemBasePtr> &ephems, const std::vector<double> &iono_params)
+    {
+        std::vector<ObsPtr> valid_obs;
+        std::vector<EphemBasePtr> valid_ephems;
+        filter_L1(obs, ephems, valid_obs, valid_ephems);
+        if (valid_obs.size() < 4)
+        {
+            LOG(ERROR) << "[gnss_comm::psr_pos] GNSS observation not enough.\n";
+            return Eigen::Matrix<double, 7, 1>::Zero();
+        }
+
+        thread_local SppSolver solver;
+        return solver.psr_pos(valid_obs, valid_ephems, sat_states(valid_obs, valid_ephems), iono_params);
+    }
+
+    void psr_pos_batch(const std::vector<std::vector<ObsPtr>> &obs, 
+        const std::vector<std::vector<EphemBasePtr>> &ephems, const std::vector<double> &iono_params, 
+        std::vector<Eigen::Matrix<double, 7, 1>> &results, uint32_t num_threads)
+    {
+        const size_t num_epochs = obs.size();
+        results.assign(num_epochs, Eigen::Matrix<double, 7, 1>::Zero());
+        if (num_threads == 0)
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        num_threads = std::min<size_t>(num_threads, num_epochs);
+
+        // epochs are independent, thread t solves epochs t, t+num_threads, ...
+        auto solve_epochs = [&](uint32_t t)
+        {
+            for (size_t i = t; i < num_epochs; i += num_threads)
+                results[i] = psr_pos(obs[i], ephems[i], iono_params);
+        };
+        std::vector<std::thread> workers;
+        for (uint32_t t = 1; t < num_threads; ++t)
+            workers.emplace_back(solve_epochs, t);
+        if (num_threads > 0)
+            solve_epochs(0);
+        for (auto &worker : workers)
+            worker.join();
+    }
+
     void dopp_res(const Eigen::Matrix<double, 4, 1> &rcv_state, const Eigen::Vector3d &rcv_ecef,
                   const std::vector<ObsPtr> &obs, const std::vector<SatStatePtr> &all_sv_states, 
                   Eigen::VectorXd &res, Eigen::MatrixXd &J)
@@ -285,104 +441,34 @@ namespace gnss_comm
         const std::vector<EphemBasePtr> &ephems, Eigen::Vector3d &ref_ecef)
     {
         LOG(INFO) << "try to solve Doppler velocity.";
-        Eigen::Matrix<double, 4, 1> result;
-        result.setZero();
-
-        if (ref_ecef.norm() == 0)
-        {
-            // reference point not given, try calculate using pseudorange
-            std::vector<double> zero_iono_params(8, 0.0);
-            Eigen::Matrix<double, 7, 1> psr_result = psr_pos(obs, ephems, zero_iono_params);
-            if (psr_result.head<3>().norm() != 0)
-            {
-                ref_ecef = psr_result.head<3>();
-            }
-            else
-            {
-                LOG(ERROR) << "[gnss_comm::dopp_vel] Unable to initialize reference position for Doppler calculation.\n";
-                return result;
-            }
-        }
-
         std::vector<ObsPtr> valid_obs;
         std::vector<EphemBasePtr> valid_ephems;
         filter_L1(obs, ephems, valid_obs, valid_ephems);
-
         if (valid_obs.size() < 4)
         {
             LOG(ERROR) << "[gnss_comm::dopp_vel] GNSS observation not enough for velocity calculation.\n";
-            return result;
+            return Eigen::Matrix<double, 4, 1>::Zero();
         }
 
-        std::vector<SatStatePtr> all_sat_states = sat_states(valid_obs, valid_ephems);
-        // compute azel for all satellite
-        std::vector<Eigen::Vector2d> all_sv_azel;
-        for (uint32_t i = 0; i < all_sat_states.size(); ++i)
-        {
-            double azel[2] = {0, 0};
-            sat_azel(ref_ecef, all_sat_states[i]->pos, azel);
-            all_sv_azel.emplace_back(azel[0], azel[1]);
-        }
-
-        Eigen::Matrix<double, 4, 1> xyzt_dot;
-        xyzt_dot.setZero();
-        double dx_norm = 1.0;
-        uint32_t num_iter = 0;
-        while(num_iter < MAX_ITER_PVT && dx_norm > EPSILON_PVT)
+        // satellite states are shared by the reference position and the velocity solution
+        thread_local SppSolver solver;
+        const std::vector<SatStatePtr> all_sat_states = sat_states(valid_obs, valid_ephems);
+        if (ref_ecef.norm() == 0)
         {
-            Eigen::MatrixXd G;
-            Eigen::VectorXd b;
-            dopp_res(xyzt_dot, ref_ecef, valid_obs, all_sat_states, b, G);
-            
-            std::vector<uint32_t> good_idx;
-            for (uint32_t i = 0; i < valid_obs.size(); ++i)
+            // reference point not given, try calculate using pseudorange
+            std::vector<double> zero_iono_params(8, 0.0);
+            Eigen::Matrix<double, 7, 1> psr_result = solver.psr_pos(valid_obs, valid_ephems, 
+                all_sat_states, zero_iono_params);
+            if (psr_result.head<3>().norm() != 0)
             {
-                if (G.row(i).norm() <= 0)   continue;       // res not computed
-                if (all_sv_azel[i].y() > CUT_OFF_DEGREE/180.0*M_PI)  
-                    good_idx.push_back(i);
+                ref_ecef = psr_result.head<3>();
             }
-            const uint32_t good_num = good_idx.size();
-            Eigen::MatrixXd good_G = Eigen::MatrixXd::Zero(good_num, 4);
-            Eigen::VectorXd good_b = Eigen::VectorXd::Zero(good_num);
-            Eigen::MatrixXd good_W = Eigen::MatrixXd::Zero(good_num, good_num);
-            for (uint32_t i = 0; i < good_num; ++i)
+            else
             {
-                const uint32_t origin_idx = good_idx[i];
-                good_G.row(i) = G.row(origin_idx);
-                good_b(i) = b(origin_idx);
-                const double sin_el = sin(all_sv_azel[origin_idx].y());
-                double weight = sin_el*sin_el;
-                const ObsPtr &this_obs = valid_obs[origin_idx];
-                int l1_idx = -1;
-                L1_freq(this_obs, &l1_idx);
-                LOG_IF(FATAL, l1_idx < 0) << "[gnss_comm::dopp_vel] no L1 observation found.\n";
-                if (this_obs->dopp_std[l1_idx] > 0)
-                    weight /= (this_obs->dopp_std[l1_idx]/0.256);
-
-                const uint32_t obs_sys = satsys(this_obs->sat, NULL);
-                if (obs_sys == SYS_GPS || obs_sys == SYS_BDS)
-                    weight /= valid_ephems[origin_idx]->ura-1;
-                else if (obs_sys == SYS_GAL)
-                    weight /= valid_ephems[origin_idx]->ura-2;
-                else if (obs_sys == SYS_GLO)
-                    weight /= 2;
-                good_W(i, i) = weight;
+                LOG(ERROR) << "[gnss_comm::dopp_vel] Unable to initialize reference position for Doppler calculation.\n";
+                return Eigen::Matrix<double, 4, 1>::Zero();
             }
-
-            // solve
-            Eigen::VectorXd dx = -(good_G.transpose()*good_W*good_G).inverse() * good_G.transpose() * good_W * good_b;
-            dx_norm = dx.norm();
-            xyzt_dot += dx;
-
-            // dx_norm = 0;
-            // LOG(INFO) << "cov is \n" << (G.transpose()*W*G).inverse();
-            ++num_iter;
         }
-
-        if (num_iter == MAX_ITER_PVT)
-            LOG(WARNING) << "[gnss_comm::dopp_vel] XYZT solver reached maximum iterations.\n";
-        
-        result = xyzt_dot;
-        return result;
+        return solver.dopp_vel(valid_obs, valid_ephems, all_sat_states, ref_ecef);
     }
 }
\ No newline at end of file
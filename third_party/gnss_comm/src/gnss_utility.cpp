@@ -31,6 +31,8 @@
 
 #include "gnss_utility.hpp"
 
+#include <atomic>
+
 namespace gnss_comm
 {
     // some of the following functions are adapted from RTKLIB
@@ -639,6 +641,167 @@ namespace gnss_comm
         return sv_vel;
     }
 
+    ObsPtr ObsPool::acquire()
+    {
+        // objects come back roughly in the order they were handed out, a short scan finds one
+        const size_t num_scan = std::min(pool_.size(), static_cast<size_t>(16));
+        for (size_t i = 0; i < num_scan; ++i)
+        {
+            ObsPtr &obs = pool_[cursor_];
+            cursor_ = (cursor_ + 1) % pool_.size();
+            if (obs.use_count() == 1)
+            {
+                // pairs with the release of the last other owner
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return obs;
+            }
+        }
+        ObsPtr obs(new Obs());
+        if (pool_.size() < max_size_)
+        {
+            pool_.insert(pool_.begin() + cursor_, obs);
+            cursor_ = (cursor_ + 1) % pool_.size();
+        }
+        return obs;
+    }
+
+    void EphemBatch::resize(size_t num)
+    {
+        pos_x.resize(num);
+        pos_y.resize(num);
+        pos_z.resize(num);
+        vel_x.resize(num);
+        vel_y.resize(num);
+        vel_z.resize(num);
+        dt.resize(num);
+        ddt.resize(num);
+    }
+
+    void eph2state_batch(const gtime_t &time, const double *time_offset, const EphemPtr *ephems, 
+        size_t num, EphemBatch &batch)
+    {
+        enum { TK, DT_TOC, SQRT_MU_A, A, E, MK0, N, OMG, CUS, CUC, CRS, CRC, CIS, CIC, I0, I_DOT, 
+               OMG_K0, OMG_RATE, AF0, AF1, AF2, EARTH_OMG, NUM_COLS };
+        batch.resize(num);
+        batch.work.resize(NUM_COLS * num);
+        batch.geo_indices.clear();
+        double *col[NUM_COLS];
+        for (int k = 0; k < NUM_COLS; ++k)
+            col[k] = batch.work.data() + k * num;
+
+        // gather the ephemeris parameters, resolving the per system constants
+        for (size_t i = 0; i < num; ++i)
+        {
+            const Ephem &eph = *ephems[i];
+            double tk = time_diff(time, eph.toe) + time_offset[i];
+            if (tk > WEEK_SECONDS/2)
+                tk -= WEEK_SECONDS;
+            else if (tk < -WEEK_SECONDS/2)
+                tk += WEEK_SECONDS;
+            if (std::abs(tk) > EPH_VALID_SECONDS)
+                LOG(WARNING) << "Ephemeris is not valid anymore";
+
+            uint32_t prn;
+            uint32_t sys = satsys(eph.sat, &prn);
+            double mu = MU, earth_omg = EARTH_OMG_GPS;
+            switch (sys)
+            {
+                case SYS_GPS: mu = MU_GPS; earth_omg = EARTH_OMG_GPS; break;
+                case SYS_GAL: mu = MU;     earth_omg = EARTH_OMG_GPS; break;
+                case SYS_GLO: mu = MU;     earth_omg = EARTH_OMG_GLO; break;
+                case SYS_BDS: mu = MU;     earth_omg = EARTH_OMG_BDS; break;
+            }
+            const double toe_tow = (sys == SYS_BDS ? time2bdt(time_add(eph.toe, -14), NULL) : eph.toe_tow);
+            const bool is_geo = (sys == SYS_BDS && prn <= 5);
+            if (is_geo)
+                batch.geo_indices.push_back(i);
+
+            col[TK][i] = tk;
+            col[DT_TOC][i] = time_diff(time, eph.toc) + time_offset[i];
+            col[SQRT_MU_A][i] = sqrt(mu * eph.A);
+            col[A][i] = eph.A;
+            col[E][i] = eph.e;
+            col[MK0][i] = eph.M0;
+            col[N][i] = sqrt(mu / pow(eph.A, 3)) + eph.delta_n;
+            col[OMG][i] = eph.omg;
+            col[CUS][i] = eph.cus;  col[CUC][i] = eph.cuc;
+            col[CRS][i] = eph.crs;  col[CRC][i] = eph.crc;
+            col[CIS][i] = eph.cis;  col[CIC][i] = eph.cic;
+            col[I0][i] = eph.i0;
+            col[I_DOT][i] = eph.i_dot;
+            // OMG_k = OMG_K0 + OMG_RATE * tk, the GEO orbit is rotated into ECEF afterwards
+            col[OMG_K0][i] = eph.OMG0 - earth_omg * toe_tow;
+            col[OMG_RATE][i] = eph.OMG_dot - (is_geo ? 0.0 : earth_omg);
+            col[AF0][i] = eph.af0;  col[AF1][i] = eph.af1;  col[AF2][i] = eph.af2;
+            col[EARTH_OMG][i] = earth_omg;
+        }
+
+        // same equations as eph2pos and eph2vel
+        for (size_t i = 0; i < num; ++i)
+        {
+            const double tk = col[TK][i], e = col[E][i], n = col[N][i];
+            const double Mk = col[MK0][i] + n * tk;
+            double Ek = Mk;
+            for (int iter = 0; iter < KEPLER_BATCH_ITER; ++iter)
+                Ek -= (Ek - e * sin(Ek) - Mk) / (1.0 - e * cos(Ek));
+            const double sin_Ek = sin(Ek), cos_Ek = cos(Ek);
+            const double sqrt_1_e2 = sqrt(1 - e*e);
+            const double Ek_dot = n / (1 - e*cos_Ek);
+            const double vk_dot = sqrt_1_e2 * Ek_dot / (1 - e*cos_Ek);
+            const double vk = atan2(sqrt_1_e2 * sin_Ek, cos_Ek - e);
+            const double phi = vk + col[OMG][i];
+            const double cos_2phi = cos(2 * phi), sin_2phi = sin(2 * phi);
+
+            const double uk = phi + col[CUS][i] * sin_2phi + col[CUC][i] * cos_2phi;
+            const double rk = col[A][i] * (1 - e * cos_Ek) + col[CRS][i] * sin_2phi + col[CRC][i] * cos_2phi;
+            const double ik = col[I0][i] + col[I_DOT][i] * tk + col[CIS][i] * sin_2phi + col[CIC][i] * cos_2phi;
+            const double uk_dot = vk_dot + 2 * vk_dot * (col[CUS][i]*cos_2phi - col[CUC][i]*sin_2phi);
+            const double rk_dot = col[A][i] * e * Ek_dot * sin_Ek + 2 * vk_dot * (col[CRS][i]*cos_2phi - col[CRC][i]*sin_2phi);
+            const double ik_dot = col[I_DOT][i] + 2 * vk_dot * (col[CIS][i]*cos_2phi - col[CIC][i]*sin_2phi);
+            const double sin_ik = sin(ik), cos_ik = cos(ik);
+            const double sin_uk = sin(uk), cos_uk = cos(uk);
+
+            const double xk_prime = rk * cos_uk, yk_prime = rk * sin_uk;
+            const double xk_prime_dot = rk_dot * cos_uk - rk * uk_dot * sin_uk;
+            const double yk_prime_dot = rk_dot * sin_uk + rk * uk_dot * cos_uk;
+
+            const double OMGk_dot = col[OMG_RATE][i];
+            const double OMG_k = col[OMG_K0][i] + OMGk_dot * tk;
+            const double sin_OMG_k = sin(OMG_k), cos_OMG_k = cos(OMG_k);
+            batch.pos_x[i] = xk_prime * cos_OMG_k - yk_prime * cos_ik * sin_OMG_k;
+            batch.pos_y[i] = xk_prime * sin_OMG_k + yk_prime * cos_ik * cos_OMG_k;
+            batch.pos_z[i] = yk_prime * sin_ik;
+            const double term1 = xk_prime_dot - yk_prime*OMGk_dot*cos_ik;
+            const double term2 = xk_prime*OMGk_dot + yk_prime_dot*cos_ik - yk_prime*ik_dot*sin_ik;
+            batch.vel_x[i] = term1 * cos_OMG_k - term2 * sin_OMG_k;
+            batch.vel_y[i] = term1 * sin_OMG_k + term2 * cos_OMG_k;
+            batch.vel_z[i] = yk_prime_dot * sin_ik + yk_prime_dot * ik_dot * cos_ik;
+
+            const double dt = col[DT_TOC][i];
+            const double rel = 2.0 * col[SQRT_MU_A][i] * e / LIGHT_SPEED / LIGHT_SPEED;
+            batch.dt[i] = col[AF0][i] + col[AF1][i] * dt + col[AF2][i] * dt * dt - rel * sin_Ek;
+            batch.ddt[i] = col[AF1][i] + 2.0 * col[AF2][i] * dt - rel * cos_Ek * Ek_dot;
+        }
+
+        // BDS GEO: the orbit above is in the inclined frame, rotate it into ECEF
+        for (size_t i : batch.geo_indices)
+        {
+            const double earth_omg = col[EARTH_OMG][i], tk = col[TK][i];
+            const double xg = batch.pos_x[i], yg = batch.pos_y[i], zg = batch.pos_z[i];
+            const double xg_dot = batch.vel_x[i], yg_dot = batch.vel_y[i], zg_dot = batch.vel_z[i];
+            const double sin_o = sin(earth_omg * tk), cos_o = cos(earth_omg * tk);
+            const double sin_o_dot = earth_omg * cos_o, cos_o_dot = -earth_omg * sin_o;
+            batch.pos_x[i] =  xg * cos_o + yg * sin_o * COS_N5 + zg * sin_o * SIN_N5;
+            batch.pos_y[i] = -xg * sin_o + yg * cos_o * COS_N5 + zg * cos_o * SIN_N5;
+            batch.pos_z[i] = -yg * SIN_N5 + zg * COS_N5;
+            batch.vel_x[i] = xg_dot*cos_o + xg*cos_o_dot + yg_dot*sin_o*COS_N5 + yg*sin_o_dot*COS_N5 + 
+                             zg_dot*sin_o*SIN_N5 + zg*sin_o_dot*SIN_N5;
+            batch.vel_y[i] = -xg_dot*sin_o - xg*sin_o_dot + yg_dot*cos_o*COS_N5 + yg*cos_o_dot*COS_N5 + 
+                             zg_dot*cos_o*SIN_N5 + zg*cos_o_dot*SIN_N5;
+            batch.vel_z[i] = -yg_dot*SIN_N5 + zg_dot*COS_N5;
+        }
+    }
+
     void deq(const Eigen::Vector3d &pos, const Eigen::Vector3d &vel, const Eigen::Vector3d &acc,
              Eigen::Vector3d &pos_dot, Eigen::Vector3d &vel_dot)
     {
@@ -730,6 +893,60 @@ namespace gnss_comm
         return sv_vel;
     }
 
+    GloOrbitPropagator::GloOrbitPropagator(const GloEphem &geph)
+        : toe(geph.toe), tau_n(geph.tau_n), gamma(geph.gamma)
+    {
+        Node node;
+        node.pos << geph.pos[0], geph.pos[1], geph.pos[2];
+        node.vel << geph.vel[0], geph.vel[1], geph.vel[2];
+        acc << geph.acc[0], geph.acc[1], geph.acc[2];
+        forward_nodes.push_back(node);
+        backward_nodes.push_back(node);
+    }
+
+    void GloOrbitPropagator::propagate(const gtime_t &curr_time, Eigen::Vector3d &sv_pos, 
+        Eigen::Vector3d &sv_vel, double *svdt, double *svddt)
+    {
+        double dt = time_diff(curr_time, toe);
+        if (svdt)   *svdt = -tau_n + gamma * dt;
+        if (svddt)  *svddt = gamma;
+
+        // same steps as geph2pos: full TSTEP steps while |dt| >= TSTEP, then one partial step
+        const double tt = dt<0.0?-TSTEP:TSTEP;
+        size_t num_steps = 0;
+        for (; fabs(dt) > 1e-9 && fabs(dt) >= TSTEP; dt -= tt)
+            ++num_steps;
+
+        {
+            std::lock_guard<std::mutex> lk(m_nodes);
+            std::vector<Node> &nodes = (tt < 0.0 ? backward_nodes : forward_nodes);
+            while (nodes.size() <= num_steps)
+            {
+                Node node = nodes.back();
+                glo_orbit(tt, node.pos, node.vel, acc);
+                nodes.push_back(node);
+            }
+            sv_pos = nodes[num_steps].pos;
+            sv_vel = nodes[num_steps].vel;
+        }
+        if (fabs(dt) > 1e-9)
+            glo_orbit(dt, sv_pos, sv_vel, acc);
+    }
+
+    void geph2state(const gtime_t &curr_time, const GloEphemPtr geph_ptr, Eigen::Vector3d &sv_pos, 
+        Eigen::Vector3d &sv_vel, double *svdt, double *svddt)
+    {
+        std::shared_ptr<GloOrbitPropagator> orbit = std::atomic_load(&geph_ptr->orbit);
+        if (!orbit)
+        {
+            std::shared_ptr<GloOrbitPropagator> new_orbit(new GloOrbitPropagator(*geph_ptr));
+            // another thread may have created one in the meantime, then that one is used
+            if (std::atomic_compare_exchange_strong(&geph_ptr->orbit, &orbit, new_orbit))
+                orbit = new_orbit;
+        }
+        orbit->propagate(curr_time, sv_pos, sv_vel, svdt, svddt);
+    }
+
     Eigen::Vector3d ecef2enu(const Eigen::Vector3d &ref_lla, const Eigen::Vector3d &v_ecef)
     {
         double lat = ref_lla.x() * D2R, lon = ref_lla.y() * D2R;
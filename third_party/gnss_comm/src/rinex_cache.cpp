@@ -0,0 +1,435 @@
+/**
+* This file is part of gnss_comm.
+*
+* Copyright (C) 2021 Aerial Robotics Group, Hong Kong University of Science and Technology
+* Author: CAO Shaozu (shaozu.cao@gmail.com)
+*
+* gnss_comm is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* gnss_comm is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with gnss_comm. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rinex_cache.hpp"
+#include "rinex_helper.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+namespace gnss_comm
+{
+    static const uint32_t CACHE_MAGIC   = 0x48434347;      // "GCCH"
+    static const uint32_t CACHE_VERSION = 1;
+    enum CacheKind : uint32_t { CACHE_OBS = 1, CACHE_EPHEM = 2, CACHE_IONO = 3 };
+    enum EphemType : uint8_t { EPHEM_KEPLER = 0, EPHEM_GLO = 1 };
+
+    static bool file_exists(const std::string &filepath)
+    {
+        struct stat file_stat;
+        return stat(filepath.c_str(), &file_stat) == 0;
+    }
+
+    uint64_t rinex_file_hash(const std::string &filepath, uint64_t *file_size)
+    {
+        RinexFile file(filepath);
+        if (file_size)  *file_size = file.size();
+        if (!file.valid())  return 0;
+
+        // FNV-1a over 8-byte words, the tail bytes one by one
+        const uint64_t prime = 0x100000001b3ULL;
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        const char *p = file.data(), *end = file.data() + file.size();
+        for (; p + 8 <= end; p += 8)
+        {
+            uint64_t word;
+            memcpy(&word, p, 8);
+            hash = (hash ^ word) * prime;
+        }
+        for (; p < end; ++p)
+            hash = (hash ^ static_cast<uint8_t>(*p)) * prime;
+        return hash;
+    }
+
+    /* append-only byte buffer, written to the cache file at once */
+    class CacheWriter
+    {
+      public:
+        template <typename T>
+        void put(const T &value)
+        {
+            const char *bytes = reinterpret_cast<const char*>(&value);
+            buf_.insert(buf_.end(), bytes, bytes + sizeof(T));
+        }
+        template <typename T>
+        void put_vector(const std::vector<T> &values)
+        {
+            const char *bytes = reinterpret_cast<const char*>(values.data());
+            buf_.insert(buf_.end(), bytes, bytes + values.size() * sizeof(T));
+        }
+        void put_time(const gtime_t &t)
+        {
+            put(static_cast<int64_t>(t.time));
+            put(t.sec);
+        }
+        bool write(const std::string &filepath) const
+        {
+            const std::string tmp_filepath = filepath + ".tmp";
+            FILE *fp = fopen(tmp_filepath.c_str(), "wb");
+            if (!fp)    return false;
+            const bool ok = (fwrite(buf_.data(), 1, buf_.size(), fp) == buf_.size());
+            if (fclose(fp) != 0 || !ok || rename(tmp_filepath.c_str(), filepath.c_str()) != 0)
+            {
+                remove(tmp_filepath.c_str());
+                return false;
+            }
+            return true;
+        }
+
+      private:
+        std::vector<char> buf_;
+    };
+
+    /* bounds-checked reader over the mapped cache file, any overrun fails the whole load */
+    class CacheReader
+    {
+      public:
+        CacheReader(const char *data, size_t size) : p_(data), end_(data + size), ok_(data != nullptr) {}
+        bool ok() const { return ok_; }
+        template <typename T>
+        T get()
+        {
+            T value = T();
+            if (ok_ && p_ + sizeof(T) <= end_)
+            {
+                memcpy(&value, p_, sizeof(T));
+                p_ += sizeof(T);
+            }
+            else
+            {
+                ok_ = false;
+            }
+            return value;
+        }
+        template <typename T>
+        void get_vector(std::vector<T> &values, size_t num)
+        {
+            if (!ok_ || num > static_cast<size_t>(end_ - p_) / sizeof(T))
+            {
+                ok_ = false;
+                return;
+            }
+            values.resize(num);
+            memcpy(values.data(), p_, num * sizeof(T));
+            p_ += num * sizeof(T);
+        }
+        gtime_t get_time()
+        {
+            gtime_t t;
+            t.time = static_cast<time_t>(get<int64_t>());
+            t.sec = get<double>();
+            return t;
+        }
+
+      private:
+        const char *p_, *end_;
+        bool ok_;
+    };
+
+    static bool put_header(CacheWriter &writer, const std::string &rinex_filepath, CacheKind kind)
+    {
+        uint64_t source_size = 0;
+        const uint64_t source_hash = rinex_file_hash(rinex_filepath, &source_size);
+        if (source_size == 0)   return false;
+        writer.put(CACHE_MAGIC);
+        writer.put(CACHE_VERSION);
+        writer.put(static_cast<uint32_t>(kind));
+        writer.put(static_cast<uint32_t>(0));
+        writer.put(source_size);
+        writer.put(source_hash);
+        return true;
+    }
+
+    static bool check_header(CacheReader &reader, const std::string &rinex_filepath, CacheKind kind)
+    {
+        const uint32_t magic = reader.get<uint32_t>();
+        const uint32_t version = reader.get<uint32_t>();
+        const uint32_t cache_kind = reader.get<uint32_t>();
+        reader.get<uint32_t>();
+        const uint64_t cache_size = reader.get<uint64_t>();
+        const uint64_t cache_hash = reader.get<uint64_t>();
+        if (!reader.ok() || magic != CACHE_MAGIC || version != CACHE_VERSION || cache_kind != kind)
+            return false;
+        uint64_t source_size = 0;
+        const uint64_t source_hash = rinex_file_hash(rinex_filepath, &source_size);
+        return source_size == cache_size && source_hash == cache_hash;
+    }
+
+    bool save_obs_cache(const std::string &cache_filepath, const std::string &rinex_filepath, 
+        const std::vector<std::vector<ObsPtr>> &rinex_meas)
+    {
+        CacheWriter writer;
+        if (!put_header(writer, rinex_filepath, CACHE_OBS))   return false;
+        writer.put(static_cast<uint64_t>(rinex_meas.size()));
+        for (const auto &meas : rinex_meas)
+        {
+            writer.put(static_cast<uint32_t>(meas.size()));
+            for (const ObsPtr &obs : meas)
+            {
+                const size_t num_freqs = obs->freqs.size();
+                writer.put_time(obs->time);
+                writer.put(obs->sat);
+                writer.put(static_cast<uint32_t>(num_freqs));
+                for (const std::vector<double> *values : {&obs->freqs, &obs->CN0, &obs->psr, 
+                        &obs->psr_std, &obs->cp, &obs->cp_std, &obs->dopp, &obs->dopp_std})
+                {
+                    LOG_IF(FATAL, values->size() != num_freqs) << "Suspicious observation field.\n";
+                    writer.put_vector(*values);
+                }
+                for (const std::vector<uint8_t> *values : {&obs->LLI, &obs->code, &obs->status})
+                {
+                    LOG_IF(FATAL, values->size() != num_freqs) << "Suspicious observation field.\n";
+                    writer.put_vector(*values);
+                }
+            }
+        }
+        return writer.write(cache_filepath);
+    }
+
+    bool load_obs_cache(const std::string &cache_filepath, const std::string &rinex_filepath, 
+        std::vector<std::vector<ObsPtr>> &rinex_meas)
+    {
+        if (!file_exists(cache_filepath))   return false;
+        RinexFile file(cache_filepath);
+        if (!file.valid())  return false;
+        CacheReader reader(file.data(), file.size());
+        if (!check_header(reader, rinex_filepath, CACHE_OBS))     return false;
+
+        std::vector<std::vector<ObsPtr>> cached_meas;
+        const uint64_t num_epochs = reader.get<uint64_t>();
+        for (uint64_t i = 0; i < num_epochs && reader.ok(); ++i)
+        {
+            const uint32_t num_obs = reader.get<uint32_t>();
+            std::vector<ObsPtr> meas;
+            for (uint32_t j = 0; j < num_obs && reader.ok(); ++j)
+            {
+                ObsPtr obs(new Obs());
+                obs->time = reader.get_time();
+                obs->sat = reader.get<uint32_t>();
+                const uint32_t num_freqs = reader.get<uint32_t>();
+                for (std::vector<double> *values : {&obs->freqs, &obs->CN0, &obs->psr, 
+                        &obs->psr_std, &obs->cp, &obs->cp_std, &obs->dopp, &obs->dopp_std})
+                    reader.get_vector(*values, num_freqs);
+                for (std::vector<uint8_t> *values : {&obs->LLI, &obs->code, &obs->status})
+                    reader.get_vector(*values, num_freqs);
+                meas.push_back(obs);
+            }
+            cached_meas.push_back(meas);
+        }
+        if (!reader.ok())   return false;
+        rinex_meas.insert(rinex_meas.end(), cached_meas.begin(), cached_meas.end());
+        return true;
+    }
+
+    bool save_ephem_cache(const std::string &cache_filepath, const std::string &rinex_filepath, 
+        const std::map<uint32_t, std::vector<EphemBasePtr>> &sat2ephem)
+    {
+        CacheWriter writer;
+        if (!put_header(writer, rinex_filepath, CACHE_EPHEM))     return false;
+        writer.put(static_cast<uint64_t>(sat2ephem.size()));
+        for (const auto &sat_ephems : sat2ephem)
+        {
+            writer.put(sat_ephems.first);
+            writer.put(static_cast<uint32_t>(sat_ephems.second.size()));
+            for (const EphemBasePtr &ephem_base : sat_ephems.second)
+            {
+                const GloEphemPtr glo_ephem = std::dynamic_pointer_cast<GloEphem>(ephem_base);
+                writer.put(glo_ephem ? EPHEM_GLO : EPHEM_KEPLER);
+                writer.put(ephem_base->sat);
+                writer.put_time(ephem_base->ttr);
+                writer.put_time(ephem_base->toe);
+                writer.put(ephem_base->health);
+                writer.put(ephem_base->ura);
+                writer.put(ephem_base->iode);
+                if (glo_ephem)
+                {
+                    writer.put(glo_ephem->freqo);
+                    writer.put(glo_ephem->age);
+                    for (size_t k = 0; k < 3; ++k)
+                    {
+                        writer.put(glo_ephem->pos[k]);
+                        writer.put(glo_ephem->vel[k]);
+                        writer.put(glo_ephem->acc[k]);
+                    }
+                    writer.put(glo_ephem->tau_n);
+                    writer.put(glo_ephem->gamma);
+                    writer.put(glo_ephem->delta_tau_n);
+                    continue;
+                }
+                const EphemPtr ephem = std::dynamic_pointer_cast<Ephem>(ephem_base);
+                writer.put_time(ephem->toc);
+                writer.put(ephem->toe_tow);
+                writer.put(ephem->week);
+                writer.put(ephem->iodc);
+                writer.put(ephem->code);
+                for (double value : {ephem->A, ephem->e, ephem->i0, ephem->omg, ephem->OMG0, 
+                        ephem->M0, ephem->delta_n, ephem->OMG_dot, ephem->i_dot, 
+                        ephem->cuc, ephem->cus, ephem->crc, ephem->crs, ephem->cic, ephem->cis, 
+                        ephem->af0, ephem->af1, ephem->af2, ephem->tgd[0], ephem->tgd[1], 
+                        ephem->A_dot, ephem->n_dot})
+                    writer.put(value);
+            }
+        }
+        return writer.write(cache_filepath);
+    }
+
+    bool load_ephem_cache(const std::string &cache_filepath, const std::string &rinex_filepath, 
+        std::map<uint32_t, std::vector<EphemBasePtr>> &sat2ephem)
+    {
+        if (!file_exists(cache_filepath))   return false;
+        RinexFile file(cache_filepath);
+        if (!file.valid())  return false;
+        CacheReader reader(file.data(), file.size());
+        if (!check_header(reader, rinex_filepath, CACHE_EPHEM))   return false;
+
+        std::map<uint32_t, std::vector<EphemBasePtr>> cached_ephems;
+        const uint64_t num_sats = reader.get<uint64_t>();
+        for (uint64_t i = 0; i < num_sats && reader.ok(); ++i)
+        {
+            const uint32_t sat = reader.get<uint32_t>();
+            const uint32_t num_ephems = reader.get<uint32_t>();
+            std::vector<EphemBasePtr> &ephems = cached_ephems[sat];
+            for (uint32_t j = 0; j < num_ephems && reader.ok(); ++j)
+            {
+                const uint8_t type = reader.get<uint8_t>();
+                GloEphemPtr glo_ephem;
+                EphemPtr ephem;
+                EphemBase *ephem_base = nullptr;
+                if (type == EPHEM_GLO)
+                {
+                    glo_ephem.reset(new GloEphem());
+                    ephem_base = glo_ephem.get();
+                }
+                else
+                {
+                    ephem.reset(new Ephem());
+                    ephem_base = ephem.get();
+                }
+                ephem_base->sat = reader.get<uint32_t>();
+                ephem_base->ttr = reader.get_time();
+                ephem_base->toe = reader.get_time();
+                ephem_base->health = reader.get<uint32_t>();
+                ephem_base->ura = reader.get<double>();
+                ephem_base->iode = reader.get<uint32_t>();
+                if (glo_ephem)
+                {
+                    glo_ephem->freqo = reader.get<int>();
+                    glo_ephem->age = reader.get<uint32_t>();
+                    for (size_t k = 0; k < 3; ++k)
+                    {
+                        glo_ephem->pos[k] = reader.get<double>();
+                        glo_ephem->vel[k] = reader.get<double>();
+                        glo_ephem->acc[k] = reader.get<double>();
+                    }
+                    glo_ephem->tau_n = reader.get<double>();
+                    glo_ephem->gamma = reader.get<double>();
+                    glo_ephem->delta_tau_n = reader.get<double>();
+                    ephems.push_back(glo_ephem);
+                    continue;
+                }
+                ephem->toc = reader.get_time();
+                ephem->toe_tow = reader.get<double>();
+                ephem->week = reader.get<uint32_t>();
+                ephem->iodc = reader.get<uint32_t>();
+                ephem->code = reader.get<uint32_t>();
+                for (double *value : {&ephem->A, &ephem->e, &ephem->i0, &ephem->omg, &ephem->OMG0, 
+                        &ephem->M0, &ephem->delta_n, &ephem->OMG_dot, &ephem->i_dot, 
+                        &ephem->cuc, &ephem->cus, &ephem->crc, &ephem->crs, &ephem->cic, &ephem->cis, 
+                        &ephem->af0, &ephem->af1, &ephem->af2, &ephem->tgd[0], &ephem->tgd[1], 
+                        &ephem->A_dot, &ephem->n_dot})
+                    *value = reader.get<double>();
+                ephems.push_back(ephem);
+            }
+        }
+        if (!reader.ok())   return false;
+        for (auto &sat_ephems : cached_ephems)
+        {
+            std::vector<EphemBasePtr> &ephems = sat2ephem[sat_ephems.first];
+            ephems.insert(ephems.end(), sat_ephems.second.begin(), sat_ephems.second.end());
+        }
+        return true;
+    }
+
+    static std::string cache_path(const std::string &rinex_filepath, const std::string &cache_filepath, 
+        const char *suffix)
+    {
+        return cache_filepath.empty() ? rinex_filepath + suffix : cache_filepath;
+    }
+
+    void rinex2obs_cached(const std::string &rinex_filepath, 
+        std::vector<std::vector<ObsPtr>> &rinex_meas, const std::string &cache_filepath)
+    {
+        const std::string filepath = cache_path(rinex_filepath, cache_filepath, ".gcache");
+        if (load_obs_cache(filepath, rinex_filepath, rinex_meas))     return;
+        std::vector<std::vector<ObsPtr>> parsed_meas;
+        rinex2obs(rinex_filepath, parsed_meas);
+        LOG_IF(WARNING, !save_obs_cache(filepath, rinex_filepath, parsed_meas)) 
+            << "Cannot write observation cache " << filepath;
+        rinex_meas.insert(rinex_meas.end(), parsed_meas.begin(), parsed_meas.end());
+    }
+
+    void rinex2ephems_cached(const std::string &rinex_filepath, 
+        std::map<uint32_t, std::vector<EphemBasePtr>> &sat2ephem, const std::string &cache_filepath)
+    {
+        const std::string filepath = cache_path(rinex_filepath, cache_filepath, ".gcache");
+        if (load_ephem_cache(filepath, rinex_filepath, sat2ephem))    return;
+        std::map<uint32_t, std::vector<EphemBasePtr>> parsed_ephems;
+        rinex2ephems(rinex_filepath, parsed_ephems);
+        LOG_IF(WARNING, !save_ephem_cache(filepath, rinex_filepath, parsed_ephems)) 
+            << "Cannot write ephemeris cache " << filepath;
+        for (auto &sat_ephems : parsed_ephems)
+        {
+            std::vector<EphemBasePtr> &ephems = sat2ephem[sat_ephems.first];
+            ephems.insert(ephems.end(), sat_ephems.second.begin(), sat_ephems.second.end());
+        }
+    }
+
+    void rinex2iono_params_cached(const std::string &rinex_filepath, 
+        std::vector<double> &iono_params, const std::string &cache_filepath)
+    {
+        const std::string filepath = cache_path(rinex_filepath, cache_filepath, ".iono.gcache");
+        if (file_exists(filepath))
+        {
+            RinexFile file(filepath);
+            CacheReader reader(file.data(), file.size());
+            if (file.valid() && check_header(reader, rinex_filepath, CACHE_IONO))
+            {
+                std::vector<double> cached_params;
+                reader.get_vector(cached_params, 8);
+                if (reader.ok())
+                {
+                    iono_params.swap(cached_params);
+                    return;
+                }
+            }
+        }
+        rinex2iono_params(rinex_filepath, iono_params);
+        CacheWriter writer;
+        bool saved = put_header(writer, rinex_filepath, CACHE_IONO);
+        if (saved)
+        {
+            writer.put_vector(iono_params);
+            saved = writer.write(filepath);
+        }
+        LOG_IF(WARNING, !saved) << "Cannot write ionosphere cache " << filepath;
+    }
+
+}   // namespace gnss_comm
@@ -20,66 +20,241 @@
 
 #include "rinex_helper.hpp"
 
+#include <cstring>
+#include <cstdarg>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 namespace gnss_comm
 {
-    /* convert string to double  ----------------------------------------------------------
-    * args   : std::string    num_str        I   input string
-    * return : double value inside the string
-    *-------------------------------------------------------------------------------------*/
-    static double str2double(const std::string &num_str)
+    RinexFile::RinexFile(const std::string &rinex_filepath) : data_(nullptr), size_(0), pos_(0)
     {
-        // replace character 'D' with 'e'
-        size_t D_pos = num_str.find("D");
-        std::string tmp_str = num_str;
-        if (D_pos != std::string::npos)
-            tmp_str = tmp_str.replace(D_pos, 1, "e");
-        return std::stod(tmp_str);
+        const int fd = open(rinex_filepath.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            LOG(ERROR) << "Cannot open RINEX file " << rinex_filepath;
+            return;
+        }
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+        {
+            void *addr = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                madvise(addr, file_stat.st_size, MADV_SEQUENTIAL);
+                data_ = static_cast<const char*>(addr);
+                size_ = file_stat.st_size;
+            }
+        }
+        close(fd);
+        LOG_IF(ERROR, !data_) << "Cannot map RINEX file " << rinex_filepath;
+    }
+
+    RinexFile::~RinexFile()
+    {
+        if (data_)
+            munmap(const_cast<char*>(data_), size_);
     }
 
-    static GloEphemPtr rinex_line2glo_ephem(const std::vector<std::string> &ephem_lines, const uint32_t gpst_leap_seconds)
+    static bool read_line(const char *&cursor, const char *end, const char *&line, size_t &len)
+    {
+        if (cursor >= end)  return false;
+        line = cursor;
+        const char *line_end = static_cast<const char*>(memchr(line, '\n', end - cursor));
+        if (!line_end)  line_end = end;
+        cursor = (line_end == end ? end : line_end + 1);
+        len = line_end - line;
+        if (len > 0 && line[len-1] == '\r')  --len;
+        return true;
+    }
+
+    bool RinexFile::next_line(const char *&line, size_t &len)
+    {
+        if (!data_)     return false;
+        const char *cursor = data_ + pos_;
+        const bool has_line = read_line(cursor, data_ + size_, line, len);
+        pos_ = cursor - data_;
+        return has_line;
+    }
+
+    /* convert fixed-width field to double  -------------------------------------------------------
+    * args   : char*     str        I   field start
+    *          size_t    width      I   field width
+    * return : double value inside the field, 0 if blank
+    * Fortran 'D' exponents are accepted. The digits are accumulated as an integer and scaled by an 
+    * exact power of ten, which is correctly rounded; other fields fall back to strtod.
+    *---------------------------------------------------------------------------------------------*/
+    static double field2double(const char *str, size_t width)
+    {
+        static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+        const char *p = str, *end = str + width;
+        while (p < end && *p == ' ')  ++p;
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative = (*p++ == '-');
+        uint64_t mantissa = 0;
+        int num_digits = 0, exp10 = 0;
+        bool exact = true;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p)
+        {
+            if (num_digits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa)  ++num_digits;
+            }
+            else
+            {
+                ++exp10;
+                exact = false;
+            }
+        }
+        if (p < end && *p == '.')
+        {
+            for (++p; p < end && *p >= '0' && *p <= '9'; ++p)
+            {
+                if (num_digits < 19)
+                {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    if (mantissa)  ++num_digits;
+                    --exp10;
+                }
+                else
+                {
+                    exact = false;
+                }
+            }
+        }
+        if (p < end && (*p == 'D' || *p == 'd' || *p == 'E' || *p == 'e'))
+        {
+            ++p;
+            bool exp_negative = false;
+            if (p < end && (*p == '-' || *p == '+'))
+                exp_negative = (*p++ == '-');
+            int exp_value = 0;
+            for (; p < end && *p >= '0' && *p <= '9'; ++p)
+                exp_value = exp_value * 10 + (*p - '0');
+            exp10 += (exp_negative ? -exp_value : exp_value);
+        }
+
+        if (exact && mantissa <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22)
+        {
+            const double value = (exp10 < 0 ? mantissa / pow10[-exp10] : mantissa * pow10[exp10]);
+            return negative ? -value : value;
+        }
+
+        char buf[64];
+        size_t n = 0;
+        for (const char *q = str; q < str + width && n < sizeof(buf)-1; ++q)
+            buf[n++] = (*q == 'D' || *q == 'd') ? 'E' : *q;
+        buf[n] = '\0';
+        return strtod(buf, nullptr);
+    }
+
+    /* convert fixed-width field to integer, like std::stoi but 0 if blank */
+    static int field2int(const char *str, size_t width)
+    {
+        const char *p = str, *end = str + width;
+        while (p < end && *p == ' ')  ++p;
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative = (*p++ == '-');
+        int value = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p)
+            value = value * 10 + (*p - '0');
+        return negative ? -value : value;
+    }
+
+    /* one line of the mapped file, columns past the line end read as blanks */
+    struct RinexLine
+    {
+        const char *str;
+        size_t len;
+
+        char at(size_t i) const { return i < len ? str[i] : ' '; }
+        size_t width(size_t offset, size_t w) const 
+        {
+            return offset >= len ? 0 : std::min(w, len - offset);
+        }
+        double num(size_t offset, size_t w) const 
+        {
+            return field2double(str + offset, width(offset, w));
+        }
+        int integer(size_t offset, size_t w) const 
+        {
+            return field2int(str + offset, width(offset, w));
+        }
+        bool blank(size_t offset, size_t w) const
+        {
+            const size_t n = width(offset, w);
+            for (size_t i = 0; i < n; ++i)
+                if (str[offset+i] != ' ')    return false;
+            return true;
+        }
+        bool contains(const char *label) const
+        {
+            const char *label_end = label + strlen(label);
+            return std::search(str, str+len, label, label_end) != str+len;
+        }
+    };
+
+    static bool next_line(RinexFile &file, RinexLine &line)
+    {
+        return file.next_line(line.str, line.len);
+    }
+
+    static gtime_t rinex_line2epoch(const RinexLine &line)
+    {
+        double epoch[6];
+        epoch[0] = static_cast<double>(line.integer(4, 4));
+        epoch[1] = static_cast<double>(line.integer(9, 2));
+        epoch[2] = static_cast<double>(line.integer(12, 2));
+        epoch[3] = static_cast<double>(line.integer(15, 2));
+        epoch[4] = static_cast<double>(line.integer(18, 2));
+        epoch[5] = static_cast<double>(line.integer(21, 2));
+        return epoch2time(epoch);
+    }
+
+    static GloEphemPtr rinex_line2glo_ephem(const RinexLine *ephem_lines, const uint32_t gpst_leap_seconds)
     {
-        LOG_IF(FATAL, ephem_lines.size() != 4) << "GLO ephemeris record should contain 8 lines";
         LOG_IF(FATAL, ephem_lines[0].at(0) != 'R') << "Not a valid GLO ephemeris record";
         GloEphemPtr glo_ephem(new GloEphem());
 
-        uint32_t prn = static_cast<uint32_t>(std::stoi(ephem_lines[0].substr(1, 2)));
+        uint32_t prn = static_cast<uint32_t>(ephem_lines[0].integer(1, 2));
         glo_ephem->sat = sat_no(SYS_GLO, prn);
-        double epoch[6];
-        epoch[0] = static_cast<double>(std::stoi(ephem_lines[0].substr(4, 4)));
-        epoch[1] = static_cast<double>(std::stoi(ephem_lines[0].substr(9, 2)));
-        epoch[2] = static_cast<double>(std::stoi(ephem_lines[0].substr(12, 2)));
-        epoch[3] = static_cast<double>(std::stoi(ephem_lines[0].substr(15, 2)));
-        epoch[4] = static_cast<double>(std::stoi(ephem_lines[0].substr(18, 2)));
-        epoch[5] = static_cast<double>(std::stoi(ephem_lines[0].substr(21, 2)));
-        glo_ephem->toe = epoch2time(epoch);
+        glo_ephem->toe = rinex_line2epoch(ephem_lines[0]);
         glo_ephem->toe.time += gpst_leap_seconds;
-        glo_ephem->tau_n = -1.0 * str2double(ephem_lines[0].substr(23, 19));
-        glo_ephem->gamma = str2double(ephem_lines[0].substr(42, 19));
+        glo_ephem->tau_n = -1.0 * ephem_lines[0].num(23, 19);
+        glo_ephem->gamma = ephem_lines[0].num(42, 19);
 
         // the second line
-        glo_ephem->pos[0] = str2double(ephem_lines[1].substr(4, 19)) * 1e3;
-        glo_ephem->vel[0] = str2double(ephem_lines[1].substr(23, 19)) * 1e3;
-        glo_ephem->acc[0] = str2double(ephem_lines[1].substr(42, 19)) * 1e3;
-        glo_ephem->health = static_cast<uint32_t>(str2double(ephem_lines[1].substr(61, 19)));
+        glo_ephem->pos[0] = ephem_lines[1].num(4, 19) * 1e3;
+        glo_ephem->vel[0] = ephem_lines[1].num(23, 19) * 1e3;
+        glo_ephem->acc[0] = ephem_lines[1].num(42, 19) * 1e3;
+        glo_ephem->health = static_cast<uint32_t>(ephem_lines[1].num(61, 19));
 
         // the third line
-        glo_ephem->pos[1] = str2double(ephem_lines[2].substr(4, 19)) * 1e3;
-        glo_ephem->vel[1] = str2double(ephem_lines[2].substr(23, 19)) * 1e3;
-        glo_ephem->acc[1] = str2double(ephem_lines[2].substr(42, 19)) * 1e3;
-        glo_ephem->freqo  = static_cast<int>(str2double(ephem_lines[2].substr(61, 19)));
+        glo_ephem->pos[1] = ephem_lines[2].num(4, 19) * 1e3;
+        glo_ephem->vel[1] = ephem_lines[2].num(23, 19) * 1e3;
+        glo_ephem->acc[1] = ephem_lines[2].num(42, 19) * 1e3;
+        glo_ephem->freqo  = static_cast<int>(ephem_lines[2].num(61, 19));
 
         // the forth line
-        glo_ephem->pos[2] = str2double(ephem_lines[3].substr(4, 19)) * 1e3;
-        glo_ephem->vel[2] = str2double(ephem_lines[3].substr(23, 19)) * 1e3;
-        glo_ephem->acc[2] = str2double(ephem_lines[3].substr(42, 19)) * 1e3;
-        glo_ephem->age  = static_cast<uint32_t>(str2double(ephem_lines[3].substr(61, 19)));
+        glo_ephem->pos[2] = ephem_lines[3].num(4, 19) * 1e3;
+        glo_ephem->vel[2] = ephem_lines[3].num(23, 19) * 1e3;
+        glo_ephem->acc[2] = ephem_lines[3].num(42, 19) * 1e3;
+        glo_ephem->age  = static_cast<uint32_t>(ephem_lines[3].num(61, 19));
 
         return glo_ephem;
     }
 
-    static EphemPtr rinex_line2ephem(const std::vector<std::string> &ephem_lines)
+    static EphemPtr rinex_line2ephem(const RinexLine *ephem_lines)
     {
-        LOG_IF(FATAL, ephem_lines.size() != 8) << "Ephemeris record should contain 8 lines";
         uint32_t sat_sys = SYS_NONE;
         if      (ephem_lines[0].at(0) == 'G')    sat_sys = SYS_GPS;
         else if (ephem_lines[0].at(0) == 'C')    sat_sys = SYS_BDS;
@@ -87,73 +262,66 @@ namespace gnss_comm
         LOG_IF(FATAL, sat_sys == SYS_NONE) << "Satellite system is not supported: " << ephem_lines[0].at(0);
 
         EphemPtr ephem(new Ephem());
-        uint32_t prn = static_cast<uint32_t>(std::stoi(ephem_lines[0].substr(1, 2)));
+        uint32_t prn = static_cast<uint32_t>(ephem_lines[0].integer(1, 2));
         ephem->sat = sat_no(sat_sys, prn);
-        double epoch[6];
-        epoch[0] = static_cast<double>(std::stoi(ephem_lines[0].substr(4, 4)));
-        epoch[1] = static_cast<double>(std::stoi(ephem_lines[0].substr(9, 2)));
-        epoch[2] = static_cast<double>(std::stoi(ephem_lines[0].substr(12, 2)));
-        epoch[3] = static_cast<double>(std::stoi(ephem_lines[0].substr(15, 2)));
-        epoch[4] = static_cast<double>(std::stoi(ephem_lines[0].substr(18, 2)));
-        epoch[5] = static_cast<double>(std::stoi(ephem_lines[0].substr(21, 2)));
-        ephem->toc = epoch2time(epoch);
+        ephem->toc = rinex_line2epoch(ephem_lines[0]);
         if (sat_sys == SYS_BDS)     ephem->toc.time += 14;     // BDS-GPS time correction
-        ephem->af0 = str2double(ephem_lines[0].substr(23, 19));
-        ephem->af1 = str2double(ephem_lines[0].substr(42, 19));
-        ephem->af2 = str2double(ephem_lines[0].substr(61, 19));
+        ephem->af0 = ephem_lines[0].num(23, 19);
+        ephem->af1 = ephem_lines[0].num(42, 19);
+        ephem->af2 = ephem_lines[0].num(61, 19);
 
         // the second line
         if (sat_sys == SYS_GPS)
-            ephem->iode  = str2double(ephem_lines[1].substr(4, 19));
-        ephem->crs       = str2double(ephem_lines[1].substr(23, 19));
-        ephem->delta_n   = str2double(ephem_lines[1].substr(42, 19));
-        ephem->M0        = str2double(ephem_lines[1].substr(61, 19));
+            ephem->iode  = ephem_lines[1].num(4, 19);
+        ephem->crs       = ephem_lines[1].num(23, 19);
+        ephem->delta_n   = ephem_lines[1].num(42, 19);
+        ephem->M0        = ephem_lines[1].num(61, 19);
 
         // the third line
-        ephem->cuc = str2double(ephem_lines[2].substr(4, 19));
-        ephem->e = str2double(ephem_lines[2].substr(23, 19));
-        ephem->cus = str2double(ephem_lines[2].substr(42, 19));
-        double sqrt_A = str2double(ephem_lines[2].substr(61, 19));
+        ephem->cuc = ephem_lines[2].num(4, 19);
+        ephem->e = ephem_lines[2].num(23, 19);
+        ephem->cus = ephem_lines[2].num(42, 19);
+        double sqrt_A = ephem_lines[2].num(61, 19);
         ephem->A = sqrt_A * sqrt_A;
 
         // the forth line
-        ephem->toe_tow = str2double(ephem_lines[3].substr(4, 19));
-        ephem->cic = str2double(ephem_lines[3].substr(23, 19));
-        ephem->OMG0 = str2double(ephem_lines[3].substr(42, 19));
-        ephem->cis = str2double(ephem_lines[3].substr(61, 19));
+        ephem->toe_tow = ephem_lines[3].num(4, 19);
+        ephem->cic = ephem_lines[3].num(23, 19);
+        ephem->OMG0 = ephem_lines[3].num(42, 19);
+        ephem->cis = ephem_lines[3].num(61, 19);
 
         // the fifth line
-        ephem->i0 = str2double(ephem_lines[4].substr(4, 19));
-        ephem->crc = str2double(ephem_lines[4].substr(23, 19));
-        ephem->omg = str2double(ephem_lines[4].substr(42, 19));
-        ephem->OMG_dot = str2double(ephem_lines[4].substr(61, 19));
+        ephem->i0 = ephem_lines[4].num(4, 19);
+        ephem->crc = ephem_lines[4].num(23, 19);
+        ephem->omg = ephem_lines[4].num(42, 19);
+        ephem->OMG_dot = ephem_lines[4].num(61, 19);
 
         // the sixth line
-        ephem->i_dot = str2double(ephem_lines[5].substr(4, 19));
+        ephem->i_dot = ephem_lines[5].num(4, 19);
         if  (sat_sys == SYS_GAL)
         {
-            uint32_t ephe_source = static_cast<uint32_t>(str2double(ephem_lines[5].substr(23, 19)));
+            uint32_t ephe_source = static_cast<uint32_t>(ephem_lines[5].num(23, 19));
             if (!(ephe_source & 0x01))  
             {
                 // LOG(ERROR) << "not contain I/NAV E1-b info, skip this ephemeris";
                 return ephem;   // only parse I/NAV E1-b ephemeris
             }
         }
-        ephem->week = static_cast<uint32_t>(str2double(ephem_lines[5].substr(42, 19)));
+        ephem->week = static_cast<uint32_t>(ephem_lines[5].num(42, 19));
         if (sat_sys == SYS_GPS || sat_sys == SYS_GAL)     ephem->toe = gpst2time(ephem->week, ephem->toe_tow);
         else if (sat_sys == SYS_BDS)                      ephem->toe = bdt2time(ephem->week, ephem->toe_tow+14);
         // if (sat_sys == SYS_GAL)     ephem->toe = gst2time(ephem->week, ephem->toe_tow);
 
         // the seventh line
-        ephem->ura = str2double(ephem_lines[6].substr(4, 19));
-        ephem->health = static_cast<uint32_t>(str2double(ephem_lines[6].substr(23, 19)));
-        ephem->tgd[0] = str2double(ephem_lines[6].substr(42, 19));
+        ephem->ura = ephem_lines[6].num(4, 19);
+        ephem->health = static_cast<uint32_t>(ephem_lines[6].num(23, 19));
+        ephem->tgd[0] = ephem_lines[6].num(42, 19);
         if (sat_sys == SYS_BDS || sat_sys == SYS_GAL)
-            ephem->tgd[1] = str2double(ephem_lines[6].substr(61, 19));
-        if (sat_sys == SYS_GPS)     ephem->iodc = str2double(ephem_lines[6].substr(61, 19));
+            ephem->tgd[1] = ephem_lines[6].num(61, 19);
+        if (sat_sys == SYS_GPS)     ephem->iodc = ephem_lines[6].num(61, 19);
 
         // the eighth line
-        double ttr_tow = str2double(ephem_lines[7].substr(4, 19));
+        double ttr_tow = ephem_lines[7].num(4, 19);
         // GAL week = GST week + 1024 + rollover, already align with GPS week!!!
         if      (sat_sys == SYS_GPS || sat_sys == SYS_GAL)   ephem->ttr = gpst2time(ephem->week, ttr_tow);
         else if (sat_sys == SYS_BDS)   ephem->ttr = bdt2time(ephem->week, ttr_tow);
@@ -169,229 +337,298 @@ namespace gnss_comm
         return ephem;
     }
 
-    void rinex2ephems(const std::string &rinex_filepath, std::map<uint32_t, std::vector<EphemBasePtr>> &sat2ephem)
+    void rinex2ephems(const std::string &rinex_filepath, 
+        const std::function<void(const EphemBasePtr&)> &ephem_callback)
     {
+        RinexFile ephem_file(rinex_filepath);
+        if (!ephem_file.valid())    return;
         uint32_t gpst_leap_seconds = static_cast<uint32_t>(-1);
-        std::ifstream ephem_file(rinex_filepath);
-        std::string line;
-        while(std::getline(ephem_file, line))
+        RinexLine line;
+        while (next_line(ephem_file, line))
         {
-            if (line.find("RINEX VERSION / TYPE") != std::string::npos && line.find("3.04") == std::string::npos)
+            if (line.contains("RINEX VERSION / TYPE") && !line.contains("3.04"))
             {
                 LOG(ERROR) << "Only RINEX 3.04 is supported for observation file";
                 return;
             }
-            else if (line.find("LEAP SECONDS") != std::string::npos && line.find("BDS") == std::string::npos)
-                gpst_leap_seconds = static_cast<uint32_t>(std::stoi(line.substr(4, 6)));
-            else if (line.find("END OF HEADER") != std::string::npos)
+            else if (line.contains("LEAP SECONDS") && !line.contains("BDS"))
+                gpst_leap_seconds = static_cast<uint32_t>(line.integer(4, 6));
+            else if (line.contains("END OF HEADER"))
                 break;
         }
         LOG_IF(FATAL, gpst_leap_seconds == static_cast<uint32_t>(-1)) << "No leap second record found";
 
-        while(std::getline(ephem_file, line))
+        RinexLine ephem_lines[8];
+        while (next_line(ephem_file, ephem_lines[0]))
         {
-            if (line.at(0) == 'G' || line.at(0) == 'C' || line.at(0) == 'E')
+            const char sys_char = ephem_lines[0].at(0);
+            if (sys_char == 'G' || sys_char == 'C' || sys_char == 'E')
             {
-                std::vector<std::string> ephem_lines;
-                ephem_lines.push_back(line);
-                for (size_t i = 0; i < 7; ++i)
-                {
-                    std::getline(ephem_file, line);
-                    ephem_lines.push_back(line);
-                }
+                for (size_t i = 1; i < 8; ++i)
+                    LOG_IF(FATAL, !next_line(ephem_file, ephem_lines[i])) << "Incomplete ephemeris record";
                 EphemPtr ephem = rinex_line2ephem(ephem_lines);
                 if (!ephem || ephem->ttr.time == 0)  continue;
-                if (sat2ephem.count(ephem->sat) == 0)
-                    sat2ephem.emplace(ephem->sat, std::vector<EphemBasePtr>());
-                sat2ephem.at(ephem->sat).push_back(ephem);
+                ephem_callback(ephem);
+            }
+            else if (sys_char == 'R')
+            {
+                for (size_t i = 1; i < 4; ++i)
+                    LOG_IF(FATAL, !next_line(ephem_file, ephem_lines[i])) << "Incomplete ephemeris record";
+                ephem_callback(rinex_line2glo_ephem(ephem_lines, gpst_leap_seconds));
+            }
+        }
+    }
+
+    void rinex2ephems(const std::string &rinex_filepath, std::map<uint32_t, std::vector<EphemBasePtr>> &sat2ephem)
+    {
+        rinex2ephems(rinex_filepath, [&sat2ephem](const EphemBasePtr &ephem)
+        {
+            sat2ephem[ephem->sat].push_back(ephem);
+        });
+    }
+
+    // TODO: GLONASS slot number
+    RinexObsReader::RinexObsReader(const std::string &rinex_filepath) 
+        : file_(rinex_filepath), valid_(false)
+    {
+        if (!file_.valid())     return;
+
+        // parse header
+        uint8_t sys_char = 0;
+        RinexLine line;
+        while (next_line(file_, line))
+        {
+            if (line.contains("RINEX VERSION / TYPE") && !line.contains("3.04"))
+            {
+                LOG(ERROR) << "Only RINEX 3.04 is supported for observation file";
+                return;
             }
-            else if (line.at(0) == 'R')
+            else if (line.contains("SYS / # / OBS TYPES"))
             {
-                std::vector<std::string> ephem_lines;
-                ephem_lines.push_back(line);
-                for (size_t i = 0; i < 3; ++i)
+                if (line.at(0) != ' ')
+                {
+                    sys_char = line.at(0);
+                    sys_fields_[sys_char].clear();
+                }
+                for (size_t i = 0; i < 13; ++i)
                 {
-                    std::getline(ephem_file, line);
-                    ephem_lines.push_back(line);
+                    if (line.blank(7+4*i, 3))   continue;
+                    ObsField field;
+                    field.type = line.at(7+4*i);
+                    const std::string band = {static_cast<char>(sys_char), line.at(8+4*i)};
+                    field.freq = type2freq.count(band) ? type2freq.at(band) : -1.0;
+                    sys_fields_[sys_char].push_back(field);
                 }
-                GloEphemPtr glo_ephem = rinex_line2glo_ephem(ephem_lines, gpst_leap_seconds);
-                if (sat2ephem.count(glo_ephem->sat) == 0)
-                    sat2ephem.emplace(glo_ephem->sat, std::vector<EphemBasePtr>());
-                sat2ephem.at(glo_ephem->sat).push_back(glo_ephem);
+            }
+            else if (line.contains("END OF HEADER"))
+            {
+                valid_ = true;
+                break;
             }
         }
+        LOG_IF(ERROR, !valid_) << "No RINEX header found in " << rinex_filepath;
     }
 
-    static ObsPtr rinex_line2obs(const std::string rinex_str, 
-        const std::map<uint8_t, std::vector<std::string>> &sys2type)
+    ObsPtr RinexObsReader::parse_obs(const char *line_str, size_t line_len) const
     {
         ObsPtr obs;
-        uint8_t sys_char = rinex_str.at(0);
-        if (char2sys.count(sys_char) == 0)   return obs;
+        const RinexLine line = {line_str, line_len};
+        const uint8_t sys_char = line.at(0);
+        if (char2sys.count(sys_char) == 0 || sys_fields_[sys_char].empty())   return obs;
         obs.reset(new Obs());
         uint32_t sys = char2sys.at(sys_char);
-        uint32_t prn = static_cast<uint32_t>(std::stoi(rinex_str.substr(1, 2)));
+        uint32_t prn = static_cast<uint32_t>(line.integer(1, 2));
         obs->sat = sat_no(sys, prn);
-        std::map<double, uint32_t> freq2idx;
-        std::vector<std::string> date_types = sys2type.at(sys_char);
         uint32_t line_offset = 3;
-        for (auto type : date_types)
+        for (const ObsField &field : sys_fields_[sys_char])
         {
-            std::string field_str = rinex_str.substr(line_offset, 14);
+            const uint32_t field_offset = line_offset;
             line_offset += 14 + 2;
-            if (field_str.find_first_not_of(' ') == std::string::npos)  continue;
-            const double field_value = stod(field_str);
-            std::stringstream ss;
-            ss << sys_char << type.at(1);
-            const double freq = type2freq.at(ss.str());
-            uint32_t freq_idx = static_cast<uint32_t>(-1);
-            if (freq2idx.count(freq) == 0)
+            if (line.blank(field_offset, 14))  continue;
+            const double field_value = line.num(field_offset, 14);
+            LOG_IF(FATAL, field.freq < 0) << "Unrecognized frequency band of " << sys_char;
+
+            // frequencies of a satellite are few, a linear search is enough
+            uint32_t freq_idx = 0;
+            while (freq_idx < obs->freqs.size() && obs->freqs[freq_idx] != field.freq)
+                ++freq_idx;
+            if (freq_idx == obs->freqs.size())
             {
-                obs->freqs.push_back(freq);
-                freq_idx = obs->freqs.size()-1;
-                freq2idx.emplace(freq, freq_idx);
-            }
-            else
-            {
-                freq_idx = freq2idx.at(freq);
+                obs->freqs.push_back(field.freq);
+                obs->CN0.push_back(0);
+                obs->LLI.push_back(0);
+                obs->code.push_back(0);
+                obs->psr.push_back(0);
+                obs->psr_std.push_back(0);
+                obs->cp.push_back(0);
+                obs->cp_std.push_back(0);
+                obs->dopp.push_back(0);
+                obs->dopp_std.push_back(0);
+                obs->status.push_back(0x0F);
             }
             
-            if (type.at(0) == 'L')
+            if (field.type == 'L')
                 obs->cp[freq_idx] = field_value;
-            else if (type.at(0) == 'C')
+            else if (field.type == 'C')
                 obs->psr[freq_idx] = field_value;
-            else if (type.at(0) == 'D')
+            else if (field.type == 'D')
                 obs->dopp[freq_idx] = field_value;
-            else if (type.at(0) == 'S')
+            else if (field.type == 'S')
                 obs->CN0[freq_idx] = field_value;
             else
-                LOG(FATAL) << "Unrecognized measurement type " << type.at(0);
-        }
-        // fill in other fields
-        uint32_t num_freqs = obs->freqs.size();
-        LOG_IF(FATAL, num_freqs < obs->CN0.size()) << "Suspicious observation field.\n";
-        std::fill_n(std::back_inserter(obs->CN0), num_freqs-obs->CN0.size(), 0);
-        LOG_IF(FATAL, num_freqs < obs->LLI.size()) << "Suspicious observation field.\n";
-        std::fill_n(std::back_inserter(obs->LLI), num_freqs-obs->LLI.size(), 0);
-        LOG_IF(FATAL, num_freqs < obs->code.size()) << "Suspicious observation field.\n";
-        std::fill_n(std::back_inserter(obs->code), num_freqs-obs->code.size(), 0);
-        LOG_IF(FATAL, num_freqs < obs->psr.size()) << "Suspicious observation field.\n";
-        std::fill_n(std::back_inserter(obs->psr), num_freqs-obs->psr.size(), 0);
-        LOG_IF(FATAL, num_freqs < obs->psr_std.size()) << "Suspicious observation field.\n";
-        std::fill_n(std::back_inserter(obs->psr_std), num_freqs-obs->psr_std.size(), 0);
-        LOG_IF(FATAL, num_freqs < obs->cp.size()) << "Suspicious observation field.\n";
-        std::fill_n(std::back_inserter(obs->cp), num_freqs-obs->cp.size(), 0);
-        LOG_IF(FATAL, num_freqs < obs->cp_std.size()) << "Suspicious observation field.\n";
-        std::fill_n(std::back_inserter(obs->cp_std), num_freqs-obs->cp_std.size(), 0);
-        LOG_IF(FATAL, num_freqs < obs->dopp.size()) << "Suspicious observation field.\n";
-        std::fill_n(std::back_inserter(obs->dopp), num_freqs-obs->dopp.size(), 0);
-        LOG_IF(FATAL, num_freqs < obs->dopp_std.size()) << "Suspicious observation field.\n";
-        std::fill_n(std::back_inserter(obs->dopp_std), num_freqs-obs->dopp_std.size(), 0);
-        LOG_IF(FATAL, num_freqs < obs->status.size()) << "Suspicious observation field.\n";
-        std::fill_n(std::back_inserter(obs->status), num_freqs-obs->status.size(), 0x0F);
-
+                LOG(FATAL) << "Unrecognized measurement type " << field.type;
+        }
         return obs;
     }
 
-    // TODO: GLONASS slot number
-    void rinex2obs(const std::string &rinex_filepath, std::vector<std::vector<ObsPtr>> &rinex_meas)
+    bool RinexObsReader::parse_epoch(const char *&cursor, const char *end, std::vector<ObsPtr> &meas) const
     {
-        std::ifstream obs_file(rinex_filepath);
-        std::string rinex_line;
+        meas.clear();
+        RinexLine line;
+        do
+        {
+            if (!read_line(cursor, end, line.str, line.len))    return false;
+        } while (line.len == 0);
+
+        LOG_IF(FATAL, line.at(0) != '>') << "Invalid Observation record " << std::string(line.str, line.len);
+        LOG_IF(FATAL, line.at(31) != '0') << "Invalid Epoch data " << line.at(31)-48;
+        double epoch_time[6];
+        epoch_time[0] = line.num(2, 4);
+        epoch_time[1] = line.num(7, 2);
+        epoch_time[2] = line.num(10, 2);
+        epoch_time[3] = line.num(13, 2);
+        epoch_time[4] = line.num(16, 2);
+        epoch_time[5] = line.num(18, 11);
+        const gtime_t obs_time = epoch2time(epoch_time);
+        const int num_obs = line.integer(32, 3);
+        meas.reserve(num_obs);
+        for (int i = 0; i < num_obs; ++i)
+        {
+            LOG_IF(FATAL, !read_line(cursor, end, line.str, line.len)) << "Incomplete RINEX file";
+            ObsPtr obs = parse_obs(line.str, line.len);
+            if (!obs || obs->freqs.empty())  continue;
+            obs->time = obs_time;
+            meas.emplace_back(obs);
+        }
+        return true;
+    }
 
-        // parse header
-        std::map<uint8_t, std::vector<std::string>> sys2type;
-        uint8_t sys_char = 0;
-        while (std::getline(obs_file, rinex_line))
+    bool RinexObsReader::next(std::vector<ObsPtr> &meas)
+    {
+        meas.clear();
+        if (!valid_)    return false;
+        const char *cursor = file_.data() + file_.tell();
+        const bool has_epoch = parse_epoch(cursor, file_.data() + file_.size(), meas);
+        file_.seek(cursor - file_.data());
+        return has_epoch;
+    }
+
+    void RinexObsReader::read_all(std::vector<std::vector<ObsPtr>> &rinex_meas, uint32_t num_threads)
+    {
+        if (!valid_)    return;
+        if (num_threads == 0)
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        const char *begin = file_.data() + file_.tell();
+        const char *end = file_.data() + file_.size();
+        file_.seek(file_.size());
+
+        // chunk boundaries at the first epoch header ('>' at the line start) after each even split
+        std::vector<const char*> bounds(1, begin);
+        const size_t chunk_size = (end - begin) / num_threads + 1;
+        for (uint32_t k = 1; k < num_threads; ++k)
         {
-            if (rinex_line.find("RINEX VERSION / TYPE") != std::string::npos && rinex_line.find("3.04") == std::string::npos)
-            {
-                LOG(ERROR) << "Only RINEX 3.04 is supported for observation file";
-                return;
-            }
-            else if (rinex_line.find("SYS / # / OBS TYPES") != std::string::npos)
+            const char *p = std::max(begin + k * chunk_size, bounds.back());
+            while (p < end && !(*p == '>' && p[-1] == '\n'))
             {
-                if (rinex_line.at(0) != ' ')
-                {
-                    sys_char = rinex_line.at(0);
-                    sys2type.emplace(sys_char, std::vector<std::string>());
-                }
-                for (size_t i = 0; i < 13; ++i)
-                    if (rinex_line.substr(7+4*i, 3) != "   ")
-                        sys2type.at(sys_char).emplace_back(rinex_line.substr(7+4*i, 3));
+                p = static_cast<const char*>(memchr(p, '\n', end - p));
+                p = (p ? p + 1 : end);
             }
-            else if (rinex_line.find("END OF HEADER") != std::string::npos)  break;
-        }
-
-        while (std::getline(obs_file, rinex_line))
-        {
-            LOG_IF(FATAL, rinex_line.at(0) != '>') << "Invalid Observation record " << rinex_line;
-            LOG_IF(FATAL, rinex_line.at(31) != '0') << "Invalid Epoch data " << rinex_line.at(31)-48;
-            std::vector<double> epoch_time;
-            epoch_time.emplace_back(std::stod(rinex_line.substr(2, 4)));
-            epoch_time.emplace_back(std::stod(rinex_line.substr(7, 2)));
-            epoch_time.emplace_back(std::stod(rinex_line.substr(10, 2)));
-            epoch_time.emplace_back(std::stod(rinex_line.substr(13, 2)));
-            epoch_time.emplace_back(std::stod(rinex_line.substr(16, 2)));
-            epoch_time.emplace_back(std::stod(rinex_line.substr(18, 11)));
-            gtime_t obs_time = epoch2time(&(epoch_time[0]));
-            const int num_obs = std::stoi(rinex_line.substr(32, 3));
+            if (p >= end)   break;
+            if (p > bounds.back())  bounds.push_back(p);
+        }
+        bounds.push_back(end);
+
+        // the file is in time order, so concatenating the chunks in file order keeps it
+        const size_t num_chunks = bounds.size() - 1;
+        std::vector<std::vector<std::vector<ObsPtr>>> chunk_meas(num_chunks);
+        auto parse_chunk = [&](size_t k)
+        {
+            const char *cursor = bounds[k];
             std::vector<ObsPtr> meas;
-            for (int i = 0; i < num_obs; ++i)
-            {
-                LOG_IF(FATAL, !std::getline(obs_file, rinex_line)) << "Incomplete RINEX file";
-                ObsPtr obs = rinex_line2obs(rinex_line, sys2type);
-                if (!obs || obs->freqs.empty())  continue;
-                obs->time = obs_time;
-                meas.emplace_back(obs);
-            }
-            rinex_meas.emplace_back(meas);
+            while (parse_epoch(cursor, bounds[k+1], meas))
+                chunk_meas[k].push_back(meas);
+        };
+        std::vector<std::thread> workers;
+        for (size_t k = 1; k < num_chunks; ++k)
+            workers.emplace_back(parse_chunk, k);
+        parse_chunk(0);
+        for (auto &worker : workers)
+            worker.join();
+
+        size_t num_epochs = rinex_meas.size();
+        for (const auto &meas : chunk_meas)
+            num_epochs += meas.size();
+        rinex_meas.reserve(num_epochs);
+        for (auto &meas : chunk_meas)
+            std::move(meas.begin(), meas.end(), std::back_inserter(rinex_meas));
+    }
+
+    void rinex2obs(const std::string &rinex_filepath, 
+        const std::function<bool(const std::vector<ObsPtr>&)> &epoch_callback)
+    {
+        RinexObsReader reader(rinex_filepath);
+        std::vector<ObsPtr> meas;
+        while (reader.next(meas))
+        {
+            if (!epoch_callback(meas))  break;
         }
     }
 
+    void rinex2obs(const std::string &rinex_filepath, std::vector<std::vector<ObsPtr>> &rinex_meas, 
+        uint32_t num_threads)
+    {
+        RinexObsReader reader(rinex_filepath);
+        if (!reader.valid())    return;
+        struct stat file_stat;
+        if (stat(rinex_filepath.c_str(), &file_stat) == 0 && file_stat.st_size < (8 << 20))
+            num_threads = 1;        // thread start-up outweighs parsing small files
+        reader.read_all(rinex_meas, num_threads);
+    }
+
     void rinex2iono_params(const std::string &rinex_filepath, std::vector<double> &iono_params)
     {
         iono_params.resize(8);
-        std::ifstream file(rinex_filepath);
-        std::string line;
+        RinexFile file(rinex_filepath);
+        RinexLine line;
 
         // check first line, mainly RINEX version
-        if (!(std::getline(file, line) && line.find("RINEX VERSION")  != std::string::npos 
-                && line.find("3.04") != std::string::npos))
+        if (!(next_line(file, line) && line.contains("RINEX VERSION") && line.contains("3.04")))
         {
             LOG(ERROR) << "Only RINEX 3.04 is supported";
             return;
         }
 
         bool find_alpha = false, find_beta = false;
-        while(std::getline(file, line))
+        while (next_line(file, line))
         {
-            if (line.find("IONOSPHERIC CORR") != std::string::npos && line.find("GPSA") != std::string::npos)
+            if (line.contains("IONOSPHERIC CORR") && line.contains("GPSA"))
             {
-
                 // parse ion alpha value
                 for (size_t i = 0; i < 4; ++i)
-                {
-                    std::string value_str = line.substr(i*12+5, 12);
-                    iono_params[i] = str2double(value_str);
-                }
+                    iono_params[i] = line.num(i*12+5, 12);
                 find_alpha = true;
             }
-            else if (line.find("IONOSPHERIC CORR") != std::string::npos && line.find("GPSB") != std::string::npos)
+            else if (line.contains("IONOSPHERIC CORR") && line.contains("GPSB"))
             {
                 // parse ion beta value
                 for (size_t i = 0; i < 4; ++i)
-                {
-                    std::string value_str = line.substr(i*12+5, 12);
-                    iono_params[i+4] = str2double(value_str);
-                }
+                    iono_params[i+4] = line.num(i*12+5, 12);
                 find_beta = true;
             }
 
             if(find_alpha && find_beta)
                 break;
         }
-        file.close();
     }
 
     int obs_index(const uint32_t sys, const double freq)
@@ -503,11 +740,51 @@ namespace gnss_comm
         return sat2freqo;
     }
 
-    void obs2rinex(const std::string &rinex_filepath, 
-        const std::vector<std::vector<ObsPtr>> &gnss_meas)
+    /* printf-style append to the output buffer, no allocation once the buffer has grown */
+    static void append_format(std::string &buf, const char *format, ...)
+    {
+        char tmp[256];
+        va_list args;
+        va_start(args, format);
+        const int n = vsnprintf(tmp, sizeof(tmp), format, args);
+        va_end(args);
+        if (n > 0)   buf.append(tmp, std::min(static_cast<size_t>(n), sizeof(tmp)-1));
+    }
+
+    RinexObsWriter::RinexObsWriter(const std::string &rinex_filepath, size_t buffer_size) 
+        : fp_(fopen(rinex_filepath.c_str(), "w")), buffer_size_(buffer_size), header_written_(false), 
+          stop_(false), flushing_(false)
+    {
+        if (!fp_)
+        {
+            LOG(ERROR) << "Cannot open RINEX file " << rinex_filepath;
+            return;
+        }
+        active_.reserve(buffer_size_ + 4096);
+        pending_.reserve(buffer_size_ + 4096);
+        flush_thread_ = std::thread(&RinexObsWriter::flush_loop, this);
+    }
+
+    RinexObsWriter::~RinexObsWriter()
+    {
+        if (!fp_)   return;
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_all();
+        flush_thread_.join();
+        fclose(fp_);
+    }
+
+    void RinexObsWriter::write_header(const gtime_t *first_time, const gtime_t *last_time, 
+        const std::map<uint32_t, int> &glo_sat2freqo)
     {
-        FILE *fp = fopen(rinex_filepath.c_str(), "w");
-        fprintf(fp, "%9.2f%-11s%-20s%-20s%-20s\n", 3.04, "", "OBSERVATION DATA", 
+        if (!fp_ || header_written_)     return;
+        header_written_ = true;
+        std::string &buf = active_;
+        append_format(buf, "%9.2f%-11s%-20s%-20s%-20s\n", 3.04, "", "OBSERVATION DATA", 
             "M: Mixed", "RINEX VERSION / TYPE");
         std::time_t time_ptr;
         time_ptr = time(NULL);
@@ -515,115 +792,176 @@ namespace gnss_comm
         char date_str[256];
         sprintf(date_str, "%4d%02d%02d %02d%02d%02d UTC", tm_utc->tm_year+1900, tm_utc->tm_mon+1, 
             tm_utc->tm_mday, tm_utc->tm_hour, tm_utc->tm_min, tm_utc->tm_sec);
-        fprintf(fp, "%-20.20s%-20.20s%-20.20s%-20s\n","gnss_comm obs2rinex", "", date_str,
+        append_format(buf, "%-20.20s%-20.20s%-20.20s%-20s\n","gnss_comm obs2rinex", "", date_str,
             "PGM / RUN BY / DATE");
-        fprintf(fp, "%-60.60s%-20s\n", "", "MARKER NAME");
-        fprintf(fp, "%-20.20s%-40.40s%-20s\n", "", "", "MARKER NUMBER");
-        fprintf(fp, "%-20.20s%-40.40s%-20s\n", "", "", "MARKER TYPE");
-        fprintf(fp, "%-20.20s%-40.40s%-20s\n", "", "", "OBSERVER / AGENCY");
-        fprintf(fp, "%-20.20s%-20.20s%-20.20s%-20s\n", "", "", "", "REC # / TYPE / VERS");
-        fprintf(fp, "%-20.20s%-20.20s%-20.20s%-20s\n", "", "", "", "ANT # / TYPE");
+        append_format(buf, "%-60.60s%-20s\n", "", "MARKER NAME");
+        append_format(buf, "%-20.20s%-40.40s%-20s\n", "", "", "MARKER NUMBER");
+        append_format(buf, "%-20.20s%-40.40s%-20s\n", "", "", "MARKER TYPE");
+        append_format(buf, "%-20.20s%-40.40s%-20s\n", "", "", "OBSERVER / AGENCY");
+        append_format(buf, "%-20.20s%-20.20s%-20.20s%-20s\n", "", "", "", "REC # / TYPE / VERS");
+        append_format(buf, "%-20.20s%-20.20s%-20.20s%-20s\n", "", "", "", "ANT # / TYPE");
         // ignore approximate position
-        fprintf(fp, "%-14.14s%-14.14s%-14.14s%-18s%-20s\n", "", "", "", "", "APPROX POSITION XYZ");
-        fprintf(fp, "%-14.14s%-14.14s%-14.14s%-18s%-20s\n", "", "", "", "", "ANTENNA: DELTA H/E/N");
+        append_format(buf, "%-14.14s%-14.14s%-14.14s%-18s%-20s\n", "", "", "", "", "APPROX POSITION XYZ");
+        append_format(buf, "%-14.14s%-14.14s%-14.14s%-18s%-20s\n", "", "", "", "", "ANTENNA: DELTA H/E/N");
 
         // observation type, hard code here
         // only support dual-frequency record without the knowledge of signal type
-        fprintf(fp, "%c  %3d %3s %3s %3s %3s %3s %3s %3s %3s%20s  %-20s\n", 'G', 8, "C1C", "L1C", 
+        append_format(buf, "%c  %3d %3s %3s %3s %3s %3s %3s %3s %3s%20s  %-20s\n", 'G', 8, "C1C", "L1C", 
             "D1C", "S1C", "C2S", "L2S", "D2S", "S2S", "", "SYS / # / OBS TYPES ");
-        fprintf(fp, "%c  %3d %3s %3s %3s %3s %3s %3s %3s %3s%20s  %-20s\n", 'R', 8, "C1C", "L1C", 
+        append_format(buf, "%c  %3d %3s %3s %3s %3s %3s %3s %3s %3s%20s  %-20s\n", 'R', 8, "C1C", "L1C", 
             "D1C", "S1C", "C2C", "L2C", "D2C", "S2C", "", "SYS / # / OBS TYPES ");
-        fprintf(fp, "%c  %3d %3s %3s %3s %3s %3s %3s %3s %3s%20s  %-20s\n", 'E', 8, "C1C", "L1C", 
+        append_format(buf, "%c  %3d %3s %3s %3s %3s %3s %3s %3s %3s%20s  %-20s\n", 'E', 8, "C1C", "L1C", 
             "D1C", "S1C", "C7Q", "L7Q", "D7Q", "S7Q", "", "SYS / # / OBS TYPES ");
-        fprintf(fp, "%c  %3d %3s %3s %3s %3s %3s %3s %3s %3s%20s  %-20s\n", 'C', 8, "C2I", "L2I", 
+        append_format(buf, "%c  %3d %3s %3s %3s %3s %3s %3s %3s %3s%20s  %-20s\n", 'C', 8, "C2I", "L2I", 
             "D2I", "S2I", "C7I", "L7I", "D7I", "S7I", "", "SYS / # / OBS TYPES ");
         
-        if (!gnss_meas.empty())
-        {
-            int front_idx = -1;
-            while(gnss_meas[++front_idx].empty());
-            const gtime_t start_time = gnss_meas[front_idx].front()->time;
-            double ep[6];
-            time2epoch(start_time, ep);
-            fprintf(fp, "  %04.0f%6.0f%6.0f%6.0f%6.0f%13.7f     %-12s%-20s\n", ep[0], 
+        double ep[6];
+        if (first_time)
+        {
+            time2epoch(*first_time, ep);
+            append_format(buf, "  %04.0f%6.0f%6.0f%6.0f%6.0f%13.7f     %-12s%-20s\n", ep[0], 
                 ep[1], ep[2], ep[3], ep[4], ep[5], "GPS", "TIME OF FIRST OBS");
-            int back_idx = static_cast<int>(gnss_meas.size());
-            while(gnss_meas[--back_idx].empty());
-            const gtime_t end_time = gnss_meas[back_idx].front()->time;
-            time2epoch(end_time, ep);
-            fprintf(fp, "  %04.0f%6.0f%6.0f%6.0f%6.0f%13.7f     %-12s%-20s\n", ep[0], 
+        }
+        if (last_time)
+        {
+            time2epoch(*last_time, ep);
+            append_format(buf, "  %04.0f%6.0f%6.0f%6.0f%6.0f%13.7f     %-12s%-20s\n", ep[0], 
                 ep[1], ep[2], ep[3], ep[4], ep[5], "GPS", "TIME OF LAST OBS");
         }
-        fprintf(fp,"%c %-58s%-20s\n",'G',"","SYS / PHASE SHIFT");
-        fprintf(fp,"%c %-58s%-20s\n",'R',"","SYS / PHASE SHIFT");
-        fprintf(fp,"%c %-58s%-20s\n",'E',"","SYS / PHASE SHIFT");
-        fprintf(fp,"%c %-58s%-20s\n",'C',"","SYS / PHASE SHIFT");
+        append_format(buf,"%c %-58s%-20s\n",'G',"","SYS / PHASE SHIFT");
+        append_format(buf,"%c %-58s%-20s\n",'R',"","SYS / PHASE SHIFT");
+        append_format(buf,"%c %-58s%-20s\n",'E',"","SYS / PHASE SHIFT");
+        append_format(buf,"%c %-58s%-20s\n",'C',"","SYS / PHASE SHIFT");
 
         // add GLONASS SLOT / FRQ #
-        std::map<uint32_t, int> glo_sat2freqo = get_glo_freqo(gnss_meas);
         auto glo_sat2freqo_it = glo_sat2freqo.begin();
         const int num_glo_sats = static_cast<int>(glo_sat2freqo.size());
         for (int i = 0; i < (num_glo_sats<=0?1:(num_glo_sats-1)/8+1); ++i)
         {
             if (i == 0)
-                fprintf(fp, "%3d", num_glo_sats);
+                append_format(buf, "%3d", num_glo_sats);
             else
-                fprintf(fp, "%3s", "");
+                append_format(buf, "%3s", "");
             for (int j = 0; j < 8; ++j)
             {
                 if (i*8+j < num_glo_sats)
                 {
-                    fprintf(fp, " %3s %2d", sat2str(glo_sat2freqo_it->first).c_str(), glo_sat2freqo_it->second);
+                    append_format(buf, " %3s %2d", sat2str(glo_sat2freqo_it->first).c_str(), glo_sat2freqo_it->second);
                     ++ glo_sat2freqo_it;
                 }
                 else
                 {
-                    fprintf(fp, " %6s", "");
+                    append_format(buf, " %6s", "");
                 }
             }
-            fprintf(fp, " %-20s\n", "GLONASS SLOT / FRQ #");
+            append_format(buf, " %-20s\n", "GLONASS SLOT / FRQ #");
         }
-        fprintf(fp," C1C    0.000 C1P    0.000 C2C    0.000 C2P    0.000        GLONASS COD/PHS/BIS \n");
-        fprintf(fp,"%-60.60s%-20s\n","","END OF HEADER");
+        append_format(buf," C1C    0.000 C1P    0.000 C2C    0.000 C2P    0.000        GLONASS COD/PHS/BIS \n");
+        append_format(buf,"%-60.60s%-20s\n","","END OF HEADER");
+    }
 
-        // write data
-        for (auto &meas : gnss_meas)
+    void RinexObsWriter::write(const std::vector<ObsPtr> &meas)
+    {
+        if (!fp_ || meas.empty())   return;
+        if (!header_written_)
         {
-            if (meas.empty())         continue;
-            double ep[6];
-            time2epoch(meas[0]->time, ep);
-            fprintf(fp, "> %04.0f %2.0f %2.0f %2.0f %2.0f%11.7f  %d%3d%21s\n", 
-                ep[0], ep[1], ep[2], ep[3], ep[4], ep[5], 0, static_cast<int>(meas.size()), "");
-            
-            std::vector<ObsPtr> sorted_meas(meas);
-            std::sort(sorted_meas.begin(), sorted_meas.end(), [](ObsPtr o1, ObsPtr o2) {
-                return o1->sat < o2->sat;
-            });
-            
-            for (auto &obs : sorted_meas)
+            // streaming: the first epoch decides the header, GLONASS slots seen later are not listed
+            const std::map<uint32_t, int> glo_sat2freqo = get_glo_freqo({meas});
+            write_header(&(meas[0]->time), nullptr, glo_sat2freqo);
+        }
+
+        std::string &buf = active_;
+        double ep[6];
+        time2epoch(meas[0]->time, ep);
+        append_format(buf, "> %04.0f %2.0f %2.0f %2.0f %2.0f%11.7f  %d%3d%21s\n", 
+            ep[0], ep[1], ep[2], ep[3], ep[4], ep[5], 0, static_cast<int>(meas.size()), "");
+        
+        sorted_meas_.assign(meas.begin(), meas.end());
+        std::sort(sorted_meas_.begin(), sorted_meas_.end(), [](const ObsPtr &o1, const ObsPtr &o2) {
+            return o1->sat < o2->sat;
+        });
+        
+        for (auto &obs : sorted_meas_)
+        {
+            append_format(buf, "%3s", sat2str(obs->sat).c_str());
+            for (int k = 0; k < 2; ++k)
             {
-                std::string sat_str = sat2str(obs->sat);
-                fprintf(fp, "%3s", sat_str.c_str());
-                for (int k = 0; k < 2; ++k)
+                int freq_idx = -1;
+                const double freq = index_freq(obs, k, freq_idx);
+                if (freq < 0)
                 {
-                    int freq_idx = -1;
-                    const double freq = index_freq(obs, k, freq_idx);
-                    if (freq < 0)
-                    {
-                        fprintf(fp, "%16s%16s%16s%16s", "", "", "", "");
-                    }
-                    else 
-                    {
-                        fprintf(fp, "%14.3f%2s", obs->psr[freq_idx], "");
-                        fprintf(fp, "%14.3f%2s", obs->cp[freq_idx], "");
-                        fprintf(fp, "%14.3f%2s", obs->dopp[freq_idx], "");
-                        fprintf(fp, "%14.3f%2s", obs->CN0[freq_idx], "");
-                    }
+                    append_format(buf, "%16s%16s%16s%16s", "", "", "", "");
+                }
+                else 
+                {
+                    append_format(buf, "%14.3f%2s%14.3f%2s%14.3f%2s%14.3f%2s", obs->psr[freq_idx], "", 
+                        obs->cp[freq_idx], "", obs->dopp[freq_idx], "", obs->CN0[freq_idx], "");
                 }
-                fprintf(fp, "\n");
             }
+            buf.push_back('\n');
+        }
+        sorted_meas_.clear();
+
+        if (active_.size() >= buffer_size_)
+            hand_over(false);
+    }
+
+    void RinexObsWriter::flush()
+    {
+        if (!fp_)   return;
+        hand_over(true);
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this] { return !flushing_; });
+        fflush(fp_);
+    }
+
+    void RinexObsWriter::hand_over(bool wait)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (flushing_)
+        {
+            // the disk is behind, keep appending to the active buffer instead of stalling the caller
+            if (!wait)  return;
+            cond_.wait(lock, [this] { return !flushing_; });
         }
+        if (active_.empty())    return;
+        active_.swap(pending_);
+        flushing_ = true;
+        cond_.notify_all();
+    }
+
+    void RinexObsWriter::flush_loop()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true)
+        {
+            cond_.wait(lock, [this] { return flushing_ || stop_; });
+            if (!flushing_ && stop_)    break;
+            lock.unlock();
+            fwrite(pending_.data(), 1, pending_.size(), fp_);
+            pending_.clear();
+            lock.lock();
+            flushing_ = false;
+            cond_.notify_all();
+        }
+    }
 
-        fclose(fp);
+    void obs2rinex(const std::string &rinex_filepath, 
+        const std::vector<std::vector<ObsPtr>> &gnss_meas)
+    {
+        RinexObsWriter writer(rinex_filepath);
+        const std::map<uint32_t, int> glo_sat2freqo = get_glo_freqo(gnss_meas);
+        int front_idx = -1, back_idx = static_cast<int>(gnss_meas.size());
+        while (++front_idx < back_idx && gnss_meas[front_idx].empty());
+        while (--back_idx > front_idx && gnss_meas[back_idx].empty());
+        if (front_idx < static_cast<int>(gnss_meas.size()))
+            writer.write_header(&(gnss_meas[front_idx].front()->time), 
+                &(gnss_meas[back_idx].front()->time), glo_sat2freqo);
+        else
+            writer.write_header(nullptr, nullptr, glo_sat2freqo);
+
+        // write data
+        for (auto &meas : gnss_meas)
+            writer.write(meas);
     }
 }   // namespace gnss_comm